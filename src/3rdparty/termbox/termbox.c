@@ -369,6 +369,51 @@ static void write_sgr(uint16_t fg, uint16_t bg) {
   }
 }
 
+void tb_scroll(int top, int bottom, int lines)
+{
+  char buf[32];
+  int y, i, count;
+
+  if (top < 0 || bottom >= front_buffer.height || top >= bottom || lines == 0)
+    return;
+
+  count = lines > 0 ? lines : -lines;
+  if (count > bottom - top)
+    return;
+
+  WRITE_LITERAL("\033[");
+  WRITE_INT(top+1);
+  WRITE_LITERAL(";");
+  WRITE_INT(bottom+1);
+  WRITE_LITERAL("r");
+
+  /* index at the bottom margin scrolls up, reverse index at the top down */
+  write_cursor(0, lines > 0 ? bottom : top);
+  for (i = 0; i < count; ++i) {
+    if (lines > 0)
+      WRITE_LITERAL("\033D");
+    else
+      WRITE_LITERAL("\033M");
+  }
+
+  WRITE_LITERAL("\033[r");
+  lastx = LAST_COORD_INIT;
+  lasty = LAST_COORD_INIT;
+
+  /* the front buffer follows, rows that scrolled in match no cell */
+  if (lines > 0) {
+    memmove(&CELL(&front_buffer, 0, top), &CELL(&front_buffer, 0, top + count),
+            sizeof(struct tb_cell) * front_buffer.width * (bottom - top + 1 - count));
+    for (y = bottom + 1 - count; y <= bottom; ++y)
+      memset(&CELL(&front_buffer, 0, y), 0xFF, sizeof(struct tb_cell) * front_buffer.width);
+  } else {
+    memmove(&CELL(&front_buffer, 0, top + count), &CELL(&front_buffer, 0, top),
+            sizeof(struct tb_cell) * front_buffer.width * (bottom - top + 1 - count));
+    for (y = top; y < top + count; ++y)
+      memset(&CELL(&front_buffer, 0, y), 0xFF, sizeof(struct tb_cell) * front_buffer.width);
+  }
+}
+
 static void cellbuf_init(struct cellbuf *buf, int width, int height)
 {
   buf->cells = (struct tb_cell*)malloc(sizeof(struct tb_cell) * width * height);
@@ -513,12 +558,20 @@ static void send_attr(uint16_t fg, uint16_t bg)
 static void send_char(int x, int y, uint32_t c)
 {
   char buf[7];
-  int bw = tb_utf8_unicode_to_char(buf, c);
+  int bw;
+  if (!c) {
+    /* the column after a wide character, which the terminal has moved past */
+    if (x-1 == lastx && y == lasty)
+      lastx = x;
+    else
+      lastx = LAST_COORD_INIT;
+    return;
+  }
+  bw = tb_utf8_unicode_to_char(buf, c);
   buf[bw] = '\0';
   if (x-1 != lastx || y != lasty)
     write_cursor(x, y);
   lastx = x; lasty = y;
-  if(!c) buf[0] = ' '; // replace 0 with whitespace
   bytebuffer_puts(&output_buffer, buf);
 }
 
@@ -182,6 +182,13 @@ SO_IMPORT void tb_set_clear_attributes(uint16_t fg, uint16_t bg);
 /* Syncronizes the internal back buffer with the terminal. */
 SO_IMPORT void tb_present(void);
 
+/* Scrolls the rows 'top' to 'bottom' of the terminal by 'lines', up if it is
+ * positive and down if it is negative, using a scroll region. The rows that
+ * scroll in are drawn by the next tb_present(). Only for terminals that know
+ * DECSTBM, index and reverse index.
+ */
+SO_IMPORT void tb_scroll(int top, int bottom, int lines);
+
 #define TB_HIDE_CURSOR -1
 
 /* Sets the position of the cursor. Upper-left character is (0, 0). If you pass
@@ -191,7 +198,8 @@ SO_IMPORT void tb_present(void);
 SO_IMPORT void tb_set_cursor(int cx, int cy);
 
 /* Changes cell's parameters in the internal back buffer at the specified
- * position.
+ * position. A cell with ch 0 is the second column of the wide character
+ * before it and sends nothing.
  */
 SO_IMPORT void tb_put_cell(int x, int y, const struct tb_cell *cell);
 SO_IMPORT void tb_change_cell(int x, int y, uint32_t ch, uint16_t fg, uint16_t bg);
@@ -0,0 +1,73 @@
+
+#include "Arena.h"
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+Arena::Arena(Arena && other)
+  : chunks_(std::move(other.chunks_)),
+    next_(other.next_),
+    end_(other.end_),
+    bytes_(other.bytes_)
+{
+  other.clear();
+}
+
+Arena & Arena::operator = (Arena && other)
+{
+  if (this != &other)
+  {
+    chunks_ = std::move(other.chunks_);
+    next_ = other.next_;
+    end_ = other.end_;
+    bytes_ = other.bytes_;
+
+    other.clear();
+  }
+
+  return *this;
+}
+
+void * Arena::allocate(std::size_t size, std::size_t align)
+{
+  char * start = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(next_) + align - 1) & ~(uintptr_t)(align - 1));
+  if (next_ && start + size <= end_)
+  {
+    next_ = start + size;
+    return start;
+  }
+
+  // Chunks come from new[], so they are aligned for anything
+  if (size > CHUNK_SIZE / 4)
+  {
+    chunks_.emplace_back(new char[size]);
+    bytes_ += size;
+    return chunks_.back().get();
+  }
+
+  chunks_.emplace_back(new char[CHUNK_SIZE]);
+  bytes_ += CHUNK_SIZE;
+
+  start = chunks_.back().get();
+  next_ = start + size;
+  end_ = start + CHUNK_SIZE;
+  return start;
+}
+
+char * Arena::copy(const char * data, std::size_t size)
+{
+  char * copy = static_cast<char *>(allocate(size));
+  if (size > 0)
+    memcpy(copy, data, size);
+
+  return copy;
+}
+
+void Arena::clear()
+{
+  chunks_.clear();
+  next_ = nullptr;
+  end_ = nullptr;
+  bytes_ = 0;
+}
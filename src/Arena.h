@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+// Bump allocator for data that is added piece by piece and freed all at once, like the
+// text of a document. Allocations are carved out of chunks of CHUNK_SIZE bytes, larger
+// ones get a chunk of their own. Nothing is freed until the arena is cleared or
+// destroyed, which frees one block per chunk. No destructors are run, so only data that
+// owns nothing else belongs in an arena.
+class Arena
+{
+  public:
+    static const std::size_t CHUNK_SIZE = 64 * 1024;
+
+  public:
+    Arena() { }
+    Arena(Arena && other);
+
+    Arena(Arena const&) = delete;
+    Arena & operator = (Arena const&) = delete;
+
+    Arena & operator = (Arena && other);
+
+    // size bytes aligned to align, which has to be a power of two of at most alignof(double)
+    void * allocate(std::size_t size, std::size_t align = 1);
+
+    // A copy of the size bytes at data
+    char * copy(const char * data, std::size_t size);
+
+    void clear();
+
+    // Bytes of the chunks
+    std::size_t memoryUsage() const { return bytes_ + chunks_.capacity() * sizeof(chunks_[0]); }
+
+  private:
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    char * next_ = nullptr;
+    char * end_ = nullptr;
+    std::size_t bytes_ = 0;
+};
@@ -0,0 +1,760 @@
+#include "ArrowTable.h"
+#include "Memory.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+static const char MAGIC[] = "ARROW1";
+static const std::size_t MAGIC_SIZE = 6;
+
+// The magic and its padding at the start, the footer size and the magic at the end
+static const std::size_t MIN_FILE_SIZE = 8 + 4 + MAGIC_SIZE;
+
+// Marks the metadata size of a message since version 0.15
+static const uint32_t CONTINUATION = 0xFFFFFFFF;
+
+// Sizes of the structs in the flatbuffers
+static const std::size_t BLOCK_SIZE = 24;
+static const std::size_t FIELD_NODE_SIZE = 16;
+static const std::size_t BUFFER_SIZE = 16;
+
+// Members of the MessageHeader and Type unions of the Arrow schema
+enum MessageType
+{
+  MESSAGE_SCHEMA = 1,
+  MESSAGE_DICTIONARY_BATCH = 2,
+  MESSAGE_RECORD_BATCH = 3,
+};
+
+enum ArrowType
+{
+  TYPE_NULL = 1,
+  TYPE_INT = 2,
+  TYPE_FLOATING_POINT = 3,
+  TYPE_BINARY = 4,
+  TYPE_UTF8 = 5,
+  TYPE_BOOL = 6,
+  TYPE_DATE = 8,
+  TYPE_TIMESTAMP = 10,
+  TYPE_LIST = 12,
+  TYPE_STRUCT = 13,
+  TYPE_UNION = 14,
+  TYPE_FIXED_SIZE_LIST = 16,
+  TYPE_MAP = 17,
+  TYPE_LARGE_BINARY = 19,
+  TYPE_LARGE_UTF8 = 20,
+  TYPE_LARGE_LIST = 21,
+  TYPE_RUN_END_ENCODED = 22,
+  TYPE_BINARY_VIEW = 23,
+  TYPE_UTF8_VIEW = 24,
+  TYPE_LIST_VIEW = 25,
+  TYPE_LARGE_LIST_VIEW = 26,
+};
+
+template <typename T>
+static T load(const uint8_t * data)
+{
+  T value;
+  memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+static bool fits(std::size_t size, std::size_t pos, std::size_t bytes)
+{
+  return pos <= size && bytes <= size - pos;
+}
+
+// A table of the flatbuffers Arrow keeps its metadata in. Everything read through it is
+// checked to lie within the buffer, a field that doesn't reads as absent.
+struct ArrowTable::FlatTable
+{
+  const uint8_t * data_ = nullptr;
+  std::size_t size_ = 0;
+  std::size_t table_ = 0;
+  std::size_t vtable_ = 0;
+  uint16_t vtableSize_ = 0;
+
+  static FlatTable at(const uint8_t * data, std::size_t size, std::size_t pos)
+  {
+    FlatTable table;
+    if (!fits(size, pos, 4))
+      return table;
+
+    const int64_t vtable = (int64_t)pos - load<int32_t>(data + pos);
+    if (vtable < 0 || !fits(size, (std::size_t)vtable, 4))
+      return table;
+
+    const uint16_t vtableSize = load<uint16_t>(data + vtable);
+    if (vtableSize < 4 || !fits(size, (std::size_t)vtable, vtableSize))
+      return table;
+
+    table.data_ = data;
+    table.size_ = size;
+    table.table_ = pos;
+    table.vtable_ = (std::size_t)vtable;
+    table.vtableSize_ = vtableSize;
+    return table;
+  }
+
+  static FlatTable root(const uint8_t * data, std::size_t size)
+  {
+    return fits(size, 0, 4) ? at(data, size, load<uint32_t>(data)) : FlatTable();
+  }
+
+  bool valid() const { return data_ != nullptr; }
+
+  // Position of field id in the buffer, 0 if it is absent
+  std::size_t field(int id) const
+  {
+    const std::size_t entry = 4 + 2 * id;
+    if (!data_ || entry + 2 > vtableSize_)
+      return 0;
+
+    const uint16_t offset = load<uint16_t>(data_ + vtable_ + entry);
+    return offset ? table_ + offset : 0;
+  }
+
+  template <typename T>
+  T scalar(int id, T value = T()) const
+  {
+    const std::size_t pos = field(id);
+    return pos && fits(size_, pos, sizeof(T)) ? load<T>(data_ + pos) : value;
+  }
+
+  // Position of what the offset in field id points to, 0 if it is absent
+  std::size_t target(int id) const
+  {
+    const std::size_t pos = field(id);
+    if (!pos || !fits(size_, pos, 4))
+      return 0;
+
+    const std::size_t target = pos + load<uint32_t>(data_ + pos);
+    return fits(size_, target, 4) ? target : 0;
+  }
+
+  FlatTable table(int id) const
+  {
+    const std::size_t pos = target(id);
+    return pos ? at(data_, size_, pos) : FlatTable();
+  }
+
+  // Position of the first element of vector field id, whose elements take size bytes,
+  // 0 when it is absent or doesn't fit
+  std::size_t vector(int id, std::size_t size, std::size_t & count) const
+  {
+    count = 0;
+
+    const std::size_t pos = target(id);
+    if (!pos)
+      return 0;
+
+    const uint32_t elements = load<uint32_t>(data_ + pos);
+    if (size > 0 && elements > (size_ - pos - 4) / size)
+      return 0;
+
+    count = elements;
+    return pos + 4;
+  }
+
+  // Table i of a vector of tables starting at first
+  FlatTable element(std::size_t first, std::size_t i) const
+  {
+    const std::size_t pos = first + 4 * i;
+    return at(data_, size_, pos + load<uint32_t>(data_ + pos));
+  }
+
+  StrView string(int id) const
+  {
+    std::size_t count;
+    const std::size_t first = vector(id, 1, count);
+    return first ? StrView((const char *)data_ + first, count) : StrView();
+  }
+};
+
+struct ArrowTable::Message
+{
+  uint8_t type_ = 0;
+  FlatTable header_;
+  const uint8_t * body_ = nullptr;
+  std::size_t bodySize_ = 0;
+};
+
+bool ArrowTable::readField(FlatTable const& field, Layout & layout, int & nodes, int & buffers)
+{
+  enum { NAME, NULLABLE, TYPE_TYPE, TYPE, DICTIONARY, CHILDREN };
+
+  const FlatTable type = field.table(TYPE);
+  int count = 2;
+
+  switch (field.scalar<uint8_t>(TYPE_TYPE))
+  {
+    case TYPE_NULL:
+      layout.type_ = Type::Null;
+      count = 0;
+      break;
+
+    case TYPE_INT:
+      layout.bits_ = type.scalar<int32_t>(0);
+      layout.signed_ = type.scalar<uint8_t>(1) != 0;
+      if (layout.bits_ == 8 || layout.bits_ == 16 || layout.bits_ == 32 || layout.bits_ == 64)
+        layout.type_ = Type::Int;
+      break;
+
+    case TYPE_FLOATING_POINT:
+    {
+      // Half precision isn't supported
+      const int16_t precision = type.scalar<int16_t>(0);
+      if (precision == 1 || precision == 2)
+      {
+        layout.type_ = Type::Float;
+        layout.bits_ = precision == 1 ? 32 : 64;
+      }
+      break;
+    }
+
+    case TYPE_BINARY:
+    case TYPE_UTF8:
+      layout.type_ = Type::Text;
+      count = 3;
+      break;
+
+    case TYPE_LARGE_BINARY:
+    case TYPE_LARGE_UTF8:
+      layout.type_ = Type::LargeText;
+      count = 3;
+      break;
+
+    case TYPE_BOOL:
+      layout.type_ = Type::Bool;
+      break;
+
+    case TYPE_DATE:
+      layout.type_ = Type::Date;
+      layout.unit_ = type.scalar<int16_t>(0, 1);
+      break;
+
+    case TYPE_TIMESTAMP:
+      layout.type_ = Type::Timestamp;
+      layout.unit_ = type.scalar<int16_t>(0);
+      break;
+
+    case TYPE_STRUCT:
+    case TYPE_FIXED_SIZE_LIST:
+      count = 1;
+      break;
+
+    case TYPE_UNION:
+      // Dense unions have offsets besides the type ids
+      count = type.scalar<int16_t>(0) == 1 ? 2 : 1;
+      break;
+
+    case TYPE_RUN_END_ENCODED:
+      count = 0;
+      break;
+
+    case TYPE_LIST_VIEW:
+    case TYPE_LARGE_LIST_VIEW:
+      count = 3;
+      break;
+
+    case TYPE_BINARY_VIEW:
+    case TYPE_UTF8_VIEW:
+      return false;
+
+    default:
+      // The lists and maps have validity and offsets, the other primitive types validity
+      // and values
+      break;
+  }
+
+  nodes = 1;
+  buffers = count;
+
+  std::size_t children;
+  const std::size_t first = field.vector(CHILDREN, 4, children);
+  for (std::size_t i = 0; i < children; ++i)
+  {
+    Layout child;
+    int childNodes = 0;
+    int childBuffers = 0;
+
+    if (!readField(field.element(first, i), child, childNodes, childBuffers))
+      return false;
+
+    nodes += childNodes;
+    buffers += childBuffers;
+  }
+
+  return true;
+}
+
+bool ArrowTable::isArrow(StrView data)
+{
+  return data.size() >= MAGIC_SIZE && memcmp(data.data(), MAGIC, MAGIC_SIZE) == 0;
+}
+
+bool ArrowTable::readMessage(const uint8_t * block, Message & message, std::string & error) const
+{
+  const StrView file = file_.data();
+  const uint8_t * data = (const uint8_t *)file.data();
+
+  const int64_t offset = load<int64_t>(block);
+  const int32_t metadataSize = load<int32_t>(block + 8);
+  const int64_t bodySize = load<int64_t>(block + 16);
+
+  if (offset < 0 || metadataSize < 8 || bodySize < 0 || !fits(file.size(), (std::size_t)offset, (std::size_t)metadataSize) ||
+      !fits(file.size(), (std::size_t)offset + metadataSize, (std::size_t)bodySize))
+  {
+    error = "a block lies outside of the file";
+    return false;
+  }
+
+  // Before 0.15 the size came without the continuation marker
+  const uint8_t * metadata = data + offset;
+  std::size_t prefix = 4;
+  if (load<uint32_t>(metadata) == CONTINUATION)
+    prefix = 8;
+
+  const int32_t size = load<int32_t>(metadata + prefix - 4);
+  if (size < 0 || (std::size_t)size > (std::size_t)metadataSize - prefix)
+  {
+    error = "the metadata of a message doesn't fit its block";
+    return false;
+  }
+
+  enum { VERSION, HEADER_TYPE, HEADER };
+
+  const FlatTable root = FlatTable::root(metadata + prefix, size);
+  message.type_ = root.scalar<uint8_t>(HEADER_TYPE);
+  message.header_ = root.table(HEADER);
+  message.body_ = data + offset + metadataSize;
+  message.bodySize_ = bodySize;
+
+  if (!message.header_.valid())
+  {
+    error = "a message has no header";
+    return false;
+  }
+
+  return true;
+}
+
+bool ArrowTable::readArrays(Message const& message, std::vector<Column> const& columns, std::vector<Array> & arrays, int64_t & length, std::string & error)
+{
+  enum { LENGTH, NODES, BUFFERS, COMPRESSION };
+
+  FlatTable const& batch = message.header_;
+  if (batch.field(COMPRESSION))
+  {
+    error = "compressed record batches aren't supported";
+    return false;
+  }
+
+  length = batch.scalar<int64_t>(LENGTH);
+
+  int nodes = 0;
+  int buffers = 0;
+  for (auto const& column : columns)
+  {
+    nodes += column.nodes_;
+    buffers += column.buffers_;
+  }
+
+  std::size_t nodeCount;
+  std::size_t bufferCount;
+  const std::size_t firstNode = batch.vector(NODES, FIELD_NODE_SIZE, nodeCount);
+  const std::size_t firstBuffer = batch.vector(BUFFERS, BUFFER_SIZE, bufferCount);
+
+  if (length < 0 || nodeCount < (std::size_t)nodes || bufferCount < (std::size_t)buffers)
+  {
+    error = "a record batch doesn't match the schema";
+    return false;
+  }
+
+  const uint8_t * data = batch.data_;
+  int node = 0;
+  int buffer = 0;
+
+  arrays.assign(columns.size(), Array());
+  for (std::size_t i = 0; i < columns.size(); ++i)
+  {
+    Column const& column = columns[i];
+    const int firstBufferOfColumn = buffer;
+
+    const uint8_t * fieldNode = data + firstNode + node * FIELD_NODE_SIZE;
+    node += column.nodes_;
+    buffer += column.buffers_;
+
+    const Layout& layout = column.layout_;
+    if (layout.type_ == Type::Unsupported || layout.type_ == Type::Null)
+      continue;
+
+    // The buffers of the column, each an offset into the body and a size
+    const uint8_t * views[3] = { nullptr, nullptr, nullptr };
+    std::size_t sizes[3] = { 0, 0, 0 };
+
+    for (int b = 0; b < column.buffers_ && b < 3; ++b)
+    {
+      const uint8_t * entry = data + firstBuffer + (firstBufferOfColumn + b) * BUFFER_SIZE;
+      const int64_t offset = load<int64_t>(entry);
+      const int64_t size = load<int64_t>(entry + 8);
+
+      if (offset < 0 || size < 0 || !fits(message.bodySize_, (std::size_t)offset, (std::size_t)size))
+      {
+        error = "a buffer lies outside of its record batch";
+        return false;
+      }
+
+      views[b] = message.body_ + offset;
+      sizes[b] = size;
+    }
+
+    Array & array = arrays[i];
+    array.length_ = load<int64_t>(fieldNode);
+    const int64_t nulls = load<int64_t>(fieldNode + 8);
+
+    // The validity bitmap can be left out when there are no nulls
+    const std::size_t bitmap = (std::size_t)(array.length_ + 7) / 8;
+    if (nulls > 0 && sizes[0] > 0)
+      array.validity_ = views[0];
+
+    std::size_t needed = 0;
+    switch (layout.type_)
+    {
+      case Type::Bool:
+        needed = bitmap;
+        break;
+
+      case Type::Text:
+      case Type::LargeText:
+      {
+        const std::size_t width = layout.type_ == Type::Text ? 4 : 8;
+        if (array.length_ > 0 && sizes[1] < (array.length_ + 1) * width)
+        {
+          error = "the offsets of a column don't fit its buffer";
+          return false;
+        }
+
+        array.offsets_ = views[1];
+        views[1] = views[2];
+        sizes[1] = sizes[2];
+        break;
+      }
+
+      case Type::Date:
+        needed = array.length_ * (layout.unit_ == 0 ? 4 : 8);
+        break;
+
+      case Type::Timestamp:
+        needed = array.length_ * 8;
+        break;
+
+      default:
+        needed = array.length_ * (layout.bits_ / 8);
+        break;
+    }
+
+    if (array.length_ < 0 || (array.validity_ && sizes[0] < bitmap) || sizes[1] < needed)
+    {
+      error = "the values of a column don't fit its buffer";
+      return false;
+    }
+
+    array.values_ = views[1];
+    array.valuesSize_ = sizes[1];
+  }
+
+  return true;
+}
+
+bool ArrowTable::open(std::string const& filename, std::string & error)
+{
+  if (!file_.open(filename))
+  {
+    error = "could not open the file";
+    return false;
+  }
+
+  const StrView file = file_.data();
+  const uint8_t * data = (const uint8_t *)file.data();
+
+  if (file.size() < MIN_FILE_SIZE || !isArrow(file) || memcmp(file.data() + file.size() - MAGIC_SIZE, MAGIC, MAGIC_SIZE) != 0)
+  {
+    error = "not an Arrow IPC file";
+    return false;
+  }
+
+  const int32_t footerSize = load<int32_t>(data + file.size() - MAGIC_SIZE - 4);
+  if (footerSize <= 0 || (std::size_t)footerSize > file.size() - MIN_FILE_SIZE)
+  {
+    error = "the footer doesn't fit the file";
+    return false;
+  }
+
+  enum { FOOTER_VERSION, FOOTER_SCHEMA, FOOTER_DICTIONARIES, FOOTER_RECORD_BATCHES };
+  enum { SCHEMA_ENDIANNESS, SCHEMA_FIELDS };
+  enum { FIELD_NAME, FIELD_NULLABLE, FIELD_TYPE_TYPE, FIELD_TYPE, FIELD_DICTIONARY };
+  enum { DICTIONARY_ID, DICTIONARY_INDEX_TYPE };
+
+  const FlatTable footer = FlatTable::root(data + file.size() - MAGIC_SIZE - 4 - footerSize, footerSize);
+  const FlatTable schema = footer.table(FOOTER_SCHEMA);
+  if (!schema.valid())
+  {
+    error = "the footer has no schema";
+    return false;
+  }
+
+  if (schema.scalar<int16_t>(SCHEMA_ENDIANNESS) != 0)
+  {
+    error = "big endian files aren't supported";
+    return false;
+  }
+
+  std::size_t fieldCount;
+  const std::size_t firstField = schema.vector(SCHEMA_FIELDS, 4, fieldCount);
+
+  for (std::size_t i = 0; i < fieldCount; ++i)
+  {
+    const FlatTable field = schema.element(firstField, i);
+    Column column;
+    column.name_ = field.string(FIELD_NAME).str();
+
+    Layout layout;
+    if (!readField(field, layout, column.nodes_, column.buffers_))
+    {
+      error = "column '" + column.name_ + "' has a type that isn't supported";
+      return false;
+    }
+
+    const FlatTable encoding = field.table(FIELD_DICTIONARY);
+    if (!encoding.valid())
+    {
+      column.layout_ = layout;
+      columns_.push_back(column);
+      continue;
+    }
+
+    // The record batches hold the indices, 32 bit signed integers unless it says otherwise
+    const FlatTable indexType = encoding.table(DICTIONARY_INDEX_TYPE);
+    const int valueNodes = column.nodes_;
+    const int valueBuffers = column.buffers_;
+
+    column.layout_.type_ = Type::Int;
+    column.layout_.bits_ = indexType.valid() ? indexType.scalar<int32_t>(0) : 32;
+    column.layout_.signed_ = indexType.valid() ? indexType.scalar<uint8_t>(1) != 0 : true;
+    column.nodes_ = 1;
+    column.buffers_ = 2;
+
+    const int64_t id = encoding.scalar<int64_t>(DICTIONARY_ID);
+    auto dictionary = std::find_if(dictionaries_.begin(), dictionaries_.end(), [id] (Dictionary const& dictionary) { return dictionary.id_ == id; });
+    if (dictionary == dictionaries_.end())
+    {
+      Dictionary added;
+      added.id_ = id;
+      added.layout_ = layout;
+      added.nodes_ = valueNodes;
+      added.buffers_ = valueBuffers;
+      dictionaries_.push_back(added);
+      dictionary = dictionaries_.end() - 1;
+    }
+
+    column.dictionary_ = (int)(dictionary - dictionaries_.begin());
+    columns_.push_back(column);
+  }
+
+  std::size_t blockCount;
+  const std::size_t firstBlock = footer.vector(FOOTER_DICTIONARIES, BLOCK_SIZE, blockCount);
+
+  enum { DICTIONARY_BATCH_ID, DICTIONARY_BATCH_DATA, DICTIONARY_BATCH_DELTA };
+
+  for (std::size_t i = 0; i < blockCount; ++i)
+  {
+    Message message;
+    if (!readMessage(footer.data_ + firstBlock + i * BLOCK_SIZE, message, error))
+      return false;
+
+    if (message.type_ != MESSAGE_DICTIONARY_BATCH)
+    {
+      error = "a dictionary block doesn't hold a dictionary";
+      return false;
+    }
+
+    if (message.header_.scalar<uint8_t>(DICTIONARY_BATCH_DELTA))
+    {
+      error = "delta dictionaries aren't supported";
+      return false;
+    }
+
+    const int64_t id = message.header_.scalar<int64_t>(DICTIONARY_BATCH_ID);
+    auto dictionary = std::find_if(dictionaries_.begin(), dictionaries_.end(), [id] (Dictionary const& dictionary) { return dictionary.id_ == id; });
+    if (dictionary == dictionaries_.end())
+      continue;
+
+    Column values;
+    values.layout_ = dictionary->layout_;
+    values.nodes_ = dictionary->nodes_;
+    values.buffers_ = dictionary->buffers_;
+
+    message.header_ = message.header_.table(DICTIONARY_BATCH_DATA);
+    if (!message.header_.valid())
+    {
+      error = "a dictionary batch has no data";
+      return false;
+    }
+
+    std::vector<Array> arrays;
+    int64_t length;
+    if (!readArrays(message, std::vector<Column>(1, values), arrays, length, error))
+      return false;
+
+    dictionary->values_ = arrays.front();
+  }
+
+  const std::size_t firstBatch = footer.vector(FOOTER_RECORD_BATCHES, BLOCK_SIZE, blockCount);
+
+  // Row 0 holds the names
+  int64_t rows = 1;
+  for (std::size_t i = 0; i < blockCount; ++i)
+  {
+    Message message;
+    if (!readMessage(footer.data_ + firstBatch + i * BLOCK_SIZE, message, error))
+      return false;
+
+    if (message.type_ != MESSAGE_RECORD_BATCH)
+    {
+      error = "a record batch block doesn't hold a record batch";
+      return false;
+    }
+
+    Batch batch;
+    int64_t length;
+    if (!readArrays(message, columns_, batch.arrays_, length, error))
+      return false;
+
+    if (length == 0)
+      continue;
+
+    if (rows + length > std::numeric_limits<int>::max())
+    {
+      error = "the file has too many rows";
+      return false;
+    }
+
+    batch.first_ = (int)rows;
+    batches_.push_back(std::move(batch));
+    rows += length;
+  }
+
+  rows_ = (int)rows;
+  return true;
+}
+
+static int64_t readInt(int bits, bool isSigned, const uint8_t * values, int64_t row)
+{
+  switch (bits)
+  {
+    case 8: return isSigned ? (int64_t)load<int8_t>(values + row) : (int64_t)load<uint8_t>(values + row);
+    case 16: return isSigned ? (int64_t)load<int16_t>(values + row * 2) : (int64_t)load<uint16_t>(values + row * 2);
+    case 32: return isSigned ? (int64_t)load<int32_t>(values + row * 4) : (int64_t)load<uint32_t>(values + row * 4);
+    default: return load<int64_t>(values + row * 8);
+  }
+}
+
+StrView ArrowTable::format(Layout const& layout, Array const& array, int64_t row)
+{
+  if (row < 0 || row >= array.length_ || !array.values_ || (array.validity_ && !(array.validity_[row >> 3] & (1 << (row & 7)))))
+    return StrView();
+
+  switch (layout.type_)
+  {
+    case Type::Int:
+    {
+      if (layout.bits_ == 64 && !layout.signed_ && load<uint64_t>(array.values_ + row * 8) > (uint64_t)std::numeric_limits<int64_t>::max())
+        return StrView(scratch_, snprintf(scratch_, sizeof(scratch_), "%" PRIu64, load<uint64_t>(array.values_ + row * 8)));
+
+      return StrView(scratch_, str::formatInt(readInt(layout.bits_, layout.signed_, array.values_, row), scratch_));
+    }
+
+    case Type::Float:
+    {
+      if (layout.bits_ == 64)
+        return StrView(scratch_, str::formatDouble(load<double>(array.values_ + row * 8), scratch_));
+
+      return StrView(scratch_, str::formatFloat(load<float>(array.values_ + row * 4), scratch_));
+    }
+
+    case Type::Bool:
+      return array.values_[row >> 3] & (1 << (row & 7)) ? StrView("TRUE") : StrView("FALSE");
+
+    case Type::Text:
+    case Type::LargeText:
+    {
+      const int64_t begin = layout.type_ == Type::Text ? load<int32_t>(array.offsets_ + row * 4) : load<int64_t>(array.offsets_ + row * 8);
+      const int64_t end = layout.type_ == Type::Text ? load<int32_t>(array.offsets_ + row * 4 + 4) : load<int64_t>(array.offsets_ + row * 8 + 8);
+
+      if (begin < 0 || end < begin || (uint64_t)end > array.valuesSize_)
+        return StrView();
+
+      return StrView((const char *)array.values_ + begin, end - begin);
+    }
+
+    case Type::Date:
+    {
+      // Days, or milliseconds
+      if (layout.unit_ == 0)
+        return StrView(scratch_, str::formatDate(load<int32_t>(array.values_ + row * 4), scratch_));
+
+      const int64_t milliseconds = load<int64_t>(array.values_ + row * 8);
+      return StrView(scratch_, str::formatDate(milliseconds / 86400000 - (milliseconds % 86400000 < 0 ? 1 : 0), scratch_));
+    }
+
+    case Type::Timestamp:
+    {
+      // Seconds down to nanoseconds
+      static const int64_t UNITS[] = { 1, 1000, 1000000, 1000000000 };
+      return StrView(scratch_, str::formatTimestamp(load<int64_t>(array.values_ + row * 8), UNITS[std::min(std::max(layout.unit_, 0), 3)], scratch_));
+    }
+
+    default:
+      return StrView();
+  }
+}
+
+StrView ArrowTable::field(Index const& idx)
+{
+  if (idx.x < 0 || idx.x >= columnCount() || idx.y < 0 || idx.y >= rows_)
+    return StrView();
+
+  Column const& column = columns_[idx.x];
+  if (idx.y == 0)
+    return StrView(column.name_);
+
+  const auto batch = std::upper_bound(batches_.begin(), batches_.end(), idx.y, [] (int row, Batch const& batch) { return row < batch.first_; }) - 1;
+  Array const& array = batch->arrays_[idx.x];
+  const int64_t row = idx.y - batch->first_;
+
+  if (column.dictionary_ < 0)
+    return format(column.layout_, array, row);
+
+  if (row >= array.length_ || !array.values_ || (array.validity_ && !(array.validity_[row >> 3] & (1 << (row & 7)))))
+    return StrView();
+
+  Dictionary const& dictionary = dictionaries_[column.dictionary_];
+  return format(dictionary.layout_, dictionary.values_, readInt(column.layout_.bits_, column.layout_.signed_, array.values_, row));
+}
+
+std::size_t ArrowTable::memoryUsage() const
+{
+  std::size_t bytes = memory::bytes(columns_) + memory::bytes(dictionaries_) + memory::bytes(batches_);
+  for (auto const& column : columns_)
+    bytes += column.name_.capacity();
+
+  for (auto const& batch : batches_)
+    bytes += memory::bytes(batch.arrays_);
+
+  return bytes;
+}
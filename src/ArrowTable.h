@@ -0,0 +1,130 @@
+#pragma once
+
+#include "Str.h"
+#include "Index.h"
+#include "MappedFile.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Read-only table of an Arrow IPC file, which is what Feather version 2 files are too.
+// The file is mapped and only its footer and the metadata of its record batches are read
+// when it is opened, the columns are used where they lie in the file. Text, binary and
+// the values of dictionary encoded columns are views into it, numbers, booleans, dates
+// and timestamps are formatted when a field is looked at.
+//
+// Row 0 holds the names of the columns, the rows of the record batches follow it in the
+// order the footer lists them. Compressed record batches, delta dictionaries and the view
+// types aren't supported, columns of nested and the other types read as empty fields.
+class ArrowTable
+{
+  public:
+    ArrowTable() { }
+
+    ArrowTable(ArrowTable const&) = delete;
+    ArrowTable & operator = (ArrowTable const&) = delete;
+
+    // Whether data starts the way an Arrow IPC file does
+    static bool isArrow(StrView data);
+
+    // Maps the file and reads its schema and record batches. Returns false with what's
+    // wrong in error if it can't be read.
+    bool open(std::string const& filename, std::string & error);
+
+    int rowCount() const { return rows_; }
+    int columnCount() const { return (int)columns_.size(); }
+
+    // Returns field idx.x of row idx.y, which is empty for nulls and past the end. Text is
+    // a view into the file, formatted fields are only valid until the next call.
+    StrView field(Index const& idx);
+
+    // Bytes of the column and batch metadata, the mapped file is not counted
+    std::size_t memoryUsage() const;
+
+  private:
+    enum class Type
+    {
+      Unsupported,
+      Null,
+      Int,
+      Float,
+      Bool,
+      Text,
+      LargeText,
+      Date,
+      Timestamp,
+    };
+
+    // How the values of an array are stored. bits_ is the width of an Int or Float, unit_
+    // is the Arrow unit of a Date or Timestamp.
+    struct Layout
+    {
+      Type type_ = Type::Unsupported;
+      int bits_ = 0;
+      bool signed_ = true;
+      int unit_ = 0;
+    };
+
+    // The buffers of an array, all null pointers of a column that isn't supported
+    struct Array
+    {
+      int64_t length_ = 0;
+      const uint8_t * validity_ = nullptr;
+      const uint8_t * offsets_ = nullptr;
+      const uint8_t * values_ = nullptr;
+      std::size_t valuesSize_ = 0;
+    };
+
+    // The layout is of the arrays in the record batches, which hold indices into one of
+    // the dictionaries for a dictionary encoded column. Nodes and buffers count the field
+    // nodes and buffers the column and its children take up in a record batch.
+    struct Column
+    {
+      std::string name_;
+      Layout layout_;
+      int dictionary_ = -1;
+      int nodes_ = 0;
+      int buffers_ = 0;
+    };
+
+    // The values of a dictionary, read from its dictionary batch
+    struct Dictionary
+    {
+      int64_t id_ = 0;
+      Layout layout_;
+      int nodes_ = 0;
+      int buffers_ = 0;
+      Array values_;
+    };
+
+    struct Batch
+    {
+      int first_ = 0;
+      std::vector<Array> arrays_;
+    };
+
+    struct FlatTable;
+    struct Message;
+
+    // Fills in how a field of the schema is stored, and counts the field nodes and buffers
+    // it and its children take up in a record batch. False for the types whose buffers
+    // can't be counted from the schema.
+    static bool readField(FlatTable const& field, Layout & layout, int & nodes, int & buffers);
+
+    // The metadata of the message at one of the blocks the footer lists, and its body
+    bool readMessage(const uint8_t * block, Message & message, std::string & error) const;
+
+    static bool readArrays(Message const& message, std::vector<Column> const& columns, std::vector<Array> & arrays, int64_t & length, std::string & error);
+
+    StrView format(Layout const& layout, Array const& array, int64_t row);
+
+  private:
+    MappedFile file_;
+    std::vector<Column> columns_;
+    std::vector<Dictionary> dictionaries_;
+    std::vector<Batch> batches_;
+    int rows_ = 0;
+
+    char scratch_[str::FORMAT_SIZE];
+};
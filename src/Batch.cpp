@@ -0,0 +1,59 @@
+#include "Batch.h"
+#include "Document.h"
+#include "Tcl.h"
+#include "Log.h"
+#include "Profile.h"
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace batch {
+
+  static const int LOADING_POLL_INTERVAL = 10;
+
+  int run(std::string const& script, std::vector<std::string> const& documents)
+  {
+    tcl::initialize();
+
+    // Nobody is waiting for a responsive interface, load and evaluate everything up front
+    tcl::evaluate("set doc_backgroundLoadSize 0; set doc_backgroundSaveSize 0; set doc_lazyEvaluation 0; set doc_recalcBudget 0");
+
+    for (auto const& filename : documents)
+    {
+      if (!doc::load(filename))
+        return 1;
+    }
+
+    // Standard input is still read on a thread, the script gets all of it
+    while (doc::isLoading())
+    {
+      if (!doc::updateLoading())
+        std::this_thread::sleep_for(std::chrono::milliseconds(LOADING_POLL_INTERVAL));
+    }
+
+    if (doc::getOpenBufferCount() == 0)
+      doc::createDefaultEmpty();
+
+    profile::markStartup("documents");
+    profile::printStartupProfile();
+
+    std::ifstream file(script, std::ios::binary);
+    if (!file)
+    {
+      logError("Could not open script '", script, "'");
+      return 1;
+    }
+
+    std::stringstream code;
+    code << file.rdbuf();
+
+    // A failing script is reported by tcl::evaluate()
+    const bool ok = tcl::evaluate(code.str());
+
+    doc::shutdown();
+    tcl::shutdown();
+    return ok ? 0 : 1;
+  }
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Batch mode, zum --batch and zum_batch: loads the documents and runs a script against
+// them without a view, so it works without a terminal or display. Documents are loaded
+// and evaluated up front. Errors, warnings and what the script prints go to stderr.
+namespace batch {
+
+  // Returns the exit code, 1 when a document can't be loaded or the script fails
+  int run(std::string const& script, std::vector<std::string> const& documents);
+}
@@ -0,0 +1,28 @@
+#include "Batch.h"
+#include "Profile.h"
+
+#include <cstdio>
+#include <cstring>
+
+// Runs a script against documents like zum --batch, without the view, so it builds where
+// the interface doesn't and the tests can run it:
+//
+//   zum_batch [--startup-profile] script.tcl [document ...]
+
+int main(int argc, char * argv[])
+{
+  int first = 1;
+  if (argc > first && strcmp(argv[first], "--startup-profile") == 0)
+  {
+    profile::enableStartupProfile();
+    ++first;
+  }
+
+  if (argc <= first)
+  {
+    fprintf(stderr, "usage: zum_batch [--startup-profile] script.tcl [document ...]\n");
+    return 1;
+  }
+
+  return batch::run(argv[first], std::vector<std::string>(argv + first + 1, argv + argc));
+}
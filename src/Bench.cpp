@@ -0,0 +1,621 @@
+#include "Document.h"
+#include "Editor.h"
+#include "Generator.h"
+#include "Replay.h"
+#include "Tcl.h"
+#include "Log.h"
+#include "bx/platform.h"
+
+#ifdef ZUM_BENCH_MEMORY
+#include "MemoryCount.h"
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#if BX_PLATFORM_LINUX || BX_PLATFORM_OSX
+#include <sys/resource.h>
+#endif
+
+// Headless benchmarks of loading, evaluation, editing and drawing. They run against the
+// null view and write their results to stdout as JSON, so they can be tracked per commit:
+//
+//   zum_bench [--max-cells count] [--iterations count] [name filter]
+//   zum_bench --replay events [document]
+//   zum_bench_memory [--max-cells count] [name filter]
+//
+// With --replay the events recorded by zum --record are played back against the document
+// instead, and the latency of each key is reported, see Replay.h.
+//
+// The datasets come from the generator zum_gen uses, with fixed seeds, so the numbers of
+// two machines are about the same documents.
+//
+// zum_bench_memory, this file built with ZUM_BENCH_MEMORY, runs the memory_ benchmarks
+// instead. They run their operation once and report what it allocated instead of its
+// time, counted by the operator new of MemoryCount.cpp: the allocations and their bytes, the
+// bytes still held after it and the most held during it, both over what was held before,
+// and the peak RSS of the process while it ran. Memory from malloc() or mapped files isn't
+// counted but is in the RSS. Of the last two, only Linux resets the peak for each
+// operation, elsewhere it is the peak of the process so far.
+
+static const long long DATASET_CELLS[] = { 10000, 1000000, 10000000 };
+static const int DATASET_COLUMNS = 10;
+
+static const int CHAIN_LENGTHS[] = { 1000, 100000 };
+static const int SUM_FORMULAS = 100;
+static const int MOVING_SUM_ROWS = 1000;
+
+// Every row of the moving sums is a formula, larger datasets take too long to load
+static const long long MOVING_SUM_MAX_CELLS = 1000000;
+
+static const int EDITS_PER_ITERATION = 100;
+static const int ROW_EDITS_PER_ITERATION = 10;
+static const int DRAWS_PER_ITERATION = 100;
+
+static const char * NEEDLE = "needle";
+
+typedef std::function<void()> BenchFunc;
+
+struct BenchResult
+{
+  std::string name_;
+  long long cells_;
+  int iterations_;
+  double best_;
+  double mean_;
+};
+
+// What one run of a memory_ benchmark allocated, the bytes over what was held before it.
+// operations_ is what the counts are divided by for the per operation figures: the cells,
+// or the edits.
+struct MemoryResult
+{
+  std::string name_;
+  long long cells_;
+  long long operations_;
+  long long allocations_;
+  long long allocatedBytes_;
+  long long liveBytes_;
+  long long peakBytes_;
+  long long peakRss_;
+};
+
+static std::vector<BenchResult> results_;
+static std::vector<MemoryResult> memoryResults_;
+static std::vector<std::string> dataFiles_;
+static std::string filter_;
+static int iterationOverride_ = 0;
+static long long maxCells_ = DATASET_CELLS[2];
+
+// Keeps the compiler from dropping reads whose result is not otherwise used
+static volatile double sink_ = 0.0;
+
+static double seconds()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool selected(std::string const& name)
+{
+  return filter_.empty() || name.find(filter_) != std::string::npos;
+}
+
+// Fewer iterations for the large datasets, a single run of those already takes seconds
+static int iterationsFor(long long cells)
+{
+  if (iterationOverride_ > 0)
+    return iterationOverride_;
+
+  return cells <= 10000 ? 20 : (cells <= 1000000 ? 3 : 1);
+}
+
+// Calls setup and then func iterations times, only func is timed. Records the fastest
+// and the mean iteration.
+static void run(std::string const& name, long long cells, BenchFunc const& setup, BenchFunc const& func)
+{
+  if (!selected(name))
+    return;
+
+  const int iterations = iterationsFor(cells);
+  double best = 0.0;
+  double total = 0.0;
+
+  for (int i = 0; i < iterations; ++i)
+  {
+    if (setup)
+      setup();
+
+    const double start = seconds();
+    func();
+    const double elapsed = seconds() - start;
+
+    best = i == 0 ? elapsed : std::min(best, elapsed);
+    total += elapsed;
+  }
+
+  results_.push_back({ name, cells, iterations, best, total / iterations });
+  fprintf(stderr, "%-28s %10lld cells %10.3f ms\n", name.c_str(), cells, best * 1000.0);
+}
+
+#ifdef ZUM_BENCH_MEMORY
+
+// Makes the next peakRss() the peak from now on, where the system allows it
+static void resetPeakRss()
+{
+#if BX_PLATFORM_LINUX
+  if (FILE * file = fopen("/proc/self/clear_refs", "w"))
+  {
+    fputs("5", file);
+    fclose(file);
+  }
+#endif
+}
+
+// In bytes, 0 where it isn't known
+static long long peakRss()
+{
+#if BX_PLATFORM_LINUX
+  if (FILE * file = fopen("/proc/self/status", "r"))
+  {
+    char line[256];
+    long long kilobytes = -1;
+    while (kilobytes < 0 && fgets(line, sizeof(line), file))
+      if (sscanf(line, "VmHWM: %lld kB", &kilobytes) != 1)
+        kilobytes = -1;
+
+    fclose(file);
+    if (kilobytes >= 0)
+      return kilobytes * 1024;
+  }
+#endif
+
+#if BX_PLATFORM_LINUX || BX_PLATFORM_OSX
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    return BX_PLATFORM_OSX ? usage.ru_maxrss : usage.ru_maxrss * 1024LL;
+#endif
+
+  return 0;
+}
+
+// Runs func once, counting what it allocates, see the top of the file
+static void measure(std::string const& name, long long cells, long long operations, BenchFunc const& func)
+{
+  if (!selected(name))
+    return;
+
+  const long long count = alloc::count();
+  const long long bytes = alloc::bytes();
+  const long long live = alloc::live();
+
+  alloc::resetPeak();
+  resetPeakRss();
+
+  func();
+
+  MemoryResult result;
+  result.name_ = name;
+  result.cells_ = cells;
+  result.operations_ = std::max(operations, 1LL);
+  result.allocations_ = alloc::count() - count;
+  result.allocatedBytes_ = alloc::bytes() - bytes;
+  result.liveBytes_ = alloc::live() - live;
+  result.peakBytes_ = alloc::peak() - live;
+  result.peakRss_ = peakRss();
+
+  memoryResults_.push_back(result);
+  fprintf(stderr, "%-28s %10lld cells %10lld allocs %10.1f MB peak %10.1f MB rss\n", name.c_str(), cells,
+          result.allocations_, result.peakBytes_ / 1048576.0, result.peakRss_ / 1048576.0);
+}
+
+#endif
+
+static std::string datasetName(std::string const& kind, long long cells)
+{
+  return "zum_bench_" + kind + "_" + std::to_string(cells);
+}
+
+static std::string addDataFile(std::string const& filename)
+{
+  dataFiles_.push_back(filename);
+  return filename;
+}
+
+static std::string writeDataset(std::string const& name, gen::Options const& options)
+{
+  const std::string filename = addDataFile(name + ".csv");
+  if (!gen::writeCsv(filename, options))
+  {
+    fprintf(stderr, "Could not write %s\n", filename.c_str());
+    exit(1);
+  }
+
+  return filename;
+}
+
+// Column A holds text with the needle in the last row, the other columns hold numbers
+static std::string writeTable(long long cells)
+{
+  gen::Options options;
+  options.rows = cells / DATASET_COLUMNS;
+  options.textColumns = 1;
+  options.numberColumns = DATASET_COLUMNS - 1;
+  options.formulaColumns = 0;
+  options.keyColumn = true;
+  options.needle = NEEDLE;
+
+  return writeDataset(datasetName("table", cells), options);
+}
+
+// Column A is one chain of formulas, each adds one to the row above
+static std::string writeChain(int length)
+{
+  gen::Options options;
+  options.rows = length;
+  options.textColumns = 0;
+  options.numberColumns = 0;
+  options.formulaColumns = 1;
+  options.formulaDensity = 1.0;
+  options.chainDepth = length;
+
+  return writeDataset(datasetName("chain", length), options);
+}
+
+// Column A holds numbers, about SUM_FORMULAS cells of column B sum all of column A
+static std::string writeSums(long long rows)
+{
+  gen::Options options;
+  options.rows = rows;
+  options.textColumns = 0;
+  options.numberColumns = 1;
+  options.formulaColumns = 1;
+  options.formulaDensity = (double)SUM_FORMULAS / rows;
+  options.sumWidth = rows;
+
+  return writeDataset(datasetName("sums", rows), options);
+}
+
+// Column A holds numbers, every cell of column B sums the MOVING_SUM_ROWS of column A
+// from its own row on
+static std::string writeMovingSums(long long cells)
+{
+  gen::Options options;
+  options.rows = cells / 2;
+  options.textColumns = 0;
+  options.numberColumns = 1;
+  options.formulaColumns = 1;
+  options.formulaDensity = 1.0;
+  options.sumWidth = MOVING_SUM_ROWS;
+  options.movingSum = true;
+
+  return writeDataset(datasetName("moving", cells), options);
+}
+
+static void loadDocument(std::string const& filename)
+{
+  if (!doc::load(filename))
+  {
+    fprintf(stderr, "Could not load %s\n", filename.c_str());
+    exit(1);
+  }
+
+  while (doc::isLoading())
+    doc::updateLoading();
+}
+
+static void closeDocument()
+{
+  doc::close();
+}
+
+static void tclEvaluate(std::string const& code)
+{
+  if (!tcl::evaluate(code))
+  {
+    fprintf(stderr, "Tcl error in '%s': %s\n", code.c_str(), tcl::result().c_str());
+    exit(1);
+  }
+}
+
+#ifdef ZUM_BENCH_MEMORY
+
+// Loading keeps the document, whose bytes per cell are the live bytes over the cells. The
+// edits and their undo keep the redo history.
+static void benchMemory(long long cells, std::string const& csv)
+{
+  const std::string saved = addDataFile(datasetName("memory", cells) + ".zum2");
+
+  measure("memory_load_csv", cells, cells, [&] () { loadDocument(csv); });
+
+  tclEvaluate("set doc_memoizeResults 0");
+  measure("memory_filter", cells, cells, [] () { tclEvaluate("filter -noHeader B -gt 500"); });
+  closeDocument();
+  tclEvaluate("set doc_memoizeResults 1");
+
+  measure("memory_edit_undo", cells, EDITS_PER_ITERATION, [] () {
+    for (int i = 0; i < EDITS_PER_ITERATION; ++i)
+      doc::setCellText(Index(1, i), std::to_string(i));
+
+    for (int i = 0; i < EDITS_PER_ITERATION; ++i)
+      doc::undo();
+  });
+
+  measure("memory_sort", cells, cells, [] () { tclEvaluate("sort -noHeader B -numeric"); });
+
+  tclEvaluate("set doc_saveFormat zum2");
+  tclEvaluate("set doc_incrementalSave 0");
+  measure("memory_save_zum2", cells, cells, [&] () { doc::save(saved); });
+  tclEvaluate("set doc_incrementalSave 1");
+  tclEvaluate("set doc_saveFormat zum1");
+
+  closeDocument();
+}
+
+#endif
+
+static void benchDataset(long long cells)
+{
+  const std::string csv = writeTable(cells);
+
+#ifdef ZUM_BENCH_MEMORY
+  benchMemory(cells, csv);
+#else
+  const std::string zum1 = addDataFile(datasetName("table", cells) + ".zum");
+  const int rows = cells / DATASET_COLUMNS;
+
+  run("load_csv", cells, nullptr, [&] () { loadDocument(csv); closeDocument(); });
+
+  loadDocument(csv);
+  doc::save(zum1);
+  closeDocument();
+
+  run("load_zum1", cells, nullptr, [&] () { loadDocument(zum1); closeDocument(); });
+
+  // ZUM2 with uncompressed and with LZ4 compressed column blocks
+  const std::string zum2 = addDataFile(datasetName("table", cells) + ".zum2");
+  const std::string zum2Lz4 = addDataFile(datasetName("table_lz4", cells) + ".zum2");
+
+  tclEvaluate("set doc_saveFormat zum2");
+  loadDocument(csv);
+  tclEvaluate("set doc_saveCompression none");
+  doc::save(zum2);
+  tclEvaluate("set doc_saveCompression lz4");
+  doc::save(zum2Lz4);
+  closeDocument();
+  tclEvaluate("set doc_saveFormat zum1");
+
+  run("load_zum2", cells, nullptr, [&] () { loadDocument(zum2); closeDocument(); });
+  run("load_zum2_lz4", cells, nullptr, [&] () { loadDocument(zum2Lz4); closeDocument(); });
+
+  // Saving the whole file, and saving it again after a few edits, which only appends the
+  // blocks of rows they are in
+  const std::string saved = addDataFile(datasetName("saved", cells) + ".zum2");
+
+  tclEvaluate("set doc_saveFormat zum2");
+  loadDocument(zum2Lz4);
+  tclEvaluate("set doc_incrementalSave 0");
+  run("save_zum2", cells, nullptr, [&] () { doc::save(saved); });
+  tclEvaluate("set doc_incrementalSave 1");
+
+  auto editScattered = [rows] () {
+    for (int i = 0; i < 10; ++i)
+      doc::setCellText(Index(1, (int)((long long)rows * i / 10)), std::to_string(i));
+  };
+
+  run("save_zum2_edited", cells, editScattered, [&] () { doc::save(saved); });
+  closeDocument();
+  tclEvaluate("set doc_saveFormat zum1");
+
+  const std::string exported = addDataFile(datasetName("exported", cells) + ".csv");
+
+  loadDocument(csv);
+  tclEvaluate("set doc_backgroundSaveSize 0");
+  run("export_csv", cells, nullptr, [&] () { tclEvaluate("export " + exported); });
+  closeDocument();
+
+  loadDocument(csv);
+
+  // The scans run each time, the memoized results are timed after them
+  tclEvaluate("set doc_memoizeResults 0");
+
+  // The filter creates a view buffer, closing it only drops its row list
+  run("filter", cells, nullptr, [] () { tclEvaluate("filter -noHeader B -gt 500"); closeDocument(); });
+
+  // The groups go into a new buffer, closing it leaves the table
+  run("groupby", cells, nullptr, [] () { tclEvaluate("groupby -noHeader B -count -sum C -avg D"); closeDocument(); });
+
+  // The same reading the cells, without the encoded columns the first run builds
+  tclEvaluate("set doc_columnEncoding 0");
+  run("filter_cells", cells, nullptr, [] () { tclEvaluate("filter -noHeader B -gt 500"); closeDocument(); });
+  run("groupby_cells", cells, nullptr, [] () { tclEvaluate("groupby -noHeader B -count -sum C -avg D"); closeDocument(); });
+  tclEvaluate("set doc_columnEncoding 1");
+
+  // Repeating them takes the rows and groups kept by the first run
+  tclEvaluate("set doc_memoizeResults 1");
+  run("filter_memoized", cells, nullptr, [] () { tclEvaluate("filter -noHeader B -gt 500"); closeDocument(); });
+  run("groupby_memoized", cells, nullptr, [] () { tclEvaluate("groupby -noHeader B -count -sum C -avg D"); closeDocument(); });
+
+  // Column A is unique, joining the table with itself copies every row once
+  run("join", cells, nullptr, [] () {
+    tclEvaluate("joinBuffers -noHeader [currentBuffer] A [currentBuffer] A");
+    closeDocument();
+  });
+
+  run("find", cells, nullptr, [] () {
+    Index match;
+    doc::findText(NEEDLE, Index(0, 0), true, match);
+  });
+
+  // Runs down the filled first column and back up
+  run("data_edge", cells, nullptr, [] () {
+    const Index last = doc::findDataEdge(Index(0, 0), 0, 1);
+    sink_ = doc::findDataEdge(last, 0, -1).y;
+  });
+
+  // Reads every number one cell at a time, the way formulas read their references
+  run("read_values", cells, nullptr, [rows] () {
+    double sum = 0.0;
+    for (int y = 0; y < rows; ++y)
+      for (int x = 1; x < DATASET_COLUMNS; ++x)
+        sum += doc::getCellValue(Index(x, y));
+
+    sink_ = sum;
+  });
+
+  run("add_remove_row", cells, nullptr, [rows] () {
+    for (int i = 0; i < ROW_EDITS_PER_ITERATION; ++i)
+    {
+      doc::addRow(rows / 2);
+      doc::removeRow(rows / 2 + 1);
+    }
+  });
+
+  auto edit = [] () {
+    for (int i = 0; i < EDITS_PER_ITERATION; ++i)
+      doc::setCellText(Index(1, i), std::to_string(i));
+  };
+
+  run("undo_redo", cells, edit, [] () {
+    for (int i = 0; i < EDITS_PER_ITERATION; ++i)
+      doc::undo();
+
+    for (int i = 0; i < EDITS_PER_ITERATION; ++i)
+      doc::redo();
+  });
+
+  doc::scroll() = Index(0, rows / 2);
+  doc::cursorPos() = Index(2, rows / 2 + 5);
+
+  // drawInterface() lays out the visible columns that drawWorkspace() then fills
+  run("draw_workspace", cells, drawInterface, [] () {
+    for (int i = 0; i < DRAWS_PER_ITERATION; ++i)
+      drawWorkspace();
+  });
+
+  // Redefining the column formula throws away the blocks it computed
+  auto colexpr = [] () { tclEvaluate("colexpr K {B1*C1+D1*E1-F1/2}"); };
+  auto readColexpr = [rows] () {
+    double sum = 0.0;
+    for (int y = 0; y < rows; ++y)
+      sum += doc::getCellValue(Index(DATASET_COLUMNS, y));
+
+    sink_ = sum;
+  };
+
+  run("evaluate_colexpr", cells, colexpr, readColexpr);
+
+  tclEvaluate("set doc_jit 1");
+  run("evaluate_colexpr_jit", cells, colexpr, readColexpr);
+  tclEvaluate("set doc_jit 0");
+
+  closeDocument();
+
+  if (selected("evaluate_sum"))
+  {
+    loadDocument(writeSums(cells));
+    run("evaluate_sum", cells, nullptr, [] () { doc::evaluateDocument(); });
+    closeDocument();
+  }
+
+  if (cells <= MOVING_SUM_MAX_CELLS && selected("evaluate_moving_sum"))
+  {
+    loadDocument(writeMovingSums(cells));
+    run("evaluate_moving_sum", cells, nullptr, [] () { doc::evaluateDocument(); });
+    closeDocument();
+  }
+#endif
+}
+
+static void printResults()
+{
+  printf("{\n  \"benchmarks\": [\n");
+
+  for (std::size_t i = 0; i < results_.size(); ++i)
+  {
+    BenchResult const& result = results_[i];
+    printf("    { \"name\": \"%s\", \"cells\": %lld, \"iterations\": %d, \"best_ms\": %.3f, \"mean_ms\": %.3f }%s\n",
+           result.name_.c_str(), result.cells_, result.iterations_, result.best_ * 1000.0, result.mean_ * 1000.0,
+           i + 1 < results_.size() ? "," : "");
+  }
+
+  printf("  ],\n  \"memory\": [\n");
+
+  for (std::size_t i = 0; i < memoryResults_.size(); ++i)
+  {
+    MemoryResult const& result = memoryResults_[i];
+    printf("    { \"name\": \"%s\", \"cells\": %lld, \"operations\": %lld, \"allocations\": %lld, \"allocated_bytes\": %lld, "
+           "\"live_bytes\": %lld, \"peak_live_bytes\": %lld, \"peak_rss_bytes\": %lld, \"allocations_per_op\": %.3f, \"live_bytes_per_op\": %.3f }%s\n",
+           result.name_.c_str(), result.cells_, result.operations_, result.allocations_, result.allocatedBytes_,
+           result.liveBytes_, result.peakBytes_, result.peakRss_, (double)result.allocations_ / result.operations_,
+           (double)result.liveBytes_ / result.operations_, i + 1 < memoryResults_.size() ? "," : "");
+  }
+
+  printf("  ]\n}\n");
+}
+
+int main(int argc, char * argv[])
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--max-cells") == 0 && i + 1 < argc)
+      maxCells_ = atoll(argv[++i]);
+    else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+      iterationOverride_ = atoi(argv[++i]);
+    else
+      filter_ = argv[i];
+  }
+
+  setLogLevel(LogLevel::Error);
+
+  tcl::initialize();
+
+  if (argc > 2 && strcmp(argv[1], "--replay") == 0)
+  {
+    std::vector<view::Event> events;
+    if (!replay::load(argv[2], events))
+      return 1;
+
+    if (argc > 3)
+      loadDocument(argv[3]);
+    else
+      doc::createDefaultEmpty();
+
+    replay::Latencies latencies;
+    replay::play(events, latencies);
+    latencies.print();
+    return 0;
+  }
+
+  doc::createDefaultEmpty();
+
+  for (long long cells : DATASET_CELLS)
+    if (cells <= maxCells_)
+      benchDataset(cells);
+
+#ifndef ZUM_BENCH_MEMORY
+  for (int length : CHAIN_LENGTHS)
+  {
+    if (length > maxCells_ || !selected("evaluate_chain"))
+      continue;
+
+    loadDocument(writeChain(length));
+    run("evaluate_chain", length, nullptr, [] () { doc::evaluateDocument(); });
+    closeDocument();
+  }
+#endif
+
+  doc::shutdown();
+
+  for (auto const& filename : dataFiles_)
+    remove(filename.c_str());
+
+  printResults();
+  return 0;
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// On-disk layout of the ZUM2 binary document format. All values are little endian
+// and every section starts on an 8 byte boundary.
+//
+//   FileHeader
+//   ColumnWidth[widthCount]
+//   ColumnEntry[columnCount]
+//   IndexEntry[indexCount]
+//   column blocks
+//   index rows
+//
+// From version 2 on every column block is stored behind a BlockEnvelope, compressed
+// with the codec it names. Blocks are compressed on their own, so they can be
+// decompressed in parallel. Version 1 files store the blocks as they are.
+//
+// From version 3 on the file keeps the column indexes, see ColumnIndex. An index is
+// stored as the rows of its column in index order, the cells give back the keys.
+// Older files end the header before indexCount_ and have no indexes.
+//
+// From version 4 on a formula that was evaluated when it was saved is stored as an
+// EvaluatedFormula, and loading keeps its value instead of evaluating it again. Only the
+// other formulas are evaluated on open. formulaChecksum_ sums a hash of the position and
+// expression records of every formula; when the loaded formulas don't add up to it, all
+// of them are evaluated.
+//
+// A column may be stored as any number of blocks, which hold different rows of it. Saves
+// write a block per BLOCK_ROWS rows from a multiple of it on, and saving to the file
+// again appends the blocks that changed and a new directory after everything else, and
+// then rewrites the header to point at them. So the sections may come in any order, and
+// the file may hold blocks and directories nothing points at anymore. Readers of every
+// version read such files.
+//
+// A column block holds the cells of one column sorted by row, as parallel arrays:
+//
+//   BlockHeader
+//   uint32_t    rows[cellCount]
+//   uint32_t    formats[cellCount]
+//   uint8_t     kinds[cellCount]
+//   double      values[cellCount]
+//   uint32_t    textOffsets[cellCount + 1]    offsets into the block strings
+//   uint32_t    exprOffsets[cellCount + 1]    offsets into the block expressions
+//   ExprRecord  expressions[exprCount]
+//   char        strings[stringsSize]
+namespace zum2 {
+
+  static const char MAGIC[4] = { 'Z', 'U', 'M', '2' };
+  static const uint32_t VERSION = 4;
+  static const uint32_t ENDIAN_MARK = 0x01020304;
+  static const uint32_t BLOCK_ROWS = 4096;
+
+  enum Codec : uint32_t
+  {
+    None = 0,
+    Lz4 = 1,
+  };
+
+  enum CellKind : uint8_t
+  {
+    Text = 0,
+    Number = 1,
+    Formula = 2,
+    EvaluatedFormula = 3,
+  };
+
+  struct FileHeader
+  {
+    char magic_[4];
+    uint32_t version_;
+    uint32_t byteOrder_;
+    uint32_t width_;
+    uint32_t height_;
+    uint32_t widthCount_;
+    uint32_t columnCount_;
+
+    // The codec the blocks were saved with, a block that doesn't get smaller is
+    // still stored as it is
+    uint32_t codec_;
+
+    uint64_t widthsOffset_;
+    uint64_t columnsOffset_;
+
+    uint32_t indexCount_;
+    uint32_t reserved_;
+    uint64_t indexesOffset_;
+
+    uint64_t formulaChecksum_;
+  };
+
+  // Bytes of the header of version 1 and 2 files, and of version 3 files
+  static const std::size_t HEADER_V2_SIZE = 48;
+  static const std::size_t HEADER_V3_SIZE = 64;
+  static_assert(offsetof(FileHeader, indexCount_) == HEADER_V2_SIZE, "version 3 only adds to the header");
+  static_assert(offsetof(FileHeader, formulaChecksum_) == HEADER_V3_SIZE, "version 4 only adds to the header");
+
+  // An index saved while stale has no rows, it is built again when it is used
+  struct IndexEntry
+  {
+    uint32_t column_;
+    uint32_t stale_;
+    uint32_t numberCount_;
+    uint32_t textCount_;
+    uint32_t formulaCount_;
+    uint32_t reserved_;
+
+    // uint32_t rows of the numbers, then of the texts, then of the formulas
+    uint64_t rowsOffset_;
+  };
+
+  struct ColumnWidth
+  {
+    uint32_t column_;
+    uint32_t width_;
+  };
+
+  struct ColumnEntry
+  {
+    uint32_t column_;
+    uint32_t cellCount_;
+    uint64_t blockOffset_;
+    uint64_t blockSize_;
+  };
+
+  // blockSize_ of the column entry includes the envelope and the padding after the
+  // storedSize_ bytes of the block
+  struct BlockEnvelope
+  {
+    uint32_t codec_;
+    uint32_t reserved_;
+    uint64_t rawSize_;
+    uint64_t storedSize_;
+  };
+
+  struct BlockHeader
+  {
+    uint32_t cellCount_;
+    uint32_t exprCount_;
+    uint64_t stringsSize_;
+  };
+
+  // One element of a formula in reverse polish order, see Expr. The name in the strings
+  // of the block is the one of a function, or of the sheet a cell or range is in when it
+  // is another document.
+  struct ExprRecord
+  {
+    uint8_t type_;
+    uint8_t padding_[3];
+    uint32_t nameLength_;
+    union {
+      double constant_;
+      uint64_t nameOffset_;
+    };
+    int32_t startX_;
+    int32_t startY_;
+    int32_t endX_;
+    int32_t endY_;
+  };
+
+  inline std::size_t align(std::size_t size)
+  {
+    return (size + 7) & ~static_cast<std::size_t>(7);
+  }
+}
@@ -0,0 +1,257 @@
+#include "Cache.h"
+#include "Tcl.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <new>
+
+namespace cache {
+
+  // Megabytes the caches may hold together
+  static const tcl::Variable CACHE_MEMORY("app_cacheMemory", 512);
+
+  // The caches are balanced at most this often, the cgroup is read at most every
+  // PRESSURE_POLL_SECONDS
+  static const double BALANCE_SECONDS = 0.25;
+  static const double PRESSURE_POLL_SECONDS = 1.0;
+
+  // The cgroup is short of memory above this share of its limit, and the caches then keep
+  // PRESSURE_KEEP of what they held
+  static const double PRESSURE_SHARE = 0.9;
+  static const double PRESSURE_KEEP = 0.5;
+
+  // Put aside for operator new to fall back on
+  static const std::size_t RESERVE_BYTES = 8 << 20;
+
+  static const std::size_t UNLIMITED = std::numeric_limits<std::size_t>::max();
+
+  typedef std::chrono::steady_clock Clock;
+
+  static std::vector<Cache *> & caches()
+  {
+    static std::vector<Cache *> caches;
+    return caches;
+  }
+
+  static std::vector<Counters *> & counters()
+  {
+    static std::vector<Counters *> counters;
+    return counters;
+  }
+
+  static std::atomic<void *> reserve_(nullptr);
+  static std::atomic<bool> allocationFailed_(false);
+
+  // The budget while memory is short, UNLIMITED while it isn't
+  static std::size_t pressureBudget_ = UNLIMITED;
+
+  static Clock::time_point lastBalance_;
+  static Clock::time_point lastPoll_;
+
+  // The directory of the cgroup v2 of the process, empty without one
+  static std::string cgroup_;
+  static bool cgroupFound_ = false;
+
+  Cache::Cache(const char * name, Cost cost, std::size_t (*bytes)(), void (*shrink)(std::size_t target))
+    : name_(name),
+      cost_(cost),
+      bytes_(bytes),
+      shrink_(shrink)
+  {
+    caches().push_back(this);
+  }
+
+  Counters::Counters(const char * name)
+    : name_(name),
+      hits_(0),
+      misses_(0)
+  {
+    counters().push_back(this);
+  }
+
+  // Takes the reserve, so the allocation that failed is tried again, and leaves shrinking
+  // the caches to the next balance(). Without the reserve the allocation fails.
+  static void newHandler()
+  {
+    void * reserve = reserve_.exchange(nullptr);
+    if (!reserve)
+      throw std::bad_alloc();
+
+    free(reserve);
+    allocationFailed_ = true;
+  }
+
+  void initialize()
+  {
+    reserve_ = malloc(RESERVE_BYTES);
+    std::set_new_handler(newHandler);
+  }
+
+  static std::string findCgroup()
+  {
+    FILE * file = fopen("/proc/self/cgroup", "r");
+    if (!file)
+      return std::string();
+
+    // The unified hierarchy is the line 0::path
+    std::string path;
+    char line[4096];
+    while (fgets(line, sizeof(line), file))
+    {
+      if (line[0] == '0' && line[1] == ':' && line[2] == ':')
+      {
+        path = line + 3;
+        while (!path.empty() && (path.back() == '\n' || path.back() == '/'))
+          path.pop_back();
+        break;
+      }
+    }
+
+    fclose(file);
+
+    const std::string cgroup = "/sys/fs/cgroup" + path;
+    FILE * current = fopen((cgroup + "/memory.current").c_str(), "r");
+    if (!current)
+      return std::string();
+
+    fclose(current);
+    return cgroup;
+  }
+
+  // Bytes in a memory file of the cgroup, UNLIMITED for max or a file that can't be read
+  static std::size_t readCgroup(const char * name)
+  {
+    FILE * file = fopen((cgroup_ + "/" + name).c_str(), "r");
+    if (!file)
+      return UNLIMITED;
+
+    unsigned long long value = 0;
+    const bool read = fscanf(file, "%llu", &value) == 1;
+    fclose(file);
+
+    return read ? (std::size_t)value : UNLIMITED;
+  }
+
+  static bool cgroupPressure()
+  {
+    if (!cgroupFound_)
+    {
+      cgroup_ = findCgroup();
+      cgroupFound_ = true;
+    }
+
+    if (cgroup_.empty())
+      return false;
+
+    const std::size_t limit = std::min(readCgroup("memory.high"), readCgroup("memory.max"));
+    if (limit == UNLIMITED)
+      return false;
+
+    const std::size_t current = readCgroup("memory.current");
+    return current != UNLIMITED && current > limit * PRESSURE_SHARE;
+  }
+
+  bool balance()
+  {
+    const Clock::time_point now = Clock::now();
+    const bool failed = allocationFailed_.exchange(false);
+    if (!failed && std::chrono::duration<double>(now - lastBalance_).count() < BALANCE_SECONDS)
+      return false;
+
+    lastBalance_ = now;
+
+    std::vector<std::pair<Cache *, std::size_t>> held;
+    std::size_t total = 0;
+    for (Cache * cache : caches())
+    {
+      held.emplace_back(cache, cache->bytes_());
+      total += held.back().second;
+    }
+
+    bool pressure = failed;
+    if (std::chrono::duration<double>(now - lastPoll_).count() >= PRESSURE_POLL_SECONDS)
+    {
+      lastPoll_ = now;
+      pressure |= cgroupPressure();
+
+      if (!pressure)
+        pressureBudget_ = UNLIMITED;
+    }
+
+    if (pressure)
+    {
+      pressureBudget_ = std::min(pressureBudget_, (std::size_t)(total * PRESSURE_KEEP));
+      logWarning("Memory is short, the caches shrink from ", (long long)total, " to ", (long long)pressureBudget_, " bytes");
+    }
+
+    if (failed && !reserve_)
+      reserve_ = malloc(RESERVE_BYTES);
+
+    const std::size_t limit = budget();
+    if (total <= limit)
+      return false;
+
+    // The caches whose entries are the cheapest to make again give up the most
+    std::stable_sort(held.begin(), held.end(), [] (std::pair<Cache *, std::size_t> const& lhs, std::pair<Cache *, std::size_t> const& rhs) {
+      return lhs.first->cost_ < rhs.first->cost_;
+    });
+
+    std::size_t excess = total - limit;
+    for (auto const& it : held)
+    {
+      if (excess == 0)
+        break;
+
+      if (it.second == 0)
+        continue;
+
+      it.first->shrink_(it.second > excess ? it.second - excess : 0);
+
+      const std::size_t after = it.first->bytes_();
+      excess -= std::min(excess, it.second > after ? it.second - after : 0);
+    }
+
+    return true;
+  }
+
+  std::vector<std::pair<std::string, std::size_t>> usage()
+  {
+    std::vector<std::pair<std::string, std::size_t>> usage;
+    for (Cache const* cache : caches())
+      usage.emplace_back(cache->name_, cache->bytes_());
+
+    return usage;
+  }
+
+  std::vector<Stats> stats()
+  {
+    std::vector<Stats> stats;
+    for (Cache const* cache : caches())
+    {
+      stats.emplace_back();
+      stats.back().name_ = cache->name_;
+      stats.back().bytes_ = cache->bytes_();
+
+      for (Counters const* it : counters())
+      {
+        if (stats.back().name_ != it->name_)
+          continue;
+
+        stats.back().hits_ += it->hits_.load(std::memory_order_relaxed);
+        stats.back().misses_ += it->misses_.load(std::memory_order_relaxed);
+      }
+    }
+
+    return stats;
+  }
+
+  std::size_t budget()
+  {
+    return std::min((std::size_t)std::max(CACHE_MEMORY.toInt(), 0) << 20, pressureBudget_);
+  }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// One memory budget, app_cacheMemory megabytes, for the caches of every buffer and of the
+// editor. A cache reports the bytes it holds and drops entries when asked to. When the
+// caches hold more than the budget together, balance() shrinks them in the order of what
+// their entries cost to make again, the cheapest first.
+//
+// Memory pressure lowers the budget, to half of what the caches held: the cgroup of the
+// process nearing its memory.high or memory.max, or operator new failing, which then takes
+// a reserve put aside for it. Main thread only.
+namespace cache {
+
+  // What it takes to make an entry of a cache again, from the cheapest
+  enum class Cost
+  {
+    DRAW,     // laying out or styling a cell that is drawn
+    DECODE,   // splitting a page of a file again
+    SCAN      // reading a whole column again
+  };
+
+  // Caches are static objects, like tcl::Variable. bytes gives what the cache holds now,
+  // shrink drops entries until it holds at most target bytes.
+  struct Cache
+  {
+    Cache(const char * name, Cost cost, std::size_t (*bytes)(), void (*shrink)(std::size_t target));
+
+    const char * name_;
+    Cost cost_;
+    std::size_t (*bytes_)();
+    void (*shrink_)(std::size_t target);
+  };
+
+  // Lookups of a cache, counted where its entries are looked up: a hit found the entry, a
+  // miss had to make it. Static objects with the name of their cache, from any thread.
+  struct Counters
+  {
+    explicit Counters(const char * name);
+
+    void hit() { hits_.fetch_add(1, std::memory_order_relaxed); }
+    void miss() { misses_.fetch_add(1, std::memory_order_relaxed); }
+
+    const char * name_;
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+  };
+
+  struct Stats
+  {
+    std::string name_;
+    std::size_t bytes_ = 0;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+  };
+
+  // Puts the reserve aside and installs the new handler
+  void initialize();
+
+  // Shrinks the caches when they hold more than the budget or memory is short. Called by
+  // the main loop between events, returns true if a cache was shrunk.
+  bool balance();
+
+  // The name and the bytes of every cache
+  std::vector<std::pair<std::string, std::size_t>> usage();
+
+  // The bytes and the lookups of every cache, none for the caches without Counters
+  std::vector<Stats> stats();
+
+  // Bytes the caches may hold together now, less than app_cacheMemory while memory is short
+  std::size_t budget();
+}
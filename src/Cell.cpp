@@ -1,9 +1,14 @@
 
 #include "Cell.h"
 
+#include <cmath>
+
 static const std::string START = "#{";
 static const std::string END = "}";
 
+// Significant digits of formula values shown without a number format
+static const int DISPLAY_PRECISION = 6;
+
 std::tuple<uint32_t, std::string> parseFormatAndValue(std::string const& str)
 {
   const std::size_t startPos = str.find(START);
@@ -17,6 +22,22 @@ std::tuple<uint32_t, std::string> parseFormatAndValue(std::string const& str)
   return std::make_tuple(format, value);
 }
 
+uint32_t parseFormatAndValue(StrView str, std::string & value)
+{
+  const std::size_t startPos = str.find(StrView(START));
+  const std::size_t endPos = startPos == StrView::npos ? StrView::npos : str.find(StrView(END), startPos);
+
+  if (startPos == StrView::npos || endPos == StrView::npos)
+  {
+    value.assign(str.data(), str.size());
+    return 0;
+  }
+
+  const uint32_t format = std::stod(str.substr(startPos + START.size(), endPos - startPos - START.size()).str());
+  value.assign(str.data(), startPos);
+  return format;
+}
+
 uint32_t parseFormat(std::string const& str)
 {
   if (str.size() < 3)
@@ -31,4 +52,79 @@ std::string formatToStr(uint32_t format)
     return "";
 
   return START + str::fromInt(format) + END;
-}
\ No newline at end of file
+}
+Cell & Cell::operator = (Cell const& copy)
+{
+  if (this == &copy)
+    return *this;
+
+  text = copy.text;
+  format = copy.format;
+  value = copy.value;
+  type = copy.type;
+  evaluated = copy.evaluated;
+  formula.reset(copy.formula ? new Formula(*copy.formula) : nullptr);
+
+  return *this;
+}
+
+void Cell::setFormula(std::vector<Expr> && expression)
+{
+  type = CellType::Formula;
+
+  if (!formula)
+    formula.reset(new Formula());
+
+  std::shared_ptr<FormulaTemplate> pattern = std::make_shared<FormulaTemplate>();
+  pattern->program = compileExpression(expression);
+  pattern->expression = ExprCode(expression);
+
+  formula->pattern = pattern;
+  formula->origin = Index(0, 0);
+}
+
+std::vector<Expr> Cell::expression() const
+{
+  if (!formula)
+    return std::vector<Expr>();
+
+  ExprCode expression = formula->pattern->expression;
+  expression.offset(formula->origin);
+  return expression.decode();
+}
+
+std::string const& Cell::display() const
+{
+  return errorText(type == CellType::Formula ? valueError(value) : FormulaError::None);
+}
+
+std::string Cell::displayValue() const
+{
+  char buffer[str::FORMAT_SIZE];
+  const StrView display = displayValue(buffer);
+  return std::string(display.data(), display.size());
+}
+
+StrView Cell::displayValue(char * buffer) const
+{
+  if (type == CellType::Formula && valueError(value) != FormulaError::None)
+    return display();
+
+  if (type == CellType::Text)
+    return StrView();
+
+  // Microseconds since 1970-01-01, as timestamps are parsed. Values too large for one
+  // show as numbers.
+  if ((format & NUMBER_TIMESTAMP) != 0 && std::abs(value) < 9e18)
+    return StrView(buffer, str::formatTimestamp((long long)value, 1000000, buffer));
+
+  const int decimals = formatDecimals(format);
+  if (type == CellType::Number && decimals < 0 && (format & NUMBER_GROUPED) == 0)
+    return StrView();
+
+  // The formats don't change the text of numbers without one, only of formulas
+  if (decimals < 0 && (format & NUMBER_GROUPED) == 0)
+    return StrView(buffer, str::formatDouble(value, DISPLAY_PRECISION, buffer));
+
+  return StrView(buffer, str::formatFixed(value, decimals < 0 ? 0 : decimals, (format & NUMBER_GROUPED) != 0, buffer));
+}
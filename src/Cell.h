@@ -4,6 +4,8 @@
 #include "Str.h"
 #include "Expression.h"
 
+#include <memory>
+
 static const uint32_t ALIGN_MASK      = 0x0000000F;
 static const uint32_t ALIGN_LEFT      = 0x00000000;
 static const uint32_t ALIGN_RIGHT     = 0x00000001;
@@ -11,19 +13,98 @@ static const uint32_t ALIGN_CENTER    = 0x00000002;
 static const uint32_t FONT_MASK       = 0x000000F0;
 static const uint32_t FONT_BOLD       = 0x00000010;
 static const uint32_t FONT_UNDERLINE  = 0x00000020;
+static const uint32_t DECIMALS_MASK   = 0x00000F00;
+static const uint32_t DECIMALS_SHIFT  = 8;
+static const uint32_t NUMBER_GROUPED  = 0x00001000;
+static const uint32_t NUMBER_TIMESTAMP = 0x00002000;
+
+// Cells keep their format in 16 bits
+static_assert(NUMBER_TIMESTAMP <= 0x8000, "format bits have to fit Cell::format");
+
+// Numbers show with this many fixed decimals, or -1 if the format doesn't set any. The
+// bits hold the decimals plus one.
+static const int MAX_DECIMALS = (DECIMALS_MASK >> DECIMALS_SHIFT) - 1;
+
+inline int formatDecimals(uint32_t format)
+{
+  return (int)((format & DECIMALS_MASK) >> DECIMALS_SHIFT) - 1;
+}
+
+inline uint32_t setFormatDecimals(uint32_t format, int decimals)
+{
+  return (format & ~DECIMALS_MASK) | ((uint32_t)(decimals + 1) << DECIMALS_SHIFT);
+}
 
 std::tuple<uint32_t, std::string> parseFormatAndValue(std::string const& str);
+
+// Returns the format of str and sets value to the rest, reusing the buffer of value
+uint32_t parseFormatAndValue(StrView str, std::string & value);
 uint32_t parseFormat(std::string const& str);
 std::string formatToStr(uint32_t format);
 
-struct Cell
+enum class CellType : uint8_t
+{
+  Text,
+  Number,
+  Formula,
+};
+
+// A formula with its references relative to a cell. Formulas that only differ by where
+// they are, like the ones filling a column, share one template and its program.
+struct FormulaTemplate
+{
+  ExprCode expression;
+  Program program;
+
+  // Only set for shared templates, getting the text of a formula from it needs no
+  // serializing of its expression
+  ExprText text;
+};
+
+// What only formulas need. The references of pattern are relative to origin. The value
+// of a formula is formatted when it is shown, an error is held in the value.
+struct Formula
 {
-  std::string text;
-  std::string display;
-  uint32_t format = 0;
+  std::shared_ptr<const FormulaTemplate> pattern;
+  Index origin;
+};
 
+// The text of a cell is interned in the string pool of its document. The formula part
+// is only allocated for formulas, so a cell takes 24 bytes. What evaluation reads, the
+// value, type and evaluated flag, comes first and shares the first 16 bytes with the
+// text and format, the formula is only followed for formula cells.
+struct Cell
+{
   double value = 0.0;
-  bool hasExpression = false;
+  uint32_t text = 0;
+  uint16_t format = 0;
+  CellType type = CellType::Text;
   bool evaluated = false;
-  std::vector<Expr> expression;
+
+  std::unique_ptr<Formula> formula;
+
+  Cell() { }
+  Cell(Cell const& copy) { *this = copy; }
+  Cell(Cell && other) = default;
+
+  Cell & operator = (Cell const& copy);
+  Cell & operator = (Cell && other) = default;
+
+  bool hasExpression() const { return type == CellType::Formula; }
+
+  // Turns the cell into a formula of expression, with a template of its own
+  void setFormula(std::vector<Expr> && expression);
+
+  // The expression with absolute references, empty unless the cell is a formula
+  std::vector<Expr> expression() const;
+
+  // The text of the error of a formula, empty for anything else
+  std::string const& display() const;
+
+  // Numbers and evaluated formulas shown with format, or an empty string for cells that
+  // show their text. The second form formats into buffer, of str::FORMAT_SIZE chars.
+  std::string displayValue() const;
+  StrView displayValue(char * buffer) const;
 };
+
+static_assert(sizeof(Cell) <= 24, "tiles hold TILE_SIZE cells, keep them small");
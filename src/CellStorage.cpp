@@ -0,0 +1,665 @@
+
+#include "CellStorage.h"
+#include "Memory.h"
+#include "bx/platform.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+#if BX_COMPILER_MSVC
+#  include <intrin.h>
+#endif
+
+static_assert(CellStorage::TILE_HEIGHT == 64, "a column of a tile has a word of occupancy bits");
+
+CellStorage::CellStorage(CellStorage && other)
+  : directory_(std::move(other.directory_)),
+    size_(other.size_),
+    file_(std::move(other.file_)),
+    epoch_(other.epoch_)
+{
+  other.directory_ = std::make_shared<Directory>();
+  other.size_ = 0;
+}
+
+CellStorage & CellStorage::operator = (CellStorage && other)
+{
+  directory_ = std::move(other.directory_);
+  size_ = other.size_;
+  file_ = std::move(other.file_);
+  epoch_ = other.epoch_;
+  other.directory_ = std::make_shared<Directory>();
+  other.size_ = 0;
+  return *this;
+}
+
+bool CellStorage::useTileFile(std::string const& directory, std::size_t budget)
+{
+  if (size_ > 0)
+    return false;
+
+  std::shared_ptr<TileFile> file = std::make_shared<TileFile>(sizeof(Tile), budget);
+  if (!file->open(directory))
+    return false;
+
+  clear();
+  file_ = std::move(file);
+  return true;
+}
+
+std::shared_ptr<CellStorage::Tile> CellStorage::newTile(Tile const* copy)
+{
+  void * slot = file_ ? file_->allocate() : nullptr;
+
+  // A full tile file leaves the tiles on the heap
+  if (!slot)
+    return copy ? std::make_shared<Tile>(*copy) : std::make_shared<Tile>();
+
+  Tile * tile = copy ? new (slot) Tile(*copy) : new (slot) Tile();
+  file_->touch(tile);
+
+  // The tile keeps the file alive, a copy of the storage may outlive the original
+  std::shared_ptr<TileFile> file = file_;
+  return std::shared_ptr<Tile>(tile, [file] (Tile * tile) {
+    tile->~Tile();
+    file->release(tile);
+  });
+}
+
+CellStorage::Tile * CellStorage::writable(std::shared_ptr<Tile> & tile)
+{
+  if (tile.use_count() > 1)
+    tile = newTile(tile.get());
+  else
+  {
+    // A copy that shared the tile may just have been destroyed on another thread, what
+    // it read has to happen before the tile changes
+    std::atomic_thread_fence(std::memory_order_acquire);
+  }
+
+  return tile.get();
+}
+
+CellStorage::Tile * CellStorage::written(std::shared_ptr<Tile> & tile)
+{
+  Tile * result = writable(tile);
+  result->written_ = epoch_;
+  return result;
+}
+
+CellStorage::Directory & CellStorage::writableDirectory()
+{
+  // Copying the directory shares every tile with the copies still holding the old one
+  if (directory_.use_count() > 1)
+    directory_ = std::make_shared<Directory>(*directory_);
+  else
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+  return *directory_;
+}
+
+std::shared_ptr<CellStorage::Tile> * CellStorage::findTileSlot(Directory & directory, int tx, int ty) const
+{
+  std::shared_ptr<Tile> * tile = nullptr;
+
+  // A tile left of or above the first has no place in the dense directory
+  if (tx >= 0 && ty >= 0 && tx < DENSE_TILE_COLUMNS && ty < DENSE_TILE_ROWS)
+  {
+    if (ty >= (int)directory.rows_.size() || tx >= (int)directory.rows_[ty].size() || !directory.rows_[ty][tx])
+      return nullptr;
+
+    tile = &directory.rows_[ty][tx];
+  }
+  else
+    tile = directory.sparse_.find(tileKey(tx, ty));
+
+  if (tile && file_)
+    file_->touch(tile->get());
+
+  return tile;
+}
+
+CellStorage::Tile * CellStorage::findTile(int tx, int ty) const
+{
+  std::shared_ptr<Tile> const* tile = findTileSlot(*directory_, tx, ty);
+  return tile ? tile->get() : nullptr;
+}
+
+CellStorage::Tile * CellStorage::findWritableTile(int tx, int ty)
+{
+  std::shared_ptr<Tile> * tile = findTileSlot(writableDirectory(), tx, ty);
+  return tile ? writable(*tile) : nullptr;
+}
+
+CellStorage::Tile * CellStorage::getTile(int tx, int ty)
+{
+  Directory & directory = writableDirectory();
+  std::shared_ptr<Tile> * tile = nullptr;
+
+  if (tx < DENSE_TILE_COLUMNS && ty < DENSE_TILE_ROWS)
+  {
+    if (ty >= (int)directory.rows_.size())
+      directory.rows_.resize(ty + 1);
+
+    if (tx >= (int)directory.rows_[ty].size())
+      directory.rows_[ty].resize(tx + 1);
+
+    tile = &directory.rows_[ty][tx];
+  }
+  else
+  {
+    tile = &directory.sparse_[tileKey(tx, ty)];
+  }
+
+  if (!*tile)
+    *tile = newTile(nullptr);
+  else if (file_)
+    file_->touch(tile->get());
+
+  return written(*tile);
+}
+
+void CellStorage::releaseTile(int tx, int ty)
+{
+  Directory & directory = writableDirectory();
+
+  if (tx < DENSE_TILE_COLUMNS && ty < DENSE_TILE_ROWS)
+    directory.rows_[ty][tx].reset();
+  else
+    directory.sparse_.erase(tileKey(tx, ty));
+
+  directory.released_[tileKey(tx, ty)] = epoch_;
+}
+
+Cell & CellStorage::get(Index const& idx)
+{
+  assert(idx.x >= 0 && idx.y >= 0);
+
+  Tile * tile = getTile(idx.x / TILE_WIDTH, idx.y / TILE_HEIGHT);
+  const int slot = slotOf(idx);
+
+  if (!tile->isUsed(slot))
+  {
+    tile->setUsed(slot, true);
+    tile->count_++;
+    size_++;
+  }
+
+  // The caller may change the cell, so the cached sums can't be trusted anymore
+  tile->summed_ = false;
+  return tile->cells_[slot];
+}
+
+Cell * CellStorage::find(Index const& idx)
+{
+  if (idx.x < 0 || idx.y < 0)
+    return nullptr;
+
+  // A miss leaves a shared directory alone
+  const int tx = idx.x / TILE_WIDTH;
+  const int ty = idx.y / TILE_HEIGHT;
+  const int slot = slotOf(idx);
+
+  Tile const* tile = findTile(tx, ty);
+  if (!tile || !tile->isUsed(slot))
+    return nullptr;
+
+  return &findWritableTile(tx, ty)->cells_[slot];
+}
+
+Cell const* CellStorage::find(Index const& idx) const
+{
+  if (idx.x < 0 || idx.y < 0)
+    return nullptr;
+
+  Tile const* tile = findTile(idx.x / TILE_WIDTH, idx.y / TILE_HEIGHT);
+  if (!tile)
+    return nullptr;
+
+  const int slot = slotOf(idx);
+  return tile->isUsed(slot) ? &tile->cells_[slot] : nullptr;
+}
+
+void CellStorage::erase(Index const& idx)
+{
+  if (idx.x < 0 || idx.y < 0)
+    return;
+
+  const int tx = idx.x / TILE_WIDTH;
+  const int ty = idx.y / TILE_HEIGHT;
+
+  Tile * tile = findTile(tx, ty);
+  const int slot = slotOf(idx);
+
+  if (!tile || !tile->isUsed(slot))
+    return;
+
+  tile = findWritableTile(tx, ty);
+  tile->written_ = epoch_;
+  tile->cells_[slot] = Cell();
+  tile->setUsed(slot, false);
+  tile->count_--;
+  size_--;
+  tile->summed_ = false;
+
+  if (tile->count_ == 0)
+    releaseTile(tx, ty);
+}
+
+void CellStorage::Tile::setUsed(int slot, bool used)
+{
+  const uint64_t bit = (uint64_t)1 << (slot % 64);
+  const uint64_t rowBit = (uint64_t)1 << (slot / TILE_WIDTH);
+
+  if (used)
+  {
+    used_[slot / 64] |= bit;
+    columnUsed_[slot % TILE_WIDTH] |= rowBit;
+  }
+  else
+  {
+    used_[slot / 64] &= ~bit;
+    columnUsed_[slot % TILE_WIDTH] &= ~rowBit;
+  }
+}
+
+// The lowest set bit of bits, or the highest one if not forward. bits can't be 0.
+static int firstBit(uint64_t bits, bool forward)
+{
+#if BX_COMPILER_MSVC
+  unsigned long index;
+  if (forward)
+    _BitScanForward64(&index, bits);
+  else
+    _BitScanReverse64(&index, bits);
+  return index;
+#else
+  return forward ? __builtin_ctzll(bits) : 63 - __builtin_clzll(bits);
+#endif
+}
+
+int CellStorage::findFilled(int Index::* axis, Index const& from, int last, bool filled) const
+{
+  if (from.x < 0 || from.y < 0)
+    return -1;
+
+  const bool alongRow = axis == &Index::x;
+  const int span = alongRow ? TILE_WIDTH : TILE_HEIGHT;
+  const bool forward = last >= from.*axis;
+
+  if (!forward)
+    last = std::max(last, 0);
+
+  Index idx = from;
+  int & pos = idx.*axis;
+
+  while (forward ? pos <= last : pos >= last)
+  {
+    const int tileFirst = pos - pos % span;
+    const int begin = pos - tileFirst;
+    const int end = (forward ? std::min(last, tileFirst + span - 1) : std::max(last, tileFirst)) - tileFirst;
+
+    // The bits of the offsets from begin to end within the tile
+    const uint64_t range = (~(uint64_t)0 >> (63 - std::max(begin, end))) & (~(uint64_t)0 << std::min(begin, end));
+
+    Tile const* tile = findTile(idx.x / TILE_WIDTH, idx.y / TILE_HEIGHT);
+    uint64_t stored = 0;
+    if (tile && alongRow)
+    {
+      const int shift = (idx.y % TILE_HEIGHT) * TILE_WIDTH;
+      stored = (tile->used_[shift / 64] >> (shift % 64)) & (((uint64_t)1 << TILE_WIDTH) - 1);
+    }
+    else if (tile)
+      stored = tile->columnUsed_[idx.x % TILE_WIDTH];
+
+    stored &= range;
+
+    // Looking for a cell without anything, the first one that isn't stored ends the
+    // search unless a stored one before it holds nothing
+    const uint64_t free = ~stored & range;
+    uint64_t candidates = stored;
+    if (!filled && free)
+    {
+      const int gap = firstBit(free, forward);
+      candidates &= forward ? ((uint64_t)1 << gap) - 1 : ~(uint64_t)0 << gap << 1;
+    }
+
+    while (candidates)
+    {
+      const int offset = firstBit(candidates, forward);
+      candidates &= ~((uint64_t)1 << offset);
+
+      const int slot = alongRow ? (idx.y % TILE_HEIGHT) * TILE_WIDTH + offset : offset * TILE_WIDTH + idx.x % TILE_WIDTH;
+      Cell const& cell = tile->cells_[slot];
+      if ((cell.text != 0 || cell.hasExpression()) == filled)
+        return tileFirst + offset;
+    }
+
+    if (!filled && free)
+      return tileFirst + firstBit(free, forward);
+
+    pos = forward ? tileFirst + span : tileFirst - 1;
+  }
+
+  return -1;
+}
+
+void CellStorage::shift(int Index::* axis, int first, int delta)
+{
+  if (delta == 0)
+    return;
+
+  std::vector<Index> moved;
+  std::vector<Index> removed;
+
+  static_cast<CellStorage const&>(*this).forEach([&] (Index const& idx, Cell const&) {
+    if (idx.*axis >= first)
+      moved.push_back(idx);
+    else if (idx.*axis >= first + delta)
+      removed.push_back(idx);
+  });
+
+  for (auto const& idx : removed)
+    erase(idx);
+
+  // Cells are visited in row-major order. Moving forward has to start with the last
+  // cell and moving backward with the first, so a cell never lands on one yet to move.
+  if (delta > 0)
+    std::reverse(moved.begin(), moved.end());
+
+  for (auto const& idx : moved)
+  {
+    Index target = idx;
+    target.*axis += delta;
+
+    Cell & cell = get(target);
+    cell = std::move(*find(idx));
+    erase(idx);
+  }
+}
+
+void CellStorage::permuteRows(int first, std::vector<uint32_t> const& order)
+{
+  const int last = first + (int)order.size();
+
+  std::vector<int> targets(order.size());
+  for (std::size_t i = 0; i < order.size(); ++i)
+    targets[order[i]] = first + (int)i;
+
+  std::vector<Index> sources;
+
+  static_cast<CellStorage const&>(*this).forEach([&] (Index const& idx, Cell const&) {
+    if (idx.y >= first && idx.y < last && targets[idx.y - first] != idx.y)
+      sources.push_back(idx);
+  });
+
+  // Park the cells that move, a target may still hold a cell that hasn't moved yet
+  std::vector<Cell> parked;
+  parked.reserve(sources.size());
+
+  for (auto const& idx : sources)
+  {
+    parked.push_back(std::move(*find(idx)));
+    erase(idx);
+  }
+
+  // Filled in row-major order of the targets, so every tile is written at once instead
+  // of once per row that moves into it. That matters most when tiles have to be paged
+  // in. The cells of a source row are next to each other in sources.
+  std::vector<uint32_t> rowStart(order.size() + 1, 0);
+  for (auto const& idx : sources)
+    rowStart[idx.y - first + 1]++;
+
+  for (std::size_t i = 1; i < rowStart.size(); ++i)
+    rowStart[i] += rowStart[i - 1];
+
+  for (std::size_t i = 0; i < order.size(); ++i)
+    for (uint32_t k = rowStart[order[i]]; k < rowStart[order[i] + 1]; ++k)
+      get(Index(sources[k].x, first + (int)i)) = std::move(parked[k]);
+}
+
+void CellStorage::remapTexts(std::vector<uint32_t> const& ids)
+{
+  for (TileRef const& ref : sortedTiles(false))
+  {
+    if (file_)
+      file_->touch(ref.tile);
+
+    bool changes = false;
+    for (int slot = 0; slot < TILE_SIZE && !changes; ++slot)
+      changes = ref.tile->isUsed(slot) && ids[ref.tile->cells_[slot].text] != ref.tile->cells_[slot].text;
+
+    if (!changes)
+      continue;
+
+    Tile * tile = written(*findTileSlot(writableDirectory(), ref.x, ref.y));
+    for (int slot = 0; slot < TILE_SIZE; ++slot)
+      if (tile->isUsed(slot))
+        tile->cells_[slot].text = ids[tile->cells_[slot].text];
+
+    // The zones hold the ids
+    tile->summed_ = false;
+  }
+}
+
+std::size_t CellStorage::compact(std::size_t count)
+{
+  Directory const& current = *directory_;
+
+  bool untrimmed = !current.rows_.empty() && current.rows_.back().empty();
+  for (auto const& row : current.rows_)
+    untrimmed = untrimmed || (!row.empty() && !row.back());
+
+  if (untrimmed)
+  {
+    Directory & directory = writableDirectory();
+    for (auto & row : directory.rows_)
+    {
+      while (!row.empty() && !row.back())
+        row.pop_back();
+
+      row.shrink_to_fit();
+    }
+
+    while (!directory.rows_.empty() && directory.rows_.back().empty())
+      directory.rows_.pop_back();
+
+    directory.rows_.shrink_to_fit();
+  }
+
+  if (!file_)
+    return 0;
+
+  std::size_t moved = 0;
+  for (TileRef const& ref : sortedTiles(false))
+  {
+    if (moved == count)
+      break;
+
+    // A tile a full file left on the heap moves into it too
+    if (file_->firstFree() >= file_->indexOf(ref.tile))
+      continue;
+
+    std::shared_ptr<Tile> & slot = *findTileSlot(writableDirectory(), ref.x, ref.y);
+    if (slot.use_count() > 1)
+      continue;
+
+    std::shared_ptr<Tile> tile = newTile(nullptr);
+    if (file_->indexOf(tile.get()) >= file_->indexOf(slot.get()))
+      break;
+
+    // Moved rather than copied, the formulas stay where they are
+    *tile = std::move(*slot);
+    slot = std::move(tile);
+    moved++;
+  }
+
+  file_->shrink();
+  return moved;
+}
+
+void CellStorage::Tile::updateSums()
+{
+  formulaColumns_ = 0;
+
+  for (auto & zone : zones_)
+    zone = Zone();
+
+  // Transpose the numbers into values_, empty and formula cells count as zero
+  for (int slot = 0; slot < TILE_SIZE; ++slot)
+  {
+    const int x = slot % TILE_WIDTH;
+    const int y = slot / TILE_WIDTH;
+    double & value = values_[x * TILE_HEIGHT + y];
+
+    value = 0.0;
+    if (!isUsed(slot))
+      continue;
+
+    Cell const& cell = cells_[slot];
+    Zone & zone = zones_[x];
+    zone.cells++;
+
+    if (cell.type == CellType::Formula)
+    {
+      formulaColumns_ |= 1u << x;
+      zone.formulas = true;
+      continue;
+    }
+
+    value = cell.value;
+    zone.bloom |= Zone::bloomBit(cell.text);
+
+    if (cell.type == CellType::Text)
+      zone.text = true;
+    else if (zone.numbers++ == 0)
+      zone.min = zone.max = value;
+    else
+    {
+      zone.min = value < zone.min ? value : zone.min;
+      zone.max = value > zone.max ? value : zone.max;
+    }
+  }
+
+  for (int x = 0; x < TILE_WIDTH; ++x)
+    columnSums_[x] = reduce::sum(&values_[x * TILE_HEIGHT], TILE_HEIGHT);
+
+  summed_ = true;
+}
+
+void CellStorage::zone(int x, int y, Zone & zone)
+{
+  Tile * tile = x < 0 || y < 0 ? nullptr : findTile(x / TILE_WIDTH, y / TILE_HEIGHT);
+  if (!tile)
+  {
+    zone = Zone();
+    return;
+  }
+
+  if (!tile->summed_)
+    tile->updateSums();
+
+  zone = tile->zones_[x % TILE_WIDTH];
+}
+
+void CellStorage::updateSums()
+{
+  auto update = [this] (Tile * tile) {
+    if (file_)
+      file_->touch(tile);
+
+    if (!tile->summed_)
+      tile->updateSums();
+  };
+
+  for (auto & row : directory_->rows_)
+    for (auto & tile : row)
+      if (tile)
+        update(tile.get());
+
+  for (auto & it : directory_->sparse_)
+    update(it.second.get());
+}
+
+void CellStorage::unshare()
+{
+  Directory & directory = writableDirectory();
+
+  for (auto & row : directory.rows_)
+    for (auto & tile : row)
+      if (tile)
+        writable(tile);
+
+  for (auto & it : directory.sparse_)
+    writable(it.second);
+}
+
+void CellStorage::clear()
+{
+  // The tile file stays, new tiles still go into it. Copies keep the old directory.
+  directory_ = std::make_shared<Directory>();
+  directory_->cleared_ = epoch_;
+  size_ = 0;
+}
+
+// With writable set the tiles shared with other storages are copied first, and stamped
+std::vector<CellStorage::TileRef> CellStorage::sortedTiles(bool writable, int firstRow, int lastRow)
+{
+  std::vector<TileRef> tiles;
+  Directory & directory = writable ? writableDirectory() : *directory_;
+
+  const std::size_t rowEnd = std::min<std::size_t>(directory.rows_.size(), (std::size_t)lastRow + 1);
+  for (std::size_t y = firstRow; y < rowEnd; ++y)
+    for (std::size_t x = 0; x < directory.rows_[y].size(); ++x)
+      if (directory.rows_[y][x])
+        tiles.push_back({ (int)x, (int)y, writable ? written(directory.rows_[y][x]) : directory.rows_[y][x].get() });
+
+  if (!directory.sparse_.empty())
+  {
+    for (auto & it : directory.sparse_)
+    {
+      const int y = it.first >> 32;
+      if (y >= firstRow && y <= lastRow)
+        tiles.push_back({ (int)(uint32_t)it.first, y, writable ? written(it.second) : it.second.get() });
+    }
+
+    std::sort(tiles.begin(), tiles.end(), [] (TileRef const& lhs, TileRef const& rhs) -> bool {
+      return lhs.y < rhs.y || (lhs.y == rhs.y && lhs.x < rhs.x);
+    });
+  }
+
+  return tiles;
+}
+
+std::size_t CellStorage::memoryUsage() const
+{
+  // A directory shared by several storages is split between them too
+  Directory const& directory = *directory_;
+  const std::size_t sharing = directory_.use_count();
+
+  std::size_t bytes = memory::bytes(directory.rows_) + directory.sparse_.memoryUsage() + directory.released_.memoryUsage();
+
+  auto tileBytes = [this] (std::shared_ptr<Tile> const& tile) -> std::size_t {
+    return file_ && file_->holds(tile.get()) ? 0 : sizeof(Tile) / tile.use_count();
+  };
+
+  for (auto const& it : directory.sparse_)
+    bytes += tileBytes(it.second);
+
+  for (auto const& row : directory.rows_)
+  {
+    bytes += memory::bytes(row);
+    for (auto const& tile : row)
+      if (tile)
+        bytes += tileBytes(tile);
+  }
+
+  bytes /= sharing;
+
+  if (file_)
+    bytes += file_->residentSlots() * file_->slotSize();
+
+  return bytes;
+}
@@ -0,0 +1,552 @@
+#pragma once
+
+#include "Cell.h"
+#include "Index.h"
+#include "Reduce.h"
+#include "FlatHashMap.h"
+#include "MurmurHash.h"
+#include "TileFile.h"
+
+#include <vector>
+#include <algorithm>
+#include <climits>
+#include <memory>
+
+// Chunked cell store. Cells live in fixed size tiles that are allocated on first
+// write and kept in a row-major tile directory, so neighbouring cells share memory
+// and looking up a cell is two array indexings instead of a hash probe. Tiles that
+// fall outside the dense directory are kept in a sparse map instead.
+//
+// Every tile also caches the sum of the numbers in each of its columns, so summing
+// a long column range only visits the tiles instead of every cell, and a zone map of
+// each column that lets scans skip the tiles none of whose cells can match. The cache
+// is dropped by get() and erase(). find() is meant for evaluation and must only be
+// used to change the value of formula cells, those are never part of the cache.
+//
+// Copies share their tiles, a shared tile is copied by whichever storage hands out a
+// cell of it that may change. They share the tile directory too, so copying a storage
+// only bumps a reference count. The first change after a copy copies the directory,
+// and the copy can be read on another thread through its const members while the
+// original keeps changing. Whatever is last to let go of a tile or directory frees it.
+//
+// The tiles can also live in a TileFile, for documents that don't fit in memory. What
+// formulas own stays on the heap, the tiles themselves are paged in and out of the
+// file. Copies share the file.
+//
+// Whatever may change a cell other than the value of a formula stamps its tile with the
+// current epoch, so a save that starts a new one can later tell the tiles written since.
+// find() doesn't stamp, it only changes formulas, and neither does unshare().
+class CellStorage
+{
+  public:
+    static const int TILE_WIDTH = 16;
+    static const int TILE_HEIGHT = 64;
+    static const int TILE_SIZE = TILE_WIDTH * TILE_HEIGHT;
+
+    static const int DENSE_TILE_COLUMNS = 64;
+    // The directory only grows as far as the rows written, so it can cover 256M rows
+    static const int DENSE_TILE_ROWS = 1 << 22;
+
+    // What a tile knows of the cells of one of its columns, empty cells are the ones
+    // that aren't stored. The range only holds the values of the number cells.
+    struct Zone
+    {
+      int cells = 0;
+      int numbers = 0;
+      double min = 0.0;
+      double max = 0.0;
+      bool text = false;
+      bool formulas = false;
+
+      // One word bloom filter of the text ids of the text and number cells
+      uint64_t bloom = 0;
+
+      static uint64_t bloomBit(uint32_t id) { return (uint64_t)1 << (murmurMix64(id) & 63); }
+      bool mayHoldText(uint32_t id) const { return (bloom & bloomBit(id)) != 0; }
+    };
+
+  public:
+    CellStorage() { }
+    CellStorage(CellStorage const& copy) = default;
+    CellStorage(CellStorage && other);
+
+    CellStorage & operator = (CellStorage const& copy) = default;
+    CellStorage & operator = (CellStorage && other);
+
+    // Returns the cell at idx, creating it if it does not exist.
+    Cell & get(Index const& idx);
+
+    // Returns the cell at idx or nullptr. Never creates a cell.
+    Cell * find(Index const& idx);
+    Cell const* find(Index const& idx) const;
+
+    bool has(Index const& idx) const { return find(idx) != nullptr; }
+    void erase(Index const& idx);
+    void clear();
+
+    // Moves every cell at or after first along axis by delta, in place. With a negative
+    // delta the cells in the -delta lines before first are removed.
+    void shift(int Index::* axis, int first, int delta);
+
+    // Moves the cells of row first + order[i] to row first + i, in place. order has to
+    // be a permutation of 0 .. order.size() - 1.
+    void permuteRows(int first, std::vector<uint32_t> const& order);
+
+    std::size_t size() const { return size_; }
+
+    // Replaces the text of every cell by ids[text], after a StringPool::compact(). Only
+    // the tiles with a text that changes are copied and stamped.
+    void remapTexts(std::vector<uint32_t> const& ids);
+
+    // Moves up to count tiles of a tile file, in row-major order, to the free slots nearer
+    // the front of the file and gives back the chunks this frees at its end. Tiles shared
+    // with other storages stay where they are. Also trims the tile directory to the rows
+    // and columns that have tiles. Returns the tiles moved, fewer than count once there
+    // are no more to move.
+    std::size_t compact(std::size_t count);
+
+    // The first position from from towards last along axis, both inclusive, whose cell
+    // holds something, or with filled false the first one whose cell doesn't. A cell holds
+    // something when it is stored with a text or a formula, a cell that only keeps a
+    // format doesn't. Returns -1 if there is none. The occupancy bits of a tile skip all
+    // of its cells along the line at once, only the stored cells are read.
+    int findFilled(int Index::* axis, Index const& from, int last, bool filled) const;
+
+    uint64_t epoch() const { return epoch_; }
+    void startEpoch() { epoch_++; }
+
+    // Calls func(x, y) with the first cell of every tile written or removed in epoch since
+    // or a later one. Returns false instead if the storage was cleared since.
+    template <typename Func>
+    bool forEachTileWrittenSince(uint64_t since, Func const& func) const;
+
+    // Keeps the tiles in a scratch file in directory from now on, with at most about
+    // budget bytes of them in memory. Only an empty storage can switch, returns false
+    // if it isn't or the file can't be created.
+    bool useTileFile(std::string const& directory, std::size_t budget);
+    TileFile const* tileFile() const { return file_.get(); }
+
+    // Bytes of the tiles and the tile directory. What formula cells own is not included,
+    // and a tile shared by several storages is split between them. Of the tiles in a
+    // tile file only the ones in memory count.
+    std::size_t memoryUsage() const;
+
+    // Sums the values in column x from row first to row last, both inclusive. Numbers
+    // come from the per tile cache, formula cells are passed to evaluate(idx, cell)
+    // which returns their value.
+    template <typename Func>
+    double sumColumn(int x, int first, int last, Func const& evaluate);
+
+    // Adds the numbers in column x from row first to row last, both inclusive, to stats.
+    // Whole tiles come from the per tile cache, formula cells are passed to evaluate(idx,
+    // cell) which returns their value, or NaN to leave them out.
+    template <typename Func>
+    void statsColumn(int x, int first, int last, reduce::Stats & stats, Func const& evaluate);
+
+    // Writes the values of the count cells of column x from row first on to values, with
+    // 0 for the cells that aren't stored. Numbers come from the per tile cache, formula
+    // cells are passed to evaluate(idx, cell) which returns their value.
+    template <typename Func>
+    void columnValues(int x, int first, int count, double * values, Func const& evaluate);
+
+    // Fills zone with what the tile holding row y knows of column x. The tile covers the
+    // TILE_HEIGHT rows from y - y % TILE_HEIGHT on, zone is empty if it doesn't exist.
+    void zone(int x, int y, Zone & zone);
+
+    // Visits the formula cells in column x from row first to row last, both inclusive.
+    // Tiles without a formula in the column are skipped.
+    template <typename Func>
+    void forEachFormula(int x, int first, int last, Func const& func);
+
+    // Rebuilds every stale column sum. Afterwards, and until a cell is changed again,
+    // sumColumn() and statsColumn() only read the tiles of columns without formulas and
+    // can be called from several threads.
+    void updateSums();
+
+    // Copies the tiles shared with other storages. Until the storage is copied again,
+    // find() then never has to copy a tile and can be called from several threads.
+    void unshare();
+
+    // Visits every stored cell in row-major order.
+    template <typename Func>
+    void forEach(Func const& func);
+
+    // Visits every stored cell tile by tile, in the order the tiles are in their tile
+    // file, so the file is read front to back. Without one the order is row-major.
+    template <typename Func>
+    void forEachInStorageOrder(Func const& func);
+
+    template <typename Func>
+    void forEach(Func const& func) const;
+
+    // Visits the stored cells from row first to row last, both inclusive, in row-major
+    // order. Only the tiles holding those rows are looked at.
+    template <typename Func>
+    void forEachInRows(int first, int last, Func const& func) const;
+
+  private:
+    struct Tile
+    {
+      Cell cells_[TILE_SIZE];
+      uint64_t used_[TILE_SIZE / 64] = { 0 };
+      int count_ = 0;
+
+      // used_ transposed, a bit per row for each column
+      uint64_t columnUsed_[TILE_WIDTH] = { 0 };
+
+      // Column sums of the numbers in this tile, valid while summed_ is set. Columns
+      // with a bit set in formulaColumns_ contain formulas and have to be visited.
+      // values_ holds the numbers column by column, so partial columns can be
+      // reduced from contiguous memory. The zones are rebuilt along with the sums.
+      double columnSums_[TILE_WIDTH];
+      double values_[TILE_SIZE];
+      Zone zones_[TILE_WIDTH];
+      uint32_t formulaColumns_ = 0;
+      bool summed_ = false;
+
+      // The epoch it was last written in
+      uint64_t written_ = 0;
+
+      bool isUsed(int slot) const { return (used_[slot / 64] >> (slot % 64)) & 1; }
+      void setUsed(int slot, bool used);
+      void updateSums();
+    };
+
+    struct TileRef
+    {
+      int x;
+      int y;
+      Tile * tile;
+    };
+
+    static uint64_t tileKey(int tx, int ty) { return Index(tx, ty).key(); }
+    static int slotOf(Index const& idx) { return (idx.y % TILE_HEIGHT) * TILE_WIDTH + (idx.x % TILE_WIDTH); }
+
+    // Returns tile, copied first if another storage shares it
+    Tile * writable(std::shared_ptr<Tile> & tile);
+
+    // The same for a tile whose cells may change, stamped with the epoch
+    Tile * written(std::shared_ptr<Tile> & tile);
+
+    // A new tile, a copy of copy if it is set. It is placed in the tile file if there is one.
+    std::shared_ptr<Tile> newTile(Tile const* copy);
+
+    struct Directory
+    {
+      std::vector<std::vector<std::shared_ptr<Tile>>> rows_;
+      FlatHashMap<std::shared_ptr<Tile>> sparse_;
+
+      // The epoch each tile was last removed in, and the one the storage was cleared in
+      FlatHashMap<uint64_t> released_;
+      uint64_t cleared_ = 0;
+    };
+
+    // Returns the directory, copied first if another storage shares it
+    Directory & writableDirectory();
+
+    std::shared_ptr<Tile> * findTileSlot(Directory & directory, int tx, int ty) const;
+    Tile * findTile(int tx, int ty) const;
+    Tile * findWritableTile(int tx, int ty);
+    Tile * getTile(int tx, int ty);
+    void releaseTile(int tx, int ty);
+
+    // The tiles of the tile rows from firstRow to lastRow in row-major order
+    std::vector<TileRef> sortedTiles(bool writable, int firstRow = 0, int lastRow = INT_MAX);
+
+    template <typename Func>
+    static void visitTile(TileRef const& ref, Func const& func);
+
+    template <typename Func>
+    void visit(Func const& func, bool writable, int first = 0, int last = INT_MAX);
+
+    // Calls func(tile, tileFirst, begin, end, formulas) for every tile of column x with rows
+    // from first to last, both inclusive, where begin to end are the rows of the tile in
+    // that range and formulas tells whether the column of the tile holds any. The sums
+    // of the tile are up to date, and a tile with formulas is writable as evaluating them
+    // changes them. func gets nullptr for a tile that isn't stored.
+    template <typename Func>
+    void visitColumnTiles(int x, int first, int last, Func const& func);
+
+  private:
+    std::shared_ptr<Directory> directory_ = std::make_shared<Directory>();
+    std::size_t size_ = 0;
+    std::shared_ptr<TileFile> file_;
+    uint64_t epoch_ = 1;
+};
+
+template <typename Func>
+void CellStorage::forEach(Func const& func)
+{
+  visit(func, true);
+}
+
+template <typename Func>
+void CellStorage::visit(Func const& func, bool writable, int first, int last)
+{
+  const std::vector<TileRef> tiles = sortedTiles(writable, first / TILE_HEIGHT, last / TILE_HEIGHT);
+
+  for (std::size_t begin = 0; begin < tiles.size(); )
+  {
+    // Find all tiles in the same tile row
+    std::size_t end = begin;
+    while (end < tiles.size() && tiles[end].y == tiles[begin].y)
+      end++;
+
+    if (file_)
+      for (std::size_t t = begin; t < end; ++t)
+        file_->touch(tiles[t].tile);
+
+    const int tileFirst = tiles[begin].y * TILE_HEIGHT;
+    const int firstY = std::max(first - tileFirst, 0);
+    const int lastY = std::min(last - tileFirst, TILE_HEIGHT - 1);
+
+    for (int y = firstY; y <= lastY; ++y)
+      for (std::size_t t = begin; t < end; ++t)
+      {
+        Tile * tile = tiles[t].tile;
+        for (int x = 0; x < TILE_WIDTH; ++x)
+        {
+          const int slot = y * TILE_WIDTH + x;
+          if (tile->isUsed(slot))
+            func(Index(tiles[t].x * TILE_WIDTH + x, tiles[t].y * TILE_HEIGHT + y), tile->cells_[slot]);
+        }
+      }
+
+    begin = end;
+  }
+}
+
+template <typename Func>
+void CellStorage::visitTile(TileRef const& ref, Func const& func)
+{
+  for (int slot = 0; slot < TILE_SIZE; ++slot)
+    if (ref.tile->isUsed(slot))
+      func(Index(ref.x * TILE_WIDTH + slot % TILE_WIDTH, ref.y * TILE_HEIGHT + slot / TILE_WIDTH), ref.tile->cells_[slot]);
+}
+
+template <typename Func>
+void CellStorage::forEachInStorageOrder(Func const& func)
+{
+  std::vector<TileRef> tiles = sortedTiles(true);
+
+  if (file_)
+    std::sort(tiles.begin(), tiles.end(), [this] (TileRef const& lhs, TileRef const& rhs) {
+      return file_->indexOf(lhs.tile) < file_->indexOf(rhs.tile);
+    });
+
+  for (auto const& ref : tiles)
+  {
+    if (file_)
+      file_->touch(ref.tile);
+
+    visitTile(ref, func);
+  }
+}
+
+template <typename Func>
+void CellStorage::visitColumnTiles(int x, int first, int last, Func const& func)
+{
+  if (x < 0 || first > last || last < 0)
+    return;
+
+  if (first < 0)
+    first = 0;
+
+  const int tx = x / TILE_WIDTH;
+  const int column = x % TILE_WIDTH;
+
+  for (int ty = first / TILE_HEIGHT; ty <= last / TILE_HEIGHT; ++ty)
+  {
+    const int tileFirst = ty * TILE_HEIGHT;
+    const int begin = std::max(first, tileFirst) - tileFirst;
+    const int end = std::min(last, tileFirst + TILE_HEIGHT - 1) - tileFirst;
+
+    Tile * tile = findTile(tx, ty);
+    if (!tile)
+    {
+      func(nullptr, tileFirst, begin, end, false);
+      continue;
+    }
+
+    if (!tile->summed_)
+      tile->updateSums();
+
+    const bool formulas = (tile->formulaColumns_ & (1u << column)) != 0;
+    if (formulas)
+      tile = findWritableTile(tx, ty);
+
+    func(tile, tileFirst, begin, end, formulas);
+  }
+}
+
+template <typename Func>
+double CellStorage::sumColumn(int x, int first, int last, Func const& evaluate)
+{
+  const int column = x % TILE_WIDTH;
+  double sum = 0.0;
+
+  visitColumnTiles(x, first, last, [&] (Tile * tile, int tileFirst, int begin, int end, bool formulas) {
+    if (!tile)
+      return;
+
+    if (!formulas)
+    {
+      if (tile->zones_[column].numbers == 0)
+        return;
+
+      if (begin == 0 && end == TILE_HEIGHT - 1)
+        sum += tile->columnSums_[column];
+      else
+        sum += reduce::sum(&tile->values_[column * TILE_HEIGHT + begin], end - begin + 1);
+
+      return;
+    }
+
+    for (int y = begin; y <= end; ++y)
+    {
+      const int slot = y * TILE_WIDTH + column;
+      if (!tile->isUsed(slot))
+        continue;
+
+      Cell & cell = tile->cells_[slot];
+      if (cell.type == CellType::Formula)
+        sum += evaluate(Index(x, tileFirst + y), cell);
+      else
+        sum += cell.value;
+    }
+  });
+
+  return sum;
+}
+
+template <typename Func>
+void CellStorage::forEach(Func const& func) const
+{
+  const_cast<CellStorage *>(this)->visit([&func] (Index const& idx, Cell & cell) { func(idx, static_cast<Cell const&>(cell)); }, false);
+}
+
+template <typename Func>
+void CellStorage::forEachInRows(int first, int last, Func const& func) const
+{
+  if (first > last || last < 0)
+    return;
+
+  const_cast<CellStorage *>(this)->visit([&func] (Index const& idx, Cell & cell) { func(idx, static_cast<Cell const&>(cell)); }, false, std::max(first, 0), last);
+}
+
+template <typename Func>
+bool CellStorage::forEachTileWrittenSince(uint64_t since, Func const& func) const
+{
+  Directory const& directory = *directory_;
+  if (directory.cleared_ >= since)
+    return false;
+
+  for (std::size_t y = 0; y < directory.rows_.size(); ++y)
+    for (std::size_t x = 0; x < directory.rows_[y].size(); ++x)
+      if (directory.rows_[y][x] && directory.rows_[y][x]->written_ >= since)
+        func((int)x * TILE_WIDTH, (int)y * TILE_HEIGHT);
+
+  for (auto const& it : directory.sparse_)
+    if (it.second->written_ >= since)
+      func((int)(uint32_t)it.first * TILE_WIDTH, (int)(it.first >> 32) * TILE_HEIGHT);
+
+  for (auto const& it : directory.released_)
+    if (it.second >= since)
+      func((int)(uint32_t)it.first * TILE_WIDTH, (int)(it.first >> 32) * TILE_HEIGHT);
+
+  return true;
+}
+
+template <typename Func>
+void CellStorage::statsColumn(int x, int first, int last, reduce::Stats & stats, Func const& evaluate)
+{
+  const int column = x % TILE_WIDTH;
+
+  visitColumnTiles(x, first, last, [&] (Tile * tile, int tileFirst, int begin, int end, bool formulas) {
+    if (!tile)
+      return;
+
+    Zone const& zone = tile->zones_[column];
+    if (!formulas && zone.numbers == 0)
+      return;
+
+    // Text cells add nothing to the column sum, so a whole column is its zone
+    if (!formulas && begin == 0 && end == TILE_HEIGHT - 1)
+    {
+      reduce::Stats whole;
+      whole.sum_ = tile->columnSums_[column];
+      whole.min_ = zone.min;
+      whole.max_ = zone.max;
+      whole.count_ = zone.numbers;
+
+      stats.merge(whole);
+      return;
+    }
+
+    for (int y = begin; y <= end; ++y)
+    {
+      const int slot = y * TILE_WIDTH + column;
+      if (!tile->isUsed(slot))
+        continue;
+
+      Cell & cell = tile->cells_[slot];
+      if (cell.type == CellType::Formula)
+        stats.add(evaluate(Index(x, tileFirst + y), cell));
+      else if (cell.type == CellType::Number)
+        stats.add(cell.value);
+    }
+  });
+}
+
+template <typename Func>
+void CellStorage::columnValues(int x, int first, int count, double * values, Func const& evaluate)
+{
+  const int column = x % TILE_WIDTH;
+
+  visitColumnTiles(x, first, first + count - 1, [&] (Tile * tile, int tileFirst, int begin, int end, bool formulas) {
+    double * out = values + (tileFirst + begin - first);
+
+    if (!tile)
+    {
+      std::fill(out, out + (end - begin + 1), 0.0);
+      return;
+    }
+
+    if (!formulas)
+    {
+      std::copy(&tile->values_[column * TILE_HEIGHT + begin], &tile->values_[column * TILE_HEIGHT + end + 1], out);
+      return;
+    }
+
+    for (int row = begin; row <= end; ++row)
+    {
+      const int slot = row * TILE_WIDTH + column;
+      Cell & cell = tile->cells_[slot];
+
+      if (!tile->isUsed(slot))
+        *out++ = 0.0;
+      else if (cell.type == CellType::Formula)
+        *out++ = evaluate(Index(x, tileFirst + row), cell);
+      else
+        *out++ = cell.value;
+    }
+  });
+}
+
+template <typename Func>
+void CellStorage::forEachFormula(int x, int first, int last, Func const& func)
+{
+  const int column = x % TILE_WIDTH;
+
+  visitColumnTiles(x, first, last, [&] (Tile * tile, int tileFirst, int begin, int end, bool formulas) {
+    if (!formulas)
+      return;
+
+    for (int y = begin; y <= end; ++y)
+    {
+      const int slot = y * TILE_WIDTH + column;
+      if (tile->isUsed(slot) && tile->cells_[slot].type == CellType::Formula)
+        func(Index(x, tileFirst + y), tile->cells_[slot]);
+    }
+  });
+}
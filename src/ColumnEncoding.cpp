@@ -0,0 +1,568 @@
+#include "ColumnEncoding.h"
+#include "DocumentState.h"
+#include "Scheduler.h"
+#include "Cache.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace encoding {
+
+  // Integers are kept as such up to this magnitude, so the steps between them and the
+  // bounds of a comparison are exact in doubles
+  static const double MAX_INTEGER = 4503599627370496.0;  // 2^52
+
+  static uint64_t bitsOf(double value)
+  {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+  }
+
+  static const uint64_t MISSING_BITS = bitsOf(NAN);
+
+  static std::size_t packedBytes(std::size_t count, int bits)
+  {
+    return (count * bits + 63) / 64 * sizeof(uint64_t);
+  }
+
+  static bool compares(Compare op, double value, double number)
+  {
+    switch (op)
+    {
+      case Compare::Greater:       return value > number;
+      case Compare::GreaterEqual:  return value >= number;
+      case Compare::Less:          return value < number;
+      default:                     return value <= number;
+    }
+  }
+
+  int bitsFor(uint64_t max)
+  {
+    int bits = 0;
+    while (bits < 64 && (max >> bits) != 0)
+      bits++;
+
+    return bits;
+  }
+
+  void PackedInts::pack(uint64_t const* values, std::size_t count, int bits)
+  {
+    bits_ = bits;
+    words_.assign(packedBytes(count, bits) / sizeof(uint64_t), 0);
+
+    if (bits == 0)
+      return;
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      const std::size_t bit = i * bits;
+      const std::size_t word = bit / 64;
+      const int offset = bit % 64;
+
+      words_[word] |= values[i] << offset;
+      if (offset + bits > 64)
+        words_[word + 1] |= values[i] >> (64 - offset);
+    }
+  }
+
+  void IdBlock::encode(uint32_t const* ids, std::size_t count)
+  {
+    assert(count <= (std::size_t)BLOCK_ROWS);
+
+    count_ = count;
+    values_.clear();
+    runEnds_.clear();
+    codes_ = PackedInts();
+
+    // The distinct ids in the order they come in, by an open addressing table twice the
+    // size of a block that holds the code plus one of each
+    static const int TABLE_BITS = 13;
+    uint32_t tableIds[1 << TABLE_BITS];
+    uint16_t tableCodes[1 << TABLE_BITS] = { 0 };
+
+    std::vector<uint32_t> distinct;
+    std::vector<uint64_t> codes(count);
+    std::size_t runs = 0;
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      const uint32_t id = ids[i];
+      runs += i == 0 || id != ids[i - 1];
+
+      if (i > 0 && id == ids[i - 1])
+      {
+        codes[i] = codes[i - 1];
+        continue;
+      }
+
+      std::size_t slot = (id * 2654435761u) >> (32 - TABLE_BITS);
+      while (tableCodes[slot] && tableIds[slot] != id)
+        slot = (slot + 1) & ((1 << TABLE_BITS) - 1);
+
+      if (!tableCodes[slot])
+      {
+        tableIds[slot] = id;
+        tableCodes[slot] = distinct.size() + 1;
+        distinct.push_back(id);
+      }
+
+      codes[i] = tableCodes[slot] - 1;
+    }
+
+    const int bits = distinct.size() > 1 ? bitsFor(distinct.size() - 1) : 0;
+
+    const std::size_t plainBytes = count * sizeof(uint32_t);
+    const std::size_t runBytes = runs * 2 * sizeof(uint32_t);
+    const std::size_t dictionaryBytes = distinct.size() * sizeof(uint32_t) + packedBytes(count, bits);
+
+    if (runBytes <= dictionaryBytes && runBytes < plainBytes)
+    {
+      kind_ = Kind::RunLength;
+      values_.reserve(runs);
+      runEnds_.reserve(runs);
+
+      for (std::size_t i = 0; i < count; ++i)
+      {
+        if (i == 0 || ids[i] != ids[i - 1])
+        {
+          values_.push_back(ids[i]);
+          runEnds_.push_back(i);
+        }
+
+        runEnds_.back() = i + 1;
+      }
+    }
+    else if (dictionaryBytes < plainBytes)
+    {
+      kind_ = Kind::Dictionary;
+      codes_.pack(codes.data(), count, bits);
+      values_.swap(distinct);
+    }
+    else
+    {
+      kind_ = Kind::Plain;
+      values_.assign(ids, ids + count);
+    }
+
+    values_.shrink_to_fit();
+  }
+
+  std::size_t IdBlock::bytes() const
+  {
+    return (values_.capacity() + runEnds_.capacity()) * sizeof(uint32_t) + codes_.bytes();
+  }
+
+  void IdBlock::decode(uint32_t * out) const
+  {
+    switch (kind_)
+    {
+      case Kind::Dictionary:
+        for (uint32_t row = 0; row < count_; ++row)
+          out[row] = values_[codes_.get(row)];
+        break;
+
+      case Kind::RunLength:
+        for (std::size_t run = 0, row = 0; run < values_.size(); ++run)
+          for (; row < runEnds_[run]; ++row)
+            out[row] = values_[run];
+        break;
+
+      default:
+        std::copy(values_.begin(), values_.end(), out);
+        break;
+    }
+  }
+
+  void NumberBlock::encode(double const* values, std::size_t count)
+  {
+    assert(count <= (std::size_t)BLOCK_ROWS);
+
+    count_ = count;
+    values_.clear();
+    runEnds_.clear();
+    codes_ = PackedInts();
+    base_ = 0;
+    step_ = 0;
+
+    // Runs are of the same bits, integers come back as the same bits from an int64_t.
+    // NaNs other than the one of a row without a number, and -0, are left to the doubles.
+    std::size_t runs = 0;
+    std::size_t present = 0;
+    bool integers = true;
+    int64_t min = 0;
+    int64_t max = 0;
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      const uint64_t bits = bitsOf(values[i]);
+      runs += i == 0 || bits != bitsOf(values[i - 1]);
+
+      if (bits == MISSING_BITS)
+        continue;
+
+      const double value = values[i];
+      if (!integers || !(std::abs(value) <= MAX_INTEGER) || bitsOf((double)(int64_t)value) != bits)
+      {
+        integers = false;
+        continue;
+      }
+
+      const int64_t integer = (int64_t)value;
+      min = present == 0 ? integer : std::min(min, integer);
+      max = present == 0 ? integer : std::max(max, integer);
+      present++;
+    }
+
+    const std::size_t plainBytes = count * sizeof(double);
+    const std::size_t runBytes = runs * (sizeof(double) + sizeof(uint32_t));
+
+    std::size_t bestBytes = std::min(plainBytes, runBytes);
+    kind_ = runBytes <= plainBytes ? Kind::RunLength : Kind::Plain;
+
+    // Offsets from the smallest integer, one more than the largest for no number
+    const int offsetBits = integers ? bitsFor((uint64_t)(max - min) + 1) : 0;
+    if (integers && present > 0 && packedBytes(count, offsetBits) < bestBytes)
+    {
+      bestBytes = packedBytes(count, offsetBits);
+      kind_ = Kind::FrameOfReference;
+    }
+
+    // Steps between rows that all have a number
+    int64_t minStep = 0;
+    int64_t maxStep = 0;
+    if (integers && present == count && count > 1)
+    {
+      for (std::size_t i = 1; i < count; ++i)
+      {
+        const int64_t step = (int64_t)values[i] - (int64_t)values[i - 1];
+        minStep = i == 1 ? step : std::min(minStep, step);
+        maxStep = i == 1 ? step : std::max(maxStep, step);
+      }
+
+      const int stepBits = bitsFor((uint64_t)(maxStep - minStep));
+      if (packedBytes(count, stepBits) < bestBytes)
+        kind_ = Kind::Delta;
+    }
+
+    switch (kind_)
+    {
+      case Kind::FrameOfReference:
+        {
+          std::vector<uint64_t> codes(count, 0);
+          for (std::size_t i = 0; i < count; ++i)
+            if (bitsOf(values[i]) != MISSING_BITS)
+              codes[i] = (uint64_t)((int64_t)values[i] - min) + 1;
+
+          base_ = min;
+          codes_.pack(codes.data(), count, offsetBits);
+        }
+        break;
+
+      case Kind::Delta:
+        {
+          std::vector<uint64_t> codes(count, 0);
+          for (std::size_t i = 1; i < count; ++i)
+            codes[i] = (uint64_t)((int64_t)values[i] - (int64_t)values[i - 1] - minStep);
+
+          base_ = (int64_t)values[0];
+          step_ = minStep;
+          codes_.pack(codes.data(), count, bitsFor((uint64_t)(maxStep - minStep)));
+        }
+        break;
+
+      case Kind::RunLength:
+        for (std::size_t i = 0; i < count; ++i)
+        {
+          if (i == 0 || bitsOf(values[i]) != bitsOf(values[i - 1]))
+          {
+            values_.push_back(values[i]);
+            runEnds_.push_back(i);
+          }
+
+          runEnds_.back() = i + 1;
+        }
+        break;
+
+      default:
+        values_.assign(values, values + count);
+        break;
+    }
+
+    values_.shrink_to_fit();
+    runEnds_.shrink_to_fit();
+  }
+
+  std::size_t NumberBlock::bytes() const
+  {
+    return values_.capacity() * sizeof(double) + runEnds_.capacity() * sizeof(uint32_t) + codes_.bytes();
+  }
+
+  void NumberBlock::decode(double * out) const
+  {
+    switch (kind_)
+    {
+      case Kind::FrameOfReference:
+        for (uint32_t row = 0; row < count_; ++row)
+        {
+          const uint64_t code = codes_.get(row);
+          out[row] = code == 0 ? NAN : (double)(base_ + (int64_t)(code - 1));
+        }
+        break;
+
+      case Kind::Delta:
+        {
+          int64_t value = base_;
+          for (uint32_t row = 0; row < count_; ++row)
+          {
+            if (row > 0)
+              value += step_ + (int64_t)codes_.get(row);
+
+            out[row] = (double)value;
+          }
+        }
+        break;
+
+      case Kind::RunLength:
+        for (std::size_t run = 0, row = 0; run < values_.size(); ++run)
+          for (; row < runEnds_[run]; ++row)
+            out[row] = values_[run];
+        break;
+
+      default:
+        std::copy(values_.begin(), values_.end(), out);
+        break;
+    }
+  }
+
+  void NumberBlock::compare(Compare op, double number, uint64_t * mask) const
+  {
+    for (int w = 0; w < MASK_WORDS; ++w)
+      mask[w] = 0;
+
+    if (std::isnan(number))
+      return;
+
+    switch (kind_)
+    {
+      case Kind::RunLength:
+        for (std::size_t run = 0, row = 0; run < values_.size(); ++run)
+        {
+          const std::size_t end = runEnds_[run];
+          if (compares(op, values_[run], number))
+            for (; row < end; ++row)
+              mask[row / 64] |= (uint64_t)1 << (row % 64);
+
+          row = end;
+        }
+        break;
+
+      case Kind::FrameOfReference:
+        {
+          // The integers that compare are a range, and so are their codes. Beyond the
+          // integers a block holds every one of them compares the same way.
+          number = std::max(-2 * MAX_INTEGER, std::min(number, 2 * MAX_INTEGER));
+
+          double low = -INFINITY;
+          double high = INFINITY;
+          switch (op)
+          {
+            case Compare::Greater:       low = std::floor(number) + 1; break;
+            case Compare::GreaterEqual:  low = std::ceil(number); break;
+            case Compare::Less:          high = std::ceil(number) - 1; break;
+            default:                     high = std::floor(number); break;
+          }
+
+          // Code 0 is a row without a number
+          const double lowCode = std::max(low - base_ + 1, 1.0);
+          const double highCode = std::min(high - base_ + 1, 4 * MAX_INTEGER);
+          if (lowCode > highCode)
+            return;
+
+          const uint64_t first = (uint64_t)lowCode;
+          const uint64_t last = (uint64_t)highCode;
+
+          for (uint32_t row = 0; row < count_; ++row)
+          {
+            const uint64_t code = codes_.get(row);
+            mask[row / 64] |= (uint64_t)(code >= first && code <= last) << (row % 64);
+          }
+        }
+        break;
+
+      default:
+        {
+          double values[BLOCK_ROWS];
+          decode(values);
+
+          for (uint32_t row = 0; row < count_; ++row)
+            mask[row / 64] |= (uint64_t)compares(op, values[row], number) << (row % 64);
+        }
+        break;
+    }
+  }
+}
+
+namespace doc {
+
+  // Lookups of the encoded columns, see cache::Counters
+  static cache::Counters ENCODING_COUNTERS("encodings");
+
+  // Reads block of column into the encoded block, which is left out for a formula
+  static void encodeColumnBlock(Document const& doc, int column, int block, EncodedColumn::Block & encoded)
+  {
+    const int first = block * encoding::BLOCK_ROWS;
+    const int count = std::min(encoding::BLOCK_ROWS, doc.height_ - first);
+
+    uint32_t ids[encoding::BLOCK_ROWS];
+    double numbers[encoding::BLOCK_ROWS];
+
+    for (int row = 0; row < count; ++row)
+    {
+      Cell const* cell = doc.cells_.find(Index(column, first + row));
+      if (cell && cell->type == CellType::Formula)
+        return;
+
+      ids[row] = cell ? cell->text : StringPool::EMPTY;
+      numbers[row] = cell && cell->type == CellType::Number ? cell->value : NAN;
+
+      if (cell && cell->type == CellType::Text)
+        encoded.text_ |= cell->text != StringPool::EMPTY;
+      else if (cell)
+        encoded.hiddenNumbers_ |= cell->text == StringPool::EMPTY;
+    }
+
+    encoded.ids_.encode(ids, count);
+    encoded.numbers_.encode(numbers, count);
+    encoded.encoded_ = true;
+  }
+
+  // The encoded column if it is current, or nullptr
+  EncodedColumn const* currentEncodedColumn(Document const& doc, int column)
+  {
+    for (auto const& it : doc.encodings_)
+      if (it.column_ == column && !it.stale_ && it.height_ == doc.height_)
+        return &it;
+
+    return nullptr;
+  }
+
+  // Counts a scan of column and returns it encoded, built first if it is stale and was
+  // scanned before. nullptr until then, with doc_columnEncoding off or for a document
+  // that is loading or paged. Blocks are encoded on the scheduler unless the cells are in
+  // a tile file.
+  EncodedColumn const* encodedColumn(Document & doc, int column)
+  {
+    if (!COLUMN_ENCODING.toBool() || doc.loading_ || doc.paged_)
+      return nullptr;
+
+    EncodedColumn * encoded = nullptr;
+    for (auto & it : doc.encodings_)
+      if (it.column_ == column)
+        encoded = &it;
+
+    if (!encoded)
+    {
+      doc.encodings_.emplace_back();
+      encoded = &doc.encodings_.back();
+      encoded->column_ = column;
+    }
+
+    if (!encoded->stale_ && encoded->height_ == doc.height_)
+    {
+      ENCODING_COUNTERS.hit();
+      return encoded;
+    }
+
+    ENCODING_COUNTERS.miss();
+    if (++encoded->scans_ < 2)
+      return nullptr;
+
+    const int blockCount = (doc.height_ + encoding::BLOCK_ROWS - 1) / encoding::BLOCK_ROWS;
+    encoded->blocks_ = std::vector<EncodedColumn::Block>(blockCount);
+
+    const int threads = doc.cells_.tileFile() ? 1 : Scheduler::shared().threadCount();
+    const int rangeCount = std::max(1, std::min(blockCount, threads * FILTER_CHUNKS_PER_THREAD));
+
+    std::vector<Scheduler::Task> tasks;
+    for (int r = 0; r < rangeCount; ++r)
+    {
+      const int first = (int)((long long)blockCount * r / rangeCount);
+      const int last = (int)((long long)blockCount * (r + 1) / rangeCount);
+
+      tasks.push_back([&doc, encoded, column, first, last] () {
+        for (int block = first; block < last; ++block)
+          encodeColumnBlock(doc, column, block, encoded->blocks_[block]);
+      });
+    }
+
+    if (rangeCount == 1)
+      tasks.front()();
+    else
+      Scheduler::shared().run(tasks);
+
+    encoded->stale_ = false;
+    encoded->height_ = doc.height_;
+    encoded->scans_ = 0;
+    return encoded;
+  }
+
+  // Fills mask with the rows of block of the encoded clause column that pass clause.
+  // Returns false if the block isn't encoded, or the clause has to look at its cells.
+  bool filterEncodedBlock(Document const& doc, FilterClause const& clause, EncodedColumn const& encoded, int block, uint64_t * mask)
+  {
+    if (block >= (int)encoded.blocks_.size() || !encoded.blocks_[block].encoded_)
+      return false;
+
+    EncodedColumn::Block const& encodedBlock = encoded.blocks_[block];
+    StringPool const& strings = doc.strings_;
+
+    switch (clause.op)
+    {
+      case FilterOp::Equal:
+      case FilterOp::NotEqual:
+        {
+          const bool equal = clause.op == FilterOp::Equal;
+          encodedBlock.ids_.select([&clause, equal] (uint32_t id) {
+            return id != StringPool::EMPTY && (id == clause.valueId) == equal;
+          }, mask);
+        }
+        return true;
+
+      case FilterOp::Regexp:
+      case FilterOp::NotRegexp:
+        {
+          const bool matches = clause.op == FilterOp::Regexp;
+          encodedBlock.ids_.select([&clause, &strings, matches] (uint32_t id) {
+            return id != StringPool::EMPTY && clause.pattern->matches(id, strings.str(id)) == matches;
+          }, mask);
+        }
+        return true;
+
+      case FilterOp::Match:
+      case FilterOp::NoMatch:
+      case FilterOp::Like:
+      case FilterOp::NotLike:
+        encodedBlock.ids_.select([&clause, &strings] (uint32_t id) {
+          bool include = false;
+          return id != StringPool::EMPTY && filterIncludes(clause, strings.str(id), false, 0.0, include, true) && include;
+        }, mask);
+        return true;
+
+      default:
+        {
+          if (encodedBlock.text_ || encodedBlock.hiddenNumbers_)
+            return false;
+
+          static const encoding::Compare COMPARES[] = {
+            encoding::Compare::Greater, encoding::Compare::GreaterEqual, encoding::Compare::Less, encoding::Compare::LessEqual
+          };
+
+          encodedBlock.numbers_.compare(COMPARES[(int)clause.op - (int)FilterOp::Greater], clause.number, mask);
+        }
+        return true;
+    }
+  }
+}
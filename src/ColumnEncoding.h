@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Compact forms of a block of BLOCK_ROWS rows of a column, for scans to run on without
+// looking at the cells. A block is kept twice, as the text ids of its rows and as their
+// numbers, and each picks whichever of its encodings takes the least room:
+//
+//   ids      a dictionary of the distinct ids with a bit-packed code per row, runs of
+//            one id, or the plain ids
+//   numbers  integers as bit-packed offsets from the smallest one (frame of reference),
+//            rising integers like timestamps as bit-packed steps between rows (delta),
+//            runs of one value, or the plain doubles
+//
+// The kernels test what a dictionary holds once per distinct id and a run once for all
+// of its rows, and compare integer codes instead of decoding them. What they can't work
+// on is decoded a block at a time. Rows are numbered from 0 within a block, a mask has a
+// bit per row.
+namespace encoding {
+
+  static const int BLOCK_ROWS = 4096;
+  static const int MASK_WORDS = BLOCK_ROWS / 64;
+
+  enum class Kind : uint8_t
+  {
+    Plain,
+    Dictionary,
+    RunLength,
+    FrameOfReference,
+    Delta
+  };
+
+  // Unsigned integers of bits() bits each, packed into words
+  class PackedInts
+  {
+    public:
+      void pack(uint64_t const* values, std::size_t count, int bits);
+
+      uint64_t get(std::size_t i) const
+      {
+        if (bits_ == 0)
+          return 0;
+
+        const std::size_t bit = i * bits_;
+        const std::size_t word = bit / 64;
+        const int offset = bit % 64;
+
+        uint64_t value = words_[word] >> offset;
+        if (offset + bits_ > 64)
+          value |= words_[word + 1] << (64 - offset);
+
+        return bits_ == 64 ? value : value & (((uint64_t)1 << bits_) - 1);
+      }
+
+      int bits() const { return bits_; }
+      std::size_t bytes() const { return words_.capacity() * sizeof(uint64_t); }
+
+    private:
+      std::vector<uint64_t> words_;
+      int bits_ = 0;
+  };
+
+  // The bits an unsigned value up to max takes
+  int bitsFor(uint64_t max);
+
+  // The text ids of the rows of a block
+  class IdBlock
+  {
+    public:
+      void encode(uint32_t const* ids, std::size_t count);
+
+      Kind kind() const { return kind_; }
+      std::size_t size() const { return count_; }
+
+      // Bytes it holds besides itself
+      std::size_t bytes() const;
+
+      void decode(uint32_t * out) const;
+
+      // Sets the bits of mask of the rows whose id passes test, and clears the others.
+      // test is called once per distinct id of a dictionary, once per run, and for plain
+      // ids once per row that doesn't repeat the id of the row before.
+      template <typename Test>
+      void select(Test const& test, uint64_t * mask) const;
+
+    private:
+      Kind kind_ = Kind::Plain;
+      uint32_t count_ = 0;
+
+      // The dictionary, the id of every run or the plain ids
+      std::vector<uint32_t> values_;
+
+      // The row after every run
+      std::vector<uint32_t> runEnds_;
+
+      // The dictionary code of every row
+      PackedInts codes_;
+  };
+
+  enum class Compare : uint8_t
+  {
+    Greater,
+    GreaterEqual,
+    Less,
+    LessEqual
+  };
+
+  // The numbers of the rows of a block, NaN for the rows without one
+  class NumberBlock
+  {
+    public:
+      void encode(double const* values, std::size_t count);
+
+      Kind kind() const { return kind_; }
+      std::size_t size() const { return count_; }
+      std::size_t bytes() const;
+
+      void decode(double * out) const;
+
+      // Sets the bits of mask of the rows with a number that compares to number, and
+      // clears the others
+      void compare(Compare op, double number, uint64_t * mask) const;
+
+    private:
+      Kind kind_ = Kind::Plain;
+      uint32_t count_ = 0;
+
+      // The smallest number for FrameOfReference, with the code of a row its offset plus
+      // one and 0 for no number. For Delta the first number, the code of a later row is
+      // its step from the one before less the smallest step.
+      int64_t base_ = 0;
+      int64_t step_ = 0;
+      PackedInts codes_;
+
+      // The plain numbers or the number of every run
+      std::vector<double> values_;
+      std::vector<uint32_t> runEnds_;
+  };
+
+  template <typename Test>
+  void IdBlock::select(Test const& test, uint64_t * mask) const
+  {
+    for (int w = 0; w < MASK_WORDS; ++w)
+      mask[w] = 0;
+
+    switch (kind_)
+    {
+      case Kind::Dictionary:
+        {
+          // A bit per code, a dictionary is never larger than a block
+          uint64_t passes[MASK_WORDS] = { 0 };
+          for (std::size_t code = 0; code < values_.size(); ++code)
+            if (test(values_[code]))
+              passes[code / 64] |= (uint64_t)1 << (code % 64);
+
+          for (uint32_t row = 0; row < count_; ++row)
+          {
+            const uint64_t code = codes_.get(row);
+            mask[row / 64] |= ((passes[code / 64] >> (code % 64)) & 1) << (row % 64);
+          }
+        }
+        break;
+
+      case Kind::RunLength:
+        {
+          uint32_t row = 0;
+          for (std::size_t run = 0; run < values_.size(); ++run)
+          {
+            const uint32_t end = runEnds_[run];
+            if (test(values_[run]))
+              for (; row < end; ++row)
+                mask[row / 64] |= (uint64_t)1 << (row % 64);
+
+            row = end;
+          }
+        }
+        break;
+
+      default:
+        {
+          bool passes = false;
+          for (uint32_t row = 0; row < count_; ++row)
+          {
+            if (row == 0 || values_[row] != values_[row - 1])
+              passes = test(values_[row]);
+
+            mask[row / 64] |= (uint64_t)passes << (row % 64);
+          }
+        }
+        break;
+    }
+  }
+
+  inline bool maskHas(uint64_t const* mask, int row)
+  {
+    return (mask[row / 64] >> (row % 64)) & 1;
+  }
+}
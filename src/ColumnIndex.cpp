@@ -0,0 +1,248 @@
+#include "ColumnIndex.h"
+#include "Memory.h"
+
+#include <algorithm>
+
+// Moves the row of every entry at or after first by delta, dropping the rows a negative
+// delta removes. The order of the entries doesn't change.
+template <typename T, typename Row>
+static void shiftEntries(std::vector<T> & entries, Row const& rowOf, int first, int delta)
+{
+  std::size_t kept = 0;
+
+  for (std::size_t i = 0; i < entries.size(); ++i)
+  {
+    int & row = rowOf(entries[i]);
+
+    if (row >= first)
+      row += delta;
+    else if (row >= first + delta)
+      continue;
+
+    entries[kept++] = entries[i];
+  }
+
+  entries.resize(kept);
+}
+
+void ColumnIndex::build(CellStorage const& cells, StringPool const& strings, int height)
+{
+  numbers_.clear();
+  texts_.clear();
+  formulas_.clear();
+
+  for (int y = 0; y < height; ++y)
+  {
+    Cell const* cell = cells.find(Index(column_, y));
+    if (!cell)
+      continue;
+
+    if (cell->hasExpression())
+      formulas_.push_back(y);
+    else if (cell->type == CellType::Number)
+      numbers_.push_back({ cell->value, y });
+    else
+      texts_.push_back({ cell->text, y });
+  }
+
+  // The entries are collected by row, a stable sort on the key keeps them that way
+  std::stable_sort(numbers_.begin(), numbers_.end(), [] (NumberEntry const& lhs, NumberEntry const& rhs) {
+    return lhs.value_ < rhs.value_;
+  });
+
+  std::stable_sort(texts_.begin(), texts_.end(), [&strings] (TextEntry const& lhs, TextEntry const& rhs) {
+    return lhs.text_ != rhs.text_ && strings.str(lhs.text_) < strings.str(rhs.text_);
+  });
+
+  stale_ = false;
+}
+
+void ColumnIndex::erase(int row, Cell const& cell, StringPool const& strings)
+{
+  if (cell.hasExpression())
+  {
+    auto it = std::lower_bound(formulas_.begin(), formulas_.end(), row);
+    if (it != formulas_.end() && *it == row)
+      formulas_.erase(it);
+  }
+  else if (cell.type == CellType::Number)
+  {
+    auto it = std::lower_bound(numbers_.begin(), numbers_.end(), NumberEntry { cell.value, row }, [] (NumberEntry const& lhs, NumberEntry const& rhs) {
+      return lhs.value_ < rhs.value_ || (lhs.value_ == rhs.value_ && lhs.row_ < rhs.row_);
+    });
+
+    if (it != numbers_.end() && it->row_ == row)
+      numbers_.erase(it);
+  }
+  else
+  {
+    const StrView text = strings.str(cell.text);
+    auto it = std::lower_bound(texts_.begin(), texts_.end(), row, [&strings, &text] (TextEntry const& entry, int row) {
+      const StrView key = strings.str(entry.text_);
+      return key < text || (key == text && entry.row_ < row);
+    });
+
+    if (it != texts_.end() && it->row_ == row)
+      texts_.erase(it);
+  }
+}
+
+void ColumnIndex::insert(int row, Cell const& cell, StringPool const& strings)
+{
+  if (cell.hasExpression())
+  {
+    formulas_.insert(std::lower_bound(formulas_.begin(), formulas_.end(), row), row);
+  }
+  else if (cell.type == CellType::Number)
+  {
+    const NumberEntry entry { cell.value, row };
+    numbers_.insert(std::lower_bound(numbers_.begin(), numbers_.end(), entry, [] (NumberEntry const& lhs, NumberEntry const& rhs) {
+      return lhs.value_ < rhs.value_ || (lhs.value_ == rhs.value_ && lhs.row_ < rhs.row_);
+    }), entry);
+  }
+  else
+  {
+    const StrView text = strings.str(cell.text);
+    auto it = std::lower_bound(texts_.begin(), texts_.end(), row, [&strings, &text] (TextEntry const& entry, int row) {
+      const StrView key = strings.str(entry.text_);
+      return key < text || (key == text && entry.row_ < row);
+    });
+
+    texts_.insert(it, TextEntry { cell.text, row });
+  }
+}
+
+void ColumnIndex::shiftRows(int first, int delta)
+{
+  shiftEntries(numbers_, [] (NumberEntry & entry) -> int & { return entry.row_; }, first, delta);
+  shiftEntries(texts_, [] (TextEntry & entry) -> int & { return entry.row_; }, first, delta);
+  shiftEntries(formulas_, [] (int & row) -> int & { return row; }, first, delta);
+}
+
+void ColumnIndex::findEqual(std::string const& text, bool isNumber, double number, StringPool const& strings, std::vector<int> & rows) const
+{
+  auto it = std::lower_bound(texts_.begin(), texts_.end(), text, [&strings] (TextEntry const& entry, std::string const& text) {
+    return strings.str(entry.text_) < text;
+  });
+
+  for (; it != texts_.end() && strings.str(it->text_) == text; ++it)
+    rows.push_back(it->row_);
+
+  // Number cells display their own text, which may spell the number differently
+  if (isNumber)
+  {
+    auto value = std::lower_bound(numbers_.begin(), numbers_.end(), number, [] (NumberEntry const& entry, double number) {
+      return entry.value_ < number;
+    });
+
+    for (; value != numbers_.end() && value->value_ == number; ++value)
+      rows.push_back(value->row_);
+  }
+
+  rows.insert(rows.end(), formulas_.begin(), formulas_.end());
+}
+
+void ColumnIndex::findGreater(double number, bool orEqual, std::vector<int> & rows) const
+{
+  auto it = orEqual
+    ? std::lower_bound(numbers_.begin(), numbers_.end(), number, [] (NumberEntry const& entry, double number) {
+        return entry.value_ < number;
+      })
+    : std::upper_bound(numbers_.begin(), numbers_.end(), number, [] (double number, NumberEntry const& entry) {
+        return number < entry.value_;
+      });
+
+  for (; it != numbers_.end(); ++it)
+    rows.push_back(it->row_);
+
+  for (auto const& entry : texts_)
+    rows.push_back(entry.row_);
+
+  rows.insert(rows.end(), formulas_.begin(), formulas_.end());
+}
+
+void ColumnIndex::findLess(double number, bool orEqual, std::vector<int> & rows) const
+{
+  for (auto it = numbers_.begin(); it != numbers_.end() && (it->value_ < number || (orEqual && it->value_ == number)); ++it)
+    rows.push_back(it->row_);
+
+  for (auto const& entry : texts_)
+    rows.push_back(entry.row_);
+
+  rows.insert(rows.end(), formulas_.begin(), formulas_.end());
+}
+
+void ColumnIndex::save(std::vector<uint32_t> & rows, uint32_t & numbers, uint32_t & texts) const
+{
+  rows.clear();
+  rows.reserve(numbers_.size() + texts_.size() + formulas_.size());
+
+  for (auto const& entry : numbers_)
+    rows.push_back(entry.row_);
+
+  for (auto const& entry : texts_)
+    rows.push_back(entry.row_);
+
+  rows.insert(rows.end(), formulas_.begin(), formulas_.end());
+
+  numbers = numbers_.size();
+  texts = texts_.size();
+}
+
+bool ColumnIndex::restore(CellStorage const& cells, StringPool const& strings, uint32_t const* rows, uint32_t numbers, uint32_t texts, uint32_t formulas)
+{
+  stale_ = true;
+  numbers_.clear();
+  texts_.clear();
+  formulas_.clear();
+
+  auto cellAt = [this, &cells] (uint32_t row) { return cells.find(Index(column_, row)); };
+
+  for (uint32_t i = 0; i < numbers; ++i)
+  {
+    Cell const* cell = cellAt(rows[i]);
+    if (!cell || cell->hasExpression() || cell->type != CellType::Number)
+      return false;
+
+    const NumberEntry entry { cell->value, (int)rows[i] };
+    if (!numbers_.empty() && (entry.value_ < numbers_.back().value_ || (entry.value_ == numbers_.back().value_ && entry.row_ <= numbers_.back().row_)))
+      return false;
+
+    numbers_.push_back(entry);
+  }
+
+  for (uint32_t i = numbers; i < numbers + texts; ++i)
+  {
+    Cell const* cell = cellAt(rows[i]);
+    if (!cell || cell->hasExpression() || cell->type != CellType::Text)
+      return false;
+
+    const TextEntry entry { cell->text, (int)rows[i] };
+    if (!texts_.empty())
+    {
+      const StrView previous = strings.str(texts_.back().text_);
+      const StrView text = strings.str(entry.text_);
+      if (text < previous || (text == previous && entry.row_ <= texts_.back().row_))
+        return false;
+    }
+
+    texts_.push_back(entry);
+  }
+
+  for (uint32_t i = numbers + texts; i < numbers + texts + formulas; ++i)
+  {
+    Cell const* cell = cellAt(rows[i]);
+    if (!cell || !cell->hasExpression() || (!formulas_.empty() && (int)rows[i] <= formulas_.back()))
+      return false;
+
+    formulas_.push_back(rows[i]);
+  }
+
+  stale_ = false;
+  return true;
+}
+
+std::size_t ColumnIndex::memoryUsage() const
+{
+  return memory::bytes(numbers_) + memory::bytes(texts_) + memory::bytes(formulas_);
+}
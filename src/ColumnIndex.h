@@ -0,0 +1,77 @@
+#pragma once
+
+#include "CellStorage.h"
+#include "StringPool.h"
+
+#include <vector>
+#include <cstdint>
+
+// Secondary index over the cells of one column, kept sorted like the leaves of a
+// B-tree: number cells by value and text cells by their text, both then by row.
+// Formulas change with every recalculation, so only their rows are kept and they are
+// candidates of every lookup. Lookups return candidate rows, a superset of the rows
+// that pass, which the caller still checks cell by cell.
+//
+// Edits to single cells are followed with erase() and insert(), rows moving with
+// shiftRows(). Any other change makes the index stale until it is built again.
+class ColumnIndex
+{
+  public:
+    explicit ColumnIndex(int column) : column_(column) { }
+
+    int column() const { return column_; }
+    void setColumn(int column) { column_ = column; }
+
+    bool stale() const { return stale_; }
+    void invalidate() { stale_ = true; }
+
+    void build(CellStorage const& cells, StringPool const& strings, int height);
+
+    // Removes or adds the entry of cell, the cell at row
+    void erase(int row, Cell const& cell, StringPool const& strings);
+    void insert(int row, Cell const& cell, StringPool const& strings);
+
+    // Follows the rows at or after first moving by delta. With a negative delta the
+    // entries of the -delta rows before first are removed.
+    void shiftRows(int first, int delta);
+
+    // Appends the rows that can display text, isNumber is set when text parses as number
+    void findEqual(std::string const& text, bool isNumber, double number, StringPool const& strings, std::vector<int> & rows) const;
+
+    // Appends the rows that can hold a number above, or below, number, or equal to it
+    // with orEqual. Text cells are compared by the number they start with, so every one
+    // is a candidate.
+    void findGreater(double number, bool orEqual, std::vector<int> & rows) const;
+    void findLess(double number, bool orEqual, std::vector<int> & rows) const;
+
+    // The rows in index order, the numbers then the texts then the formulas, and how
+    // many there are of each. This is what the binary format stores.
+    void save(std::vector<uint32_t> & rows, uint32_t & numbers, uint32_t & texts) const;
+
+    // Takes the rows in the order save() gave them, with the keys read from cells. Returns
+    // false, and stays stale, if they don't match the cells of the column.
+    bool restore(CellStorage const& cells, StringPool const& strings, uint32_t const* rows, uint32_t numbers, uint32_t texts, uint32_t formulas);
+
+    std::size_t memoryUsage() const;
+
+  private:
+    struct NumberEntry
+    {
+      double value_;
+      int row_;
+    };
+
+    struct TextEntry
+    {
+      uint32_t text_;
+      int row_;
+    };
+
+  private:
+    int column_;
+    bool stale_ = true;
+
+    std::vector<NumberEntry> numbers_;
+    std::vector<TextEntry> texts_;
+    std::vector<int> formulas_;
+};
@@ -0,0 +1,86 @@
+#include "ColumnLayout.h"
+#include "Memory.h"
+
+#include <algorithm>
+
+int ColumnLayout::stored(int column) const
+{
+  auto it = widths_.find(column);
+  return it == widths_.end() ? -1 : it->second;
+}
+
+int ColumnLayout::width(int column, int defaultWidth) const
+{
+  auto it = widths_.find(column);
+  return it == widths_.end() ? defaultWidth : it->second;
+}
+
+void ColumnLayout::set(int column, int width)
+{
+  widths_[column] = width;
+  invalidateFrom(column);
+}
+
+void ColumnLayout::reset(int column)
+{
+  if (widths_.erase(column) > 0)
+    invalidateFrom(column);
+}
+
+void ColumnLayout::shift(int first, int delta)
+{
+  if (delta == 0)
+    return;
+
+  std::unordered_map<int, int> shifted;
+
+  for (std::pair<int, int> col : widths_)
+  {
+    if (col.first < first && col.first >= first + delta)
+      continue;
+
+    if (col.first >= first)
+      col.first += delta;
+
+    shifted.insert(col);
+  }
+
+  widths_ = std::move(shifted);
+  invalidateFrom(std::min(first, first + delta));
+}
+
+int ColumnLayout::offset(int column, int defaultWidth) const
+{
+  if (column <= 0)
+    return 0;
+
+  if (offsetsDefault_ != defaultWidth)
+  {
+    offsets_.clear();
+    offsetsDefault_ = defaultWidth;
+  }
+
+  if (offsets_.empty())
+    offsets_.push_back(0);
+
+  while ((int)offsets_.size() <= column)
+  {
+    const int last = offsets_.size() - 1;
+    offsets_.push_back(offsets_[last] + width(last, defaultWidth));
+  }
+
+  return offsets_[column];
+}
+
+void ColumnLayout::invalidateFrom(int column)
+{
+  // The offset of column itself doesn't depend on its width
+  const std::size_t keep = std::max(column + 1, 1);
+  if (offsets_.size() > keep)
+    offsets_.resize(keep);
+}
+
+std::size_t ColumnLayout::memoryUsage() const
+{
+  return memory::bytes(widths_) + memory::bytes(offsets_);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+
+// Column widths of a document, columns without a width of their own use the default
+// width. A prefix sum of the widths is kept up to the last column asked for, so the
+// x offset of a column is found without walking the columns before it. Changing a
+// width only drops the offsets after it.
+class ColumnLayout
+{
+  public:
+    // Returns the width set for column, or -1 if it uses the default width
+    int stored(int column) const;
+    int width(int column, int defaultWidth) const;
+
+    void set(int column, int width);
+    void reset(int column);
+
+    // Moves the width of every column at or after first by delta. With a negative delta
+    // the widths of the -delta columns before first are dropped.
+    void shift(int first, int delta);
+
+    // Returns the sum of the widths of the columns before column
+    int offset(int column, int defaultWidth) const;
+
+    std::unordered_map<int, int> const& widths() const { return widths_; }
+
+    std::size_t memoryUsage() const;
+
+  private:
+    void invalidateFrom(int column);
+
+  private:
+    std::unordered_map<int, int> widths_;
+
+    // offsets_[i] is the offset of column i, computed with offsetsDefault_ as default width
+    mutable std::vector<int> offsets_;
+    mutable int offsetsDefault_ = -1;
+};
@@ -6,6 +6,12 @@
 #include "Tokenizer.h"
 #include "Tcl.h"
 #include "Log.h"
+#include "View.h"
+#include "FlatHashMap.h"
+#include "Cache.h"
+
+#include <algorithm>
+#include <memory>
 
 
 static Str commandSequence_;
@@ -16,6 +22,8 @@ static std::vector<EditCommand> editCommands_ = {
     {'o', 0}, true,
     "Add new row below the current and start editing that row",
     [] (int) {
+      doc::Transaction transaction;
+
       if (!doc::isReadOnly())
       {
         Index idx = doc::cursorPos();
@@ -30,6 +38,8 @@ static std::vector<EditCommand> editCommands_ = {
     {'O', 0}, true,
     "Add new row above the current and start editing that row",
     [] (int) {
+      doc::Transaction transaction;
+
       if (!doc::isReadOnly() && doc::cursorPos().y > 0)
       {
         Index idx = doc::cursorPos();
@@ -42,6 +52,8 @@ static std::vector<EditCommand> editCommands_ = {
     {'d', 'c'}, false,
     "Delete the current column",
     [] (int) {
+      doc::Transaction transaction;
+
       if (!doc::isReadOnly())
       {
         if (doc::getColumnCount() > 1)
@@ -63,6 +75,8 @@ static std::vector<EditCommand> editCommands_ = {
     {'d', 'r'}, false,
     "Delete the current row",
     [] (int) {
+      doc::Transaction transaction;
+
       if (!doc::isReadOnly())
       {
         if (doc::getRowCount() > 1)
@@ -84,91 +98,190 @@ static std::vector<EditCommand> editCommands_ = {
     {'f', 'r'}, false,
     "Right-justify the text in the current cell",
     [] (int) {
-      for (auto const& idx : doc::selectedCells())
-      {
-        const uint32_t oldFormat = doc::getCellFormat(idx);
-        const uint32_t newFormat = (oldFormat & ~ALIGN_MASK) | ALIGN_RIGHT;
-        doc::setCellFormat(idx, newFormat);
-      }
+      doc::changeCellFormats(doc::selectedCells(), [] (uint32_t oldFormat) {
+        return (oldFormat & ~ALIGN_MASK) | ALIGN_RIGHT;
+      });
     }
   },
   {
     {'f', 'c'}, false,
     "Center-justify the text in the current cell",
     [] (int) {
-      for (auto const& idx : doc::selectedCells())
-      {
-        const uint32_t oldFormat = doc::getCellFormat(idx);
-        const uint32_t newFormat = (oldFormat & ~ALIGN_MASK) | ALIGN_CENTER;
-        doc::setCellFormat(idx, newFormat);
-      }
+      doc::changeCellFormats(doc::selectedCells(), [] (uint32_t oldFormat) {
+        return (oldFormat & ~ALIGN_MASK) | ALIGN_CENTER;
+      });
     }
   },
   {
     {'f', 'l'}, false,
     "Left-justify the text in the current cell",
     [] (int) {
-      for (auto const& idx : doc::selectedCells())
-      {
-        const uint32_t oldFormat = doc::getCellFormat(idx);
-        const uint32_t newFormat = (oldFormat & ~ALIGN_MASK) | ALIGN_LEFT;
-        doc::setCellFormat(idx, newFormat);
-      }
+      doc::changeCellFormats(doc::selectedCells(), [] (uint32_t oldFormat) {
+        return (oldFormat & ~ALIGN_MASK) | ALIGN_LEFT;
+      });
     }
   },
   {
     {'f', 'n'}, false,
     "Normal font in the current cell",
     [] (int) {
-      for (auto const& idx : doc::selectedCells())
-      {
-        const uint32_t oldFormat = doc::getCellFormat(idx);
-        const uint32_t newFormat = oldFormat & ~FONT_MASK;
-        doc::setCellFormat(idx, newFormat);
-      }
+      doc::changeCellFormats(doc::selectedCells(), [] (uint32_t oldFormat) {
+        return oldFormat & ~FONT_MASK;
+      });
     }
   },
   {
     {'f', 'b'}, false,
     "Bold font in the current cell",
     [] (int) {
-      for (auto const& idx : doc::selectedCells())
-      {
-        const uint32_t oldFormat = doc::getCellFormat(idx);
-        const uint32_t newFormat = oldFormat ^ FONT_BOLD;
-        doc::setCellFormat(idx, newFormat);
-      }
+      doc::changeCellFormats(doc::selectedCells(), [] (uint32_t oldFormat) {
+        return oldFormat ^ FONT_BOLD;
+      });
     }
   },
   {
     {'f', 'u'}, false,
     "Underline the font in the current cell",
     [] (int) {
-      for (auto const& idx : doc::selectedCells())
-      {
-        const uint32_t oldFormat = doc::getCellFormat(idx);
-        const uint32_t newFormat = oldFormat ^ FONT_UNDERLINE;
-        doc::setCellFormat(idx, newFormat);
-      }
+      doc::changeCellFormats(doc::selectedCells(), [] (uint32_t oldFormat) {
+        return oldFormat ^ FONT_UNDERLINE;
+      });
+    }
+  },
+  {
+    {'f', '.'}, false,
+    "Show the numbers in the current cell with one more decimal",
+    [] (int) {
+      doc::changeCellFormats(doc::selectedCells(), [] (uint32_t oldFormat) {
+        const int decimals = std::min(formatDecimals(oldFormat) + 1, MAX_DECIMALS);
+        return setFormatDecimals(oldFormat, decimals);
+      });
+    }
+  },
+  {
+    {'f', ','}, false,
+    "Separate the thousands of the numbers in the current cell",
+    [] (int) {
+      doc::changeCellFormats(doc::selectedCells(), [] (uint32_t oldFormat) {
+        return oldFormat ^ NUMBER_GROUPED;
+      });
+    }
+  },
+  {
+    {'f', 't'}, false,
+    "Show the numbers in the current cell as timestamps, counted in microseconds",
+    [] (int) {
+      doc::changeCellFormats(doc::selectedCells(), [] (uint32_t oldFormat) {
+        return oldFormat ^ NUMBER_TIMESTAMP;
+      });
     }
   },
+  {
+    {'f', 'g'}, false,
+    "Show the numbers in the current cell with as many decimals as they need",
+    [] (int) {
+      doc::changeCellFormats(doc::selectedCells(), [] (uint32_t oldFormat) {
+        return oldFormat & ~(DECIMALS_MASK | NUMBER_GROUPED | NUMBER_TIMESTAMP);
+      });
+    }
+  },
+};
+
+// Bindings are installed once a key is looked up, a run that never reads keys, like
+// --batch, doesn't pay for the bindings of the scripting library and the config file
+struct PendingBinding
+{
+  uint32_t key[2];
+  std::string sequence;
+  std::string command;
+  std::string description;
 };
 
+static std::vector<PendingBinding> pendingBindings_;
+
+static void installBindings();
+
+// Position in editCommands_ of each key sequence, keyed by commandKey(). Built on first
+// use and kept up to date by bind, so looking up a key press is a hash lookup.
+static FlatHashMap<std::size_t> commandKeys_;
+
+static uint64_t commandKey(uint32_t key1, uint32_t key2)
+{
+  return ((uint64_t)key1 << 32) | key2;
+}
+
+static FlatHashMap<std::size_t> & commandKeys()
+{
+  // The first command of a key sequence is the one that is found, as in editCommands_
+  if (commandKeys_.empty())
+    for (std::size_t i = 0; i < editCommands_.size(); ++i)
+      commandKeys_.insert(commandKey(editCommands_[i].key[0], editCommands_[i].key[1]), i);
+
+  installBindings();
+  return commandKeys_;
+}
+
+// A command of one key matches key1 whatever key2 is, a command of two keys has to match
+// both. When both match the one that came first in editCommands_ wins.
 static bool getEditCommand(uint32_t key1, uint32_t key2, EditCommand ** command)
 {
-  for (auto & cmd : editCommands_)
-    if (cmd.key[0] == key1 && (cmd.key[1] == 0 || cmd.key[1] == key2))
-    {
-      if (command)
-        *command = &cmd;
-      return true;
-    }
+  FlatHashMap<std::size_t> & keys = commandKeys();
 
-  return false;
+  const std::size_t * single = keys.find(commandKey(key1, 0));
+  const std::size_t * pair = key2 != 0 ? keys.find(commandKey(key1, key2)) : nullptr;
+
+  if (!single && !pair)
+    return false;
+
+  const std::size_t found = !pair ? *single : (!single ? *pair : std::min(*single, *pair));
+  if (command)
+    *command = &editCommands_[found];
+
+  return true;
+}
+
+static void installBinding(PendingBinding const& binding)
+{
+  std::shared_ptr<tcl::Script> script = std::make_shared<tcl::Script>(binding.command);
+  auto evaluate = [script] (int) { doc::Transaction transaction; script->evaluate(); };
+
+  EditCommand * command = nullptr;
+  if (getEditCommand(binding.key[0], binding.key[1], &command))
+  {
+    logInfo("Rebinding key-sequence '", binding.sequence, "' to ", binding.command);
+
+    command->manualRepeat = false;
+    command->description = binding.description;
+    command->command = evaluate;
+  }
+  else
+  {
+    editCommands_.push_back({
+      binding.key[0], binding.key[1], false,
+      binding.description,
+      evaluate
+    });
+
+    commandKeys_.insert(commandKey(binding.key[0], binding.key[1]), editCommands_.size() - 1);
+  }
+}
+
+static void installBindings()
+{
+  if (pendingBindings_.empty())
+    return;
+
+  // getEditCommand() comes back here, the list is taken first
+  std::vector<PendingBinding> bindings;
+  bindings.swap(pendingBindings_);
+
+  for (auto const& binding : bindings)
+    installBinding(binding);
 }
 
 std::vector<EditCommand> const& getEditCommands()
 {
+  installBindings();
   return editCommands_;
 }
 
@@ -224,9 +337,26 @@ void executeEditCommands()
 static const int COMMAND_HISTORY_LENGHT = 1000;
 static std::vector<std::string> commandHistory_;
 
+// What the script of the command line writes becomes one undo step, and the document is
+// recalculated once it is done
+static std::unique_ptr<doc::Transaction> appCommandsTransaction_;
+
 void executeAppCommands(std::string const& commandLine)
 {
-  tcl::evaluate(commandLine);
+  appCommandsTransaction_.reset(new doc::Transaction());
+  tcl::startJob(commandLine);
+}
+
+void finishAppCommands()
+{
+  const int retcode = tcl::finishJob();
+  appCommandsTransaction_.reset();
+
+  if (retcode == JIM_SIGNAL)
+  {
+    flashMessage("Script stopped");
+    return;
+  }
 
   const std::string result = tcl::result();
   if (!result.empty())
@@ -236,9 +366,9 @@ void executeAppCommands(std::string const& commandLine)
 TCL_FUNC(edit, "index")
 {
   TCL_CHECK_ARG(2);
-  TCL_STRING_ARG(1, index);
+  TCL_INDEX_ARG(1, index);
 
-  doc::cursorPos() = Index::fromStr(index);
+  doc::cursorPos() = index;
   editCurrentCell();
 
   return JIM_OK;
@@ -247,12 +377,12 @@ TCL_FUNC(edit, "index")
 TCL_FUNC(cursor, "?index?", "Return and optionally set the position of the cursor in the current document")
 {
   TCL_CHECK_ARGS(1, 2);
-  TCL_STRING_ARG(1, index);
+  TCL_INDEX_ARG(1, index);
 
   if (argc == 2)
-    doc::cursorPos() = Index::fromStr(index);
+    doc::cursorPos() = index;
 
-  TCL_STRING_RESULT(doc::cursorPos().toStr());
+  TCL_INDEX_RESULT(doc::cursorPos());
 }
 
 TCL_FUNC(bind, "keysequence command ?description?", "Bind a command to a specific keyboard sequence")
@@ -270,24 +400,7 @@ TCL_FUNC(bind, "keysequence command ?description?", "Bind a command to a specifi
     return JIM_ERR;
   }
 
-  EditCommand * command = nullptr;
-  if (getEditCommand(buffer[0], buffer.size() == 2 ? buffer[1] : 0, &command))
-  {
-    logInfo("Rebinding key-sequence '", keySequence, "' to ", commandStr);
-
-    command->manualRepeat = false;
-    command->description = description;
-    command->command = [commandStr] (int) { tcl::evaluate(commandStr); };
-  }
-  else
-  {
-    editCommands_.push_back({
-      buffer[0], buffer.size() == 2 ? buffer[1] : 0, false,
-      description,
-      [commandStr] (int) { tcl::evaluate(commandStr); }
-    });
-  }
-
+  pendingBindings_.push_back({ { buffer[0], buffer.size() == 2 ? buffer[1] : 0 }, keySequence, commandStr, description });
   return JIM_OK;
 }
 
@@ -297,3 +410,45 @@ TCL_FUNC(flashMessage, "message")
   TCL_STRING_ARG(1, message);
   flashMessage(message);
 }
+
+TCL_FUNC(memory, "", "Returns the bytes held by each part of every buffer, the view and the Tcl interpreter as a list of name bytes pairs")
+{
+  TCL_CHECK_ARG(1);
+
+  Jim_Obj * result = Jim_NewListObj(interp, nullptr, 0);
+  std::size_t total = 0;
+
+  auto add = [&] (std::string const& name, std::size_t bytes) {
+    Jim_ListAppendElement(interp, result, Jim_NewStringObj(interp, name.c_str(), name.size()));
+    Jim_ListAppendElement(interp, result, Jim_NewIntObj(interp, bytes));
+    total += bytes;
+  };
+
+  for (int i = 0; i < doc::getOpenBufferCount(); ++i)
+    for (auto const& part : doc::memoryUsage(i))
+      add("buffer" + str::fromInt(i) + "." + part.first, part.second);
+
+  add("view", view::memoryUsage());
+  add("tcl", tcl::memoryUsage());
+
+  const std::size_t sum = total;
+  add("total", sum);
+
+  Jim_SetResult(interp, result);
+  return JIM_OK;
+}
+
+TCL_FUNC(caches, "", "Returns the bytes held by each cache sharing the app_cacheMemory budget as a list of name bytes pairs")
+{
+  TCL_CHECK_ARG(1);
+
+  Jim_Obj * result = Jim_NewListObj(interp, nullptr, 0);
+  for (auto const& it : cache::usage())
+  {
+    Jim_ListAppendElement(interp, result, Jim_NewStringObj(interp, it.first.c_str(), it.first.size()));
+    Jim_ListAppendElement(interp, result, Jim_NewIntObj(interp, it.second));
+  }
+
+  Jim_SetResult(interp, result);
+  return JIM_OK;
+}
@@ -25,6 +25,9 @@ struct EditCommand
 void pushEditCommandKey(uint32_t ch);
 void clearEditCommandSequence();
 void executeEditCommands();
+
+// Runs the script as a job of tcl, the main loop calls finishAppCommands() once it ended
 void executeAppCommands(std::string const& commandLine);
+void finishAppCommands();
 
 std::vector<EditCommand> const& getEditCommands();
@@ -0,0 +1,174 @@
+#include "Compaction.h"
+#include "DocumentState.h"
+#include "Log.h"
+#include "Tcl.h"
+
+#include <algorithm>
+
+namespace doc {
+
+  // Idle maintenance compacts a document once this percent of its stored cells hold
+  // nothing, of its strings are no longer used or of the slots of its tile file are free,
+  // 0 leaves it to the compact command. They are counted again once the pool grew, the
+  // cells shrank or a quarter of them were emptied, and a step moves COMPACT_STEP_TILES
+  // tiles.
+  static const tcl::Variable COMPACT_THRESHOLD("doc_compactThreshold", 50);
+  static const std::size_t MIN_COMPACT_STRINGS = 64 * 1024;
+  static const std::size_t MIN_COMPACT_CELLS = 64 * 1024;
+  static const std::size_t COMPACT_STEP_TILES = 256;
+
+  // Whether the cells and strings doc holds are to be counted again
+  static bool cellsToCount(Document const& doc)
+  {
+    const std::size_t strings = doc.strings_.size();
+    const std::size_t cells = doc.cells_.size();
+
+    if (doc.emptiedCells_ >= MIN_COMPACT_CELLS && doc.emptiedCells_ > cells / 4)
+      return true;
+
+    return strings >= MIN_COMPACT_STRINGS && (strings > doc.checkedStrings_ + doc.checkedStrings_ / 4 || cells + cells / 4 < doc.checkedCells_);
+  }
+
+  static bool tileFileFragmented(Document const& doc, int threshold)
+  {
+    TileFile const* file = doc.cells_.tileFile();
+    if (!file || file->fileSize() == 0)
+      return false;
+
+    const std::size_t slots = file->fileSize() / file->slotSize();
+    const std::size_t free = file->freeSlots();
+    return free > doc.checkedFreeSlots_ && free * 100 >= slots * threshold;
+  }
+
+  // A document written in the background is left alone, the writer reads its strings
+  bool compactionDue(Document const& doc)
+  {
+    const int threshold = COMPACT_THRESHOLD.toInt();
+    return threshold > 0 && !doc.writing_ && (cellsToCount(doc) || tileFileFragmented(doc, threshold));
+  }
+
+  // Counts the stored cells of doc that hold nothing, no text, formula or format, and
+  // erases them once they are at least threshold percent of the cells. Then counts the
+  // strings the cells still use, and those of the yanked cells if they are of doc, and
+  // drops the others once they are at least threshold percent of the pool. What was built
+  // of the cells goes stale. Also trims the tile directory. Adds the cells erased and the
+  // strings dropped to cells and strings.
+  static void compactCells(Document & doc, int threshold, std::size_t & cells, std::size_t & strings)
+  {
+    doc.cells_.compact(0);
+    doc.emptiedCells_ = 0;
+
+    // A cell a column formula shows instead of its value holds nothing but is shown
+    std::vector<int> computed;
+    for (auto const& formula : doc.columnFormulas_)
+      computed.push_back(formula.column_);
+
+    std::vector<Index> empty;
+    static_cast<CellStorage const&>(doc.cells_).forEach([&empty, &computed] (Index const& idx, Cell const& cell) {
+      if (cell.type == CellType::Text && cell.text == StringPool::EMPTY && cell.format == 0)
+        if (std::find(computed.begin(), computed.end(), idx.x) == computed.end())
+          empty.push_back(idx);
+    });
+
+    const bool erase = !empty.empty() && empty.size() * 100 >= doc.cells_.size() * threshold;
+    if (erase)
+    {
+      for (auto const& idx : empty)
+        doc.cells_.erase(idx);
+
+      cells += empty.size();
+    }
+
+    Clip & clip = yankedClip();
+    const bool clipped = clip.doc_.get() == &doc;
+    std::vector<bool> live(doc.strings_.size(), false);
+
+    auto mark = [&live] (Index const&, Cell const& cell) { live[cell.text] = true; };
+    static_cast<CellStorage const&>(doc.cells_).forEach(mark);
+    if (clipped)
+      static_cast<CellStorage const&>(clip.cells_).forEach(mark);
+
+    const std::size_t size = doc.strings_.size();
+    const std::size_t dead = size - 1 - std::count(live.begin() + 1, live.end(), true);
+    const bool drop = dead > 0 && dead * 100 >= size * threshold;
+
+    doc.checkedStrings_ = drop ? size - dead : size;
+    doc.checkedCells_ = doc.cells_.size();
+    if (!erase && !drop)
+      return;
+
+    if (drop)
+    {
+      const std::vector<uint32_t> ids = doc.strings_.compact(live);
+      doc.cells_.remapTexts(ids);
+      if (clipped)
+        clip.cells_.remapTexts(ids);
+
+      doc.cellStyles_.clear();
+      doc.styleGeneration_++;
+      doc.search_ = SearchIndex();
+      doc.searchPattern_.reset();
+      strings += dead;
+    }
+
+    for (auto & index : doc.indexes_)
+      index.invalidate();
+
+    invalidateLookups(doc, -1);
+  }
+
+  // Moves up to count tiles of the tile file of doc to the front of the file. Returns
+  // the tiles moved.
+  static std::size_t compactTiles(Document & doc, std::size_t count)
+  {
+    const std::size_t moved = doc.cells_.compact(count);
+    if (moved < count)
+      doc.checkedFreeSlots_ = doc.cells_.tileFile() ? doc.cells_.tileFile()->freeSlots() : 0;
+
+    return moved;
+  }
+
+  void compactStep(Document & doc)
+  {
+    std::size_t cells = 0;
+    std::size_t strings = 0;
+    if (cellsToCount(doc))
+      compactCells(doc, COMPACT_THRESHOLD.toInt(), cells, strings);
+    else
+      compactTiles(doc, COMPACT_STEP_TILES);
+  }
+
+  TCL_FUNC(compact, "", "Erases the cells of the current document that hold nothing, drops the strings no cell uses anymore and moves the tiles of its tile file to the front of the file, giving back the rest of it. Returns the cells erased, the strings dropped and the tiles moved as a list of names and values. Idle maintenance compacts a document on its own, see doc_compactThreshold.")
+  {
+    TCL_CHECK_ARG(1);
+
+    Document & doc = currentDoc();
+    if (doc.loading_ || doc.paged_ || doc.writing_)
+    {
+      logError("can't compact a document that is loading, paged or being written");
+      return JIM_ERR;
+    }
+
+    std::size_t cells = 0;
+    std::size_t strings = 0;
+    compactCells(doc, 0, cells, strings);
+
+    std::size_t tiles = 0;
+    std::size_t moved = 0;
+    do
+    {
+      moved = compactTiles(doc, COMPACT_STEP_TILES);
+      tiles += moved;
+    } while (moved == COMPACT_STEP_TILES);
+
+    Jim_Obj * list = Jim_NewListObj(interp, nullptr, 0);
+    Jim_ListAppendElement(interp, list, Jim_NewStringObj(interp, "cells", -1));
+    Jim_ListAppendElement(interp, list, Jim_NewIntObj(interp, (long long)cells));
+    Jim_ListAppendElement(interp, list, Jim_NewStringObj(interp, "strings", -1));
+    Jim_ListAppendElement(interp, list, Jim_NewIntObj(interp, (long long)strings));
+    Jim_ListAppendElement(interp, list, Jim_NewStringObj(interp, "tiles", -1));
+    Jim_ListAppendElement(interp, list, Jim_NewIntObj(interp, (long long)tiles));
+    Jim_SetResult(interp, list);
+    return JIM_OK;
+  }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+// Compaction of a document: the stored cells that hold nothing are erased, the strings
+// no cell uses anymore dropped and the tiles of its tile file moved to the front of the
+// file, giving back the rest of it. The compact command does all of it at once, idle
+// maintenance a step at a time once enough of the document is dead space.
+namespace doc {
+
+  struct Document;
+
+  // Whether idle maintenance has a step of compaction to do, see doc_compactThreshold,
+  // and does it
+  bool compactionDue(Document const& doc);
+  void compactStep(Document & doc);
+}
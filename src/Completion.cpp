@@ -1,14 +1,27 @@
-
 #include "Completion.h"
 #include "Editor.h"
 #include "Tcl.h"
 #include "Log.h"
 
-void completeEditLine(Str & editLine)
+void completeEditLine(EditLine & editLine)
 {
-  const std::vector<Str> parts = editLine.split(' ', true);
+  // Only the word after the last space is completed, the rest of the line stays as is
+  int wordStart = editLine.size();
+  while (wordStart > 0 && editLine[wordStart - 1] != ' ')
+    wordStart--;
+
+  // A trailing space leaves nothing to complete
+  if (wordStart == editLine.size() && wordStart > 0)
+  {
+    setCompletionHints(std::vector<std::string>());
+    return;
+  }
+
+  EditLine lastWord;
+  for (int i = wordStart; i < editLine.size(); ++i)
+    lastWord.insert(i - wordStart, editLine[i]);
 
-  std::string word = parts.empty() ? std::string("") : parts.back().utf8();
+  std::string word = lastWord.utf8();
   std::string removedPart = "";
 
   switch (word.front())
@@ -21,47 +34,20 @@ void completeEditLine(Str & editLine)
   }
 
 
-  const std::vector<std::string> hints = tcl::findMatches(word);
+  std::string prefix;
+  const std::vector<std::string> hints = tcl::findMatches(word, &prefix);
 
   if (hints.size() == 1)
   {
-    editLine.clear();
-    for (int i = 0; i < (parts.size() - 1); ++i)
-      editLine.append(parts[i]);
-
-    editLine.append(Str(removedPart + hints.front())).append(' ');
+    editLine.erase(wordStart, editLine.size() - wordStart);
+    editLine.insert(wordStart, removedPart + hints.front() + " ");
   }
-  else if (hints.size() > 1)
+  else if (!prefix.empty())
   {
-    // See if we append to the search word
-    int len = word.size();
-    while (true)
-    {
-      char ch = 0;
-      if (len < hints.front().size())
-        ch = hints.front()[len];
-      else
-        break;
-
-      bool matches = true;
-      for (auto const& hint : hints)
-        matches &= (len < hint.size()) && (hint[len] == ch);
-
-      if (!matches)
-        break;
-
-      ++len;
-    }
-
-    if (len > 0)
-    {
-      editLine.clear();
-      for (int i = 0; i < (parts.size() - 1); ++i)
-        editLine.append(parts[i]);
-
-      editLine.append(Str(removedPart + hints.front().substr(0, len)));
-    }
+    // Extend the word by what all the hints share
+    editLine.erase(wordStart, editLine.size() - wordStart);
+    editLine.insert(wordStart, removedPart + prefix);
   }
 
   setCompletionHints(hints);
-}
\ No newline at end of file
+}
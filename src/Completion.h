@@ -1,6 +1,6 @@
 
 #pragma once
 
-#include "Str.h"
+#include "EditLine.h"
 
-void completeEditLine(Str & command);
\ No newline at end of file
+void completeEditLine(EditLine & editLine);
\ No newline at end of file
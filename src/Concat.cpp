@@ -0,0 +1,178 @@
+#include "Concat.h"
+#include "DocumentState.h"
+#include "Document.h"
+#include "Log.h"
+
+#include <algorithm>
+
+namespace doc {
+
+  // A buffer taking part in a concatenation: the document rows it shows and the text of
+  // its header cells, if the first row is one
+  struct ConcatSource
+  {
+    std::shared_ptr<Document> doc_;
+    bool view_ = false;
+    std::vector<int> rows_;
+    std::vector<std::string> header_;
+  };
+
+  static bool collectConcatSource(long buffer, bool header, ConcatSource & source)
+  {
+    if (buffer < 0 || buffer >= (long)documentBuffers().size())
+    {
+      logError("no buffer ", buffer, " to concatenate");
+      return false;
+    }
+
+    BufferSwitch bufferSwitch(buffer);
+
+    Document & doc = currentDoc();
+    source.doc_ = currentBuffer().doc_;
+    source.view_ = currentBuffer().view_;
+
+    if (doc.loading_ || doc.paged_)
+    {
+      logError("can't concatenate a document that is loading or paged, filter it into a view first");
+      return false;
+    }
+
+    const int rowCount = getRowCount();
+
+    source.rows_.reserve(rowCount);
+    for (int y = 0; y < rowCount; ++y)
+      source.rows_.push_back(documentRow(y));
+
+    if (header && rowCount > 0)
+      for (int x = 0; x < doc.width_; ++x)
+      {
+        Cell const* cell = doc.cells_.find(Index(x, source.rows_[0]));
+        source.header_.push_back(cell ? getText(*cell) : std::string());
+      }
+
+    return true;
+  }
+
+  bool concatBuffers(std::vector<long> const& buffers, bool header, int & rows)
+  {
+    std::vector<ConcatSource> sources(buffers.size());
+    for (std::size_t s = 0; s < sources.size(); ++s)
+      if (!collectConcatSource(buffers[s], header, sources[s]))
+        return false;
+
+    ConcatSource const& first = sources[0];
+    std::shared_ptr<Document> doc = std::make_shared<Document>();
+
+    doc->width_ = first.doc_->width_;
+    doc->columns_ = first.doc_->columns_;
+    doc->delimiter_ = first.doc_->delimiter_;
+    doc->strings_ = first.doc_->strings_;
+    doc->filename_ = "[No Name]";
+    doc->readOnly_ = false;
+
+    // Copies a cell of source into the document, formulas move the way pasting moves them
+    auto copyCell = [&doc, &first] (ConcatSource const& source, Index const& from, Index const& to, std::vector<uint32_t> & ids) {
+      Cell const* cell = source.doc_->cells_.find(from);
+      if (!cell)
+        return;
+
+      Cell & copy = doc->cells_.get(to);
+      copy = *cell;
+
+      if (source.doc_ != first.doc_)
+      {
+        uint32_t & id = ids[cell->text];
+        if (id == UINT32_MAX)
+          id = doc->strings_.intern(source.doc_->strings_.str(cell->text));
+
+        copy.text = id;
+      }
+
+      if (copy.hasExpression())
+      {
+        copy.formula->origin = to;
+        copy.evaluated = false;
+        shareFormula(*doc, to, copy);
+      }
+    };
+
+    // The rows of a document that isn't a view are where they are in it, its tiles are
+    // shared until either document is edited
+    int row = 0;
+    std::vector<uint32_t> ids;
+    if (!first.view_)
+    {
+      doc->cells_ = first.doc_->cells_;
+      row = first.rows_.size();
+    }
+    else
+      for (; row < (int)first.rows_.size(); ++row)
+        for (int x = 0; x < first.doc_->width_; ++x)
+          copyCell(first, Index(x, first.rows_[row]), Index(x, row), ids);
+
+    // The headers of the columns the others add go into the first row
+    if (header && row == 0)
+      row = 1;
+
+    std::vector<std::string> names = first.header_;
+    for (std::size_t s = 1; s < sources.size(); ++s)
+    {
+      ConcatSource const& source = sources[s];
+      const int width = source.doc_->width_;
+      ids.assign(source.doc_->strings_.size(), UINT32_MAX);
+
+      // Each column of the source goes to the first column of that name it didn't take yet
+      std::vector<int> columns(width);
+      std::vector<bool> taken(names.size(), false);
+      for (int x = 0; x < width; ++x)
+      {
+        if (!header)
+        {
+          columns[x] = x;
+          continue;
+        }
+
+        std::string const& name = x < (int)source.header_.size() ? source.header_[x] : std::string();
+        int column = 0;
+        while (column < (int)names.size() && (taken[column] || names[column] != name))
+          column++;
+
+        if (column == (int)names.size())
+        {
+          names.push_back(name);
+          taken.push_back(false);
+
+          if (!source.rows_.empty())
+            copyCell(source, Index(x, source.rows_[0]), Index(column, 0), ids);
+
+          const int columnWidth = source.doc_->columns_.stored(x);
+          if (columnWidth >= 0)
+            doc->columns_.set(column, columnWidth);
+        }
+
+        taken[column] = true;
+        columns[x] = column;
+      }
+
+      for (std::size_t y = header ? 1 : 0; y < source.rows_.size(); ++y, ++row)
+        for (int x = 0; x < width; ++x)
+          copyCell(source, Index(x, source.rows_[y]), Index(columns[x], row), ids);
+
+      doc->width_ = std::max({ doc->width_, width, (int)names.size() });
+    }
+
+    doc->height_ = row;
+
+    Buffer buffer;
+    buffer.doc_ = doc;
+    documentBuffers().push_back(std::move(buffer));
+    jumpToBuffer(documentBuffers().size() - 1);
+
+    // Only the formulas that were moved are evaluated again
+    rebuildDependencies(*doc);
+    evaluateDocument(*doc, true);
+
+    rows = row - (header && row > 0 ? 1 : 0);
+    return true;
+  }
+}
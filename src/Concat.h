@@ -0,0 +1,13 @@
+#pragma once
+
+#include <vector>
+
+// Concatenation of buffers into a new one, the columns of the others matched to those of
+// the first by their header
+namespace doc {
+
+  // Opens a new buffer with the rows of buffers one after the other and sets rows to the
+  // rows it got, not counting the header. header tells whether the first row of each
+  // buffer is one. Returns false, having logged why, when a buffer can't take part.
+  bool concatBuffers(std::vector<long> const& buffers, bool header, int & rows);
+}
@@ -0,0 +1,382 @@
+#include "ConditionalFormat.h"
+#include "DocumentState.h"
+#include "Document.h"
+#include "Cache.h"
+#include "View.h"
+#include "Log.h"
+#include "Tcl.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace doc {
+
+  // Cells whose style the format rules keep, the cache starts over beyond that
+  static const std::size_t MAX_CACHED_STYLES = 64 * 1024;
+
+  // Lookups of the styles the format rules keep, see cache::Counters
+  static cache::Counters STYLE_COUNTERS("styles");
+
+  // Adds delta to the count a duplicate rule has of the value of cell, which isn't a formula
+  static void countValue(Document & doc, FormatRule & rule, Cell const& cell, int delta)
+  {
+    if (cell.type == CellType::Number && !std::isnan(cell.value))
+      rule.numbers_[lookupKey(cell.value)] += delta;
+    else if (cell.type == CellType::Text && !doc.strings_.str(cell.text).empty())
+      rule.texts_[cell.text] += delta;
+  }
+
+  void uncountRuleValues(Document & doc, Index const& idx, std::vector<FormatRule *> & counted)
+  {
+    for (auto & rule : doc.formatRules_)
+      if (rule.kind_ == FormatRule::Duplicate && rule.column_ == idx.x && !rule.stale_ && !rule.formulas_ && rule.height_ == doc.height_)
+      {
+        if (Cell const* previous = static_cast<CellStorage const&>(doc.cells_).find(idx))
+          countValue(doc, rule, *previous, -1);
+
+        counted.push_back(&rule);
+      }
+  }
+
+  void countRuleValues(Document & doc, Cell const& cell, int height, std::vector<FormatRule *> const& counted)
+  {
+    for (auto & rule : doc.formatRules_)
+      if (rule.height_ == height)
+        rule.height_ = doc.height_;
+
+    if (cell.type != CellType::Formula)
+      for (FormatRule * rule : counted)
+      {
+        countValue(doc, *rule, cell, 1);
+        rule->stale_ = false;
+      }
+
+    if (!counted.empty())
+      doc.styleGeneration_++;
+  }
+
+  void shiftFormatRules(Document & doc, int Index::* axis, int first, int delta)
+  {
+    doc.styleGeneration_++;
+    doc.markedCells_.clear();
+
+    if (axis == &Index::y)
+      return;
+
+    doc.formatRules_.erase(std::remove_if(doc.formatRules_.begin(), doc.formatRules_.end(), [first, delta] (FormatRule const& rule) {
+      return rule.column_ < first && rule.column_ >= first + delta;
+    }), doc.formatRules_.end());
+
+    for (auto & rule : doc.formatRules_)
+      if (rule.column_ >= first)
+        rule.column_ += delta;
+  }
+
+  // The number of cell that rules compare, false for text and empty cells. A cell a sliced
+  // recalculation hasn't reached yet keeps the value it is drawn with.
+  static bool styleValue(Document & doc, Index const& idx, Cell & cell, double & value)
+  {
+    if (cell.type == CellType::Text)
+      return false;
+
+    if (!cell.evaluated && !doc.recalcStale_.count(idx.key()))
+      evaluateCell(idx, cell);
+
+    value = cell.value;
+    return !std::isnan(value);
+  }
+
+  // Counts the cells of the column of a Duplicate rule by their value
+  static void countValues(Document & doc, FormatRule & rule)
+  {
+    rule.numbers_.clear();
+    rule.texts_.clear();
+    rule.formulas_ = false;
+
+    for (int y = 0; y < doc.height_; ++y)
+    {
+      const Index idx(rule.column_, y);
+      Cell * cell = doc.cells_.find(idx);
+      if (!cell)
+        continue;
+
+      rule.formulas_ = rule.formulas_ || cell->hasExpression();
+
+      double value;
+      if (styleValue(doc, idx, *cell, value))
+        rule.numbers_[lookupKey(value)]++;
+      else if (cell->type == CellType::Text && !doc.strings_.str(cell->text).empty())
+        rule.texts_[cell->text]++;
+    }
+
+    rule.stale_ = false;
+    rule.height_ = doc.height_;
+    rule.changes_ = doc.changes_;
+  }
+
+  // Brings what the rules read of whole columns up to date, a new generation of styles
+  // starts when that changed. While a sliced recalculation runs the rules over formulas
+  // keep what they have, rather than reading their column again with every slice.
+  static void updateFormatRules(Document & doc)
+  {
+    const bool recalculating = doc.recalcPosition_ < doc.recalcQueue_.size();
+
+    for (auto & rule : doc.formatRules_)
+    {
+      if (rule.kind_ == FormatRule::Duplicate)
+      {
+        if (!rule.stale_ && rule.height_ == doc.height_ && (!rule.formulas_ || recalculating || rule.changes_ == doc.changes_))
+          continue;
+
+        countValues(doc, rule);
+        doc.styleGeneration_++;
+      }
+      else if (rule.kind_ == FormatRule::Top || rule.kind_ == FormatRule::Bottom)
+      {
+        if (!rule.stale_ && (recalculating || rule.changes_ == doc.changes_))
+          continue;
+
+        // The sketch follows edits of single cells, so most changes only read it again
+        const double share = std::min(std::max(rule.value_, 0.0), 100.0) / 100.0;
+        auto const& quantiles = useColumnSketch(doc, rule.column_).summary_.quantiles_;
+        const double threshold = quantiles.count() > 0 ? quantiles.quantile(rule.kind_ == FormatRule::Top ? 1.0 - share : share) : NAN;
+
+        if (lookupKey(threshold) != lookupKey(rule.threshold_))
+          doc.styleGeneration_++;
+
+        rule.threshold_ = threshold;
+        rule.stale_ = false;
+        rule.changes_ = doc.changes_;
+      }
+    }
+  }
+
+  static bool ruleMatches(Document & doc, FormatRule const& rule, Index const& idx, Cell & cell)
+  {
+    double value = 0.0;
+    const bool number = styleValue(doc, idx, cell, value);
+    const bool text = cell.type == CellType::Text && !doc.strings_.str(cell.text).empty();
+
+    switch (rule.kind_)
+    {
+      case FormatRule::Above:
+        return number && value > rule.value_;
+
+      case FormatRule::Below:
+        return number && value < rule.value_;
+
+      case FormatRule::Top:
+        return number && value >= rule.threshold_;
+
+      case FormatRule::Bottom:
+        return number && value <= rule.threshold_;
+
+      case FormatRule::Equal:
+        if (number && rule.number_)
+          return value == rule.value_;
+
+        return cell.type != CellType::Formula && doc.strings_.str(cell.text) == StrView(rule.text_);
+
+      case FormatRule::Duplicate:
+        if (number)
+        {
+          uint32_t const* count = rule.numbers_.find(lookupKey(value));
+          return count && *count > 1;
+        }
+
+        if (text)
+        {
+          uint32_t const* count = rule.texts_.find(cell.text);
+          return count && *count > 1;
+        }
+
+        return false;
+    }
+
+    return false;
+  }
+
+  bool hasCellStyles(Document const& doc)
+  {
+    return (!doc.formatRules_.empty() || !doc.markedCells_.empty()) && !doc.loading_ && !doc.paged_;
+  }
+
+  uint16_t cellStyle(Document & doc, Index const& index, Cell * cell)
+  {
+    if (!doc.markedCells_.empty() && doc.markedCells_.count(index.key()))
+      return view::COLOR_HIGHLIGHT;
+
+    if (std::none_of(doc.formatRules_.begin(), doc.formatRules_.end(), [&index] (FormatRule const& rule) { return rule.column_ == index.x; }))
+      return 0;
+
+    if (!cell)
+      return 0;
+
+    updateFormatRules(doc);
+
+    CachedStyle const* cached = doc.cellStyles_.find(index.key());
+    if (cached && cached->generation_ == doc.styleGeneration_ && cached->type_ == cell->type && cached->text_ == cell->text &&
+        lookupKey(cached->value_) == lookupKey(cell->value))
+    {
+      STYLE_COUNTERS.hit();
+      return cached->style_;
+    }
+
+    STYLE_COUNTERS.miss();
+
+    uint16_t style = 0;
+    for (auto const& rule : doc.formatRules_)
+      if (rule.column_ == index.x && ruleMatches(doc, rule, index, *cell))
+        style |= rule.style_;
+
+    if (doc.cellStyles_.size() >= MAX_CACHED_STYLES)
+      doc.cellStyles_.clear();
+
+    doc.cellStyles_[index.key()] = CachedStyle { cell->value, cell->text, cell->type, doc.styleGeneration_, style };
+    return style;
+  }
+
+  static const struct { const char * name_; FormatRule::Kind kind_; bool value_; } FORMAT_KINDS[] = {
+    { ">", FormatRule::Above, true },
+    { "<", FormatRule::Below, true },
+    { "=", FormatRule::Equal, true },
+    { "duplicate", FormatRule::Duplicate, false },
+    { "top", FormatRule::Top, true },
+    { "bottom", FormatRule::Bottom, true },
+  };
+
+  static const struct { const char * name_; uint16_t style_; } FORMAT_STYLES[] = {
+    { "highlight", view::COLOR_HIGHLIGHT },
+    { "bold", view::COLOR_BOLD },
+    { "underline", view::COLOR_UNDERLINE },
+    { "reverse", view::COLOR_REVERSE },
+  };
+
+  TCL_SUBFUNC(highlight, "add",   "column kind ?value? ?style?", "Draws the cells of column that are > value, < value or = value, the duplicate ones, or the ones in the top or bottom value percent of the numbers with style, a list of highlight, bold, underline and reverse, highlight by default. Only the cells on screen are checked.",
+                         "clear", "?column?",                    "Removes the rules of column, or all of them",
+                         "list",  "",                            "Returns the rules of the current document as lists of column, kind, value and style")
+  {
+    enum { CMD_ADD, CMD_CLEAR, CMD_LIST };
+
+    Document & doc = currentDoc();
+
+    if (subCommand == CMD_LIST)
+    {
+      TCL_CHECK_ARG_DESC(0, "");
+
+      Jim_Obj * list = Jim_NewListObj(interp, nullptr, 0);
+      for (auto const& rule : doc.formatRules_)
+      {
+        Jim_Obj * item = Jim_NewListObj(interp, nullptr, 0);
+        Jim_ListAppendElement(interp, item, Jim_NewStringObj(interp, Index::columnToStr(rule.column_).c_str(), -1));
+
+        for (auto const& kind : FORMAT_KINDS)
+          if (kind.kind_ == rule.kind_)
+          {
+            Jim_ListAppendElement(interp, item, Jim_NewStringObj(interp, kind.name_, -1));
+            Jim_ListAppendElement(interp, item, Jim_NewStringObj(interp, rule.text_.c_str(), -1));
+          }
+
+        Jim_Obj * styles = Jim_NewListObj(interp, nullptr, 0);
+        for (auto const& style : FORMAT_STYLES)
+          if (rule.style_ & style.style_)
+            Jim_ListAppendElement(interp, styles, Jim_NewStringObj(interp, style.name_, -1));
+
+        Jim_ListAppendElement(interp, item, styles);
+        Jim_ListAppendElement(interp, list, item);
+      }
+
+      Jim_SetResult(interp, list);
+      return JIM_OK;
+    }
+
+    if (subCommand == CMD_CLEAR)
+    {
+      TCL_CHECK_ARGS_DESC(0, 1, "?column?");
+
+      const int column = argc == 1 ? Index::strToColumn(Jim_String(argv[0])) : -1;
+      if (argc == 1 && column < 0)
+      {
+        logError("highlight column ", Jim_String(argv[0]), " out of range");
+        return JIM_ERR;
+      }
+
+      doc.formatRules_.erase(std::remove_if(doc.formatRules_.begin(), doc.formatRules_.end(), [column] (FormatRule const& rule) {
+        return column < 0 || rule.column_ == column;
+      }), doc.formatRules_.end());
+
+      doc.cellStyles_.clear();
+      doc.styleGeneration_++;
+      return JIM_OK;
+    }
+
+    TCL_CHECK_ARGS_DESC(2, 4, "column kind ?value? ?style?");
+
+    FormatRule rule;
+    rule.column_ = Index::strToColumn(Jim_String(argv[0]));
+    if (rule.column_ < 0 || rule.column_ >= getColumnCount())
+    {
+      logError("highlight column ", Jim_String(argv[0]), " out of range");
+      return JIM_ERR;
+    }
+
+    const std::string kindName(Jim_String(argv[1]));
+    auto kind = std::find_if(std::begin(FORMAT_KINDS), std::end(FORMAT_KINDS), [&kindName] (decltype(FORMAT_KINDS[0]) kind) { return kindName == kind.name_; });
+    if (kind == std::end(FORMAT_KINDS))
+    {
+      logError("unknown highlight rule '", kindName, "'");
+      return JIM_ERR;
+    }
+
+    rule.kind_ = kind->kind_;
+
+    int arg = 2;
+    if (kind->value_)
+    {
+      if (argc <= arg)
+      {
+        logError("highlight ", kindName, " needs a value");
+        return JIM_ERR;
+      }
+
+      rule.text_ = Jim_String(argv[arg++]);
+      rule.number_ = str::parseValue(StrView(rule.text_), rule.value_);
+
+      if (!rule.number_ && rule.kind_ != FormatRule::Equal)
+      {
+        logError("highlight ", kindName, " needs a number, not '", rule.text_, "'");
+        return JIM_ERR;
+      }
+    }
+
+    if (argc > arg + 1)
+    {
+      logError("too many arguments to highlight ", kindName);
+      return JIM_ERR;
+    }
+
+    rule.style_ = view::COLOR_HIGHLIGHT;
+    if (arg < argc)
+    {
+      rule.style_ = 0;
+
+      const int count = Jim_ListLength(interp, argv[arg]);
+      for (int i = 0; i < count; ++i)
+      {
+        const std::string name(Jim_String(Jim_ListGetIndex(interp, argv[arg], i)));
+        auto style = std::find_if(std::begin(FORMAT_STYLES), std::end(FORMAT_STYLES), [&name] (decltype(FORMAT_STYLES[0]) style) { return name == style.name_; });
+        if (style == std::end(FORMAT_STYLES))
+        {
+          logError("unknown highlight style '", name, "'");
+          return JIM_ERR;
+        }
+
+        rule.style_ |= style->style_;
+      }
+    }
+
+    doc.formatRules_.push_back(std::move(rule));
+    doc.styleGeneration_++;
+    return JIM_OK;
+  }
+}
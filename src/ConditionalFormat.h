@@ -0,0 +1,35 @@
+#pragma once
+
+#include "Cell.h"
+#include "Index.h"
+
+#include <cstdint>
+#include <vector>
+
+// Conditional formatting: per column rules of the highlight command give the cells they
+// match a style. Only the cells drawn are checked, their styles are cached per cell, and
+// what a rule reads of its whole column, value counts or a quantile of the column
+// sketch, is kept up to date as the column changes.
+namespace doc {
+
+  struct Document;
+  struct FormatRule;
+
+  // Whether format rules or marked cells may give a cell of doc a style
+  bool hasCellStyles(Document const& doc);
+
+  // The style of cell, the one at index of doc or nullptr, once hasCellStyles(doc)
+  uint16_t cellStyle(Document & doc, Index const& index, Cell * cell);
+
+  // Takes the cell at idx, which is about to be set, out of the value counts of the
+  // duplicate rules of its column that are up to date, and adds those rules to counted
+  void uncountRuleValues(Document & doc, Index const& idx, std::vector<FormatRule *> & counted);
+
+  // Counts cell, just set, for the rules uncountRuleValues() gave counted. height is the
+  // row count of doc before the edit.
+  void countRuleValues(Document & doc, Cell const& cell, int height, std::vector<FormatRule *> const& counted);
+
+  // Format rules move along with their columns, the ones of dropped columns go with them.
+  // The marked cells are let go.
+  void shiftFormatRules(Document & doc, int Index::* axis, int first, int delta);
+}
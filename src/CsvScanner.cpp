@@ -0,0 +1,172 @@
+
+#include "CsvScanner.h"
+#include "bx/platform.h"
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#  define CSV_SCAN_AVX2 1
+#elif defined(__SSE2__) || (BX_COMPILER_MSVC && (BX_ARCH_64BIT || _M_IX86_FP >= 2))
+#  include <emmintrin.h>
+#  define CSV_SCAN_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define CSV_SCAN_NEON 1
+#endif
+
+#if BX_COMPILER_MSVC
+#  include <intrin.h>
+#endif
+
+namespace csv {
+
+  static inline uint32_t countTrailingZeros(uint32_t mask)
+  {
+#if BX_COMPILER_MSVC
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+  }
+
+  static inline uint32_t countBits(uint32_t mask)
+  {
+#if BX_COMPILER_MSVC
+    return __popcnt(mask);
+#else
+    return __builtin_popcount(mask);
+#endif
+  }
+
+  // Returns a mask with bit i set when byte i of the block at data equals a, b or c
+#if CSV_SCAN_AVX2
+  static const std::size_t BLOCK_SIZE = 32;
+
+  static inline uint32_t matchBlock(const char * data, char a, char b, char c)
+  {
+    const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+    const __m256i match = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(a)),
+                                                          _mm256_cmpeq_epi8(block, _mm256_set1_epi8(b))),
+                                          _mm256_cmpeq_epi8(block, _mm256_set1_epi8(c)));
+    return static_cast<uint32_t>(_mm256_movemask_epi8(match));
+  }
+#elif CSV_SCAN_SSE2
+  static const std::size_t BLOCK_SIZE = 16;
+
+  static inline uint32_t matchBlock(const char * data, char a, char b, char c)
+  {
+    const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+    const __m128i match = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(a)),
+                                                    _mm_cmpeq_epi8(block, _mm_set1_epi8(b))),
+                                       _mm_cmpeq_epi8(block, _mm_set1_epi8(c)));
+    return static_cast<uint32_t>(_mm_movemask_epi8(match));
+  }
+#elif CSV_SCAN_NEON
+  static const std::size_t BLOCK_SIZE = 16;
+
+  static inline uint32_t matchBlock(const char * data, char a, char b, char c)
+  {
+    static const uint8_t BIT_WEIGHTS[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+
+    const uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t *>(data));
+    const uint8x16_t match = vorrq_u8(vorrq_u8(vceqq_u8(block, vdupq_n_u8(a)),
+                                               vceqq_u8(block, vdupq_n_u8(b))),
+                                      vceqq_u8(block, vdupq_n_u8(c)));
+
+    // There is no movemask on NEON, so weight each lane by its bit and add up each half
+    const uint8x16_t bits = vandq_u8(match, vld1q_u8(BIT_WEIGHTS));
+    return vaddv_u8(vget_low_u8(bits)) | (vaddv_u8(vget_high_u8(bits)) << 8);
+  }
+#else
+  static const std::size_t BLOCK_SIZE = 16;
+
+  static inline uint32_t matchBlock(const char * data, char a, char b, char c)
+  {
+    uint32_t mask = 0;
+    for (std::size_t i = 0; i < BLOCK_SIZE; ++i)
+      if (data[i] == a || data[i] == b || data[i] == c)
+        mask |= 1u << i;
+
+    return mask;
+  }
+#endif
+
+  void findStructure(StrView data, char delimiter, char quote, std::vector<uint32_t> & offsets)
+  {
+    const char * ptr = data.data();
+    const std::size_t size = data.size();
+    std::size_t i = 0;
+
+    for (; i + BLOCK_SIZE <= size; i += BLOCK_SIZE)
+    {
+      uint32_t mask = matchBlock(ptr + i, delimiter, '\n', quote);
+
+      while (mask != 0)
+      {
+        offsets.push_back(i + countTrailingZeros(mask));
+        mask &= mask - 1;
+      }
+    }
+
+    for (; i < size; ++i)
+      if (ptr[i] == delimiter || ptr[i] == '\n' || ptr[i] == quote)
+        offsets.push_back(i);
+  }
+
+  std::size_t count(StrView data, char ch)
+  {
+    const char * ptr = data.data();
+    const std::size_t size = data.size();
+    std::size_t i = 0;
+    std::size_t result = 0;
+
+    for (; i + BLOCK_SIZE <= size; i += BLOCK_SIZE)
+      result += countBits(matchBlock(ptr + i, ch, ch, ch));
+
+    for (; i < size; ++i)
+      if (ptr[i] == ch)
+        result++;
+
+    return result;
+  }
+
+  bool needsQuotes(StrView text, char delimiter)
+  {
+    for (char ch : text)
+      if (ch == delimiter || ch == QUOTE || ch == '\n' || ch == '\r')
+        return true;
+
+    return false;
+  }
+
+  StrView Reader::fieldText(StrView data, std::size_t start, std::size_t end, bool quoted, bool escaped, std::size_t closeQuote)
+  {
+    if (!quoted)
+      return data.substr(start, end - start);
+
+    // Anything between the closing quote and the delimiter is kept, the way spreadsheets
+    // read it
+    const StrView inner = data.substr(start + 1, closeQuote - start - 1);
+    const StrView tail = closeQuote + 1 < end ? data.substr(closeQuote + 1, end - closeQuote - 1) : StrView();
+
+    if (!escaped && tail.empty())
+      return inner;
+
+    // Copies the runs between doubled quotes, each up to and including its first quote
+    unquoted_.clear();
+
+    std::size_t pos = 0;
+    for (std::size_t found = inner.find(quote_); found != StrView::npos; found = inner.find(quote_, pos))
+    {
+      unquoted_.append(inner.data() + pos, found + 1 - pos);
+      pos = found + 2;
+    }
+
+    if (pos < inner.size())
+      unquoted_.append(inner.data() + pos, inner.size() - pos);
+
+    unquoted_.append(tail.data(), tail.size());
+    return StrView(unquoted_);
+  }
+}
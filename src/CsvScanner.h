@@ -0,0 +1,118 @@
+#pragma once
+
+#include "Str.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Vectorized scanning of CSV data. The kernels compare 32 (AVX2) or 16 (SSE2, NEON)
+// bytes at a time and fall back to plain loops on other targets.
+namespace csv {
+
+  // Appends the offsets of every delimiter, newline and quote char in data. Pass the
+  // delimiter as quote to ignore quotes.
+  void findStructure(StrView data, char delimiter, char quote, std::vector<uint32_t> & offsets);
+
+  // Returns the number of times ch occurs in data
+  std::size_t count(StrView data, char ch);
+
+  static const char QUOTE = '"';
+
+  // Returns true if text has to be quoted to be read back as one field
+  bool needsQuotes(StrView text, char delimiter);
+
+  // Splits CSV data into fields as RFC 4180 has it: a field in quotes may hold delimiters,
+  // line breaks and doubled quotes, and lines end in "\n" or "\r\n". A quote anywhere
+  // but at the start of a field is kept as it is. The reader walks the offsets found by
+  // findStructure() once and never backtracks.
+  class Reader
+  {
+    public:
+      Reader(char delimiter, char quote = QUOTE) : delimiter_(delimiter), quote_(quote) { }
+
+      // Calls field(text, lineEnd) for every field of data in order, lineEnd is true
+      // for the last field of a line that ends in a line break. text points into data,
+      // or into the reader for fields with doubled quotes, until field returns.
+      template <typename FieldFunc>
+      void read(StrView data, FieldFunc const& field);
+
+      // Only the fields of the columns keep is true for are unquoted, the others are
+      // passed to field empty. Null keeps every column.
+      void keepColumns(std::vector<bool> const* keep) { keep_ = keep; }
+
+      // While field runs, the offset in data past the field and its delimiter or line break
+      std::size_t fieldEnd() const { return fieldEnd_; }
+
+    private:
+      // The text of the field from start to end, closeQuote is the quote ending a
+      // quoted field
+      StrView fieldText(StrView data, std::size_t start, std::size_t end, bool quoted, bool escaped, std::size_t closeQuote);
+
+    private:
+      char delimiter_;
+      char quote_;
+      std::vector<uint32_t> structure_;
+      std::string unquoted_;
+      std::vector<bool> const* keep_ = nullptr;
+      std::size_t fieldEnd_ = 0;
+  };
+
+  template <typename FieldFunc>
+  void Reader::read(StrView data, FieldFunc const& field)
+  {
+    structure_.clear();
+    structure_.reserve(data.size() / 8);
+    findStructure(data, delimiter_, quote_, structure_);
+
+    std::size_t start = 0;
+    std::size_t closeQuote = 0;
+    bool quoted = false;
+    bool inQuotes = false;
+    bool escaped = false;
+    std::size_t column = 0;
+
+    for (auto offset : structure_)
+    {
+      const char ch = data[offset];
+
+      // A quote right after the closing quote is a doubled quote, and opens the field again
+      if (ch == quote_)
+      {
+        if (inQuotes)
+        {
+          inQuotes = false;
+          closeQuote = offset;
+        }
+        else if (offset == start || (quoted && offset == closeQuote + 1))
+        {
+          escaped = escaped || offset != start;
+          quoted = inQuotes = true;
+        }
+
+        continue;
+      }
+
+      if (inQuotes)
+        continue;
+
+      const bool lineEnd = ch == '\n';
+      const std::size_t end = lineEnd && offset > start && data[offset - 1] == '\r' ? offset - 1 : offset;
+
+      const bool kept = !keep_ || (column < keep_->size() && (*keep_)[column]);
+      fieldEnd_ = offset + 1;
+      field(kept ? fieldText(data, start, end, quoted, escaped, closeQuote) : StrView(), lineEnd);
+
+      start = offset + 1;
+      quoted = escaped = false;
+      column = lineEnd ? 0 : column + 1;
+    }
+
+    // The last line may not end with a line break, or even close its quotes
+    fieldEnd_ = data.size();
+    if (start < data.size() && (!keep_ || (column < keep_->size() && (*keep_)[column])))
+      field(fieldText(data, start, data.size(), quoted, escaped, inQuotes ? data.size() : closeQuote), false);
+    else if (start < data.size())
+      field(StrView(), false);
+  }
+}
@@ -0,0 +1,129 @@
+#include "Dedupe.h"
+#include "MurmurHash.h"
+#include "Scheduler.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace dedupe {
+
+  // Rows hashed by one task, fewer rows aren't worth the partitions of another range
+  static const std::size_t RANGE_ROWS = 64 * 1024;
+
+  static const uint32_t SEED = 0x9747b28c;
+
+  // The rows a range dealt to one partition, in order, and their hashes
+  struct Bucket
+  {
+    std::vector<uint32_t> rows_;
+    std::vector<uint32_t> hashes_;
+  };
+
+  static void hashRange(std::vector<uint32_t> const& keys, std::size_t width, std::size_t first, std::size_t last,
+                        int partitionBits, std::vector<Bucket> & buckets)
+  {
+    for (auto & bucket : buckets)
+    {
+      bucket.rows_.reserve((last - first) / buckets.size() + 16);
+      bucket.hashes_.reserve(bucket.rows_.capacity());
+    }
+
+    for (std::size_t row = first; row < last; ++row)
+    {
+      const uint32_t hash = murmurHash(&keys[row * width], width * sizeof(uint32_t), SEED);
+      Bucket & bucket = buckets[partitionBits == 0 ? 0 : hash >> (32 - partitionBits)];
+
+      bucket.rows_.push_back(row);
+      bucket.hashes_.push_back(hash);
+    }
+  }
+
+  // Sets first[row] for the rows of partition that are the first of their key. The
+  // ranges are visited in order, so the first row of a key probes the table first.
+  static void probePartition(std::vector<uint32_t> const& keys, std::size_t width, std::vector<std::vector<Bucket>> const& ranges,
+                             std::size_t partition, std::vector<uint8_t> & first)
+  {
+    std::size_t count = 0;
+    for (auto const& buckets : ranges)
+      count += buckets[partition].rows_.size();
+
+    // At most three quarters full. A slot holds the hash of its key over its row plus one, so a
+    // probe reads one word, and is 0 when empty.
+    std::size_t capacity = 16;
+    while (capacity * 3 < count * 4)
+      capacity *= 2;
+
+    const std::size_t mask = capacity - 1;
+    std::vector<uint64_t> slots(capacity, 0);
+
+    for (auto const& buckets : ranges)
+    {
+      Bucket const& bucket = buckets[partition];
+
+      for (std::size_t i = 0; i < bucket.rows_.size(); ++i)
+      {
+        const uint32_t row = bucket.rows_[i];
+        const uint32_t hash = bucket.hashes_[i];
+        uint32_t const* key = &keys[(std::size_t)row * width];
+
+        for (std::size_t slot = murmurMix64(hash) & mask; ; slot = (slot + 1) & mask)
+        {
+          const uint64_t entry = slots[slot];
+          if (entry == 0)
+          {
+            slots[slot] = (uint64_t)hash << 32 | (row + 1);
+            first[row] = 1;
+            break;
+          }
+
+          if (entry >> 32 == hash && memcmp(&keys[(std::size_t)((uint32_t)entry - 1) * width], key, width * sizeof(uint32_t)) == 0)
+            break;
+        }
+      }
+    }
+  }
+
+  std::vector<uint32_t> firstRows(std::vector<uint32_t> const& keys, std::size_t width)
+  {
+    const std::size_t rowCount = width == 0 ? 0 : keys.size() / width;
+    const std::size_t rangeCount = std::max<std::size_t>(1, std::min<std::size_t>(rowCount / RANGE_ROWS, Scheduler::shared().threadCount()));
+
+    // As many partitions as ranges, rounded up to a power of two
+    int partitionBits = 0;
+    while (((std::size_t)1 << partitionBits) < rangeCount)
+      partitionBits++;
+
+    const std::size_t partitionCount = (std::size_t)1 << partitionBits;
+
+    std::vector<std::vector<Bucket>> ranges(rangeCount, std::vector<Bucket>(partitionCount));
+    std::vector<Scheduler::Task> tasks;
+
+    for (std::size_t r = 0; r < rangeCount; ++r)
+    {
+      const std::size_t first = rowCount * r / rangeCount;
+      const std::size_t last = rowCount * (r + 1) / rangeCount;
+
+      std::vector<Bucket> * buckets = &ranges[r];
+      tasks.push_back([&keys, width, first, last, partitionBits, buckets] () {
+        hashRange(keys, width, first, last, partitionBits, *buckets);
+      });
+    }
+
+    Scheduler::shared().run(tasks);
+    tasks.clear();
+
+    // Every partition sets the flags of its own rows
+    std::vector<uint8_t> first(rowCount, 0);
+    for (std::size_t p = 0; p < partitionCount; ++p)
+      tasks.push_back([&keys, width, &ranges, p, &first] () { probePartition(keys, width, ranges, p, first); });
+
+    Scheduler::shared().run(tasks);
+
+    std::vector<uint32_t> rows;
+    for (std::size_t row = 0; row < rowCount; ++row)
+      if (first[row])
+        rows.push_back(row);
+
+    return rows;
+  }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Distinct rows of a table given as keys, width 32 bit ids per row and the rows one after
+// the other in one array. The rows are hashed in ranges on the scheduler, each range
+// dealing its rows out to partitions by the top bits of their hashes. The partitions then
+// look for their first occurrences in parallel, each in an open addressing table of its
+// own, so equal keys always meet in the same table and no table is shared.
+namespace dedupe {
+
+  // The rows whose key no earlier row has, in order
+  std::vector<uint32_t> firstRows(std::vector<uint32_t> const& keys, std::size_t width);
+}
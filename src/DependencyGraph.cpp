@@ -0,0 +1,340 @@
+
+#include "DependencyGraph.h"
+#include "Memory.h"
+
+#include <algorithm>
+
+static bool rangeContains(std::pair<Index, Index> const& range, Index const& idx)
+{
+  return idx.x >= range.first.x && idx.x <= range.second.x &&
+         idx.y >= range.first.y && idx.y <= range.second.y;
+}
+
+template <typename BucketFunc>
+bool DependencyGraph::forEachBucket(std::vector<std::pair<Index, Index>> const& ranges, BucketFunc const& bucket)
+{
+  long long count = 0;
+  for (auto const& range : ranges)
+  {
+    const long long columns = (long long)range.second.x - range.first.x + 1;
+    const long long rows = (long long)range.second.y / RANGE_BUCKET_ROWS - range.first.y / RANGE_BUCKET_ROWS + 1;
+    count += std::max(columns, 0LL) * std::max(rows, 0LL);
+  }
+
+  if (count > MAX_RANGE_BUCKETS)
+    return false;
+
+  // Ranges of a formula that overlap share buckets, each is passed once
+  FlatHashSet seen;
+  for (auto const& range : ranges)
+    for (int x = range.first.x; x <= range.second.x; ++x)
+      for (int y = range.first.y / RANGE_BUCKET_ROWS; y <= range.second.y / RANGE_BUCKET_ROWS; ++y)
+        if (seen.insert(Index(x, y).key()))
+          bucket(Index(x, y).key());
+
+  return true;
+}
+
+void DependencyGraph::indexRanges(uint64_t formula, Precedents const& precedents)
+{
+  if (precedents.ranges_.empty())
+    return;
+
+  const bool indexed = forEachBucket(precedents.ranges_, [this, formula] (uint64_t key) {
+    rangeBuckets_[key].push_back(formula);
+  });
+
+  if (!indexed)
+    wideRangeFormulas_.insert(formula);
+}
+
+void DependencyGraph::unindexRanges(uint64_t formula, Precedents const& precedents)
+{
+  if (precedents.ranges_.empty())
+    return;
+
+  if (wideRangeFormulas_.erase(formula) > 0)
+    return;
+
+  forEachBucket(precedents.ranges_, [this, formula] (uint64_t key) {
+    std::vector<uint64_t> * list = rangeBuckets_.find(key);
+    if (!list)
+      return;
+
+    list->erase(std::remove(list->begin(), list->end(), formula), list->end());
+
+    if (list->empty())
+      rangeBuckets_.erase(key);
+  });
+}
+
+void DependencyGraph::setPrecedents(Index const& cell, std::vector<Expr> const& expression, int sheet)
+{
+  removeCell(cell);
+
+  Precedents precedents;
+
+  for (auto const& expr : expression)
+  {
+    if (expr.sheet_ != sheet)
+      continue;
+
+    if (expr.type_ == Expr::Cell)
+      precedents.cells_.push_back(expr.startIndex_);
+    else if (expr.type_ == Expr::Range)
+      precedents.ranges_.push_back(std::make_pair(expr.startIndex_, expr.endIndex_));
+  }
+
+  if (precedents.cells_.empty() && precedents.ranges_.empty())
+    return;
+
+  for (auto const& idx : precedents.cells_)
+    dependents_[idx.key()].push_back(cell);
+
+  indexRanges(cell.key(), precedents);
+  precedents_[cell.key()] = std::move(precedents);
+}
+
+void DependencyGraph::removeCell(Index const& cell)
+{
+  Precedents const* precedents = precedents_.find(cell.key());
+  if (!precedents)
+    return;
+
+  for (auto const& idx : precedents->cells_)
+  {
+    std::vector<Index> * list = dependents_.find(idx.key());
+    if (!list)
+      continue;
+
+    list->erase(std::remove(list->begin(), list->end(), cell), list->end());
+
+    if (list->empty())
+      dependents_.erase(idx.key());
+  }
+
+  unindexRanges(cell.key(), *precedents);
+  precedents_.erase(cell.key());
+}
+
+void DependencyGraph::clear()
+{
+  precedents_.clear();
+  dependents_.clear();
+  rangeBuckets_.clear();
+  wideRangeFormulas_.clear();
+}
+
+void DependencyGraph::shift(int Index::* axis, int first, int delta, bool moveReferences)
+{
+  if (delta == 0)
+    return;
+
+  auto dropped = [axis, first, delta] (Index const& idx) { return idx.*axis < first && idx.*axis >= first + delta; };
+
+  auto move = [axis, first, delta] (Index & idx) {
+    if (idx.*axis >= first)
+      idx.*axis += delta;
+  };
+
+  // Entries that keep their key are updated where they are, the others are taken out
+  // and put back under their new key. Formulas that moved can't land on one that stayed.
+  std::vector<uint64_t> erased;
+  std::vector<std::pair<uint64_t, Precedents>> moved;
+
+  for (auto & it : precedents_)
+  {
+    Index cell = Index::fromKey(it.first);
+    if (dropped(cell))
+    {
+      erased.push_back(it.first);
+      continue;
+    }
+
+    Precedents & precedents = it.second;
+    if (moveReferences)
+    {
+      for (auto & idx : precedents.cells_)
+        move(idx);
+
+      for (auto & range : precedents.ranges_)
+      {
+        move(range.first);
+        move(range.second);
+      }
+    }
+
+    if (cell.*axis >= first)
+    {
+      move(cell);
+      erased.push_back(it.first);
+      moved.emplace_back(cell.key(), std::move(precedents));
+    }
+  }
+
+  for (uint64_t key : erased)
+    precedents_.erase(key);
+
+  for (auto & it : moved)
+    precedents_.insert(it.first, std::move(it.second));
+
+  // Most ranges moved or now belong to a formula that did, the index is made again
+  rangeBuckets_.clear();
+  wideRangeFormulas_.clear();
+
+  for (auto const& it : precedents_)
+    indexRanges(it.first, it.second);
+
+  // A cell that moved onto a dropped one that was referenced takes over its dependents
+  erased.clear();
+  std::vector<std::pair<uint64_t, std::vector<Index>>> movedDependents;
+
+  for (auto & it : dependents_)
+  {
+    Index idx = Index::fromKey(it.first);
+
+    std::vector<Index> & list = it.second;
+    list.erase(std::remove_if(list.begin(), list.end(), dropped), list.end());
+
+    for (auto & cell : list)
+      move(cell);
+
+    if (moveReferences && idx.*axis >= first)
+    {
+      move(idx);
+      erased.push_back(it.first);
+      if (!list.empty())
+        movedDependents.emplace_back(idx.key(), std::move(list));
+    }
+    else if (list.empty())
+      erased.push_back(it.first);
+  }
+
+  for (uint64_t key : erased)
+    dependents_.erase(key);
+
+  for (auto & it : movedDependents)
+  {
+    if (std::vector<Index> * existing = dependents_.find(it.first))
+      existing->insert(existing->end(), it.second.begin(), it.second.end());
+    else
+      dependents_.insert(it.first, std::move(it.second));
+  }
+}
+
+void DependencyGraph::appendDependents(Index const& idx, FlatHashSet & visited, std::vector<Index> & result) const
+{
+  std::vector<Index> const* deps = dependents_.find(idx.key());
+  if (deps)
+  {
+    for (auto const& dep : *deps)
+      if (visited.insert(dep.key()))
+        result.push_back(dep);
+  }
+
+  auto visit = [&] (uint64_t formula) {
+    if (visited.count(formula) == 1)
+      return;
+
+    for (auto const& range : precedents_.find(formula)->ranges_)
+    {
+      if (rangeContains(range, idx))
+      {
+        visited.insert(formula);
+        result.push_back(Index::fromKey(formula));
+        return;
+      }
+    }
+  };
+
+  if (std::vector<uint64_t> const* bucket = rangeBuckets_.find(Index(idx.x, idx.y / RANGE_BUCKET_ROWS).key()))
+  {
+    for (uint64_t formula : *bucket)
+      visit(formula);
+  }
+
+  for (auto const& formula : wideRangeFormulas_)
+    visit(formula.first);
+}
+
+std::vector<Index> DependencyGraph::collectDependents(Index const& idx) const
+{
+  return collectDependents(std::vector<Index>(1, idx));
+}
+
+std::vector<Index> DependencyGraph::collectDependents(std::vector<Index> const& cells) const
+{
+  std::vector<Index> result;
+  FlatHashSet visited;
+
+  for (auto const& idx : cells)
+    if (visited.insert(idx.key()))
+      result.push_back(idx);
+
+  // The result vector doubles as the work list, so long chains don't recurse
+  for (std::size_t i = 0; i < result.size(); ++i)
+  {
+    const Index current = result[i];
+    appendDependents(current, visited, result);
+  }
+
+  return result;
+}
+
+std::vector<Index> DependencyGraph::collectReferencing(std::vector<Index> const* cells) const
+{
+  std::vector<Index> result;
+
+  if (!cells)
+  {
+    for (auto const& it : precedents_)
+      result.push_back(Index::fromKey(it.first));
+
+    return result;
+  }
+
+  FlatHashSet visited;
+  for (auto const& idx : *cells)
+    appendDependents(idx, visited, result);
+
+  return result;
+}
+
+std::vector<Index> DependencyGraph::collectReferencing(int Index::* axis, int position) const
+{
+  std::vector<Index> result;
+
+  for (auto const& it : precedents_)
+  {
+    Precedents const& precedents = it.second;
+
+    bool found = std::any_of(precedents.cells_.begin(), precedents.cells_.end(), [axis, position] (Index const& idx) {
+      return idx.*axis == position;
+    });
+
+    found = found || std::any_of(precedents.ranges_.begin(), precedents.ranges_.end(), [axis, position] (std::pair<Index, Index> const& range) {
+      return range.first.*axis <= position && range.second.*axis >= position;
+    });
+
+    if (found)
+      result.push_back(Index::fromKey(it.first));
+  }
+
+  return result;
+}
+
+std::size_t DependencyGraph::memoryUsage() const
+{
+  std::size_t bytes = precedents_.memoryUsage() + dependents_.memoryUsage() + rangeBuckets_.memoryUsage() + wideRangeFormulas_.memoryUsage();
+
+  for (auto const& it : precedents_)
+    bytes += memory::bytes(it.second.cells_) + memory::bytes(it.second.ranges_);
+
+  for (auto const& it : dependents_)
+    bytes += memory::bytes(it.second);
+
+  for (auto const& it : rangeBuckets_)
+    bytes += memory::bytes(it.second);
+
+  return bytes;
+}
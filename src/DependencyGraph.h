@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Index.h"
+#include "Expression.h"
+#include "FlatHashMap.h"
+
+#include <vector>
+
+// Tracks which cells a formula references (its precedents) and, in reverse,
+// which formulas reference a cell (its dependents). This lets an edit
+// recalculate only the cells that are affected by it.
+//
+// The formulas with ranges are indexed by the cells they cover, in buckets of a column
+// and RANGE_BUCKET_ROWS rows, so a changed cell only looks at the ranges of its bucket.
+// A formula whose ranges cover more than MAX_RANGE_BUCKETS buckets is looked at for
+// every cell instead.
+//
+// A graph follows the references to one document, the one of the formulas unless it
+// is given a sheet. The formulas of a graph for another sheet depend on cells of that
+// document and are only ever collected with collectReferencing().
+class DependencyGraph
+{
+  public:
+    static const int RANGE_BUCKET_ROWS = 1024;
+    static const long long MAX_RANGE_BUCKETS = 4096;
+
+    // Replaces the precedents of the formula in cell with the references to sheet found in expression.
+    void setPrecedents(Index const& cell, std::vector<Expr> const& expression, int sheet = Expr::NO_SHEET);
+
+    // Forgets everything about cell as a formula. Other formulas may still depend on it.
+    void removeCell(Index const& cell);
+
+    void clear();
+
+    // Moves the formulas at or after first along axis by delta, the way a structural edit
+    // moves cells. With a negative delta the formulas in the -delta lines before first
+    // are dropped. With moveReferences their references at or after first move along,
+    // a graph for another sheet keeps them.
+    void shift(int Index::* axis, int first, int delta, bool moveReferences);
+
+    // Collects idx followed by every cell that transitively depends on it.
+    std::vector<Index> collectDependents(Index const& idx) const;
+
+    // Collects cells followed by every other cell that transitively depends on one of them.
+    std::vector<Index> collectDependents(std::vector<Index> const& cells) const;
+
+    // Collects the formulas that reference one of cells, or every formula with references
+    // when cells is nullptr. The cells themselves aren't collected.
+    std::vector<Index> collectReferencing(std::vector<Index> const* cells) const;
+
+    // Collects the formulas that reference a cell of the line at position along axis,
+    // itself or through a range
+    std::vector<Index> collectReferencing(int Index::* axis, int position) const;
+
+    bool empty() const { return precedents_.empty(); }
+
+    std::size_t memoryUsage() const;
+
+  private:
+    struct Precedents
+    {
+      std::vector<Index> cells_;
+      std::vector<std::pair<Index, Index>> ranges_;
+    };
+
+    void appendDependents(Index const& idx, FlatHashSet & visited, std::vector<Index> & result) const;
+
+    // Calls bucket(key) for the key of every bucket the ranges cover, once per bucket.
+    // Returns false without calling it when they cover more than MAX_RANGE_BUCKETS.
+    template <typename BucketFunc>
+    static bool forEachBucket(std::vector<std::pair<Index, Index>> const& ranges, BucketFunc const& bucket);
+
+    void indexRanges(uint64_t formula, Precedents const& precedents);
+    void unindexRanges(uint64_t formula, Precedents const& precedents);
+
+  private:
+    // Keyed by Index::key()
+    FlatHashMap<Precedents> precedents_;
+    FlatHashMap<std::vector<Index>> dependents_;
+
+    // The formulas whose ranges cover each bucket, keyed by Index(column, row bucket),
+    // and the formulas that cover too many
+    FlatHashMap<std::vector<uint64_t>> rangeBuckets_;
+    FlatHashSet wideRangeFormulas_;
+};
@@ -0,0 +1,471 @@
+#include "Diff.h"
+#include "DocumentState.h"
+#include "Document.h"
+#include "Scheduler.h"
+#include "Log.h"
+
+#include <algorithm>
+
+namespace diff {
+
+  // Pairs the rows from first on of the middle of a and b in order
+  static void alignInOrder(std::vector<uint64_t> const& a, std::vector<uint64_t> const& b, int first, int aEnd, int bEnd, std::vector<Edit> & edits)
+  {
+    int x = first;
+    int y = first;
+
+    for (; x < aEnd && y < bEnd; ++x, ++y)
+    {
+      if (a[x] == b[y])
+        edits.push_back({ Op::Same, x, y });
+      else
+      {
+        edits.push_back({ Op::Removed, x, -1 });
+        edits.push_back({ Op::Added, -1, y });
+      }
+    }
+
+    for (; x < aEnd; ++x)
+      edits.push_back({ Op::Removed, x, -1 });
+
+    for (; y < bEnd; ++y)
+      edits.push_back({ Op::Added, -1, y });
+  }
+
+  // Appends the edits of the rows from first on of a up to aEnd and of b up to bEnd.
+  // Returns false, having appended nothing, if it takes more than maxEdits edits.
+  static bool alignMyers(std::vector<uint64_t> const& a, std::vector<uint64_t> const& b, int first, int aEnd, int bEnd, int maxEdits, std::vector<Edit> & edits)
+  {
+    const int n = aEnd - first;
+    const int m = bEnd - first;
+    const int limit = std::min(n + m, maxEdits);
+
+    // The furthest x on every diagonal k = x - y, at v[k + offset]. The diagonals of
+    // round d are kept in trace from d * d on, so the path can be followed back.
+    const int offset = limit + 1;
+    std::vector<int> v(2 * offset + 1, 0);
+    std::vector<int> trace;
+
+    int found = -1;
+    for (int d = 0; d <= limit && found < 0; ++d)
+    {
+      trace.insert(trace.end(), v.begin() + offset - d, v.begin() + offset + d + 1);
+
+      for (int k = -d; k <= d; k += 2)
+      {
+        int x = k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1]) ? v[offset + k + 1] : v[offset + k - 1] + 1;
+        int y = x - k;
+
+        while (x < n && y < m && a[first + x] == b[first + y])
+        {
+          ++x;
+          ++y;
+        }
+
+        v[offset + k] = x;
+
+        if (x >= n && y >= m)
+        {
+          found = d;
+          break;
+        }
+      }
+    }
+
+    if (found < 0)
+      return false;
+
+    // Followed back from the end, so the edits come in reverse
+    std::vector<Edit> path;
+    int x = n;
+    int y = m;
+
+    for (int d = found; d > 0; --d)
+    {
+      int const* round = &trace[(std::size_t)d * d];
+      auto at = [round, d] (int k) { return round[k + d]; };
+
+      const int k = x - y;
+      const int previousK = k == -d || (k != d && at(k - 1) < at(k + 1)) ? k + 1 : k - 1;
+      const int previousX = at(previousK);
+      const int previousY = previousX - previousK;
+
+      for (; x > previousX && y > previousY; --x, --y)
+        path.push_back({ Op::Same, first + x - 1, first + y - 1 });
+
+      if (x == previousX)
+        path.push_back({ Op::Added, -1, first + previousY });
+      else
+        path.push_back({ Op::Removed, first + previousX, -1 });
+
+      x = previousX;
+      y = previousY;
+    }
+
+    for (; x > 0 && y > 0; --x, --y)
+      path.push_back({ Op::Same, first + x - 1, first + y - 1 });
+
+    edits.insert(edits.end(), path.rbegin(), path.rend());
+    return true;
+  }
+
+  std::vector<Edit> align(std::vector<uint64_t> const& a, std::vector<uint64_t> const& b, int maxEdits)
+  {
+    const int n = a.size();
+    const int m = b.size();
+
+    int prefix = 0;
+    while (prefix < n && prefix < m && a[prefix] == b[prefix])
+      prefix++;
+
+    int suffix = 0;
+    while (suffix < n - prefix && suffix < m - prefix && a[n - suffix - 1] == b[m - suffix - 1])
+      suffix++;
+
+    std::vector<Edit> edits;
+    edits.reserve(std::max(n, m));
+
+    for (int i = 0; i < prefix; ++i)
+      edits.push_back({ Op::Same, i, i });
+
+    if (!alignMyers(a, b, prefix, n - suffix, m - suffix, maxEdits, edits))
+      alignInOrder(a, b, prefix, n - suffix, m - suffix, edits);
+
+    for (int i = suffix; i > 0; --i)
+      edits.push_back({ Op::Same, n - i, m - i });
+
+    return edits;
+  }
+}
+
+namespace doc {
+
+  // A run of removed and added rows of another count is lined up by the cells they share
+  // while that takes comparing at most this many pairs of rows
+  static const std::size_t DIFF_PAIRING_ROWS = 4096;
+
+  // One side of a diff: the document rows of a buffer and the hash of every row. header_
+  // is the document row of the header, or -1.
+  struct DiffSide
+  {
+    std::shared_ptr<Document> doc_;
+    int header_ = -1;
+    std::vector<int> rows_;
+    std::vector<uint64_t> hashes_;
+  };
+
+  // A row of the result, i indexes the rows of side a or b, -1 for the one it isn't of.
+  // Changed rows are of both.
+  struct DiffRow
+  {
+    char marker_;
+    int a_;
+    int b_;
+  };
+
+  static const uint32_t DIFF_SEEDS[] = { 0x2545f491, 0x9e3779b9 };
+
+  // What cell shows, to compare the cells of different documents. Formulas have to be
+  // evaluated, as collectDiffSide() leaves them.
+  static StrView diffText(Document const& doc, Cell const* cell, char * buffer)
+  {
+    if (!cell)
+      return StrView();
+
+    if (cell->type != CellType::Formula)
+      return doc.strings_.str(cell->text);
+
+    const StrView value = cell->displayValue(buffer);
+    return value.empty() ? StrView(cell->display()) : value;
+  }
+
+  // Collects the rows of buffer into side and evaluates their formulas, the hashes only
+  // read the cells
+  static bool collectDiffSide(long buffer, bool header, DiffSide & side)
+  {
+    if (buffer < 0 || buffer >= (long)documentBuffers().size())
+    {
+      logError("no buffer ", buffer, " to diff");
+      return false;
+    }
+
+    BufferSwitch bufferSwitch(buffer);
+
+    Document & doc = currentDoc();
+    side.doc_ = currentBuffer().doc_;
+
+    if (doc.loading_ || doc.paged_)
+    {
+      logError("can't diff a document that is loading or paged");
+      return false;
+    }
+
+    for (int x = 0; x < doc.width_; ++x)
+      doc.cells_.forEachFormula(x, 0, doc.height_ - 1, [] (Index const& idx, Cell & cell) {
+        if (!cell.evaluated)
+          evaluateCell(idx, cell);
+      });
+
+    const int rowCount = getRowCount();
+    if (header && rowCount > 0)
+      side.header_ = documentRow(0);
+
+    for (int y = header ? 1 : 0; y < rowCount; ++y)
+      side.rows_.push_back(documentRow(y));
+
+    return true;
+  }
+
+  // Hashes the width cells of every row of side, in ranges on the scheduler
+  static void hashDiffRows(DiffSide & side, int width)
+  {
+    Document const& doc = *side.doc_;
+    side.hashes_.resize(side.rows_.size());
+
+    const std::size_t rangeCount = std::max<std::size_t>(1, std::min<std::size_t>(side.rows_.size() / FILTER_CHUNK_ROWS, Scheduler::shared().threadCount()));
+    std::vector<Scheduler::Task> tasks;
+
+    for (std::size_t r = 0; r < rangeCount; ++r)
+    {
+      tasks.push_back([&side, &doc, width, r, rangeCount] () {
+        const std::size_t first = side.rows_.size() * r / rangeCount;
+        const std::size_t last = side.rows_.size() * (r + 1) / rangeCount;
+        char buffer[str::FORMAT_SIZE];
+
+        for (std::size_t i = first; i < last; ++i)
+        {
+          uint32_t hashes[2] = { DIFF_SEEDS[0], DIFF_SEEDS[1] };
+
+          // Empty cells change the hash too, so the texts can't move between columns
+          for (int x = 0; x < width; ++x)
+          {
+            const StrView text = diffText(doc, doc.cells_.find(Index(x, side.rows_[i])), buffer);
+            hashes[0] = murmurHash(text.data(), text.size(), hashes[0]);
+            hashes[1] = murmurHash(text.data(), text.size(), hashes[1]);
+          }
+
+          side.hashes_[i] = (uint64_t)hashes[0] << 32 | hashes[1];
+        }
+      });
+    }
+
+    Scheduler::shared().run(tasks);
+  }
+
+  // Cells of row i of a and row j of b with the same text
+  static int sharedCells(DiffSide const& a, int i, DiffSide const& b, int j, int width)
+  {
+    char textA[str::FORMAT_SIZE];
+    char textB[str::FORMAT_SIZE];
+
+    int shared = 0;
+    for (int x = 0; x < width; ++x)
+      if (diffText(*a.doc_, a.doc_->cells_.find(Index(x, a.rows_[i])), textA) == diffText(*b.doc_, b.doc_->cells_.find(Index(x, b.rows_[j])), textB))
+        shared++;
+
+    return shared;
+  }
+
+  // Rows of a and b in the order the alignment has them. The rows of a removed right before
+  // the ones of b added in their place are changed, pair by pair. When there are more of
+  // one, the other lines up with the run of them it shares the most cells with.
+  static std::vector<DiffRow> diffRowsInOrder(DiffSide const& a, DiffSide const& b, int width)
+  {
+    const std::vector<diff::Edit> edits = diff::align(a.hashes_, b.hashes_, DIFF_MAX_EDITS);
+
+    std::vector<DiffRow> rows;
+    std::vector<int> removed;
+    std::vector<int> added;
+
+    auto flush = [&] () {
+      const std::size_t changed = std::min(removed.size(), added.size());
+      const std::size_t shifts = std::max(removed.size(), added.size()) - changed + 1;
+      const bool moreRemoved = removed.size() > added.size();
+
+      // Every shift compares changed rows cell by cell
+      std::size_t offset = 0;
+      if (changed > 0 && shifts > 1 && shifts * changed <= DIFF_PAIRING_ROWS)
+      {
+        int best = -1;
+        for (std::size_t shift = 0; shift < shifts; ++shift)
+        {
+          int shared = 0;
+          for (std::size_t i = 0; i < changed; ++i)
+            shared += moreRemoved ? sharedCells(a, removed[shift + i], b, added[i], width) : sharedCells(a, removed[i], b, added[shift + i], width);
+
+          if (shared > best)
+          {
+            best = shared;
+            offset = shift;
+          }
+        }
+      }
+
+      const std::size_t removedOffset = moreRemoved ? offset : 0;
+      const std::size_t addedOffset = moreRemoved ? 0 : offset;
+
+      for (std::size_t i = 0; i < removedOffset; ++i)
+        rows.push_back({ '-', removed[i], -1 });
+
+      for (std::size_t i = 0; i < addedOffset; ++i)
+        rows.push_back({ '+', -1, added[i] });
+
+      for (std::size_t i = 0; i < changed; ++i)
+        rows.push_back({ '~', removed[removedOffset + i], added[addedOffset + i] });
+
+      for (std::size_t i = removedOffset + changed; i < removed.size(); ++i)
+        rows.push_back({ '-', removed[i], -1 });
+
+      for (std::size_t i = addedOffset + changed; i < added.size(); ++i)
+        rows.push_back({ '+', -1, added[i] });
+
+      removed.clear();
+      added.clear();
+    };
+
+    for (auto const& edit : edits)
+    {
+      if (edit.op_ == diff::Op::Removed)
+        removed.push_back(edit.a_);
+      else if (edit.op_ == diff::Op::Added)
+        added.push_back(edit.b_);
+      else
+        flush();
+    }
+
+    flush();
+    return rows;
+  }
+
+  // Rows of b in order, paired with the first row of a with the same key that isn't paired
+  // yet, then the rows of a that are left
+  static std::vector<DiffRow> diffRowsByKey(DiffSide const& a, DiffSide const& b, int column)
+  {
+    char buffer[str::FORMAT_SIZE];
+    auto keyText = [column, &buffer] (DiffSide const& side, int i) {
+      return diffText(*side.doc_, side.doc_->cells_.find(Index(column, side.rows_[i])), buffer);
+    };
+
+    auto keyHash = [] (StrView text) {
+      return (uint64_t)murmurHash(text.data(), text.size(), DIFF_SEEDS[0]) << 32 | murmurHash(text.data(), text.size(), DIFF_SEEDS[1]);
+    };
+
+    // The rows of a with every key as chains through next, in order. heads holds the
+    // first row of a key plus one, next the following row of the same key plus one.
+    FlatHashMap<uint32_t> heads;
+    std::vector<uint32_t> next(a.rows_.size(), 0);
+    heads.reserve(a.rows_.size());
+
+    for (std::size_t i = a.rows_.size(); i-- > 0; )
+    {
+      uint32_t & head = heads[keyHash(keyText(a, i))];
+      next[i] = head;
+      head = i + 1;
+    }
+
+    std::vector<DiffRow> rows;
+    std::vector<bool> paired(a.rows_.size(), false);
+
+    for (std::size_t i = 0; i < b.rows_.size(); ++i)
+    {
+      // The text of a row of a may be formatted into the same buffer
+      const std::string key = keyText(b, i).str();
+      uint32_t const* head = heads.find(keyHash(key));
+
+      int match = -1;
+      for (uint32_t row = head ? *head : 0; row != 0 && match < 0; row = next[row - 1])
+        if (!paired[row - 1] && keyText(a, row - 1) == key)
+          match = row - 1;
+
+      if (match < 0)
+        rows.push_back({ '+', -1, (int)i });
+      else
+      {
+        paired[match] = true;
+        if (a.hashes_[match] != b.hashes_[i])
+          rows.push_back({ '~', match, (int)i });
+      }
+    }
+
+    for (std::size_t i = 0; i < a.rows_.size(); ++i)
+      if (!paired[i])
+        rows.push_back({ '-', (int)i, -1 });
+
+    return rows;
+  }
+
+  bool diffBuffers(long bufferA, long bufferB, bool header, int keyColumn, std::size_t & added, std::size_t & removed, std::size_t & changed)
+  {
+    DiffSide a, b;
+    if (!collectDiffSide(bufferA, header, a) || !collectDiffSide(bufferB, header, b))
+      return false;
+
+    // Only the rows whose hashes differ are compared cell by cell
+    const int width = std::max(a.doc_->width_, b.doc_->width_);
+    hashDiffRows(a, width);
+    hashDiffRows(b, width);
+
+    const std::vector<DiffRow> rows = keyColumn < 0 ? diffRowsInOrder(a, b, width) : diffRowsByKey(a, b, keyColumn);
+
+    // The rows go into a new document after a column of markers and one of source rows,
+    // the sides keep their documents alive while it is filled
+    createDefaultEmpty();
+    Document & doc = currentDoc();
+
+    std::vector<uint32_t> idsA(a.doc_->strings_.size(), UINT32_MAX);
+    std::vector<uint32_t> idsB(b.doc_->strings_.size(), UINT32_MAX);
+
+    // Rows are shown counted from 1, after the header
+    const int firstShownRow = header ? 2 : 1;
+
+    auto setDiffText = [] (Index const& idx, std::string const& text) {
+      setText(idx, text);
+      fitColumnWidth(idx.x, text);
+    };
+
+    for (int x = 0; x < width; ++x)
+    {
+      const int stored = b.doc_->columns_.stored(x);
+      if (stored >= 0)
+        doc.columns_.set(x + 2, stored);
+    }
+
+    int row = 0;
+    if (a.header_ >= 0 && b.header_ >= 0)
+    {
+      setDiffText(Index(0, row), "diff");
+      setDiffText(Index(1, row), "row");
+
+      for (int x = 0; x < width; ++x)
+        copyJoinedCell(*b.doc_, Index(x, b.header_), Index(x + 2, row), idsB);
+
+      row++;
+    }
+
+    added = removed = changed = 0;
+    char textA[str::FORMAT_SIZE];
+    char textB[str::FORMAT_SIZE];
+
+    for (auto const& it : rows)
+    {
+      DiffSide const& side = it.b_ >= 0 ? b : a;
+      const int sideRow = it.b_ >= 0 ? it.b_ : it.a_;
+
+      setDiffText(Index(0, row), std::string(1, it.marker_));
+      setDiffText(Index(1, row), str::fromInt(sideRow + firstShownRow));
+
+      for (int x = 0; x < width; ++x)
+        copyJoinedCell(*side.doc_, Index(x, side.rows_[sideRow]), Index(x + 2, row), it.b_ >= 0 ? idsB : idsA);
+
+      if (it.marker_ == '~')
+        for (int x = 0; x < width; ++x)
+          if (diffText(*a.doc_, a.doc_->cells_.find(Index(x, a.rows_[it.a_])), textA) != diffText(*b.doc_, b.doc_->cells_.find(Index(x, b.rows_[it.b_])), textB))
+            doc.markedCells_.insert(Index(x + 2, row).key());
+
+      (it.marker_ == '+' ? added : it.marker_ == '-' ? removed : changed)++;
+      row++;
+    }
+
+    return true;
+  }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Alignment of two sequences of row hashes by their longest common subsequence. The rows
+// both start and end with are paired first, the rest with Myers' greedy algorithm, which
+// takes time and memory that grow with the number of edits rather than the rows.
+namespace diff {
+
+  enum class Op : uint8_t
+  {
+    Same,
+    Removed,
+    Added,
+  };
+
+  // A row of a, of b or a pair of equal rows of both, -1 for the side it isn't of
+  struct Edit
+  {
+    Op op_;
+    int32_t a_;
+    int32_t b_;
+  };
+
+  // The rows of a and b in order, with a row of a removed before the row of b added in
+  // its place. Past maxEdits edits the rows between the common start and end are paired
+  // in order instead, each pair the same or a removal followed by an addition.
+  std::vector<Edit> align(std::vector<uint64_t> const& a, std::vector<uint64_t> const& b, int maxEdits);
+}
+
+// Diffs of buffers on the alignment, into a new buffer
+namespace doc {
+
+  // Opens a new buffer with the rows that differ between bufferA and bufferB, marked and
+  // with the row they are in their buffer, and counts them into added, removed and
+  // changed. Rows are paired by the text of keyColumn, or in order if it is negative.
+  // header tells whether the first row of each buffer is one. Returns false, having
+  // logged why, when a buffer can't be diffed.
+  bool diffBuffers(long bufferA, long bufferB, bool header, int keyColumn, std::size_t & added, std::size_t & removed, std::size_t & changed);
+}
@@ -1,11 +1,62 @@
 
 #include "Document.h"
+#include "DocumentState.h"
 #include "Str.h"
+#include "Utf8.h"
 #include "Cell.h"
+#include "CellStorage.h"
+#include "ColumnIndex.h"
+#include "ColumnLayout.h"
+#include "StringPool.h"
+#include "SearchIndex.h"
+#include "TextPattern.h"
+#include "DependencyGraph.h"
+#include "FlatHashMap.h"
+#include "MappedFile.h"
+#include "InputStream.h"
+#include "CsvScanner.h"
+#include "Scheduler.h"
+#include "BinaryFormat.h"
+#include "Lz4.h"
+#include "Gzip.h"
+#include "GroupBy.h"
+#include "Join.h"
+#include "Dedupe.h"
+#include "Diff.h"
+#include "RowVisibility.h"
+#include "Query.h"
+#include "Sketch.h"
+#include "ColumnEncoding.h"
+#include "FileWriter.h"
+#include "Journal.h"
+#include "PagedTable.h"
+#include "PipelineStages.h"
+#include "Concat.h"
+#include "Top.h"
+#include "Sample.h"
+#include "LoadSelection.h"
+#include "Reload.h"
+#include "HiddenRows.h"
+#include "Viewport.h"
+#include "Estimate.h"
+#include "ConditionalFormat.h"
+#include "ParquetWriter.h"
 #include "Editor.h"
 #include "Log.h"
+#include "Profile.h"
+#include "Memory.h"
+#include "Cache.h"
+#include "MurmurHash.h"
+#include "3rdparty/tinydir/tinydir.h"
+
+#include "bx/platform.h"
+#include "bx/thread.h"
+#include "bx/mutex.h"
+#include "bx/handlealloc.h"
+#include "bx/timer.h"
 
 #include <assert.h>
+#include <sys/stat.h>
 #include <stdlib.h>
 #include <memory.h>
 #include <string.h>
@@ -14,17 +65,29 @@
 
 #include <vector>
 #include <list>
+#include <deque>
 #include <utility>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <map>
+#include <set>
 #include <unordered_map>
 #include <unordered_set>
+#include <cctype>
 #include <algorithm>
+#include <iterator>
 #include <cmath>
-
-#include <ini.h>
-
+#include <limits>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <random>
+#include <regex>
+
+// radixsort.h uses memset and memcpy without including string.h
+#include "bx/radixsort.h"
 #include "Tcl.h"
 
 namespace doc {
@@ -34,70 +97,364 @@ namespace doc {
   static const tcl::Variable DEFAULT_ROW_COUNT("doc_defaultRowCount", 40);
   static const tcl::Variable DEFAULT_COLUMN_COUNT("doc_defaultColumnCount", 16);
   static const tcl::Variable DEFAULT_COLUMN_WIDTH("doc_defaultColumnWidth", 20);
+  static const tcl::Variable SAVE_FORMAT("doc_saveFormat", "zum1");
+
+  // Codec of the column blocks of saved ZUM2 files, lz4 or none
+  static const tcl::Variable SAVE_COMPRESSION("doc_saveCompression", "lz4");
+
+  // Saving a ZUM2 file again appends the blocks that changed instead of writing all of
+  // them, until less than half of the file is still used, see appendZum2()
+  static const tcl::Variable INCREMENTAL_SAVE("doc_incrementalSave", true);
+  static const tcl::Variable LOAD_CHUNK_SIZE("doc_loadChunkSize", 4 * 1024 * 1024);
 
-  struct Document
+  // Threads used by evaluateDocument(). 1 evaluates every formula serially, 0 uses one
+  // per worker in the shared pool. With more than one thread the formulas are levelled
+  // into waves that only depend on earlier waves, and each wave is evaluated in parallel.
+  static const tcl::Variable RECALC_THREADS("doc_recalcThreads", 0);
+
+  // Fewer formulas than this are not worth levelling
+  static const std::size_t PARALLEL_RECALC_MIN_FORMULAS = 1024;
+  static const std::size_t PARALLEL_RECALC_MIN_JOB_SIZE = 256;
+
+  // With lazy evaluation a loaded document is shown before its formulas are evaluated.
+  // Cells are evaluated when they are first drawn, and the rest by evaluateIdle().
+  static const tcl::Variable LAZY_EVALUATION("doc_lazyEvaluation", false);
+
+  static const std::size_t IDLE_EVALUATION_BATCH = 4096;
+
+  // An edit that dirties at least RECALC_SLICE_MIN_CELLS cells is recalculated a slice at a
+  // time between frames, for at most doc_recalcBudget milliseconds each, the rows on screen
+  // first. Cells it hasn't reached yet are drawn with the value they had. 0 recalculates
+  // every edit before returning.
+  static const tcl::Variable RECALC_BUDGET("doc_recalcBudget", 8);
+  static const std::size_t RECALC_SLICE_MIN_CELLS = 10000;
+
+  // Cells evaluated between looks at the clock
+  static const std::size_t RECALC_CLOCK_INTERVAL = 256;
+
+  // Reads of other documents nested in each other before the innermost gives up, which
+  // ends a cycle of formulas through several documents
+  static const int MAX_SHEET_DEPTH = 64;
+
+  // CSV files of at least this many bytes are loaded on a background thread, 0 disables it
+  static const tcl::Variable BACKGROUND_LOAD_SIZE("doc_backgroundLoadSize", 16 * 1024 * 1024);
+
+  // Documents of at least this many cells are written on the scheduler by the save and
+  // export commands, while editing goes on. 0 writes every document right away.
+  static const tcl::Variable BACKGROUND_SAVE_SIZE("doc_backgroundSaveSize", 250000);
+
+  // Selections of at least this many cells have their statistics computed on the
+  // scheduler, the status line shows them once they are done. 0 computes every
+  // selection right away.
+  static const tcl::Variable SELECTION_STATS_ASYNC_CELLS("doc_selectionStatsAsyncCells", 1000000);
+
+  // CSV files of at least this many bytes are opened as read-only paged documents, that
+  // only parse the rows that are looked at. 0 disables it.
+  static const tcl::Variable PAGED_LOAD_SIZE("doc_pagedLoadSize", 1024 * 1024 * 1024);
+
+  // Paged documents keep the index of their file in a sidecar file next to it, so opening
+  // the file again while it is unchanged needs no indexing, see PagedTable
+  static const tcl::Variable PAGED_SIDECAR("doc_pagedSidecar", false);
+
+  // Megabytes of cell tiles a document keeps in memory, the rest lives in a memory mapped
+  // scratch file in doc_tileFileDirectory, /var/tmp if it is empty. 0 keeps every tile in
+  // memory. Applies to documents created after it is set.
+  static const tcl::Variable TILE_FILE_BUDGET("doc_tileFileBudget", 0);
+  static const tcl::Variable TILE_FILE_DIRECTORY("doc_tileFileDirectory", "");
+
+  // Milliseconds between looking for lines appended to the files of followed documents
+  static const tcl::Variable FOLLOW_INTERVAL("doc_followInterval", 500);
+
+  // Search terms are ECMAScript regular expressions when this is set. Those can't use
+  // the search index, so the rows are scanned on the scheduler instead.
+  static const tcl::Variable SEARCH_REGEX("doc_searchRegex", false);
+
+  static const int SEARCH_CHUNK_ROWS = 1024;
+
+  // Saves encode their column blocks and exports format their rows on the scheduler, up
+  // to this many per worker ahead of the one written. An export formats EXPORT_CHUNK_ROWS
+  // rows at once.
+  static const int WRITE_ITEMS_PER_THREAD = 8;
+  static const int EXPORT_CHUNK_ROWS = 1024;
+
+  // Filters and groupby read the columns of an unpaged document encoded when this is
+  // set, see ColumnEncoding.h. A clause over fewer rows than a block reads the cells.
+  const tcl::Variable COLUMN_ENCODING("doc_columnEncoding", true);
+
+  // A column sketch is built again once it followed more than one edit per this many
+  // rows, and is built in ranges of at least SKETCH_RANGE_ROWS rows
+  static const int SKETCH_ROWS_PER_EDIT = 100;
+  static const int SKETCH_RANGE_ROWS = 64 * 1024;
+
+  // Rows of a column formula computed at once, and the significant digits it shows like
+  // a formula cell does
+  static const int COLUMN_FORMULA_BLOCK_ROWS = 1024;
+  static const int COLUMN_FORMULA_PRECISION = 6;
+
+  // Rows of the formulas a fill down wrote that are evaluated at once
+  static const int FILL_BLOCK_ROWS = 1024;
+
+  // Rows of a column whose values fit sets its width to
+  static const int FIT_SAMPLE_ROWS = 1000;
+
+  // Lookups of the caches registered further down, see cache::Counters
+  static cache::Counters LOOKUP_COUNTERS("lookups");
+  static cache::Counters SKETCH_COUNTERS("sketches");
+
+  // Edits of a document with a file are journaled next to it until it is saved, and
+  // replayed when it is loaded again after a crash
+  static const tcl::Variable JOURNAL("doc_journal", true);
+
+  // Limits of the undo history of a buffer, 0 is unlimited. The oldest states are dropped
+  // beyond them, or written to a temporary file when doc_undoSpill is set and read back
+  // once undo reaches them.
+  static const tcl::Variable UNDO_MEMORY_LIMIT("doc_undoMemoryLimit", 256 * 1024 * 1024);
+  static const tcl::Variable UNDO_MAX_STEPS("doc_undoMaxSteps", 0);
+  static const tcl::Variable UNDO_SPILL("doc_undoSpill", false);
+
+  // The stamp of filename, an invalid one if it can't be looked at
+  static FileStamp fileStamp(std::string const& filename)
   {
-    int width_ = 0;
-    int height_ = 0;
-    std::unordered_map<int, int> columnWidth_;
-    std::unordered_map<Index, Cell> cells_;
-    std::string filename_;
-    bool readOnly_ = false;
-    char delimiter_;
-  };
+    FileStamp stamp;
+
+    struct stat info;
+    if (stat(filename.c_str(), &info) == 0)
+    {
+      stamp.size_ = info.st_size;
+      stamp.time_ = info.st_mtime;
+    }
 
-  enum class EditAction
+    return stamp;
+  }
+
+  // The rows of a column index in index order, as ColumnIndex::save() gives them
+  struct IndexSnapshot
   {
-    CellText,
-    ColumnWidth,
-    UndoRedo,
-    AddColumn,
-    RemoveColumn,
-    AddRow,
-    RemoveRow
+    int column_ = 0;
+    bool stale_ = true;
+    std::vector<uint32_t> rows_;
+    uint32_t numbers_ = 0;
+    uint32_t texts_ = 0;
   };
 
-  struct UndoState
+  // What writing a document reads, taken on the main thread so it can be written on
+  // another one. The cells share their tile directory and tiles with the document until
+  // it changes them, and the strings are the pool's own, so taking one copies little
+  // more than the column widths and the saved indexes.
+  struct DocumentSnapshot
   {
-    UndoState(Document const& doc, Index const& idx, EditAction action)
-      : doc_(doc),
-        cursor_(idx),
-        action_(action)
-    { }
+    int width_;
+    int height_;
+    char delimiter_;
+    CellStorage cells_;
+    std::unordered_map<int, int> widths_;
+    StringPool::Table strings_;
+    std::vector<IndexSnapshot> indexes_;
+    std::shared_ptr<const SavedLayout> layout_;
+
+    explicit DocumentSnapshot(Document const& doc)
+      : width_(doc.width_),
+        height_(doc.height_),
+        delimiter_(doc.delimiter_),
+        cells_(doc.cells_),
+        widths_(doc.columns_.widths()),
+        strings_(doc.strings_.strings()),
+        layout_(doc.savedLayout_)
+    {
+      for (auto const& index : doc.indexes_)
+      {
+        indexes_.emplace_back();
+        IndexSnapshot & saved = indexes_.back();
+
+        saved.column_ = index.column();
+        saved.stale_ = index.stale();
+        if (!saved.stale_)
+          index.save(saved.rows_, saved.numbers_, saved.texts_);
+      }
+    }
 
-    Document doc_;
-    Index cursor_;
-    EditAction action_;
+    StrView str(uint32_t id) const { return strings_.str(id); }
   };
 
-  struct Buffer
+  static Clip clip_;
+
+  Clip & yankedClip()
   {
-    Document doc_;
-    Index cursorPos_ = Index(0, 0);
-    Index scroll_ = Index(0, 0);
-    Index selectionStart_ = Index(-1, -1);
-    Index selectionEnd_ = Index(-1, -1);
-    std::vector<UndoState> undoStack_;
-    std::vector<UndoState> redoStack_;
-  };
+    return clip_;
+  }
+
+  // Documents with a write in flight, they are kept until it is done even if closed
+  static std::vector<std::shared_ptr<Document>> writingDocuments_;
+
+  static TaskGroup & backgroundWrites()
+  {
+    static TaskGroup group;
+    return group;
+  }
+
+  static void evaluateLoadedDocument(bool keepEvaluated = false);
+  static zum2::Codec saveCodec();
+  static void recalculateSheetReaders(int sheet, std::vector<Index> const* changed);
+  static void cancelSelectionStats();
+  static void replayJournal();
+
+  BufferRegistry::~BufferRegistry()
+  {
+    clear();
+
+    if (handles_)
+      bx::destroyHandleAlloc(&allocator_, handles_);
+  }
 
-  static std::vector<Buffer> & documentBuffers()
+  void BufferRegistry::push_back(Buffer && buffer)
   {
-    static std::vector<Buffer> buffer;
-    return buffer;
+    if (!handles_ || handles_->getNumHandles() == handles_->getMaxHandles())
+      grow();
+
+    const uint16_t handle = handles_->alloc();
+    if (handle >= buffers_.size())
+      buffers_.resize(handle + 1);
+
+    buffers_[handle].reset(new Buffer(std::move(buffer)));
+    order_.push_back(handle);
+  }
+
+  void BufferRegistry::erase(std::size_t i)
+  {
+    const uint16_t handle = order_[i];
+    order_.erase(order_.begin() + i);
+
+    buffers_[handle].reset();
+    handles_->free(handle);
+  }
+
+  void BufferRegistry::clear()
+  {
+    while (!order_.empty())
+      erase(order_.size() - 1);
+  }
+
+  void BufferRegistry::grow()
+  {
+    const uint16_t room = handles_ ? handles_->getMaxHandles() : 0;
+    assert(room < bx::HandleAlloc::invalid / 2);
+
+    bx::HandleAlloc * handles = bx::createHandleAlloc(&allocator_, room > 0 ? room * 2 : 16);
+
+    // A new allocator hands out its handles in order, the ones that aren't in use are freed again
+    if (handles_)
+    {
+      for (uint16_t handle = 0; handle < room; ++handle)
+        handles->alloc();
+
+      for (uint16_t handle = 0; handle < room; ++handle)
+        if (!handles_->isValid(handle))
+          handles->free(handle);
+
+      bx::destroyHandleAlloc(&allocator_, handles_);
+    }
+
+    handles_ = handles;
+  }
+
+  BufferRegistry & documentBuffers()
+  {
+    static BufferRegistry buffers;
+    return buffers;
   }
 
   static int currentBufferIndex_ = 0;
 
-  static Buffer & currentBuffer()
+  Buffer & currentBuffer()
   {
     assert(!documentBuffers().empty());
     return documentBuffers().at(currentBufferIndex_);
   }
 
-  static Document & currentDoc()
+  // The document readSheet() made the one of the current buffer for the duration of a read
+  static thread_local Document * sheetDoc_ = nullptr;
+
+  Document & currentDoc()
+  {
+    return sheetDoc_ ? *sheetDoc_ : *currentBuffer().doc_;
+  }
+
+  // A document is named by its file name without the directory and extension
+  static int documentSheet(Document & doc)
+  {
+    if (doc.sheet_ == Expr::NO_SHEET || doc.sheetFilename_ != doc.filename_)
+    {
+      std::string name = doc.filename_;
+
+      const std::size_t slash = name.find_last_of("/\\");
+      if (slash != std::string::npos)
+        name.erase(0, slash + 1);
+
+      const std::size_t dot = name.find('.');
+      if (dot != std::string::npos)
+        name.erase(dot);
+
+      doc.sheet_ = name.empty() ? Expr::NO_SHEET : sheetId(name);
+      doc.sheetFilename_ = doc.filename_;
+    }
+
+    return doc.sheet_;
+  }
+
+  // The first loaded document named sheet, nullptr if none is
+  static Document * findSheetDocument(int sheet)
+  {
+    for (auto & buffer : documentBuffers())
+    {
+      Document & doc = *buffer.doc_;
+      if (!doc.loading_ && documentSheet(doc) == sheet)
+        return &doc;
+    }
+
+    return nullptr;
+  }
+
+  // Counts what changed the documents outside of scripts and edits, see fetchViewport()
+  static uint32_t displayChanges_ = 0;
+
+  static void displayChanged()
+  {
+    displayChanges_++;
+  }
+
+  uint64_t displayVersion()
+  {
+    return ((uint64_t)tcl::scriptGeneration() << 32) | displayChanges_;
+  }
+
+  int documentRow(int row)
   {
-    return currentBuffer().doc_;
+    Buffer const& buffer = currentBuffer();
+    if (!buffer.view_)
+      return row;
+
+    return row >= 0 && row < (int)buffer.rows_.size() ? buffer.rows_[row] : -1;
+  }
+
+  static Index documentIndex(Index const& idx)
+  {
+    return Index(idx.x, documentRow(idx.y));
+  }
+
+  std::string pagedText(Document & doc, Index const& idx, uint32_t * format)
+  {
+    const StrView field = doc.paged_->field(idx);
+    if (field.empty())
+      return std::string();
+
+    uint32_t fieldFormat;
+    std::string value;
+    std::tie(fieldFormat, value) = parseFormatAndValue(field.str());
+
+    if (format)
+      *format = fieldFormat;
+
+    return value;
   }
 
   Index & cursorPos()
@@ -125,73 +482,37 @@ namespace doc {
     return currentBuffer().selectionStart_.x >= 0 && currentBuffer().selectionStart_.y >= 0;
   }
 
-  std::vector<Index> selectedCells()
+  IndexRange selectedCells()
   {
-    std::vector<Index> selection;
-
     Index const& start = currentBuffer().selectionStart_;
+    Index const& end = currentBuffer().selectionEnd_;
 
-    const int width = currentBuffer().selectionEnd_.x - start.x;
-    const int height = currentBuffer().selectionEnd_.y - start.y;
-
-    selection.reserve(width * height);
-
-    if (width == 0 && height == 0)
-    {
-      selection.push_back(currentBuffer().cursorPos_);
-    }
-    else
-    {
-      for (int y = 0; y <= height; ++y)
-        for (int x = 0; x <= width; ++x)
-          selection.emplace_back(start.x + x, start.y + y);
-    }
+    if (start == end)
+      return IndexRange(currentBuffer().cursorPos_, currentBuffer().cursorPos_);
 
-      return selection;
+    return IndexRange(start, end);
   }
 
-  std::vector<Index> selectedColumns()
+  IndexRange selectedColumns()
   {
-    std::vector<Index> selection;
-
     Index const& start = currentBuffer().selectionStart_;
-    const int width = currentBuffer().selectionEnd_.x - start.x;
-
-    if (width == 0)
-    {
-      selection.push_back(currentBuffer().cursorPos_);
-    }
-    else
-    {
-      selection.reserve(width);
+    Index const& end = currentBuffer().selectionEnd_;
 
-      for (int x = 0; x <= width; ++x)
-        selection.emplace_back(start.x + x, start.y);
-    }
+    if (start.x == end.x)
+      return IndexRange(currentBuffer().cursorPos_, currentBuffer().cursorPos_);
 
-    return selection;
+    return IndexRange(start, Index(end.x, start.y));
   }
 
-  std::vector<Index> selectedRows()
+  IndexRange selectedRows()
   {
-    std::vector<Index> selection;
-
     Index const& start = currentBuffer().selectionStart_;
-    const int height = currentBuffer().selectionEnd_.y - start.y;
-
-    if (height == 0)
-    {
-      selection.push_back(currentBuffer().cursorPos_);
-    }
-    else
-    {
-      selection.reserve(height);
+    Index const& end = currentBuffer().selectionEnd_;
 
-      for (int y = 0; y <= height; ++y)
-        selection.emplace_back(start.x, start.y + y);
-    }
+    if (start.y == end.y)
+      return IndexRange(currentBuffer().cursorPos_, currentBuffer().cursorPos_);
 
-    return selection;
+    return IndexRange(start, Index(start.x, end.y));
   }
 
   Index selectionIndex(Index const& idx)
@@ -230,1194 +551,11274 @@ namespace doc {
     return currentBufferIndex_;
   }
 
+  BufferSwitch::BufferSwitch(int buffer)
+    : previous_(currentBufferIndex_)
+  {
+    currentBufferIndex_ = buffer;
+  }
+
+  BufferSwitch::~BufferSwitch()
+  {
+    if (previous_ >= 0)
+      currentBufferIndex_ = previous_;
+  }
+
   int getOpenBufferCount()
   {
     return documentBuffers().size();
   }
 
-  void createDefaultEmpty()
+  static std::size_t cellStateBytes(std::vector<CellState> const& states)
   {
-    documentBuffers().push_back({});
-    jumpToBuffer(documentBuffers().size() - 1);
+    std::size_t bytes = memory::bytes(states);
+    for (auto const& state : states)
+      bytes += memory::bytes(state.text_);
 
-    currentDoc().width_ = 0;
-    currentDoc().height_ = 0;
-    currentDoc().filename_ = "[No Name]";
-    currentDoc().delimiter_ = ',';
-    currentDoc().readOnly_ = false;
+    return bytes;
   }
 
-  void close()
+  static std::size_t undoStateBytes(UndoState const& state)
   {
-    documentBuffers().erase(documentBuffers().begin() + currentBufferIndex_);
+    std::size_t bytes = memory::bytes(state.records_);
 
-    if (documentBuffers().empty())
-      createDefaultEmpty();
-    else
-      currentBufferIndex_ = std::max(0, std::min((int)documentBuffers().size(), currentBufferIndex()));
+    for (auto const& record : state.records_)
+      bytes += memory::bytes(record.before_.text_) + memory::bytes(record.after_.text_) + memory::bytes(record.order_) +
+               cellStateBytes(record.removed_) + cellStateBytes(record.rewritten_);
+
+    return bytes;
   }
 
-  static Cell & getCell(Index const& idx)
+  template <typename Stack>
+  static std::size_t undoBytes(Stack const& stack)
   {
-    return currentDoc().cells_[idx];
+    std::size_t bytes = memory::bytes(stack);
+    for (auto const& state : stack)
+      bytes += undoStateBytes(state);
+
+    return bytes;
   }
 
-  static bool hasCell(Index const& idx)
+  // The formula part of the cells and the templates they share
+  static std::size_t formulaBytes(Document const& doc)
   {
-    return currentDoc().cells_.find(idx) != currentDoc().cells_.end();
+    std::size_t bytes = memory::bytes(doc.formulaTemplates_);
+
+    doc.cells_.forEach([&bytes] (Index const&, Cell const& cell) {
+      if (cell.formula)
+        bytes += sizeof(Formula);
+    });
+
+    // make_shared puts the template and its two reference counts in one allocation
+    for (auto const& it : doc.formulaTemplates_)
+      bytes += memory::bytes(it.first) + sizeof(FormulaTemplate) + 2 * sizeof(long) +
+               it.second->expression.memoryUsage() + it.second->program.code_.memoryUsage() +
+               memory::bytes(it.second->text.text_) + memory::bytes(it.second->text.refs_);
+
+    return bytes;
   }
 
-  static std::string getText(Cell const& cell)
+  static std::size_t columnLookupBytes(ColumnLookup const& lookup)
   {
-    if (cell.hasExpression && !cell.expression.empty())
-      return "=" + exprToString(cell.expression);
+    return sizeof(std::pair<const std::tuple<int, int, int>, ColumnLookup>) + lookup.values_.memoryUsage() + memory::bytes(lookup.rows_);
+  }
 
-    return cell.text;
+  static std::size_t columnSketchBytes(ColumnSketch const& sketch)
+  {
+    return sketch.summary_.distinct_.memoryUsage() + sketch.summary_.quantiles_.memoryUsage();
   }
 
-  static bool forceUndoMerge_ = false;
+  static std::size_t encodedColumnBytes(EncodedColumn const& encoded)
+  {
+    std::size_t bytes = sizeof(EncodedColumn) + memory::bytes(encoded.blocks_);
+    for (auto const& block : encoded.blocks_)
+      bytes += block.ids_.bytes() + block.numbers_.bytes();
 
-  static void takeUndoSnapshot(EditAction action, bool canMerge)
+    return bytes;
+  }
+
+  std::vector<std::pair<std::string, std::size_t>> memoryUsage(int index)
   {
-    bool createNew = true;
+    std::vector<std::pair<std::string, std::size_t>> usage;
 
-    if (!currentBuffer().undoStack_.empty())
-    {
-      UndoState & state = currentBuffer().undoStack_.back();
+    if (index < 0 || index >= getOpenBufferCount())
+      return usage;
 
-      if (state.action_ == action && (canMerge || forceUndoMerge_))
-        createNew = false;
-    }
+    Buffer const& buffer = documentBuffers()[index];
+    Document const& doc = *buffer.doc_;
 
-    if (createNew)
-    {
-      currentBuffer().undoStack_.emplace_back(currentDoc(), cursorPos(), action);
-      currentBuffer().redoStack_.clear();
-    }
-  }
+    bool shared = false;
+    for (int i = 0; i < index; ++i)
+      shared |= documentBuffers()[i].doc_ == buffer.doc_;
 
-  bool undo()
-  {
-    if (!currentBuffer().undoStack_.empty())
+    if (!shared)
     {
-      currentBuffer().redoStack_.emplace_back(currentDoc(), cursorPos(), EditAction::UndoRedo);
+      usage.emplace_back("cells", doc.cells_.memoryUsage());
+      usage.emplace_back("formulas", formulaBytes(doc));
+      usage.emplace_back("strings", doc.strings_.memoryUsage());
+      usage.emplace_back("search", doc.search_.memoryUsage() + (doc.searchPattern_ ? doc.searchPattern_->memoryUsage() : 0));
 
-      UndoState const& state = currentBuffer().undoStack_.back();
-      currentDoc() = state.doc_;
-      cursorPos() = state.cursor_;
+      std::size_t indexBytes = memory::bytes(doc.indexes_);
+      for (auto const& it : doc.indexes_)
+        indexBytes += it.memoryUsage();
 
-      currentBuffer().undoStack_.pop_back();
-      return true;
-    }
+      usage.emplace_back("indexes", indexBytes);
 
-    return false;
-  }
+      std::size_t sketchBytes = memory::bytes(doc.sketches_);
+      for (auto const& it : doc.sketches_)
+        sketchBytes += columnSketchBytes(it);
 
-  bool redo()
-  {
-    if (!currentBuffer().redoStack_.empty())
-    {
-      currentBuffer().undoStack_.emplace_back(currentDoc(), cursorPos(), EditAction::UndoRedo);
+      usage.emplace_back("sketches", sketchBytes);
 
-      UndoState const& state = currentBuffer().redoStack_.back();
-      currentDoc() = state.doc_;
-      cursorPos() = state.cursor_;
+      std::size_t lookupBytes = 0;
+      for (auto const& it : doc.lookups_)
+        lookupBytes += columnLookupBytes(it.second);
 
-      currentBuffer().redoStack_.pop_back();
+      usage.emplace_back("lookups", lookupBytes);
 
-      return true;
+      std::size_t encodedBytes = 0;
+      for (auto const& it : doc.encodings_)
+        encodedBytes += encodedColumnBytes(it);
+
+      usage.emplace_back("encodings", encodedBytes);
+
+      std::size_t resultBytes = memory::bytes(doc.results_);
+      for (auto const& it : doc.results_)
+        resultBytes += memoizedResultBytes(it);
+
+      usage.emplace_back("results", resultBytes);
+
+      std::size_t dependencyBytes = doc.dependencies_.memoryUsage();
+      for (auto const& it : doc.sheetDependencies_)
+        dependencyBytes += it.second.memoryUsage();
+
+      usage.emplace_back("dependencies", dependencyBytes);
+      usage.emplace_back("columns", doc.columns_.memoryUsage());
+      usage.emplace_back("file", memory::bytes(doc.fileChunks_) + memory::bytes(doc.fileLines_));
+      usage.emplace_back("pending", memory::bytes(doc.pendingFormulas_));
+      usage.emplace_back("recalc", memory::bytes(doc.recalcQueue_) + doc.recalcStale_.memoryUsage());
+
+      if (doc.paged_)
+        usage.emplace_back("paged", doc.paged_->memoryUsage());
     }
 
-    return false;
-  }
+    usage.emplace_back("rows", memory::bytes(buffer.rows_));
+    usage.emplace_back("hidden", buffer.hidden_.memoryUsage());
+    usage.emplace_back("undo", undoBytes(buffer.undoStack_));
+    usage.emplace_back("redo", undoBytes(buffer.redoStack_));
 
-  std::string getFilename()
-  {
-    return currentDoc().filename_;
+    return usage;
   }
 
-  bool isReadOnly()
+  void createDefaultEmpty()
   {
-    return currentDoc().readOnly_;
+    documentBuffers().push_back({});
+    jumpToBuffer(documentBuffers().size() - 1);
+
+    currentDoc().width_ = 0;
+    currentDoc().height_ = 0;
+    currentDoc().filename_ = "[No Name]";
+    currentDoc().delimiter_ = ',';
+    currentDoc().readOnly_ = false;
+
+    const int budget = TILE_FILE_BUDGET.toInt();
+    if (budget > 0 && !currentDoc().cells_.useTileFile(TILE_FILE_DIRECTORY.toStr(), (std::size_t)budget << 20))
+      logWarning("Could not create a tile file, the document is kept in memory");
   }
 
-  static bool exportCSV(std::string const& filename)
+  // Copies the cells of the clip into a document of their own, for when the one they were
+  // yanked from is closed
+  static void detachClip()
   {
-    std::ofstream file(filename.c_str());
-    if (!file.is_open())
-    {
-      flashMessage("Could not save document!");
-      return false;
-    }
+    std::shared_ptr<Document> doc = std::make_shared<Document>();
+    CellStorage const& cells = clip_.cells_;
 
-    // Write all the cells
-    for (int y = 0; y < currentDoc().height_; ++y)
-    {
-      for (int x = 0; x < currentDoc().width_; ++x)
+    for (int y = 0; y < clip_.size_.y; ++y)
+      for (int x = 0; x < clip_.size_.x; ++x)
       {
-        Cell const& cell = getCell(Index(x, y));
+        Cell const* cell = cells.find(clip_.source(x, y));
+        if (!cell)
+          continue;
 
-        file << getText(cell);
+        Cell & copy = doc->cells_.get(Index(x, y));
+        copy = *cell;
+        copy.text = doc->strings_.intern(clip_.doc_->strings_.str(cell->text));
 
-        if (x < (currentDoc().width_ - 1))
-        {
-          file << currentDoc().delimiter_;
-        }
-        else
-        {
-          if (y < (currentDoc().height_ - 1))
-            file << std::endl;
-        }
+        if (copy.hasExpression())
+          copy.formula->origin = Index(x, y);
       }
-    }
 
-    return true;
+    clip_.cells_ = std::move(doc->cells_);
+    clip_.doc_ = doc;
+    clip_.first_ = Index(0, 0);
+    clip_.rows_ = std::vector<int>();
   }
 
-  bool save(std::string const& filename)
+  void shutdown()
   {
-    logInfo("Saving document: ", filename);
+    cancelLoad();
+    cancelSelectionStats();
+    clip_ = Clip();
 
-    std::ofstream file(filename.c_str());
-    if (!file.is_open())
+    // Writes in flight are finished, and the ones waiting for them
+    while (!writingDocuments_.empty())
     {
-      flashMessage("Could not save document!");
-      return false;
+      backgroundWrites().wait();
+      Scheduler::shared().runCompletions();
     }
 
+    documentBuffers().clear();
+  }
 
-    // Collect and sort the cells, so they are saved in the same order
-    std::vector<Index> allCells;
-    allCells.reserve(currentDoc().cells_.size());
-
-    for (auto it : currentDoc().cells_)
-      allCells.push_back(it.first);
+  void close()
+  {
+    // Canceling also closes the loading buffer
+    if (currentDoc().loading_)
+    {
+      cancelLoad();
+      return;
+    }
 
-    std::stable_sort(allCells.begin(), allCells.end(), [](Index const& lhs, Index const& rhs) -> bool { return lhs.y < rhs.y; });
-    std::stable_sort(allCells.begin(), allCells.end(), [](Index const& lhs, Index const& rhs) -> bool { return lhs.x < rhs.x; });
+    // Formulas of the other buffers that read this one see it gone
+    std::shared_ptr<Document> doc = currentBuffer().doc_;
+    displayChanged();
+    const int sheet = documentSheet(*doc);
 
-    // Collect and sort all columns so they are saved in the same order
-    std::vector<int> allColumns;
-    allColumns.reserve(currentDoc().columnWidth_.size());
-    for (auto it : currentDoc().columnWidth_)
-      allColumns.push_back(it.first);
+    documentBuffers().erase(currentBufferIndex_);
 
-    std::stable_sort(allColumns.begin(), allColumns.end());
+    // Yanked cells outlive the document, not the document itself
+    bool shown = false;
+    for (auto & buffer : documentBuffers())
+      shown |= buffer.doc_ == doc;
 
+    if (clip_.doc_ == doc && !shown)
+      detachClip();
 
-    // Write file header
-    file << "ZUM1" << std::endl;
+    if (documentBuffers().empty())
+      createDefaultEmpty();
+    else
+      currentBufferIndex_ = std::max(0, std::min((int)documentBuffers().size() - 1, currentBufferIndex()));
 
-    // Write column information section
-    file << std::endl << "[columns]" << std::endl;
-    for (auto col : allColumns)
-      file << Index::columnToStr(col) << " = " << currentDoc().columnWidth_[col] << std::endl;
-    
-    // Write cell content
-    file << std::endl << "[data]" << std::endl;
-    for (auto idx: allCells)
+    if (doc.use_count() == 1)
     {
-      const std::string text = getText(getCell(idx));
-
-      if (!text.empty())
-        file << idx.toStr() << " = " << text << std::endl;
-    }
-
-    // Write cell format
-    file << std::endl << "[format]" << std::endl;
-    for (auto idx: allCells)
-    { 
-      const Cell & cell = getCell(idx);
-
-      if (cell.format != 0)
-        file << idx.toStr() << " = " << formatToStr(cell.format) << std::endl;
+      doc.reset();
+      recalculateSheetReaders(sheet, nullptr);
     }
+  }
 
-    file << std::endl;
+  static ColumnIndex * findColumnIndex(Document & doc, int column)
+  {
+    for (auto & index : doc.indexes_)
+      if (index.column() == column)
+        return &index;
 
-    currentDoc().filename_ = filename;
-    return true;
+    return nullptr;
   }
 
-  struct Parser
+  static ColumnSketch * findColumnSketch(Document & doc, int column)
   {
-    Parser(std::string const& data, char delim)
-      : data_(data),
-        delim_(delim)
-    { }
+    for (auto & sketch : doc.sketches_)
+      if (sketch.column_ == column)
+        return &sketch;
 
-    bool next(std::string & value)
-    {
-      value.clear();
+    return nullptr;
+  }
 
-      if (eof())
-        return false;
+  bool sketchCurrent(Document const& doc, ColumnSketch const& sketch)
+  {
+    return !sketch.stale_ && sketch.height_ == doc.height_ &&
+           (!sketch.summary_.formulas_ || sketch.changes_ == doc.changes_) &&
+           sketch.edits_ * SKETCH_ROWS_PER_EDIT <= (uint64_t)sketch.height_;
+  }
 
-      while (!eof() && data_[pos_] != delim_ && data_[pos_] != '\n')
-        value.append(1, data_[pos_++]);
+  ColumnFormula * findColumnFormula(Document & doc, int column)
+  {
+    for (auto & formula : doc.columnFormulas_)
+      if (formula.column_ == column)
+        return &formula;
 
-      if (eof())
-        return false;
+    return nullptr;
+  }
 
-      const bool newLine = data_[pos_++] == '\n';
-      return newLine;
+  // Marks the blocks of the column formulas holding row as stale, every block if row is
+  // negative. Column formulas can read each other, so all of them are marked.
+  static void invalidateColumnFormulas(Document & doc, int row)
+  {
+    for (auto & formula : doc.columnFormulas_)
+    {
+      if (row < 0)
+        formula.valid_.assign(formula.valid_.size(), false);
+      else if (row / COLUMN_FORMULA_BLOCK_ROWS < (int)formula.valid_.size())
+        formula.valid_[row / COLUMN_FORMULA_BLOCK_ROWS] = false;
     }
+  }
 
-    bool eof() const { return pos_ >= data_.size(); }
-
-    std::string const& data_;
-    char delim_;
-    int pos_ = 0;
-  };
-
-  static void setText(Index const& idx, std::string const& text, bool forceFormat = false)
+  uint64_t lookupKey(double value)
   {
-    Cell & cell = getCell(idx);
+    value += 0.0;
 
-    if (forceFormat)
-    {
-      std::tie(cell.format, cell.text) = parseFormatAndValue(text);
+    uint64_t key;
+    memcpy(&key, &value, sizeof(key));
+    return key;
+  }
 
-      int width = getColumnWidth(idx.x);
-      if (width < cell.text.size())
-        currentDoc().columnWidth_[idx.x] = cell.text.size() + 1;
-    }
-    else
-    {
-      uint32_t format;
-      std::tie(format, cell.text) = parseFormatAndValue(text);
-    }
+  void invalidateLookups(Document & doc, int column)
+  {
+    for (auto & rule : doc.formatRules_)
+      if (column < 0 || rule.column_ == column)
+        rule.stale_ = true;
 
-    if (currentDoc().width_ < (idx.x + 1))
-      currentDoc().width_ = idx.x + 1;
+    for (auto & encoded : doc.encodings_)
+      if (column < 0 || encoded.column_ == column)
+        encoded.stale_ = true;
 
-    if (currentDoc().height_ < (idx.y + 1))
-      currentDoc().height_ = (idx.y + 1);
+    invalidateMemoizedResults(doc, column);
 
-    if (cell.text.front() == '=')
-    {
-      cell.hasExpression = true;
-      cell.expression = parseExpression(cell.text.substr(1));
-    }
-    else
+    if (column < 0)
     {
-      cell.hasExpression = false;
+      doc.lookups_.clear();
+      return;
     }
+
+    for (auto it = doc.lookups_.lower_bound(std::make_tuple(column, 0, 0)); it != doc.lookups_.end() && std::get<0>(it->first) == column; ++it)
+      it->second.stale_ = true;
   }
 
-  static bool loadCSV(std::string const& data, char defaultDelimiter)
+  // The caller may change the cell in any way, so an index, a sketch or a lookup index of
+  // its column has to be built again
+  Cell & getCell(Index const& idx)
   {
-    createDefaultEmpty();
-    currentDoc().width_ = 0;
-    currentDoc().height_ = 0;
+    Document & doc = currentDoc();
 
-    // Examin document to determin delimiter type
-    if (defaultDelimiter == 0)
-    {
-      const std::string delimiters = DELIMITERS.toStr();
+    if (!doc.indexes_.empty())
+      if (ColumnIndex * index = findColumnIndex(doc, idx.x))
+        index->invalidate();
 
-      std::vector<int> delimCount(delimiters.size(), 0);
-      std::stringstream ss(data);
+    if (!doc.sketches_.empty())
+      if (ColumnSketch * sketch = findColumnSketch(doc, idx.x))
+        sketch->stale_ = true;
 
-      std::string firstLine;
-      std::getline(ss, firstLine);
+    if (!doc.lookups_.empty() || !doc.formatRules_.empty() || !doc.encodings_.empty() || !doc.results_.empty())
+      invalidateLookups(doc, idx.x);
 
-      for (auto ch : firstLine)
-      {
-        const std::size_t idx = delimiters.find_first_of(ch);
-        if (idx != std::string::npos)
-          delimCount[idx]++;
-      }
-
-      int maxCount = -1;
-      currentDoc().delimiter_ = delimiters[0];
-      for (int i = 0; i < delimCount.size(); ++i)
-      {
-        if (delimCount[i] > maxCount)
-        {
-          maxCount = delimCount[i];
-          currentDoc().delimiter_ = delimiters[i];
-        }
-      }
-    }
-    else
-     currentDoc().delimiter_ = defaultDelimiter;
+    invalidateColumnFormulas(doc, idx.y);
 
-    Parser p(data, currentDoc().delimiter_);
-
-    int column = 0;
-    int row = 0;
-    while (!p.eof())
-    {
-      std::string cellText = "";
-      const bool newLine = p.next(cellText);
+    return doc.cells_.get(idx);
+  }
 
-      if (!cellText.empty() && cellText != "\n")
-        setText(Index(column, row), cellText, true);
+  // Writes the formula text of cell to out and returns true, or returns false for a cell
+  // that is shown by its text
+  static bool formulaText(Cell const& cell, std::string & out)
+  {
+    if (!cell.hasExpression() || cell.formula->pattern->expression.empty())
+      return false;
 
-      column++;
+    out.push_back('=');
 
-      if (newLine)
-      {
-        column = 0;
-        row++;
-      }
-    }
+    FormulaTemplate const& pattern = *cell.formula->pattern;
+    if (!pattern.text.empty())
+      writeExprText(pattern.text, cell.formula->origin, out);
+    else
+      out += exprToString(cell.expression());
 
-    evaluateDocument();
     return true;
   }
 
-  static bool loadZum1(std::string const& dataIn)
+  std::string getText(Cell const& cell)
   {
-    // Remove the header data
-    const std::string data = dataIn.substr(5);
-
-    createDefaultEmpty();
-    currentDoc().width_ = 0;
-    currentDoc().height_ = 0;
+    std::string text;
+    if (formulaText(cell, text))
+      return text;
 
-    ini_t * ini = ini_load(data.c_str(), nullptr);
+    return currentDoc().strings_.str(cell.text).str();
+  }
 
-    { // Load columns section
-      const int columnsSection = ini_find_section(ini, "columns", 0);
-      if (columnsSection != INI_NOT_FOUND)
-      {
-        const int columnsCount = ini_property_count(ini, columnsSection);
-        for (int i = 0; i < columnsCount; ++i)
-        {
-          const int col = Index::strToColumn(std::string(ini_property_name(ini, columnsSection, i)));
-          const int width = std::atoi(ini_property_value(ini, columnsSection, i));
+  static CellState captureCell(Index const& idx)
+  {
+    CellState state;
+    state.idx_ = idx;
 
-          currentDoc().columnWidth_[col] = width;
-        }
-      }      
+    Cell const* cell = currentDoc().cells_.find(idx);
+    if (cell)
+    {
+      state.exists_ = true;
+      state.text_ = getText(*cell);
+      state.format_ = cell->format;
     }
 
-    { // Load data section
-      const int dataSection = ini_find_section(ini, "data", 0);
-      if (dataSection == INI_NOT_FOUND)
-      {
-        logError("Could not locate the data section in the document");
-        ini_destroy(ini);
-        return false;
-      }
-
-      const int dataCount = ini_property_count(ini, dataSection);
-      
-      for (int i = 0; i < dataCount; ++i)
-      {
-        const Index idx = Index::fromStr(std::string(ini_property_name(ini, dataSection, i)));
-        const std::string value = ini_property_value(ini, dataSection, i);
+    return state;
+  }
 
-        setText(idx, value);
-      }
-    }
+  static int storedColumnWidth(int column)
+  {
+    return currentDoc().columns_.stored(column);
+  }
 
-    { // Load format section
-      const int formatSection = ini_find_section(ini, "format", 0);
-      if (formatSection != INI_NOT_FOUND)
-      {
-        const int formatCount = ini_property_count(ini, formatSection);
-        for (int i = 0; i < formatCount; ++i)
-        {
-          const Index idx = Index::fromStr(std::string(ini_property_name(ini, formatSection, i)));
-          const std::string value = ini_property_value(ini, formatSection, i);
+  static void restoreColumnWidth(int column, int width)
+  {
+    if (width < 0)
+      currentDoc().columns_.reset(column);
+    else
+      currentDoc().columns_.set(column, width);
+  }
 
-          getCell(idx).format = parseFormat(value);
-        }
-      }
-    }
+  static bool forceUndoMerge_ = false;
 
-    ini_destroy(ini);
+  // While a Transaction is alive every edit goes into the same undo state, and the cells
+  // to recalculate are collected until the outermost transaction ends
+  static int transactionDepth_ = 0;
+  static bool transactionRecorded_ = false;
+  static bool transactionRecalculateAll_ = false;
+  static std::vector<Index> transactionEdited_;
 
-    evaluateDocument();
-    return true;
-  }
+  static void trimUndoHistory(Buffer & buffer);
 
-  bool load(std::string const& filename)
+  // Returns a new record for an edit, in the current undo state when the edit can be
+  // merged into it or in a fresh one otherwise.
+  static UndoRecord & addUndoRecord(EditAction action, bool canMerge)
   {
-    std::ifstream file(filename.c_str());
-    if (!file.is_open())
-    {
-      logError("Could not open document '", filename, "'");
-      flashMessage("Could not open document!");
-      return false;
-    }
+    std::deque<UndoState> & undoStack = currentBuffer().undoStack_;
 
-    std::string data = "";
-    std::string line = "";
-    while (std::getline(file, line))
-      data += line + "\n";
+    const bool merge = !undoStack.empty() &&
+                       ((transactionDepth_ > 0 && transactionRecorded_) ||
+                        (undoStack.back().action_ == action && (canMerge || forceUndoMerge_)));
 
-    if (data.size() == 0)
-    {
-      logError("No data in file '", filename, "'");
-      return false;
-    }
-
-    // Determin if we are reading a zum file, of a csv type of file.
-    if (data.size() > 5 && data[0] == 'Z' && data[1] == 'U' && data[2] == 'M' && data[3] == '1' && data[4] == '\n')
-    {
-      if (!loadZum1(data))
-      {
-        logError("Could not parse document '", filename, "'");
-        return false;
-      }
-    }
-    else
+    if (!merge)
     {
-      if (!loadCSV(data, 0))
+      // The state before is complete now, it counts towards the limits from here on
+      if (!undoStack.empty())
       {
-        logError("Could not parse document '", filename, "'");
-        return false;
+        UndoState & last = undoStack.back();
+        const std::size_t bytes = undoStateBytes(last);
+
+        currentBuffer().undoBytes_ += bytes - last.bytes_;
+        last.bytes_ = bytes;
       }
-    }
 
-    currentDoc().filename_ = filename;
-    currentDoc().readOnly_ = false;
+      undoStack.emplace_back(cursorPos(), Index(currentDoc().width_, currentDoc().height_), action);
+      currentBuffer().redoStack_.clear();
 
-    return true;
-  }
+      trimUndoHistory(currentBuffer());
+    }
 
-  bool loadRaw(std::string const& data, std::string const& filename, char delimiter)
-  {
-    if (!loadCSV(data, delimiter))
-      return false;
+    if (transactionDepth_ > 0)
+      transactionRecorded_ = true;
 
-    currentDoc().filename_ = filename;
-    currentDoc().readOnly_ = true;
+    UndoRecord record;
+    record.action_ = action;
 
-    return true;
+    undoStack.back().records_.push_back(record);
+    return undoStack.back().records_.back();
   }
 
-  int getColumnWidth(int column)
+  // A journal holds one entry per line. Edits are an R or U, applied or reverted,
+  // followed by the fields of their undo record, and each edit ends with an S entry
+  // holding the document size. Texts are written after their length.
+  static void journalInt(std::string & out, long long value)
   {
-    auto col = currentDoc().columnWidth_.find(column);
-
-    if (col == currentDoc().columnWidth_.end())
-      return DEFAULT_COLUMN_WIDTH.toInt();
-
-    return (*col).second;
+    char number[20];
+    out.push_back(' ');
+    out.append(number, str::formatInt(value, number));
   }
 
-  void setColumnWidth(int column, int width)
+  static void journalText(std::string & out, std::string const& text)
   {
-    if (currentDoc().readOnly_)
-      return;
-
-    takeUndoSnapshot(EditAction::ColumnWidth, true);
-    currentDoc().columnWidth_[column] = std::max(3, width);
+    journalInt(out, text.size());
+    out.push_back(' ');
+    out += text;
   }
 
-  int getRowCount()
+  static void journalCell(std::string & out, CellState const& state)
   {
-    return currentDoc().height_;
+    journalInt(out, state.idx_.x);
+    journalInt(out, state.idx_.y);
+    journalInt(out, state.exists_);
+    journalInt(out, state.format_);
+    journalText(out, state.text_);
   }
 
-  int getColumnCount()
+  static void journalCells(std::string & out, std::vector<CellState> const& states)
   {
-    return currentDoc().width_;
+    journalInt(out, states.size());
+    for (auto const& state : states)
+      journalCell(out, state);
   }
 
-  static void collectDependencies(Cell const& cell, Index const& idx, std::unordered_set<Index> & deps)
+  static void journalRecord(std::string & out, UndoRecord const& record, bool reverted)
   {
-    if (!cell.hasExpression)
-      return;
+    out.push_back(reverted ? 'U' : 'R');
+    journalInt(out, (int)record.action_);
+    journalInt(out, record.position_);
+    journalInt(out, record.widthBefore_);
+    journalInt(out, record.widthAfter_);
+    journalCell(out, record.before_);
+    journalCell(out, record.after_);
+    journalCells(out, record.removed_);
+    journalCells(out, record.rewritten_);
+
+    journalInt(out, record.order_.size());
+    for (uint32_t row : record.order_)
+      journalInt(out, row);
+
+    out.push_back('\n');
+  }
 
-    for (auto const& expr : cell.expression)
-    {
-      if (expr.type_ == Expr::Cell)
-      {
-        const auto result = deps.insert(expr.startIndex_);
-        if (result.second)
-          collectDependencies(getCell(expr.startIndex_), expr.startIndex_, deps);
-      }
-      else if (expr.type_ == Expr::Range)
-      {
-        const Index startIdx = expr.startIndex_;
-        const Index endIdx = expr.endIndex_;
+  static void journalSize(std::string & out)
+  {
+    out.push_back('S');
+    journalInt(out, currentDoc().width_);
+    journalInt(out, currentDoc().height_);
+    out.push_back('\n');
+  }
 
-        for (int y = startIdx.y; y <= endIdx.y; ++y)
-          for (int x = startIdx.x; x <= endIdx.x; ++x)
-          {
-            const auto result = deps.insert(Index(x, y));
-            if (result.second)
-              collectDependencies(getCell(Index(x, y)), Index(x, y), deps);
-          }
-      }
-    }
+  static std::string journalFilename(std::string const& filename)
+  {
+    return filename + ".journal";
   }
 
-  void evaluateCell(Cell & cell)
+  // The journal only applies to the file it was started on, which is told apart by its size
+  static std::string journalHeader(std::string const& filename)
   {
-    cell.evaluated = true;
+    long long size = -1;
 
-    if (cell.hasExpression)
+    if (FILE * file = fopen(filename.c_str(), "rb"))
     {
-      cell.value = evaluate(cell.expression);
-      cell.display = str::fromDouble(cell.value);
+      if (fseek(file, 0, SEEK_END) == 0)
+        size = ftell(file);
+      fclose(file);
     }
+
+    return "ZUMJ1 " + str::fromInt(size) + "\n";
   }
 
-  void evaluateDocument()
+  // Appends entries to the journal of the current document, which is started by its
+  // first edit. A document without a file has nothing to replay the journal onto.
+  static void journal(std::string const& entries)
   {
     Document & doc = currentDoc();
 
-    for (auto & it : doc.cells_)
-    {
-      const Index idx = it.first;
-      Cell & cell = it.second;
-
-      cell.value = 0.0;
-
-      if (cell.hasExpression)
-      {
-        if (cell.expression.empty())
-        {
-          cell.display = "#ERROR";
-          cell.evaluated = true;
-        }
-        else
-        {
-          cell.evaluated = false;
-          cell.display = "";
-        }
-      }
-      else
-      {
-        cell.display = cell.text;
-        cell.evaluated = true;
+    if (!JOURNAL.toBool() || currentBuffer().view_ || doc.filename_ == "[No Name]")
+      return;
 
-        try {
-          cell.value = std::stod(cell.text);
-        } catch (std::exception) {
-        }
-      }
+    if (!doc.journal_)
+    {
+      doc.journal_.reset(new Journal());
+      if (!doc.journal_->open(journalFilename(doc.filename_), journalHeader(doc.filename_)))
+        logError("Could not create journal for '", doc.filename_, "'");
     }
 
-    for (auto & it : doc.cells_)
-      evaluateCell(it.second);
+    doc.journal_->append(entries);
+    if (doc.saving_)
+      doc.writeJournal_ += entries;
   }
 
-  std::string getCellText(Index const& idx)
+  // Journals the last count records of the undo state edits go to, in one write
+  static void journalEdits(std::size_t count)
   {
-    if (idx.x < 0 || idx.x >= currentDoc().width_ || idx.y < 0 || idx.y >= currentDoc().height_)
-      return "";
+    currentDoc().modified_ = true;
+    currentDoc().changes_++;
+
+    if (!JOURNAL.toBool() || count == 0)
+      return;
+
+    std::vector<UndoRecord> const& records = currentBuffer().undoStack_.back().records_;
 
-    Cell const& cell = currentDoc().cells_[idx];
-    return getText(cell);
+    std::string entries;
+    for (std::size_t i = records.size() - count; i < records.size(); ++i)
+      journalRecord(entries, records[i], false);
+
+    journalSize(entries);
+    journal(entries);
   }
 
-  std::string getCellDisplayText(Index const& idx)
+  // Journals an edit of the current buffer once record is filled in
+  static void journalEdit(UndoRecord const& record)
   {
-    if (!hasCell(idx))
-      return "";
+    currentDoc().modified_ = true;
+    currentDoc().changes_++;
 
-    Cell const& cell = currentDoc().cells_[idx];
+    if (!JOURNAL.toBool())
+      return;
 
-    if (cell.display.empty())
-      return getText(cell);
-    return cell.display;
+    std::string entries;
+    journalRecord(entries, record, false);
+    journalSize(entries);
+    journal(entries);
   }
 
-  double getCellValue(Index const& idx)
+  std::string getFilename()
   {
-    if (idx.x < 0 || idx.x >= currentDoc().width_ || idx.y < 0 || idx.y >= currentDoc().height_)
-      return 0.0;
-
-    Cell & cell = currentDoc().cells_[idx];
-    if (!cell.evaluated)
-      evaluateCell(cell);
+    if (currentBuffer().view_)
+      return "[No Name]";
 
-    return cell.value;
+    return currentDoc().filename_;
   }
 
-  uint32_t getCellFormat(Index const& idx)
+  bool isReadOnly()
   {
-    if (idx.x < 0 || idx.x >= currentDoc().width_ || idx.y < 0 || idx.y >= currentDoc().height_)
-      return 0;
+    if (currentBuffer().view_)
+      return false;
 
-    Cell const& cell = currentDoc().cells_[idx];
-    return cell.format;
+    return currentDoc().readOnly_;
   }
 
-  void setCellText(Index const& idx, std::string const& text)
+  static void removePrecedents(Document & doc, Index const& idx)
   {
-    if (currentDoc().readOnly_)
-      return;
+    doc.dependencies_.removeCell(idx);
 
-    takeUndoSnapshot(EditAction::CellText, false);
-    setText(idx, text);
-    evaluateDocument();
+    for (auto & it : doc.sheetDependencies_)
+      it.second.removeCell(idx);
   }
 
-  void setCellFormat(Index const& idx, uint32_t format)
+  // Follows the references of the formula in cell, at idx, to its own document and to others
+  static void setPrecedents(Document & doc, Index const& idx, Cell const& cell)
   {
-    if (idx.x < 0 || idx.x >= currentDoc().width_ || idx.y < 0 || idx.y >= currentDoc().height_)
-      return;
+    const std::vector<Expr> expression = cell.expression();
+    doc.dependencies_.setPrecedents(idx, expression);
 
-    if (currentDoc().readOnly_)
-      return;
+    for (auto & it : doc.sheetDependencies_)
+      it.second.removeCell(idx);
 
-    takeUndoSnapshot(EditAction::CellText, false);
+    for (auto const& expr : expression)
+      if (expr.sheet_ != Expr::NO_SHEET && (expr.type_ == Expr::Cell || expr.type_ == Expr::Range))
+        doc.sheetDependencies_[expr.sheet_].setPrecedents(idx, expression, expr.sheet_);
+  }
 
-    Cell & cell = currentDoc().cells_[idx];
-    cell.format = format;
+  void rebuildDependencies(Document & doc)
+  {
+    doc.dependencies_.clear();
+    doc.sheetDependencies_.clear();
+
+    // Reading through a const storage leaves the tiles shared with a snapshot alone
+    CellStorage const& cells = doc.cells_;
+    cells.forEach([&doc] (Index const& idx, Cell const& cell) {
+      if (cell.hasExpression())
+        setPrecedents(doc, idx, cell);
+    });
   }
 
-  void increaseColumnWidth(int column)
+  // Gives the view in buffer a document of its own, holding a copy of the rows it shows
+  static void materializeView(Buffer & buffer)
   {
-    if (currentDoc().readOnly_)
-      return;
+    Document const& source = *buffer.doc_;
+    std::shared_ptr<Document> doc = std::make_shared<Document>();
+
+    doc->width_ = source.width_;
+    doc->height_ = buffer.rows_.size();
+    doc->columns_ = source.columns_;
+    doc->delimiter_ = source.delimiter_;
+    doc->strings_ = source.strings_;
+    doc->filename_ = "[No Name]";
+
+    for (std::size_t row = 0; row < buffer.rows_.size(); ++row)
+      for (int x = 0; x < source.width_; ++x)
+      {
+        const Index idx(x, buffer.rows_[row]);
 
-    int width = getColumnWidth(column);
+        if (source.paged_)
+        {
+          uint32_t format = 0;
+          const std::string text = pagedText(*buffer.doc_, idx, &format);
+          if (text.empty())
+            continue;
+
+          Cell & cell = doc->cells_.get(Index(x, row));
+          cell.format = format;
+          cell.text = doc->strings_.intern(text);
+          parseCellText(cell, text);
+          shareFormula(*doc, Index(x, row), cell);
+        }
+        else if (Cell const* cell = source.cells_.find(idx))
+          doc->cells_.get(Index(x, row)) = *cell;
+      }
+
+    rebuildDependencies(*doc);
 
-    takeUndoSnapshot(EditAction::ColumnWidth, true);
-    currentDoc().columnWidth_[column] = width + 1;
+    buffer.doc_ = doc;
+    buffer.view_ = false;
+    buffer.rows_ = std::vector<int>();
   }
 
-  void decreaseColumnWidth(int column)
+  // Called before every edit of the current buffer. A view is materialized before it is
+  // edited, and so are the views of a document before the document is. Returns false if
+  // the document is read only.
+  static bool beginEdit()
   {
-    if (currentDoc().readOnly_)
-      return;
-
-    int width = getColumnWidth(column);
+    Buffer & current = currentBuffer();
+    displayChanged();
 
-    if (width > 3)
+    if (current.view_)
     {
-      takeUndoSnapshot(EditAction::ColumnWidth, true);
-      currentDoc().columnWidth_[column] = width - 1;
+      materializeView(current);
+      return true;
     }
+
+    if (current.doc_->readOnly_)
+      return false;
+
+    for (auto & buffer : documentBuffers())
+      if (buffer.view_ && buffer.doc_ == current.doc_)
+        materializeView(buffer);
+
+    return true;
   }
 
-  void addColumn(int column)
+  // Writes the text of cell the way getText() returns it, without copying plain text.
+  // text is the buffer for the formulas, one for all of them.
+  static void writeCellText(FileWriter & writer, DocumentSnapshot const& doc, Cell const& cell, std::string & text)
   {
-    column = std::min(column, currentDoc().width_ - 1);
-
-    if (currentDoc().readOnly_)
-      return;
+    text.clear();
+    if (formulaText(cell, text))
+      writer.write(text);
+    else
+      writer.write(doc.str(cell.text));
+  }
 
-    takeUndoSnapshot(EditAction::AddColumn, true);
+  // Appends what is written to it to a string, for the parts of a file made on the scheduler
+  class StringWriter
+  {
+    public:
+      explicit StringWriter(std::string & text) : text_(text) { }
 
-    currentDoc().width_++;
+      void write(const char * data, std::size_t size) { text_.append(data, size); }
+      void write(StrView text) { text_.append(text.data(), text.size()); }
+      void put(char ch) { text_ += ch; }
+      void put(char ch, std::size_t count) { text_.append(count, ch); }
 
-    std::unordered_map<Index, Cell> newCells;
+    private:
+      std::string & text_;
+  };
 
-    for (std::pair<Index, Cell> cell : currentDoc().cells_)
+  // Has prepare(i, item) fill the count items on the scheduler and passes them to
+  // write(item) in order, on the calling thread. Up to WRITE_ITEMS_PER_THREAD items per
+  // thread are prepared ahead of the one written, each in a slot of its own that the
+  // next item goes into once it is written. So the workers go on while write waits for
+  // the file, and the items in flight bound the memory. Waiting for the item to write
+  // runs it if no worker started it yet. Without parallel every item is prepared right
+  // before it is written.
+  template <typename Item, typename Prepare, typename Write>
+  static void pipelineWrites(std::size_t count, bool parallel, Prepare const& prepare, Write const& write)
+  {
+    if (!parallel)
     {
-      if (cell.first.x >= column)
-        cell.first.x++;
-
-      for (auto & expr : cell.second.expression)
+      Item item;
+      for (std::size_t i = 0; i < count; ++i)
       {
-        if (expr.startIndex_.x >= column)
-          expr.startIndex_.x++;
-
-        if (expr.endIndex_.x >= column)
-          expr.endIndex_.x++;
+        prepare(i, item);
+        write(item);
       }
 
-      newCells.insert(cell);
+      return;
     }
 
-    currentDoc().cells_ = std::move(newCells);
-    evaluateDocument();
-  }
-
-  void addRow(int row)
-  {
-    row = std::min(row, currentDoc().height_ - 1);
-
-    if (currentDoc().readOnly_)
+    const std::size_t window = std::min<std::size_t>(count, std::max(Scheduler::shared().threadCount(), 1) * WRITE_ITEMS_PER_THREAD);
+    if (window == 0)
       return;
 
-    takeUndoSnapshot(EditAction::AddRow, true);
+    // The groups go first, they wait for the tasks filling the items
+    std::vector<Item> items(window);
+    std::unique_ptr<TaskGroup[]> groups(new TaskGroup[window]);
 
-    currentDoc().height_++;
+    auto start = [&] (std::size_t index) {
+      Item * item = &items[index % window];
+      groups[index % window].spawn([&prepare, item, index] () { prepare(index, *item); });
+    };
 
-    std::unordered_map<Index, Cell> newCells;
+    for (std::size_t i = 0; i < window; ++i)
+      start(i);
 
-    for (std::pair<Index, Cell> cell : currentDoc().cells_)
+    for (std::size_t i = 0; i < count; ++i)
     {
-      if (cell.first.y > row)
-        cell.first.y++;
+      groups[i % window].wait();
+      write(items[i % window]);
 
-      for (auto & expr : cell.second.expression)
-      {
-        if (expr.startIndex_.y > row)
-          expr.startIndex_.y++;
+      if (i + window < count)
+        start(i + window);
+    }
+  }
 
-        if (expr.endIndex_.y > row)
-          expr.endIndex_.y++;
-      }
+  // Writes the text of the cell as one field
+  template <typename Writer>
+  static void writeCsvField(Writer & writer, DocumentSnapshot const& doc, Cell const& cell, char delimiter, std::string & text)
+  {
+    text.clear();
+    writeCsvText(writer, formulaText(cell, text) ? StrView(text) : StrView(doc.str(cell.text)), delimiter);
+  }
+
+  // A view is materialized before it is written, paged documents can't be. Returns false
+  // if the current document can't be written.
+  static bool prepareWrite(const char * verb)
+  {
+    if (currentBuffer().view_)
+      materializeView(currentBuffer());
 
-      newCells.insert(cell);
+    if (currentDoc().paged_)
+    {
+      flashMessage(std::string("Paged documents can't be ") + verb + ", filter them into a view first");
+      return false;
     }
 
-    currentDoc().cells_ = std::move(newCells);
-    evaluateDocument();
+    return true;
   }
 
-  void removeColumn(int column)
+  // Writes the rows of the width_ x height_ grid from first up to end, followed by a line
+  // break unless the last one is the last row. Only stored cells are visited, the
+  // delimiters of the empty cells between them are written in runs.
+  template <typename Writer>
+  static void writeCsvRows(Writer & writer, DocumentSnapshot const& doc, int first, int end)
   {
-    if (currentDoc().readOnly_)
-      return;
+    const char delimiter = doc.delimiter_;
+    std::string text;
 
-    takeUndoSnapshot(EditAction::RemoveColumn, false);
+    // The next cell to write, the delimiters before it are already written
+    Index next(0, first);
 
-    currentDoc().width_--;
+    auto moveTo = [&] (Index const& idx) {
+      for (; next.y < idx.y; ++next.y, next.x = 0)
+      {
+        writer.put(delimiter, doc.width_ - 1 - next.x);
+        writer.put('\n');
+      }
+
+      writer.put(delimiter, idx.x - next.x);
+      next.x = idx.x;
+    };
+
+    doc.cells_.forEachInRows(first, end - 1, [&] (Index const& idx, Cell const& cell) {
+      if (idx.x >= doc.width_)
+        return;
+
+      moveTo(idx);
+      writeCsvField(writer, doc, cell, delimiter, text);
+    });
 
-    std::unordered_map<int, int> newColumnWidth;
-    std::unordered_map<Index, Cell> newCells;
+    moveTo(Index(doc.width_ - 1, end - 1));
+    if (end < doc.height_)
+      writer.put('\n');
+  }
+
+  // Streams the grid in chunks of rows formatted on the scheduler. The rows of documents
+  // whose tiles live in a tile file are formatted on the writing thread, so that tiles
+  // are paged in one chunk at a time.
+  static bool writeCSV(DocumentSnapshot const& doc, std::string const& filename)
+  {
+    FileWriter writer;
+    if (!writer.open(filename))
+      return false;
 
-    // Remove and update column info
-    for (std::pair<int, int> col : currentDoc().columnWidth_)
+    if (doc.width_ > 0 && doc.height_ > 0)
     {
-      if (col.first != column)
-      {
-        if (col.first > column)
-          col.first--;
+      const std::size_t chunks = (doc.height_ + EXPORT_CHUNK_ROWS - 1) / EXPORT_CHUNK_ROWS;
 
-        newColumnWidth.insert(col);
-      }
+      pipelineWrites<std::string>(chunks, !doc.cells_.tileFile(), [&doc] (std::size_t chunk, std::string & text) {
+        const int first = chunk * EXPORT_CHUNK_ROWS;
+
+        text.clear();
+        StringWriter out(text);
+        writeCsvRows(out, doc, first, std::min(first + EXPORT_CHUNK_ROWS, doc.height_));
+      }, [&writer] (std::string const& text) {
+        writer.write(text);
+      });
     }
 
-    // Remove and update cells
-    for (std::pair<Index, Cell> cell : currentDoc().cells_)
+    return writer.close();
+  }
+
+  // Writes rows of doc, document rows in the order given, with a line break after each.
+  // Runs of consecutive rows are written like writeCSV() writes the grid. The fields of a
+  // paged document are written as they are in its file.
+  static bool writeCsvRowList(Document & doc, std::vector<int> const& rows, std::string const& filename)
+  {
+    FileWriter writer;
+    if (!writer.open(filename))
+      return false;
+
+    if (doc.paged_)
     {
-      if (cell.first.x != column)
+      for (const int y : rows)
       {
-        if (cell.first.x > column)
-          cell.first.x--;
-
-        for (auto & expr : cell.second.expression)
+        for (int x = 0; x < doc.width_; ++x)
         {
-          if (expr.startIndex_.x > column)
-            expr.startIndex_.x--;
+          if (x > 0)
+            writer.put(doc.delimiter_);
 
-          if (expr.endIndex_.x > column)
-            expr.endIndex_.x--;
+          writeCsvText(writer, doc.paged_->field(Index(x, y)), doc.delimiter_);
         }
 
-        newCells.insert(cell);
+        writer.put('\n');
       }
+
+      return writer.close();
     }
 
-    currentDoc().cells_ = std::move(newCells);
-    currentDoc().columnWidth_ = std::move(newColumnWidth);
-    evaluateDocument();
-  }
+    const DocumentSnapshot snapshot(doc);
+    const std::size_t chunks = (rows.size() + EXPORT_CHUNK_ROWS - 1) / EXPORT_CHUNK_ROWS;
 
-  void removeRow(int row)
-  {
-    if (row < 0 || row >= getRowCount())
-      return;
+    pipelineWrites<std::string>(chunks, !snapshot.cells_.tileFile(), [&snapshot, &rows] (std::size_t chunk, std::string & text) {
+      const std::size_t first = chunk * EXPORT_CHUNK_ROWS;
+      const std::size_t end = std::min(first + EXPORT_CHUNK_ROWS, rows.size());
 
-    if (currentDoc().readOnly_)
-      return;
+      text.clear();
+      StringWriter out(text);
 
-    takeUndoSnapshot(EditAction::RemoveRow, false);
+      for (std::size_t i = first, next = first; i < end; i = next)
+      {
+        for (next = i + 1; next < end && rows[next] == rows[next - 1] + 1; ++next) { }
 
-    currentDoc().height_--;
+        // The last row of the document is written without its line break
+        writeCsvRows(out, snapshot, rows[i], rows[next - 1] + 1);
+        if (rows[next - 1] + 1 == snapshot.height_)
+          out.put('\n');
+      }
+    }, [&writer] (std::string const& text) {
+      writer.write(text);
+    });
 
-    std::unordered_map<Index, Cell> newCells;
+    return writer.close();
+  }
 
-    for (std::pair<Index, Cell> cell : currentDoc().cells_)
+  // The value a cell is written as to a typed column: 0 for empty cells, 1 for numbers
+  // and evaluated formulas, 2 for text. Formulas that aren't evaluated write their text,
+  // into the buffer.
+  static int cellValue(DocumentSnapshot const& doc, Cell const& cell, double & number, StrView & text, std::string & buffer)
+  {
+    if (cell.hasExpression())
     {
-      if (cell.first.y != row)
-      {
-        if (cell.first.y > row)
-          cell.first.y--;
-
-      for (auto & expr : cell.second.expression)
+      if (cell.evaluated && cell.display().empty())
       {
-        if (expr.startIndex_.y > row)
-          expr.startIndex_.y--;
-
-        if (expr.endIndex_.y > row)
-          expr.endIndex_.y--;
+        number = cell.value;
+        return 1;
       }
 
-        newCells.insert(cell);
-      }
+      buffer.clear();
+      if (cell.evaluated)
+        text = cell.display();
+      else
+        text = formulaText(cell, buffer) ? StrView(buffer) : StrView();
     }
-
-    currentDoc().cells_ = std::move(newCells);
-    evaluateDocument();
+    else if (cell.type == CellType::Number)
+    {
+      number = cell.value;
+      return 1;
+    }
+    else
+      text = doc.str(cell.text);
+
+    return text.empty() ? 0 : 2;
   }
 
-  // -- Tcl bindings --
+  // Writes the rows below the first one to a Parquet file whose columns are named by the
+  // first row. A column of whole numbers is written as integers, one of numbers as
+  // doubles and any other one as text, which the numbers in it are written as typed.
+  static bool writeParquet(DocumentSnapshot const& doc, std::string const& filename, bool compress)
+  {
+    static const double MAX_EXACT_INTEGER = 9007199254740992.0;
+
+    std::vector<std::string> names(doc.width_);
+    std::vector<ParquetWriter::Type> types(doc.width_, ParquetWriter::Type::Int);
+    std::vector<uint8_t> hasValues(doc.width_, 0);
+    std::string buffer;
+    char formatted[str::FORMAT_SIZE];
+    double number = 0.0;
+    StrView text;
+
+    doc.cells_.forEach([&] (Index const& idx, Cell const& cell) {
+      if (idx.x >= doc.width_ || idx.y >= doc.height_)
+        return;
+
+      const int value = cellValue(doc, cell, number, text, buffer);
+      if (idx.y == 0)
+      {
+        names[idx.x] = value != 1 ? text.str() : cell.hasExpression() ? cell.displayValue(formatted).str() : doc.str(cell.text).str();
+        return;
+      }
 
-  TCL_FUNC(newDocument, "", "Create a new empty document")
+      ParquetWriter::Type & type = types[idx.x];
+      if (value == 2)
+        type = ParquetWriter::Type::Text;
+      else if (value == 1 && type == ParquetWriter::Type::Int && (number != std::floor(number) || std::fabs(number) >= MAX_EXACT_INTEGER))
+        type = ParquetWriter::Type::Double;
+
+      hasValues[idx.x] |= value != 0;
+    });
+
+    ParquetWriter writer;
+    if (!writer.open(filename, compress))
+      return false;
+
+    for (int x = 0; x < doc.width_; ++x)
+      writer.addColumn(names[x].empty() ? Index::columnToStr(x) : names[x], hasValues[x] ? types[x] : ParquetWriter::Type::Text);
+
+    // The next cell to write, the nulls before it are already written
+    Index next(0, 1);
+
+    auto moveTo = [&] (Index const& idx) {
+      for (; next.y < idx.y || (next.y == idx.y && next.x < idx.x); )
+      {
+        writer.addNull();
+        if (++next.x == doc.width_)
+          next = Index(0, next.y + 1);
+      }
+    };
+
+    doc.cells_.forEach([&] (Index const& idx, Cell const& cell) {
+      if (idx.y == 0 || idx.x >= doc.width_ || idx.y >= doc.height_)
+        return;
+
+      moveTo(idx);
+
+      const int value = cellValue(doc, cell, number, text, buffer);
+      const ParquetWriter::Type type = hasValues[idx.x] ? types[idx.x] : ParquetWriter::Type::Text;
+
+      if (value == 0)
+        writer.addNull();
+      else if (type == ParquetWriter::Type::Int)
+        writer.addInt((int64_t)number);
+      else if (type == ParquetWriter::Type::Double)
+        writer.addDouble(number);
+      else if (value == 2)
+        writer.addText(text);
+      else
+        writer.addText(cell.hasExpression() ? cell.displayValue(formatted) : doc.str(cell.text));
+
+      if (++next.x == doc.width_)
+        next = Index(0, next.y + 1);
+    });
+
+    if (doc.width_ > 0)
+      moveTo(Index(0, std::max(doc.height_, 1)));
+
+    return writer.close();
+  }
+
+  static bool isParquetFilename(std::string const& filename)
   {
-    createDefaultEmpty();
-    return JIM_OK;
+    static const std::string EXTENSION = ".parquet";
+    return filename.size() > EXTENSION.size() && filename.compare(filename.size() - EXTENSION.size(), EXTENSION.size(), EXTENSION) == 0;
   }
 
-  TCL_FUNC(closeBuffer, "", "Close the current buffer")
+  // Exports to a Parquet file when the file name says so and to CSV otherwise
+  static bool writeExport(DocumentSnapshot const& doc, std::string const& filename, bool compress)
   {
-    close();
-    return JIM_OK;
+    return isParquetFilename(filename) ? writeParquet(doc, filename, compress) : writeCSV(doc, filename);
   }
 
-  TCL_FUNC(load, "filename", "Open a new document")
+  static bool exportCSV(std::string const& filename)
   {
-    TCL_CHECK_ARG(2);
-    TCL_STRING_ARG(1, filename);
+    if (!prepareWrite("exported"))
+      return false;
 
-    logInfo("Trying to load document ", filename);
+    if (!writeExport(DocumentSnapshot(currentDoc()), filename, saveCodec() == zum2::Lz4))
+    {
+      flashMessage("Could not save document!");
+      return false;
+    }
 
-    const bool loaded = load(filename);
-    TCL_INT_RESULT(loaded ? 1 : 0);
+    return true;
   }
 
-  TCL_FUNC(save, "filename", "Save the current document")
+  static const char ZEROS[8] = { 0 };
+
+  static void writePadded(FILE * file, const void * data, std::size_t size, uint64_t & offset)
   {
-    TCL_CHECK_ARG(2);
-    TCL_STRING_ARG(1, filename);
+    if (size > 0)
+      fwrite(data, 1, size, file);
 
-    const bool saved = save(filename);
-    TCL_INT_RESULT(saved ? 1 : 0);
+    const std::size_t padded = zum2::align(size);
+    fwrite(ZEROS, 1, padded - size, file);
+    offset += padded;
   }
 
-  TCL_FUNC(export, "filename", "Export the document to a CSV file")
+  static void appendPadded(std::string & block, const void * data, std::size_t size)
   {
-    TCL_CHECK_ARG(2);
-    TCL_STRING_ARG(1, filename);
-
-    const bool saved = exportCSV(filename);
-    TCL_INT_RESULT(saved ? 1 : 0);
+    block.append(static_cast<const char *>(data), size);
+    block.append(ZEROS, zum2::align(size) - size);
   }
 
-  TCL_FUNC(nextBuffer, "", "Switch to the next open buffer")
+  // Replaces the count values of array with the differences to the value before, or
+  // the other way round
+  static void deltaCode(uint32_t * array, std::size_t count, bool encode)
   {
-    nextBuffer();
-    return JIM_OK;
+    if (encode)
+    {
+      for (std::size_t i = count; i-- > 1; )
+        array[i] -= array[i - 1];
+    }
+    else
+    {
+      for (std::size_t i = 1; i < count; ++i)
+        array[i] += array[i - 1];
+    }
   }
 
-  TCL_FUNC(prevBuffer, "", "Switch to the previous buffer")
+  // Groups the first bytes of the count values of width bytes in data, then all second
+  // bytes and so on, or the other way round. The high bytes of row numbers and values
+  // are mostly alike and end up in long runs.
+  static void shuffleBytes(char * data, std::size_t count, std::size_t width, bool shuffle, std::string & scratch)
   {
-    previousBuffer();
-    return JIM_OK;
+    scratch.assign(data, count * width);
+    const char * source = scratch.data();
+
+    if (shuffle)
+    {
+      for (std::size_t b = 0; b < width; ++b)
+        for (std::size_t i = 0; i < count; ++i)
+          data[b * count + i] = source[i * width + b];
+    }
+    else
+    {
+      for (std::size_t i = 0; i < count; ++i)
+        for (std::size_t b = 0; b < width; ++b)
+          data[i * width + b] = source[b * count + i];
+    }
   }
 
-  TCL_FUNC(currentBuffer, "?buffer?", "Returns the current buffer and optionally jumps to a specified buffer")
+  // Prepares a raw column block for zum2::Lz4, or restores it after decompressing: the
+  // ascending rows and offsets are delta coded, and the bytes of the numeric arrays are
+  // shuffled. Returns false if the arrays don't fit in the block.
+  static bool filterBlock(char * block, std::size_t size, bool encode, std::string & scratch)
   {
-    TCL_CHECK_ARGS(1, 2);
-    TCL_INT_ARG(1, buffer);
+    zum2::BlockHeader header;
+    if (size < sizeof(header))
+      return false;
 
-    if (argc == 2)
-      jumpToBuffer(buffer);
+    memcpy(&header, block, sizeof(header));
 
-    TCL_INT_RESULT(currentBufferIndex());
+    const std::size_t count = header.cellCount_;
+    const std::size_t rows = zum2::align(sizeof(header));
+    const std::size_t formats = rows + zum2::align(count * sizeof(uint32_t));
+    const std::size_t values = formats + zum2::align(count * sizeof(uint32_t)) + zum2::align(count);
+    const std::size_t textOffsets = values + zum2::align(count * sizeof(double));
+    const std::size_t exprOffsets = textOffsets + zum2::align((count + 1) * sizeof(uint32_t));
+
+    if (exprOffsets + (count + 1) * sizeof(uint32_t) > size)
+      return false;
+
+    const std::size_t offsetArrays[] = { rows, textOffsets, exprOffsets };
+    const std::size_t offsetCounts[] = { count, count + 1, count + 1 };
+
+    for (int i = 0; i < 3; ++i)
+    {
+      uint32_t * array = reinterpret_cast<uint32_t *>(block + offsetArrays[i]);
+
+      if (encode)
+        deltaCode(array, offsetCounts[i], true);
+
+      shuffleBytes(block + offsetArrays[i], offsetCounts[i], sizeof(uint32_t), encode, scratch);
+
+      if (!encode)
+        deltaCode(array, offsetCounts[i], false);
+    }
+
+    shuffleBytes(block + formats, count, sizeof(uint32_t), encode, scratch);
+    shuffleBytes(block + values, count, sizeof(double), encode, scratch);
+    return true;
   }
 
-  TCL_FUNC(undo, "", "Undo the last command")
+  // Compresses block into compressed unless that doesn't make it smaller, and sets up
+  // envelope for whichever of the two is stored. Returns true if that's compressed.
+  static bool encodeBlock(std::string & block, zum2::Codec codec, std::string & compressed, zum2::BlockEnvelope & envelope)
   {
-    if (undo())
-      return JIM_OK;
-    return JIM_ERR;
+    memset(&envelope, 0, sizeof(envelope));
+    envelope.rawSize_ = block.size();
+
+    if (codec == zum2::Lz4)
+    {
+      std::string scratch;
+      filterBlock(&block[0], block.size(), true, scratch);
+
+      compressed.resize(lz4::bound(block.size()));
+      compressed.resize(lz4::compress(block, &compressed[0]));
+
+      if (compressed.size() < block.size())
+      {
+        envelope.codec_ = zum2::Lz4;
+        envelope.storedSize_ = compressed.size();
+        return true;
+      }
+
+      filterBlock(&block[0], block.size(), false, scratch);
+    }
+
+    envelope.codec_ = zum2::None;
+    envelope.storedSize_ = block.size();
+    return false;
   }
 
-  TCL_FUNC(redo, "", "Redo the last undone command")
+  // Whether the value of a formula can be saved as its result, see BinaryFormat.h
+  static bool formulaValueCurrent(Cell const& cell)
   {
-    if (redo())
-      return JIM_OK;
-    return JIM_ERR;
+    return cell.evaluated && !cell.formula->pattern->program.empty();
   }
 
-  TCL_FUNC(columnCount, "", "Returns the column count of the current document")
+  // What a formula adds to the formula checksum of a ZUM2 file
+  static uint64_t formulaChecksum(Index const& idx, const zum2::ExprRecord * records, std::size_t count)
   {
-    TCL_INT_RESULT(currentDoc().width_);
+    const uint32_t hash = murmurHash(records, (int)(count * sizeof(zum2::ExprRecord)), 0);
+    return murmurMix64(idx.key() ^ ((uint64_t)hash << 32));
   }
 
-  TCL_FUNC(rowCount, "", "Returns the row count of the current document")
+  // The key of the block of rows of column in a SavedLayout, keys sort like the directory
+  static uint64_t blockKey(int column, int block)
   {
-    TCL_INT_RESULT(currentDoc().height_);
+    return ((uint64_t)column << 32) | (uint32_t)block;
   }
 
-  TCL_FUNC(addColumn, "column", "Add a new column to the current document after the indicated column")
+  static uint64_t blockHash(const void * data, std::size_t size)
   {
-    TCL_CHECK_ARG(2);
-    TCL_INT_ARG(1, column);
+    return ((uint64_t)murmurHash(data, (int)size, 0) << 32) | murmurHash(data, (int)size, 0x9747b28c);
+  }
 
-    addColumn(column);
-    return JIM_OK;
+  // Tells whether an index saved at some point still has the same rows
+  static uint64_t indexHash(uint32_t stale, uint32_t numbers, uint32_t texts, const uint32_t * rows, std::size_t count)
+  {
+    const uint32_t counts[] = { stale, numbers, texts, (uint32_t)count };
+    return murmurMix64(blockHash(counts, sizeof(counts)) ^ blockHash(rows, count * sizeof(uint32_t)));
   }
 
-  TCL_FUNC(addRow, "row", "Add a new row to the current document after the indicated row")
+  // Lays out the cells of column in rows, which are sorted, as a raw column block. saved
+  // gets its column, cell count and hash, and what its formulas add to the checksum.
+  static void buildZum2Block(DocumentSnapshot const& doc, int column, std::vector<int> const& rows, std::string & block, SavedBlock & saved)
   {
-    TCL_CHECK_ARG(2);
-    TCL_INT_ARG(1, row);
+    const std::size_t count = rows.size();
+
+    std::vector<uint32_t> formats(count);
+    std::vector<uint8_t> kinds(count);
+    std::vector<double> values(count);
+    std::vector<uint32_t> textOffsets(count + 1, 0);
+    std::vector<uint32_t> exprOffsets(count + 1, 0);
+    std::vector<zum2::ExprRecord> expressions;
+    std::string strings;
+    std::string names;
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      Cell const& cell = *doc.cells_.find(Index(column, rows[i]));
 
-    addRow(row);
-    return JIM_OK;
+      formats[i] = cell.format;
+      values[i] = cell.value;
+      kinds[i] = cell.hasExpression() ? (formulaValueCurrent(cell) ? zum2::EvaluatedFormula : zum2::Formula) :
+                                        (cell.type == CellType::Number ? zum2::Number : zum2::Text);
+
+      const StrView text = doc.str(cell.text);
+      strings.append(text.data(), text.size());
+      textOffsets[i + 1] = strings.size();
+
+      if (cell.hasExpression())
+      {
+        for (auto const& expr : cell.expression())
+        {
+          zum2::ExprRecord record;
+          memset(&record, 0, sizeof(record));
+
+          record.type_ = expr.type_;
+          record.startX_ = expr.startIndex_.x;
+          record.startY_ = expr.startIndex_.y;
+          record.endX_ = expr.endIndex_.x;
+          record.endY_ = expr.endIndex_.y;
+
+          if (expr.type_ == Expr::Constant)
+            record.constant_ = expr.constant_;
+          else if (expr.type_ == Expr::Function)
+          {
+            const char * name = functionName(expr.func_);
+            record.nameOffset_ = names.size();
+            record.nameLength_ = strlen(name);
+            names += name;
+          }
+          else if (expr.sheet_ != Expr::NO_SHEET)
+          {
+            // A reference to another document keeps the name of its sheet
+            const std::string sheet = sheetName(expr.sheet_);
+            record.nameOffset_ = names.size();
+            record.nameLength_ = sheet.size();
+            names += sheet;
+          }
+
+          expressions.push_back(record);
+        }
+      }
+
+      exprOffsets[i + 1] = expressions.size();
+    }
+
+    // Function and sheet names go after the cell texts, so the texts stay contiguous
+    for (auto & record : expressions)
+      if (record.nameLength_ > 0)
+        record.nameOffset_ += strings.size();
+
+    strings += names;
+
+    saved.formulaChecksum_ = 0;
+    saved.formulas_ = !expressions.empty();
+    for (std::size_t i = 0; i < count; ++i)
+      if (kinds[i] == zum2::Formula || kinds[i] == zum2::EvaluatedFormula)
+        saved.formulaChecksum_ += formulaChecksum(Index(column, rows[i]), expressions.data() + exprOffsets[i], exprOffsets[i + 1] - exprOffsets[i]);
+
+    zum2::BlockHeader blockHeader;
+    blockHeader.cellCount_ = count;
+    blockHeader.exprCount_ = expressions.size();
+    blockHeader.stringsSize_ = strings.size();
+
+    std::vector<uint32_t> blockRows(rows.begin(), rows.end());
+
+    block.clear();
+    appendPadded(block, &blockHeader, sizeof(blockHeader));
+    appendPadded(block, blockRows.data(), count * sizeof(uint32_t));
+    appendPadded(block, formats.data(), count * sizeof(uint32_t));
+    appendPadded(block, kinds.data(), count * sizeof(uint8_t));
+    appendPadded(block, values.data(), count * sizeof(double));
+    appendPadded(block, textOffsets.data(), (count + 1) * sizeof(uint32_t));
+    appendPadded(block, exprOffsets.data(), (count + 1) * sizeof(uint32_t));
+    appendPadded(block, expressions.data(), expressions.size() * sizeof(zum2::ExprRecord));
+    appendPadded(block, strings.data(), strings.size());
+
+    memset(&saved.entry_, 0, sizeof(saved.entry_));
+    saved.entry_.column_ = column;
+    saved.entry_.cellCount_ = count;
+    saved.hash_ = blockHash(block.data(), block.size());
   }
 
-  TCL_FUNC(delimiter, "?delimiter?", "Set or return the delimiter to use in the current document")
+  // A column block of a save, built and compressed on the scheduler to be written in order
+  struct EncodedBlock
   {
-    TCL_CHECK_ARGS(1, 2);
-    TCL_STRING_ARG(1, delims);
+    uint64_t key_ = 0;
+    SavedBlock saved_;
 
-    if (argc == 1)
-      TCL_STRING_RESULT(std::string(1, currentDoc().delimiter_));
-    else if (argc == 2)
-      currentDoc().delimiter_ = delims.empty() ? ',' : delims.front();
+    // Set if the block isn't written, because it's the same as saved or has no cells left
+    bool unchanged_ = false;
+    bool removed_ = false;
 
-    return JIM_OK;
-  }
+    std::string block_;
+    std::string compressed_;
+    bool isCompressed_ = false;
+    zum2::BlockEnvelope envelope_;
+  };
 
-  TCL_FUNC(filename, "", "Returns the filename of the current document")
+  static void encodeSavedBlock(EncodedBlock & encoded, zum2::Codec codec)
   {
-    TCL_STRING_RESULT(currentDoc().filename_);
+    encoded.isCompressed_ = encodeBlock(encoded.block_, codec, encoded.compressed_, encoded.envelope_);
   }
 
-  TCL_FUNC(columnWidth, "column ?width?", "This function returns and optionally sets the width of the specified column.")
+  // Writes the block behind its envelope at offset, and where it went to its saved block
+  static void writeSavedBlock(FILE * file, EncodedBlock & encoded, uint64_t & offset)
   {
-    TCL_CHECK_ARGS(2, 3);
-    TCL_STRING_ARG(1, columnStr);
-    TCL_INT_ARG(2, width);
+    std::string const& stored = encoded.isCompressed_ ? encoded.compressed_ : encoded.block_;
 
-    const int column = Index::strToColumn(columnStr);
+    encoded.saved_.entry_.blockOffset_ = offset;
+    writePadded(file, &encoded.envelope_, sizeof(encoded.envelope_), offset);
+    writePadded(file, stored.data(), stored.size(), offset);
+    encoded.saved_.entry_.blockSize_ = offset - encoded.saved_.entry_.blockOffset_;
+  }
 
-    if (argc == 3)
-      setColumnWidth(column, width);
+  static zum2::FileHeader zum2Header(DocumentSnapshot const& doc, zum2::Codec codec)
+  {
+    zum2::FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic_, zum2::MAGIC, sizeof(header.magic_));
+    header.version_ = zum2::VERSION;
+    header.byteOrder_ = zum2::ENDIAN_MARK;
+    header.width_ = doc.width_;
+    header.height_ = doc.height_;
+    header.codec_ = codec;
+    header.indexCount_ = doc.indexes_.size();
+    return header;
+  }
 
-    const int w = getColumnWidth(column);
+  static std::vector<zum2::ColumnWidth> zum2Widths(DocumentSnapshot const& doc)
+  {
+    std::vector<zum2::ColumnWidth> widths;
+    for (auto const& it : doc.widths_)
+      widths.push_back({ (uint32_t)it.first, (uint32_t)it.second });
 
-    logInfo("Column: ", column, " is ", w);
+    std::sort(widths.begin(), widths.end(), [] (zum2::ColumnWidth const& lhs, zum2::ColumnWidth const& rhs) -> bool {
+      return lhs.column_ < rhs.column_;
+    });
 
-    TCL_INT_RESULT(getColumnWidth(column));
+    return widths;
   }
 
-  TCL_FUNC(cell, "index ?value?", "Set or return the value of a particular cell in the current document")
+  // Writes the rows of the index at offset, unless the file has them already. They are
+  // the ones of an index of the same column with the same hash.
+  static void writeSavedIndex(FILE * file, IndexSnapshot const& index, SavedLayout const* saved, uint64_t & offset, SavedIndex & written)
   {
-    TCL_CHECK_ARGS(2, 3);
-    TCL_STRING_ARG(1, index);
-    TCL_STRING_ARG(2, value);
-
-    const Index idx = Index::fromStr(index);
-
-    if (argc == 3)
-      setCellText(idx, value);
+    const uint32_t count = index.rows_.size();
+
+    memset(&written.entry_, 0, sizeof(written.entry_));
+    written.entry_.column_ = index.column_;
+    written.entry_.stale_ = index.stale_ ? 1 : 0;
+    written.entry_.numberCount_ = index.numbers_;
+    written.entry_.textCount_ = index.texts_;
+    written.entry_.formulaCount_ = count - index.numbers_ - index.texts_;
+    written.hash_ = indexHash(written.entry_.stale_, index.numbers_, index.texts_, index.rows_.data(), count);
+
+    if (saved)
+      for (auto const& it : saved->indexes_)
+        if (it.entry_.column_ == written.entry_.column_ && it.hash_ == written.hash_)
+        {
+          written.entry_.rowsOffset_ = it.entry_.rowsOffset_;
+          return;
+        }
 
-    TCL_STRING_UTF8_RESULT(getCellText(idx));
+    written.entry_.rowsOffset_ = offset;
+    writePadded(file, index.rows_.data(), count * sizeof(uint32_t), offset);
   }
 
-  TCL_FUNC(isReadOnly, "", "Returns true if the current document is read only")
+  // The bytes of the file the header of layout leads to, directoryBytes are the ones of the
+  // header and the directory
+  static uint64_t liveBytes(SavedLayout const& layout, uint64_t directoryBytes)
   {
-    TCL_INT_RESULT(isReadOnly() ? 1 : 0);
+    uint64_t bytes = directoryBytes;
+    for (auto const& it : layout.blocks_)
+      bytes += it.second.entry_.blockSize_;
+
+    for (auto const& it : layout.indexes_)
+      bytes += zum2::align(((uint64_t)it.entry_.numberCount_ + it.entry_.textCount_ + it.entry_.formulaCount_) * sizeof(uint32_t));
+
+    return bytes;
   }
 
-  TCL_SUBFUNC(selection, "all",     "", "Returns the index of all the selected cells",
-                         "row",     "", "Returns the index of selected rows",
-                         "column",  "", "Returns the index of selected columns")
+  // Writes the document in the binary ZUM2 format, see BinaryFormat.h, and where its
+  // blocks went to layout
+  static bool saveZum2(DocumentSnapshot const& doc, std::string const& filename, zum2::Codec codec, SavedLayout & layout)
   {
-    enum { CMD_ALL, CMD_ROW, CMD_COLUMN };
+    FILE * file = fopen(filename.c_str(), "wb");
+    if (!file)
+      return false;
 
-    std::vector<Index> cells;
+    // forEach() visits the cells in row-major order, so every block ends up sorted by row
+    std::map<uint64_t, std::vector<int>> blocks;
+    std::vector<int> * last = nullptr;
+    uint64_t lastKey = 0;
 
-    switch (subCommand)
-    {
-      case CMD_ALL:
-        cells = selectedCells();
-        break;
+    doc.cells_.forEach([&] (Index const& idx, Cell const&) {
+      const uint64_t key = blockKey(idx.x, idx.y / zum2::BLOCK_ROWS);
+      if (!last || key != lastKey)
+      {
+        last = &blocks[key];
+        lastKey = key;
+      }
 
-      case CMD_ROW:
-        cells = selectedRows();
-        break;
+      last->push_back(idx.y);
+    });
 
-      case CMD_COLUMN:
-        cells = selectedColumns();
-        break;
-    }
+    const std::vector<zum2::ColumnWidth> widths = zum2Widths(doc);
 
-    Jim_Obj * list = Jim_NewListObj(interp, nullptr, 0);
+    zum2::FileHeader header = zum2Header(doc, codec);
+    header.widthCount_ = widths.size();
+    header.columnCount_ = blocks.size();
+
+    uint64_t offset = 0;
+    writePadded(file, &header, sizeof(header), offset);
+
+    header.widthsOffset_ = offset;
+    writePadded(file, widths.data(), widths.size() * sizeof(zum2::ColumnWidth), offset);
+
+    // The column directory is written again once the block offsets are known
+    std::vector<zum2::ColumnEntry> entries(blocks.size());
+    header.columnsOffset_ = offset;
+    writePadded(file, entries.data(), entries.size() * sizeof(zum2::ColumnEntry), offset);
 
-    for (auto cell : cells)
+    std::vector<zum2::IndexEntry> indexes(doc.indexes_.size());
+    header.indexesOffset_ = offset;
+    writePadded(file, indexes.data(), indexes.size() * sizeof(zum2::IndexEntry), offset);
+
+    const uint64_t directoryBytes = offset;
+
+    layout.blocks_.clear();
+    layout.indexes_.clear();
+
+    // The blocks are built and compressed on the scheduler, and written in the order of
+    // the directory
+    std::vector<std::map<uint64_t, std::vector<int>>::const_iterator> order;
+    for (auto it = blocks.begin(); it != blocks.end(); ++it)
+      order.push_back(it);
+
+    std::size_t entry = 0;
+    pipelineWrites<EncodedBlock>(order.size(), !doc.cells_.tileFile(), [&doc, &order, codec] (std::size_t i, EncodedBlock & encoded) {
+      encoded.key_ = order[i]->first;
+      buildZum2Block(doc, encoded.key_ >> 32, order[i]->second, encoded.block_, encoded.saved_);
+      encodeSavedBlock(encoded, codec);
+    }, [&] (EncodedBlock & encoded) {
+      writeSavedBlock(file, encoded, offset);
+      layout.blocks_[encoded.key_] = encoded.saved_;
+
+      header.formulaChecksum_ += encoded.saved_.formulaChecksum_;
+      entries[entry++] = encoded.saved_.entry_;
+    });
+
+    for (std::size_t i = 0; i < indexes.size(); ++i)
     {
-      const std::string idx = cell.toStr();
-      Jim_ListAppendElement(interp, list, Jim_NewStringObj(interp, idx.c_str(), idx.size()));
+      layout.indexes_.emplace_back();
+      writeSavedIndex(file, doc.indexes_[i], nullptr, offset, layout.indexes_.back());
+      indexes[i] = layout.indexes_.back().entry_;
     }
 
-    Jim_SetResult(interp, list);
-    return JIM_OK;
-  }
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, 1, sizeof(header), file);
 
-  TCL_FUNC(execWithUndoMerge, "command", "Executes the supplied command while any changes to the document are merge to the same undo state")
-  {
-    TCL_CHECK_ARG(2);
-    TCL_STRING_ARG(1, command);
+    fseek(file, header.columnsOffset_, SEEK_SET);
+    fwrite(entries.data(), sizeof(zum2::ColumnEntry), entries.size(), file);
 
-    forceUndoMerge_ = true;
-    tcl::evaluate(command);
-    forceUndoMerge_ = false;
+    fseek(file, header.indexesOffset_, SEEK_SET);
+    fwrite(indexes.data(), sizeof(zum2::IndexEntry), indexes.size(), file);
 
-    return JIM_OK;
+    const bool ok = ferror(file) == 0 && syncFile(file);
+    fclose(file);
+
+    layout.fileSize_ = offset;
+    layout.liveBytes_ = liveBytes(layout, directoryBytes);
+    return ok;
   }
 
-  enum class FilterOp
+  // Saves the document to the ZUM2 file it was last saved to or loaded from by appending
+  // the blocks of rows that changed since, then a new directory, and then pointing the
+  // header at that. The old directory stays valid until the header is written, which is
+  // the header's first bytes only, so a crash leaves the file as it was saved before or
+  // after. Returns false, with the file as before, if the changes aren't known.
+  static bool appendZum2(DocumentSnapshot const& doc, std::string const& filename, zum2::Codec codec, SavedLayout & layout)
   {
-    Equal,
-    NotEqual,
-    Match,
-    NoMatch,
-    Greater,
-    LessThan
-  };
+    SavedLayout const& saved = *doc.layout_;
 
-  TCL_FUNC(filter, "?-noHeader? column operation value ?column operation value ...?")
-  {
-    TCL_CHECK_ARGS(4, 1000);
+    // The blocks of the tiles written since, and those with formulas, which are evaluated
+    // without writing their tiles. A block whose raw block hashes the same isn't written.
+    std::set<uint64_t> changed;
+    const bool tracked = doc.cells_.forEachTileWrittenSince(saved.epoch_, [&changed] (int x, int y) {
+      for (int column = x; column < x + CellStorage::TILE_WIDTH; ++column)
+        changed.insert(blockKey(column, y / zum2::BLOCK_ROWS));
+    });
 
-    bool copyHeader = true;
-    if (std::string(Jim_String(argv[1])) == "-noHeader")
-      copyHeader = false;
+    if (!tracked)
+      return false;
 
-    if (!copyHeader && argc < 5)
-      return JIM_ERR;
+    for (auto const& it : saved.blocks_)
+      if (it.second.formulas_)
+        changed.insert(it.first);
 
-    int column = 0;
-    FilterOp op = FilterOp::Match;
-    std::vector<std::tuple<int, FilterOp, std::string>> matches;
+    FILE * file = fopen(filename.c_str(), "r+b");
+    if (!file)
+      return false;
 
-    for (int field = 0, i = copyHeader ? 1 : 2; i < argc; ++field, ++i)
+    if (fseek(file, saved.fileSize_, SEEK_SET) != 0)
     {
-      const std::string value(Jim_String(argv[i]));
+      fclose(file);
+      return false;
+    }
 
-      switch (field)
-      {
-        case 0:
-          {
-            column = Index::strToColumn(value);
-            if (column < 0 || column >= getColumnCount())
-            {
-              logError("filter column ", column, " out of range");
-              return JIM_ERR;
-            }
-          }
-          break;
+    layout.blocks_ = saved.blocks_;
+    layout.indexes_.clear();
 
-        case 1:
-          {
-            if (value == "-equal")
-              op = FilterOp::Equal;
-            else if (value == "-nequal")
-              op = FilterOp::NotEqual;
-            else if (value == "-match")
-              op = FilterOp::Match;
-            else if (value == "-nomatch")
-              op = FilterOp::NoMatch;
-            else if (value == "-gt")
-              op = FilterOp::Greater;
-            else if (value == "-lt")
-              op = FilterOp::LessThan;
-            else
-            {
-              logError("unknown filter operation '", value, "'");
-              return JIM_ERR;
-            }
-          }
-          break;
+    uint64_t offset = saved.fileSize_;
+    const std::vector<uint64_t> keys(changed.begin(), changed.end());
 
-        case 2:
-          {
-            matches.push_back(std::make_tuple(column, op, value));
-            field = 0;
-          }
-          break;
-      }
-    }
+    pipelineWrites<EncodedBlock>(keys.size(), !doc.cells_.tileFile(), [&doc, &saved, &keys, codec] (std::size_t i, EncodedBlock & encoded) {
+      const int column = keys[i] >> 32;
+      const int first = (int)(uint32_t)keys[i] * zum2::BLOCK_ROWS;
 
-    Document & doc = currentDoc();
-    Buffer buffer;
+      std::vector<int> rows;
+      for (int y = first; y < first + (int)zum2::BLOCK_ROWS; ++y)
+        if (doc.cells_.find(Index(column, y)))
+          rows.push_back(y);
 
-    buffer.doc_.width_ = doc.width_;
-    buffer.doc_.columnWidth_ = doc.columnWidth_;
-    buffer.doc_.delimiter_ = doc.delimiter_;
-    buffer.doc_.filename_ = "[No Name]";
-    buffer.doc_.readOnly_ = false;
+      encoded.key_ = keys[i];
+      encoded.removed_ = rows.empty();
+      encoded.unchanged_ = false;
+      if (encoded.removed_)
+        return;
 
-    if (copyHeader)
-    {
-      for (int i = 0; i < doc.width_; ++i)
-        buffer.doc_.cells_[Index(i, 0)] = doc.cells_[Index(i, 0)];
-    }
+      buildZum2Block(doc, column, rows, encoded.block_, encoded.saved_);
 
-    int row = copyHeader ? 1 : 0;
-    for (int y = copyHeader ? 1 : 0; y < doc.height_; ++y)
-    {
-      bool include = true;
+      auto previous = saved.blocks_.find(encoded.key_);
+      encoded.unchanged_ = previous != saved.blocks_.end() && previous->second.hash_ == encoded.saved_.hash_ &&
+                           previous->second.entry_.cellCount_ == encoded.saved_.entry_.cellCount_;
 
-      for (auto const& it : matches)
+      if (!encoded.unchanged_)
+        encodeSavedBlock(encoded, codec);
+    }, [&] (EncodedBlock & encoded) {
+      if (encoded.removed_)
+        layout.blocks_.erase(encoded.key_);
+      else if (!encoded.unchanged_)
       {
-        int column;
-        FilterOp op;
-        std::string value;
-        std::tie(column, op, value) = it;
+        writeSavedBlock(file, encoded, offset);
+        layout.blocks_[encoded.key_] = encoded.saved_;
+      }
+    });
 
-        const std::string text = getCellDisplayText(Index(column, y));
-        if (text.empty() || value.empty())
-        {
-          include = false;
-          break;
-        }
+    std::vector<zum2::IndexEntry> indexes;
+    for (auto const& index : doc.indexes_)
+    {
+      layout.indexes_.emplace_back();
+      writeSavedIndex(file, index, &saved, offset, layout.indexes_.back());
+      indexes.push_back(layout.indexes_.back().entry_);
+    }
 
-        switch (op)
-        {
-          case FilterOp::Equal:
-            include &= text == value;
-            break;
+    const std::vector<zum2::ColumnWidth> widths = zum2Widths(doc);
 
-          case FilterOp::NotEqual:
-            include &= text != value;
-            break;
+    std::vector<zum2::ColumnEntry> entries;
+    entries.reserve(layout.blocks_.size());
 
-          case FilterOp::Match:
-            include &= text.find(value) != std::string::npos;
-            break;
+    zum2::FileHeader header = zum2Header(doc, codec);
+    header.widthCount_ = widths.size();
+    header.columnCount_ = layout.blocks_.size();
 
-          case FilterOp::NoMatch:
-            include &= text.find(value) == std::string::npos;
+    for (auto const& it : layout.blocks_)
+    {
+      entries.push_back(it.second.entry_);
+      header.formulaChecksum_ += it.second.formulaChecksum_;
+    }
+
+    const uint64_t directoryStart = offset;
+
+    header.widthsOffset_ = offset;
+    writePadded(file, widths.data(), widths.size() * sizeof(zum2::ColumnWidth), offset);
+
+    header.columnsOffset_ = offset;
+    writePadded(file, entries.data(), entries.size() * sizeof(zum2::ColumnEntry), offset);
+
+    header.indexesOffset_ = offset;
+    writePadded(file, indexes.data(), indexes.size() * sizeof(zum2::IndexEntry), offset);
+
+    // Everything the new header leads to is on disk before it is written
+    bool ok = ferror(file) == 0 && syncFile(file);
+    if (ok)
+    {
+      fseek(file, 0, SEEK_SET);
+      fwrite(&header, 1, sizeof(header), file);
+      ok = ferror(file) == 0 && syncFile(file);
+    }
+
+    fclose(file);
+
+    layout.fileSize_ = offset;
+    layout.liveBytes_ = liveBytes(layout, zum2::align(sizeof(header)) + offset - directoryStart);
+    return ok;
+  }
+
+  // Writes the document in the text based ZUM1 format
+  static bool saveZum1(DocumentSnapshot const& doc, std::string const& filename)
+  {
+    FileWriter writer;
+    if (!writer.open(filename))
+      return false;
+
+    // Sort the columns so they are saved in the same order
+    std::vector<std::pair<int, int>> allColumns(doc.widths_.begin(), doc.widths_.end());
+    std::sort(allColumns.begin(), allColumns.end());
+
+    char name[Index::MAX_NAME_LENGTH];
+    char number[20];
+
+    writer.write(StrView("ZUM1\n\n[columns]\n", 16));
+    for (auto const& col : allColumns)
+    {
+      writer.write(name, Index::formatColumn(col.first, name));
+      writer.write(StrView(" = ", 3));
+      writer.write(number, str::formatInt(col.second, number));
+      writer.put('\n');
+    }
+
+    // Cells are stored row by row, so one walk writes the data in a stable order. The
+    // few formats are collected on the way and written after the data.
+    std::string formats;
+    std::string text;
+
+    writer.write(StrView("\n[data]\n", 8));
+    doc.cells_.forEach([&] (Index const& idx, Cell const& cell) {
+      const std::size_t length = idx.format(name);
+
+      if (cell.hasExpression() || !doc.str(cell.text).empty())
+      {
+        writer.write(name, length);
+        writer.write(StrView(" = ", 3));
+        writeCellText(writer, doc, cell, text);
+        writer.put('\n');
+      }
+
+      if (cell.format != 0)
+        formats.append(name, length).append(" = ").append(formatToStr(cell.format)).append(1, '\n');
+    });
+
+    writer.write(StrView("\n[format]\n", 10));
+    writer.write(formats);
+    writer.put('\n');
+
+    return writer.close(true);
+  }
+
+  // Moves the completely written temporary over filename. rename() replaces the file
+  // atomically on POSIX systems, elsewhere the old file has to be removed first.
+  static bool replaceFile(std::string const& temporary, std::string const& filename)
+  {
+#if !(BX_PLATFORM_LINUX || BX_PLATFORM_OSX)
+    remove(filename.c_str());
+#endif
+
+    return rename(temporary.c_str(), filename.c_str()) == 0;
+  }
+
+  // Whether a ZUM2 save of doc to filename can append to the file, see appendZum2(). Once
+  // less than half of it is in use the whole file is written again instead.
+  static bool canAppend(DocumentSnapshot const& doc, std::string const& filename)
+  {
+    SavedLayout const* saved = doc.layout_.get();
+    return saved && saved->filename_ == filename && saved->liveBytes_ * 2 >= saved->fileSize_ && fileStamp(filename) == saved->stamp_;
+  }
+
+  // The document is written next to the file and then moved over it, so a crash while
+  // saving leaves the old file and its journal intact. With append a ZUM2 file may be
+  // saved to in place instead. A ZUM2 save keeps where its blocks went in layout, all
+  // but the epoch_ the caller sets.
+  static bool writeDocument(DocumentSnapshot const& doc, std::string const& filename, bool binary, zum2::Codec codec, bool append, SavedLayout & layout)
+  {
+    if (binary && append && canAppend(doc, filename))
+    {
+      if (appendZum2(doc, filename, codec, layout))
+      {
+        layout.filename_ = filename;
+        layout.stamp_ = fileStamp(filename);
+        return true;
+      }
+
+      logWarning("Could not save to '", filename, "' in place, it is written again");
+    }
+
+    const std::string temporary = filename + ".tmp";
+
+    if (!(binary ? saveZum2(doc, temporary, codec, layout) : saveZum1(doc, temporary)) || !replaceFile(temporary, filename))
+    {
+      remove(temporary.c_str());
+      return false;
+    }
+
+    layout.filename_ = filename;
+    layout.stamp_ = fileStamp(filename);
+    return true;
+  }
+
+  static bool binarySave(Document const& doc)
+  {
+    return doc.binary_ || SAVE_FORMAT.toStr() == "zum2";
+  }
+
+  static zum2::Codec saveCodec()
+  {
+    return SAVE_COMPRESSION.toStr() == "lz4" ? zum2::Lz4 : zum2::None;
+  }
+
+  // Everything journaled up to the snapshot is in the file now. What was journaled while
+  // it was written starts the journal of the file.
+  static void finishSave(Document & doc, std::string const& filename, std::shared_ptr<const SavedLayout> const& layout)
+  {
+    doc.filename_ = filename;
+    doc.journal_.reset();
+    doc.stamp_ = fileStamp(filename);
+    doc.savedLayout_ = layout;
+
+    // The saved file is the document now, whatever was appended to the old one
+    doc.following_ = false;
+
+    if (doc.writeJournal_.empty())
+      return;
+
+    doc.journal_.reset(new Journal());
+    if (!doc.journal_->open(journalFilename(filename), journalHeader(filename) + doc.writeJournal_))
+      logError("Could not create journal for '", filename, "'");
+
+    doc.writeJournal_.clear();
+  }
+
+  bool save(std::string const& filename)
+  {
+    PROFILE_SCOPE(SAVE);
+
+    if (!prepareWrite("saved"))
+      return false;
+
+    logInfo("Saving document: ", filename);
+
+    // What changes from here on goes into the next save
+    Document & doc = currentDoc();
+    const DocumentSnapshot snapshot(doc);
+    doc.cells_.startEpoch();
+
+    const bool binary = binarySave(doc);
+    std::shared_ptr<SavedLayout> layout = std::make_shared<SavedLayout>();
+    layout->epoch_ = doc.cells_.epoch();
+
+    if (!writeDocument(snapshot, filename, binary, saveCodec(), INCREMENTAL_SAVE.toBool(), *layout))
+    {
+      flashMessage("Could not save document!");
+      return false;
+    }
+
+    finishSave(doc, filename, binary ? layout : nullptr);
+    doc.modified_ = false;
+    return true;
+  }
+
+  static void finishWrite(Document * written, std::string const& filename, bool exporting, bool ok, std::shared_ptr<const SavedLayout> const& layout);
+
+  // Writes doc from a snapshot on the scheduler. A save takes the document as saved right
+  // away, edits made meanwhile mark it modified again.
+  static void startWrite(std::shared_ptr<Document> const& doc, std::string const& filename, bool exporting)
+  {
+    std::shared_ptr<DocumentSnapshot> snapshot = std::make_shared<DocumentSnapshot>(*doc);
+    const bool binary = binarySave(*doc);
+    const zum2::Codec codec = saveCodec();
+    const bool append = INCREMENTAL_SAVE.toBool();
+
+    doc->cells_.startEpoch();
+    std::shared_ptr<SavedLayout> layout = std::make_shared<SavedLayout>();
+    layout->epoch_ = doc->cells_.epoch();
+
+    doc->writing_ = true;
+    doc->saving_ = !exporting;
+    writingDocuments_.push_back(doc);
+
+    if (!exporting)
+    {
+      doc->writeJournal_.clear();
+      doc->modified_ = false;
+    }
+
+    logInfo(exporting ? "Exporting document: " : "Saving document: ", filename);
+    flashMessage((exporting ? "Exporting " : "Saving ") + filename);
+
+    Document * written = doc.get();
+    backgroundWrites().spawn([snapshot, written, filename, exporting, binary, codec, append, layout] () {
+      const bool ok = exporting ? writeExport(*snapshot, filename, codec == zum2::Lz4) : writeDocument(*snapshot, filename, binary, codec, append, *layout);
+      Scheduler::shared().postCompletion([written, filename, exporting, ok, binary, layout] () {
+        finishWrite(written, filename, exporting, ok, binary ? layout : nullptr);
+      });
+    });
+  }
+
+  static void finishWrite(Document * written, std::string const& filename, bool exporting, bool ok, std::shared_ptr<const SavedLayout> const& layout)
+  {
+    auto it = std::find_if(writingDocuments_.begin(), writingDocuments_.end(), [written] (std::shared_ptr<Document> const& doc) {
+      return doc.get() == written;
+    });
+
+    assert(it != writingDocuments_.end());
+    std::shared_ptr<Document> doc = *it;
+    writingDocuments_.erase(it);
+
+    doc->writing_ = false;
+    doc->saving_ = false;
+
+    if (!ok)
+    {
+      logError("Could not write document '", filename, "'");
+      flashMessage("Could not save document!");
+
+      if (!exporting)
+      {
+        doc->modified_ = true;
+        doc->writeJournal_.clear();
+      }
+    }
+    else
+    {
+      if (!exporting)
+        finishSave(*doc, filename, layout);
+
+      flashMessage((exporting ? "Exported " : "Saved ") + filename);
+    }
+
+    if (!doc->queuedWrites_.empty())
+    {
+      const PendingWrite next = doc->queuedWrites_.front();
+      doc->queuedWrites_.erase(doc->queuedWrites_.begin());
+      startWrite(doc, next.filename_, next.export_);
+    }
+  }
+
+  // Saves or exports the current document, the save and export commands. Large documents
+  // are written on the scheduler, and a write requested while one is in flight waits for
+  // it. A newer request replaces a waiting one of the same kind, since it writes the
+  // same document again. Returns 0 if the document can't be written, 1 once it is
+  // written and 2 while it is written in the background.
+  static int requestWrite(std::string const& filename, bool exporting)
+  {
+    if (!prepareWrite(exporting ? "exported" : "saved"))
+      return 0;
+
+    Document & doc = currentDoc();
+    const int backgroundSize = BACKGROUND_SAVE_SIZE.toInt();
+
+    if (!doc.writing_ && (backgroundSize <= 0 || doc.cells_.size() < (std::size_t)backgroundSize))
+      return (exporting ? exportCSV(filename) : save(filename)) ? 1 : 0;
+
+    if (!doc.writing_)
+    {
+      startWrite(currentBuffer().doc_, filename, exporting);
+      return 2;
+    }
+
+    auto queued = std::find_if(doc.queuedWrites_.begin(), doc.queuedWrites_.end(), [exporting] (PendingWrite const& write) {
+      return write.export_ == exporting;
+    });
+
+    if (queued == doc.queuedWrites_.end())
+      queued = doc.queuedWrites_.insert(doc.queuedWrites_.end(), PendingWrite());
+
+    queued->filename_ = filename;
+    queued->export_ = exporting;
+
+    flashMessage((exporting ? "Exporting " : "Saving ") + filename + " once the write in progress is done");
+    return 2;
+  }
+
+  // Classifies text, the text of cell, as a formula, number or text, and parses the formula
+  // or number. A timestamp is a number of microseconds, see str::parseTimestamp(), and
+  // shows its text. Doesn't touch the document, so it is safe to call from worker threads.
+  void parseCellText(Cell & cell, std::string const& text)
+  {
+    if (!text.empty() && text.front() == '=')
+    {
+      cell.setFormula(parseExpression(text.substr(1)));
+    }
+    else
+    {
+      cell.formula.reset();
+
+      if (str::parseValue(text, cell.value))
+        cell.type = CellType::Number;
+      else
+      {
+        cell.type = CellType::Text;
+        cell.value = 0.0;
+      }
+    }
+  }
+
+  void shareFormula(Document & doc, Index const& idx, Cell & cell)
+  {
+    if (!cell.hasExpression())
+      return;
+
+    Formula & formula = *cell.formula;
+    const Index offset(formula.origin.x - idx.x, formula.origin.y - idx.y);
+
+    // The bytes of an expression identify it by its operators, constants and references
+    ExprCode expression = formula.pattern->expression;
+    expression.offset(offset);
+
+    std::shared_ptr<const FormulaTemplate> & shared = doc.formulaTemplates_[expression.key()];
+    if (!shared)
+    {
+      std::shared_ptr<FormulaTemplate> pattern = std::make_shared<FormulaTemplate>();
+      pattern->text = exprText(expression.decode());
+      pattern->expression = std::move(expression);
+      pattern->program = formula.pattern->program;
+      offsetProgram(pattern->program, offset);
+      shared = pattern;
+    }
+
+    formula.pattern = shared;
+    formula.origin = idx;
+  }
+
+  static void updateDependencies(Index const& idx, Cell const& cell)
+  {
+    if (cell.hasExpression())
+      setPrecedents(currentDoc(), idx, cell);
+    else
+      removePrecedents(currentDoc(), idx);
+  }
+
+  void growDocument(Index const& idx)
+  {
+    if (currentDoc().width_ < (idx.x + 1))
+      currentDoc().width_ = idx.x + 1;
+
+    if (currentDoc().height_ < (idx.y + 1))
+      currentDoc().height_ = (idx.y + 1);
+  }
+
+  void fitColumnWidth(int column, StrView text)
+  {
+    int width = getColumnWidth(column);
+    if (width < (int)text.size())
+      currentDoc().columns_.set(column, text.size() + 1);
+  }
+
+  // Widens every column to fit the longest value widths has for it
+  static void fitColumnWidths(std::vector<std::size_t> const& widths)
+  {
+    const int defaultWidth = DEFAULT_COLUMN_WIDTH.toInt();
+
+    for (std::size_t column = 0; column < widths.size(); ++column)
+      if (currentDoc().columns_.width(column, defaultWidth) < (int)widths[column])
+        currentDoc().columns_.set(column, widths[column] + 1);
+  }
+
+  void setText(Index const& idx, std::string const& text, bool forceFormat)
+  {
+    Document & doc = currentDoc();
+
+    // An index of the column that is up to date follows the edit
+    ColumnIndex * index = doc.indexes_.empty() ? nullptr : findColumnIndex(doc, idx.x);
+    if (index && index->stale())
+      index = nullptr;
+
+    if (index)
+      if (Cell const* previous = static_cast<CellStorage const&>(doc.cells_).find(idx))
+        index->erase(idx.y, *previous, doc.strings_);
+
+    // So does a sketch, except for the value it can't take out. The header isn't in it.
+    ColumnSketch * sketch = doc.sketches_.empty() || idx.y == 0 ? nullptr : findColumnSketch(doc, idx.x);
+    if (sketch && !sketchCurrent(doc, *sketch))
+      sketch = nullptr;
+
+    if (sketch)
+      if (Cell const* previous = static_cast<CellStorage const&>(doc.cells_).find(idx))
+        if (previous->type == CellType::Formula || !doc.strings_.str(previous->text).empty())
+          sketch->summary_.values_--;
+
+    // And the counts of the duplicate rules, while the column holds no formula
+    std::vector<FormatRule *> counted;
+    uncountRuleValues(doc, idx, counted);
+
+    if (!doc.lookups_.empty() || !doc.formatRules_.empty() || !doc.encodings_.empty() || !doc.results_.empty())
+      invalidateLookups(doc, idx.x);
+
+    invalidateColumnFormulas(doc, idx.y);
+
+    const int height = doc.height_;
+    Cell & cell = doc.cells_.get(idx);
+    std::string value;
+
+    if (forceFormat)
+    {
+      std::tie(cell.format, value) = parseFormatAndValue(text);
+      fitColumnWidth(idx.x, value);
+    }
+    else
+    {
+      uint32_t format;
+      std::tie(format, value) = parseFormatAndValue(text);
+    }
+
+    cell.text = currentDoc().strings_.intern(value);
+    if (cell.text == StringPool::EMPTY)
+      doc.emptiedCells_++;
+
+    growDocument(idx);
+    parseCellText(cell, value);
+    shareFormula(currentDoc(), idx, cell);
+    updateDependencies(idx, cell);
+
+    if (index)
+      index->insert(idx.y, cell, doc.strings_);
+
+    // The rows the edit added are empty in every column
+    for (auto & it : doc.sketches_)
+      if (it.height_ == height)
+        it.height_ = doc.height_;
+
+    if (sketch && cell.type == CellType::Formula)
+      sketch->stale_ = true;
+    else if (sketch)
+    {
+      sketch->summary_.add(cell, doc.strings_);
+      sketch->edits_++;
+    }
+
+    countRuleValues(doc, cell, height, counted);
+  }
+
+  uint64_t hashField(uint64_t row, StrView text, uint32_t field)
+  {
+    return murmurMix64(row * FILE_CHUNK_PRIME + murmurHash(text.data(), text.size(), field) + 1);
+  }
+
+  void addChunkRow(std::vector<FileChunk> & chunks, uint64_t hash)
+  {
+    if (chunks.empty() || chunks.back().closed_)
+      chunks.emplace_back();
+
+    FileChunk & chunk = chunks.back();
+    chunk.hash_ = chunk.hash_ * FILE_CHUNK_PRIME + hash;
+    chunk.rows_++;
+    chunk.closed_ = (hash & ((1u << FILE_CHUNK_BITS) - 1)) == 0;
+  }
+
+  bool appendChunk(std::vector<FileChunk> & chunks, FileChunk const& chunk)
+  {
+    if (chunks.empty() || chunks.back().closed_)
+    {
+      chunks.push_back(chunk);
+      return true;
+    }
+
+    uint64_t scale = 1;
+    uint64_t power = FILE_CHUNK_PRIME;
+    for (uint32_t rows = chunk.rows_; rows > 0; rows >>= 1, power *= power)
+      if (rows & 1)
+        scale *= power;
+
+    FileChunk & last = chunks.back();
+    last.hash_ = last.hash_ * scale + chunk.hash_;
+    last.rows_ += chunk.rows_;
+    last.closed_ = chunk.closed_;
+    return false;
+  }
+
+  // Parses the lines of the chunk into cells. With a selection the lines it drops and
+  // the columns it skips never become cells, first is set for the chunk that starts the
+  // file.
+  static void parseChunk(ParsedChunk & chunk, char delimiter, LoadSelection const* selection = nullptr, bool first = false)
+  {
+    std::vector<int> const* columns = selection && !selection->columns_.empty() ? &selection->columns_ : nullptr;
+    std::string value;
+
+    utf8::validate(chunk.data_, &chunk.malformed_);
+
+    auto addCell = [&chunk, &value, columns] (int field, StrView text) {
+      const int column = !columns ? field : field < (int)columns->size() ? (*columns)[field] : -1;
+      if (text.empty() || column < 0)
+        return;
+
+      Cell cell;
+      cell.format = parseFormatAndValue(text, value);
+
+      // Ids are local to the chunk until mergeChunk() moves the cells into the document
+      cell.text = chunk.strings_.intern(value);
+      parseCellText(cell, value);
+
+      if ((int)chunk.widths_.size() <= column)
+        chunk.widths_.resize(column + 1, 0);
+
+      chunk.widths_[column] = std::max(chunk.widths_[column], value.size());
+      chunk.cells_.emplace_back(Index(column, chunk.rows_), std::move(cell));
+    };
+
+    csv::Reader reader(delimiter);
+    if (selection && !selection->keep_.empty())
+      reader.keepColumns(&selection->keep_);
+
+    if (!selection || !selection->where_)
+    {
+      int field = 0;
+      uint64_t hash = 0;
+      reader.read(chunk.data_, [&chunk, &field, &hash, &addCell] (StrView text, bool lineEnd) {
+        addCell(field, text);
+        hash = hashField(hash, text, field);
+
+        if (lineEnd)
+        {
+          addChunkRow(chunk.fileChunks_, hash);
+          chunk.fileLines_.push_back(FileLine { (uint32_t)hash, (uint32_t)field + 1 });
+          hash = 0;
+          field = 0;
+          chunk.rows_++;
+        }
+        else
+          field++;
+      });
+
+      return;
+    }
+
+    readSelectedLines(reader, chunk.data_, *selection, first && selection->header_, addCell, [&chunk] () { chunk.rows_++; });
+  }
+
+  std::size_t loadChunkSize()
+  {
+    // Field offsets within a chunk are 32 bit
+    return std::min(std::max(LOAD_CHUNK_SIZE.toInt(), 1024), 1 << 30);
+  }
+
+  std::vector<ParsedChunk> splitChunks(StrView data)
+  {
+    const std::size_t chunkSize = loadChunkSize();
+
+    std::vector<ParsedChunk> chunks;
+
+    std::size_t start = 0;
+    while (start < data.size())
+    {
+      std::size_t end = std::min(start + chunkSize, data.size()) - 1;
+      std::size_t quotes = csv::count(data.substr(start, end - start), csv::QUOTE);
+
+      for (;;)
+      {
+        const std::size_t newline = data.find('\n', end);
+        if (newline == StrView::npos)
+        {
+          end = data.size();
+          break;
+        }
+
+        quotes += csv::count(data.substr(end, newline - end), csv::QUOTE);
+        end = newline + 1;
+
+        if (quotes % 2 == 0)
+          break;
+      }
+
+      chunks.emplace_back();
+      chunks.back().data_ = data.substr(start, end - start);
+
+      start = end;
+    }
+
+    return chunks;
+  }
+
+  std::size_t wholeLines(StrView data)
+  {
+    std::size_t end = data.size();
+    while (end > 0 && data[end - 1] != '\n')
+      end--;
+
+    if (end == 0 || csv::count(data.substr(0, end), csv::QUOTE) % 2 == 0)
+      return end;
+
+    // The last line break is quoted, look for the last one that isn't from the start
+    std::size_t lines = 0;
+    std::size_t quotes = 0;
+    std::size_t pos = 0;
+
+    for (std::size_t newline = data.find('\n'); newline != StrView::npos; newline = data.find('\n', pos))
+    {
+      quotes += csv::count(data.substr(pos, newline - pos), csv::QUOTE);
+      pos = newline + 1;
+
+      if (quotes % 2 == 0)
+        lines = pos;
+    }
+
+    return lines;
+  }
+
+  // Examines the first line of data to determine which of delimiters it uses
+  static char detectDelimiter(StrView data, std::string const& delimiters)
+  {
+    std::vector<int> delimCount(delimiters.size(), 0);
+    const StrView firstLine = data.substr(0, data.find('\n'));
+
+    for (std::size_t i = 0; i < delimiters.size(); ++i)
+      delimCount[i] = csv::count(firstLine, delimiters[i]);
+
+    int maxCount = -1;
+    char delimiter = delimiters[0];
+    for (std::size_t i = 0; i < delimCount.size(); ++i)
+    {
+      if (delimCount[i] > maxCount)
+      {
+        maxCount = delimCount[i];
+        delimiter = delimiters[i];
+      }
+    }
+
+    return delimiter;
+  }
+
+  char detectDelimiter(StrView data)
+  {
+    return detectDelimiter(data, DELIMITERS.toStr());
+  }
+
+  // Moves the cells of a parsed chunk that starts at row into the current document, and
+  // adds their indices to merged if it is set. Returns the row following the chunk.
+  static int mergeChunk(ParsedChunk & chunk, int row, std::vector<Index> * merged = nullptr)
+  {
+    StringPool & strings = currentDoc().strings_;
+
+    std::vector<uint32_t> textIds(chunk.strings_.size());
+    for (std::size_t i = 0; i < textIds.size(); ++i)
+      textIds[i] = strings.intern(chunk.strings_.str(i));
+
+    for (auto & it : chunk.cells_)
+    {
+      const Index idx(it.first.x, it.first.y + row);
+
+      it.second.text = textIds[it.second.text];
+
+      if (merged)
+        merged->push_back(idx);
+
+      growDocument(idx);
+      shareFormula(currentDoc(), idx, it.second);
+      updateDependencies(idx, it.second);
+
+      getCell(idx) = std::move(it.second);
+    }
+
+    fitColumnWidths(chunk.widths_);
+
+    // Runs are only kept for the lines of the file from the first on
+    if (row == 0 || !currentDoc().fileChunks_.empty())
+    {
+      for (auto const& fileChunk : chunk.fileChunks_)
+        appendChunk(currentDoc().fileChunks_, fileChunk);
+
+      currentDoc().fileLines_.insert(currentDoc().fileLines_.end(), chunk.fileLines_.begin(), chunk.fileLines_.end());
+    }
+
+    if (chunk.malformed_ != StrView::npos && !currentDoc().malformedText_)
+    {
+      logWarning("The document isn't valid UTF-8 from its line ", (long)(row + csv::count(chunk.data_.substr(0, chunk.malformed_), '\n') + 1), " on, the text shows the way it decodes");
+      currentDoc().malformedText_ = true;
+    }
+
+    chunk.cells_ = std::vector<std::pair<Index, Cell>>();
+    chunk.strings_ = StringPool();
+    chunk.fileLines_ = std::vector<FileLine>();
+    return row + chunk.rows_;
+  }
+
+  // Parses the lines of data in parallel, then merges them into the current document in
+  // order from row on. Returns the row following them. selection picks what of the
+  // lines is loaded, see parseChunk().
+  static int mergeLines(StrView data, int row, std::vector<Index> * merged = nullptr, LoadSelection const* selection = nullptr)
+  {
+    std::vector<ParsedChunk> chunks = splitChunks(data);
+    const char delimiter = currentDoc().delimiter_;
+
+    std::vector<Scheduler::Task> tasks;
+    for (auto & chunk : chunks)
+    {
+      const bool first = row == 0 && &chunk == &chunks.front();
+      tasks.push_back([&chunk, delimiter, selection, first] () { parseChunk(chunk, delimiter, selection, first); });
+    }
+
+    Scheduler::shared().run(tasks);
+
+    for (auto & chunk : chunks)
+      row = mergeChunk(chunk, row, merged);
+
+    return row;
+  }
+
+  bool loadCSV(StrView data, char defaultDelimiter, LoadSelection const* selection)
+  {
+    createDefaultEmpty();
+    currentDoc().width_ = 0;
+    currentDoc().height_ = 0;
+    currentDoc().delimiter_ = defaultDelimiter == 0 ? detectDelimiter(data) : defaultDelimiter;
+    currentDoc().fileRows_ = mergeLines(data, 0, nullptr, selection);
+
+    evaluateLoadedDocument();
+    return true;
+  }
+
+  // A CSV document being loaded in the background. Every chunk is parsed by a task on
+  // the scheduler, which flags it in parsed_ and posts a completion. The UI thread merges
+  // the parsed chunks into the loading buffer in order from updateLoading(), so the
+  // document fills in while it loads. The tasks go first when it is destroyed.
+  struct BackgroundLoad
+  {
+    MappedFile file_;
+    std::vector<ParsedChunk> chunks_;
+    std::unique_ptr<std::atomic<bool>[]> parsed_;
+    char delimiter_ = ',';
+
+    std::size_t merged_ = 0;
+    std::size_t bytesMerged_ = 0;
+    int row_ = 0;
+    int progress_ = -1;
+
+    TaskGroup tasks_;
+  };
+
+  static std::unique_ptr<BackgroundLoad> backgroundLoad_;
+
+  // A CSV document read from standard input. A reader thread parses the whole lines it
+  // has read into a chunk whenever doc_loadChunkSize bytes came in or STREAM_PUBLISH_INTERVAL
+  // passed, and queues it. updateLoading() merges the queued chunks into the loading
+  // buffer, so the rows can be looked at while the producer is still writing.
+  //
+  // A gzip compressed file loads the same way from the file_ of filename_, see inflateMain().
+  struct StreamLoad
+  {
+    bx::Mutex mutex_;
+    bx::Thread thread_;
+    std::atomic<bool> quit_;
+    std::string delimiters_;
+    std::size_t chunkSize_ = 0;
+    MappedFile file_;
+    std::string filename_;
+
+    // Handed over under mutex_
+    std::vector<ParsedChunk> parsed_;
+    char delimiter_ = 0;
+    std::size_t bytesRead_ = 0;
+    bool done_ = false;
+    bool failed_ = false;
+
+    int row_ = 0;
+    std::size_t bytesMerged_ = 0;
+
+    StreamLoad() : quit_(false) { }
+  };
+
+  static const int STREAM_PUBLISH_INTERVAL = 100;
+
+  static std::unique_ptr<StreamLoad> streamLoad_;
+
+  static int loadingBufferIndex()
+  {
+    for (std::size_t i = 0; i < documentBuffers().size(); ++i)
+      if (documentBuffers()[i].doc_->loading_)
+        return i;
+
+    return -1;
+  }
+
+  static bool startBackgroundLoad(std::string const& filename)
+  {
+    if (backgroundLoad_ || streamLoad_)
+    {
+      flashMessage("Another document is still loading!");
+      return false;
+    }
+
+    std::unique_ptr<BackgroundLoad> load(new BackgroundLoad());
+    if (!load->file_.open(filename))
+    {
+      logError("Could not open document '", filename, "'");
+      flashMessage("Could not open document!");
+      return false;
+    }
+
+    createDefaultEmpty();
+    currentDoc().width_ = 0;
+    currentDoc().height_ = 0;
+    currentDoc().delimiter_ = detectDelimiter(load->file_.data());
+    currentDoc().filename_ = filename;
+    currentDoc().readOnly_ = true;
+    currentDoc().loading_ = true;
+
+    load->delimiter_ = currentDoc().delimiter_;
+    load->chunks_ = splitChunks(load->file_.data());
+    load->parsed_.reset(new std::atomic<bool>[load->chunks_.size()]);
+
+    for (std::size_t i = 0; i < load->chunks_.size(); ++i)
+      load->parsed_[i] = false;
+
+    backgroundLoad_ = std::move(load);
+
+    BackgroundLoad * started = backgroundLoad_.get();
+    for (std::size_t i = 0; i < started->chunks_.size(); ++i)
+    {
+      started->tasks_.spawn([started, i] () {
+        parseChunk(started->chunks_[i], started->delimiter_);
+        started->parsed_[i] = true;
+        Scheduler::shared().postCompletion([] () { updateLoading(); });
+      });
+    }
+
+    logInfo("Loading document ", filename, " in the background");
+    return true;
+  }
+
+  static int streamMain(void * userData)
+  {
+    StreamLoad & load = *static_cast<StreamLoad *>(userData);
+
+    InputStream input;
+    std::string buffer;
+    char delimiter = 0;
+
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point published = Clock::now();
+
+    // Parses the whole lines read so far, or everything once the input ended
+    auto publish = [&] (bool end) {
+      published = Clock::now();
+
+      const std::size_t size = end ? buffer.size() : wholeLines(buffer);
+      if (size == 0)
+        return;
+
+      if (delimiter == 0)
+        delimiter = detectDelimiter(buffer, load.delimiters_);
+
+      ParsedChunk chunk;
+      chunk.data_ = StrView(buffer.data(), size);
+      parseChunk(chunk, delimiter);
+      chunk.data_ = StrView();
+
+      buffer.erase(0, size);
+
+      bx::MutexScope lock(load.mutex_);
+      load.parsed_.push_back(std::move(chunk));
+      load.delimiter_ = delimiter;
+      load.bytesRead_ += size;
+    };
+
+    while (!load.quit_)
+    {
+      const InputStream::Result result = input.read(buffer, STREAM_PUBLISH_INTERVAL);
+      if (result == InputStream::End)
+        break;
+
+      if (buffer.size() >= load.chunkSize_ || Clock::now() - published >= std::chrono::milliseconds(STREAM_PUBLISH_INTERVAL))
+      {
+        publish(false);
+        Scheduler::shared().postCompletion([] () { updateLoading(); });
+      }
+    }
+
+    publish(true);
+
+    {
+      bx::MutexScope lock(load.mutex_);
+      load.done_ = true;
+    }
+
+    Scheduler::shared().postCompletion([] () { updateLoading(); });
+    return 0;
+  }
+
+  static bool startStreamLoad()
+  {
+    if (backgroundLoad_ || streamLoad_)
+    {
+      flashMessage("Another document is still loading!");
+      return false;
+    }
+
+    createDefaultEmpty();
+    currentDoc().width_ = 0;
+    currentDoc().height_ = 0;
+    currentDoc().delimiter_ = DELIMITERS.toStr()[0];
+    currentDoc().readOnly_ = true;
+    currentDoc().loading_ = true;
+
+    streamLoad_.reset(new StreamLoad());
+    streamLoad_->delimiters_ = DELIMITERS.toStr();
+    streamLoad_->chunkSize_ = loadChunkSize();
+    streamLoad_->thread_.init(streamMain, streamLoad_.get());
+
+    logInfo("Reading a document from standard input");
+    return true;
+  }
+
+  // Decompresses the file of a compressed load and parses it as it comes out. Every round
+  // parses the whole lines decompressed in the round before on the scheduler, while the
+  // next doc_loadChunkSize bytes are decompressed next to them. The members of a BGZF file
+  // are decompressed in parallel too, any other file in order.
+  static int inflateMain(void * userData)
+  {
+    StreamLoad & load = *static_cast<StreamLoad *>(userData);
+
+    const StrView data = load.file_.data();
+    const std::vector<StrView> members = gzip::members(data);
+    const bool parallel = members.size() > 1;
+    const std::size_t workers = std::max(Scheduler::shared().threadCount(), 1);
+
+    gzip::Inflater inflater(data);
+    std::size_t member = 0;
+    std::atomic<bool> failed(false);
+    bool end = false;
+    char delimiter = 0;
+
+    // Decompressed text that isn't parsed yet, starting with a line
+    std::string text;
+    std::vector<std::string> parts;
+
+    while (!load.quit_)
+    {
+      const bool last = end;
+      const std::size_t size = last ? text.size() : wholeLines(text);
+
+      if (delimiter == 0 && size > 0)
+        delimiter = detectDelimiter(text, load.delimiters_);
+
+      std::vector<ParsedChunk> chunks = splitChunks(StrView(text.data(), size));
+      std::vector<Scheduler::Task> tasks;
+      for (auto & chunk : chunks)
+        tasks.push_back([&chunk, delimiter] () { parseChunk(chunk, delimiter); });
+
+      // The members of a round are dealt out to the workers in runs, the output of every
+      // run goes into a part of its own
+      parts.clear();
+      if (!last && parallel)
+      {
+        std::size_t next = member;
+        std::size_t bytes = 0;
+        while (next < members.size() && bytes < load.chunkSize_)
+          bytes += gzip::memberSize(members[next++]);
+
+        const std::size_t runs = std::min(workers, next - member);
+        parts.resize(runs);
+
+        for (std::size_t run = 0; run < runs; ++run)
+        {
+          const std::size_t first = member + (next - member) * run / runs;
+          const std::size_t after = member + (next - member) * (run + 1) / runs;
+
+          tasks.push_back([&members, &parts, &failed, run, first, after] () {
+            for (std::size_t i = first; i < after && !failed; ++i)
+              if (!gzip::inflate(members[i], parts[run]))
+                failed = true;
+          });
+        }
+
+        member = next;
+      }
+      else if (!last)
+      {
+        parts.resize(1);
+        tasks.push_back([&] () {
+          if (!inflater.inflate(parts[0], load.chunkSize_))
+            failed = true;
+        });
+      }
+
+      Scheduler::shared().run(tasks);
+
+      for (auto & chunk : chunks)
+        chunk.data_ = StrView();
+
+      {
+        bx::MutexScope lock(load.mutex_);
+        for (auto & chunk : chunks)
+          load.parsed_.push_back(std::move(chunk));
+
+        load.delimiter_ = delimiter;
+        load.bytesRead_ += size;
+      }
+
+      Scheduler::shared().postCompletion([] () { updateLoading(); });
+
+      if (last)
+        break;
+
+      text.erase(0, size);
+      for (auto const& part : parts)
+        text += part;
+
+      end = failed || (parallel ? member == members.size() : inflater.done());
+    }
+
+    {
+      bx::MutexScope lock(load.mutex_);
+      load.done_ = true;
+      load.failed_ = failed;
+    }
+
+    Scheduler::shared().postCompletion([] () { updateLoading(); });
+    return 0;
+  }
+
+  // Loads a gzip compressed CSV file without decompressing it to disk first. Once loaded
+  // the document is named after the file without .gz, so saving it doesn't write CSV
+  // over the compressed file.
+  static bool startCompressedLoad(std::string const& filename)
+  {
+    if (backgroundLoad_ || streamLoad_)
+    {
+      flashMessage("Another document is still loading!");
+      return false;
+    }
+
+    std::unique_ptr<StreamLoad> load(new StreamLoad());
+    if (!load->file_.open(filename))
+    {
+      logError("Could not open document '", filename, "'");
+      flashMessage("Could not open document!");
+      return false;
+    }
+
+    createDefaultEmpty();
+    currentDoc().width_ = 0;
+    currentDoc().height_ = 0;
+    currentDoc().delimiter_ = DELIMITERS.toStr()[0];
+    currentDoc().filename_ = filename;
+    currentDoc().readOnly_ = true;
+    currentDoc().loading_ = true;
+
+    streamLoad_ = std::move(load);
+    streamLoad_->filename_ = filename;
+    streamLoad_->delimiters_ = DELIMITERS.toStr();
+    streamLoad_->chunkSize_ = loadChunkSize();
+    streamLoad_->thread_.init(inflateMain, streamLoad_.get());
+
+    logInfo("Loading compressed document ", filename, " in the background");
+    return true;
+  }
+
+  static std::string uncompressedFilename(std::string const& filename)
+  {
+    static const std::string EXTENSION = ".gz";
+    if (filename.size() > EXTENSION.size() && filename.compare(filename.size() - EXTENSION.size(), EXTENSION.size(), EXTENSION) == 0)
+      return filename.substr(0, filename.size() - EXTENSION.size());
+
+    return filename + ".csv";
+  }
+
+  // What the members of gzip data say they decompress to, at least the size of data. The
+  // sizes are modulo 4 GB, a file that large compresses at least that well anyway.
+  static std::size_t inflatedSize(StrView data)
+  {
+    std::size_t size = 0;
+    for (StrView member : gzip::members(data))
+      size += gzip::memberSize(member);
+
+    return std::max(size, data.size());
+  }
+
+  // Loads a gzip compressed CSV file here instead of on a thread, named like
+  // startCompressedLoad() names it. Corrupt data ends it like it ends that.
+  static bool loadCompressed(StrView data, std::string const& filename)
+  {
+    gzip::Inflater inflater(data);
+    std::string text;
+    bool failed = false;
+
+    while (!failed && !inflater.done())
+      failed = !inflater.inflate(text, loadChunkSize());
+
+    loadCSV(StrView(text.data(), text.size()), 0);
+
+    if (failed)
+    {
+      logError("Could not decompress all of '", filename, "', loaded the ", currentDoc().fileRows_, " rows before the corrupt data");
+      flashMessage("Could not decompress all of " + filename);
+    }
+
+    currentDoc().filename_ = uncompressedFilename(filename);
+    currentDoc().readOnly_ = false;
+    return true;
+  }
+
+  // Merges the chunks the reader thread queued since the last time into the loading buffer
+  static bool updateStreamLoad()
+  {
+    StreamLoad & load = *streamLoad_;
+
+    std::vector<ParsedChunk> parsed;
+    char delimiter;
+    bool done;
+    bool failed;
+    {
+      bx::MutexScope lock(load.mutex_);
+      parsed.swap(load.parsed_);
+      delimiter = load.delimiter_;
+      load.bytesMerged_ = load.bytesRead_;
+      done = load.done_;
+      failed = load.failed_;
+    }
+
+    const int bufferIndex = loadingBufferIndex();
+    assert(bufferIndex >= 0);
+
+    // The merge helpers work on the current document, which the user may have switched away from
+    const int previousBufferIndex = currentBufferIndex_;
+    currentBufferIndex_ = bufferIndex;
+
+    if (delimiter != 0)
+      currentDoc().delimiter_ = delimiter;
+
+    for (auto & chunk : parsed)
+      load.row_ = mergeChunk(chunk, load.row_);
+
+    if (done)
+    {
+      load.thread_.shutdown();
+
+      currentDoc().loading_ = false;
+      currentDoc().readOnly_ = false;
+      currentDoc().fileRows_ = load.row_;
+      evaluateLoadedDocument();
+
+      if (load.filename_.empty())
+        flashMessage("Read " + std::to_string(load.row_) + " rows from standard input");
+      else if (failed)
+      {
+        logError("Could not decompress all of '", load.filename_, "', loaded the ", load.row_, " rows before the corrupt data");
+        flashMessage("Could not decompress all of " + load.filename_);
+      }
+      else
+        flashMessage("Loaded " + load.filename_);
+
+      if (!load.filename_.empty())
+        currentDoc().filename_ = uncompressedFilename(load.filename_);
+
+      streamLoad_.reset();
+    }
+    else if (!parsed.empty())
+      flashMessage((load.filename_.empty() ? std::string("Reading standard input ") : "Loading " + load.filename_ + " ") + std::to_string(load.bytesMerged_ >> 20) + " MB");
+
+    currentBufferIndex_ = previousBufferIndex;
+    return !parsed.empty() || done;
+  }
+
+  // Opens a CSV file as a paged document, see PagedTable. Its rows appear as they are indexed.
+  static bool openPaged(std::string const& filename, char delimiter)
+  {
+    std::unique_ptr<PagedTable> table(new PagedTable());
+    if (!table->open(filename, delimiter, PAGED_SIDECAR.toBool()))
+    {
+      logError("Could not open document '", filename, "'");
+      flashMessage("Could not open document!");
+      return false;
+    }
+
+    createDefaultEmpty();
+
+    // With the index of a sidecar every row is there at once
+    if (!table->indexing())
+    {
+      currentDoc().width_ = table->columnCount();
+      currentDoc().height_ = table->rowCount();
+    }
+
+    currentDoc().paged_ = std::move(table);
+    currentDoc().delimiter_ = delimiter;
+    currentDoc().filename_ = filename;
+    currentDoc().readOnly_ = true;
+
+    logInfo("Opened document ", filename, " paged");
+    return true;
+  }
+
+  // Opens an Arrow IPC or Parquet file as a paged document, all of its rows are there at once
+  static bool openColumnar(std::string const& filename)
+  {
+    std::unique_ptr<PagedTable> table(new PagedTable());
+    std::string error;
+    if (!table->openColumnar(filename, error))
+    {
+      logError("Could not open document '", filename, "': ", error);
+      flashMessage("Could not open document!");
+      return false;
+    }
+
+    createDefaultEmpty();
+    currentDoc().width_ = table->columnCount();
+    currentDoc().height_ = table->rowCount();
+    currentDoc().paged_ = std::move(table);
+    currentDoc().filename_ = filename;
+    currentDoc().readOnly_ = true;
+
+    logInfo("Opened columnar document ", filename);
+    return true;
+  }
+
+  static bool isColumnarFile(std::string const& filename)
+  {
+    MappedFile file;
+    return file.open(filename) && PagedTable::isColumnar(file.data());
+  }
+
+  // Whether name matches pattern, where * stands for any run of characters and ? for one
+  static bool matchesPattern(const char * name, const char * pattern)
+  {
+    if (*pattern == '*')
+      return matchesPattern(name, pattern + 1) || (*name && matchesPattern(name + 1, pattern));
+
+    if (*pattern == 0 || *name == 0)
+      return *pattern == *name;
+
+    return (*pattern == '?' || *pattern == *name) && matchesPattern(name + 1, pattern + 1);
+  }
+
+  bool loadDirectory(std::string const& directory, std::string const& pattern)
+  {
+    PROFILE_SCOPE(LOAD);
+
+    std::vector<std::string> filenames;
+
+    tinydir_dir dir;
+    if (tinydir_open_sorted(&dir, directory.c_str()) == 0)
+    {
+      for (std::size_t i = 0; i < dir.n_files; ++i)
+      {
+        tinydir_file file;
+        if (tinydir_readfile_n(&dir, &file, i) == 0 && file.is_reg && matchesPattern(file.name, pattern.c_str()))
+          filenames.push_back(file.path);
+      }
+
+      tinydir_close(&dir);
+    }
+
+    if (filenames.empty())
+    {
+      logError("No files matching '", pattern, "' in '", directory, "'");
+      flashMessage("No documents to open!");
+      return false;
+    }
+
+    MappedFile first;
+    if (!first.open(filenames.front()))
+    {
+      logError("Could not open document '", filenames.front(), "'");
+      flashMessage("Could not open document!");
+      return false;
+    }
+
+    const char delimiter = detectDelimiter(first.data());
+
+    std::unique_ptr<PagedTable> table(new PagedTable());
+    if (!table->open(filenames, delimiter))
+    {
+      logError("Could not open the documents in '", directory, "'");
+      flashMessage("Could not open document!");
+      return false;
+    }
+
+    createDefaultEmpty();
+    currentDoc().paged_ = std::move(table);
+    currentDoc().delimiter_ = delimiter;
+    currentDoc().filename_ = directory;
+    currentDoc().readOnly_ = true;
+
+    logInfo("Opened ", (int)filenames.size(), " documents in ", directory, " as partitions");
+    return true;
+  }
+
+  bool isIndexing(Document const& doc)
+  {
+    return doc.paged_ && doc.paged_->indexing();
+  }
+
+  // Takes over the rows the indexers of paged documents found. Returns true if any
+  // document grew.
+  static bool updatePagedDocuments()
+  {
+    bool changed = false;
+
+    for (auto & buffer : documentBuffers())
+    {
+      Document & doc = *buffer.doc_;
+      if (buffer.view_ || !isIndexing(doc) || !doc.paged_->update())
+        continue;
+
+      doc.width_ = doc.paged_->columnCount();
+      doc.height_ = doc.paged_->rowCount();
+      changed = true;
+
+      if (!doc.paged_->indexing())
+        flashMessage("Indexed " + doc.filename_);
+    }
+
+    return changed;
+  }
+
+  // Files loaded together, like the ones on the command line. The CSV files among them
+  // are parsed on the scheduler at the same time, every file in a task group of its own.
+  // Each goes into a buffer of its own once it and every file before it are in, so the
+  // buffers keep the given order. Any other file is loaded by load() when its turn comes.
+  struct MultiLoad
+  {
+    struct File
+    {
+      std::string filename_;
+      FileStamp stamp_;
+      MappedFile file_;
+      std::vector<ParsedChunk> chunks_;
+      char delimiter_ = ',';
+      bool opened_ = false;
+      bool parsed_ = false;     // on the scheduler, load() takes it otherwise
+      TaskGroup tasks_;
+    };
+
+    std::vector<std::unique_ptr<File>> files_;
+    std::size_t next_ = 0;
+  };
+
+  static std::unique_ptr<MultiLoad> multiLoad_;
+
+  // Whether a file of size bytes is small enough to be parsed along with others, larger
+  // ones are paged or loaded in the background
+  static bool isSmallFile(std::size_t size)
+  {
+    const int pagedSize = PAGED_LOAD_SIZE.toInt();
+    const int backgroundSize = BACKGROUND_LOAD_SIZE.toInt();
+
+    return size > 0 && (pagedSize <= 0 || size < (std::size_t)pagedSize) && (backgroundSize <= 0 || size < (std::size_t)backgroundSize);
+  }
+
+  // Whether a file can be parsed along with others, a small CSV file that isn't open
+  static bool startParse(MultiLoad::File & file)
+  {
+    if (!file.opened_)
+      return false;
+
+    bool open = false;
+    for (auto const& buffer : documentBuffers())
+      open |= buffer.doc_->filename_ == file.filename_;
+
+    const StrView data = file.file_.data();
+
+    if (open || !isSmallFile(data.size()) ||
+        (data.size() > 4 && memcmp(data.data(), zum2::MAGIC, sizeof(zum2::MAGIC)) == 0) ||
+        (data.size() > 5 && memcmp(data.data(), "ZUM1\n", 5) == 0))
+    {
+      file.file_.close();
+      return false;
+    }
+
+    file.delimiter_ = detectDelimiter(data);
+    file.chunks_ = splitChunks(data);
+
+    MultiLoad::File * started = &file;
+    for (std::size_t i = 0; i < file.chunks_.size(); ++i)
+      file.tasks_.spawn([started, i] () { parseChunk(started->chunks_[i], started->delimiter_); });
+
+    return true;
+  }
+
+  // Puts the files whose turn came into buffers, waiting for their tasks if wait is set.
+  // Returns true if a buffer was added.
+  static bool updateMultiLoad(bool wait)
+  {
+    MultiLoad & multi = *multiLoad_;
+    bool added = false;
+
+    while (multi.next_ < multi.files_.size())
+    {
+      MultiLoad::File & file = *multi.files_[multi.next_];
+      if (file.parsed_ && !wait && !file.tasks_.done())
+        break;
+
+      // Only the first file is shown, the others go behind it
+      const int previousBufferIndex = multi.next_ > 0 ? currentBufferIndex_ : -1;
+      multi.next_++;
+
+      if (file.parsed_)
+      {
+        file.tasks_.wait();
+
+        createDefaultEmpty();
+        currentDoc().delimiter_ = file.delimiter_;
+
+        int row = 0;
+        for (auto & chunk : file.chunks_)
+          row = mergeChunk(chunk, row);
+
+        currentDoc().fileRows_ = row;
+        evaluateLoadedDocument();
+
+        currentDoc().filename_ = file.filename_;
+        currentDoc().stamp_ = file.stamp_;
+        replayJournal();
+      }
+      else if (!load(file.filename_))
+        continue;
+
+      added = true;
+      jumpToBuffer(previousBufferIndex);
+
+      // Only the file that is waited for
+      wait = false;
+    }
+
+    if (multi.next_ == multi.files_.size())
+      multiLoad_.reset();
+
+    return added;
+  }
+
+  bool load(std::vector<std::string> const& filenames)
+  {
+    PROFILE_SCOPE(LOAD);
+
+    if (multiLoad_)
+    {
+      flashMessage("Other documents are still loading!");
+      return false;
+    }
+
+    multiLoad_.reset(new MultiLoad());
+
+    // Every file is asked for before the first is read, so the disk reads them side by
+    // side instead of one after the other as they are split into chunks
+    for (auto const& filename : filenames)
+    {
+      std::unique_ptr<MultiLoad::File> file(new MultiLoad::File());
+      file->filename_ = filename;
+      file->stamp_ = fileStamp(filename);
+      file->opened_ = filename != "-" && file->file_.open(filename);
+      if (file->opened_ && isSmallFile(file->file_.data().size()))
+        file->file_.willNeed(0, file->file_.data().size());
+
+      multiLoad_->files_.push_back(std::move(file));
+    }
+
+    for (auto & file : multiLoad_->files_)
+      file->parsed_ = startParse(*file);
+
+    // The first document shows up as soon as it is in, the others while the user looks at it
+    const std::size_t before = documentBuffers().size();
+    updateMultiLoad(true);
+    return documentBuffers().size() > before || multiLoad_;
+  }
+
+  bool isLoading()
+  {
+    if (backgroundLoad_ || streamLoad_ || multiLoad_)
+      return true;
+
+    for (auto const& buffer : documentBuffers())
+      if (isIndexing(*buffer.doc_))
+        return true;
+
+    return false;
+  }
+
+  // What updateLoading() does, returns true when the buffer changed
+  static bool mergeLoading()
+  {
+    bool indexed = updatePagedDocuments();
+
+    // A file of a background load merges while the ones behind it wait for their turn
+    if (multiLoad_ && !backgroundLoad_ && !streamLoad_)
+      indexed = updateMultiLoad(false) || indexed;
+
+    if (streamLoad_)
+      return updateStreamLoad() || indexed;
+
+    if (!backgroundLoad_)
+      return indexed;
+
+    BackgroundLoad & load = *backgroundLoad_;
+    const int bufferIndex = loadingBufferIndex();
+    assert(bufferIndex >= 0);
+
+    // The merge helpers work on the current document, which the user may have switched away from
+    const int previousBufferIndex = currentBufferIndex_;
+    currentBufferIndex_ = bufferIndex;
+
+    bool merged = false;
+    while (load.merged_ < load.chunks_.size() && load.parsed_[load.merged_])
+    {
+      ParsedChunk & chunk = load.chunks_[load.merged_];
+      load.bytesMerged_ += chunk.data_.size();
+      load.row_ = mergeChunk(chunk, load.row_);
+      load.merged_++;
+      merged = true;
+    }
+
+    const bool done = load.merged_ == load.chunks_.size();
+
+    if (done)
+    {
+      load.tasks_.wait();
+
+      currentDoc().loading_ = false;
+      currentDoc().readOnly_ = false;
+      currentDoc().fileRows_ = load.row_;
+      evaluateLoadedDocument();
+
+      flashMessage("Loaded " + currentDoc().filename_);
+      backgroundLoad_.reset();
+
+      replayJournal();
+    }
+    else
+    {
+      const int progress = (int)(load.bytesMerged_ * 100 / std::max<std::size_t>(load.file_.data().size(), 1));
+      if (progress != load.progress_)
+      {
+        load.progress_ = progress;
+        flashMessage("Loading " + currentDoc().filename_ + " " + std::to_string(progress) + "%");
+      }
+    }
+
+    currentBufferIndex_ = previousBufferIndex;
+    return merged || done || indexed;
+  }
+
+  bool updateLoading()
+  {
+    const bool changed = mergeLoading();
+    if (changed)
+      displayChanged();
+
+    return changed;
+  }
+
+  void cancelLoad()
+  {
+    if (multiLoad_)
+    {
+      for (auto & file : multiLoad_->files_)
+      {
+        file->tasks_.cancel();
+        file->tasks_.wait();
+      }
+
+      multiLoad_.reset();
+    }
+
+    if (!backgroundLoad_ && !streamLoad_)
+      return;
+
+    if (backgroundLoad_)
+    {
+      backgroundLoad_->tasks_.cancel();
+      backgroundLoad_->tasks_.wait();
+    }
+
+    if (streamLoad_)
+    {
+      streamLoad_->quit_ = true;
+      streamLoad_->thread_.shutdown();
+    }
+
+    const int bufferIndex = loadingBufferIndex();
+    const std::string filename = streamLoad_ && streamLoad_->filename_.empty() ? std::string("standard input") : documentBuffers()[bufferIndex].doc_->filename_;
+
+    documentBuffers().erase(bufferIndex);
+    backgroundLoad_.reset();
+    streamLoad_.reset();
+
+    if (documentBuffers().empty())
+      createDefaultEmpty();
+    else if (currentBufferIndex_ >= bufferIndex)
+      currentBufferIndex_ = std::max(0, currentBufferIndex_ - 1);
+
+    logInfo("Canceled loading document ", filename);
+    flashMessage("Canceled loading " + filename);
+  }
+
+  // Parses the ini styled body of a ZUM1 document, everything after the header line
+  static bool loadZum1(StrView data)
+  {
+    createDefaultEmpty();
+    currentDoc().width_ = 0;
+    currentDoc().height_ = 0;
+
+    enum class Section { None, Columns, Data, Format };
+
+    Section section = Section::None;
+    bool hasData = false;
+
+    std::size_t pos = 0;
+    while (pos < data.size())
+    {
+      std::size_t end = data.find('\n', pos);
+      if (end == StrView::npos)
+        end = data.size();
+
+      const StrView line = data.substr(pos, end - pos).stripWhitespace();
+      pos = end + 1;
+
+      if (line.empty() || line[0] == ';' || line[0] == '#')
+        continue;
+
+      if (line[0] == '[')
+      {
+        const StrView name = line.substr(1, line.find(']') - 1);
+
+        if (name == StrView("columns", 7))
+          section = Section::Columns;
+        else if (name == StrView("data", 4))
+          section = Section::Data;
+        else if (name == StrView("format", 6))
+          section = Section::Format;
+        else
+          section = Section::None;
+
+        hasData = hasData || section == Section::Data;
+        continue;
+      }
+
+      const std::size_t separator = line.find('=');
+      if (separator == StrView::npos)
+        continue;
+
+      const std::string name = line.substr(0, separator).stripWhitespace().str();
+      const StrView value = line.substr(separator + 1).stripWhitespace();
+
+      switch (section)
+      {
+        case Section::Columns:
+          currentDoc().columns_.set(Index::strToColumn(name), std::atoi(value.str().c_str()));
+          break;
+
+        case Section::Data:
+          setText(Index::fromStr(name), value.str());
+          break;
+
+        case Section::Format:
+          getCell(Index::fromStr(name)).format = parseFormat(value.str());
+          break;
+
+        case Section::None:
+          break;
+      }
+    }
+
+    if (!hasData)
+    {
+      logError("Could not locate the data section in the document");
+      return false;
+    }
+
+    evaluateLoadedDocument();
+    return true;
+  }
+
+  // Hands out the consecutive, 8 byte aligned arrays of a ZUM2 column block
+  struct BlockReader
+  {
+    BlockReader(StrView data) : data_(data) { }
+
+    template <typename T>
+    const T * take(std::size_t count)
+    {
+      const std::size_t size = zum2::align(count * sizeof(T));
+      if (pos_ + size > data_.size())
+        return nullptr;
+
+      const T * result = reinterpret_cast<const T *>(data_.data() + pos_);
+      pos_ += size;
+      return result;
+    }
+
+    StrView data_;
+    std::size_t pos_ = 0;
+  };
+
+  static bool loadZum2Column(zum2::ColumnEntry const& entry, StrView data, uint64_t & checksum)
+  {
+    BlockReader reader(data);
+
+    const zum2::BlockHeader * block = reader.take<zum2::BlockHeader>(1);
+    if (!block || block->cellCount_ != entry.cellCount_)
+      return false;
+
+    const std::size_t count = block->cellCount_;
+
+    const uint32_t * rows = reader.take<uint32_t>(count);
+    const uint32_t * formats = reader.take<uint32_t>(count);
+    const uint8_t * kinds = reader.take<uint8_t>(count);
+    const double * values = reader.take<double>(count);
+    const uint32_t * textOffsets = reader.take<uint32_t>(count + 1);
+    const uint32_t * exprOffsets = reader.take<uint32_t>(count + 1);
+    const zum2::ExprRecord * expressions = reader.take<zum2::ExprRecord>(block->exprCount_);
+    const char * strings = reader.take<char>(block->stringsSize_);
+
+    if (!rows || !formats || !kinds || !values || !textOffsets || !exprOffsets || !expressions || !strings)
+      return false;
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      if (textOffsets[i] > textOffsets[i + 1] || textOffsets[i + 1] > block->stringsSize_ ||
+          exprOffsets[i] > exprOffsets[i + 1] || exprOffsets[i + 1] > block->exprCount_)
+        return false;
+
+      const Index idx(entry.column_, rows[i]);
+      Cell & cell = getCell(idx);
+
+      cell.text = currentDoc().strings_.intern(std::string(strings + textOffsets[i], textOffsets[i + 1] - textOffsets[i]));
+      cell.format = formats[i];
+      cell.value = values[i];
+
+      if (kinds[i] == zum2::Number)
+        cell.type = CellType::Number;
+
+      if (kinds[i] != zum2::Formula && kinds[i] != zum2::EvaluatedFormula)
+        continue;
+
+      checksum += formulaChecksum(idx, expressions + exprOffsets[i], exprOffsets[i + 1] - exprOffsets[i]);
+
+      std::vector<Expr> expression;
+      expression.reserve(exprOffsets[i + 1] - exprOffsets[i]);
+
+      for (uint32_t e = exprOffsets[i]; e < exprOffsets[i + 1]; ++e)
+      {
+        zum2::ExprRecord const& record = expressions[e];
+        const Index start(record.startX_, record.startY_);
+        const Index end(record.endX_, record.endY_);
+
+        switch (record.type_)
+        {
+          case Expr::Constant:
+            expression.push_back(Expr(record.constant_));
+            break;
+
+          case Expr::Cell:
+          case Expr::Range:
+            {
+              if (record.nameOffset_ + record.nameLength_ > block->stringsSize_)
+                return false;
+
+              expression.push_back(record.type_ == Expr::Cell ? Expr(start) : Expr(start, end));
+              if (record.nameLength_ > 0)
+                expression.back().sheet_ = sheetId(std::string(strings + record.nameOffset_, record.nameLength_));
+            }
+            break;
+
+          case Expr::Function:
+            {
+              if (record.nameOffset_ + record.nameLength_ > block->stringsSize_)
+                return false;
+
+              const FuncDef * func = findFunction(std::string(strings + record.nameOffset_, record.nameLength_));
+              if (!func)
+                return false;
+
+              expression.push_back(Expr(func));
+            }
+            break;
+
+          default:
+            return false;
+        }
+      }
+
+      cell.setFormula(std::move(expression));
+      shareFormula(currentDoc(), idx, cell);
+      setPrecedents(currentDoc(), idx, cell);
+
+      // The saved value is kept unless the checksum of the file turns out not to match
+      cell.evaluated = kinds[i] == zum2::EvaluatedFormula;
+    }
+
+    return true;
+  }
+
+  // A column block of a ZUM2 file, data_ points into the file or at the decompressed
+  // raw_ once compressed_ was decompressed
+  struct Zum2Block
+  {
+    StrView data_;
+    StrView compressed_;
+    std::unique_ptr<char[]> raw_;
+    std::size_t rawSize_ = 0;
+    bool ok_ = true;
+  };
+
+  // Takes the block out of its envelope, see BinaryFormat.h
+  static bool readZum2Block(uint32_t version, StrView stored, Zum2Block & block)
+  {
+    if (version < 2)
+    {
+      block.data_ = stored;
+      return true;
+    }
+
+    zum2::BlockEnvelope envelope;
+    if (stored.size() < sizeof(envelope))
+      return false;
+
+    memcpy(&envelope, stored.data(), sizeof(envelope));
+    if (envelope.storedSize_ > stored.size() - sizeof(envelope))
+      return false;
+
+    const StrView payload = stored.substr(sizeof(envelope), envelope.storedSize_);
+
+    switch (envelope.codec_)
+    {
+      case zum2::None:
+        block.data_ = payload;
+        return envelope.rawSize_ == payload.size();
+
+      // LZ4 doesn't grow data by more than 255 times, anything beyond is corrupt
+      case zum2::Lz4:
+        if (envelope.rawSize_ / 255 > payload.size())
+          return false;
+
+        block.compressed_ = payload;
+        block.rawSize_ = envelope.rawSize_;
+        return true;
+
+      default:
+        logError("Unknown ZUM2 block codec ", envelope.codec_);
+        return false;
+    }
+  }
+
+  // Reads a document in the binary ZUM2 format, see BinaryFormat.h. Read from filename, the
+  // document keeps where the blocks are for saving to it again.
+  static bool loadZum2(StrView data, std::string const& filename = std::string())
+  {
+    zum2::FileHeader header;
+    memset(&header, 0, sizeof(header));
+
+    if (data.size() < zum2::HEADER_V2_SIZE)
+      return false;
+
+    memcpy(&header, data.data(), zum2::HEADER_V2_SIZE);
+
+    if (header.version_ < 1 || header.version_ > zum2::VERSION || header.byteOrder_ != zum2::ENDIAN_MARK)
+    {
+      logError("Unsupported ZUM2 version or byte order");
+      return false;
+    }
+
+    if (header.version_ >= 3)
+    {
+      const std::size_t headerSize = header.version_ >= 4 ? sizeof(header) : zum2::HEADER_V3_SIZE;
+      if (data.size() < headerSize)
+        return false;
+
+      memcpy(&header, data.data(), headerSize);
+    }
+
+    if (header.widthsOffset_ + header.widthCount_ * sizeof(zum2::ColumnWidth) > data.size() ||
+        header.columnsOffset_ + header.columnCount_ * sizeof(zum2::ColumnEntry) > data.size() ||
+        header.indexesOffset_ + header.indexCount_ * sizeof(zum2::IndexEntry) > data.size())
+      return false;
+
+    createDefaultEmpty();
+    currentDoc().width_ = header.width_;
+    currentDoc().height_ = header.height_;
+    currentDoc().binary_ = true;
+
+    const zum2::ColumnWidth * widths = reinterpret_cast<const zum2::ColumnWidth *>(data.data() + header.widthsOffset_);
+    for (uint32_t i = 0; i < header.widthCount_; ++i)
+      currentDoc().columns_.set(widths[i].column_, widths[i].width_);
+
+    const zum2::ColumnEntry * entries = reinterpret_cast<const zum2::ColumnEntry *>(data.data() + header.columnsOffset_);
+    std::vector<Zum2Block> blocks(header.columnCount_);
+
+    for (uint32_t i = 0; i < header.columnCount_; ++i)
+    {
+      zum2::ColumnEntry const& entry = entries[i];
+
+      if (entry.blockOffset_ + entry.blockSize_ > data.size() ||
+          !readZum2Block(header.version_, data.substr(entry.blockOffset_, entry.blockSize_), blocks[i]))
+      {
+        logError("Corrupt column block for column ", Index::columnToStr(entry.column_));
+        return false;
+      }
+    }
+
+    // The blocks are decompressed on the scheduler, since they are only put into the
+    // document one after the other
+    std::vector<Scheduler::Task> tasks;
+    for (auto & block : blocks)
+    {
+      if (block.compressed_.size() == 0)
+        continue;
+
+      Zum2Block * target = &block;
+      tasks.push_back([target] () {
+        target->raw_.reset(new char[target->rawSize_]);
+        std::string scratch;
+        target->ok_ = lz4::decompress(target->compressed_, target->raw_.get(), target->rawSize_) &&
+                      filterBlock(target->raw_.get(), target->rawSize_, false, scratch);
+        target->data_ = StrView(target->raw_.get(), target->rawSize_);
+      });
+    }
+
+    Scheduler::shared().run(tasks);
+
+    // Only files whose blocks each hold rows of one block of rows can be saved to again
+    std::shared_ptr<SavedLayout> layout;
+    if (!filename.empty())
+      layout = std::make_shared<SavedLayout>();
+
+    uint64_t checksum = 0;
+    for (uint32_t i = 0; i < header.columnCount_; ++i)
+    {
+      zum2::ColumnEntry const& entry = entries[i];
+      const uint64_t blockChecksum = checksum;
+
+      if (!blocks[i].ok_ || !loadZum2Column(entry, blocks[i].data_, checksum))
+      {
+        logError("Corrupt column block for column ", Index::columnToStr(entry.column_));
+        return false;
+      }
+
+      if (layout && entry.cellCount_ > 0)
+      {
+        const uint32_t * rows = reinterpret_cast<const uint32_t *>(blocks[i].data_.data() + zum2::align(sizeof(zum2::BlockHeader)));
+        const uint64_t key = blockKey(entry.column_, rows[0] / zum2::BLOCK_ROWS);
+
+        if (rows[entry.cellCount_ - 1] / zum2::BLOCK_ROWS != rows[0] / zum2::BLOCK_ROWS || layout->blocks_.count(key))
+          layout.reset();
+        else
+        {
+          SavedBlock & saved = layout->blocks_[key];
+          saved.entry_ = entry;
+          saved.hash_ = blockHash(blocks[i].data_.data(), blocks[i].data_.size());
+          saved.formulaChecksum_ = checksum - blockChecksum;
+          saved.formulas_ = reinterpret_cast<const zum2::BlockHeader *>(blocks[i].data_.data())->exprCount_ > 0;
+        }
+      }
+
+      // Each block is only needed until its cells are in the document
+      blocks[i].raw_.reset();
+    }
+
+    // The indexes take their keys from the cells, an index that doesn't match them is built again when used
+    const zum2::IndexEntry * indexes = reinterpret_cast<const zum2::IndexEntry *>(data.data() + header.indexesOffset_);
+    for (uint32_t i = 0; i < header.indexCount_; ++i)
+    {
+      zum2::IndexEntry const& entry = indexes[i];
+      const uint64_t count = (uint64_t)entry.numberCount_ + entry.textCount_ + entry.formulaCount_;
+
+      if (entry.column_ >= (uint32_t)currentDoc().width_ || findColumnIndex(currentDoc(), entry.column_))
+        continue;
+
+      currentDoc().indexes_.emplace_back(entry.column_);
+      ColumnIndex & index = currentDoc().indexes_.back();
+
+      if (entry.stale_ || entry.rowsOffset_ + count * sizeof(uint32_t) > data.size())
+        continue;
+
+      if (layout)
+      {
+        layout->indexes_.emplace_back();
+        layout->indexes_.back().entry_ = entry;
+        layout->indexes_.back().hash_ = indexHash(0, entry.numberCount_, entry.textCount_, reinterpret_cast<const uint32_t *>(data.data() + entry.rowsOffset_), count);
+      }
+
+      if (!index.restore(currentDoc().cells_, currentDoc().strings_, reinterpret_cast<const uint32_t *>(data.data() + entry.rowsOffset_),
+                         entry.numberCount_, entry.textCount_, entry.formulaCount_))
+        logWarning("The index of column ", Index::columnToStr(entry.column_), " doesn't match its cells, it is built again");
+    }
+
+    const bool keepValues = header.version_ >= 4 && checksum == header.formulaChecksum_;
+    if (header.version_ >= 4 && !keepValues)
+      logWarning("The formulas don't match the checksum of the file, they are evaluated again");
+
+    evaluateLoadedDocument(keepValues);
+
+    // What changes from here on goes into the next save
+    if (layout)
+    {
+      layout->filename_ = filename;
+      layout->stamp_ = fileStamp(filename);
+      layout->fileSize_ = zum2::align(data.size());
+      layout->liveBytes_ = liveBytes(*layout, zum2::align(sizeof(header)) + zum2::align(header.widthCount_ * sizeof(zum2::ColumnWidth)) +
+                                              zum2::align(header.columnCount_ * sizeof(zum2::ColumnEntry)) +
+                                              zum2::align(header.indexCount_ * sizeof(zum2::IndexEntry)));
+
+      currentDoc().cells_.startEpoch();
+      layout->epoch_ = currentDoc().cells_.epoch();
+      currentDoc().savedLayout_ = layout;
+    }
+
+    return true;
+  }
+
+  // Switches to a buffer that already shows filename as it is on disk. Opening a file
+  // again then shares its document instead of loading a second copy.
+  static bool switchToOpenDocument(std::string const& filename, FileStamp const& stamp)
+  {
+    if (!stamp.valid())
+      return false;
+
+    for (std::size_t i = 0; i < documentBuffers().size(); ++i)
+    {
+      Buffer const& buffer = documentBuffers()[i];
+      Document const& doc = *buffer.doc_;
+
+      if (buffer.view_ || doc.loading_ || doc.modified_ || doc.filename_ != filename || !(doc.stamp_ == stamp))
+        continue;
+
+      logInfo("Document ", filename, " is already open");
+      jumpToBuffer(i);
+      return true;
+    }
+
+    return false;
+  }
+
+  static const char ZSTD_MAGIC[] = { '\x28', '\xb5', '\x2f', '\xfd' };
+
+  static bool loadFile(std::string const& filename)
+  {
+    MappedFile file;
+    if (!file.open(filename))
+    {
+      logError("Could not open document '", filename, "'");
+      flashMessage("Could not open document!");
+      return false;
+    }
+
+    const StrView data = file.data();
+
+    if (data.size() == 0)
+    {
+      logError("No data in file '", filename, "'");
+      return false;
+    }
+
+    // Determin if we are reading a zum file, of a csv type of file.
+    if (data.size() > 4 && memcmp(data.data(), zum2::MAGIC, sizeof(zum2::MAGIC)) == 0)
+    {
+      if (!loadZum2(data, filename))
+      {
+        logError("Could not parse document '", filename, "'");
+        return false;
+      }
+    }
+    else if (data.size() > 5 && data[0] == 'Z' && data[1] == 'U' && data[2] == 'M' && data[3] == '1' && data[4] == '\n')
+    {
+      if (!loadZum1(data.substr(5)))
+      {
+        logError("Could not parse document '", filename, "'");
+        return false;
+      }
+    }
+    else if (PagedTable::isColumnar(data))
+      return openColumnar(filename);
+    else if (gzip::isGzip(data))
+    {
+      // Decompressed on a thread when the CSV file would be loaded on one
+      const int backgroundSize = BACKGROUND_LOAD_SIZE.toInt();
+      if (backgroundSize > 0 && inflatedSize(data) >= (std::size_t)backgroundSize)
+        return startCompressedLoad(filename);
+
+      return loadCompressed(data, filename);
+    }
+    else if (data.size() >= sizeof(ZSTD_MAGIC) && memcmp(data.data(), ZSTD_MAGIC, sizeof(ZSTD_MAGIC)) == 0)
+    {
+      logError("Could not open document '", filename, "': Zstandard compressed files aren't supported, decompress it first");
+      flashMessage("Could not open document!");
+      return false;
+    }
+    else
+    {
+      const int pagedSize = PAGED_LOAD_SIZE.toInt();
+      if (pagedSize > 0 && data.size() >= (std::size_t)pagedSize)
+        return openPaged(filename, detectDelimiter(data));
+
+      const int backgroundSize = BACKGROUND_LOAD_SIZE.toInt();
+      if (backgroundSize > 0 && data.size() >= (std::size_t)backgroundSize)
+        return startBackgroundLoad(filename);
+
+      if (!loadCSV(data, 0))
+      {
+        logError("Could not parse document '", filename, "'");
+        return false;
+      }
+    }
+
+    currentDoc().filename_ = filename;
+    currentDoc().readOnly_ = false;
+
+    replayJournal();
+    return true;
+  }
+
+  // Picks count of the records after the first line of CSV data in one pass, each as
+  // likely as any other: the first count records are kept and every later one replaces a
+  // random one of them with the chance that it is picked. A line break in quotes doesn't
+  // end a record. Appends the first line and the picked records to sample, in the order
+  // of the file, and returns the number of records after the first line.
+  static std::size_t sampleRecords(StrView data, std::size_t count, std::string & sample)
+  {
+    // Quotes are counted a block at a time, the lines of a block without any are records
+    static const std::size_t QUOTE_BLOCK = 1 << 16;
+
+    std::mt19937_64 random(std::random_device{}());
+
+    std::vector<std::pair<std::size_t, std::size_t>> picked;
+    std::size_t records = 0;
+    bool header = true;
+
+    auto append = [&data, &sample] (std::size_t start, std::size_t end) {
+      sample.append(data.data() + start, end - start);
+      if (sample.empty() || sample.back() != '\n')
+        sample.push_back('\n');
+    };
+
+    std::size_t start = 0;
+    std::size_t pos = 0;
+    std::size_t quotes = 0;
+    std::size_t checkedEnd = 0;
+    std::size_t unquotedEnd = 0;
+
+    while (start < data.size())
+    {
+      const std::size_t newline = data.find('\n', pos);
+      const std::size_t end = newline == StrView::npos ? data.size() : newline + 1;
+
+      if (end > checkedEnd)
+      {
+        checkedEnd = pos + QUOTE_BLOCK;
+        if (csv::count(data.substr(pos, QUOTE_BLOCK), csv::QUOTE) == 0)
+          unquotedEnd = checkedEnd;
+      }
+
+      if (end > unquotedEnd)
+        quotes += csv::count(data.substr(pos, end - pos), csv::QUOTE);
+
+      pos = end;
+
+      if (quotes % 2 != 0 && end < data.size())
+        continue;
+
+      if (header)
+        append(start, end);
+      else if (records < count)
+        picked.emplace_back(start, end);
+      else
+      {
+        const uint64_t slot = random() % (records + 1);
+        if (slot < count)
+          picked[slot] = std::make_pair(start, end);
+      }
+
+      records += header ? 0 : 1;
+      header = false;
+      quotes = 0;
+      start = end;
+    }
+
+    std::sort(picked.begin(), picked.end());
+    for (auto const& record : picked)
+      append(record.first, record.second);
+
+    return records;
+  }
+
+  bool isPlainCsv(StrView data)
+  {
+    return !(data.size() == 0 || PagedTable::isColumnar(data) || gzip::isGzip(data) ||
+             (data.size() >= sizeof(zum2::MAGIC) && memcmp(data.data(), zum2::MAGIC, sizeof(zum2::MAGIC)) == 0) ||
+             (data.size() >= 5 && memcmp(data.data(), "ZUM1\n", 5) == 0) ||
+             (data.size() >= sizeof(ZSTD_MAGIC) && memcmp(data.data(), ZSTD_MAGIC, sizeof(ZSTD_MAGIC)) == 0));
+  }
+
+  // Opens a document of count records of the CSV file filename, picked at random, and its
+  // first line. Like a new document it has no name, edits stay away from the file.
+  static bool loadSample(std::string const& filename, std::size_t count)
+  {
+    MappedFile file;
+    if (!file.open(filename))
+    {
+      logError("Could not open document '", filename, "'");
+      flashMessage("Could not open document!");
+      return false;
+    }
+
+    const StrView data = file.data();
+    if (!isPlainCsv(data))
+    {
+      logError("Only CSV files can be loaded as a sample, load '", filename, "' and sample the buffer instead");
+      return false;
+    }
+
+    std::string sample;
+    const std::size_t records = sampleRecords(data, count, sample);
+
+    if (!loadCSV(StrView(sample), detectDelimiter(data)))
+      return false;
+
+    currentBuffer().sampleRate_ = records > count ? (count + 1.0) / (records + 1.0) : 1.0;
+    flashMessage("Sampled " + str::fromInt(std::min(count, records)) + " of the " + str::fromInt(records) + " rows of " + filename);
+    return true;
+  }
+
+  bool load(std::string const& filename)
+  {
+    PROFILE_SCOPE(LOAD);
+
+    if (filename == "-")
+      return startStreamLoad();
+
+    const FileStamp stamp = fileStamp(filename);
+    if (switchToOpenDocument(filename, stamp))
+      return true;
+
+    if (!loadFile(filename))
+      return false;
+
+    currentDoc().stamp_ = stamp;
+    return true;
+  }
+
+  static void recalculateFrom(std::vector<Index> const& edited, std::function<void ()> const& first = nullptr);
+
+  static bool startFollowing(Buffer & buffer)
+  {
+    Document & doc = *buffer.doc_;
+
+    if (buffer.view_ || doc.paged_ || doc.loading_ || doc.filename_.empty())
+    {
+      flashMessage("Only loaded CSV documents can be followed");
+      return false;
+    }
+
+    MappedFile file;
+    if (!file.open(doc.filename_))
+    {
+      flashMessage("Could not open " + doc.filename_);
+      return false;
+    }
+
+    const StrView data = file.data();
+    if ((data.size() >= 4 && memcmp(data.data(), zum2::MAGIC, sizeof(zum2::MAGIC)) == 0) ||
+        (data.size() >= 5 && memcmp(data.data(), "ZUM1\n", 5) == 0))
+    {
+      flashMessage("Only loaded CSV documents can be followed");
+      return false;
+    }
+
+    if (!doc.stamp_.valid() || data.size() < (std::size_t)doc.stamp_.size_)
+    {
+      flashMessage(doc.filename_ + " changed since it was loaded, load it again to follow it");
+      return false;
+    }
+
+    // A last line without a line break is read again once it has one
+    doc.followOffset_ = wholeLines(data.substr(0, doc.stamp_.size_));
+    doc.following_ = true;
+
+    flashMessage("Following " + doc.filename_);
+    return true;
+  }
+
+  // Appends the whole lines added to the file of the current document since the last
+  // time, and recalculates the formulas that depend on them. Returns true if it grew.
+  static bool followFile(Document & doc)
+  {
+    const FileStamp stamp = fileStamp(doc.filename_);
+    if (!stamp.valid() || stamp == doc.stamp_)
+      return false;
+
+    if (stamp.size_ < doc.followOffset_)
+    {
+      doc.following_ = false;
+      flashMessage(doc.filename_ + " was truncated, stopped following it");
+      return false;
+    }
+
+    MappedFile file;
+    if (!file.open(doc.filename_))
+      return false;
+
+    const StrView appended = file.data().substr(doc.followOffset_);
+    const std::size_t size = wholeLines(appended);
+
+    doc.stamp_ = stamp;
+    if (size == 0)
+      return false;
+
+    // Buffers with the cursor on the last row keep it there, like tail -f
+    const int lastRow = doc.height_ - 1;
+    std::vector<Buffer *> pinned;
+    for (auto & buffer : documentBuffers())
+      if (buffer.doc_.get() == &doc && !buffer.view_ && buffer.cursorPos_.y >= lastRow)
+        pinned.push_back(&buffer);
+
+    std::vector<Index> merged;
+    doc.fileRows_ = mergeLines(appended.substr(0, size), doc.fileRows_, &merged);
+    doc.followOffset_ += size;
+
+    recalculateFrom(merged);
+
+    for (Buffer * buffer : pinned)
+      buffer->cursorPos_.y = std::max(doc.height_ - 1, 0);
+
+    return true;
+  }
+
+  bool follow(bool enable)
+  {
+    Document & doc = currentDoc();
+    if (!enable)
+    {
+      doc.following_ = false;
+      return true;
+    }
+
+    return doc.following_ || startFollowing(currentBuffer());
+  }
+
+  bool isFollowing()
+  {
+    for (auto const& buffer : documentBuffers())
+      if (buffer.doc_->following_)
+        return true;
+
+    return false;
+  }
+
+  static std::chrono::steady_clock::time_point lastFollowPoll_;
+
+  bool updateFollowing()
+  {
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now - lastFollowPoll_ < std::chrono::milliseconds(FOLLOW_INTERVAL.toInt()))
+      return false;
+
+    lastFollowPoll_ = now;
+
+    // The merge helpers work on the current document
+    const int previousBufferIndex = currentBufferIndex_;
+    bool changed = false;
+
+    for (std::size_t i = 0; i < documentBuffers().size(); ++i)
+    {
+      Document & doc = *documentBuffers()[i].doc_;
+      if (!doc.following_ || documentBuffers()[i].view_)
+        continue;
+
+      currentBufferIndex_ = i;
+      changed = followFile(doc) || changed;
+    }
+
+    currentBufferIndex_ = previousBufferIndex;
+    if (changed)
+      displayChanged();
+
+    return changed;
+  }
+
+  bool loadRaw(std::string const& data, std::string const& filename, char delimiter)
+  {
+    if (!loadCSV(data, delimiter))
+      return false;
+
+    currentDoc().filename_ = filename;
+    currentDoc().readOnly_ = true;
+
+    return true;
+  }
+
+  int getColumnWidth(int column)
+  {
+    return currentDoc().columns_.width(column, DEFAULT_COLUMN_WIDTH.toInt());
+  }
+
+  int getColumnOffset(int column)
+  {
+    return currentDoc().columns_.offset(column, DEFAULT_COLUMN_WIDTH.toInt());
+  }
+
+  static void changeColumnWidth(int column, int width)
+  {
+    UndoRecord & record = addUndoRecord(EditAction::ColumnWidth, true);
+    record.position_ = column;
+    record.widthBefore_ = storedColumnWidth(column);
+    record.widthAfter_ = width;
+
+    currentDoc().columns_.set(column, width);
+    journalEdit(record);
+  }
+
+  void setColumnWidth(int column, int width)
+  {
+    if (!beginEdit())
+      return;
+
+    changeColumnWidth(column, std::max(3, width));
+  }
+
+  int getRowCount()
+  {
+    if (currentBuffer().view_)
+      return currentBuffer().rows_.size();
+
+    return currentDoc().height_;
+  }
+
+  int getColumnCount()
+  {
+    return currentDoc().width_;
+  }
+
+  static std::atomic<uint64_t> formulaResets_(0);
+
+  uint64_t formulaResets()
+  {
+    return formulaResets_;
+  }
+
+  // Numbers and text keep the value parsed in parseCellText(), only formulas need evaluating
+  static void resetCell(Cell & cell)
+  {
+    if (cell.hasExpression())
+    {
+      formulaResets_++;
+
+      // A formula that doesn't compile holds its error right away
+      Program const& program = cell.formula->pattern->program;
+      cell.value = program.empty() ? evaluate(program, cell.formula->origin) : 0.0;
+      cell.evaluated = program.empty();
+    }
+    else
+    {
+      cell.evaluated = true;
+    }
+  }
+
+  // Like resetCell(), but a formula keeps the value it had for drawing until it is evaluated
+  static void markStale(Cell & cell)
+  {
+    if (cell.hasExpression() && !cell.formula->pattern->program.empty())
+    {
+      formulaResets_++;
+      cell.evaluated = false;
+    }
+    else
+      resetCell(cell);
+  }
+
+  static void clearRecalcQueue(Document & doc)
+  {
+    doc.recalcQueue_ = std::vector<Index>();
+    doc.recalcPosition_ = 0;
+    doc.recalcStale_.clear();
+  }
+
+  // Evaluates cell on its own, everything it references has to be evaluated already
+  static void evaluateFormula(Cell & cell)
+  {
+    cell.evaluated = true;
+
+    if (cell.hasExpression())
+    {
+      cell.value = evaluate(cell.formula->pattern->program, cell.formula->origin);
+    }
+  }
+
+  // Formulas that called a Tcl function with arguments it had no result for, while the
+  // calls were deferred. They are evaluated again once the calls ran.
+  static std::vector<Index> missedCalls_;
+  static std::mutex missedCallMutex_;
+
+  // Whether the evaluations of formulas are timed, see recalcProfile
+  static std::atomic<bool> recalcProfiling_(false);
+  static std::mutex formulaCostMutex_;
+
+  static void addFormulaCost(Index const& idx, Cell const& cell, int64_t ticks)
+  {
+    std::lock_guard<std::mutex> lock(formulaCostMutex_);
+
+    Document & doc = currentDoc();
+    FormulaCost & cost = doc.formulaCosts_[idx.key()];
+    cost.ticks_ += ticks;
+    cost.calls_++;
+    cost.pattern_ = cell.formula->pattern;
+
+    doc.formulaCostMax_ = std::max(doc.formulaCostMax_, cost.ticks_);
+  }
+
+  // Evaluates the formula at idx, remembering it if it missed the result of a call
+  static void evaluateFormula(Index const& idx, Cell & cell)
+  {
+    const bool timed = recalcProfiling_ && cell.hasExpression();
+    const int64_t start = timed ? bx::getHPCounter() : 0;
+
+    evaluateFormula(cell);
+
+    if (timed)
+      addFormulaCost(idx, cell, bx::getHPCounter() - start);
+
+    if (takeMissedCall())
+    {
+      std::lock_guard<std::mutex> lock(missedCallMutex_);
+      missedCalls_.push_back(idx);
+    }
+  }
+
+  // Calls func(idx, cell) for every formula that the formula in cell references and that
+  // still has to be evaluated
+  template <typename Func>
+  static void forEachPendingPrecedent(Document & doc, Cell const& cell, Func const& func)
+  {
+    Formula const& formula = *cell.formula;
+
+    for (auto const& expr : formula.pattern->expression)
+    {
+      // The cells of other documents are evaluated when they are read
+      if (expr.sheet_ != Expr::NO_SHEET)
+        continue;
+
+      const Index start(formula.origin.x + expr.startIndex_.x, formula.origin.y + expr.startIndex_.y);
+
+      if (expr.type_ == Expr::Cell)
+      {
+        if (start.x < 0 || start.x >= doc.width_ || start.y < 0 || start.y >= doc.height_)
+          continue;
+
+        Cell * precedent = doc.cells_.find(start);
+        if (precedent && !precedent->evaluated)
+          func(start, *precedent);
+      }
+      else if (expr.type_ == Expr::Range)
+      {
+        const int lastColumn = std::min(formula.origin.x + expr.endIndex_.x, doc.width_ - 1);
+        const int lastRow = std::min(formula.origin.y + expr.endIndex_.y, doc.height_ - 1);
+
+        for (int x = std::max(start.x, 0); x <= lastColumn; ++x)
+        {
+          doc.cells_.forEachFormula(x, start.y, lastRow, [&func] (Index const& idx, Cell & precedent) {
+            if (!precedent.evaluated)
+              func(idx, precedent);
+          });
+        }
+      }
+    }
+  }
+
+  void evaluateCell(Index const& idx, Cell & cell)
+  {
+    if (cell.evaluated)
+      return;
+
+    Document & doc = currentDoc();
+
+    bool pending = false;
+    if (cell.hasExpression())
+      forEachPendingPrecedent(doc, cell, [&pending] (Index const&, Cell &) { pending = true; });
+
+    if (!pending)
+    {
+      evaluateFormula(idx, cell);
+      return;
+    }
+
+    struct Frame
+    {
+      Index idx_;
+      Cell * cell_;
+      bool expanded_;
+      bool cycle_;
+    };
+
+    std::vector<Frame> stack(1, Frame { idx, &cell, false, false });
+
+    // Stack position of the expanded frames, the chain of formulas being evaluated
+    FlatHashMap<std::size_t> path;
+
+    while (!stack.empty())
+    {
+      const std::size_t top = stack.size() - 1;
+
+      if (stack[top].cell_->evaluated)
+      {
+        stack.pop_back();
+        continue;
+      }
+
+      // Precedents are pushed above the frame and evaluated first
+      if (!stack[top].expanded_)
+      {
+        stack[top].expanded_ = true;
+        path[stack[top].idx_.key()] = top;
+
+        forEachPendingPrecedent(doc, *stack[top].cell_, [&] (Index const& precedent, Cell & precedentCell) {
+          const std::size_t * position = path.find(precedent.key());
+          if (!position)
+          {
+            stack.push_back(Frame { precedent, &precedentCell, false, false });
+            return;
+          }
+
+          // Every formula on the chain from the precedent up to here is part of the cycle
+          for (std::size_t i = *position; i <= top; ++i)
+            if (stack[i].expanded_)
+              stack[i].cycle_ = true;
+        });
+
+        continue;
+      }
+
+      const Frame frame = stack[top];
+      stack.pop_back();
+      path.erase(frame.idx_.key());
+
+      if (frame.cycle_)
+      {
+        frame.cell_->evaluated = true;
+        frame.cell_->value = errorValue(FormulaError::Cycle);
+      }
+      else
+        evaluateFormula(frame.idx_, *frame.cell_);
+    }
+  }
+
+  // Orders the formulas that need evaluating into waves, where every formula only references
+  // formulas in earlier waves. Returns false if the formulas reference each other in a cycle.
+  static bool levelFormulas(Document & doc, std::vector<std::vector<Index>> & waves)
+  {
+    std::vector<Index> formulas;
+    FlatHashMap<int> formulaIds;
+
+    // Row and id of the formulas in each column, sorted since cells are visited row by row
+    std::unordered_map<int, std::vector<std::pair<int, int>>> formulaRows;
+
+    CellStorage const& cells = doc.cells_;
+    cells.forEach([&] (Index const& idx, Cell const& cell) {
+      if (cell.evaluated)
+        return;
+
+      formulaIds[idx.key()] = formulas.size();
+      formulaRows[idx.x].push_back(std::make_pair(idx.y, (int)formulas.size()));
+      formulas.push_back(idx);
+    });
+
+    std::vector<int> pendingPrecedents(formulas.size(), 0);
+    std::vector<std::vector<int>> dependents(formulas.size());
+
+    for (std::size_t i = 0; i < formulas.size(); ++i)
+    {
+      Cell const* cell = doc.cells_.find(formulas[i]);
+
+      auto addPrecedent = [&] (int id) {
+        dependents[id].push_back(i);
+        pendingPrecedents[i]++;
+      };
+
+      for (auto const& expr : cell->expression())
+      {
+        // Reading another document evaluates its cells, which only the main thread may do
+        if (expr.sheet_ != Expr::NO_SHEET)
+          return false;
+
+        if (expr.type_ == Expr::Cell)
+        {
+          const int * id = formulaIds.find(expr.startIndex_.key());
+          if (id)
+            addPrecedent(*id);
+        }
+        else if (expr.type_ == Expr::Range)
+        {
+          for (int x = expr.startIndex_.x; x <= expr.endIndex_.x; ++x)
+          {
+            auto rows = formulaRows.find(x);
+            if (rows == formulaRows.end())
+              continue;
+
+            auto const& list = rows->second;
+            auto it = std::lower_bound(list.begin(), list.end(), std::make_pair(expr.startIndex_.y, -1));
+            for (; it != list.end() && it->first <= expr.endIndex_.y; ++it)
+              addPrecedent(it->second);
+          }
+        }
+      }
+    }
+
+    std::vector<int> wave;
+    for (std::size_t i = 0; i < formulas.size(); ++i)
+      if (pendingPrecedents[i] == 0)
+        wave.push_back(i);
+
+    std::size_t levelled = 0;
+    while (!wave.empty())
+    {
+      std::vector<int> next;
+      waves.emplace_back();
+
+      for (int id : wave)
+      {
+        waves.back().push_back(formulas[id]);
+
+        for (int dependent : dependents[id])
+          if (--pendingPrecedents[dependent] == 0)
+            next.push_back(dependent);
+      }
+
+      levelled += wave.size();
+      wave = std::move(next);
+    }
+
+    return levelled == formulas.size();
+  }
+
+  static bool evaluateInWaves(Document & doc, int threads)
+  {
+    std::vector<std::vector<Index>> waves;
+    if (!levelFormulas(doc, waves))
+      return false;
+
+    // Nothing may write to the tiles while the workers read them, and the workers must
+    // not copy the tiles a snapshot being saved shares
+    doc.cells_.unshare();
+    doc.cells_.updateSums();
+
+    for (auto const& wave : waves)
+    {
+      const std::size_t jobCount = std::max<std::size_t>(1, std::min<std::size_t>(threads, wave.size() / PARALLEL_RECALC_MIN_JOB_SIZE));
+      const std::size_t jobSize = (wave.size() + jobCount - 1) / jobCount;
+
+      // Each formula only writes to its own cell, and everything it reads was evaluated in an earlier wave
+      std::vector<Scheduler::Task> tasks;
+      for (std::size_t first = 0; first < wave.size(); first += jobSize)
+      {
+        const std::size_t last = std::min(wave.size(), first + jobSize);
+
+        tasks.push_back([&doc, &wave, first, last] () {
+          for (std::size_t i = first; i < last; ++i)
+            evaluateFormula(wave[i], *doc.cells_.find(wave[i]));
+        });
+      }
+
+      Scheduler::shared().run(tasks);
+
+      // The formulas of later waves need the results of the calls this one queued
+      while (runDeferredCalls())
+      {
+        std::vector<Index> missed;
+        missed.swap(missedCalls_);
+
+        for (auto const& idx : missed)
+          evaluateFormula(idx, *doc.cells_.find(idx));
+      }
+    }
+
+    return true;
+  }
+
+  // Evaluates formulas with their calls of Tcl functions deferred, so the calls are made
+  // in batches. evaluate() evaluates the formulas, the ones that missed the result of a
+  // call are then evaluated again with the formulas depending on them, once the calls
+  // ran. That repeats while results of calls lead to calls with new arguments.
+  template <typename Func>
+  static void evaluateBatched(Document & doc, Func const& evaluate)
+  {
+    const bool deferred = deferFunctionCalls(true);
+
+    evaluate();
+
+    while (runDeferredCalls())
+    {
+      std::vector<Index> missed;
+      missed.swap(missedCalls_);
+
+      const std::vector<Index> dirty = doc.dependencies_.collectDependents(missed);
+      for (auto const& it : dirty)
+        if (Cell * cell = doc.cells_.find(it))
+          resetCell(*cell);
+
+      for (auto const& it : dirty)
+      {
+        Cell * cell = doc.cells_.find(it);
+        if (cell && !cell->evaluated)
+          evaluateCell(it, *cell);
+      }
+    }
+
+    deferFunctionCalls(deferred);
+  }
+
+  void evaluateDocument(Document & doc, bool keepEvaluated)
+  {
+    PROFILE_SCOPE(EVALUATE);
+
+    doc.pendingFormulas_.clear();
+    doc.pendingPosition_ = 0;
+    clearRecalcQueue(doc);
+
+    // Resetting doesn't depend on the order, a tile file is read front to back
+    std::size_t formulaCount = 0;
+    doc.cells_.forEachInStorageOrder([&formulaCount, keepEvaluated] (Index const&, Cell & cell) {
+      if (keepEvaluated && cell.evaluated)
+        return;
+
+      resetCell(cell);
+      if (!cell.evaluated)
+        formulaCount++;
+    });
+
+    if (formulaCount == 0)
+      return;
+
+    int threads = RECALC_THREADS.toInt();
+    if (threads <= 0)
+      threads = Scheduler::shared().threadCount();
+
+    evaluateBatched(doc, [&doc, threads, formulaCount] () {
+      // Cyclic references fall back to the serial order, which evaluates them the way getCellValue() always did
+      if (threads > 1 && formulaCount >= PARALLEL_RECALC_MIN_FORMULAS && evaluateInWaves(doc, threads))
+        return;
+
+      doc.cells_.forEach([] (Index const& idx, Cell & cell) {
+        if (!cell.evaluated)
+          evaluateCell(idx, cell);
+      });
+    });
+  }
+
+  void evaluateDocument()
+  {
+    evaluateDocument(currentDoc(), false);
+    recalculateSheetReaders(documentSheet(currentDoc()), nullptr);
+  }
+
+  // Rebuilds the dependencies and evaluates every formula, after edits that move cells
+  static void recalculateDocument()
+  {
+    if (transactionDepth_ > 0)
+    {
+      transactionRecalculateAll_ = true;
+      return;
+    }
+
+    rebuildDependencies(currentDoc());
+    evaluateDocument();
+  }
+
+  // Evaluates again what an edit that moved the cells at position along axis changed,
+  // once shiftCells() moved them and their references. Only the formulas that read the
+  // line at position, which now holds other cells than before, and the ones depending on
+  // them get other values. References of other documents to this one didn't move, so all
+  // their formulas reading it are evaluated again.
+  static void recalculateShifted(int Index::* axis, int position)
+  {
+    // The cells a transaction collected before are where they were before the edit
+    if (transactionDepth_ > 0 && (transactionRecalculateAll_ || !transactionEdited_.empty()))
+    {
+      transactionRecalculateAll_ = true;
+      return;
+    }
+
+    Document & doc = currentDoc();
+
+    // Cells still waiting to be evaluated are queued by where they were before
+    if (doc.pendingPosition_ < doc.pendingFormulas_.size() || doc.recalcPosition_ < doc.recalcQueue_.size() || !doc.recalcStale_.empty())
+    {
+      recalculateDocument();
+      return;
+    }
+
+    recalculateFrom(doc.dependencies_.collectReferencing(axis, position));
+    recalculateSheetReaders(documentSheet(doc), nullptr);
+  }
+
+  static void evaluateLoadedDocument(bool keepEvaluated)
+  {
+    Document & doc = currentDoc();
+
+    // Formulas of the other buffers may have been waiting for it
+    if (!LAZY_EVALUATION.toBool())
+    {
+      evaluateDocument(doc, keepEvaluated);
+      recalculateSheetReaders(documentSheet(doc), nullptr);
+      return;
+    }
+
+    doc.pendingFormulas_.clear();
+    doc.pendingPosition_ = 0;
+    clearRecalcQueue(doc);
+
+    doc.cells_.forEach([&doc, keepEvaluated] (Index const& idx, Cell & cell) {
+      if (keepEvaluated && cell.evaluated)
+        return;
+
+      resetCell(cell);
+      if (!cell.evaluated)
+        doc.pendingFormulas_.push_back(idx);
+    });
+
+    recalculateSheetReaders(documentSheet(doc), nullptr);
+  }
+
+  bool hasPendingEvaluation()
+  {
+    Document const& doc = currentDoc();
+    return doc.pendingPosition_ < doc.pendingFormulas_.size() || doc.recalcPosition_ < doc.recalcQueue_.size();
+  }
+
+  bool isRecalculating()
+  {
+    Document const& doc = currentDoc();
+    return doc.recalcPosition_ < doc.recalcQueue_.size();
+  }
+
+  // Evaluates queued cells of a sliced recalculation until they run out or the budget does
+  static void evaluateRecalcSlice(Document & doc)
+  {
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(std::max(1, RECALC_BUDGET.toInt()));
+
+    evaluateBatched(doc, [&doc, deadline] () {
+      for (std::size_t count = 0; doc.recalcPosition_ < doc.recalcQueue_.size(); ++doc.recalcPosition_, ++count)
+      {
+        if (count % RECALC_CLOCK_INTERVAL == RECALC_CLOCK_INTERVAL - 1 && Clock::now() >= deadline)
+          break;
+
+        Index const& idx = doc.recalcQueue_[doc.recalcPosition_];
+        Cell * cell = doc.cells_.find(idx);
+        if (cell && !cell->evaluated)
+          evaluateCell(idx, *cell);
+      }
+    });
+
+    doc.changes_++;
+
+    if (doc.recalcPosition_ == doc.recalcQueue_.size())
+      clearRecalcQueue(doc);
+  }
+
+  // Evaluates the formulas of the rows read ahead that are left to evaluate
+  static void evaluateReadAhead(Document & doc)
+  {
+    std::vector<int> rows;
+    rows.swap(doc.readAheadRows_);
+
+    evaluateBatched(doc, [&doc, &rows] () {
+      for (std::size_t first = 0; first < rows.size(); )
+      {
+        std::size_t last = first;
+        while (last + 1 < rows.size() && rows[last + 1] == rows[last] + 1)
+          last++;
+
+        for (int x = 0; x < doc.width_; ++x)
+          doc.cells_.forEachFormula(x, rows[first], rows[last], [] (Index const& idx, Cell & cell) {
+            if (!cell.evaluated)
+              evaluateCell(idx, cell);
+          });
+
+        first = last + 1;
+      }
+    });
+
+    doc.changes_++;
+  }
+
+  void readAhead(int first, int last)
+  {
+    Document & doc = currentDoc();
+    if (!doc.paged_ && !hasPendingEvaluation())
+      return;
+
+    std::vector<int> rows;
+    for (int row = std::max(first, 0); row <= last; ++row)
+    {
+      const int documentRowIndex = documentRow(row);
+      if (documentRowIndex >= 0 && documentRowIndex < doc.height_)
+        rows.push_back(documentRowIndex);
+    }
+
+    std::sort(rows.begin(), rows.end());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+
+    if (!doc.paged_)
+    {
+      doc.readAheadRows_ = std::move(rows);
+      return;
+    }
+
+    // The rows of a view are split page by page
+    for (std::size_t i = 0; i < rows.size(); )
+    {
+      const int page = rows[i] / PagedTable::PAGE_ROWS;
+      std::size_t last = i;
+      while (last + 1 < rows.size() && rows[last + 1] / PagedTable::PAGE_ROWS == page)
+        last++;
+
+      doc.paged_->readAhead(rows[i], rows[last]);
+      i = last + 1;
+    }
+  }
+
+  bool evaluateIdle()
+  {
+    Document & doc = currentDoc();
+    displayChanged();
+
+    // The rows about to be scrolled to go before what is off screen either way
+    if (!doc.readAheadRows_.empty())
+    {
+      evaluateReadAhead(doc);
+      return false;
+    }
+
+    // What an edit left stale is on screen, it goes before what a lazy load left over
+    if (doc.recalcPosition_ < doc.recalcQueue_.size())
+    {
+      evaluateRecalcSlice(doc);
+      return true;
+    }
+
+    const std::size_t last = std::min(doc.pendingFormulas_.size(), doc.pendingPosition_ + IDLE_EVALUATION_BATCH);
+
+    // Edits may have evaluated, changed or removed some of the cells since the load
+    evaluateBatched(doc, [&doc, last] () {
+      for (; doc.pendingPosition_ < last; ++doc.pendingPosition_)
+      {
+        Index const& idx = doc.pendingFormulas_[doc.pendingPosition_];
+        Cell * cell = doc.cells_.find(idx);
+        if (cell && !cell->evaluated)
+          evaluateCell(idx, *cell);
+      }
+    });
+
+    doc.changes_++;
+
+    if (doc.pendingPosition_ == doc.pendingFormulas_.size())
+    {
+      doc.pendingFormulas_ = std::vector<Index>();
+      doc.pendingPosition_ = 0;
+    }
+
+    return false;
+  }
+
+  // Adds the virtual cells of column formulas that read the cells of changed, in the rows
+  // that store no cell of their own
+  static void addColumnFormulaCells(Document & doc, std::vector<Index> & changed)
+  {
+    FlatHashSet added;
+
+    // Added cells are looked at in turn, for column formulas reading column formulas
+    for (std::size_t i = 0; i < changed.size(); ++i)
+    {
+      const Index idx = changed[i];
+
+      for (auto const& formula : doc.columnFormulas_)
+        if (std::find(formula.inputs_.begin(), formula.inputs_.end(), idx.x) != formula.inputs_.end())
+        {
+          const Index cell(formula.column_, idx.y);
+          if (!doc.cells_.find(cell) && added.insert(cell.key()))
+            changed.push_back(cell);
+        }
+    }
+  }
+
+  // Queues the dirty cells of a large recalculation for evaluateIdle(), the ones in the rows
+  // on screen first. They keep their values for drawing until they are evaluated, reading
+  // one through getCellValue() evaluates it right away.
+  static void queueRecalculation(Document & doc, std::vector<Index> const& dirty)
+  {
+    FlatHashSet visibleRows;
+    visibleRows.insert(0);
+
+    // Rows hidden in the buffer are passed over on screen
+    const int firstRow = scroll().y;
+    const int lastRow = visibleRow(visibleIndex(firstRow) + std::max(view::height(), 0));
+    for (int row = firstRow; row <= lastRow; ++row)
+    {
+      if (isRowHidden(row))
+        continue;
+
+      const int documentRowIndex = documentRow(row);
+      if (documentRowIndex >= 0)
+        visibleRows.insert(documentRowIndex);
+    }
+
+    std::vector<Index> later;
+    for (auto const& it : dirty)
+    {
+      Cell * cell = doc.cells_.find(it);
+      if (!cell)
+        continue;
+
+      markStale(*cell);
+      if (cell->evaluated)
+        continue;
+
+      doc.recalcStale_.insert(it.key());
+      if (visibleRows.count(it.y))
+        doc.recalcQueue_.push_back(it);
+      else
+        later.push_back(it);
+    }
+
+    doc.recalcQueue_.insert(doc.recalcQueue_.end(), later.begin(), later.end());
+    doc.changes_++;
+  }
+
+  // Recalculates the edited cells and the cells that depend on them. All affected cells
+  // are reset before any of them is evaluated, so getCellValue() pulls precedents in order.
+  // Formulas that read the virtual cells of a column formula depend on its inputs too.
+  // The cells of doc, changed among them, that are evaluated again after those of changed
+  static std::vector<Index> collectDirty(Document & doc, std::vector<Index> const& changed)
+  {
+    std::vector<Index> dirty = doc.dependencies_.collectDependents(changed);
+
+    if (!doc.columnFormulas_.empty())
+    {
+      addColumnFormulaCells(doc, dirty);
+      dirty = doc.dependencies_.collectDependents(dirty);
+    }
+
+    return dirty;
+  }
+
+  // Evaluates again the formulas of the open documents that read the cells of changed in
+  // the document named sheet, or read anything of it when changed is nullptr, and the ones
+  // depending on them. Documents reading those are followed in turn. Every affected cell of
+  // every document is reset before any is evaluated, reading a cell of another document
+  // evaluates it, so the documents don't have to be visited in order.
+  static void recalculateSheetReaders(int sheet, std::vector<Index> const* changed)
+  {
+    if (sheet == Expr::NO_SHEET)
+      return;
+
+    struct Change
+    {
+      int sheet_;
+      bool all_;
+      std::vector<Index> cells_;
+    };
+
+    std::vector<Document *> docs;
+    for (auto & buffer : documentBuffers())
+      if (!buffer.doc_->loading_ && std::find(docs.begin(), docs.end(), buffer.doc_.get()) == docs.end())
+        docs.push_back(buffer.doc_.get());
+
+    std::vector<Change> changes(1, Change { sheet, changed == nullptr, changed ? *changed : std::vector<Index>() });
+
+    // The cells reset so far by document, a cycle through documents resets each once
+    std::vector<FlatHashSet> reset(docs.size());
+    std::vector<std::vector<Index>> dirty(docs.size());
+
+    for (std::size_t i = 0; i < changes.size(); ++i)
+      for (std::size_t d = 0; d < docs.size(); ++d)
+      {
+        Document & doc = *docs[d];
+
+        auto graph = doc.sheetDependencies_.find(changes[i].sheet_);
+        if (graph == doc.sheetDependencies_.end() || graph->second.empty())
+          continue;
+
+        const std::vector<Index> readers = graph->second.collectReferencing(changes[i].all_ ? nullptr : &changes[i].cells_);
+        if (readers.empty())
+          continue;
+
+        std::vector<Index> cells;
+        for (auto const& it : collectDirty(doc, readers))
+        {
+          if (!reset[d].insert(it.key()))
+            continue;
+
+          if (Cell * cell = doc.cells_.find(it))
+            resetCell(*cell);
+
+          cells.push_back(it);
+        }
+
+        if (cells.empty())
+          continue;
+
+        dirty[d].insert(dirty[d].end(), cells.begin(), cells.end());
+        changes.push_back(Change { documentSheet(doc), false, std::move(cells) });
+      }
+
+    Document * const previous = sheetDoc_;
+
+    for (std::size_t d = 0; d < docs.size(); ++d)
+    {
+      if (dirty[d].empty())
+        continue;
+
+      Document & doc = *docs[d];
+      sheetDoc_ = &doc;
+
+      evaluateBatched(doc, [&doc, &dirty, d] () {
+        for (auto const& it : dirty[d])
+        {
+          Cell * cell = doc.cells_.find(it);
+          if (cell && !cell->evaluated)
+            evaluateCell(it, *cell);
+        }
+      });
+
+      doc.changes_++;
+    }
+
+    sheetDoc_ = previous;
+  }
+
+  // first, if given, evaluates some of the dirty cells once all of them are reset and
+  // before the others are evaluated
+  static void recalculateFrom(std::vector<Index> const& edited, std::function<void ()> const& first)
+  {
+    if (transactionDepth_ > 0)
+    {
+      transactionEdited_.insert(transactionEdited_.end(), edited.begin(), edited.end());
+      return;
+    }
+
+    Document & doc = currentDoc();
+    const std::vector<Index> dirty = collectDirty(doc, edited);
+
+    if (RECALC_BUDGET.toInt() > 0 && dirty.size() >= RECALC_SLICE_MIN_CELLS)
+    {
+      queueRecalculation(doc, dirty);
+
+      // The slices skip what it evaluated
+      if (first)
+        first();
+
+      recalculateSheetReaders(documentSheet(doc), &dirty);
+      return;
+    }
+
+    for (auto const& it : dirty)
+    {
+      Cell * cell = doc.cells_.find(it);
+      if (cell)
+        resetCell(*cell);
+    }
+
+    if (first)
+      first();
+
+    evaluateBatched(doc, [&doc, &dirty] () {
+      for (auto const& it : dirty)
+      {
+        Cell * cell = doc.cells_.find(it);
+        if (cell && !cell->evaluated)
+          evaluateCell(it, *cell);
+      }
+    });
+
+    recalculateSheetReaders(documentSheet(doc), &dirty);
+  }
+
+  static void recalculateFrom(Index const& idx)
+  {
+    recalculateFrom(std::vector<Index>(1, idx));
+  }
+
+  Transaction::Transaction()
+  {
+    if (transactionDepth_++ > 0)
+      return;
+
+    transactionRecorded_ = false;
+    transactionRecalculateAll_ = false;
+    transactionEdited_.clear();
+  }
+
+  Transaction::~Transaction()
+  {
+    if (--transactionDepth_ > 0)
+      return;
+
+    std::vector<Index> edited;
+    edited.swap(transactionEdited_);
+
+    if (transactionRecalculateAll_)
+      recalculateDocument();
+    else if (!edited.empty())
+      recalculateFrom(edited);
+  }
+
+  // Follows edits that changed the rows of the document or the values of the formulas
+  // the column formulas read
+  static void updateColumnFormulas(Document & doc)
+  {
+    bool stale = false;
+    for (auto const& formula : doc.columnFormulas_)
+      stale |= formula.formulaInputs_ && formula.changes_ != doc.changes_;
+
+    if (stale)
+      invalidateColumnFormulas(doc, -1);
+
+    for (auto & formula : doc.columnFormulas_)
+    {
+      if (stale)
+        formula.formulaInputs_ = false;
+
+      formula.changes_ = doc.changes_;
+      if (formula.height_ == doc.height_)
+        continue;
+
+      // The block of the last row may have gained or lost rows
+      if (formula.height_ > 0 && (formula.height_ - 1) / COLUMN_FORMULA_BLOCK_ROWS < (int)formula.valid_.size())
+        formula.valid_[(formula.height_ - 1) / COLUMN_FORMULA_BLOCK_ROWS] = false;
+
+      formula.height_ = doc.height_;
+      formula.values_.resize(doc.height_);
+      formula.valid_.resize((doc.height_ + COLUMN_FORMULA_BLOCK_ROWS - 1) / COLUMN_FORMULA_BLOCK_ROWS, false);
+    }
+  }
+
+  // Returns the values of the rows of block of formula, computed first if they are stale.
+  // The input columns are read a tile at a time and the expression is evaluated over all
+  // rows of the block at once.
+  static double const* columnFormulaBlock(Document & doc, ColumnFormula & formula, int block)
+  {
+    const int first = block * COLUMN_FORMULA_BLOCK_ROWS;
+    if (formula.valid_[block] || formula.computing_)
+      return &formula.values_[first];
+
+    const int count = std::min(COLUMN_FORMULA_BLOCK_ROWS, doc.height_ - first);
+    formula.computing_ = true;
+
+    std::vector<std::vector<double>> inputs(formula.inputs_.size(), std::vector<double>(count));
+    std::vector<double const*> columns(formula.inputs_.empty() ? 1 : *std::max_element(formula.inputs_.begin(), formula.inputs_.end()) + 1, nullptr);
+
+    for (std::size_t i = 0; i < formula.inputs_.size(); ++i)
+    {
+      const int x = formula.inputs_[i];
+
+      doc.cells_.columnValues(x, first, count, inputs[i].data(), [&formula] (Index const& idx, Cell & cell) {
+        formula.formulaInputs_ = true;
+        if (!cell.evaluated)
+          evaluateCell(idx, cell);
+
+        return cell.value;
+      });
+
+      // Cells another column formula computes are not stored
+      if (ColumnFormula * source = findColumnFormula(doc, x))
+      {
+        double const* computed = columnFormulaBlock(doc, *source, block);
+        CellStorage const& cells = doc.cells_;
+
+        for (int row = 0; row < count; ++row)
+          if (!cells.find(Index(x, first + row)))
+            inputs[i][row] = computed[row];
+      }
+
+      columns[x] = inputs[i].data();
+    }
+
+    evaluateRows(formula.program_, columns.data(), count, &formula.values_[first]);
+
+    formula.computing_ = false;
+    formula.valid_[block] = true;
+    return &formula.values_[first];
+  }
+
+  bool columnFormulaValue(Document & doc, Index const& idx, double & value)
+  {
+    ColumnFormula * formula = doc.columnFormulas_.empty() ? nullptr : findColumnFormula(doc, idx.x);
+    if (!formula || idx.y < 0 || idx.y >= doc.height_)
+      return false;
+
+    updateColumnFormulas(doc);
+
+    value = formula->computing_ ? errorValue(FormulaError::Cycle) : columnFormulaBlock(doc, *formula, idx.y / COLUMN_FORMULA_BLOCK_ROWS)[idx.y % COLUMN_FORMULA_BLOCK_ROWS];
+    return true;
+  }
+
+  StrView columnFormulaText(Document & doc, Index const& idx, std::string & scratch)
+  {
+    double value;
+    if (!columnFormulaValue(doc, idx, value))
+      return StrView();
+
+    const FormulaError error = valueError(value);
+    if (error != FormulaError::None)
+      return errorText(error);
+
+    char buffer[str::FORMAT_SIZE];
+    scratch.assign(buffer, str::formatDouble(value, COLUMN_FORMULA_PRECISION, buffer));
+    return scratch;
+  }
+
+  StrView getCellText(Index const& index, std::string & scratch)
+  {
+    const Index idx = documentIndex(index);
+    if (idx.x < 0 || idx.x >= currentDoc().width_ || idx.y < 0 || idx.y >= currentDoc().height_)
+      return StrView();
+
+    if (currentDoc().paged_)
+    {
+      scratch = pagedText(currentDoc(), idx);
+      return scratch;
+    }
+
+    Cell const* cell = currentDoc().cells_.find(idx);
+    if (!cell)
+      return columnFormulaText(currentDoc(), idx, scratch);
+
+    scratch.clear();
+    if (formulaText(*cell, scratch))
+      return scratch;
+
+    return currentDoc().strings_.str(cell->text);
+  }
+
+  std::string getCellText(Index const& idx)
+  {
+    std::string scratch;
+    const StrView text = getCellText(idx, scratch);
+    return std::string(text.data(), text.size());
+  }
+
+  StrView cellDisplayText(Document & doc, Index const& index, Cell * cell, std::string & scratch, bool * stale)
+  {
+    if (!cell)
+      return columnFormulaText(doc, index, scratch);
+
+    if (!cell->evaluated)
+    {
+      if (stale && doc.recalcStale_.count(index.key()))
+        *stale = true;
+      else
+        evaluateCell(index, *cell);
+    }
+
+    // Only the cells that are shown get their value formatted
+    char buffer[str::FORMAT_SIZE];
+    const StrView display = cell->displayValue(buffer);
+    if (display.data() == buffer)
+    {
+      scratch.assign(buffer, display.size());
+      return scratch;
+    }
+
+    if (!display.empty())
+      return display;
+
+    scratch.clear();
+    if (formulaText(*cell, scratch))
+      return scratch;
+
+    return doc.strings_.str(cell->text);
+  }
+
+  // With stale set, a cell a sliced recalculation hasn't reached yet is shown with the value
+  // it had instead of being evaluated, and *stale tells so
+  static StrView cellDisplayText(Index const& idx, std::string & scratch, bool * stale)
+  {
+    if (stale)
+      *stale = false;
+
+    if (currentDoc().paged_)
+    {
+      scratch = pagedText(currentDoc(), documentIndex(idx));
+      return scratch;
+    }
+
+    const Index index = documentIndex(idx);
+    return cellDisplayText(currentDoc(), index, currentDoc().cells_.find(index), scratch, stale);
+  }
+
+  StrView getCellDisplayText(Index const& idx, std::string & scratch)
+  {
+    return cellDisplayText(idx, scratch, nullptr);
+  }
+
+  StrView getCellDisplayText(Index const& idx, std::string & scratch, bool & stale)
+  {
+    return cellDisplayText(idx, scratch, &stale);
+  }
+
+  std::string getCellDisplayText(Index const& idx)
+  {
+    std::string scratch;
+    const StrView text = getCellDisplayText(idx, scratch);
+    return std::string(text.data(), text.size());
+  }
+
+  double getCellValue(Index const& idx)
+  {
+    if (idx.x < 0 || idx.x >= currentDoc().width_ || idx.y < 0 || idx.y >= currentDoc().height_)
+      return 0.0;
+
+    if (currentDoc().paged_)
+    {
+      double value = 0.0;
+      return str::parseValue(pagedText(currentDoc(), idx), value) ? value : 0.0;
+    }
+
+    Cell * cell = currentDoc().cells_.find(idx);
+    if (!cell)
+    {
+      double value = 0.0;
+      columnFormulaValue(currentDoc(), idx, value);
+      return value;
+    }
+
+    if (!cell->evaluated)
+      evaluateCell(idx, *cell);
+
+    return cell->value;
+  }
+
+  double getCellKey(Index const& idx)
+  {
+    if (idx.x < 0 || idx.x >= currentDoc().width_ || idx.y < 0 || idx.y >= currentDoc().height_ || currentDoc().paged_)
+      return getCellValue(idx);
+
+    Cell const* cell = currentDoc().cells_.find(idx);
+    if (cell && cell->type == CellType::Text && cell->text != StringPool::EMPTY)
+      return value::fromText(cell->text);
+
+    return getCellValue(idx);
+  }
+
+  // A range summed last on this thread, the formula of the next row summing the same
+  // range a row further down only has to take its first row out and add its new last
+  // one. Formulas filled down a column are evaluated row by row, so a moving sum costs
+  // the same whatever its height. Ranges of a few shapes are kept at a time, for several
+  // columns of moving sums.
+  struct SlidingSum
+  {
+    Document const* doc_ = nullptr;
+    uint64_t changes_ = 0;
+    uint64_t resets_ = 0;
+    int x_ = 0;
+    int endX_ = 0;
+    int y_ = 0;
+    int endY_ = 0;
+    double sum_ = 0.0;
+    int slides_ = 0;
+  };
+
+  static const int SLIDING_SUM_SLOTS = 8;
+  static thread_local SlidingSum slidingSums_[SLIDING_SUM_SLOTS];
+
+  // Shorter ranges are summed whole, their numbers are contiguous and summing them costs
+  // less than looking up the two rows. A range slid this many times is summed whole again,
+  // so the rounding of the subtractions doesn't add up, and so is one that took out a
+  // number this much larger than what is left, which would leave mostly rounding.
+  static const int SLIDING_SUM_MIN_ROWS = 256;
+  static const int SLIDING_SUM_MAX_SLIDES = 1024;
+  static const double SLIDING_SUM_MAX_CANCEL = 1024.0;
+
+  static double sumCells(Index const& start, Index const& end);
+
+  // getCellValue() that looks the cell up without copying its tile while it needs no evaluating
+  static double slidingValue(Document & doc, Index const& idx)
+  {
+    if (!doc.paged_ && doc.columnFormulas_.empty())
+    {
+      Cell const* cell = static_cast<CellStorage const&>(doc.cells_).find(idx);
+      if (!cell)
+        return 0.0;
+
+      if (cell->evaluated)
+        return cell->value;
+    }
+
+    return getCellValue(idx);
+  }
+
+  double sumRange(Index const& start, Index const& end)
+  {
+    Document & doc = currentDoc();
+
+    if (end.y - start.y + 1 < SLIDING_SUM_MIN_ROWS)
+      return sumCells(start, end);
+
+    SlidingSum & slot = slidingSums_[(uint32_t)(start.x * 31 + end.x * 7 + (end.y - start.y)) % SLIDING_SUM_SLOTS];
+
+    // An edit of a cell of the range resets the formulas summing it, so the sum holds
+    // until a formula is reset or the document changes
+    const bool slides = slot.doc_ == &doc && slot.changes_ == doc.changes_ && slot.resets_ == formulaResets_ &&
+                        slot.x_ == start.x && slot.endX_ == end.x && slot.y_ + 1 == start.y &&
+                        slot.endY_ + 1 == end.y && slot.slides_ < SLIDING_SUM_MAX_SLIDES && !std::isnan(slot.sum_);
+
+    double sum = 0.0;
+    bool slid = false;
+
+    if (slides)
+    {
+      // Reading the cells may evaluate formulas that sum ranges of their own
+      const int firstRow = slot.y_;
+      double largest = 0.0;
+      sum = slot.sum_;
+      slid = true;
+
+      for (int x = start.x; x <= end.x && slid; ++x)
+      {
+        // Taking an infinity back out would give NaN instead of the sum of what is left
+        const double first = slidingValue(doc, Index(x, firstRow));
+        slid = std::isfinite(first);
+        sum += slidingValue(doc, Index(x, end.y)) - first;
+        largest = std::max(largest, std::fabs(first));
+      }
+
+      slid = slid && largest <= SLIDING_SUM_MAX_CANCEL * std::fabs(sum);
+    }
+
+    if (!slid)
+      sum = sumCells(start, end);
+
+    slot.doc_ = &doc;
+    slot.changes_ = doc.changes_;
+    slot.resets_ = formulaResets_;
+    slot.x_ = start.x;
+    slot.endX_ = end.x;
+    slot.y_ = start.y;
+    slot.endY_ = end.y;
+    slot.sum_ = sum;
+    slot.slides_ = slid ? slot.slides_ + 1 : 0;
+
+    return sum;
+  }
+
+  // Sums every cell of the range
+  static double sumCells(Index const& start, Index const& end)
+  {
+    Document & doc = currentDoc();
+
+    const int lastColumn = std::min(end.x, doc.width_ - 1);
+    const int lastRow = std::min(end.y, doc.height_ - 1);
+
+    double sum = 0.0;
+
+    if (doc.paged_)
+    {
+      for (int y = std::max(start.y, 0); y <= lastRow; ++y)
+        for (int x = std::max(start.x, 0); x <= lastColumn; ++x)
+          sum += getCellValue(Index(x, y));
+
+      return sum;
+    }
+
+    for (int x = std::max(start.x, 0); x <= lastColumn; ++x)
+    {
+      // The virtual cells of a column formula are summed along with the stored ones
+      if (!doc.columnFormulas_.empty() && findColumnFormula(doc, x))
+      {
+        for (int y = std::max(start.y, 0); y <= lastRow; ++y)
+          sum += getCellValue(Index(x, y));
+
+        continue;
+      }
+
+      sum += doc.cells_.sumColumn(x, start.y, lastRow, [] (Index const& idx, Cell & cell) {
+        if (!cell.evaluated)
+          evaluateCell(idx, cell);
+
+        return cell.value;
+      });
+    }
+
+    return sum;
+  }
+
+  // Whether the cell at idx holds a number, a formula giving one or a text, and what it
+  // is. A text is a value::fromText() of its id.
+  static bool lookupValue(Document & doc, Index const& idx, double & value)
+  {
+    if (doc.paged_)
+      return str::parseValue(pagedText(doc, idx), value);
+
+    Cell * cell = doc.cells_.find(idx);
+    if (!cell)
+      return columnFormulaValue(doc, idx, value);
+
+    if (cell->type == CellType::Text)
+    {
+      value = value::fromText(cell->text);
+      return cell->text != StringPool::EMPTY;
+    }
+
+    if (!cell->evaluated)
+      evaluateCell(idx, *cell);
+
+    value = cell->value;
+    return !std::isnan(value);
+  }
+
+  static bool lookupCurrent(Document const& doc, ColumnLookup const& lookup)
+  {
+    return !lookup.stale_ && lookup.height_ == doc.height_ &&
+           (!lookup.formulas_ || (lookup.changes_ == doc.changes_ && lookup.resets_ == formulaResets_));
+  }
+
+  // Evaluates the cells of the rows from first to last of column and groups the rows by
+  // their value, in order
+  static void buildLookup(Document & doc, int column, int first, int last, ColumnLookup & lookup)
+  {
+    lookup.building_ = true;
+    lookup.resets_ = formulaResets_;
+    lookup.formulas_ = !doc.paged_ && !doc.columnFormulas_.empty() && findColumnFormula(doc, column);
+
+    std::vector<std::pair<uint64_t, int>> values;
+    for (int y = first; y <= std::min(last, doc.height_ - 1); ++y)
+    {
+      const Index idx(column, y);
+
+      if (!doc.paged_ && !lookup.formulas_)
+        if (Cell const* cell = doc.cells_.find(idx))
+          lookup.formulas_ = cell->hasExpression();
+
+      double value;
+      if (lookupValue(doc, idx, value))
+        values.emplace_back(lookupKey(value), y);
+    }
+
+    lookup.values_.clear();
+    for (auto const& it : values)
+      lookup.values_[it.first].count_++;
+
+    uint32_t offset = 0;
+    for (auto & it : lookup.values_)
+    {
+      it.second.first_ = offset;
+      offset += it.second.count_;
+      it.second.count_ = 0;
+    }
+
+    lookup.rows_.resize(values.size());
+    for (auto const& it : values)
+    {
+      ColumnLookup::Entry & entry = *lookup.values_.find(it.first);
+      lookup.rows_[entry.first_ + entry.count_++] = it.second;
+    }
+
+    lookup.stale_ = false;
+    lookup.building_ = false;
+    lookup.height_ = doc.height_;
+    lookup.changes_ = doc.changes_;
+  }
+
+  // The index of the rows from first to last of column, up to date. nullptr while it is
+  // being built, for a formula that looks up in its own range.
+  static ColumnLookup const* useLookup(Document & doc, int column, int first, int last)
+  {
+    ColumnLookup & lookup = doc.lookups_[std::make_tuple(column, first, last)];
+    if (lookup.building_)
+      return nullptr;
+
+    if (lookupCurrent(doc, lookup))
+      LOOKUP_COUNTERS.hit();
+    else
+    {
+      LOOKUP_COUNTERS.miss();
+      buildLookup(doc, column, first, last, lookup);
+    }
+
+    return &lookup;
+  }
+
+  // The entry of value in the first column of the range, nullptr without one. lookup is
+  // nullptr for a cycle.
+  static ColumnLookup::Entry const* findLookup(Document & doc, double value, Index const& start, Index const& end, ColumnLookup const*& lookup)
+  {
+    lookup = end.y >= 0 ? useLookup(doc, start.x, std::max(start.y, 0), end.y) : nullptr;
+    return lookup ? lookup->values_.find(lookupKey(value)) : nullptr;
+  }
+
+  // The column of the range a lookup reads from, counted from 1, as an offset from its
+  // first column. -1 if the range doesn't have it.
+  static int lookupColumn(double column, Index const& start, Index const& end)
+  {
+    return column >= 1.0 && column < end.x - start.x + 2.0 ? (int)column - 1 : -1;
+  }
+
+  double matchRange(double value, Index const& start, Index const& end)
+  {
+    Document & doc = currentDoc();
+    std::lock_guard<std::recursive_mutex> lock(doc.lookupMutex_);
+
+    ColumnLookup const* lookup;
+    ColumnLookup::Entry const* entry = findLookup(doc, value, start, end, lookup);
+    return entry ? lookup->rows_[entry->first_] - start.y + 1 : NAN;
+  }
+
+  double lookupRange(double value, Index const& start, Index const& end, double column)
+  {
+    Document & doc = currentDoc();
+    std::lock_guard<std::recursive_mutex> lock(doc.lookupMutex_);
+
+    const int offset = lookupColumn(column, start, end);
+
+    ColumnLookup const* lookup;
+    ColumnLookup::Entry const* entry = offset >= 0 ? findLookup(doc, value, start, end, lookup) : nullptr;
+    return entry ? getCellValue(Index(start.x + offset, lookup->rows_[entry->first_])) : NAN;
+  }
+
+  double countRange(double value, Index const& start, Index const& end)
+  {
+    Document & doc = currentDoc();
+    std::lock_guard<std::recursive_mutex> lock(doc.lookupMutex_);
+
+    double count = 0.0;
+    for (int x = start.x; x <= end.x; ++x)
+    {
+      ColumnLookup const* lookup;
+      ColumnLookup::Entry const* entry = findLookup(doc, value, Index(x, start.y), end, lookup);
+
+      if (!lookup && end.y >= 0)
+        return NAN;
+
+      count += entry ? entry->count_ : 0;
+    }
+
+    return count;
+  }
+
+  double sumIfRange(double value, Index const& start, Index const& end, double column)
+  {
+    Document & doc = currentDoc();
+    std::lock_guard<std::recursive_mutex> lock(doc.lookupMutex_);
+
+    const int offset = lookupColumn(column, start, end);
+    if (offset < 0)
+      return NAN;
+
+    ColumnLookup const* lookup;
+    ColumnLookup::Entry const* entry = findLookup(doc, value, start, end, lookup);
+    if (!lookup && end.y >= 0)
+      return NAN;
+
+    double sum = 0.0;
+    for (uint32_t i = 0; entry && i < entry->count_; ++i)
+      sum += getCellValue(Index(start.x + offset, lookup->rows_[entry->first_ + i]));
+
+    return sum;
+  }
+
+  bool readSheet(int sheet, std::function<void ()> const& read)
+  {
+    static thread_local int depth = 0;
+
+    Document * doc = depth < MAX_SHEET_DEPTH ? findSheetDocument(sheet) : nullptr;
+    if (!doc)
+      return false;
+
+    Document * const previous = sheetDoc_;
+    sheetDoc_ = doc;
+    depth++;
+
+    read();
+
+    depth--;
+    sheetDoc_ = previous;
+    return true;
+  }
+
+  // Statistics of the selection shown last. When the selection grows by a strip on one
+  // side only the strip is added to them. The strip of a large selection is computed on
+  // the scheduler, under job number job_, and added once it is done.
+  struct SelectionStats
+  {
+    std::weak_ptr<Document> doc_;
+    int buffer_ = -1;
+    uint64_t changes_ = 0;
+    int rows_ = 0;
+    Index start_ = Index(-1, -1);
+    Index end_ = Index(-1, -1);
+    reduce::Stats stats_;
+    bool pending_ = false;
+  };
+
+  static SelectionStats selectionStats_;
+
+  // The job the stats are waiting for, older jobs stop as soon as they notice
+  static std::atomic<uint64_t> selectionStatsJob_(0);
+
+  static TaskGroup & backgroundStats()
+  {
+    static TaskGroup group;
+    return group;
+  }
+
+  static void cancelSelectionStats()
+  {
+    selectionStatsJob_++;
+    selectionStats_ = SelectionStats();
+  }
+
+  // Adds the numbers of the cells from start to end, both corners inclusive, to stats.
+  // Rows are buffer rows and rows is the row table of a view, or nullptr. Formulas are
+  // passed to evaluate as in CellStorage::statsColumn().
+  template <typename Func>
+  static void addRangeStats(CellStorage & cells, std::vector<int> const* rows, Index const& start, Index const& end,
+                            uint64_t job, reduce::Stats & stats, Func const& evaluate)
+  {
+    if (!rows)
+    {
+      for (int x = start.x; x <= end.x && job == selectionStatsJob_; ++x)
+        cells.statsColumn(x, start.y, end.y, stats, evaluate);
+
+      return;
+    }
+
+    CellStorage const& lookup = cells;
+
+    for (int y = start.y; y <= end.y; ++y)
+    {
+      if ((y - start.y) % SEARCH_CHUNK_ROWS == 0 && job != selectionStatsJob_)
+        return;
+
+      for (int x = start.x; x <= end.x; ++x)
+      {
+        // Looking up cells that aren't evaluated doesn't copy shared tiles
+        const Index idx(x, (*rows)[y]);
+        Cell const* cell = lookup.find(idx);
+
+        if (!cell || cell->type == CellType::Text)
+          continue;
+
+        if (cell->type == CellType::Number)
+          stats.add(cell->value);
+        else
+          stats.add(evaluate(idx, *cells.find(idx)));
+      }
+    }
+  }
+
+  // Whether the rectangle from start to end is the one from oldStart to oldEnd grown on
+  // one side, stripStart and stripEnd are then the corners of what was added
+  static bool selectionGrowth(Index const& oldStart, Index const& oldEnd, Index const& start, Index const& end,
+                              Index & stripStart, Index & stripEnd)
+  {
+    stripStart = start;
+    stripEnd = end;
+
+    if (start.x == oldStart.x && end.x == oldEnd.x)
+    {
+      if (start.y == oldStart.y && end.y > oldEnd.y)
+      {
+        stripStart.y = oldEnd.y + 1;
+        return true;
+      }
+
+      if (end.y == oldEnd.y && start.y < oldStart.y)
+      {
+        stripEnd.y = oldStart.y - 1;
+        return true;
+      }
+    }
+
+    if (start.y == oldStart.y && end.y == oldEnd.y)
+    {
+      if (start.x == oldStart.x && end.x > oldEnd.x)
+      {
+        stripStart.x = oldEnd.x + 1;
+        return true;
+      }
+
+      if (end.x == oldEnd.x && start.x < oldStart.x)
+      {
+        stripEnd.x = oldStart.x - 1;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  bool selectionStats(reduce::Stats & stats)
+  {
+    if (!hasSelection())
+      return false;
+
+    Buffer const& buffer = currentBuffer();
+    Document & doc = *buffer.doc_;
+    const int rowCount = getRowCount();
+
+    const Index start = buffer.selectionStart_;
+    const Index end(std::min(buffer.selectionEnd_.x, doc.width_ - 1), std::min(buffer.selectionEnd_.y, rowCount - 1));
+
+    SelectionStats & cache = selectionStats_;
+    const bool current = cache.buffer_ == currentBufferIndex_ && cache.doc_.lock() == buffer.doc_ &&
+                         cache.changes_ == doc.changes_ && cache.rows_ == rowCount;
+
+    if (current && cache.start_ == start && cache.end_ == end)
+    {
+      stats = cache.stats_;
+      return !cache.pending_;
+    }
+
+    // Only finished stats can be extended
+    Index stripStart;
+    Index stripEnd;
+    if (!current || cache.pending_ || !selectionGrowth(cache.start_, cache.end_, start, end, stripStart, stripEnd))
+    {
+      cache.stats_ = reduce::Stats();
+      stripStart = start;
+      stripEnd = end;
+    }
+
+    const uint64_t job = ++selectionStatsJob_;
+
+    cache.doc_ = buffer.doc_;
+    cache.buffer_ = currentBufferIndex_;
+    cache.rows_ = rowCount;
+    cache.changes_ = doc.changes_;
+    cache.start_ = start;
+    cache.end_ = end;
+    cache.pending_ = false;
+
+    std::vector<int> const* rows = buffer.view_ ? &buffer.rows_ : nullptr;
+    const long long cells = end.x < start.x || end.y < start.y ? 0 :
+                            (long long)(stripEnd.x - stripStart.x + 1) * (stripEnd.y - stripStart.y + 1);
+    const long long asyncCells = SELECTION_STATS_ASYNC_CELLS.toInt();
+
+    if (asyncCells <= 0 || cells < asyncCells)
+    {
+      if (doc.paged_)
+      {
+        // The partitions of a document's own rows that hold no numbers in a column are passed over
+        double value = 0.0;
+        PagedTable::Zone zone;
+        for (int x = stripStart.x; x <= stripEnd.x; ++x)
+          for (int y = stripStart.y; y <= stripEnd.y; ++y)
+          {
+            int first = 0;
+            int end = 0;
+            if (!rows && doc.paged_->zone(x, y, zone, first, end) && zone.numbers == 0)
+            {
+              y = end - 1;
+              continue;
+            }
+
+            if (str::parseValue(pagedText(doc, Index(x, documentRow(y))), value))
+              cache.stats_.add(value);
+          }
+      }
+      else
+      {
+        addRangeStats(doc.cells_, rows, stripStart, stripEnd, job, cache.stats_, [] (Index const& idx, Cell & cell) {
+          if (!cell.evaluated)
+            evaluateCell(idx, cell);
+
+          return cell.value;
+        });
+      }
+    }
+    else if (doc.paged_)
+    {
+      // A paged document can only be read here, too large selections go without stats
+      cache.pending_ = true;
+    }
+    else
+    {
+      // The worker reads a copy that shares the tiles, with their caches built here so
+      // the columns without formulas are only read. Formulas aren't evaluated there,
+      // the ones left unevaluated by lazy evaluation are left out.
+      doc.cells_.updateSums();
+
+      std::shared_ptr<CellStorage> snapshot = std::make_shared<CellStorage>(doc.cells_);
+      std::shared_ptr<std::vector<int>> snapshotRows = rows ? std::make_shared<std::vector<int>>(*rows) : nullptr;
+      const reduce::Stats base = cache.stats_;
+
+      cache.pending_ = true;
+
+      backgroundStats().spawn([snapshot, snapshotRows, stripStart, stripEnd, job, base] () {
+        reduce::Stats stats = base;
+        addRangeStats(*snapshot, snapshotRows.get(), stripStart, stripEnd, job, stats, [] (Index const&, Cell & cell) {
+          return cell.evaluated ? cell.value : NAN;
+        });
+
+        if (job != selectionStatsJob_)
+          return;
+
+        Scheduler::shared().postCompletion([job, stats] () {
+          if (job != selectionStatsJob_)
+            return;
+
+          selectionStats_.stats_ = stats;
+          selectionStats_.pending_ = false;
+        });
+      });
+    }
+
+    stats = cache.stats_;
+    return !cache.pending_;
+  }
+
+  uint32_t getCellFormat(Index const& index)
+  {
+    const Index idx = documentIndex(index);
+    if (idx.x < 0 || idx.x >= currentDoc().width_ || idx.y < 0 || idx.y >= currentDoc().height_)
+      return 0;
+
+    if (currentDoc().paged_)
+    {
+      uint32_t format = 0;
+      pagedText(currentDoc(), idx, &format);
+      return format;
+    }
+
+    Cell const* cell = currentDoc().cells_.find(idx);
+    return cell ? cell->format : 0;
+  }
+
+  // A search term, matched either as a substring or as a regular expression. Doesn't
+  // change after compile(), so workers can share it.
+  // A regular expression is compiled once and kept by the document while it is the one
+  // searched for, so what it found of the strings carries over from search to search
+  struct SearchTerm
+  {
+    std::string term_;
+    bool regex_ = false;
+    std::shared_ptr<TextPattern> pattern_;
+    StringPool const* strings_ = nullptr;
+
+    bool compile(Document & doc, std::string const& term)
+    {
+      term_ = term;
+      regex_ = SEARCH_REGEX.toBool();
+      strings_ = &doc.strings_;
+
+      if (!regex_)
+        return true;
+
+      if (!doc.searchPattern_ || doc.searchPattern_->source() != term)
+      {
+        std::shared_ptr<TextPattern> pattern = std::make_shared<TextPattern>();
+        if (!pattern->compile(term))
+          return false;
+
+        doc.searchPattern_ = std::move(pattern);
+      }
+
+      pattern_ = doc.searchPattern_;
+      pattern_->reserve(doc.strings_.size());
+      return true;
+    }
+
+    bool matches(StrView text) const
+    {
+      return regex_ ? pattern_->matches(text) : text.find(term_) != StrView::npos;
+    }
+
+    bool matches(Cell const& cell, std::string & scratch) const
+    {
+      scratch.clear();
+      if (formulaText(cell, scratch))
+        return matches(scratch);
+
+      const StrView text = strings_->str(cell.text);
+      return regex_ ? pattern_->matches(cell.text, text) : text.find(term_) != StrView::npos;
+    }
+  };
+
+  // Finds the first cell in the rows from first towards last, last excluded, that matches
+  // search. Rows are buffer rows and rows is the row table of a view, or nullptr.
+  static bool scanRows(Document const& doc, std::vector<int> const* rows, SearchTerm const& search,
+                       int first, int last, bool forward, Index & match)
+  {
+    const int step = forward ? 1 : -1;
+    std::string scratch;
+
+    for (int y = first; y != last; y += step)
+    {
+      const int row = rows ? (*rows)[y] : y;
+
+      for (int x = forward ? 0 : doc.width_ - 1; x >= 0 && x < doc.width_; x += step)
+      {
+        Cell const* cell = doc.cells_.find(Index(x, row));
+        if (cell && search.matches(*cell, scratch))
+        {
+          match = Index(x, y);
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  // Scans the rows from first towards last in chunks on the scheduler. Every batch of
+  // chunks is checked in order, so the first match wins even if a later chunk is faster.
+  static bool scanRowsInParallel(Document const& doc, SearchTerm const& search, int first, int last, bool forward, Index & match)
+  {
+    Buffer const& buffer = currentBuffer();
+    std::vector<int> const* rows = buffer.view_ ? &buffer.rows_ : nullptr;
+
+    const int step = forward ? 1 : -1;
+    const int threads = Scheduler::shared().threadCount();
+
+    if (threads <= 1 || std::abs(last - first) < 2 * SEARCH_CHUNK_ROWS)
+      return scanRows(doc, rows, search, first, last, forward, match);
+
+    for (int y = first; y != last; )
+    {
+      std::vector<std::pair<int, int>> chunks;
+      for (int i = 0; i < threads && y != last; ++i)
+      {
+        const int end = forward ? std::min(last, y + SEARCH_CHUNK_ROWS) : std::max(last, y - SEARCH_CHUNK_ROWS);
+        chunks.push_back(std::make_pair(y, end));
+        y = end;
+      }
+
+      // Chunks after one that found a match stop early, their matches can't win
+      std::vector<Index> matches(chunks.size());
+      std::atomic<int> firstFound(chunks.size());
+
+      std::vector<Scheduler::Task> tasks;
+      for (int i = 0; i < (int)chunks.size(); ++i)
+      {
+        tasks.push_back([&, i] () {
+          for (int row = chunks[i].first; row != chunks[i].second && firstFound > i; row += step)
+          {
+            if (!scanRows(doc, rows, search, row, row + step, forward, matches[i]))
+              continue;
+
+            int found = firstFound;
+            while (found > i && !firstFound.compare_exchange_weak(found, i))
+              ;
+            return;
+          }
+        });
+      }
+
+      Scheduler::shared().run(tasks);
+
+      if (firstFound < (int)chunks.size())
+      {
+        match = matches[firstFound];
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // Paged documents are searched field by field on this thread, their pages are split
+  // when they are first looked at and can't be shared with the workers
+  static bool findPagedText(SearchTerm const& search, Index pos, bool forward, Index & match)
+  {
+    Document & doc = currentDoc();
+
+    const int width = doc.width_;
+    const int height = getRowCount();
+    const int step = forward ? 1 : -1;
+
+    for (; pos.y >= 0 && pos.y < height; pos.y += step, pos.x = forward ? 0 : width - 1)
+    {
+      const int row = documentRow(pos.y);
+
+      for (; pos.x >= 0 && pos.x < width; pos.x += step)
+      {
+        const std::string text = pagedText(doc, Index(pos.x, row));
+        if (!text.empty() && search.matches(text))
+        {
+          match = pos;
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  bool findText(std::string const& term, Index const& from, bool forward, Index & match)
+  {
+    if (term.empty())
+      return false;
+
+    Document & doc = currentDoc();
+
+    SearchTerm search;
+    if (!search.compile(doc, term))
+    {
+      logError("invalid search pattern '", term, "'");
+      return false;
+    }
+
+    const int width = doc.width_;
+    const int height = getRowCount();
+    const int step = forward ? 1 : -1;
+
+    Index pos(from.x + step, from.y);
+    if (!forward && pos.y >= height)
+      pos = Index(width - 1, height - 1);
+    else if (!forward)
+      pos.x = std::min(pos.x, width - 1);
+
+    if (doc.paged_)
+      return findPagedText(search, pos, forward, match);
+
+    // Regular expressions can't use the index and are matched against every cell on the
+    // scheduler, after the rest of the row the search starts in
+    if (search.regex_)
+    {
+      if (pos.y < 0 || pos.y >= height)
+        return false;
+
+      std::string scratch;
+      for (; pos.x >= 0 && pos.x < width; pos.x += step)
+      {
+        Cell const* cell = doc.cells_.find(Index(pos.x, documentRow(pos.y)));
+        if (cell && search.matches(*cell, scratch))
+        {
+          match = pos;
+          return true;
+        }
+      }
+
+      return scanRowsInParallel(doc, search, pos.y + step, forward ? height : -1, forward, match);
+    }
+
+    // Text and numbers are matched on the id of their interned text. Formulas still have
+    // to be printed, the text they are searched in isn't stored.
+    std::vector<uint8_t> matches;
+    doc.search_.find(doc.strings_, term, matches);
+    std::string scratch;
+
+    for (; pos.y >= 0 && pos.y < height; pos.y += step, pos.x = forward ? 0 : width - 1)
+    {
+      const int row = documentRow(pos.y);
+
+      for (; pos.x >= 0 && pos.x < width; pos.x += step)
+      {
+        Cell const* cell = doc.cells_.find(Index(pos.x, row));
+        if (!cell)
+          continue;
+
+        bool found = matches[cell->text] != 0;
+
+        scratch.clear();
+        if (formulaText(*cell, scratch))
+          found = scratch.find(term) != std::string::npos;
+
+        if (found)
+        {
+          match = pos;
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  // The first position from start towards limit along axis, both inclusive, whose cell
+  // shows something, or with filled false one that shows nothing. -1 if there is none.
+  static int findFilled(int Index::* axis, Index const& start, int limit, bool filled)
+  {
+    Document & doc = currentDoc();
+
+    // Paged documents, views and the virtual cells of column formulas are looked at cell
+    // by cell, the others only read the stored cells
+    const bool virtualCells = !doc.columnFormulas_.empty() && (axis == &Index::x || findColumnFormula(doc, start.x));
+    if (!doc.paged_ && !currentBuffer().view_ && !virtualCells)
+      return doc.cells_.findFilled(axis, start, limit, filled);
+
+    const int step = limit >= start.*axis ? 1 : -1;
+    std::string scratch;
+
+    for (Index idx = start; step > 0 ? idx.*axis <= limit : idx.*axis >= limit; idx.*axis += step)
+      if (getCellText(idx, scratch).empty() != filled)
+        return idx.*axis;
+
+    return -1;
+  }
+
+  Index findDataEdge(Index const& from, int dx, int dy)
+  {
+    int Index::* axis = dx != 0 ? &Index::x : &Index::y;
+    const int step = dx + dy > 0 ? 1 : -1;
+    const int size = dx != 0 ? getColumnCount() : getRowCount();
+    const int limit = step > 0 ? size - 1 : 0;
+
+    if (from.x < 0 || from.y < 0 || (step > 0 ? from.*axis >= limit : from.*axis <= 0))
+      return from;
+
+    Index edge = from;
+    edge.*axis = std::min(edge.*axis, size);
+
+    Index next = edge;
+    next.*axis += step;
+
+    std::string scratch;
+    const bool run = !getCellText(edge, scratch).empty() && !getCellText(next, scratch).empty();
+
+    // Within a stretch of cells that show something the jump goes to its end, anywhere
+    // else to the next cell that shows something, or the edge of the document
+    const int found = findFilled(axis, next, limit, !run);
+    edge.*axis = found < 0 ? limit : run ? found - step : found;
+    return edge;
+  }
+
+  std::vector<Index> findTextInBlock(std::string const& term, Index const& first, Index const& last)
+  {
+    std::vector<Index> found;
+
+    Document & doc = currentDoc();
+
+    SearchTerm search;
+    if (term.empty() || !search.compile(doc, term))
+      return found;
+
+    std::string scratch;
+
+    for (int y = std::max(first.y, 0); y <= last.y && y < getRowCount(); ++y)
+      for (int x = std::max(first.x, 0); x <= last.x && x < doc.width_; ++x)
+      {
+        const Index idx(x, documentRow(y));
+
+        if (doc.paged_)
+        {
+          scratch = pagedText(doc, idx);
+          if (!scratch.empty() && search.matches(scratch))
+            found.push_back(Index(x, y));
+        }
+        else
+        {
+          Cell const* cell = doc.cells_.find(idx);
+          if (cell && search.matches(*cell, scratch))
+            found.push_back(Index(x, y));
+        }
+      }
+
+    return found;
+  }
+
+  void setCellText(Index const& idx, std::string const& text)
+  {
+    if (!beginEdit())
+      return;
+
+    UndoRecord & record = addUndoRecord(EditAction::CellText, false);
+    record.before_ = captureCell(idx);
+
+    setText(idx, text);
+
+    record.after_ = captureCell(idx);
+    journalEdit(record);
+    recalculateFrom(idx);
+  }
+
+  void setCellTexts(Index const& origin, std::vector<std::vector<std::string>> const& values)
+  {
+    if (origin.x < 0 || origin.y < 0 || !beginEdit())
+      return;
+
+    std::vector<Index> edited;
+
+    for (std::size_t y = 0; y < values.size(); ++y)
+      for (std::size_t x = 0; x < values[y].size(); ++x)
+      {
+        const Index idx(origin.x + x, origin.y + y);
+
+        // The first cell starts a new undo state, the others are merged into it
+        UndoRecord & record = addUndoRecord(EditAction::CellText, !edited.empty());
+        record.before_ = captureCell(idx);
+
+        setText(idx, values[y][x]);
+
+        record.after_ = captureCell(idx);
+        journalEdit(record);
+        edited.push_back(idx);
+      }
+
+    recalculateFrom(edited);
+  }
+
+  void setColumnValues(int column, int first, std::vector<double> const& values)
+  {
+    if (column < 0 || first < 0 || !beginEdit())
+      return;
+
+    std::vector<Index> edited;
+    edited.reserve(values.size());
+
+    for (std::size_t i = 0; i < values.size(); ++i)
+    {
+      const Index idx(column, first + i);
+
+      UndoRecord & record = addUndoRecord(EditAction::CellText, !edited.empty());
+      record.before_ = captureCell(idx);
+
+      setText(idx, str::fromDouble(values[i]));
+
+      record.after_ = captureCell(idx);
+      journalEdit(record);
+      edited.push_back(idx);
+    }
+
+    recalculateFrom(edited);
+  }
+
+  void setCellFormat(Index const& idx, uint32_t format)
+  {
+    if (!beginEdit())
+      return;
+
+    if (idx.x < 0 || idx.x >= currentDoc().width_ || idx.y < 0 || idx.y >= currentDoc().height_)
+      return;
+
+    UndoRecord & record = addUndoRecord(EditAction::CellText, false);
+    record.before_ = captureCell(idx);
+
+    Cell & cell = getCell(idx);
+    cell.format = format;
+
+    record.after_ = captureCell(idx);
+    journalEdit(record);
+  }
+
+  void changeCellFormats(IndexRange const& range, std::function<uint32_t(uint32_t)> const& change)
+  {
+    if (!beginEdit())
+      return;
+
+    bool merge = false;
+
+    for (auto const& idx : range.clip(currentDoc().width_, currentDoc().height_))
+    {
+      Cell const* existing = currentDoc().cells_.find(idx);
+      const uint32_t format = change(existing ? existing->format : 0);
+      if (!existing && format == 0)
+        continue;
+
+      // The first cell starts a new undo state, the others are merged into it
+      UndoRecord & record = addUndoRecord(EditAction::CellText, merge);
+      record.before_ = captureCell(idx);
+
+      getCell(idx).format = format;
+
+      record.after_ = captureCell(idx);
+      journalEdit(record);
+      merge = true;
+    }
+  }
+
+  void clearCells(IndexRange const& range)
+  {
+    if (!beginEdit())
+      return;
+
+    std::vector<Index> edited;
+
+    for (auto const& idx : range.clip(currentDoc().width_, currentDoc().height_))
+    {
+      // Cells that were never written have nothing to clear
+      if (!currentDoc().cells_.has(idx))
+        continue;
+
+      UndoRecord & record = addUndoRecord(EditAction::CellText, !edited.empty());
+      record.before_ = captureCell(idx);
+
+      setText(idx, std::string());
+
+      record.after_ = captureCell(idx);
+      journalEdit(record);
+      edited.push_back(idx);
+    }
+
+    if (!edited.empty())
+      recalculateFrom(edited);
+  }
+
+  // The cells a fill from source along step writes start after it, or after the next one
+  // when both are numbers, which continue as a series of the difference between them
+  static Index fillStart(Document & doc, Index const& source, Index const& step, double * increment = nullptr)
+  {
+    CellStorage const& cells = doc.cells_;
+    const Index next(source.x + step.x, source.y + step.y);
+
+    Cell const* first = cells.find(source);
+    Cell const* second = cells.find(next);
+    if (!first || !second || first->type != CellType::Number || second->type != CellType::Number)
+      return next;
+
+    if (increment)
+      *increment = second->value - first->value;
+
+    return Index(next.x + step.x, next.y + step.y);
+  }
+
+  // Any cell of the range may change, see getCell()
+  static void invalidateRange(Document & doc, Index const& first, Index const& last)
+  {
+    for (int x = first.x; x <= last.x; ++x)
+    {
+      if (ColumnIndex * index = doc.indexes_.empty() ? nullptr : findColumnIndex(doc, x))
+        index->invalidate();
+
+      if (ColumnSketch * sketch = doc.sketches_.empty() ? nullptr : findColumnSketch(doc, x))
+        sketch->stale_ = true;
+
+      if (!doc.lookups_.empty() || !doc.formatRules_.empty() || !doc.encodings_.empty() || !doc.results_.empty())
+        invalidateLookups(doc, x);
+    }
+
+    if (!doc.columnFormulas_.empty())
+    {
+      for (int y = first.y; y <= last.y; y += COLUMN_FORMULA_BLOCK_ROWS)
+        invalidateColumnFormulas(doc, y);
+
+      invalidateColumnFormulas(doc, last.y);
+    }
+  }
+
+  // Fills the cells from first to last after the ones in the first row, or in the first
+  // column when right. Formulas share the template of the cell they are filled from, with
+  // an origin of their own, and the other cells are copied unless they continue a series,
+  // see fillStart(). The cells that were there go to removed, if given, and the ones
+  // written or emptied to filled. Neither undo state nor recalculation are touched.
+  static void fillBlock(Index const& first, Index const& last, bool right, std::vector<CellState> * removed, std::vector<Index> & filled)
+  {
+    Document & doc = currentDoc();
+    CellStorage const& cells = doc.cells_;
+
+    invalidateRange(doc, first, last);
+
+    const Index step = right ? Index(1, 0) : Index(0, 1);
+    const int end = right ? last.x : last.y;
+    const int lines = right ? last.y - first.y + 1 : last.x - first.x + 1;
+
+    for (int line = 0; line < lines; ++line)
+    {
+      const Index source = right ? Index(first.x, first.y + line) : Index(first.x + line, first.y);
+
+      double increment = 0.0;
+      const Index start = fillStart(doc, source, step, &increment);
+      const bool series = !(start == Index(source.x + step.x, source.y + step.y));
+
+      // Copied, writing the targets may move the tile of the source
+      Cell const* found = cells.find(source);
+      const bool empty = !found;
+      Cell pattern;
+      if (found)
+        pattern = *found;
+
+      for (Index idx = start; (right ? idx.x : idx.y) <= end; idx.x += step.x, idx.y += step.y)
+      {
+        Cell const* existing = cells.find(idx);
+        const bool hadFormula = existing && existing->hasExpression();
+
+        if (existing && removed)
+          removed->push_back(captureCell(idx));
+
+        if (empty)
+        {
+          if (existing)
+          {
+            doc.cells_.erase(idx);
+            removePrecedents(doc, idx);
+            filled.push_back(idx);
+          }
+
+          continue;
+        }
+
+        Cell & cell = doc.cells_.get(idx);
+        cell = pattern;
+
+        if (series)
+        {
+          cell.value = pattern.value + increment * (right ? idx.x - source.x : idx.y - source.y);
+          cell.text = doc.strings_.intern(str::fromDouble(cell.value));
+        }
+
+        if (cell.hasExpression())
+        {
+          cell.formula->origin = idx;
+          cell.evaluated = false;
+          setPrecedents(doc, idx, cell);
+        }
+        else if (hadFormula)
+          removePrecedents(doc, idx);
+
+        growDocument(idx);
+        filled.push_back(idx);
+      }
+    }
+  }
+
+  // Evaluates the formulas a fill down wrote below source, up to lastRow, a block of rows
+  // at a time when their template computes a row from the other columns of that row, see
+  // isRowProgram(). The columns read are evaluated first where they hold formulas.
+  static void evaluateFilledColumn(Document & doc, Index const& source, int lastRow)
+  {
+    Cell const* cell = static_cast<CellStorage const&>(doc.cells_).find(source);
+    if (!cell || !cell->hasExpression() || !isRowProgram(cell->formula->pattern->program))
+      return;
+
+    // References of the template are relative to its cell, the ones of a row program to row 0
+    Program program = cell->formula->pattern->program;
+    offsetProgram(program, Index(source.x, 0));
+
+    std::vector<int> inputs;
+    for (auto const& instruction : program.code_)
+    {
+      if (instruction.op_ != Program::Cell)
+        continue;
+
+      const int x = instruction.cell_.x_;
+      if (x < 0 || x >= doc.width_ || x == source.x || findColumnFormula(doc, x))
+        return;
+
+      if (std::find(inputs.begin(), inputs.end(), x) == inputs.end())
+        inputs.push_back(x);
+    }
+
+    std::vector<std::vector<double>> values(inputs.size(), std::vector<double>(FILL_BLOCK_ROWS));
+    std::vector<double const*> columns(inputs.empty() ? 1 : *std::max_element(inputs.begin(), inputs.end()) + 1, nullptr);
+    std::vector<double> out(FILL_BLOCK_ROWS);
+
+    for (std::size_t i = 0; i < inputs.size(); ++i)
+      columns[inputs[i]] = values[i].data();
+
+    for (int first = source.y + 1; first <= lastRow; first += FILL_BLOCK_ROWS)
+    {
+      const int count = std::min(FILL_BLOCK_ROWS, lastRow - first + 1);
+
+      for (std::size_t i = 0; i < inputs.size(); ++i)
+        doc.cells_.columnValues(inputs[i], first, count, values[i].data(), [] (Index const& idx, Cell & precedent) {
+          if (!precedent.evaluated)
+            evaluateCell(idx, precedent);
+
+          return precedent.value;
+        });
+
+      evaluateRows(program, columns.data(), count, out.data());
+
+      for (int row = 0; row < count; ++row)
+      {
+        Cell * target = doc.cells_.find(Index(source.x, first + row));
+        if (target && target->hasExpression() && !target->evaluated)
+        {
+          target->value = out[row];
+          target->evaluated = true;
+        }
+      }
+    }
+  }
+
+  // Recalculates what a fill changed, the formulas of a fill down a block at a time
+  static void recalculateFill(Index const& first, Index const& last, bool right, std::vector<Index> const& filled)
+  {
+    if (filled.empty())
+      return;
+
+    Document & doc = currentDoc();
+
+    recalculateFrom(filled, [&doc, first, last, right] () {
+      if (right)
+        return;
+
+      for (int x = first.x; x <= last.x; ++x)
+        evaluateFilledColumn(doc, Index(x, first.y), last.y);
+    });
+  }
+
+  void fillCells(IndexRange const& range, bool right)
+  {
+    if (range.empty() || range.first.x < 0 || range.first.y < 0 || !beginEdit())
+      return;
+
+    UndoRecord & record = addUndoRecord(EditAction::Fill, false);
+    record.position_ = right ? 1 : 0;
+    record.before_.idx_ = range.first;
+    record.after_.idx_ = range.last;
+
+    std::vector<Index> filled;
+    fillBlock(range.first, range.last, right, &record.removed_, filled);
+
+    journalEdit(record);
+    recalculateFill(range.first, range.last, right, filled);
+  }
+
+  void yankCells(IndexRange const& range)
+  {
+    Buffer const& buffer = currentBuffer();
+    Document & doc = *buffer.doc_;
+    if (doc.loading_)
+      return;
+
+    const IndexRange block = range.clip(doc.width_, getRowCount());
+    if (block.empty())
+      return;
+
+    Clip clip;
+    clip.doc_ = buffer.doc_;
+    clip.first_ = Index(block.first.x, documentRow(block.first.y));
+    clip.size_ = Index(block.width(), block.height());
+
+    if (buffer.view_)
+      for (int y = block.first.y; y <= block.last.y; ++y)
+        clip.rows_.push_back(documentRow(y));
+
+    if (!doc.paged_)
+    {
+      clip.cells_ = doc.cells_;
+      clip_ = std::move(clip);
+      return;
+    }
+
+    // A paged document has no cells to share, the block gets a document of its own
+    std::shared_ptr<Document> copy = std::make_shared<Document>();
+
+    for (int y = 0; y < clip.size_.y; ++y)
+      for (int x = 0; x < clip.size_.x; ++x)
+      {
+        uint32_t format = 0;
+        const std::string text = pagedText(doc, clip.source(x, y), &format);
+        if (text.empty())
+          continue;
+
+        Cell & cell = copy->cells_.get(Index(x, y));
+        cell.format = format;
+        cell.text = copy->strings_.intern(text);
+        parseCellText(cell, text);
+
+        // The references of the text are relative to where it is in the document
+        shareFormula(*copy, clip.source(x, y), cell);
+        if (cell.hasExpression())
+          cell.formula->origin = Index(x, y);
+      }
+
+    clip.cells_ = std::move(copy->cells_);
+    clip.doc_ = copy;
+    clip.first_ = Index(0, 0);
+    clip.rows_ = std::vector<int>();
+    clip_ = std::move(clip);
+  }
+
+  // Writes the cells of clip from dest on, as a single undoable edit that recalculates
+  // once. Formulas share the template they were yanked with, each with its own origin, and
+  // cells missing from the clip empty the ones under them.
+  static void pasteClip(Clip const& clip, Index const& dest)
+  {
+    if (clip.size_.x <= 0 || clip.size_.y <= 0 || dest.x < 0 || dest.y < 0 || !beginEdit())
+      return;
+
+    Document & doc = currentDoc();
+    CellStorage const& cells = clip.cells_;
+    CellStorage const& target = doc.cells_;
+
+    // Texts and templates yanked from another document are added to this one's
+    const bool local = clip.doc_.get() == &doc;
+    std::unordered_map<uint32_t, uint32_t> textIds;
+
+    invalidateRange(doc, dest, Index(dest.x + clip.size_.x - 1, dest.y + clip.size_.y - 1));
+
+    std::vector<Index> edited;
+
+    for (int y = 0; y < clip.size_.y; ++y)
+      for (int x = 0; x < clip.size_.x; ++x)
+      {
+        const Index idx(dest.x + x, dest.y + y);
+
+        Cell const* cell = cells.find(clip.source(x, y));
+        Cell const* existing = target.find(idx);
+        if (!cell && !existing)
+          continue;
+
+        const bool hadFormula = existing && existing->hasExpression();
+
+        // The first cell starts a new undo state, the others are merged into it
+        UndoRecord & record = addUndoRecord(EditAction::CellText, !edited.empty());
+        record.before_ = captureCell(idx);
+
+        if (!cell)
+        {
+          doc.cells_.erase(idx);
+          removePrecedents(doc, idx);
+        }
+        else
+        {
+          Cell & copy = doc.cells_.get(idx);
+          copy = *cell;
+
+          if (!local)
+          {
+            auto id = textIds.find(cell->text);
+            if (id == textIds.end())
+              id = textIds.emplace(cell->text, doc.strings_.intern(clip.doc_->strings_.str(cell->text))).first;
+
+            copy.text = id->second;
+          }
+
+          if (copy.hasExpression())
+          {
+            copy.formula->origin = idx;
+            copy.evaluated = false;
+
+            if (!local)
+              shareFormula(doc, idx, copy);
+
+            setPrecedents(doc, idx, copy);
+          }
+          else if (hadFormula)
+            removePrecedents(doc, idx);
+
+          growDocument(idx);
+        }
+
+        record.after_ = captureCell(idx);
+        edited.push_back(idx);
+      }
+
+    journalEdits(edited.size());
+
+    if (!edited.empty())
+      recalculateFrom(edited);
+  }
+
+  bool pasteCells(Index const& idx)
+  {
+    if (clip_.size_.x <= 0)
+      return false;
+
+    // Pasting into the document the cells were yanked from copies its tiles, not the clip's
+    pasteClip(clip_, idx);
+    return true;
+  }
+
+  void pasteText(Index const& idx, std::string const& text)
+  {
+    if (text.empty() || idx.x < 0 || idx.y < 0 || !beginEdit())
+      return;
+
+    Document & doc = currentDoc();
+
+    // Without a line break at the end its last line would be left out
+    std::string data = text;
+    if (data.back() != '\n')
+      data.push_back('\n');
+
+    // The lines are parsed in parallel, as a file is loaded. Cells copied from other
+    // programs are separated by tabs.
+    std::vector<ParsedChunk> chunks = splitChunks(data);
+    const char delimiter = detectDelimiter(data, "\t" + DELIMITERS.toStr());
+
+    std::vector<Scheduler::Task> tasks;
+    for (auto & chunk : chunks)
+      tasks.push_back([&chunk, delimiter] () { parseChunk(chunk, delimiter); });
+
+    Scheduler::shared().run(tasks);
+
+    Clip clip;
+    clip.doc_ = currentBuffer().doc_;
+
+    int rows = 0;
+    int columns = 0;
+
+    for (auto & chunk : chunks)
+    {
+      std::vector<uint32_t> textIds(chunk.strings_.size());
+      for (std::size_t i = 0; i < textIds.size(); ++i)
+        textIds[i] = doc.strings_.intern(chunk.strings_.str(i));
+
+      for (auto & it : chunk.cells_)
+      {
+        const Index at(it.first.x, it.first.y + rows);
+        Cell & cell = it.second;
+
+        cell.text = textIds[cell.text];
+
+        // The references of the text are relative to where it is pasted
+        shareFormula(doc, Index(idx.x + at.x, idx.y + at.y), cell);
+        if (cell.hasExpression())
+          cell.formula->origin = at;
+
+        columns = std::max(columns, at.x + 1);
+        clip.cells_.get(at) = std::move(cell);
+      }
+
+      rows += chunk.rows_;
+    }
+
+    clip.size_ = Index(columns, rows);
+    pasteClip(clip, idx);
+  }
+
+  void increaseColumnWidth(int column)
+  {
+    if (!beginEdit())
+      return;
+
+    int width = getColumnWidth(column);
+
+    changeColumnWidth(column, width + 1);
+  }
+
+  void decreaseColumnWidth(int column)
+  {
+    if (!beginEdit())
+      return;
+
+    int width = getColumnWidth(column);
+
+    if (width > 3)
+    {
+      changeColumnWidth(column, width - 1);
+    }
+  }
+
+  void fitColumns(std::vector<int> const& columns)
+  {
+    if (!beginEdit())
+      return;
+
+    Transaction transaction;
+
+    // Rows spread evenly over the document, from the header on
+    const int height = getRowCount();
+    const int step = std::max(1, height / FIT_SAMPLE_ROWS);
+
+    std::string scratch;
+    for (int column : columns)
+    {
+      std::size_t longest = 0;
+      for (int y = 0; y < height; y += step)
+        longest = std::max(longest, getCellDisplayText(Index(column, y), scratch).size());
+
+      const int width = std::max(3, (int)longest + 1);
+      if (width != getColumnWidth(column))
+        changeColumnWidth(column, width);
+    }
+  }
+
+  // Moves the indexes along with the cells, the index of a dropped column goes with it
+  static void shiftColumnIndexes(Document & doc, int Index::* axis, int first, int delta)
+  {
+    if (axis == &Index::y)
+    {
+      for (auto & index : doc.indexes_)
+        index.shiftRows(first, delta);
+
+      return;
+    }
+
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < doc.indexes_.size(); ++i)
+    {
+      ColumnIndex & index = doc.indexes_[i];
+
+      if (index.column() >= first)
+        index.setColumn(index.column() + delta);
+      else if (index.column() >= first + delta)
+        continue;
+
+      doc.indexes_[kept++] = std::move(index);
+    }
+
+    doc.indexes_.erase(doc.indexes_.begin() + kept, doc.indexes_.end());
+  }
+
+  // Sketches move along with their columns, moving rows makes them stale
+  static void shiftColumnSketches(Document & doc, int Index::* axis, int first, int delta)
+  {
+    if (axis == &Index::y)
+    {
+      for (auto & sketch : doc.sketches_)
+        sketch.stale_ = true;
+
+      return;
+    }
+
+    doc.sketches_.erase(std::remove_if(doc.sketches_.begin(), doc.sketches_.end(), [first, delta] (ColumnSketch const& sketch) {
+      return sketch.column_ < first && sketch.column_ >= first + delta;
+    }), doc.sketches_.end());
+
+    for (auto & sketch : doc.sketches_)
+      if (sketch.column_ >= first)
+        sketch.column_ += delta;
+  }
+
+  // Column formulas move along with their columns and references, a formula whose column
+  // or one of whose inputs is dropped goes with it. Moving rows makes every block stale.
+  static void shiftColumnFormulas(Document & doc, int Index::* axis, int first, int delta)
+  {
+    if (axis == &Index::y)
+    {
+      invalidateColumnFormulas(doc, -1);
+      return;
+    }
+
+    auto dropped = [first, delta] (int column) { return column < first && column >= first + delta; };
+
+    doc.columnFormulas_.erase(std::remove_if(doc.columnFormulas_.begin(), doc.columnFormulas_.end(), [&dropped] (ColumnFormula const& formula) {
+      return dropped(formula.column_) || std::any_of(formula.inputs_.begin(), formula.inputs_.end(), dropped);
+    }), doc.columnFormulas_.end());
+
+    for (auto & formula : doc.columnFormulas_)
+    {
+      if (formula.column_ >= first)
+        formula.column_ += delta;
+
+      for (auto & input : formula.inputs_)
+        if (input >= first)
+          input += delta;
+
+      for (auto & expr : formula.expression_)
+        if (expr.type_ == Expr::Cell && expr.startIndex_.x >= first)
+          expr.startIndex_.x += delta;
+
+      formula.program_ = compileExpression(formula.expression_);
+      formula.valid_.assign(formula.valid_.size(), false);
+    }
+  }
+
+  // Moves every cell and reference at or after first along axis by delta. With a negative
+  // delta, the cells in the -delta lines before first are dropped. The dependencies move
+  // the same way, so they don't have to be built again. Undo state is up to the caller.
+  static void shiftCells(int Index::* axis, int first, int delta)
+  {
+    currentDoc().cells_.shift(axis, first, delta);
+    currentDoc().dependencies_.shift(axis, first, delta, true);
+
+    for (auto & it : currentDoc().sheetDependencies_)
+      it.second.shift(axis, first, delta, false);
+
+    shiftColumnIndexes(currentDoc(), axis, first, delta);
+    shiftColumnSketches(currentDoc(), axis, first, delta);
+    shiftColumnFormulas(currentDoc(), axis, first, delta);
+    shiftFormatRules(currentDoc(), axis, first, delta);
+
+    // The ranges formulas look up in move along, so the indexes of the old ones are dropped
+    invalidateLookups(currentDoc(), -1);
+
+    // Only formulas referencing something at or after first need rewriting. When all their
+    // references move, moving the origin is enough and the template stays shared.
+    currentDoc().cells_.forEach([axis, first, delta] (Index const& idx, Cell & cell) {
+      if (!cell.hasExpression())
+        return;
+
+      Formula & formula = *cell.formula;
+      bool moved = false;
+      bool kept = false;
+
+      auto check = [&] (Index const& ref) {
+        if (ref.*axis + formula.origin.*axis >= first)
+          moved = true;
+        else
+          kept = true;
+      };
+
+      // References to other documents stay where they are
+      for (auto const& expr : formula.pattern->expression)
+      {
+        if (expr.sheet_ != Expr::NO_SHEET)
+          kept = true;
+        else if (expr.type_ == Expr::Cell || expr.type_ == Expr::Range)
+          check(expr.startIndex_);
+
+        if (expr.type_ == Expr::Range)
+          check(expr.endIndex_);
+      }
+
+      if (!moved)
+        return;
+
+      if (!kept)
+      {
+        formula.origin.*axis += delta;
+        return;
+      }
+
+      std::vector<Expr> expression = cell.expression();
+      for (auto & expr : expression)
+      {
+        if ((expr.type_ != Expr::Cell && expr.type_ != Expr::Range) || expr.sheet_ != Expr::NO_SHEET)
+          continue;
+
+        if (expr.startIndex_.*axis >= first)
+          expr.startIndex_.*axis += delta;
+
+        if (expr.type_ == Expr::Range && expr.endIndex_.*axis >= first)
+          expr.endIndex_.*axis += delta;
+      }
+
+      cell.setFormula(std::move(expression));
+      shareFormula(currentDoc(), idx, cell);
+    });
+  }
+
+  static void insertColumnAt(int column)
+  {
+    shiftCells(&Index::x, column, 1);
+    currentDoc().columns_.shift(column, 1);
+    currentDoc().width_++;
+  }
+
+  static void deleteColumnAt(int column)
+  {
+    shiftCells(&Index::x, column + 1, -1);
+    currentDoc().columns_.shift(column + 1, -1);
+    currentDoc().width_--;
+  }
+
+  // The rows no longer are the lines of the file, see reload()
+  static void insertRowAt(int row)
+  {
+    shiftCells(&Index::y, row, 1);
+    currentDoc().height_++;
+    currentDoc().fileChunks_.clear();
+    currentDoc().fileLines_ = std::vector<FileLine>();
+    currentBuffer().hidden_.shift(row, 1);
+  }
+
+  static void deleteRowAt(int row)
+  {
+    shiftCells(&Index::y, row + 1, -1);
+    currentDoc().height_--;
+    currentDoc().fileChunks_.clear();
+    currentDoc().fileLines_ = std::vector<FileLine>();
+    currentBuffer().hidden_.shift(row + 1, -1);
+  }
+
+  // Rows that move break the order of equal keys, the indexes are built again
+  static void permuteRows(int first, std::vector<uint32_t> const& order)
+  {
+    currentDoc().cells_.permuteRows(first, order);
+    currentDoc().fileChunks_.clear();
+    currentDoc().fileLines_ = std::vector<FileLine>();
+    currentBuffer().hidden_.permute(first, order);
+
+    for (auto & index : currentDoc().indexes_)
+      index.invalidate();
+
+    invalidateLookups(currentDoc(), -1);
+    invalidateColumnFormulas(currentDoc(), -1);
+  }
+
+  static std::vector<uint32_t> invertOrder(std::vector<uint32_t> const& order)
+  {
+    std::vector<uint32_t> inverse(order.size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+      inverse[order[i]] = i;
+    return inverse;
+  }
+
+  // Saves the cells a removal at position along axis drops, and every formula whose
+  // references it shifts. References into the removed line can't be shifted back.
+  static void captureRemoval(UndoRecord & record, int Index::* axis, int position)
+  {
+    CellStorage const& cells = currentDoc().cells_;
+    cells.forEach([&record, axis, position] (Index const& idx, Cell const& cell) {
+      if (idx.*axis == position)
+      {
+        record.removed_.push_back(captureCell(idx));
+        return;
+      }
+
+      for (auto const& expr : cell.expression())
+      {
+        if ((expr.type_ == Expr::Cell || expr.type_ == Expr::Range) &&
+            (expr.startIndex_.*axis >= position || expr.endIndex_.*axis >= position))
+        {
+          record.rewritten_.push_back(captureCell(idx));
+          break;
+        }
+      }
+    });
+  }
+
+  void addColumn(int column)
+  {
+    if (!beginEdit())
+      return;
+
+    column = std::min(column, currentDoc().width_ - 1);
+
+    UndoRecord & record = addUndoRecord(EditAction::AddColumn, true);
+    record.position_ = column;
+
+    insertColumnAt(column);
+    journalEdit(record);
+    recalculateShifted(&Index::x, column);
+  }
+
+  void addRow(int row)
+  {
+    if (!beginEdit())
+      return;
+
+    row = std::min(row, currentDoc().height_ - 1);
+
+    UndoRecord & record = addUndoRecord(EditAction::AddRow, true);
+    record.position_ = row + 1;
+
+    insertRowAt(row + 1);
+    journalEdit(record);
+    recalculateShifted(&Index::y, row + 1);
+  }
+
+  void removeColumn(int column)
+  {
+    if (!beginEdit())
+      return;
+
+    UndoRecord & record = addUndoRecord(EditAction::RemoveColumn, false);
+    record.position_ = column;
+    record.widthBefore_ = storedColumnWidth(column);
+    captureRemoval(record, &Index::x, column);
+
+    deleteColumnAt(column);
+    journalEdit(record);
+    recalculateShifted(&Index::x, column);
+  }
+
+  void removeRow(int row)
+  {
+    if (row < 0 || row >= getRowCount())
+      return;
+
+    if (!beginEdit())
+      return;
+
+    UndoRecord & record = addUndoRecord(EditAction::RemoveRow, false);
+    record.position_ = row;
+    captureRemoval(record, &Index::y, row);
+
+    deleteRowAt(row);
+    journalEdit(record);
+    recalculateShifted(&Index::y, row);
+  }
+
+  static void restoreCell(CellState const& state)
+  {
+    if (!state.exists_)
+    {
+      if (ColumnIndex * index = findColumnIndex(currentDoc(), state.idx_.x))
+        index->invalidate();
+
+      if (ColumnSketch * sketch = findColumnSketch(currentDoc(), state.idx_.x))
+        sketch->stale_ = true;
+
+      invalidateLookups(currentDoc(), state.idx_.x);
+      invalidateColumnFormulas(currentDoc(), state.idx_.y);
+      currentDoc().cells_.erase(state.idx_);
+      removePrecedents(currentDoc(), state.idx_);
+      return;
+    }
+
+    setText(state.idx_, state.text_);
+    getCell(state.idx_).format = state.format_;
+  }
+
+  // Sets the cells of the row at row to fields, the cells that hold what they would be set
+  // to are left as they are. The row was loaded with oldFields fields, -1 if not known,
+  // the cells past them and fields weren't in the file and stay. Adds the cells it changed
+  // to edited.
+  static void reloadRow(int row, std::vector<std::string> const& fields, int oldFields, std::vector<Index> & edited)
+  {
+    Document & doc = currentDoc();
+    const int width = std::max<int>(oldFields, fields.size());
+    std::string value;
+
+    for (int x = 0; x < width; ++x)
+    {
+      const Index idx(x, row);
+      const StrView text = x < (int)fields.size() ? StrView(fields[x]) : StrView();
+      const uint32_t format = parseFormatAndValue(text, value);
+
+      Cell const* cell = static_cast<CellStorage const&>(doc.cells_).find(idx);
+      if (cell ? cell->format == format && doc.strings_.str(cell->text) == StrView(value) : value.empty())
+        continue;
+
+      UndoRecord & record = addUndoRecord(EditAction::CellText, false);
+      record.before_ = captureCell(idx);
+
+      // Like loading, empty fields are no cells
+      if (value.empty())
+      {
+        CellState empty;
+        empty.idx_ = idx;
+        restoreCell(empty);
+      }
+      else
+        setText(idx, text.str(), true);
+
+      record.after_ = captureCell(idx);
+      journalEdit(record);
+      edited.push_back(idx);
+    }
+  }
+
+  int reload()
+  {
+    Buffer & buffer = currentBuffer();
+    Document & doc = *buffer.doc_;
+
+    if (buffer.view_ || doc.paged_ || doc.loading_ || doc.filename_.empty())
+    {
+      flashMessage("Only loaded CSV documents can be reloaded");
+      return -1;
+    }
+
+    MappedFile file;
+    if (!file.open(doc.filename_))
+    {
+      flashMessage("Could not open " + doc.filename_);
+      return -1;
+    }
+
+    const StrView data = file.data();
+    if (data.size() > 0 && !isPlainCsv(data))
+    {
+      flashMessage("Only loaded CSV documents can be reloaded");
+      return -1;
+    }
+
+    std::vector<FileChunk> chunks;
+    std::vector<FileLine> lines;
+    std::vector<ReloadRegion> regions;
+    const bool newTail = planReload(doc, data, chunks, lines, regions);
+
+    int newRows = 0;
+    for (auto const& chunk : chunks)
+      newRows += chunk.rows_;
+
+    int parsed = 0;
+    std::vector<Index> edited;
+    int shifted = -1;
+
+    if (!regions.empty())
+    {
+      if (!beginEdit())
+        return -1;
+
+      // The records of the transaction are one step, which doesn't merge with the edit before
+      Transaction transaction;
+
+      csv::Reader reader(doc.delimiter_);
+      std::vector<std::string> fields;
+
+      // From the first region down, so every region starts at its row in the file
+      for (auto const& region : regions)
+      {
+        int row = region.newStart_;
+        std::size_t step = 0;
+
+        auto removeRows = [&] () {
+          for (; step < region.steps_.size() && region.steps_[step].op_ == ReloadStep::Remove; ++step)
+          {
+            if (row >= doc.height_)
+              continue;
+
+            UndoRecord & record = addUndoRecord(EditAction::RemoveRow, false);
+            record.position_ = row;
+            captureRemoval(record, &Index::y, row);
+
+            deleteRowAt(row);
+            journalEdit(record);
+            shifted = shifted < 0 ? row : std::min(shifted, row);
+          }
+        };
+
+        // Every line of the region has a step, the rows it leaves are only passed
+        auto readLine = [&] () {
+          removeRows();
+          if (step == region.steps_.size())
+            return;
+
+          ReloadStep const& it = region.steps_[step++];
+          if (it.op_ == ReloadStep::Insert && row < doc.height_)
+          {
+            // Rows past the last one need no room
+            UndoRecord & record = addUndoRecord(EditAction::AddRow, false);
+            record.position_ = row;
+
+            insertRowAt(row);
+            journalEdit(record);
+            shifted = shifted < 0 ? row : std::min(shifted, row);
+          }
+
+          if (it.op_ != ReloadStep::Keep)
+          {
+            reloadRow(row, fields, it.fields_, edited);
+            parsed++;
+          }
+
+          row++;
+        };
+
+        reader.read(data.substr(region.bytesStart_, region.bytesEnd_ - region.bytesStart_), [&] (StrView text, bool lineEnd) {
+          fields.push_back(text.str());
+          if (!lineEnd)
+            return;
+
+          readLine();
+          fields.clear();
+        });
+
+        if (!fields.empty())
+          readLine();
+
+        fields.clear();
+        removeRows();
+      }
+    }
+
+    doc.fileChunks_ = std::move(chunks);
+    doc.fileLines_ = std::move(lines);
+    doc.fileRows_ = newRows;
+    doc.stamp_ = fileStamp(doc.filename_);
+    if (doc.following_)
+      doc.followOffset_ = wholeLines(data);
+
+    if (shifted >= 0)
+      recalculateShifted(&Index::y, shifted);
+
+    recalculateFrom(edited);
+
+    for (auto & other : documentBuffers())
+      if (other.doc_.get() == &doc && !other.view_)
+        other.cursorPos_.y = std::min(other.cursorPos_.y, std::max(doc.height_ - 1, 0));
+
+    flashMessage("Reloaded " + doc.filename_ + ", " + std::to_string(parsed) + " of " + std::to_string(newRows + (newTail ? 1 : 0)) + " rows read again");
+    return parsed;
+  }
+
+  // Empties what fillBlock() wrote and puts back the cells it replaced
+  static void revertFill(UndoRecord const& record)
+  {
+    Document & doc = currentDoc();
+    CellStorage const& cells = doc.cells_;
+
+    const Index first = record.before_.idx_;
+    const Index last = record.after_.idx_;
+    const bool right = record.position_ == 1;
+
+    invalidateRange(doc, first, last);
+
+    const Index step = right ? Index(1, 0) : Index(0, 1);
+    const int end = right ? last.x : last.y;
+    const int lines = right ? last.y - first.y + 1 : last.x - first.x + 1;
+
+    std::vector<Index> changed;
+
+    for (int line = 0; line < lines; ++line)
+    {
+      const Index source = right ? Index(first.x, first.y + line) : Index(first.x + line, first.y);
+
+      for (Index idx = fillStart(doc, source, step); (right ? idx.x : idx.y) <= end; idx.x += step.x, idx.y += step.y)
+      {
+        if (!cells.find(idx))
+          continue;
+
+        doc.cells_.erase(idx);
+        removePrecedents(doc, idx);
+        changed.push_back(idx);
+      }
+    }
+
+    for (auto const& state : record.removed_)
+    {
+      restoreCell(state);
+      changed.push_back(state.idx_);
+    }
+
+    if (!changed.empty())
+      recalculateFrom(changed);
+  }
+
+  // Reverts a single record. Returns true when the document has to be fully recalculated.
+  static bool revertRecord(UndoRecord const& record)
+  {
+    switch (record.action_)
+    {
+      case EditAction::CellText:
+        restoreCell(record.before_);
+        recalculateFrom(record.before_.idx_);
+        return false;
+
+      case EditAction::ColumnWidth:
+        restoreColumnWidth(record.position_, record.widthBefore_);
+        return false;
+
+      case EditAction::AddColumn:
+        deleteColumnAt(record.position_);
+        return true;
+
+      case EditAction::AddRow:
+        deleteRowAt(record.position_);
+        return true;
+
+      case EditAction::RemoveColumn:
+        insertColumnAt(record.position_);
+        restoreColumnWidth(record.position_, record.widthBefore_);
+        break;
+
+      case EditAction::RemoveRow:
+        insertRowAt(record.position_);
+        break;
+
+      case EditAction::SortRows:
+        permuteRows(record.position_, invertOrder(record.order_));
+        return true;
+
+      case EditAction::Fill:
+        revertFill(record);
+        return false;
+    }
+
+    for (auto const& state : record.removed_)
+      restoreCell(state);
+
+    for (auto const& state : record.rewritten_)
+      restoreCell(state);
+
+    return true;
+  }
+
+  // Applies a single record again. Returns true when the document has to be fully recalculated.
+  static bool replayRecord(UndoRecord const& record)
+  {
+    switch (record.action_)
+    {
+      case EditAction::CellText:
+        restoreCell(record.after_);
+        recalculateFrom(record.after_.idx_);
+        return false;
+
+      case EditAction::ColumnWidth:
+        restoreColumnWidth(record.position_, record.widthAfter_);
+        return false;
+
+      case EditAction::AddColumn:
+        insertColumnAt(record.position_);
+        break;
+
+      case EditAction::AddRow:
+        insertRowAt(record.position_);
+        break;
+
+      case EditAction::RemoveColumn:
+        deleteColumnAt(record.position_);
+        break;
+
+      case EditAction::RemoveRow:
+        deleteRowAt(record.position_);
+        break;
+
+      case EditAction::SortRows:
+        permuteRows(record.position_, record.order_);
+        break;
+
+      case EditAction::Fill:
+        {
+          std::vector<Index> filled;
+          fillBlock(record.before_.idx_, record.after_.idx_, record.position_ == 1, nullptr, filled);
+          recalculateFill(record.before_.idx_, record.after_.idx_, record.position_ == 1, filled);
+        }
+        return false;
+    }
+
+    return true;
+  }
+
+  // Restores the cursor and document size stored in state, and leaves the ones from
+  // before the records were applied in their place
+  static void swapUndoPosition(UndoState & state, Index const& size)
+  {
+    Document & doc = currentDoc();
+
+    doc.width_ = state.size_.x;
+    doc.height_ = state.size_.y;
+    state.size_ = size;
+
+    std::swap(cursorPos(), state.cursor_);
+  }
+
+  // Journals the records of an undone or redone state, in the order they were applied
+  static void journalUndoState(UndoState const& state, bool reverted)
+  {
+    currentDoc().modified_ = true;
+    currentDoc().changes_++;
+
+    if (!JOURNAL.toBool())
+      return;
+
+    std::string entries;
+
+    if (reverted)
+    {
+      for (auto it = state.records_.rbegin(); it != state.records_.rend(); ++it)
+        journalRecord(entries, *it, true);
+    }
+    else
+    {
+      for (auto const& record : state.records_)
+        journalRecord(entries, record, false);
+    }
+
+    journalSize(entries);
+    journal(entries);
+  }
+
+  // Reads the entries journal() writes
+  class JournalReader
+  {
+    public:
+      explicit JournalReader(StrView data) : data_(data) { }
+
+      bool atEnd() const { return pos_ >= data_.size(); }
+      std::size_t position() const { return pos_; }
+
+      bool read(char & ch)
+      {
+        if (atEnd())
+          return false;
+
+        ch = data_[pos_++];
+        return true;
+      }
+
+      bool expect(char ch)
+      {
+        char next;
+        return read(next) && next == ch;
+      }
+
+      bool readInt(long long & value)
+      {
+        if (!expect(' '))
+          return false;
+
+        const bool negative = pos_ < data_.size() && data_[pos_] == '-';
+        if (negative)
+          pos_++;
+
+        const std::size_t start = pos_;
+        value = 0;
+
+        while (pos_ < data_.size() && isDigit(data_[pos_]))
+          value = value * 10 + (data_[pos_++] - '0');
+
+        if (negative)
+          value = -value;
+
+        return pos_ > start;
+      }
+
+      template <typename T>
+      bool readInt(T & value)
+      {
+        long long number;
+        if (!readInt(number))
+          return false;
+
+        value = (T)number;
+        return true;
+      }
+
+      bool readText(std::string & text)
+      {
+        std::size_t length;
+        if (!readInt(length) || !expect(' ') || length > data_.size() - pos_)
+          return false;
+
+        text.assign(data_.data() + pos_, length);
+        pos_ += length;
+        return true;
+      }
+
+    private:
+      StrView data_;
+      std::size_t pos_ = 0;
+  };
+
+  static bool readJournalCell(JournalReader & reader, CellState & state)
+  {
+    return reader.readInt(state.idx_.x) && reader.readInt(state.idx_.y) && reader.readInt(state.exists_) &&
+           reader.readInt(state.format_) && reader.readText(state.text_);
+  }
+
+  static bool readJournalCells(JournalReader & reader, std::vector<CellState> & states)
+  {
+    std::size_t count;
+    if (!reader.readInt(count))
+      return false;
+
+    states.resize(count);
+    for (auto & state : states)
+      if (!readJournalCell(reader, state))
+        return false;
+
+    return true;
+  }
+
+  static bool readJournalRecord(JournalReader & reader, UndoRecord & record)
+  {
+    int action;
+    if (!reader.readInt(action) || action < (int)EditAction::CellText || action > (int)EditAction::Fill)
+      return false;
+
+    record.action_ = (EditAction)action;
+
+    if (!reader.readInt(record.position_) || !reader.readInt(record.widthBefore_) || !reader.readInt(record.widthAfter_) ||
+        !readJournalCell(reader, record.before_) || !readJournalCell(reader, record.after_) ||
+        !readJournalCells(reader, record.removed_) || !readJournalCells(reader, record.rewritten_))
+      return false;
+
+    std::size_t count;
+    if (!reader.readInt(count))
+      return false;
+
+    record.order_.resize(count);
+    for (auto & row : record.order_)
+      if (!reader.readInt(row))
+        return false;
+
+    return reader.expect('\n');
+  }
+
+  // An undo state is written as a P entry with its cursor, size, action and record count,
+  // followed by its records as journalRecord() writes them
+  static void writeUndoState(std::string & out, UndoState const& state)
+  {
+    out.push_back('P');
+    journalInt(out, state.cursor_.x);
+    journalInt(out, state.cursor_.y);
+    journalInt(out, state.size_.x);
+    journalInt(out, state.size_.y);
+    journalInt(out, (int)state.action_);
+    journalInt(out, state.records_.size());
+    out.push_back('\n');
+
+    for (auto const& record : state.records_)
+      journalRecord(out, record, false);
+  }
+
+  static bool readUndoState(JournalReader & reader, UndoState & state)
+  {
+    int action;
+    std::size_t count;
+
+    if (!reader.expect('P') || !reader.readInt(state.cursor_.x) || !reader.readInt(state.cursor_.y) ||
+        !reader.readInt(state.size_.x) || !reader.readInt(state.size_.y) || !reader.readInt(action) ||
+        !reader.readInt(count) || !reader.expect('\n') || action < (int)EditAction::CellText || action > (int)EditAction::Fill)
+      return false;
+
+    state.action_ = (EditAction)action;
+    state.records_.resize(count);
+
+    for (auto & record : state.records_)
+      if (!reader.expect('R') || !readJournalRecord(reader, record))
+        return false;
+
+    state.bytes_ = undoStateBytes(state);
+    return true;
+  }
+
+  static bool readSpilledState(UndoSpill & spill, std::pair<long, std::size_t> const& location, std::string & entry)
+  {
+    entry.assign(location.second, '\0');
+    return fseek(spill.file_, location.first, SEEK_SET) == 0 && fread(&entry[0], 1, entry.size(), spill.file_) == entry.size();
+  }
+
+  static void spillUndoState(Buffer & buffer, UndoState const& state)
+  {
+    if (!buffer.undoSpill_)
+    {
+      std::unique_ptr<UndoSpill> spill(new UndoSpill());
+      spill->file_ = tmpfile();
+
+      if (!spill->file_)
+      {
+        logError("Could not create a file for the undo history, dropping the oldest states instead");
+        return;
+      }
+
+      buffer.undoSpill_ = std::move(spill);
+    }
+
+    UndoSpill & spill = *buffer.undoSpill_;
+
+    std::string entry;
+    writeUndoState(entry, state);
+
+    // Writes always go to the end of what is still in use, see restoreUndoState()
+    const long offset = spill.states_.empty() ? 0 : spill.states_.back().first + spill.states_.back().second;
+
+    if (fseek(spill.file_, offset, SEEK_SET) != 0 || fwrite(entry.data(), 1, entry.size(), spill.file_) != entry.size())
+    {
+      logError("Could not write to the undo history file, dropping the oldest state");
+      return;
+    }
+
+    spill.states_.emplace_back(offset, entry.size());
+  }
+
+  // Reads the newest spilled state back, returns false if there is none
+  static bool restoreUndoState(Buffer & buffer)
+  {
+    if (!buffer.undoSpill_ || buffer.undoSpill_->states_.empty())
+      return false;
+
+    UndoSpill & spill = *buffer.undoSpill_;
+
+    const std::pair<long, std::size_t> location = spill.states_.back();
+    spill.states_.pop_back();
+
+    std::string entry;
+    if (!readSpilledState(spill, location, entry))
+    {
+      logError("Could not read the undo history file");
+      return false;
+    }
+
+    JournalReader reader(entry);
+    UndoState state(Index(), Index(), EditAction::CellText);
+
+    if (!readUndoState(reader, state))
+    {
+      logError("The undo history file is damaged");
+      return false;
+    }
+
+    buffer.undoBytes_ += state.bytes_;
+    buffer.undoStack_.push_front(std::move(state));
+    return true;
+  }
+
+  // Drops, or spills, the oldest undo states until buffer is within the limits. The state
+  // edits are recorded into is always kept.
+  static void trimUndoHistory(Buffer & buffer)
+  {
+    const std::size_t maxSteps = std::max(UNDO_MAX_STEPS.toInt(), 0);
+    const std::size_t memoryLimit = std::max(UNDO_MEMORY_LIMIT.toInt(), 0);
+
+    while (buffer.undoStack_.size() > 1 &&
+           ((maxSteps > 0 && buffer.undoStack_.size() > maxSteps) || (memoryLimit > 0 && buffer.undoBytes_ > memoryLimit)))
+    {
+      UndoState & oldest = buffer.undoStack_.front();
+
+      if (UNDO_SPILL.toBool())
+        spillUndoState(buffer, oldest);
+
+      buffer.undoBytes_ -= oldest.bytes_;
+      buffer.undoStack_.pop_front();
+    }
+  }
+
+  // Applies the edits journaled since the current document was last saved, up to the
+  // last complete entry, and continues the journal from there
+  static void replayJournal()
+  {
+    Document & doc = currentDoc();
+    if (!JOURNAL.toBool())
+      return;
+
+    const std::string filename = journalFilename(doc.filename_);
+    const std::string header = journalHeader(doc.filename_);
+
+    MappedFile file;
+    if (!file.open(filename))
+      return;
+
+    const StrView data = file.data();
+    if (data.substr(0, header.size()) != StrView(header))
+    {
+      logWarning("Ignoring journal '", filename, "', it was not written for this version of the document");
+      return;
+    }
+
+    JournalReader reader(data.substr(header.size()));
+    std::size_t complete = 0;
+    int edits = 0;
+
+    while (!reader.atEnd())
+    {
+      char kind;
+      reader.read(kind);
+
+      if (kind == 'S')
+      {
+        Index size;
+        if (!reader.readInt(size.x) || !reader.readInt(size.y) || !reader.expect('\n'))
+          break;
+
+        doc.width_ = size.x;
+        doc.height_ = size.y;
+      }
+      else
+      {
+        // A crash may have cut the last entry short
+        UndoRecord record;
+        if ((kind != 'R' && kind != 'U') || !readJournalRecord(reader, record))
+          break;
+
+        if (kind == 'R')
+          replayRecord(record);
+        else
+          revertRecord(record);
+
+        edits++;
+      }
+
+      complete = reader.position();
+    }
+
+    // The journal is started again with just the complete entries, it is the same file
+    const std::string entries = data.substr(header.size(), complete).str();
+    file.close();
+
+    doc.journal_.reset(new Journal());
+    if (!doc.journal_->open(filename, header + entries))
+      logError("Could not create journal for '", doc.filename_, "'");
+
+    if (edits == 0)
+      return;
+
+    doc.modified_ = true;
+    recalculateDocument();
+
+    logInfo("Recovered ", edits, " edits of ", doc.filename_, " from its journal");
+    flashMessage("Recovered " + std::to_string(edits) + " unsaved edits");
+  }
+
+  bool undo()
+  {
+    Buffer & buffer = currentBuffer();
+
+    if (buffer.undoStack_.empty() && !restoreUndoState(buffer))
+      return false;
+
+    beginEdit();
+
+    UndoState state = std::move(buffer.undoStack_.back());
+    buffer.undoStack_.pop_back();
+    buffer.undoBytes_ -= state.bytes_;
+
+    const Index size(currentDoc().width_, currentDoc().height_);
+
+    bool recalculate = false;
+    for (auto it = state.records_.rbegin(); it != state.records_.rend(); ++it)
+      recalculate = revertRecord(*it) || recalculate;
+
+    swapUndoPosition(state, size);
+    journalUndoState(state, true);
+
+    if (recalculate)
+    {
+      recalculateDocument();
+    }
+
+    buffer.redoStack_.push_back(std::move(state));
+    return true;
+  }
+
+  bool redo()
+  {
+    Buffer & buffer = currentBuffer();
+
+    if (buffer.redoStack_.empty())
+      return false;
+
+    beginEdit();
+
+    UndoState state = std::move(buffer.redoStack_.back());
+    buffer.redoStack_.pop_back();
+
+    const Index size(currentDoc().width_, currentDoc().height_);
+
+    bool recalculate = false;
+    for (auto const& record : state.records_)
+      recalculate = replayRecord(record) || recalculate;
+
+    swapUndoPosition(state, size);
+    journalUndoState(state, false);
+
+    if (recalculate)
+    {
+      recalculateDocument();
+    }
+
+    buffer.undoBytes_ += state.bytes_;
+    buffer.undoStack_.push_back(std::move(state));
+    return true;
+  }
+
+  // -- Sessions --
+
+  // A session file holds the open buffers. It starts with a manifest in the journal's
+  // notation, after a line with its size:
+  //
+  //   D kind filename modified binary readOnly delimiter stamp offset size formulaCount {column expression}
+  //   B document view cursor scroll selectionStart selectionEnd rowCount rows undoCount redoCount
+  //     the undo states, oldest first, then the redo states, as writeUndoState() writes them
+  //   C current buffer
+  //
+  // A D entry is a document. Kind 0 is one stored as a ZUM2 image, from offset in the
+  // images, which start 8 byte aligned after the manifest, and keep the formula values
+  // and indexes. A paged document, kind 1, is opened from its file again. Each B entry is
+  // a buffer showing the document of its index, a view with its rows.
+  static const char * SESSION_HEADER = "ZUMSESSION 1";
+
+  static void journalIndex(std::string & out, Index const& idx)
+  {
+    journalInt(out, idx.x);
+    journalInt(out, idx.y);
+  }
+
+  static bool readIndex(JournalReader & reader, Index & idx)
+  {
+    return reader.readInt(idx.x) && reader.readInt(idx.y);
+  }
+
+  bool saveSession(std::string const& filename)
+  {
+    std::vector<Document *> documents;
+    std::string manifest;
+    std::vector<std::string> images;
+    uint64_t imageOffset = 0;
+
+    for (Buffer & buffer : documentBuffers())
+    {
+      Document & doc = *buffer.doc_;
+      if (doc.loading_ || std::find(documents.begin(), documents.end(), &doc) != documents.end())
+        continue;
+
+      const int kind = doc.paged_ ? 1 : 0;
+      std::string image;
+
+      if (kind == 0)
+      {
+        // The image isn't saved to again, where its blocks went doesn't matter
+        image = filename + "." + std::to_string(documents.size()) + ".tmp";
+        SavedLayout layout;
+        if (!saveZum2(DocumentSnapshot(doc), image, saveCodec(), layout))
+        {
+          remove(image.c_str());
+          for (auto const& it : images)
+            remove(it.c_str());
+
+          logError("Could not write the session image of '", doc.filename_, "'");
+          return false;
+        }
+      }
+
+      const uint64_t size = kind == 0 ? (uint64_t)fileStamp(image).size_ : 0;
+
+      manifest.push_back('D');
+      journalInt(manifest, kind);
+      journalText(manifest, doc.filename_);
+      journalInt(manifest, doc.modified_);
+      journalInt(manifest, doc.binary_);
+      journalInt(manifest, doc.readOnly_);
+      journalInt(manifest, doc.delimiter_);
+      journalInt(manifest, doc.stamp_.size_);
+      journalInt(manifest, doc.stamp_.time_);
+      journalInt(manifest, imageOffset);
+      journalInt(manifest, size);
+
+      journalInt(manifest, doc.columnFormulas_.size());
+      for (auto const& formula : doc.columnFormulas_)
+      {
+        journalInt(manifest, formula.column_);
+        journalText(manifest, exprToString(formula.expression_));
+      }
+
+      manifest.push_back('\n');
+
+      documents.push_back(&doc);
+      if (kind == 0)
+        images.push_back(image);
+
+      imageOffset += zum2::align(size);
+    }
+
+    std::string entry;
+    for (Buffer & buffer : documentBuffers())
+    {
+      const auto document = std::find(documents.begin(), documents.end(), buffer.doc_.get());
+      if (document == documents.end())
+        continue;
+
+      const std::size_t spilled = buffer.undoSpill_ ? buffer.undoSpill_->states_.size() : 0;
+
+      manifest.push_back('B');
+      journalInt(manifest, document - documents.begin());
+      journalInt(manifest, buffer.view_);
+      journalIndex(manifest, buffer.cursorPos_);
+      journalIndex(manifest, buffer.scroll_);
+      journalIndex(manifest, buffer.selectionStart_);
+      journalIndex(manifest, buffer.selectionEnd_);
+
+      journalInt(manifest, buffer.rows_.size());
+      for (int row : buffer.rows_)
+        journalInt(manifest, row);
+
+      journalInt(manifest, spilled + buffer.undoStack_.size());
+      journalInt(manifest, buffer.redoStack_.size());
+      manifest.push_back('\n');
+
+      for (std::size_t i = 0; i < spilled; ++i)
+      {
+        if (!readSpilledState(*buffer.undoSpill_, buffer.undoSpill_->states_[i], entry))
+        {
+          for (auto const& it : images)
+            remove(it.c_str());
+
+          logError("Could not read the undo history file");
+          return false;
+        }
+
+        manifest += entry;
+      }
+
+      for (auto const& state : buffer.undoStack_)
+        writeUndoState(manifest, state);
+
+      for (auto const& state : buffer.redoStack_)
+        writeUndoState(manifest, state);
+    }
+
+    manifest.push_back('C');
+    journalInt(manifest, currentBufferIndex_);
+    manifest.push_back('\n');
+
+    const std::string temporary = filename + ".tmp";
+    FILE * file = fopen(temporary.c_str(), "wb");
+    bool ok = file != nullptr;
+
+    if (ok)
+    {
+      std::string header(SESSION_HEADER);
+      journalInt(header, manifest.size());
+      header.push_back('\n');
+      header += manifest;
+
+      uint64_t offset = 0;
+      writePadded(file, header.data(), header.size(), offset);
+
+      for (auto const& image : images)
+      {
+        MappedFile mapped;
+        ok = ok && mapped.open(image);
+        if (ok)
+          writePadded(file, mapped.data().data(), mapped.data().size(), offset);
+      }
+
+      ok = ok && ferror(file) == 0 && syncFile(file);
+      fclose(file);
+    }
+
+    for (auto const& image : images)
+      remove(image.c_str());
+
+    if (!ok || !replaceFile(temporary, filename))
+    {
+      remove(temporary.c_str());
+      logError("Could not write the session '", filename, "'");
+      return false;
+    }
+
+    logInfo("Saved ", (int)documentBuffers().size(), " buffers to the session '", filename, "'");
+    return true;
+  }
+
+  // Opens the document of a D entry into a new buffer. Returns false if the entry is
+  // damaged, document is left empty if the document can't be opened.
+  static bool restoreSessionDocument(JournalReader & reader, StrView images, std::shared_ptr<Document> & document)
+  {
+    int kind;
+    std::string filename;
+    bool modified, binary, readOnly;
+    int delimiter;
+    FileStamp stamp;
+    uint64_t offset, size;
+    std::size_t formulaCount;
+
+    if (!reader.readInt(kind) || !reader.readText(filename) || !reader.readInt(modified) || !reader.readInt(binary) ||
+        !reader.readInt(readOnly) || !reader.readInt(delimiter) || !reader.readInt(stamp.size_) || !reader.readInt(stamp.time_) ||
+        !reader.readInt(offset) || !reader.readInt(size) || !reader.readInt(formulaCount))
+      return false;
+
+    std::vector<std::pair<int, std::string>> formulas(formulaCount);
+    for (auto & formula : formulas)
+      if (!reader.readInt(formula.first) || !reader.readText(formula.second))
+        return false;
+
+    if (!reader.expect('\n'))
+      return false;
+
+    const std::size_t buffers = documentBuffers().size();
+    bool opened = false;
+
+    if (kind == 1)
+      opened = isColumnarFile(filename) ? openColumnar(filename) : openPaged(filename, (char)delimiter);
+    else if (kind == 0 && offset <= images.size() && size <= images.size() - offset)
+      opened = loadZum2(images.substr(offset, size));
+
+    if (opened)
+    {
+      Document & doc = currentDoc();
+      doc.filename_ = filename;
+      doc.modified_ = modified;
+      doc.binary_ = binary;
+      doc.readOnly_ = readOnly;
+      doc.delimiter_ = (char)delimiter;
+
+      // Opening the file again shares the document while it is what the file holds
+      if (stamp.valid() && fileStamp(filename) == stamp)
+        doc.stamp_ = stamp;
+
+      for (auto const& formula : formulas)
+        if (!tcl::evaluate("colexpr " + Index::columnToStr(formula.first) + " {" + formula.second + "}"))
+          logWarning("Could not restore the column formula of ", Index::columnToStr(formula.first), " in '", filename, "'");
+
+      // The journal of a modified document holds what it has over its file, it goes on
+      // from there instead of starting over with the next edit
+      MappedFile journalFile;
+      const std::string header = journalHeader(filename);
+      if (modified && JOURNAL.toBool() && journalFile.open(journalFilename(filename)) && journalFile.data().substr(0, header.size()) == StrView(header))
+      {
+        const std::string entries = journalFile.data().str();
+        journalFile.close();
+
+        doc.journal_.reset(new Journal());
+        if (!doc.journal_->open(journalFilename(filename), entries))
+          logError("Could not create journal for '", filename, "'");
+      }
+
+      document = currentBuffer().doc_;
+    }
+    else
+      logWarning("Could not restore '", filename, "' of the session, its buffers are left out");
+
+    // The document goes into the buffers of its B entries
+    while (documentBuffers().size() > buffers)
+      documentBuffers().erase(documentBuffers().size() - 1);
+
+    return true;
+  }
+
+  // Reads a B entry into a new buffer of the given documents
+  static bool restoreSessionBuffer(JournalReader & reader, std::vector<std::shared_ptr<Document>> const& documents)
+  {
+    std::size_t document, rowCount, undoCount, redoCount;
+    Buffer buffer;
+
+    if (!reader.readInt(document) || !reader.readInt(buffer.view_) || !readIndex(reader, buffer.cursorPos_) ||
+        !readIndex(reader, buffer.scroll_) || !readIndex(reader, buffer.selectionStart_) || !readIndex(reader, buffer.selectionEnd_) ||
+        !reader.readInt(rowCount) || document >= documents.size())
+      return false;
+
+    buffer.rows_.resize(rowCount);
+    for (int & row : buffer.rows_)
+      if (!reader.readInt(row))
+        return false;
+
+    if (!reader.readInt(undoCount) || !reader.readInt(redoCount) || !reader.expect('\n'))
+      return false;
+
+    for (std::size_t i = 0; i < undoCount + redoCount; ++i)
+    {
+      UndoState state(Index(), Index(), EditAction::CellText);
+      if (!readUndoState(reader, state))
+        return false;
+
+      if (i < undoCount)
+      {
+        buffer.undoBytes_ += state.bytes_;
+        buffer.undoStack_.push_back(std::move(state));
+      }
+      else
+        buffer.redoStack_.push_back(std::move(state));
+    }
+
+    // A document that couldn't be opened again drops its buffers
+    if (!documents[document])
+      return true;
+
+    buffer.doc_ = documents[document];
+    trimUndoHistory(buffer);
+
+    documentBuffers().push_back(std::move(buffer));
+    return true;
+  }
+
+  bool restoreSession(std::string const& filename)
+  {
+    MappedFile file;
+    if (!file.open(filename))
+    {
+      logError("Could not open the session '", filename, "'");
+      return false;
+    }
+
+    const StrView data = file.data();
+    const std::size_t headerLength = strlen(SESSION_HEADER);
+
+    std::size_t manifestSize = 0;
+
+    if (data.substr(0, headerLength) != StrView(SESSION_HEADER) || !(JournalReader(data.substr(headerLength)).readInt(manifestSize)))
+    {
+      logError("'", filename, "' is not a session");
+      return false;
+    }
+
+    const std::size_t lineEnd = data.find('\n');
+    if (lineEnd == StrView::npos || manifestSize > data.size() - lineEnd - 1)
+    {
+      logError("The session '", filename, "' is damaged");
+      return false;
+    }
+
+    const StrView manifest = data.substr(lineEnd + 1, manifestSize);
+    const std::size_t imagesStart = std::min(data.size(), zum2::align(lineEnd + 1 + manifestSize));
+    const StrView images = data.substr(imagesStart);
+
+    // The restored buffers go after the open ones
+    const std::size_t firstBuffer = documentBuffers().size();
+    const int previousBuffer = currentBufferIndex_;
+
+    std::vector<std::shared_ptr<Document>> documents;
+    JournalReader reader(manifest);
+    bool ok = true;
+    int current = -1;
+
+    while (ok && !reader.atEnd())
+    {
+      char kind;
+      reader.read(kind);
+
+      if (kind == 'D')
+      {
+        documents.emplace_back();
+        ok = restoreSessionDocument(reader, images, documents.back());
+      }
+      else if (kind == 'B')
+        ok = restoreSessionBuffer(reader, documents);
+      else if (kind == 'C')
+        ok = reader.readInt(current) && reader.expect('\n');
+      else
+        ok = false;
+    }
+
+    if (!ok)
+      logError("The session '", filename, "' is damaged, it is only partly restored");
+
+    if (documentBuffers().size() == firstBuffer)
+    {
+      if (documentBuffers().empty())
+        createDefaultEmpty();
+      else
+        jumpToBuffer(previousBuffer);
+
+      return false;
+    }
+
+    jumpToBuffer(current >= 0 && firstBuffer + current < documentBuffers().size() ? firstBuffer + current : firstBuffer);
+    return ok;
+  }
+
+  // -- Tcl bindings --
+
+  TCL_FUNC(newDocument, "", "Create a new empty document")
+  {
+    createDefaultEmpty();
+    return JIM_OK;
+  }
+
+  TCL_FUNC(closeBuffer, "", "Close the current buffer")
+  {
+    close();
+    return JIM_OK;
+  }
+
+  TCL_FUNC(load, "?-dir? ?-sample count? ?-columns list? ?-where clauses? filename ?pattern?", "Open a new document. With -dir the files in the directory filename that match pattern, *.csv by default, are opened as the partitions of one read-only document. With -sample a CSV file is read once for count of its rows picked at random, whose document has no name. With -columns only the columns of a CSV file in the list, each named by its header or its letter, are read, and with -where only its lines that pass the clauses, ?-noHeader? column operation value ... as filter takes them on the columns of the file. Such a document has no name.")
+  {
+    TCL_CHECK_ARGS(2, 6);
+
+    const std::string option(Jim_String(argv[1]));
+    if (option == "-columns" || option == "-where")
+    {
+      std::vector<std::string> names;
+      std::vector<std::string> where;
+
+      int i = 1;
+      for (; i + 1 < argc && (std::string(Jim_String(argv[i])) == "-columns" || std::string(Jim_String(argv[i])) == "-where"); i += 2)
+      {
+        std::vector<std::string> & list = std::string(Jim_String(argv[i])) == "-columns" ? names : where;
+        for (int item = 0; item < Jim_ListLength(interp, argv[i + 1]); ++item)
+          list.push_back(Jim_String(Jim_ListGetIndex(interp, argv[i + 1], item)));
+      }
+
+      if (i + 1 != argc || (names.empty() && where.empty()))
+      {
+        logError("load -columns and -where take a list each and are followed by the filename");
+        return JIM_ERR;
+      }
+
+      TCL_STRING_ARG(i, filename);
+      logInfo("Trying to load part of document ", filename);
+
+      const bool loaded = loadSelected(filename, names, where);
+      TCL_INT_RESULT(loaded ? 1 : 0);
+    }
+
+    if (std::string(Jim_String(argv[1])) == "-sample")
+    {
+      TCL_CHECK_ARG(4);
+      TCL_INT_ARG(2, count);
+      TCL_STRING_ARG(3, filename);
+
+      if (count < 1)
+      {
+        logError("load -sample needs a count of at least 1, not ", count);
+        return JIM_ERR;
+      }
+
+      logInfo("Trying to load a sample of document ", filename);
+
+      const bool loaded = loadSample(filename, count);
+      TCL_INT_RESULT(loaded ? 1 : 0);
+    }
+
+    if (std::string(Jim_String(argv[1])) == "-dir")
+    {
+      TCL_CHECK_ARGS(3, 4);
+      TCL_STRING_ARG(2, directory);
+      TCL_STRING_ARG(3, pattern);
+
+      logInfo("Trying to load the documents in ", directory);
+
+      const bool loaded = loadDirectory(directory, argc == 4 ? pattern : std::string("*.csv"));
+      TCL_INT_RESULT(loaded ? 1 : 0);
+    }
+
+    TCL_CHECK_ARG(2);
+    TCL_STRING_ARG(1, filename);
+
+    logInfo("Trying to load document ", filename);
+
+    const bool loaded = load(filename);
+    TCL_INT_RESULT(loaded ? 1 : 0);
+  }
+
+  TCL_FUNC(cancelLoad, "", "Cancel loading the document that is loading in the background")
+  {
+    cancelLoad();
+    return JIM_OK;
+  }
+
+  TCL_FUNC(follow, "?enable?", "Append the lines added to the CSV file of the current document as it grows. Returns 1 while the document is followed")
+  {
+    TCL_CHECK_ARGS(1, 2);
+    TCL_INT_ARG(1, enable);
+
+    if (argc == 2)
+      follow(enable != 0);
+
+    TCL_INT_RESULT(currentDoc().following_ ? 1 : 0);
+  }
+
+  TCL_FUNC(reload, "", "Apply the changes of the CSV file of the current document, reading again the rows that changed. Returns the number of rows read")
+  {
+    TCL_CHECK_ARG(1);
+
+    const int rows = reload();
+    if (rows < 0)
+      return JIM_ERR;
+
+    TCL_INT_RESULT(rows);
+  }
+
+  TCL_FUNC(save, "filename", "Save the current document. Returns 1 once it is saved, 2 while a large document is saved in the background and 0 if it can't be saved")
+  {
+    TCL_CHECK_ARG(2);
+    TCL_STRING_ARG(1, filename);
+    TCL_INT_RESULT(requestWrite(filename, false));
+  }
+
+  TCL_FUNC(export, "filename", "Export the document to a CSV file, or to a Parquet file if filename ends in .parquet. Returns 1 once it is written, 2 while a large document is written in the background and 0 if it can't be written")
+  {
+    TCL_CHECK_ARG(2);
+    TCL_STRING_ARG(1, filename);
+    TCL_INT_RESULT(requestWrite(filename, true));
+  }
+
+  TCL_SUBFUNC(session, "save",    "filename", "Writes the open buffers, their views, cursors and undo history to a session file",
+                       "restore", "filename", "Opens the buffers of a session file after the open ones")
+  {
+    enum { CMD_SAVE, CMD_RESTORE };
+
+    TCL_CHECK_ARG_DESC(1, "filename");
+    TCL_STRING_ARG(0, filename);
+
+    switch (subCommand)
+    {
+      case CMD_SAVE:
+        TCL_INT_RESULT(saveSession(filename) ? 1 : 0);
+
+      case CMD_RESTORE:
+        TCL_INT_RESULT(restoreSession(filename) ? 1 : 0);
+    }
+
+    return JIM_OK;
+  }
+
+  TCL_FUNC(nextBuffer, "", "Switch to the next open buffer")
+  {
+    nextBuffer();
+    return JIM_OK;
+  }
+
+  TCL_FUNC(prevBuffer, "", "Switch to the previous buffer")
+  {
+    previousBuffer();
+    return JIM_OK;
+  }
+
+  TCL_FUNC(currentBuffer, "?buffer?", "Returns the current buffer and optionally jumps to a specified buffer")
+  {
+    TCL_CHECK_ARGS(1, 2);
+    TCL_INT_ARG(1, buffer);
+
+    if (argc == 2)
+      jumpToBuffer(buffer);
+
+    TCL_INT_RESULT(currentBufferIndex());
+  }
+
+  TCL_FUNC(undo, "", "Undo the last command")
+  {
+    if (undo())
+      return JIM_OK;
+    return JIM_ERR;
+  }
+
+  TCL_FUNC(redo, "", "Redo the last undone command")
+  {
+    if (redo())
+      return JIM_OK;
+    return JIM_ERR;
+  }
+
+  TCL_FUNC(fit, "?columns?", "Sets the width of each of columns, or of every column, to fit the longest value of a sample of its rows")
+  {
+    TCL_CHECK_ARGS(1, 2);
+
+    std::vector<int> columns;
+    if (argc == 2)
+    {
+      const int count = Jim_ListLength(interp, argv[1]);
+      for (int i = 0; i < count; ++i)
+        columns.push_back(tcl::getColumn(interp, Jim_ListGetIndex(interp, argv[1], i)));
+    }
+    else
+      for (int x = 0; x < getColumnCount(); ++x)
+        columns.push_back(x);
+
+    fitColumns(columns);
+    return JIM_OK;
+  }
+
+  TCL_FUNC(columnCount, "", "Returns the column count of the current document")
+  {
+    TCL_INT_RESULT(currentDoc().width_);
+  }
+
+  TCL_FUNC(rowCount, "", "Returns the row count of the current document")
+  {
+    TCL_INT_RESULT(getRowCount());
+  }
+
+  TCL_FUNC(addColumn, "column", "Add a new column to the current document after the indicated column")
+  {
+    TCL_CHECK_ARG(2);
+    TCL_INT_ARG(1, column);
+
+    addColumn(column);
+    return JIM_OK;
+  }
+
+  TCL_FUNC(addRow, "row", "Add a new row to the current document after the indicated row")
+  {
+    TCL_CHECK_ARG(2);
+    TCL_INT_ARG(1, row);
+
+    addRow(row);
+    return JIM_OK;
+  }
+
+  TCL_FUNC(delimiter, "?delimiter?", "Set or return the delimiter to use in the current document")
+  {
+    TCL_CHECK_ARGS(1, 2);
+    TCL_STRING_ARG(1, delims);
+
+    if (argc == 1)
+      TCL_STRING_RESULT(std::string(1, currentDoc().delimiter_));
+    else if (argc == 2)
+    {
+      if (currentBuffer().view_)
+        materializeView(currentBuffer());
+
+      currentDoc().delimiter_ = delims.empty() ? ',' : delims.front();
+    }
+
+    return JIM_OK;
+  }
+
+  TCL_FUNC(filename, "", "Returns the filename of the current document")
+  {
+    TCL_STRING_RESULT(getFilename());
+  }
+
+  TCL_FUNC(columnWidth, "column ?width?", "This function returns and optionally sets the width of the specified column.")
+  {
+    TCL_CHECK_ARGS(2, 3);
+    TCL_INT_ARG(2, width);
+
+    const int column = tcl::getColumn(interp, argv[1]);
+
+    if (argc == 3)
+      setColumnWidth(column, width);
+
+    const int w = getColumnWidth(column);
+
+    logInfo("Column: ", column, " is ", w);
+
+    TCL_INT_RESULT(getColumnWidth(column));
+  }
+
+  TCL_FUNC(cell, "index ?value?", "Set or return the value of a particular cell in the current document")
+  {
+    TCL_CHECK_ARGS(2, 3);
+    TCL_INDEX_ARG(1, idx);
+    TCL_STRING_ARG(2, value);
+
+    if (argc == 3)
+      setCellText(idx, value);
+
+    TCL_STRING_UTF8_RESULT(getCellText(idx));
+  }
+
+  TCL_FUNC(cellValue, "index", "Returns the number in a particular cell of the current document, evaluating a formula cell")
+  {
+    TCL_CHECK_ARG(2);
+    TCL_INDEX_ARG(1, idx);
+
+    TCL_DOUBLE_RESULT(getCellValue(idx));
+  }
+
+  TCL_SUBFUNC(column, "get", "column ?-from row? ?-to row?",        "Returns the numbers of the rows of column from the first one, or row, to the last one, or row, as a list",
+                      "set", "column values ?-from row? ?-to row?", "Sets the rows of column from the first one, or row, to a list of numbers, as a single edit. With -to the rows after row are left alone.")
+  {
+    enum { CMD_GET, CMD_SET };
+
+    const int values = subCommand == CMD_SET ? 1 : 0;
+    if (argc < 1 + values)
+    {
+      Jim_WrongNumArgs(interp, 1, argv, subCommand == CMD_SET ? "column values ?-from row? ?-to row?" : "column ?-from row? ?-to row?");
+      return JIM_ERR;
+    }
+
+    const int column = tcl::getColumn(interp, argv[0]);
+    long from = 0;
+    long to = subCommand == CMD_SET ? std::numeric_limits<long>::max() : getRowCount() - 1;
+
+    for (int i = 1 + values; i < argc; i += 2)
+    {
+      const std::string option(Jim_String(argv[i]));
+      long * row = option == "-from" ? &from : option == "-to" ? &to : nullptr;
+
+      if (!row || i + 1 >= argc)
+      {
+        logError("column ", option, " is not an option, or misses its row");
+        return JIM_ERR;
+      }
+
+      if (Jim_GetLong(interp, argv[i + 1], row) != JIM_OK)
+        return JIM_ERR;
+    }
+
+    if (column < 0 || from < 0)
+    {
+      logError("column and rows must not be negative");
+      return JIM_ERR;
+    }
+
+    switch (subCommand)
+    {
+      case CMD_GET:
+        {
+          // The list takes its elements all at once instead of growing by each
+          std::vector<Jim_Obj *> numbers;
+          numbers.reserve(std::max(to - from + 1, 0L));
+
+          for (long y = from; y <= to; ++y)
+            numbers.push_back(Jim_NewDoubleObj(interp, getCellValue(Index(column, y))));
+
+          Jim_SetResult(interp, Jim_NewListObj(interp, numbers.data(), numbers.size()));
+        }
+        break;
+
+      case CMD_SET:
+        {
+          const int count = Jim_ListLength(interp, argv[1]);
+
+          std::vector<double> numbers;
+          numbers.reserve(count);
+
+          for (int i = 0; i < count && from + i <= to; ++i)
+          {
+            double number = 0.0;
+            if (Jim_GetDouble(interp, Jim_ListGetIndex(interp, argv[1], i), &number) != JIM_OK)
+              return JIM_ERR;
+
+            numbers.push_back(number);
+          }
+
+          setColumnValues(column, from, numbers);
+          Jim_SetEmptyResult(interp);
+        }
+        break;
+    }
+
+    return JIM_OK;
+  }
+
+  TCL_SUBFUNC(range, "get",   "first last",  "Returns the text of the cells from first to last as a list of rows",
+                     "set",   "first rows",  "Sets the cells from first on to a list of rows, as a single edit",
+                     "clear", "first last",  "Empties the cells from first to last, as a single edit")
+  {
+    enum { CMD_GET, CMD_SET, CMD_CLEAR };
+
+    switch (subCommand)
+    {
+      case CMD_GET:
+        {
+          TCL_CHECK_ARG_DESC(2, "first last");
+          TCL_INDEX_ARG(0, first);
+          TCL_INDEX_ARG(1, last);
+
+          const IndexRange cells(first, last);
+
+          Jim_Obj * rows = Jim_NewListObj(interp, nullptr, 0);
+
+          for (int y = cells.first.y; y <= cells.last.y; ++y)
+          {
+            Jim_Obj * row = Jim_NewListObj(interp, nullptr, 0);
+
+            for (int x = cells.first.x; x <= cells.last.x; ++x)
+            {
+              const std::string text = getCellText(Index(x, y));
+              Jim_ListAppendElement(interp, row, tcl::newStringObjUtf8(interp, text));
+            }
+
+            Jim_ListAppendElement(interp, rows, row);
+          }
+
+          Jim_SetResult(interp, rows);
+        }
+        break;
+
+      case CMD_SET:
+        {
+          TCL_CHECK_ARG_DESC(2, "first rows");
+          TCL_INDEX_ARG(0, first);
+
+          std::vector<std::vector<std::string>> values(Jim_ListLength(interp, argv[1]));
+
+          for (std::size_t y = 0; y < values.size(); ++y)
+          {
+            Jim_Obj * row = Jim_ListGetIndex(interp, argv[1], y);
+
+            values[y].resize(Jim_ListLength(interp, row));
+            for (std::size_t x = 0; x < values[y].size(); ++x)
+              values[y][x] = Jim_String(Jim_ListGetIndex(interp, row, x));
+          }
+
+          setCellTexts(first, values);
+        }
+        break;
+
+      case CMD_CLEAR:
+        {
+          TCL_CHECK_ARG_DESC(2, "first last");
+          TCL_INDEX_ARG(0, first);
+          TCL_INDEX_ARG(1, last);
+
+          clearCells(IndexRange(first, last));
+        }
+        break;
+    }
+
+    return JIM_OK;
+  }
+
+  TCL_FUNC(yank, "?first last?", "Copies the cells from first to last, or the selected ones, for paste. They share the tiles of the document until either changes them.")
+  {
+    TCL_CHECK_ARGS(1, 3);
+
+    if (argc == 2)
+    {
+      logError("yank needs both corners of the cells");
+      return JIM_ERR;
+    }
+
+    TCL_INDEX_ARG(1, first);
+    TCL_INDEX_ARG(2, last);
+
+    yankCells(argc == 3 ? IndexRange(first, last) : selectedCells());
+    return JIM_OK;
+  }
+
+  TCL_FUNC(paste, "?index?", "Pastes the cells yanked last with their top left cell at index, or the cursor, as a single edit. Formulas keep their references relative to each cell.")
+  {
+    TCL_CHECK_ARGS(1, 2);
+
+    Index idx = cursorPos();
+    if (argc == 2)
+      idx = tcl::getIndex(interp, argv[1]);
+
+    TCL_INT_RESULT(pasteCells(idx) ? 1 : 0);
+  }
+
+  TCL_FUNC(pasteText, "index text", "Pastes delimited text, a row of cells per line, with its first field at index as a single edit")
+  {
+    TCL_CHECK_ARGS(3, 3);
+    TCL_INDEX_ARG(1, idx);
+    TCL_STRING_ARG(2, text);
+
+    pasteText(idx, text);
+    return JIM_OK;
+  }
+
+  TCL_FUNC(fill, "?-down|-right? first last", "Fills the cells from first to last from the ones in the first row, or the first column with -right, as a single edit. Formulas keep their references relative to each cell, two numbers at the start continue as a series of their difference and other cells are copied.")
+  {
+    TCL_CHECK_ARGS(3, 4);
+
+    bool right = false;
+    if (argc == 4)
+    {
+      const std::string option(Jim_String(argv[1]));
+
+      if (option == "-right")
+        right = true;
+      else if (option != "-down")
+      {
+        logError("unknown fill option '", option, "'");
+        return JIM_ERR;
+      }
+    }
+
+    TCL_INDEX_ARG(argc - 2, first);
+    TCL_INDEX_ARG(argc - 1, last);
+
+    fillCells(IndexRange(first, last), right);
+    return JIM_OK;
+  }
+
+  TCL_FUNC(isReadOnly, "", "Returns true if the current document is read only")
+  {
+    TCL_INT_RESULT(isReadOnly() ? 1 : 0);
+  }
+
+  TCL_SUBFUNC(selection, "all",     "", "Returns the index of all the selected cells",
+                         "row",     "", "Returns the index of selected rows",
+                         "column",  "", "Returns the index of selected columns",
+                         "bounds",  "", "Returns the first and the last selected cell")
+  {
+    enum { CMD_ALL, CMD_ROW, CMD_COLUMN, CMD_BOUNDS };
+
+    IndexRange cells;
+
+    switch (subCommand)
+    {
+      case CMD_ALL:
+        cells = selectedCells();
+        break;
+
+      case CMD_ROW:
+        cells = selectedRows();
+        break;
+
+      case CMD_COLUMN:
+        cells = selectedColumns();
+        break;
+
+      case CMD_BOUNDS:
+        cells = selectedCells();
+        break;
+    }
+
+    Jim_Obj * list = Jim_NewListObj(interp, nullptr, 0);
+
+    auto append = [&] (Index const& idx) {
+      Jim_ListAppendElement(interp, list, tcl::newIndexObj(interp, idx));
+    };
+
+    if (subCommand == CMD_BOUNDS)
+    {
+      append(cells.first);
+      append(cells.last);
+    }
+    else
+    {
+      for (auto const& idx : cells)
+        append(idx);
+    }
+
+    Jim_SetResult(interp, list);
+    return JIM_OK;
+  }
+
+  TCL_FUNC(transaction, "script", "Evaluates script as a single edit, the document is recalculated once when it is done")
+  {
+    TCL_CHECK_ARG(2);
+
+    Transaction transaction;
+    return Jim_EvalObj(interp, argv[1]);
+  }
+
+  // Writes text with the matches of pattern, or the occurrences of term without one, replaced
+  // to out. Returns how many there were.
+  static int replaceText(StrView text, TextPattern const* pattern, std::string const& term, std::string const& replacement, std::string & out)
+  {
+    out.clear();
+    int count = 0;
+
+    if (pattern)
+    {
+      const char * last = text.begin();
+      for (std::cregex_iterator it(text.begin(), text.end(), pattern->regex()), end; it != end; ++it, ++count)
+      {
+        out.append(last, (*it)[0].first);
+        out += it->format(replacement);
+        last = (*it)[0].second;
+      }
+
+      out.append(last, text.end());
+      return count;
+    }
+
+    std::size_t last = 0;
+    for (std::size_t pos = text.find(StrView(term)); pos != StrView::npos; pos = text.find(StrView(term), last), ++count)
+    {
+      out.append(text.data() + last, pos - last);
+      out += replacement;
+      last = pos + term.size();
+    }
+
+    out.append(text.data() + last, text.size() - last);
+    return count;
+  }
+
+  TCL_FUNC(replace, "?-regexp? ?-column column? pattern replacement", "Replace pattern in the text of every cell, or of the cells in column, as a single edit. With -regexp pattern is a regular expression and replacement may refer to its groups as $1 and so on. Returns the cells changed and the occurrences replaced as a list of names and values.")
+  {
+    TCL_CHECK_ARGS(3, 6);
+
+    bool regex = false;
+    int column = -1;
+
+    int arg = 1;
+    for (; arg < argc - 2; ++arg)
+    {
+      const std::string option(Jim_String(argv[arg]));
+
+      if (option == "-regexp")
+        regex = true;
+      else if (option == "-column" && arg + 1 < argc - 2)
+      {
+        column = Index::strToColumn(Jim_String(argv[++arg]));
+        if (column < 0 || column >= getColumnCount())
+        {
+          logError("replace column ", Jim_String(argv[arg]), " out of range");
+          return JIM_ERR;
+        }
+      }
+      else
+      {
+        logError("unknown replace option '", option, "'");
+        return JIM_ERR;
+      }
+    }
+
+    const std::string term(Jim_String(argv[arg]));
+    const std::string replacement(Jim_String(argv[arg + 1]));
+
+    Buffer const& buffer = currentBuffer();
+    Document & doc = *buffer.doc_;
+
+    if (doc.loading_ || doc.paged_ || (doc.readOnly_ && !buffer.view_))
+    {
+      logError("can't replace in a document that is loading, paged or read only");
+      return JIM_ERR;
+    }
+
+    if (term.empty())
+      return JIM_OK;
+
+    // Text and numbers are looked at by the id of their interned text, formulas by their text
+    TextPattern pattern;
+    std::vector<uint8_t> matches;
+
+    if (regex)
+    {
+      if (!pattern.compile(term))
+      {
+        logError("invalid regular expression '", term, "'");
+        return JIM_ERR;
+      }
+
+      pattern.reserve(doc.strings_.size());
+    }
+    else
+      doc.search_.find(doc.strings_, term, matches);
+
+    struct Replacement
+    {
+      Index idx_;
+      std::string text_;
+    };
+
+    std::vector<Replacement> replacements;
+    long long occurrences = 0;
+
+    // The new text of every interned text that changes and the occurrences replaced in it
+    std::unordered_map<uint32_t, std::pair<std::string, int>> replaced;
+
+    CellStorage const& cells = doc.cells_;
+    const int rowCount = getRowCount();
+    const int firstColumn = column >= 0 ? column : 0;
+    const int lastColumn = column >= 0 ? column : doc.width_ - 1;
+
+    std::string scratch;
+    std::string text;
+
+    for (int y = 0; y < rowCount; ++y)
+    {
+      const int row = documentRow(y);
+
+      for (int x = firstColumn; x <= lastColumn; ++x)
+      {
+        Cell const* cell = cells.find(Index(x, row));
+        if (!cell)
+          continue;
+
+        scratch.clear();
+        if (formulaText(*cell, scratch))
+        {
+          if (regex ? !pattern.matches(scratch) : scratch.find(term) == std::string::npos)
+            continue;
+
+          occurrences += replaceText(scratch, regex ? &pattern : nullptr, term, replacement, text);
+          replacements.push_back(Replacement { Index(x, y), text });
+          continue;
+        }
+
+        const StrView cellText = doc.strings_.str(cell->text);
+        if (regex ? !pattern.matches(cell->text, cellText) : !matches[cell->text])
+          continue;
+
+        auto it = replaced.find(cell->text);
+        if (it == replaced.end())
+        {
+          const int count = replaceText(cellText, regex ? &pattern : nullptr, term, replacement, text);
+          it = replaced.emplace(cell->text, std::make_pair(text, count)).first;
+        }
+
+        occurrences += it->second.second;
+        replacements.push_back(Replacement { Index(x, y), it->second.first });
+      }
+    }
+
+    // One undo state, and one recalculation of what the cells changed affect
+    {
+      Transaction transaction;
+      for (auto const& it : replacements)
+        setCellText(it.idx_, it.text_);
+    }
+
+    Jim_Obj * list = Jim_NewListObj(interp, nullptr, 0);
+    Jim_ListAppendElement(interp, list, Jim_NewStringObj(interp, "cells", -1));
+    Jim_ListAppendElement(interp, list, Jim_NewIntObj(interp, (long long)replacements.size()));
+    Jim_ListAppendElement(interp, list, Jim_NewStringObj(interp, "occurrences", -1));
+    Jim_ListAppendElement(interp, list, Jim_NewIntObj(interp, occurrences));
+
+    Jim_SetResult(interp, list);
+    return JIM_OK;
+  }
+
+  TCL_FUNC(execWithUndoMerge, "command", "Executes the supplied command while any changes to the document are merge to the same undo state")
+  {
+    TCL_CHECK_ARG(2);
+    TCL_STRING_ARG(1, command);
+
+    forceUndoMerge_ = true;
+    tcl::evaluate(command);
+    forceUndoMerge_ = false;
+
+    return JIM_OK;
+  }
+
+  static bool isNumberComparison(FilterOp op)
+  {
+    return op == FilterOp::Greater || op == FilterOp::GreaterEqual || op == FilterOp::LessThan || op == FilterOp::LessEqual;
+  }
+
+  // Parses the number text starts with, like std::stod but without throwing
+  static bool parseLeadingNumber(StrView text, double & value)
+  {
+    // Pooled strings aren't null terminated, no number is longer than this
+    char buffer[64];
+    const std::size_t size = std::min(text.size(), sizeof(buffer) - 1);
+    memcpy(buffer, text.data(), size);
+    buffer[size] = 0;
+
+    char * end = nullptr;
+    value = strtod(buffer, &end);
+    return end != buffer;
+  }
+
+  // Compiles clause against strings, the pool of the document it filters
+  static bool compileFilterClause(StringPool const& strings, FilterClause & clause)
+  {
+    // A value that isn't in the pool can't be equal to any text cell
+    clause.valueId = StringPool::EMPTY;
+    strings.find(clause.value, clause.valueId);
+
+    if (isNumberComparison(clause.op))
+    {
+      if (!clause.value.empty() && !str::parseValue(clause.value, clause.number) && !parseLeadingNumber(clause.value, clause.number))
+      {
+        logError("could not compare with '", clause.value, "', it is not a number");
+        return false;
+      }
+    }
+
+    if (clause.op == FilterOp::Regexp || clause.op == FilterOp::NotRegexp)
+    {
+      clause.pattern = std::make_shared<TextPattern>();
+      if (!clause.pattern->compile(clause.value))
+      {
+        logError("invalid regular expression '", clause.value, "'");
+        return false;
+      }
+
+      clause.pattern->reserve(strings.size());
+    }
+
+    return true;
+  }
+
+  StrView filterDisplayText(Document const& doc, Cell & cell, std::string & scratch)
+  {
+    if (cell.type != CellType::Formula)
+      return doc.strings_.str(cell.text);
+
+    if (!cell.evaluated)
+      evaluateFormula(cell);
+
+    scratch = cell.displayValue();
+    return scratch;
+  }
+
+  // The id in the pool of doc of the text cell displays, formulas intern what they show
+  uint32_t displayTextId(Document & doc, Cell & cell, std::string & scratch)
+  {
+    return cell.type == CellType::Formula ? doc.strings_.intern(filterDisplayText(doc, cell, scratch)) : cell.text;
+  }
+
+  bool filterIncludes(FilterClause const& clause, StrView text, bool isNumber, double number, bool & include, bool quiet)
+  {
+    switch (clause.op)
+    {
+      case FilterOp::Equal:
+        include = text == clause.value;
+        break;
+
+      case FilterOp::NotEqual:
+        include = text != clause.value;
+        break;
+
+      case FilterOp::Match:
+        include = text.find(clause.value) != StrView::npos;
+        break;
+
+      case FilterOp::NoMatch:
+        include = text.find(clause.value) == StrView::npos;
+        break;
+
+      case FilterOp::Like:
+        include = query::like(text, clause.value);
+        break;
+
+      case FilterOp::NotLike:
+        include = !query::like(text, clause.value);
+        break;
+
+      case FilterOp::Regexp:
+        include = clause.pattern->matches(text);
+        break;
+
+      case FilterOp::NotRegexp:
+        include = !clause.pattern->matches(text);
+        break;
+
+      case FilterOp::Greater:
+      case FilterOp::GreaterEqual:
+      case FilterOp::LessThan:
+      case FilterOp::LessEqual:
+        {
+          static const char * OPERATORS[] = { " > ", " >= ", " < ", " <= " };
+          const int op = (int)clause.op - (int)FilterOp::Greater;
+
+          if (!isNumber && !parseLeadingNumber(text, number))
+          {
+            include = false;
+            if (clause.skipText)
+              return true;
+
+            if (!quiet)
+              logError("could not make comparison ", text, OPERATORS[op], clause.value);
+            return false;
+          }
+
+          switch (clause.op)
+          {
+            case FilterOp::Greater:       include = number > clause.number; break;
+            case FilterOp::GreaterEqual:  include = number >= clause.number; break;
+            case FilterOp::LessThan:      include = number < clause.number; break;
+            default:                      include = number <= clause.number; break;
+          }
+        }
+        break;
+    }
+
+    return true;
+  }
+
+  // Whether the zone map of the clause column rules out every row of a tile. Formulas
+  // are only known once evaluated, so tiles holding them are always looked at.
+  static bool filterSkipsZone(FilterClause const& clause, CellStorage::Zone const& zone)
+  {
+    // Empty cells never pass
+    if (zone.cells == 0)
+      return true;
+
+    if (zone.formulas)
+      return false;
+
+    switch (clause.op)
+    {
+      case FilterOp::Equal:
+        return clause.valueId == StringPool::EMPTY || !zone.mayHoldText(clause.valueId);
+
+      // Text cells are compared by the number they start with, or fail the filter
+      case FilterOp::Greater:
+        return !zone.text && zone.max <= clause.number;
+
+      case FilterOp::GreaterEqual:
+        return !zone.text && zone.max < clause.number;
+
+      case FilterOp::LessThan:
+        return !zone.text && zone.min >= clause.number;
+
+      case FilterOp::LessEqual:
+        return !zone.text && zone.min > clause.number;
+
+      default:
+        return false;
+    }
+  }
+
+  // The index of column, built first if it is stale, or nullptr if column has none
+  static ColumnIndex * useColumnIndex(Document & doc, int column)
+  {
+    ColumnIndex * index = findColumnIndex(doc, column);
+
+    if (index && index->stale())
+      index->build(doc.cells_, doc.strings_, doc.height_);
+
+    return index;
+  }
+
+  // Keeps the rows of selection that an index of the clause column has as candidates. Returns
+  // false if there is no index the clause can use, the candidates are still checked one by one.
+  static bool narrowByIndex(Document & doc, FilterClause const& clause, std::vector<int> & selection)
+  {
+    if (clause.op != FilterOp::Equal && !isNumberComparison(clause.op))
+      return false;
+
+    ColumnIndex * index = useColumnIndex(doc, clause.column);
+    if (!index)
+      return false;
+
+    std::vector<int> candidates;
+    if (clause.op == FilterOp::Equal)
+    {
+      double number = 0.0;
+      const bool isNumber = str::parseValue(clause.value, number);
+      index->findEqual(clause.value, isNumber, number, doc.strings_, candidates);
+    }
+    else if (clause.op == FilterOp::Greater || clause.op == FilterOp::GreaterEqual)
+      index->findGreater(clause.number, clause.op == FilterOp::GreaterEqual, candidates);
+    else
+      index->findLess(clause.number, clause.op == FilterOp::LessEqual, candidates);
+
+    std::sort(candidates.begin(), candidates.end());
+
+    // The rows of a document come in order, a view's rows may not
+    std::vector<int> kept;
+    if (std::is_sorted(selection.begin(), selection.end()))
+      std::set_intersection(selection.begin(), selection.end(), candidates.begin(), candidates.end(), std::back_inserter(kept));
+    else
+    {
+      std::vector<uint8_t> isCandidate(doc.height_, 0);
+      for (const int row : candidates)
+        isCandidate[row] = 1;
+
+      for (const int row : selection)
+        if (row < doc.height_ && isCandidate[row])
+          kept.push_back(row);
+    }
+
+    selection.swap(kept);
+    return true;
+  }
+
+  // The same for a partition of a paged document. A field equal to the value as text
+  // reads as the same number, so an equal filter can go by the range too.
+  static bool pagedFilterSkipsZone(FilterClause const& clause, PagedTable::Zone const& zone)
+  {
+    if (zone.fields == 0)
+      return true;
+
+    if (clause.op == FilterOp::Equal)
+    {
+      double number = 0.0;
+      return !zone.text && (!str::parseValue(clause.value, number) || number < zone.min || number > zone.max);
+    }
+
+    CellStorage::Zone cells;
+    cells.cells = zone.fields;
+    cells.numbers = zone.numbers;
+    cells.min = zone.min;
+    cells.max = zone.max;
+    cells.text = zone.text;
+    return filterSkipsZone(clause, cells);
+  }
+
+  // Filters the rows of a paged document, whose fields are compared as text
+  static bool applyPagedFilterClause(Document & doc, FilterClause const& clause, std::vector<int> & selection)
+  {
+    std::size_t kept = 0;
+
+    // The rows of a partition whose zone map rules them out are dropped without reading them
+    PagedTable::Zone zone;
+    int zoneFirst = 0;
+    int zoneEnd = 0;
+    bool skipZone = false;
+
+    for (std::size_t i = 0; i < selection.size(); ++i)
+    {
+      const int y = selection[i];
+
+      if (y < zoneFirst || y >= zoneEnd)
+      {
+        // Without a zone the row is looked at on its own
+        zoneFirst = y;
+        zoneEnd = y + 1;
+        skipZone = doc.paged_->zone(clause.column, y, zone, zoneFirst, zoneEnd) && pagedFilterSkipsZone(clause, zone);
+      }
+
+      if (skipZone)
+        continue;
+
+      const std::string text = pagedText(doc, Index(clause.column, y));
+      if (text.empty())
+        continue;
+
+      double number = 0.0;
+      const bool isNumber = text.front() != '=' && str::parseValue(text, number);
+
+      bool include = false;
+      if (!filterIncludes(clause, text, isNumber, number, include))
+        return false;
+
+      if (include)
+        selection[kept++] = y;
+    }
+
+    selection.resize(kept);
+    return true;
+  }
+
+  // Moves the count rows from rows on that pass clause to the front of them, in order,
+  // and sets kept to how many there are. With failedRow set a row that can't be compared
+  // is stored there instead of logged.
+  static bool filterRows(Document & doc, FilterClause const& clause, EncodedColumn const* encoded, int * rows, std::size_t count, std::size_t & kept, int * failedRow)
+  {
+    const bool textCompare = clause.op == FilterOp::Equal || clause.op == FilterOp::NotEqual;
+    const bool patternCompare = clause.op == FilterOp::Regexp || clause.op == FilterOp::NotRegexp;
+    std::string scratch;
+    kept = 0;
+
+    // The rows of the last encoded block looked at, rows are in order for a document
+    uint64_t mask[encoding::MASK_WORDS];
+    int maskBlock = -1;
+    bool masked = false;
+
+    // Runs of rows in the same tile are dropped at once when its zone map rules them out
+    CellStorage::Zone zone;
+    int zoneFirst = -1;
+    bool skipZone = false;
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      const int y = rows[i];
+
+      if (y < zoneFirst || y >= zoneFirst + CellStorage::TILE_HEIGHT)
+      {
+        zoneFirst = y - y % CellStorage::TILE_HEIGHT;
+        doc.cells_.zone(clause.column, y, zone);
+        skipZone = filterSkipsZone(clause, zone);
+      }
+
+      if (skipZone)
+        continue;
+
+      if (encoded)
+      {
+        if (y / encoding::BLOCK_ROWS != maskBlock)
+        {
+          maskBlock = y / encoding::BLOCK_ROWS;
+          masked = filterEncodedBlock(doc, clause, *encoded, maskBlock, mask);
+        }
+
+        if (masked)
+        {
+          if (encoding::maskHas(mask, y % encoding::BLOCK_ROWS))
+            rows[kept++] = y;
+          continue;
+        }
+      }
+
+      Cell * cell = doc.cells_.find(Index(clause.column, y));
+      if (!cell)
+        continue;
+
+      // Text and number cells display their interned text, so equality is an id compare
+      if (textCompare && cell->type != CellType::Formula)
+      {
+        if (cell->text != StringPool::EMPTY && (cell->text == clause.valueId) == (clause.op == FilterOp::Equal))
+          rows[kept++] = y;
+        continue;
+      }
+
+      // A regular expression runs once per distinct text, not once per cell showing it
+      if (patternCompare && cell->type != CellType::Formula)
+      {
+        if (cell->text != StringPool::EMPTY && clause.pattern->matches(cell->text, doc.strings_.str(cell->text)) == (clause.op == FilterOp::Regexp))
+          rows[kept++] = y;
+        continue;
+      }
+
+      const StrView text = filterDisplayText(doc, *cell, scratch);
+      if (text.empty())
+        continue;
+
+      bool include = false;
+      if (!filterIncludes(clause, text, cell->type == CellType::Number, cell->value, include, failedRow != nullptr))
+      {
+        if (failedRow)
+          *failedRow = y;
+        return false;
+      }
+
+      if (include)
+        rows[kept++] = y;
+    }
+
+    return true;
+  }
+
+  // Keeps the rows in selection that pass clause, in order. Empty cells never pass.
+  // A long selection is split into chunks filtered on the scheduler, whose kept rows
+  // are then put back together in order.
+  static bool applyFilterClause(Document & doc, FilterClause const& clause, std::vector<int> & selection)
+  {
+    if (clause.value.empty())
+    {
+      selection.clear();
+      return true;
+    }
+
+    if (doc.paged_)
+      return applyPagedFilterClause(doc, clause, selection);
+
+    narrowByIndex(doc, clause, selection);
+
+    // Rows out of order would decode a block for every row
+    const bool encode = selection.size() >= (std::size_t)encoding::BLOCK_ROWS && std::is_sorted(selection.begin(), selection.end());
+    EncodedColumn const* encoded = encode ? encodedColumn(doc, clause.column) : nullptr;
+
+    const int threads = Scheduler::shared().threadCount();
+    const std::size_t chunkCount = std::min<std::size_t>(threads * FILTER_CHUNKS_PER_THREAD, selection.size() / FILTER_CHUNK_ROWS);
+
+    std::size_t kept = 0;
+    if (threads <= 1 || chunkCount < 2)
+    {
+      const bool ok = filterRows(doc, clause, encoded, selection.data(), selection.size(), kept, nullptr);
+      selection.resize(kept);
+      return ok;
+    }
+
+    // The formulas of the column are evaluated first, the workers only read the cells,
+    // and must not copy the tiles a snapshot shares
+    doc.cells_.forEachFormula(clause.column, 0, doc.height_ - 1, [] (Index const& idx, Cell & cell) {
+      if (!cell.evaluated)
+        evaluateCell(idx, cell);
+    });
+
+    doc.cells_.unshare();
+    doc.cells_.updateSums();
+
+    std::vector<std::size_t> firsts(chunkCount + 1);
+    for (std::size_t i = 0; i <= chunkCount; ++i)
+      firsts[i] = selection.size() * i / chunkCount;
+
+    std::vector<std::size_t> chunkKept(chunkCount, 0);
+    std::vector<int> failedRows(chunkCount, -1);
+
+    std::vector<Scheduler::Task> tasks;
+    for (std::size_t i = 0; i < chunkCount; ++i)
+    {
+      tasks.push_back([&, i] () {
+        filterRows(doc, clause, encoded, selection.data() + firsts[i], firsts[i + 1] - firsts[i], chunkKept[i], &failedRows[i]);
+      });
+    }
+
+    Scheduler::shared().run(tasks);
+
+    // The first row that can't be compared is logged the way the serial filter does
+    for (std::size_t i = 0; i < chunkCount; ++i)
+      if (failedRows[i] >= 0)
+      {
+        int row = failedRows[i];
+        filterRows(doc, clause, nullptr, &row, 1, kept, nullptr);
+        return false;
+      }
+
+    for (std::size_t i = 0; i < chunkCount; ++i)
+    {
+      std::copy(selection.begin() + firsts[i], selection.begin() + firsts[i] + chunkKept[i], selection.begin() + kept);
+      kept += chunkKept[i];
+    }
+
+    selection.resize(kept);
+    return true;
+  }
+
+  // The canonical form of the clauses of a filter or a query, comparisons by the number
+  // they compare with
+  static std::string filterKey(std::vector<FilterClause> const& clauses)
+  {
+    std::string key = "filter";
+    for (auto const& clause : clauses)
+    {
+      key += " " + std::to_string(clause.column) + " " + std::to_string((int)clause.op) + (clause.skipText ? " skip " : " ");
+
+      if (isNumberComparison(clause.op) && !clause.value.empty())
+      {
+        uint64_t bits;
+        memcpy(&bits, &clause.number, sizeof(bits));
+        key += "#" + std::to_string(bits);
+      }
+      else
+        key += std::to_string(clause.value.size()) + ":" + clause.value;
+    }
+
+    return key;
+  }
+
+  // Fills selection with the document rows of the current buffer from first on that pass
+  // clauses, taken from the memoized result of the same clauses when it is current
+  static bool selectRows(Document & doc, int first, std::vector<FilterClause> const& clauses, std::vector<int> & selection)
+  {
+    const std::string key = filterKey(clauses);
+    if (!clauses.empty())
+      if (MemoizedResult const* result = findMemoizedResult(doc, key, first))
+      {
+        selection = result->rows_;
+        return true;
+      }
+
+    const int rowCount = getRowCount();
+
+    selection.clear();
+    selection.reserve(std::max(rowCount - first, 0));
+    for (int y = first; y < rowCount; ++y)
+      selection.push_back(documentRow(y));
+
+    for (auto const& it : clauses)
+      if (!applyFilterClause(doc, it, selection))
+        return false;
+
+    std::vector<int> columns;
+    for (auto const& it : clauses)
+      if (std::find(columns.begin(), columns.end(), it.column) == columns.end())
+        columns.push_back(it.column);
+
+    if (!clauses.empty())
+      if (MemoizedResult * result = memoizeResult(doc, key, first, columns))
+        result->rows_ = selection;
+
+    return true;
+  }
+
+  std::vector<std::string> stringArgs(int first, int argc, Jim_Obj * const* argv)
+  {
+    std::vector<std::string> args;
+    for (int i = first; i < argc; ++i)
+      args.emplace_back(Jim_String(argv[i]));
+
+    return args;
+  }
+
+  bool parseFilterClauses(std::vector<std::string> const& args, std::size_t first, StringPool const& strings, int columnCount, std::vector<FilterClause> & clauses)
+  {
+    static const std::pair<const char *, FilterOp> OPERATIONS[] = {
+      { "-equal", FilterOp::Equal }, { "-nequal", FilterOp::NotEqual },
+      { "-match", FilterOp::Match }, { "-nomatch", FilterOp::NoMatch },
+      { "-gt", FilterOp::Greater }, { "-ge", FilterOp::GreaterEqual },
+      { "-lt", FilterOp::LessThan }, { "-le", FilterOp::LessEqual },
+      { "-like", FilterOp::Like }, { "-nlike", FilterOp::NotLike },
+      { "-regexp", FilterOp::Regexp }, { "-nregexp", FilterOp::NotRegexp },
+    };
+
+    if (first >= args.size() || (args.size() - first) % 3 != 0)
+    {
+      logError("filter takes a column, an operation and a value for each clause");
+      return false;
+    }
+
+    for (std::size_t i = first; i < args.size(); i += 3)
+    {
+      FilterClause clause;
+
+      clause.column = Index::strToColumn(args[i]);
+      if (clause.column < 0 || (columnCount >= 0 && clause.column >= columnCount))
+      {
+        logError("filter column ", clause.column, " out of range");
+        return false;
+      }
+
+      auto found = std::find_if(std::begin(OPERATIONS), std::end(OPERATIONS), [&] (std::pair<const char *, FilterOp> const& it) {
+        return args[i + 1] == it.first;
+      });
+
+      if (found == std::end(OPERATIONS))
+      {
+        logError("unknown filter operation '", args[i + 1], "'");
+        return false;
+      }
+
+      clause.op = found->second;
+      clause.value = args[i + 2];
+      if (!compileFilterClause(strings, clause))
+        return false;
+
+      clauses.push_back(std::move(clause));
+    }
+
+    return true;
+  }
+
+  TCL_FUNC(filter, "?-noHeader? column operation value ?column operation value ...? ?-into filename | -inplace?")
+  {
+    TCL_CHECK_ARGS(4, 1000);
+
+    std::vector<std::string> args = stringArgs(1, argc, argv);
+
+    const bool copyHeader = args[0] != "-noHeader";
+
+    // With -inplace the rows that don't pass are hidden in the current buffer, the rows
+    // hidden before stay hidden
+    const bool inplace = args.back() == "-inplace";
+    if (inplace)
+      args.pop_back();
+
+    // With -into the rows are written to the file instead of shown in a view
+    std::string into;
+    if (args.size() >= 2 && args[args.size() - 2] == "-into")
+    {
+      into = args.back();
+      args.resize(args.size() - 2);
+    }
+
+    if (inplace && !into.empty())
+    {
+      logError("filter takes -into or -inplace, not both");
+      return JIM_ERR;
+    }
+
+    std::vector<FilterClause> clauses;
+    if (!parseFilterClauses(args, copyHeader ? 0 : 1, currentDoc().strings_, getColumnCount(), clauses))
+      return JIM_ERR;
+
+    Document & doc = currentDoc();
+    if (doc.loading_ || isIndexing(doc))
+    {
+      logError("can't filter a document that is still loading");
+      return JIM_ERR;
+    }
+
+    // Evaluate one clause at a time over the document rows that are still selected.
+    // Filtering a view selects from the rows the view shows.
+    std::vector<int> selection;
+    if (!selectRows(doc, copyHeader ? 1 : 0, clauses, selection))
+      return JIM_ERR;
+
+    if (!into.empty())
+    {
+      if (copyHeader && getRowCount() > 0)
+        selection.insert(selection.begin(), documentRow(0));
+
+      if (!writeCsvRowList(doc, selection, into))
+      {
+        logError("could not write '", into, "'");
+        return JIM_ERR;
+      }
+
+      Jim_SetResult(interp, Jim_NewIntObj(interp, (long long)selection.size() - (copyHeader && getRowCount() > 0)));
+      return JIM_OK;
+    }
+
+    // The result is the rows passing that are shown
+    if (inplace)
+    {
+      Jim_SetResult(interp, Jim_NewIntObj(interp, hideUnselected(selection, copyHeader ? 1 : 0)));
+      return JIM_OK;
+    }
+
+    // The result is a view on the same document, nothing is copied until it is edited
+    Buffer buffer;
+    buffer.doc_ = currentBuffer().doc_;
+    buffer.view_ = true;
+
+    buffer.rows_.reserve(selection.size() + 1);
+    if (copyHeader)
+      buffer.rows_.push_back(documentRow(0));
+    buffer.rows_.insert(buffer.rows_.end(), selection.begin(), selection.end());
+
+    documentBuffers().push_back(std::move(buffer));
+    jumpToBuffer(documentBuffers().size() - 1);
+
+    return JIM_OK;
+  }
+
+  // Fills keys with the text ids of columns in every one of rows, of doc, the current
+  // document, one row after the other. The cells are read in ranges on the scheduler, the
+  // texts formulas show are interned afterwards since that changes the pool. The fields
+  // of a paged document are interned into strings.
+  static void collectRowKeys(Document & doc, std::vector<int> const& rows, std::vector<int> const& columns, StringPool & strings, std::vector<uint32_t> & keys)
+  {
+    const std::size_t width = columns.size();
+    keys.assign(rows.size() * width, (uint32_t)StringPool::EMPTY);
+
+    if (doc.paged_)
+    {
+      for (std::size_t i = 0; i < rows.size(); ++i)
+        for (std::size_t c = 0; c < width; ++c)
+          keys[i * width + c] = strings.intern(pagedText(doc, Index(columns[c], rows[i])));
+
+      return;
+    }
+
+    const std::size_t rangeCount = std::max<std::size_t>(1, std::min<std::size_t>(rows.size() / FILTER_CHUNK_ROWS, Scheduler::shared().threadCount()));
+    std::vector<std::vector<std::size_t>> formulas(rangeCount);
+    CellStorage const& cells = doc.cells_;
+
+    std::vector<Scheduler::Task> tasks;
+    for (std::size_t r = 0; r < rangeCount; ++r)
+    {
+      tasks.push_back([&, r] () {
+        const std::size_t first = rows.size() * r / rangeCount;
+        const std::size_t last = rows.size() * (r + 1) / rangeCount;
+
+        for (std::size_t i = first; i < last; ++i)
+          for (std::size_t c = 0; c < width; ++c)
+            if (Cell const* cell = cells.find(Index(columns[c], rows[i])))
+            {
+              if (cell->hasExpression())
+                formulas[r].push_back(i * width + c);
+              else
+                keys[i * width + c] = cell->text;
+            }
+      });
+    }
+
+    Scheduler::shared().run(tasks);
+
+    std::string scratch;
+    for (auto const& range : formulas)
+      for (std::size_t key : range)
+        keys[key] = displayTextId(doc, *doc.cells_.find(Index(columns[key % width], rows[key / width])), scratch);
+  }
+
+  TCL_FUNC(dedupe, "?-noHeader? ?-columns columns?", "Opens a view of the rows of the current buffer that no earlier row equals in columns, a comma separated list, or in every column. Like a filter the view shows the rows of the same document and copies nothing.")
+  {
+    TCL_CHECK_ARGS(1, 4);
+
+    bool copyHeader = true;
+    std::vector<int> columns;
+
+    for (int i = 1; i < argc; ++i)
+    {
+      const std::string option(Jim_String(argv[i]));
+
+      if (option == "-noHeader")
+        copyHeader = false;
+      else if (option == "-columns" && i + 1 < argc)
+      {
+        std::stringstream list(Jim_String(argv[++i]));
+        std::string name;
+
+        while (std::getline(list, name, ','))
+        {
+          const int column = Index::strToColumn(name);
+          if (column < 0 || column >= getColumnCount())
+          {
+            logError("dedupe column ", name, " out of range");
+            return JIM_ERR;
+          }
+
+          columns.push_back(column);
+        }
+      }
+      else
+      {
+        logError("unknown dedupe option '", option, "'");
+        return JIM_ERR;
+      }
+    }
+
+    if (columns.empty())
+      for (int x = 0; x < getColumnCount(); ++x)
+        columns.push_back(x);
+
+    Document & doc = currentDoc();
+    if (doc.loading_ || isIndexing(doc))
+    {
+      logError("can't dedupe a document that is still loading");
+      return JIM_ERR;
+    }
+
+    const int rowCount = getRowCount();
+
+    std::vector<int> rows;
+    rows.reserve(std::max(rowCount, 0));
+    for (int y = copyHeader ? 1 : 0; y < rowCount; ++y)
+      rows.push_back(documentRow(y));
+
+    StringPool strings;
+    std::vector<uint32_t> keys;
+    collectRowKeys(doc, rows, columns, strings, keys);
+
+    const std::vector<uint32_t> first = dedupe::firstRows(keys, columns.size());
+
+    Buffer buffer;
+    buffer.doc_ = currentBuffer().doc_;
+    buffer.view_ = true;
+
+    buffer.rows_.reserve(first.size() + 1);
+    if (copyHeader && rowCount > 0)
+      buffer.rows_.push_back(documentRow(0));
+    for (uint32_t row : first)
+      buffer.rows_.push_back(rows[row]);
+
+    flashMessage(str::fromInt(rows.size() - first.size()) + " duplicate rows left out");
+
+    documentBuffers().push_back(std::move(buffer));
+    jumpToBuffer(documentBuffers().size() - 1);
+
+    return JIM_OK;
+  }
+
+  TCL_SUBFUNC(columnIndex, "create", "column", "Index the values of column for filter and gotoValue, a document saved in the binary format keeps its indexes",
+                           "drop",   "column", "Remove the index of column",
+                           "list",   "",       "Returns the indexed columns of the current document")
+  {
+    enum { CMD_CREATE, CMD_DROP, CMD_LIST };
+
+    Document & doc = currentDoc();
+
+    if (subCommand == CMD_LIST)
+    {
+      TCL_CHECK_ARG_DESC(0, "");
+
+      Jim_Obj * list = Jim_NewListObj(interp, nullptr, 0);
+      for (auto const& index : doc.indexes_)
+        Jim_ListAppendElement(interp, list, Jim_NewStringObj(interp, Index::columnToStr(index.column()).c_str(), -1));
+
+      Jim_SetResult(interp, list);
+      return JIM_OK;
+    }
+
+    TCL_CHECK_ARG_DESC(1, "column");
+
+    const int column = Index::strToColumn(Jim_String(argv[0]));
+    if (column < 0 || column >= getColumnCount())
+    {
+      logError("index column ", Jim_String(argv[0]), " out of range");
+      return JIM_ERR;
+    }
+
+    if (subCommand == CMD_DROP)
+    {
+      doc.indexes_.erase(std::remove_if(doc.indexes_.begin(), doc.indexes_.end(), [column] (ColumnIndex const& index) {
+        return index.column() == column;
+      }), doc.indexes_.end());
+
+      return JIM_OK;
+    }
+
+    if (doc.loading_ || doc.paged_)
+    {
+      logError("can't index a document that is loading or paged");
+      return JIM_ERR;
+    }
+
+    if (!findColumnIndex(doc, column))
+    {
+      doc.indexes_.emplace_back(column);
+      useColumnIndex(doc, column);
+    }
+
+    return JIM_OK;
+  }
+
+  // Summarizes column of doc, the current document, over the rows from firstRow up to
+  // rowCount in ranges on the scheduler. Rows are document rows taken from rows, a view's
+  // row table, if it is set.
+  static void summarizeColumn(Document & doc, int column, std::vector<int> const* rows, int firstRow, int rowCount, ColumnSummary & summary)
+  {
+    // The workers only read the cells
+    doc.cells_.forEachFormula(column, 0, doc.height_ - 1, [] (Index const& idx, Cell & cell) {
+      if (!cell.evaluated)
+        evaluateCell(idx, cell);
+    });
+
+    const int count = std::max(rowCount - firstRow, 0);
+    const int ranges = std::max(1, std::min(Scheduler::shared().threadCount(), count / SKETCH_RANGE_ROWS));
+    std::vector<ColumnSummary> parts(ranges);
+    CellStorage const& cells = doc.cells_;
+
+    std::vector<Scheduler::Task> tasks;
+    for (int i = 0; i < ranges; ++i)
+    {
+      tasks.push_back([&, i] () {
+        const int first = firstRow + (long long)count * i / ranges;
+        const int last = firstRow + (long long)count * (i + 1) / ranges;
+
+        for (int y = first; y < last; ++y)
+          if (Cell const* cell = cells.find(Index(column, rows ? (*rows)[y] : y)))
+            parts[i].add(*cell, doc.strings_);
+      });
+    }
+
+    Scheduler::shared().run(tasks);
+
+    summary = std::move(parts[0]);
+    for (int i = 1; i < ranges; ++i)
+      summary.merge(parts[i]);
+  }
+
+  ColumnSketch & useColumnSketch(Document & doc, int column)
+  {
+    ColumnSketch * sketch = findColumnSketch(doc, column);
+    if (!sketch)
+    {
+      doc.sketches_.emplace_back();
+      sketch = &doc.sketches_.back();
+      sketch->column_ = column;
+    }
+
+    if (sketchCurrent(doc, *sketch))
+      SKETCH_COUNTERS.hit();
+    else
+    {
+      SKETCH_COUNTERS.miss();
+      summarizeColumn(doc, column, nullptr, 1, doc.height_, sketch->summary_);
+      sketch->stale_ = false;
+      sketch->height_ = doc.height_;
+      sketch->changes_ = doc.changes_;
+      sketch->edits_ = 0;
+    }
+
+    return *sketch;
+  }
+
+  // The caches of the documents that share the app_cacheMemory budget. The styles of the
+  // cells drawn are dropped in no particular order, the pages of paged tables the least
+  // recently used first. Of the lookup indexes and the column sketches, the ones that are stale go first
+  // and then the largest, they are built again when a formula or colstats needs them.
+  static const cache::Cache STYLE_CACHE("styles", cache::Cost::DRAW, [] () {
+    std::size_t bytes = 0;
+    forEachDocument([&bytes] (Document & doc) { bytes += doc.cellStyles_.memoryUsage(); });
+    return bytes;
+  }, [] (std::size_t target) {
+    std::size_t bytes = STYLE_CACHE.bytes_();
+    forEachDocument([&bytes, target] (Document & doc) {
+      if (bytes <= target)
+        return;
+
+      const std::size_t held = doc.cellStyles_.memoryUsage();
+      doc.cellStyles_.shrink(held > bytes - target ? held - (bytes - target) : 0, [] (CachedStyle const&) { return std::size_t(0); });
+      bytes -= held - doc.cellStyles_.memoryUsage();
+    });
+  });
+
+  static const cache::Cache PAGE_CACHE("pages", cache::Cost::DECODE, [] () {
+    std::size_t bytes = 0;
+    forEachDocument([&bytes] (Document & doc) { bytes += doc.paged_ ? doc.paged_->cacheBytes() : 0; });
+    return bytes;
+  }, [] (std::size_t target) {
+    std::size_t bytes = PAGE_CACHE.bytes_();
+    forEachDocument([&bytes, target] (Document & doc) {
+      if (!doc.paged_ || bytes <= target)
+        return;
+
+      const std::size_t held = doc.paged_->cacheBytes();
+      doc.paged_->trimCache(held > bytes - target ? held - (bytes - target) : 0);
+      bytes -= held - doc.paged_->cacheBytes();
+    });
+  });
+
+  static const cache::Cache LOOKUP_CACHE("lookups", cache::Cost::SCAN, [] () {
+    std::size_t bytes = 0;
+    forEachDocument([&bytes] (Document & doc) {
+      for (auto const& it : doc.lookups_)
+        bytes += columnLookupBytes(it.second);
+    });
+    return bytes;
+  }, [] (std::size_t target) {
+    struct Entry
+    {
+      Document * doc_;
+      std::tuple<int, int, int> key_;
+      bool stale_;
+      std::size_t bytes_;
+    };
+
+    std::vector<Entry> entries;
+    std::size_t bytes = 0;
+    forEachDocument([&entries, &bytes] (Document & doc) {
+      for (auto const& it : doc.lookups_)
+      {
+        bytes += columnLookupBytes(it.second);
+        if (!it.second.building_)
+          entries.push_back(Entry { &doc, it.first, !lookupCurrent(doc, it.second), columnLookupBytes(it.second) });
+      }
+    });
+
+    std::sort(entries.begin(), entries.end(), [] (Entry const& lhs, Entry const& rhs) {
+      return lhs.stale_ != rhs.stale_ ? lhs.stale_ : lhs.bytes_ > rhs.bytes_;
+    });
+
+    for (auto const& entry : entries)
+    {
+      if (bytes <= target)
+        break;
+
+      std::lock_guard<std::recursive_mutex> lock(entry.doc_->lookupMutex_);
+      entry.doc_->lookups_.erase(entry.key_);
+      bytes -= entry.bytes_;
+    }
+  });
+
+  static const cache::Cache SKETCH_CACHE("sketches", cache::Cost::SCAN, [] () {
+    std::size_t bytes = 0;
+    forEachDocument([&bytes] (Document & doc) {
+      for (auto const& sketch : doc.sketches_)
+        bytes += columnSketchBytes(sketch);
+    });
+    return bytes;
+  }, [] (std::size_t target) {
+    std::size_t bytes = SKETCH_CACHE.bytes_();
+    forEachDocument([&bytes, target] (Document & doc) {
+      std::stable_sort(doc.sketches_.begin(), doc.sketches_.end(), [&doc] (ColumnSketch const& lhs, ColumnSketch const& rhs) {
+        const bool lhsStale = !sketchCurrent(doc, lhs);
+        const bool rhsStale = !sketchCurrent(doc, rhs);
+        return lhsStale != rhsStale ? lhsStale : columnSketchBytes(lhs) > columnSketchBytes(rhs);
+      });
+
+      std::size_t dropped = 0;
+      for (; dropped < doc.sketches_.size() && bytes > target; ++dropped)
+        bytes -= std::min(bytes, columnSketchBytes(doc.sketches_[dropped]));
+
+      doc.sketches_.erase(doc.sketches_.begin(), doc.sketches_.begin() + dropped);
+    });
+  });
+
+  static const cache::Cache ENCODING_CACHE("encodings", cache::Cost::SCAN, [] () {
+    std::size_t bytes = 0;
+    forEachDocument([&bytes] (Document & doc) {
+      for (auto const& encoded : doc.encodings_)
+        bytes += encodedColumnBytes(encoded);
+    });
+    return bytes;
+  }, [] (std::size_t target) {
+    std::size_t bytes = ENCODING_CACHE.bytes_();
+    forEachDocument([&bytes, target] (Document & doc) {
+      std::stable_sort(doc.encodings_.begin(), doc.encodings_.end(), [] (EncodedColumn const& lhs, EncodedColumn const& rhs) {
+        return lhs.stale_ != rhs.stale_ ? lhs.stale_ : encodedColumnBytes(lhs) > encodedColumnBytes(rhs);
+      });
+
+      std::size_t dropped = 0;
+      for (; dropped < doc.encodings_.size() && bytes > target; ++dropped)
+        bytes -= std::min(bytes, encodedColumnBytes(doc.encodings_[dropped]));
+
+      doc.encodings_.erase(doc.encodings_.begin(), doc.encodings_.begin() + dropped);
+    });
+  });
+
+  TCL_FUNC(colstats, "?-noHeader? column", "Returns the approximate distinct count, the empty cells and the 50th, 95th and 99th percentiles of the numbers of column below the header, as a list of names and values. With -noHeader the first row counts too. A sample adds its sampling rate and the rows and empty cells it estimates the whole to have. The sketches of a document are kept and follow its edits.")
+  {
+    TCL_CHECK_ARGS(2, 3);
+
+    const bool header = std::string(Jim_String(argv[1])) != "-noHeader";
+    if (header != (argc == 2))
+      return JIM_ERR;
+
+    const int column = Index::strToColumn(Jim_String(argv[argc - 1]));
+    if (column < 0 || column >= getColumnCount())
+    {
+      logError("colstats column ", Jim_String(argv[argc - 1]), " out of range");
+      return JIM_ERR;
+    }
+
+    Buffer const& buffer = currentBuffer();
+    Document & doc = *buffer.doc_;
+
+    if (doc.loading_ || doc.paged_)
+    {
+      logError("can't summarize a document that is loading or paged");
+      return JIM_ERR;
+    }
+
+    // A view is summarized every time, only the rows it shows count. The sketch of a
+    // document leaves out the header, without one its first row is added to a copy.
+    ColumnSummary viewSummary;
+    ColumnSummary const* summary = &viewSummary;
+    const int firstRow = header ? 1 : 0;
+    const int rowCount = getRowCount();
+    const int rows = std::max(rowCount - firstRow, 0);
+
+    if (buffer.view_)
+      summarizeColumn(doc, column, &buffer.rows_, firstRow, rowCount, viewSummary);
+    else if (header)
+      summary = &useColumnSketch(doc, column).summary_;
+    else
+    {
+      viewSummary = useColumnSketch(doc, column).summary_;
+      if (Cell const* cell = static_cast<CellStorage const&>(doc.cells_).find(Index(column, 0)))
+        viewSummary.add(*cell, doc.strings_);
+    }
+
+    // Small sets can be estimated above what there is
+    const uint64_t distinct = std::min(summary->distinct_.estimate(), summary->values_);
+    const long long empty = rows - (long long)summary->values_;
+
+    std::string percentiles;
+    Jim_Obj * list = Jim_NewListObj(interp, nullptr, 0);
+
+    auto append = [interp, list] (const char * name, std::string const& value) {
+      Jim_ListAppendElement(interp, list, Jim_NewStringObj(interp, name, -1));
+      Jim_ListAppendElement(interp, list, Jim_NewStringObj(interp, value.c_str(), -1));
+    };
+
+    append("distinct", str::fromInt(distinct));
+    append("empty", str::fromInt(empty));
+
+    // The percentiles of a sample estimate those of the whole as they are, the counts
+    // grow by the rate. The distinct count of the sample is only a lower bound.
+    std::string estimate;
+    if (buffer.sampleRate_ < 1.0)
+    {
+      char number[str::FORMAT_SIZE];
+      append("sampleRate", std::string(number, str::formatDouble(buffer.sampleRate_, 6, number)));
+      append("estimatedRows", str::fromInt(std::llround(rows / buffer.sampleRate_)));
+      append("estimatedEmpty", str::fromInt(std::llround(empty / buffer.sampleRate_)));
+      estimate = " (a sample of ~" + str::fromInt(std::llround(rows / buffer.sampleRate_)) + " rows)";
+    }
+
+    static const struct { const char * name; double q; } PERCENTILES[] = { { "p50", 0.5 }, { "p95", 0.95 }, { "p99", 0.99 } };
+    for (auto const& it : PERCENTILES)
+    {
+      std::string value;
+      if (summary->quantiles_.count() > 0)
+      {
+        char number[str::FORMAT_SIZE];
+        value.assign(number, str::formatDouble(summary->quantiles_.quantile(it.q), 10, number));
+        percentiles.append(1, ' ').append(it.name).append(1, ' ').append(value);
+      }
+
+      append(it.name, value);
+    }
+
+    flashMessage(Index::columnToStr(column) + ": ~" + str::fromInt(distinct) + " distinct, " + str::fromInt(empty) + " empty" + percentiles + estimate);
+
+    Jim_SetResult(interp, list);
+    return JIM_OK;
+  }
+
+  double formulaCost(Document const& doc, Index const& index)
+  {
+    std::lock_guard<std::mutex> lock(formulaCostMutex_);
+
+    FormulaCost const* cost = doc.formulaCosts_.empty() ? nullptr : doc.formulaCosts_.find(index.key());
+    return cost && doc.formulaCostMax_ > 0 ? (double)cost->ticks_ / doc.formulaCostMax_ : 0.0;
+  }
+
+  double getFormulaCost(Index const& idx)
+  {
+    return formulaCost(currentDoc(), documentIndex(idx));
+  }
+
+  // The cells of its own document the formula of pattern at idx reads
+  static std::size_t formulaFanIn(Document const& doc, FormulaTemplate const& pattern, Index const& idx)
+  {
+    std::size_t cells = 0;
+
+    for (auto const& expr : pattern.expression)
+    {
+      if (expr.sheet_ != Expr::NO_SHEET)
+        continue;
+
+      const Index start(idx.x + expr.startIndex_.x, idx.y + expr.startIndex_.y);
+
+      if (expr.type_ == Expr::Cell)
+        cells++;
+      else if (expr.type_ == Expr::Range)
+      {
+        const int columns = std::min(idx.x + expr.endIndex_.x, doc.width_ - 1) - std::max(start.x, 0) + 1;
+        const int rows = std::min(idx.y + expr.endIndex_.y, doc.height_ - 1) - std::max(start.y, 0) + 1;
+        if (columns > 0 && rows > 0)
+          cells += (std::size_t)columns * rows;
+      }
+    }
+
+    return cells;
+  }
+
+  TCL_SUBFUNC(recalcProfile, "start",  "",                    "Starts timing the evaluation of every formula, what was timed before is dropped",
+                             "stop",   "",                    "Stops timing, what was timed is kept for report and for the cost overlay, see app_showRecalcCost",
+                             "report", "?-templates? ?count?", "Returns cell, milliseconds, evaluations, cells read and formulas reading it of the count most expensive formulas of the current document, 20 by default. With -templates the formulas sharing a template are summed up, with the first cell of them, and the number of them follows the cell.")
+  {
+    enum { CMD_START, CMD_STOP, CMD_REPORT };
+
+    switch (subCommand)
+    {
+      case CMD_START:
+        TCL_CHECK_ARG_DESC(0, "");
+
+        {
+          std::lock_guard<std::mutex> lock(formulaCostMutex_);
+          for (auto & buffer : documentBuffers())
+          {
+            buffer.doc_->formulaCosts_.clear();
+            buffer.doc_->formulaCostMax_ = 0;
+          }
+        }
+
+        recalcProfiling_ = true;
+        return JIM_OK;
+
+      case CMD_STOP:
+        TCL_CHECK_ARG_DESC(0, "");
+        recalcProfiling_ = false;
+        return JIM_OK;
+
+      default:
+        break;
+    }
+
+    TCL_CHECK_ARGS_DESC(0, 2, "?-templates? ?count?");
+
+    int i = 0;
+    const bool templates = argc > 0 && std::string(Jim_String(argv[0])) == "-templates";
+    if (templates)
+      ++i;
+
+    long count = 20;
+    if (i < argc && Jim_GetLong(interp, argv[i], &count) != JIM_OK)
+      return JIM_ERR;
+
+    // A formula, or the formulas of a template, by the first of their cells
+    struct Entry
+    {
+      Index idx_;
+      std::size_t formulas_ = 0;
+      int64_t ticks_ = 0;
+      uint64_t calls_ = 0;
+      std::size_t fanIn_ = 0;
+      std::size_t fanOut_ = 0;
+    };
+
+    Document & doc = currentDoc();
+    std::vector<Entry> entries;
+    std::unordered_map<FormulaTemplate const*, std::size_t> byTemplate;
+
+    {
+      std::lock_guard<std::mutex> lock(formulaCostMutex_);
+      for (auto const& it : doc.formulaCosts_)
+      {
+        const Index idx = Index::fromKey(it.first);
+        FormulaCost const& cost = it.second;
+
+        std::size_t entry = entries.size();
+        if (templates)
+          entry = byTemplate.emplace(cost.pattern_.get(), entries.size()).first->second;
+
+        if (entry == entries.size())
+        {
+          entries.emplace_back();
+          entries.back().idx_ = idx;
+        }
+
+        Entry & summed = entries[entry];
+        if (idx.y < summed.idx_.y || (idx.y == summed.idx_.y && idx.x < summed.idx_.x))
+          summed.idx_ = idx;
+
+        summed.formulas_++;
+        summed.ticks_ += cost.ticks_;
+        summed.calls_ += cost.calls_;
+        summed.fanIn_ += formulaFanIn(doc, *cost.pattern_, idx);
+
+        const std::vector<Index> cells(1, idx);
+        summed.fanOut_ += doc.dependencies_.collectReferencing(&cells).size();
+      }
+    }
+
+    std::sort(entries.begin(), entries.end(), [] (Entry const& a, Entry const& b) { return a.ticks_ > b.ticks_; });
+    entries.resize(std::min<std::size_t>(entries.size(), std::max(count, 0L)));
+
+    Jim_Obj * list = Jim_NewListObj(interp, nullptr, 0);
+    for (auto const& entry : entries)
+    {
+      Jim_Obj * item = Jim_NewListObj(interp, nullptr, 0);
+      Jim_ListAppendElement(interp, item, Jim_NewStringObj(interp, entry.idx_.toStr().c_str(), -1));
+      if (templates)
+        Jim_ListAppendElement(interp, item, Jim_NewIntObj(interp, entry.formulas_));
+
+      Jim_ListAppendElement(interp, item, Jim_NewDoubleObj(interp, entry.ticks_ * 1000.0 / bx::getHPFrequency()));
+      Jim_ListAppendElement(interp, item, Jim_NewIntObj(interp, entry.calls_));
+      Jim_ListAppendElement(interp, item, Jim_NewIntObj(interp, entry.fanIn_));
+      Jim_ListAppendElement(interp, item, Jim_NewIntObj(interp, entry.fanOut_));
+      Jim_ListAppendElement(interp, list, item);
+    }
+
+    Jim_SetResult(interp, list);
+    return JIM_OK;
+  }
+
+  uint16_t getCellStyle(Index const& idx)
+  {
+    Document & doc = currentDoc();
+    if (!hasCellStyles(doc))
+      return 0;
+
+    const Index index = documentIndex(idx);
+    return cellStyle(doc, index, index.y >= 0 ? doc.cells_.find(index) : nullptr);
+  }
+
+  // Whether column can be reached from the inputs of the column formula computing from
+  static bool columnFormulaReads(Document & doc, int from, int column, int depth = 0)
+  {
+    ColumnFormula * formula = findColumnFormula(doc, from);
+    if (!formula || depth > (int)doc.columnFormulas_.size())
+      return false;
+
+    for (int input : formula->inputs_)
+      if (input == column || columnFormulaReads(doc, input, column, depth + 1))
+        return true;
+
+    return false;
+  }
+
+  // A bare column name, a run of letters not followed by a row or an opening bracket,
+  // stands for the cell of that column in row 1
+  static std::string columnFormulaSource(std::string const& text)
+  {
+    std::string source;
+
+    for (std::size_t i = 0; i < text.size(); )
+    {
+      if (!std::isalpha((unsigned char)text[i]))
+      {
+        source.push_back(text[i++]);
+        continue;
+      }
+
+      std::size_t end = i;
+      while (end < text.size() && std::isalpha((unsigned char)text[end]))
+        ++end;
+
+      const bool name = end == text.size() || (!std::isdigit((unsigned char)text[end]) && text[end] != '(');
+      for (; i < end; ++i)
+        source.push_back(name ? std::toupper((unsigned char)text[i]) : text[i]);
+
+      if (name)
+        source.push_back('1');
+    }
+
+    return source;
+  }
+
+  // The expression of a column formula the way colexpr takes it, with its references to
+  // row 1 as bare column names
+  static std::string columnFormulaText(std::vector<Expr> const& expression)
+  {
+    const ExprText text = exprText(expression);
+    std::string result;
+    std::size_t position = 0;
+
+    for (auto const& ref : text.refs_)
+    {
+      result.append(text.text_, position, ref.first - position);
+      result += Index::columnToStr(ref.second.x);
+      position = ref.first;
+    }
+
+    result.append(text.text_, position, std::string::npos);
+    return result;
+  }
+
+  TCL_FUNC(colexpr, "column ?expression?", "Computes column from the other columns of each row, like {A * B}. Rows that hold a cell in column show it instead. An empty expression removes the column formula, without one its expression is returned.")
+  {
+    TCL_CHECK_ARGS(2, 3);
+
+    const int column = Index::strToColumn(Jim_String(argv[1]));
+    if (column < 0)
+    {
+      logError("colexpr column ", Jim_String(argv[1]), " out of range");
+      return JIM_ERR;
+    }
+
+    Document & doc = currentDoc();
+    ColumnFormula * existing = findColumnFormula(doc, column);
+
+    if (argc == 2)
+    {
+      Jim_SetResultString(interp, existing ? columnFormulaText(existing->expression_).c_str() : "", -1);
+      return JIM_OK;
+    }
+
+    const std::string text = Jim_String(argv[2]);
+    if (std::all_of(text.begin(), text.end(), [] (char ch) { return std::isspace((unsigned char)ch) != 0; }))
+    {
+      doc.columnFormulas_.erase(std::remove_if(doc.columnFormulas_.begin(), doc.columnFormulas_.end(), [column] (ColumnFormula const& formula) {
+        return formula.column_ == column;
+      }), doc.columnFormulas_.end());
+
+      invalidateLookups(doc, -1);
+      invalidateColumnFormulas(doc, -1);
+      recalculateDocument();
+      return JIM_OK;
+    }
+
+    ColumnFormula formula;
+    formula.column_ = column;
+    formula.expression_ = parseExpression(columnFormulaSource(text));
+    formula.program_ = compileExpression(formula.expression_);
+
+    if (!isRowProgram(formula.program_))
+    {
+      logError("colexpr expression '", text, "' has to compute a row from single cells of row 1");
+      return JIM_ERR;
+    }
+
+    for (auto const& expr : formula.expression_)
+      if (expr.type_ == Expr::Cell && std::find(formula.inputs_.begin(), formula.inputs_.end(), expr.startIndex_.x) == formula.inputs_.end())
+        formula.inputs_.push_back(expr.startIndex_.x);
+
+    for (int input : formula.inputs_)
+      if (input == column || columnFormulaReads(doc, input, column))
+      {
+        logError("colexpr expression '", text, "' reads column ", Index::columnToStr(column), " itself");
+        return JIM_ERR;
+      }
+
+    if (existing)
+      *existing = std::move(formula);
+    else
+      doc.columnFormulas_.push_back(std::move(formula));
+
+    invalidateLookups(doc, -1);
+    invalidateColumnFormulas(doc, -1);
+    doc.width_ = std::max(doc.width_, column + 1);
+
+    recalculateDocument();
+    return JIM_OK;
+  }
+
+  // Whether the cell at idx of doc, the current document, displays text
+  static bool cellShowsText(Document & doc, Index const& idx, std::string const& text, std::string & scratch)
+  {
+    Cell * cell = doc.cells_.find(idx);
+    if (!cell)
+      return false;
+
+    if (cell->hasExpression() && !cell->evaluated)
+      evaluateCell(idx, *cell);
+
+    return filterDisplayText(doc, *cell, scratch) == text;
+  }
+
+  TCL_FUNC(gotoValue, "column value", "Move the cursor to the next row whose cell in column displays value, from the top again after the last row. Returns 0 if there is none.")
+  {
+    TCL_CHECK_ARG(3);
+
+    const int column = Index::strToColumn(Jim_String(argv[1]));
+    const std::string value(Jim_String(argv[2]));
+
+    if (column < 0 || column >= getColumnCount())
+    {
+      logError("gotoValue column ", Jim_String(argv[1]), " out of range");
+      return JIM_ERR;
+    }
+
+    Document & doc = currentDoc();
+    if (doc.loading_ || doc.paged_)
+    {
+      logError("can't look for values in a document that is loading or paged");
+      return JIM_ERR;
+    }
+
+    const int rowCount = getRowCount();
+    const int from = cursorPos().y;
+
+    std::string scratch;
+    int found = -1;
+
+    // The rows of a view aren't those of the document, the index only helps documents
+    ColumnIndex * index = currentBuffer().view_ ? nullptr : useColumnIndex(doc, column);
+    if (index)
+    {
+      double number = 0.0;
+      const bool isNumber = str::parseValue(value, number);
+
+      std::vector<int> candidates;
+      index->findEqual(value, isNumber, number, doc.strings_, candidates);
+      std::sort(candidates.begin(), candidates.end());
+
+      // The first match after the cursor, or else the first one from the top
+      for (const int row : candidates)
+        if (row < rowCount && (found < 0 || (found <= from && row > from)) && cellShowsText(doc, Index(column, row), value, scratch))
+        {
+          found = row;
+          if (row > from)
             break;
+        }
+    }
+    else
+    {
+      for (int i = 1; i <= rowCount && found < 0; ++i)
+      {
+        const int y = (from + i) % rowCount;
+        if (cellShowsText(doc, Index(column, documentRow(y)), value, scratch))
+          found = y;
+      }
+    }
+
+    if (found < 0)
+    {
+      TCL_INT_RESULT(0);
+    }
+
+    cursorPos() = Index(column, found);
+    TCL_INT_RESULT(1);
+  }
+
+  uint64_t orderedKey(double value)
+  {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    const uint64_t sign = (uint64_t)1 << 63;
+    return (bits & sign) ? ~bits : bits | sign;
+  }
+
+  static void sortOnNumbers(Document & doc, SortKey const& key, int first, std::vector<uint32_t> & order)
+  {
+    const uint32_t size = order.size();
+    std::vector<uint64_t> keys(size);
+    std::vector<uint64_t> tempKeys(size);
+    std::vector<uint32_t> tempOrder(size);
+
+    for (uint32_t i = 0; i < size; ++i)
+    {
+      // Cells without a number go last in both directions
+      keys[i] = UINT64_MAX;
+
+      const Index idx(key.column, first + order[i]);
+      Cell * cell = doc.cells_.find(idx);
+      if (!cell || cell->type == CellType::Text)
+        continue;
+
+      if (!cell->evaluated)
+        evaluateCell(idx, *cell);
+
+      const uint64_t value = orderedKey(cell->value);
+      keys[i] = std::min(key.descending ? ~value : value, UINT64_MAX - 1);
+    }
+
+    bx::radixSort64(keys.data(), tempKeys.data(), order.data(), tempOrder.data(), size);
+  }
+
+  // Text is sorted by rank: the distinct strings of the column are sorted once and every
+  // row is then radix sorted on the rank of its interned id
+  static void sortOnText(Document & doc, SortKey const& key, int first, std::vector<uint32_t> & order)
+  {
+    const uint32_t size = order.size();
+    std::vector<uint32_t> keys(size);
+    std::vector<uint32_t> tempKeys(size);
+    std::vector<uint32_t> tempOrder(size);
+
+    for (uint32_t i = 0; i < size; ++i)
+    {
+      Cell * cell = doc.cells_.find(Index(key.column, first + order[i]));
+      if (!cell)
+        keys[i] = StringPool::EMPTY;
+      else if (cell->type != CellType::Formula)
+        keys[i] = cell->text;
+      else
+        keys[i] = doc.strings_.intern(getCellDisplayText(Index(key.column, first + order[i])));
+    }
+
+    std::vector<uint32_t> ranks(doc.strings_.size(), 0);
+    std::vector<uint32_t> distinct;
+
+    for (uint32_t id : keys)
+      if (id != StringPool::EMPTY && ranks[id] == 0)
+      {
+        ranks[id] = 1;
+        distinct.push_back(id);
+      }
+
+    std::sort(distinct.begin(), distinct.end(), [&doc] (uint32_t lhs, uint32_t rhs) -> bool {
+      return doc.strings_.str(lhs) < doc.strings_.str(rhs);
+    });
+
+    for (uint32_t i = 0; i < distinct.size(); ++i)
+      ranks[distinct[i]] = key.descending ? distinct.size() - i : i + 1;
+
+    // Empty cells go last in both directions
+    for (uint32_t & id : keys)
+      id = id == StringPool::EMPTY ? UINT32_MAX : ranks[id];
+
+    bx::radixSort32(keys.data(), tempKeys.data(), order.data(), tempOrder.data(), size);
+  }
+
+  bool parseSortKeys(std::vector<std::string> const& args, int columnCount, std::vector<SortKey> & keys)
+  {
+    for (std::string const& value : args)
+    {
+      if (value == "-ascending" || value == "-descending" || value == "-numeric" || value == "-text")
+      {
+        if (keys.empty())
+        {
+          logError("sort option ", value, " has to follow a column");
+          return false;
+        }
+
+        if (value == "-ascending" || value == "-descending")
+          keys.back().descending = value == "-descending";
+        else
+          keys.back().numeric = value == "-numeric";
+      }
+      else
+      {
+        SortKey key;
+        key.column = Index::strToColumn(value);
+        if (key.column < 0 || (columnCount >= 0 && key.column >= columnCount))
+        {
+          logError("sort column ", key.column, " out of range");
+          return false;
+        }
+
+        keys.push_back(key);
+      }
+    }
+
+    return true;
+  }
+
+  TCL_FUNC(sort, "?-noHeader? column ?-descending? ?-numeric? ?column ...?", "Sort the rows of the current document on one or more columns, formulas keep their references")
+  {
+    TCL_CHECK_ARGS(2, 1000);
+
+    if (!beginEdit())
+      return JIM_ERR;
+
+    Document & doc = currentDoc();
+
+    int i = 1;
+    bool sortHeader = false;
+    if (std::string(Jim_String(argv[1])) == "-noHeader")
+    {
+      sortHeader = true;
+      ++i;
+    }
+
+    std::vector<std::string> args = stringArgs(i, argc, argv);
+
+    std::vector<SortKey> keys;
+    if (!parseSortKeys(args, getColumnCount(), keys))
+      return JIM_ERR;
+
+    if (keys.empty())
+      return JIM_ERR;
+
+    const int first = sortHeader ? 0 : 1;
+    if (doc.height_ - first < 2)
+      return JIM_OK;
+
+    std::vector<uint32_t> order(doc.height_ - first);
+    for (uint32_t y = 0; y < order.size(); ++y)
+      order[y] = y;
+
+    // The radix sorts are stable, so sorting on the last key first leaves the rows
+    // ordered on all of them
+    for (auto it = keys.rbegin(); it != keys.rend(); ++it)
+    {
+      if (it->numeric)
+        sortOnNumbers(doc, *it, first, order);
+      else
+        sortOnText(doc, *it, first, order);
+    }
+
+    UndoRecord & record = addUndoRecord(EditAction::SortRows, false);
+    record.position_ = first;
+    record.order_ = order;
+
+    permuteRows(first, order);
+    journalEdit(record);
+    recalculateDocument();
+
+    return JIM_OK;
+  }
+
+  TCL_FUNC(top, "?-noHeader? count column ?-ascending?", "Opens a view of the count rows of the current buffer with the largest numbers in column, largest first, or with -ascending the smallest. Like a filter the view shows the rows of the same document, and the rows are picked without sorting them.")
+  {
+    TCL_CHECK_ARGS(3, 5);
+
+    int i = 1;
+    bool copyHeader = true;
+    if (std::string(Jim_String(argv[1])) == "-noHeader")
+    {
+      copyHeader = false;
+      ++i;
+    }
+
+    if (argc < i + 2)
+      return JIM_ERR;
+
+    TCL_INT_ARG(i, count);
+    if (count < 0)
+    {
+      logError("top needs a count of at least 0, not ", count);
+      return JIM_ERR;
+    }
+
+    const std::string columnName(Jim_String(argv[i + 1]));
+    const int column = Index::strToColumn(columnName);
+    if (column < 0 || column >= getColumnCount())
+    {
+      logError("top column ", columnName, " out of range");
+      return JIM_ERR;
+    }
+
+    bool ascending = false;
+    if (i + 2 < argc)
+    {
+      const std::string option(Jim_String(argv[i + 2]));
+      if (option != "-ascending" && option != "-asc")
+      {
+        logError("unknown top option '", option, "'");
+        return JIM_ERR;
+      }
+
+      ascending = true;
+    }
+
+    return openTopView(count, column, copyHeader, ascending) ? JIM_OK : JIM_ERR;
+  }
+
+  TCL_FUNC(sample, "?-noHeader? count", "Opens a view of count rows of the current buffer picked at random, in the order of the buffer. Like a filter the view shows the rows of the same document, and it knows its sampling rate for the estimates of colstats.")
+  {
+    TCL_CHECK_ARGS(2, 3);
+
+    const bool copyHeader = std::string(Jim_String(argv[1])) != "-noHeader";
+    if (copyHeader != (argc == 2))
+      return JIM_ERR;
+
+    TCL_INT_ARG(argc - 1, count);
+    if (count < 0)
+    {
+      logError("sample needs a count of at least 0, not ", count);
+      return JIM_ERR;
+    }
+
+    return openSampleView(count, copyHeader) ? JIM_OK : JIM_ERR;
+  }
+
+  // The number in the cell at idx, or NaN for cells without one
+  static double aggregatedValue(Document & doc, Index const& idx)
+  {
+    Cell * cell = doc.cells_.find(idx);
+    if (!cell || cell->type == CellType::Text)
+      return NAN;
+
+    if (!cell->evaluated)
+      evaluateCell(idx, *cell);
+
+    return cell->type == CellType::Formula && !cell->display().empty() ? NAN : cell->value;
+  }
+
+  std::string aggregateText(Aggregate const& aggregate, groupby::Group const& group, groupby::Stats const& stats)
+  {
+    char number[str::FORMAT_SIZE];
+
+    switch (aggregate.op)
+    {
+      case AggregateOp::Count:
+        return str::fromInt(group.rows_);
+
+      case AggregateOp::Sum:
+        return std::string(number, str::formatDouble(stats.sum_, number));
+
+      case AggregateOp::Average:
+        return stats.count_ == 0 ? std::string() : std::string(number, str::formatDouble(stats.sum_ / stats.count_, number));
+
+      case AggregateOp::Min:
+        return stats.count_ == 0 ? std::string() : std::string(number, str::formatDouble(stats.min_, number));
+
+      case AggregateOp::Max:
+        return stats.count_ == 0 ? std::string() : std::string(number, str::formatDouble(stats.max_, number));
+    }
+
+    return std::string();
+  }
+
+  bool parseAggregates(std::vector<std::string> const& args, int columnCount, std::vector<Aggregate> & aggregates, std::vector<int> & inputColumns)
+  {
+    for (std::size_t i = 0; i < args.size(); ++i)
+    {
+      std::string const& option = args[i];
+
+      Aggregate aggregate;
+      if (option == "-count")
+      {
+        aggregates.push_back(aggregate);
+        continue;
+      }
+      else if (option == "-sum")
+        aggregate.op = AggregateOp::Sum;
+      else if (option == "-avg")
+        aggregate.op = AggregateOp::Average;
+      else if (option == "-min")
+        aggregate.op = AggregateOp::Min;
+      else if (option == "-max")
+        aggregate.op = AggregateOp::Max;
+      else
+      {
+        logError("unknown groupby aggregate '", option, "'");
+        return false;
+      }
+
+      if (++i == args.size())
+      {
+        logError("groupby aggregate ", option, " needs a column");
+        return false;
+      }
+
+      aggregate.column = Index::strToColumn(args[i]);
+      if (aggregate.column < 0 || (columnCount >= 0 && aggregate.column >= columnCount))
+      {
+        logError("groupby column ", aggregate.column, " out of range");
+        return false;
+      }
+
+      // Columns aggregated several ways are read once
+      aggregate.input = std::find(inputColumns.begin(), inputColumns.end(), aggregate.column) - inputColumns.begin();
+      if (aggregate.input == inputColumns.size())
+        inputColumns.push_back(aggregate.column);
+
+      aggregates.push_back(aggregate);
+    }
+
+    return true;
+  }
+
+  std::string aggregateName(Aggregate const& aggregate, std::string const& columnName)
+  {
+    static const char * NAMES[] = { "count", "sum", "avg", "min", "max" };
+
+    std::string name = NAMES[(int)aggregate.op];
+    if (aggregate.op != AggregateOp::Count)
+      name.append(1, ' ').append(columnName);
+
+    return name;
+  }
 
-          case FilterOp::Greater:
+  // Groups the rows of the current buffer from first on by keyColumn, with the stats of
+  // inputColumns for every group
+  static groupby::Result groupRows(Document & doc, int first, int keyColumn, std::vector<int> const& inputColumns)
+  {
+    // The key and the aggregated columns become typed arrays, rows with an empty key
+    // are left out. Formulas are evaluated here, the aggregation only reads the arrays.
+    const int rowCount = getRowCount();
+
+    std::vector<uint32_t> keys;
+    std::vector<std::vector<double>> values(inputColumns.size());
+    std::string scratch;
+
+    keys.reserve(std::max(rowCount - first, 0));
+    for (auto & column : values)
+      column.reserve(keys.capacity());
+
+    // The columns are decoded a block at a time where they are encoded. Encoding a column
+    // may move the others, so they are all encoded before any is looked at, each counting
+    // one scan.
+    Buffer const& buffer = currentBuffer();
+    const bool encode = rowCount - first >= encoding::BLOCK_ROWS && (!buffer.view_ || std::is_sorted(buffer.rows_.begin(), buffer.rows_.end()));
+
+    if (encode)
+    {
+      encodedColumn(doc, keyColumn);
+      for (std::size_t i = 0; i < inputColumns.size(); ++i)
+        if (inputColumns[i] != keyColumn && std::find(inputColumns.begin(), inputColumns.begin() + i, inputColumns[i]) == inputColumns.begin() + i)
+          encodedColumn(doc, inputColumns[i]);
+    }
+
+    EncodedColumn const* encodedKey = encode ? currentEncodedColumn(doc, keyColumn) : nullptr;
+    std::vector<EncodedColumn const*> encodedInputs;
+    for (const int column : inputColumns)
+      encodedInputs.push_back(encode ? currentEncodedColumn(doc, column) : nullptr);
+
+    auto blockEncoded = [] (EncodedColumn const* encoded, int block) {
+      return encoded && block < (int)encoded->blocks_.size() && encoded->blocks_[block].encoded_;
+    };
+
+    std::vector<uint32_t> keyIds(encoding::BLOCK_ROWS);
+    std::vector<std::vector<double>> inputNumbers(inputColumns.size(), std::vector<double>(encoding::BLOCK_ROWS));
+    int decodedBlock = -1;
+
+    for (int y = first; y < rowCount; ++y)
+    {
+      const int row = documentRow(y);
+      if (row < 0)
+        continue;
+
+      const int block = row / encoding::BLOCK_ROWS;
+      if (block != decodedBlock)
+      {
+        decodedBlock = block;
+
+        if (blockEncoded(encodedKey, block))
+          encodedKey->blocks_[block].ids_.decode(keyIds.data());
+
+        for (std::size_t c = 0; c < inputColumns.size(); ++c)
+          if (blockEncoded(encodedInputs[c], block))
+            encodedInputs[c]->blocks_[block].numbers_.decode(inputNumbers[c].data());
+      }
+
+      uint32_t key = StringPool::EMPTY;
+      if (blockEncoded(encodedKey, block))
+        key = keyIds[row % encoding::BLOCK_ROWS];
+      else if (Cell * cell = doc.cells_.find(Index(keyColumn, row)))
+        key = displayTextId(doc, *cell, scratch);
+
+      if (key == StringPool::EMPTY)
+        continue;
+
+      keys.push_back(key);
+      for (std::size_t c = 0; c < inputColumns.size(); ++c)
+        values[c].push_back(blockEncoded(encodedInputs[c], block) ? inputNumbers[c][row % encoding::BLOCK_ROWS] : aggregatedValue(doc, Index(inputColumns[c], row)));
+    }
+
+    return groupby::aggregate(keys, values);
+  }
+
+  TCL_FUNC(groupby, "?-noHeader? column ?-count? ?-sum column? ?-avg column? ?-min column? ?-max column? ...", "Group the rows of the current document on the values of column. The new buffer has a row per value and a column per aggregate of its rows.")
+  {
+    TCL_CHECK_ARGS(2, 1000);
+
+    int i = 1;
+    bool copyHeader = true;
+    if (std::string(Jim_String(argv[1])) == "-noHeader")
+    {
+      copyHeader = false;
+      ++i;
+    }
+
+    if (i == argc)
+      return JIM_ERR;
+
+    const int keyColumn = Index::strToColumn(Jim_String(argv[i++]));
+    if (keyColumn < 0 || keyColumn >= getColumnCount())
+    {
+      logError("groupby column ", keyColumn, " out of range");
+      return JIM_ERR;
+    }
+
+    std::vector<std::string> args = stringArgs(i, argc, argv);
+
+    std::vector<Aggregate> aggregates;
+    std::vector<int> inputColumns;
+    if (!parseAggregates(args, getColumnCount(), aggregates, inputColumns))
+      return JIM_ERR;
+
+    Document & doc = currentDoc();
+    if (doc.loading_ || doc.paged_)
+    {
+      logError("can't group a document that is loading or paged, filter it into a view first");
+      return JIM_ERR;
+    }
+
+    // The stats of the same key and columns are memoized, whichever aggregates need them
+    const int rowCount = getRowCount();
+    const int first = copyHeader ? 1 : 0;
+
+    std::string key = "groupby " + std::to_string(keyColumn);
+    for (const int column : inputColumns)
+      key += " " + std::to_string(column);
+
+    groupby::Result result;
+    if (MemoizedResult const* memoized = findMemoizedResult(doc, key, first))
+      result = memoized->groups_;
+    else
+    {
+      result = groupRows(doc, first, keyColumn, inputColumns);
+
+      std::vector<int> columns = inputColumns;
+      columns.push_back(keyColumn);
+      if (MemoizedResult * memoized = memoizeResult(doc, key, first, columns))
+        memoized->groups_ = result;
+    }
+
+    std::vector<std::string> header;
+    if (copyHeader && rowCount > 0)
+    {
+      header.push_back(getCellText(Index(keyColumn, 0)));
+
+      for (auto const& aggregate : aggregates)
+        header.push_back(aggregateName(aggregate, getCellText(Index(aggregate.column, 0))));
+    }
+
+    // The groups go into a new document, which keeps the source alive while it is filled
+    const std::shared_ptr<Document> source = currentBuffer().doc_;
+    createDefaultEmpty();
+
+    auto setGroupText = [] (Index const& idx, std::string const& text) {
+      if (text.empty())
+        return;
+
+      setText(idx, text);
+      fitColumnWidth(idx.x, text);
+    };
+
+    for (std::size_t c = 0; c < header.size(); ++c)
+      setGroupText(Index(c, 0), header[c]);
+
+    const int firstRow = header.empty() ? 0 : 1;
+    for (std::size_t g = 0; g < result.groups_.size(); ++g)
+    {
+      groupby::Group const& group = result.groups_[g];
+      groupby::Stats const* stats = result.stats_.data() + g * inputColumns.size();
+
+      setGroupText(Index(0, firstRow + g), source->strings_.str(group.key_).str());
+
+      for (std::size_t a = 0; a < aggregates.size(); ++a)
+        setGroupText(Index(a + 1, firstRow + g), aggregateText(aggregates[a], group, stats[aggregates[a].input]));
+    }
+
+    return JIM_OK;
+  }
+
+  double loadedFraction(Document const& doc)
+  {
+    if (doc.paged_ && doc.paged_->indexing())
+      return doc.paged_->progress() / 100.0;
+
+    const int loading = loadingBufferIndex();
+    if (doc.loading_ && backgroundLoad_ && loading >= 0 && documentBuffers()[loading].doc_.get() == &doc)
+      return (double)backgroundLoad_->bytesMerged_ / std::max<std::size_t>(backgroundLoad_->file_.data().size(), 1);
+
+    return 1.0;
+  }
+
+  TCL_FUNC(estimate, "?-noHeader? ?-groupby column? ?-count? ?-sum column? ?-avg column? ?-min column? ?-max column? ...", "Aggregate the rows of the current document, which may be paged or still loading, the way groupby does. The message lines show estimates with 95% confidence intervals that are refined as more rows are read, until they are exact. Without aggregates the rows are counted.")
+  {
+    TCL_CHECK_ARGS(1, 1000);
+
+    if (!startEstimate(stringArgs(1, argc, argv)))
+      return JIM_ERR;
+
+    return JIM_OK;
+  }
+
+  TCL_FUNC(cancelEstimate, "", "Stop refining the estimate of the estimate command")
+  {
+    TCL_CHECK_ARG(1);
+
+    cancelEstimate();
+    return JIM_OK;
+  }
+
+  TCL_FUNC(joinBuffers, "?-noHeader? leftBuffer leftColumn rightBuffer rightColumn ?-inner|-left?", "Join the rows of two buffers on the values of a column of each into a new buffer. Its rows have the columns of the left row followed by those of the right row, but its key. -left keeps left rows without a match.")
+  {
+    TCL_CHECK_ARGS(5, 7);
+
+    int i = 1;
+    bool copyHeader = true;
+    if (std::string(Jim_String(argv[1])) == "-noHeader")
+    {
+      copyHeader = false;
+      ++i;
+    }
+
+    if (argc - i < 4)
+      return JIM_ERR;
+
+    long leftBuffer = 0, rightBuffer = 0;
+    if (Jim_GetLong(interp, argv[i], &leftBuffer) != JIM_OK || Jim_GetLong(interp, argv[i + 2], &rightBuffer) != JIM_OK)
+      return JIM_ERR;
+
+    bool keepUnmatched = false;
+    if (i + 4 < argc)
+    {
+      const std::string option(Jim_String(argv[i + 4]));
+      if (option == "-left")
+        keepUnmatched = true;
+      else if (option != "-inner")
+      {
+        logError("unknown join option '", option, "'");
+        return JIM_ERR;
+      }
+    }
+
+    std::size_t rows = 0;
+    if (!joinBuffers(leftBuffer, Jim_String(argv[i + 1]), rightBuffer, Jim_String(argv[i + 3]), copyHeader, keepUnmatched, rows))
+      return JIM_ERR;
+
+    flashMessage("Joined " + std::to_string(rows) + " rows");
+    return JIM_OK;
+  }
+
+  TCL_FUNC(concatBuffers, "?-noHeader? buffer buffer ?buffer ...?", "Opens a new buffer with the rows of the buffers one after the other. The columns of the others are matched to those of the first by their header, columns the first doesn't have are added after its own, and only the first header is kept. Formulas keep their references relative to their cell.")
+  {
+    TCL_CHECK_ARGS(3, 1000);
+
+    int i = 1;
+    bool header = true;
+    if (std::string(Jim_String(argv[1])) == "-noHeader")
+    {
+      header = false;
+      ++i;
+    }
+
+    if (argc - i < 2)
+      return JIM_ERR;
+
+    std::vector<long> buffers(argc - i);
+    for (std::size_t s = 0; s < buffers.size(); ++s)
+      if (Jim_GetLong(interp, argv[i + s], &buffers[s]) != JIM_OK)
+        return JIM_ERR;
+
+    int rows = 0;
+    if (!concatBuffers(buffers, header, rows))
+      return JIM_ERR;
+
+    flashMessage("Concatenated " + std::to_string(rows) + " rows");
+    return JIM_OK;
+  }
+
+  TCL_FUNC(diff, "?-noHeader? bufferA bufferB ?-key column?", "Compares the rows of two buffers into a new buffer holding the rows of bufferB that bufferA doesn't have, marked +, the rows of bufferA that bufferB doesn't have, marked -, and the rows of bufferB that changed, marked ~ with the cells that changed highlighted. Each comes with its row in its buffer. Rows are paired by the value of column with -key, otherwise by the longest run of equal rows both have in order.")
+  {
+    TCL_CHECK_ARGS(3, 6);
+
+    int i = 1;
+    bool copyHeader = true;
+    if (std::string(Jim_String(argv[1])) == "-noHeader")
+    {
+      copyHeader = false;
+      ++i;
+    }
+
+    long bufferA = 0, bufferB = 0;
+    if (argc - i < 2 || Jim_GetLong(interp, argv[i], &bufferA) != JIM_OK || Jim_GetLong(interp, argv[i + 1], &bufferB) != JIM_OK)
+      return JIM_ERR;
+
+    int keyColumn = -1;
+    if (i + 2 < argc)
+    {
+      if (std::string(Jim_String(argv[i + 2])) != "-key" || i + 4 != argc)
+      {
+        logError("diff takes -key column after the buffers");
+        return JIM_ERR;
+      }
+
+      keyColumn = Index::strToColumn(Jim_String(argv[i + 3]));
+      if (keyColumn < 0)
+      {
+        logError("diff column ", Jim_String(argv[i + 3]), " out of range");
+        return JIM_ERR;
+      }
+    }
+
+    std::size_t added = 0, removed = 0, changed = 0;
+    if (!diffBuffers(bufferA, bufferB, copyHeader, keyColumn, added, removed, changed))
+      return JIM_ERR;
+
+    flashMessage(str::fromInt(added) + " added, " + str::fromInt(removed) + " removed, " + str::fromInt(changed) + " changed");
+    return JIM_OK;
+  }
+
+  // The buffer a query reads FROM, by number or by the name of its file with or without
+  // its directory. Returns -1 if there is no such buffer.
+  static long findQueryBuffer(std::string const& from)
+  {
+    const bool number = !from.empty() && std::all_of(from.begin(), from.end(), [] (char ch) { return std::isdigit((unsigned char)ch); });
+    if (number)
+    {
+      const long buffer = strtol(from.c_str(), nullptr, 10);
+      return buffer < (long)documentBuffers().size() ? buffer : -1;
+    }
+
+    for (std::size_t i = 0; i < documentBuffers().size(); ++i)
+    {
+      std::string const& filename = documentBuffers()[i].doc_->filename_;
+      const std::size_t slash = filename.find_last_of("/\\");
+
+      if (filename == from || (slash != std::string::npos && filename.compare(slash + 1, std::string::npos, from) == 0))
+        return i;
+    }
+
+    return -1;
+  }
+
+  // The column of the current buffer that name refers to, the column with name as its
+  // header or else a column name like B. Returns -1 if there is none.
+  static int findQueryColumn(std::string const& name)
+  {
+    Document & doc = currentDoc();
+    std::string scratch;
+
+    if (getRowCount() > 0)
+    {
+      const int header = documentRow(0);
+      for (int x = 0; x < doc.width_; ++x)
+      {
+        Cell * cell = doc.paged_ ? nullptr : doc.cells_.find(Index(x, header));
+        if (doc.paged_ ? pagedText(doc, Index(x, header)) == name : cell && filterDisplayText(doc, *cell, scratch) == name)
+          return x;
+      }
+    }
+
+    const bool letters = !name.empty() && std::all_of(name.begin(), name.end(), [] (char ch) { return ch >= 'A' && ch <= 'Z'; });
+    const int column = letters ? Index::strToColumn(name) : -1;
+
+    return column < getColumnCount() ? column : -1;
+  }
+
+  // The sort key of one cell for ORDER BY, numbers come before text and empty cells last
+  struct QueryKey
+  {
+    int rank_ = 2;
+    double number_ = 0.0;
+    StrView text_;
+  };
+
+  // Runs select with the buffer it reads from as the current buffer. The selected rows
+  // go into a new buffer, a view for SELECT * and a new document for a projection.
+  static bool runQuery(query::Select const& select)
+  {
+    Document & doc = currentDoc();
+    std::shared_ptr<Document> source = currentBuffer().doc_;
+
+    if (doc.loading_ || isIndexing(doc))
+    {
+      logError("can't query a document that is still loading");
+      return false;
+    }
+
+    if (doc.paged_ && (!select.columns_.empty() || !select.orderBy_.empty()))
+    {
+      logError("can't project or order the rows of a paged document, query it with SELECT * first");
+      return false;
+    }
+
+    auto resolve = [] (std::string const& name, int & column) {
+      column = findQueryColumn(name);
+      if (column < 0)
+        logError("no column ", name, " to query");
+
+      return column >= 0;
+    };
+
+    // The conditions become filter clauses, which are pushed down to the column indexes
+    // and the zone maps of the document
+    static const FilterOp OPERATORS[] = {
+      FilterOp::Equal, FilterOp::NotEqual, FilterOp::Greater, FilterOp::GreaterEqual,
+      FilterOp::LessThan, FilterOp::LessEqual, FilterOp::Like, FilterOp::NotLike
+    };
+
+    std::vector<FilterClause> clauses;
+    for (auto const& condition : select.where_)
+    {
+      FilterClause clause;
+      clause.op = OPERATORS[(int)condition.op_];
+      clause.value = condition.value_;
+      clause.skipText = true;
+
+      if (!resolve(condition.column_, clause.column) || !compileFilterClause(doc.strings_, clause))
+        return false;
+
+      clauses.push_back(clause);
+    }
+
+    std::vector<int> columns(select.columns_.size());
+    for (std::size_t i = 0; i < columns.size(); ++i)
+      if (!resolve(select.columns_[i], columns[i]))
+        return false;
+
+    std::vector<int> orderColumns(select.orderBy_.size());
+    for (std::size_t i = 0; i < orderColumns.size(); ++i)
+      if (!resolve(select.orderBy_[i].column_, orderColumns[i]))
+        return false;
+
+    const int rowCount = getRowCount();
+    const int header = rowCount > 0 ? documentRow(0) : -1;
+
+    std::vector<int> selection;
+    if (!selectRows(doc, 1, clauses, selection))
+      return false;
+
+    if (!orderColumns.empty())
+    {
+      // The keys are read once, the display text of formulas kept alive in texts
+      const std::size_t keyCount = orderColumns.size();
+      std::vector<QueryKey> keys(selection.size() * keyCount);
+      std::deque<std::string> texts;
+
+      for (std::size_t i = 0; i < selection.size(); ++i)
+        for (std::size_t k = 0; k < keyCount; ++k)
+        {
+          Cell * cell = doc.cells_.find(Index(orderColumns[k], selection[i]));
+          if (!cell)
+            continue;
+
+          std::string scratch;
+          const StrView text = filterDisplayText(doc, *cell, scratch);
+          if (text.empty())
+            continue;
+
+          QueryKey & key = keys[i * keyCount + k];
+          if (cell->type == CellType::Number || (cell->type == CellType::Formula && str::parseValue(text, key.number_)))
+          {
+            key.rank_ = 0;
+            if (cell->type == CellType::Number)
+              key.number_ = cell->value;
+          }
+          else
+          {
+            key.rank_ = 1;
+            if (text.data() == scratch.data())
             {
-              try {
-                include &= std::stod(text) > std::stod(value);
-              } catch (std::exception e) {
-                logError("could not make comparison ", text, " > ", value);
-                return JIM_ERR;
-              }
+              texts.push_back(std::move(scratch));
+              key.text_ = texts.back();
             }
-            break;
+            else
+              key.text_ = text;
+          }
+        }
 
-          case FilterOp::LessThan:
-              try {
-                include &= std::stod(text) < std::stod(value);
-              } catch (std::exception e) {
-                logError("could not make comparison ", text, " < ", value);
-                return JIM_ERR;
-              }
-            break;
+      std::vector<uint32_t> order(selection.size());
+      for (std::size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+
+      std::stable_sort(order.begin(), order.end(), [&] (uint32_t a, uint32_t b) {
+        for (std::size_t k = 0; k < keyCount; ++k)
+        {
+          QueryKey const& lhs = keys[a * keyCount + k];
+          QueryKey const& rhs = keys[b * keyCount + k];
+
+          int compare = lhs.rank_ - rhs.rank_;
+          if (compare == 0 && lhs.rank_ == 0)
+            compare = lhs.number_ < rhs.number_ ? -1 : (rhs.number_ < lhs.number_ ? 1 : 0);
+          else if (compare == 0 && lhs.rank_ == 1)
+            compare = lhs.text_ < rhs.text_ ? -1 : (rhs.text_ < lhs.text_ ? 1 : 0);
+
+          // Empty cells stay last in either direction
+          if (compare != 0)
+            return (select.orderBy_[k].descending_ && lhs.rank_ < 2 && rhs.rank_ < 2) ? compare > 0 : compare < 0;
         }
-      }
 
-      if (include)
+        return false;
+      });
+
+      std::vector<int> sorted;
+      sorted.reserve(order.size());
+      for (const uint32_t i : order)
+        sorted.push_back(selection[i]);
+
+      selection.swap(sorted);
+    }
+
+    if (select.limit_ >= 0 && (std::size_t)select.limit_ < selection.size())
+      selection.resize(select.limit_);
+
+    if (columns.empty())
+    {
+      // Like filter the result is a view on the same document
+      Buffer buffer;
+      buffer.doc_ = source;
+      buffer.view_ = true;
+
+      buffer.rows_.reserve(selection.size() + 1);
+      if (header >= 0)
+        buffer.rows_.push_back(header);
+      buffer.rows_.insert(buffer.rows_.end(), selection.begin(), selection.end());
+
+      documentBuffers().push_back(std::move(buffer));
+      jumpToBuffer(documentBuffers().size() - 1);
+    }
+    else
+    {
+      // Only the projected columns are evaluated and copied
+      if (header >= 0)
+        selection.insert(selection.begin(), header);
+
+      for (const int row : selection)
+        for (const int x : columns)
+        {
+          Cell * cell = doc.cells_.find(Index(x, row));
+          if (cell && cell->hasExpression() && !cell->evaluated)
+            evaluateCell(Index(x, row), *cell);
+        }
+
+      createDefaultEmpty();
+
+      std::vector<uint32_t> ids(source->strings_.size(), UINT32_MAX);
+
+      for (std::size_t x = 0; x < columns.size(); ++x)
       {
-        for (int i = 0; i < doc.width_; ++i)
-          buffer.doc_.cells_[Index(i, row)] = doc.cells_[Index(i, y)];
-        ++row;
+        const int width = source->columns_.stored(columns[x]);
+        if (width >= 0)
+          currentDoc().columns_.set(x, width);
       }
+
+      for (std::size_t y = 0; y < selection.size(); ++y)
+        for (std::size_t x = 0; x < columns.size(); ++x)
+          copyJoinedCell(*source, Index(columns[x], selection[y]), Index(x, y), ids);
+
+      currentDoc().width_ = std::max<int>(currentDoc().width_, columns.size());
+
+      if (header >= 0)
+        selection.erase(selection.begin());
     }
 
-    buffer.doc_.height_ = row;
+    flashMessage("Selected " + std::to_string(selection.size()) + " rows");
+    return true;
+  }
+
+  TCL_FUNC(query, "sql", "Run a SELECT statement over an open buffer, see Query.h for the grammar. SELECT * gives a view of the selected rows, selecting columns copies them into a new buffer.")
+  {
+    TCL_CHECK_ARG(2);
+    TCL_STRING_ARG(1, sql);
 
-    documentBuffers().push_back(buffer);
-    jumpToBuffer(documentBuffers().size() - 1);
+    query::Select select;
+    std::string error;
+    if (!query::parse(sql, select, error))
+    {
+      logError("query: ", error);
+      return JIM_ERR;
+    }
+
+    const long buffer = findQueryBuffer(select.from_);
+    if (buffer < 0)
+    {
+      logError("query: no buffer ", select.from_);
+      return JIM_ERR;
+    }
+
+    // A query that succeeds leaves its result current, one that fails the buffer it came from
+    BufferSwitch bufferSwitch(buffer);
+    if (!runQuery(select))
+      return JIM_ERR;
 
+    bufferSwitch.keep();
     return JIM_OK;
   }
 
+  TCL_FUNC(pipeline, "?-noHeader? ?load filename |? stage ?| stage ...?", "Run the stages one after the other on batches of rows, with nothing in between them held but what sort, top and groupby need. The rows come from the CSV file of a first load stage, read a chunk at a time, or else from the current buffer. A stage is a filter, dedupe, sort, top or groupby with the arguments of that command, join buffer column bufferColumn ?-inner|-left?, or a last export filename. Without an export the rows go into a new buffer. Returns the number of rows of the result.")
+  {
+    TCL_CHECK_ARGS(2, 1000);
+
+    std::vector<std::string> args = stringArgs(1, argc, argv);
+    const bool header = args[0] != "-noHeader";
+    if (!header)
+      args.erase(args.begin());
+
+    std::size_t rows = 0;
+    if (!runPipeline(args, header, rows))
+      return JIM_ERR;
+
+    Jim_SetResult(interp, Jim_NewIntObj(interp, (long long)rows));
+    return JIM_OK;
+  }
 }
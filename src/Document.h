@@ -3,18 +3,38 @@
 
 #include "Cell.h"
 #include "Index.h"
+#include "Reduce.h"
 
 namespace doc {
 
+  // Edits made while a Transaction is alive are undone as one, and the cells they affect
+  // are recalculated once when the outermost transaction ends
+  class Transaction
+  {
+    public:
+      Transaction();
+      ~Transaction();
+
+      Transaction(Transaction const&) = delete;
+      Transaction & operator = (Transaction const&) = delete;
+  };
+
   void createDefaultEmpty();
   void close();
 
+  // Closes every buffer. Their journals are removed, edits that were not saved are lost.
+  void shutdown();
+
   void nextBuffer();
   void previousBuffer();
   void jumpToBuffer(int buffer);
   int currentBufferIndex();
   int getOpenBufferCount();
 
+  // Bytes held by each part of buffer, by name. A document shared by several buffers is
+  // only counted for the first of them, the others report their rows and undo history.
+  std::vector<std::pair<std::string, std::size_t>> memoryUsage(int buffer);
+
   Index & cursorPos();
   Index & scroll();
   Index & selectionStart();
@@ -22,12 +42,21 @@ namespace doc {
 
   bool hasSelection();
   
-  std::vector<Index> selectedCells();
-  std::vector<Index> selectedColumns();
-  std::vector<Index> selectedRows();
+  // The selected rectangle, or the cursor when nothing is selected. The columns and rows
+  // are the first row and the first column of it.
+  IndexRange selectedCells();
+  IndexRange selectedColumns();
+  IndexRange selectedRows();
   Index selectionIndex(Index const& idx);
 
+  // Count, sum and range of the numbers in the selection. Returns false when nothing is
+  // selected, or while the stats of a large selection are computed in the background.
+  bool selectionStats(reduce::Stats & stats);
+
   int getColumnWidth(int column);
+
+  // Returns the sum of the widths of the columns before column
+  int getColumnOffset(int column);
   void setColumnWidth(int column, int width);
 
   int getRowCount();
@@ -38,8 +67,44 @@ namespace doc {
   bool redo();
 
   bool save(std::string const& filename);
+
+  // A session holds the open buffers: the documents as ZUM2 images with their formula
+  // values and indexes, views with their rows, cursors, selections and undo histories.
+  // Restoring one opens its buffers after the open ones and shows its current buffer.
+  bool saveSession(std::string const& filename);
+  bool restoreSession(std::string const& filename);
+
+  // Loading "-" reads a CSV document from standard input, in the background like a large file
   bool load(std::string const& filename);
 
+  // Loads the files into buffers in their order and shows the first. The CSV files are
+  // parsed at the same time, the first is in when this returns, updateLoading() puts the
+  // others in as they finish.
+  bool load(std::vector<std::string> const& filenames);
+
+  // Opens the files in directory that match pattern, in the order of their names, as the
+  // partitions of one paged document. The header of the first stands for all of them.
+  bool loadDirectory(std::string const& directory, std::string const& pattern);
+
+  // Large CSV documents are loaded on a background thread. While one is loading its
+  // buffer is read-only, updateLoading() merges the rows parsed so far into it and
+  // returns true when the buffer changed.
+  bool isLoading();
+  bool updateLoading();
+  void cancelLoad();
+
+  // A followed document appends the lines added to its CSV file, the way tail -f reads
+  // a log. updateFollowing() looks for them every doc_followInterval milliseconds and
+  // returns true when a document grew. Cursors on the last row stay on it.
+  bool follow(bool enable);
+  bool isFollowing();
+  bool updateFollowing();
+
+  // Applies the changes of the CSV file the current document was loaded from, reading
+  // again only the runs of rows that differ from those it was loaded with, as one edit
+  // that can be undone. Returns the rows read, -1 if the document can't be reloaded.
+  int reload();
+
   // This will load a document as read-only from the supplied string.
   bool loadRaw(std::string const& data, std::string const& filename, char delimiter = 0);
 
@@ -47,17 +112,123 @@ namespace doc {
 
   void evaluateDocument();
 
+  // Lazy evaluation mode leaves formulas of a freshly loaded document unevaluated, and a
+  // large recalculation after an edit is done in slices. evaluateIdle() evaluates the next
+  // batch of them while there is nothing else to do, it returns true when it evaluated
+  // cells of a recalculation, which may be on screen.
+  bool hasPendingEvaluation();
+  bool evaluateIdle();
+
+  // Rows first to last of the current buffer are about to be scrolled to. The pages of a
+  // paged document holding them are split on the scheduler, and the formulas in them that
+  // lazy evaluation or a sliced recalculation left are the ones evaluateIdle() does next.
+  void readAhead(int first, int last);
+
+  // True while cells of a sliced recalculation are still stale
+  bool isRecalculating();
+
   std::string getCellText(Index const& idx);
   std::string getCellDisplayText(Index const& idx);
+
+  // The same texts without copying them. The view points into the document, or into
+  // scratch for text that has to be made, and is valid until the document changes.
+  StrView getCellText(Index const& idx, std::string & scratch);
+  StrView getCellDisplayText(Index const& idx, std::string & scratch);
+
+  // For drawing: a cell a sliced recalculation hasn't reached yet shows its previous value
+  // and sets stale, instead of being evaluated
+  StrView getCellDisplayText(Index const& idx, std::string & scratch, bool & stale);
   uint32_t getCellFormat(Index const& idx);
+
+  // For drawing: the view::Colors the format rules of the column give the cell, 0 when
+  // none matches. COLOR_HIGHLIGHT is the background, the other bits go with the text.
+  uint16_t getCellStyle(Index const& idx);
+
+  // For drawing: what evaluating the formula at idx took in the recalculations timed by
+  // recalcProfile, as a share of the most any formula of the document took. 0 for the
+  // cells that weren't timed.
+  double getFormulaCost(Index const& idx);
+
   double getCellValue(Index const& idx);
 
+  // The value of the key of a lookup: as getCellValue(), but a text cell gives its text as
+  // a value::fromText() of its id in the string pool of the document
+  double getCellKey(Index const& idx);
+
+  // Sums the values of the cells from start to end, both corners inclusive
+  double sumRange(Index const& start, Index const& end);
+
+  // The lookup functions of formulas, over the range from start to end. Cells match value
+  // when they hold that number or a formula giving it, or that text. Empty cells never match.
+  // The rows of a column of the range are indexed by value once for all the lookups in
+  // them, until the column changes.
+  //
+  // matchRange() gives the row of the first match in the first column, counted from 1,
+  // and lookupRange() the value in column of that row, counted from 1 as well. Both give
+  // NaN without a match. countRange() counts the matches in the whole range, sumIfRange()
+  // sums column of the rows whose first column matches.
+  double matchRange(double value, Index const& start, Index const& end);
+  double lookupRange(double value, Index const& start, Index const& end, double column);
+  double countRange(double value, Index const& start, Index const& end);
+  double sumIfRange(double value, Index const& start, Index const& end, double column);
+
+  // Runs read with the document of the buffer sheet names, see sheetName(), as the one
+  // the functions above read, for references like ref!B2. A buffer is named by its file
+  // name without the directory and extension. Returns false, without running read, if no
+  // loaded buffer has the name.
+  bool readSheet(int sheet, std::function<void ()> const& read);
+
+  // Finds the first cell after from, or before it when searching backwards, whose text
+  // contains term. Cells are searched in row-major order.
+  bool findText(std::string const& term, Index const& from, bool forward, Index & match);
+
+  // Collects the cells from first to last, both corners inclusive, that findText() would match
+  std::vector<Index> findTextInBlock(std::string const& term, Index const& first, Index const& last);
+
+  // Where a jump from from by dx or dy, one of them 1 or -1, lands: the last cell of the
+  // stretch of cells showing something that from and the next cell are in, otherwise the
+  // next cell that shows something, or the first or last row or column of the document
+  Index findDataEdge(Index const& from, int dx, int dy);
+
   void setCellText(Index const& idx, std::string const& text);
+  // Sets values[row][column] from origin on, as a single undoable edit that recalculates
+  // the cells depending on them once
+  void setCellTexts(Index const& origin, std::vector<std::vector<std::string>> const& values);
+  // Sets the cells of column from row first on to numbers, the same single edit
+  void setColumnValues(int column, int first, std::vector<double> const& values);
+
   void setCellFormat(Index const& idx, uint32_t format);
 
+  // Replaces the format of the cells of range inside the document with change(format),
+  // as a single undoable edit
+  void changeCellFormats(IndexRange const& range, std::function<uint32_t(uint32_t)> const& change);
+
+  // Empties the cells of range, as a single undoable edit that recalculates once
+  void clearCells(IndexRange const& range);
+
+  // Fills range from the cells in its first row, or its first column when right, as a
+  // single undoable edit. Formulas share the template of the cell they are filled from,
+  // two numbers continue as a series and other cells are copied.
+  void fillCells(IndexRange const& range, bool right);
+
+  // Yanks the cells of range for pasteCells(). Nothing is copied, the yanked cells share
+  // their tiles with the document until either of them changes.
+  void yankCells(IndexRange const& range);
+
+  // Pastes the cells yanked last with their top left cell at idx, as a single undoable
+  // edit. Returns false if nothing was yanked.
+  bool pasteCells(Index const& idx);
+
+  // Pastes delimited text, a row of cells per line, from idx on as a single undoable edit
+  void pasteText(Index const& idx, std::string const& text);
+
   void increaseColumnWidth(int column);
   void decreaseColumnWidth(int column);
 
+  // Sets the width of each of columns to fit the longest value of a sample of its rows,
+  // as a single undoable edit
+  void fitColumns(std::vector<int> const& columns);
+
   void addColumn(int column);
   void addRow(int row);
   void removeColumn(int column);
@@ -0,0 +1,991 @@
+#pragma once
+
+#include "Cell.h"
+#include "Index.h"
+#include "Expression.h"
+#include "CellStorage.h"
+#include "ColumnIndex.h"
+#include "ColumnLayout.h"
+#include "StringPool.h"
+#include "SearchIndex.h"
+#include "TextPattern.h"
+#include "DependencyGraph.h"
+#include "FlatHashMap.h"
+#include "Sketch.h"
+#include "ColumnEncoding.h"
+#include "BinaryFormat.h"
+#include "Journal.h"
+#include "PagedTable.h"
+#include "RowVisibility.h"
+#include "MurmurHash.h"
+#include "Memoize.h"
+#include "LoadSelection.h"
+#include "Tcl.h"
+#include "CsvScanner.h"
+
+#include "bx/allocator.h"
+#include "bx/handlealloc.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <tuple>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+
+// The documents and buffers behind the functions of Document.h. Document.cpp keeps them
+// and dispatches the commands, the features that grew large enough for a translation
+// unit of their own work on them through this header. Nothing outside of doc includes it.
+namespace doc {
+
+  // Size and modification time of a file, to tell whether it changed
+  struct FileStamp
+  {
+    long long size_ = -1;
+    long long time_ = 0;
+
+    bool valid() const { return size_ >= 0; }
+    bool operator == (FileStamp const& other) const { return size_ == other.size_ && time_ == other.time_; }
+  };
+
+  // A save or export that waits for the one in flight
+  struct PendingWrite
+  {
+    std::string filename_;
+    bool export_ = false;
+  };
+
+  // Approximate statistics of the cells of one column, see the colstats command. add()
+  // takes the cells in any order and summaries of ranges of rows can be merged.
+  struct ColumnSummary
+  {
+    sketch::HyperLogLog distinct_;
+    sketch::Quantiles quantiles_;
+
+    // Cells that aren't empty, and whether any is a formula
+    uint64_t values_ = 0;
+    bool formulas_ = false;
+
+    // Formulas have to be evaluated, their values are counted instead of their texts
+    void add(Cell const& cell, StringPool const& strings)
+    {
+      if (cell.type == CellType::Formula)
+      {
+        uint64_t bits;
+        memcpy(&bits, &cell.value, sizeof(bits));
+
+        distinct_.add(murmurMix64(bits) ^ 0x5bd1e9955bd1e995ull);
+        quantiles_.add(cell.value);
+        formulas_ = true;
+      }
+      else if (!strings.str(cell.text).empty())
+      {
+        // Equal texts share an id in the pool
+        distinct_.add(murmurMix64((uint64_t)cell.text + 1));
+        if (cell.type == CellType::Number)
+          quantiles_.add(cell.value);
+      }
+      else
+        return;
+
+      values_++;
+    }
+
+    void merge(ColumnSummary const& other)
+    {
+      distinct_.merge(other.distinct_);
+      quantiles_.merge(other.quantiles_);
+      values_ += other.values_;
+      formulas_ |= other.formulas_;
+    }
+  };
+
+  // The summary of a column below its header the colstats command keeps. Edits of single
+  // cells add their new value, which keeps values_ exact but leaves the old one in the
+  // sketches, so it is built again once there were more than one edit per
+  // SKETCH_ROWS_PER_EDIT rows. Other changes of the column, and of anything while it has
+  // formulas, make it stale.
+  struct ColumnSketch
+  {
+    int column_ = 0;
+    bool stale_ = true;
+
+    // Rows of the document, and its changes_, when it was last up to date
+    int height_ = 0;
+    uint64_t changes_ = 0;
+    uint64_t edits_ = 0;
+
+    ColumnSummary summary_;
+  };
+
+  // A column computed by one expression over the other columns of the same row, see the
+  // colexpr command. Its cells are virtual: a row that stores no cell in the column shows
+  // the value of the expression, one that does shows its own cell. The values are
+  // computed a block of COLUMN_FORMULA_BLOCK_ROWS rows at a time, when they are first
+  // looked at, and a block again once a cell in it changed.
+  struct ColumnFormula
+  {
+    int column_ = 0;
+
+    // References are to row 0, inputs_ are the columns they read
+    std::vector<Expr> expression_;
+    Program program_;
+    std::vector<int> inputs_;
+
+    // Values of the height_ rows, the ones of a block are up to date while its valid_
+    // flag is set
+    std::vector<double> values_;
+    std::vector<bool> valid_;
+    int height_ = 0;
+
+    // Set once a block read a formula cell, whose value may change with any edit. The
+    // blocks were computed at Document::changes_ of changes_.
+    bool formulaInputs_ = false;
+    uint64_t changes_ = 0;
+
+    // Set while a block is computed, a formula reading the column meanwhile is a cycle
+    bool computing_ = false;
+  };
+
+  // A conditional format of a column, see the highlight command. The cells it matches
+  // are drawn with style_. A comparison reads its cell alone, the other kinds read the
+  // whole column once: a duplicate counts the cells by value, which go stale like the
+  // lookup indexes, and the top and bottom shares compare to a quantile of the sketch of
+  // the column.
+  struct FormatRule
+  {
+    enum Kind { Above, Below, Equal, Duplicate, Top, Bottom };
+
+    int column_ = 0;
+    Kind kind_ = Above;
+    uint16_t style_ = 0;
+
+    // What is compared to, a percent of the numbers for Top and Bottom. Equal compares
+    // text cells to text_, and number cells too when it isn't a number.
+    std::string text_;
+    double value_ = 0.0;
+    bool number_ = false;
+
+    // Cells by lookupKey() of their number or by their text for Duplicate, as of the
+    // rows and changes_ of the document
+    bool stale_ = true;
+    bool formulas_ = false;
+    int height_ = 0;
+    uint64_t changes_ = 0;
+    FlatHashMap<uint32_t> numbers_;
+    FlatHashMap<uint32_t> texts_;
+
+    // The quantile Top and Bottom compare to, NaN without numbers
+    double threshold_ = 0.0;
+  };
+
+  // The style format rules gave a cell, as long as it holds the same value and the rules
+  // are at the same generation
+  struct CachedStyle
+  {
+    double value_;
+    uint32_t text_;
+    CellType type_;
+    uint32_t generation_;
+    uint16_t style_;
+  };
+
+  // The rows of one column of a range by their value, which MATCH, VLOOKUP, COUNTIF and
+  // SUMIF look up. One is kept for each column and rows of the ranges formulas look up
+  // in, shared by all of them, and built when the first one needs it. Edits of the column
+  // make it stale, and so do any change and recalculation while it holds values of
+  // formulas or of a column formula.
+  struct ColumnLookup
+  {
+    // The rows holding a value are rows_[first_] on, in order
+    struct Entry
+    {
+      uint32_t first_ = 0;
+      uint32_t count_ = 0;
+    };
+
+    bool stale_ = true;
+
+    // Set while it is built, a formula looking up in it meanwhile is a cycle
+    bool building_ = false;
+
+    // Rows of the document, its changes_ and the formula resets when it was built
+    int height_ = 0;
+    bool formulas_ = false;
+    uint64_t changes_ = 0;
+    uint64_t resets_ = 0;
+
+    FlatHashMap<Entry> values_;
+    std::vector<int> rows_;
+  };
+
+  // A column as the filter and groupby commands read it, see ColumnEncoding.h, built the
+  // second time they scan it so a column scanned once doesn't pay for it. Blocks holding a formula aren't encoded and are read from
+  // the cells. Edits of the column make it stale, like a ColumnLookup.
+  struct EncodedColumn
+  {
+    struct Block
+    {
+      bool encoded_ = false;
+
+      // A text cell, which a comparison reads the number it starts with of, or a number
+      // cell without a text, which filters leave out
+      bool text_ = false;
+      bool hiddenNumbers_ = false;
+
+      // Ids of the texts and the values of the number cells
+      encoding::IdBlock ids_;
+      encoding::NumberBlock numbers_;
+    };
+
+    int column_ = 0;
+    bool stale_ = true;
+    int height_ = 0;
+    std::vector<Block> blocks_;
+
+    // Scans of the column while stale
+    int scans_ = 0;
+  };
+
+  // A column block of the ZUM2 file a document was saved to or loaded from, hash_ is the
+  // one of the raw block
+  struct SavedBlock
+  {
+    zum2::ColumnEntry entry_;
+    uint64_t hash_ = 0;
+    uint64_t formulaChecksum_ = 0;
+    bool formulas_ = false;
+  };
+
+  struct SavedIndex
+  {
+    zum2::IndexEntry entry_;
+    uint64_t hash_ = 0;
+  };
+
+  // Where the blocks of the document are in the ZUM2 file it was last saved to or loaded
+  // from, for the next save to that file to only append what changed, see appendZum2().
+  // The blocks are by column and block of rows, see blockKey(). The tiles of the cells
+  // written in epoch_ or a later one changed since.
+  struct SavedLayout
+  {
+    std::string filename_;
+    FileStamp stamp_;
+    uint64_t epoch_ = 0;
+    std::map<uint64_t, SavedBlock> blocks_;
+    std::vector<SavedIndex> indexes_;
+
+    // The end of the file, and the bytes of it the header still leads to
+    uint64_t fileSize_ = 0;
+    uint64_t liveBytes_ = 0;
+  };
+
+  // A run of rows of the CSV file a document was loaded from. A run ends after a row whose
+  // hash has its low FILE_CHUNK_BITS bits clear, so a file rewritten with a part of it
+  // changed has the same runs outside of that part. hash_ is a polynomial of the hashes
+  // of the rows, the runs the parse chunks of a load cut one into join to the same hash.
+  struct FileChunk
+  {
+    uint64_t hash_ = 0;
+    uint32_t rows_ = 0;
+    bool closed_ = false;
+  };
+
+  // A row of the CSV file a document was loaded from, by the low bits of its hash and the
+  // number of its fields. reload() pairs the rows of a run that differs with the rows of
+  // the file by them, and only reads again the ones that changed.
+  struct FileLine
+  {
+    uint32_t hash_;
+    uint32_t fields_;
+  };
+
+  static const int FILE_CHUNK_BITS = 7;
+  static const uint64_t FILE_CHUNK_PRIME = 0x100000001b3ull;
+
+  // Edits a diff without a key looks for when aligning rows, past them the rows that
+  // differ are paired in order. Following the edits back keeps about its square of ints.
+  static const int DIFF_MAX_EDITS = 2048;
+
+  // Rows a scan over a column takes on at least, per task on the scheduler
+  static const std::size_t FILTER_CHUNK_ROWS = 16384;
+
+  // A filter clause over at least FILTER_CHUNK_ROWS selected rows is applied in chunks of
+  // about as many rows on the scheduler, a few per worker so a slow chunk is made up for
+  static const int FILTER_CHUNKS_PER_THREAD = 4;
+
+  // Cells of a run of whole CSV lines, with rows relative to the start of the chunk
+  struct ParsedChunk
+  {
+    StrView data_;
+    std::vector<std::pair<Index, Cell>> cells_;
+    StringPool strings_;
+    int rows_ = 0;
+
+    // The longest value of each column, the columns are fitted to it once per chunk
+    std::vector<std::size_t> widths_;
+
+    // Offset in data_ of the first byte that isn't well formed UTF-8
+    std::size_t malformed_ = StrView::npos;
+
+    // The runs of the lines that end, the first may continue the last run of the chunk before
+    std::vector<FileChunk> fileChunks_;
+    std::vector<FileLine> fileLines_;
+  };
+
+  // What evaluating a formula took in the recalculations recalcProfile timed
+  struct FormulaCost
+  {
+    int64_t ticks_ = 0;
+    uint32_t calls_ = 0;
+    std::shared_ptr<const FormulaTemplate> pattern_;
+  };
+
+  struct Document
+  {
+    int width_ = 0;
+    int height_ = 0;
+    ColumnLayout columns_;
+    CellStorage cells_;
+    StringPool strings_;
+    SearchIndex search_;
+    DependencyGraph dependencies_;
+
+    // The regular expression searched for last, it keeps what it found of the strings
+    std::shared_ptr<TextPattern> searchPattern_;
+
+    // Dependencies of the formulas on other buffers, by the sheet they reference
+    std::map<int, DependencyGraph> sheetDependencies_;
+
+    // Secondary indexes of columns, see the index command
+    std::vector<ColumnIndex> indexes_;
+
+    // Summaries of columns, see the colstats command
+    std::vector<ColumnSketch> sketches_;
+
+    // Computed columns, see the colexpr command
+    std::vector<ColumnFormula> columnFormulas_;
+
+    // Conditional formats, see the highlight command, and the styles of the cells drawn.
+    // styleGeneration_ changes with the rules and whatever they read of whole columns.
+    std::vector<FormatRule> formatRules_;
+    FlatHashMap<CachedStyle> cellStyles_;
+    uint32_t styleGeneration_ = 0;
+
+    // Cells drawn highlighted whatever the rules, the changed cells of a diff
+    FlatHashSet markedCells_;
+
+    // Indexes of the lookup functions by column, first and last row. Workers evaluating
+    // formulas in parallel share them under lookupMutex_, which a formula evaluated while
+    // an index is built takes again.
+    std::map<std::tuple<int, int, int>, ColumnLookup> lookups_;
+    std::recursive_mutex lookupMutex_;
+
+    // Encoded columns, see encodedColumn()
+    std::vector<EncodedColumn> encodings_;
+
+    // Results of filters, queries and groupbys, see findMemoizedResult()
+    std::vector<MemoizedResult> results_;
+
+    // The strings and cells when what they hold was last counted, the edits that emptied
+    // a cell since, and the free slots of the tile file when its tiles were last moved,
+    // see compactionDue()
+    std::size_t checkedStrings_ = 0;
+    std::size_t checkedCells_ = 0;
+    std::size_t emptiedCells_ = 0;
+    std::size_t checkedFreeSlots_ = 0;
+
+    // Templates of the formulas in cells_ by their relative expression, see shareFormula()
+    std::unordered_map<std::string, std::shared_ptr<const FormulaTemplate>> formulaTemplates_;
+
+    // The costs of the formulas by where they were when they were timed, and the highest
+    // of them. Workers evaluating in parallel add to them under formulaCostMutex_.
+    FlatHashMap<FormulaCost> formulaCosts_;
+    int64_t formulaCostMax_ = 0;
+
+    std::string filename_;
+    bool readOnly_ = false;
+
+    // The sheet other documents reference this one by, for the filename it was named after
+    int sheet_ = Expr::NO_SHEET;
+    std::string sheetFilename_;
+
+    bool binary_ = false;
+    bool loading_ = false;
+    char delimiter_;
+    std::unique_ptr<Journal> journal_;
+
+    // Set by the first edit after the document was loaded or saved. stamp_ identifies the
+    // version of the file the document was loaded from or saved to.
+    bool modified_ = false;
+    FileStamp stamp_;
+    std::shared_ptr<const SavedLayout> savedLayout_;
+
+    // Counts the edits and evaluations of the cells, what was computed from them is
+    // stale once it changes
+    uint64_t changes_ = 0;
+
+    // Set for a paged document, which has no cells and reads its fields from the file
+    std::unique_ptr<PagedTable> paged_;
+
+    // Whole lines of the CSV file the document was loaded from. A followed document
+    // appends the lines that start at followOffset_ of the file from row fileRows_ on.
+    int fileRows_ = 0;
+    bool following_ = false;
+
+    // Whether loading it came across text that isn't well formed UTF-8, which is logged once
+    bool malformedText_ = false;
+
+    // The runs of the rows of fileRows_ and the rows themselves, which reload() compares
+    // with those of the file. Edits that move rows drop them, reload() then reads every
+    // row again.
+    std::vector<FileChunk> fileChunks_;
+    std::vector<FileLine> fileLines_;
+    long long followOffset_ = 0;
+
+    // Formulas evaluateIdle() still has to visit, from pendingPosition_ on
+    std::vector<Index> pendingFormulas_;
+    std::size_t pendingPosition_ = 0;
+
+    // Rows evaluateIdle() evaluates the formulas of before anything else, see readAhead()
+    std::vector<int> readAheadRows_;
+
+    // Cells a sliced recalculation still has to evaluate, from recalcPosition_ on. Those
+    // in recalcStale_ kept the value from before the edit for drawing.
+    std::vector<Index> recalcQueue_;
+    std::size_t recalcPosition_ = 0;
+    FlatHashSet recalcStale_;
+
+    // Set while a snapshot of the document is written in the background. What is
+    // journaled meanwhile is kept in writeJournal_ while it is a save, since the saved
+    // file won't have it.
+    bool writing_ = false;
+    bool saving_ = false;
+    std::string writeJournal_;
+    std::vector<PendingWrite> queuedWrites_;
+  };
+
+  enum class EditAction
+  {
+    CellText,
+    ColumnWidth,
+    AddColumn,
+    RemoveColumn,
+    AddRow,
+    RemoveRow,
+    SortRows,
+    Fill
+  };
+
+  // Content of a single cell as seen by undo/redo
+  struct CellState
+  {
+    Index idx_;
+    bool exists_ = false;
+    std::string text_;
+    uint32_t format_ = 0;
+  };
+
+  // One reversible edit. Only the fields used by action_ are filled in.
+  struct UndoRecord
+  {
+    EditAction action_;
+    int position_ = 0;                  // column or row of width and structural edits, 1 for a Fill to the right
+    CellState before_;                  // CellText, the corners of the range of a Fill
+    CellState after_;
+    int widthBefore_ = -1;              // ColumnWidth and RemoveColumn, -1 is the default width
+    int widthAfter_ = -1;
+    std::vector<CellState> removed_;    // cells dropped by RemoveColumn/RemoveRow or replaced by Fill
+    std::vector<CellState> rewritten_;  // formulas the removal shifted, as they were before it
+    std::vector<uint32_t> order_;       // SortRows, row position_ + order_[i] moved to position_ + i
+  };
+
+  struct UndoState
+  {
+    UndoState(Index const& idx, Index const& size, EditAction action)
+      : cursor_(idx),
+        size_(size),
+        action_(action)
+    { }
+
+    Index cursor_;
+    Index size_;
+    EditAction action_;
+    std::vector<UndoRecord> records_;
+
+    // Memory held by records_, measured when the next state is started
+    std::size_t bytes_ = 0;
+  };
+
+  // Undo states evicted to a temporary file, which is removed when it is closed. The
+  // newest is last, states_ holds where each of them starts and its length.
+  struct UndoSpill
+  {
+    UndoSpill() { }
+    ~UndoSpill() { if (file_) fclose(file_); }
+
+    UndoSpill(UndoSpill const&) = delete;
+    UndoSpill & operator = (UndoSpill const&) = delete;
+
+    FILE * file_ = nullptr;
+    std::vector<std::pair<long, std::size_t>> states_;
+  };
+
+  // A view shares the document of the buffer it was made from and only shows its rows_,
+  // the rows of the document in the order they are shown
+  struct Buffer
+  {
+    Buffer() { }
+    Buffer(Buffer && other) = default;
+    Buffer & operator = (Buffer && other) = default;
+
+    Buffer(Buffer const&) = delete;
+    Buffer & operator = (Buffer const&) = delete;
+
+    std::shared_ptr<Document> doc_ = std::make_shared<Document>();
+    bool view_ = false;
+    std::vector<int> rows_;
+    Index cursorPos_ = Index(0, 0);
+    Index scroll_ = Index(0, 0);
+    Index selectionStart_ = Index(-1, -1);
+    Index selectionEnd_ = Index(-1, -1);
+    std::deque<UndoState> undoStack_;
+    std::vector<UndoState> redoStack_;
+
+    // Sum of the bytes_ of the states in undoStack_
+    std::size_t undoBytes_ = 0;
+    std::unique_ptr<UndoSpill> undoSpill_;
+
+    // The share of the rows of what it was sampled from that a sample shows, counting a
+    // header it keeps, 1 for anything else. Estimates of the whole divide by it.
+    double sampleRate_ = 1.0;
+
+    // The rows hide and filter -inplace hid, counted the way the buffer shows its rows
+    RowVisibility hidden_;
+  };
+
+  // The open buffers in the order they are numbered. Each buffer is allocated once,
+  // under a handle, and stays where it is until it is closed. Opening, closing and
+  // switching buffers only ever move handles.
+  class BufferRegistry
+  {
+    public:
+      class iterator
+      {
+        public:
+          iterator(BufferRegistry * registry, std::size_t i) : registry_(registry), i_(i) { }
+
+          Buffer & operator * () const { return (*registry_)[i_]; }
+          iterator & operator ++ () { ++i_; return *this; }
+          bool operator != (iterator const& other) const { return i_ != other.i_; }
+
+        private:
+          BufferRegistry * registry_;
+          std::size_t i_;
+      };
+
+    public:
+      BufferRegistry() { }
+      ~BufferRegistry();
+
+      BufferRegistry(BufferRegistry const&) = delete;
+      BufferRegistry & operator = (BufferRegistry const&) = delete;
+
+      std::size_t size() const { return order_.size(); }
+      bool empty() const { return order_.empty(); }
+
+      Buffer & operator [] (std::size_t i) { return *buffers_[order_[i]]; }
+      Buffer & at(std::size_t i) { assert(i < order_.size()); return (*this)[i]; }
+
+      iterator begin() { return iterator(this, 0); }
+      iterator end() { return iterator(this, order_.size()); }
+
+      // Adds buffer after the last one
+      void push_back(Buffer && buffer);
+
+      void erase(std::size_t i);
+      void clear();
+
+    private:
+      // Moves the handles to an allocator with twice the room
+      void grow();
+
+    private:
+      bx::CrtAllocator allocator_;
+      bx::HandleAlloc * handles_ = nullptr;
+      std::vector<std::unique_ptr<Buffer>> buffers_;    // by handle
+      std::vector<uint16_t> order_;
+  };
+
+  // Makes a buffer the current one while it is alive, for the row and cell helpers that
+  // work on the current buffer. The previous buffer is current again when it ends, unless
+  // keep() was called.
+  class BufferSwitch
+  {
+    public:
+      explicit BufferSwitch(int buffer);
+      ~BufferSwitch();
+
+      BufferSwitch(BufferSwitch const&) = delete;
+      BufferSwitch & operator = (BufferSwitch const&) = delete;
+
+      // Stays in the buffer switched to
+      void keep() { previous_ = -1; }
+
+    private:
+      int previous_;
+  };
+
+  // A block of cells yanked by yankCells(). The cells stay in a copy of the storage of the
+  // document they came from, which shares its tiles until either of them changes one, and
+  // their texts are ids in the pool of doc_. The cells of a block yanked from a view are
+  // in the rows of rows_, the ones of other blocks in the rows from first_ down.
+  struct Clip
+  {
+    std::shared_ptr<Document> doc_;
+    CellStorage cells_;
+    Index first_ = Index(0, 0);
+    Index size_ = Index(0, 0);
+    std::vector<int> rows_;
+
+    Index source(int x, int y) const { return Index(first_.x + x, rows_.empty() ? first_.y + y : rows_[y]); }
+  };
+
+  // The open buffers, the current one, and its document or the one readSheet() reads
+  BufferRegistry & documentBuffers();
+  Buffer & currentBuffer();
+  Document & currentDoc();
+
+  // Calls fn with every document of the buffers once, a document several buffers show too
+  template <typename F>
+  void forEachDocument(F fn)
+  {
+    std::vector<Document *> documents;
+    for (auto & buffer : documentBuffers())
+    {
+      if (std::find(documents.begin(), documents.end(), buffer.doc_.get()) != documents.end())
+        continue;
+
+      documents.push_back(buffer.doc_.get());
+      fn(*buffer.doc_);
+    }
+  }
+
+  // Counts the formulas reset to be evaluated again, which may then change their value
+  uint64_t formulaResets();
+
+  ColumnFormula * findColumnFormula(Document & doc, int column);
+
+  // Whether the sketch is up to date, and the sketch of column built again unless it is
+  bool sketchCurrent(Document const& doc, ColumnSketch const& sketch);
+  ColumnSketch & useColumnSketch(Document & doc, int column);
+
+  // Filters and groupby read the columns of an unpaged document encoded when this is
+  // set, see encodedColumn()
+  extern const tcl::Variable COLUMN_ENCODING;
+
+  // Counts a scan of column and returns it encoded, built first if it is stale and was
+  // scanned before. nullptr until then, with doc_columnEncoding off or for a document
+  // that is loading or paged.
+  EncodedColumn const* encodedColumn(Document & doc, int column);
+
+  // The encoded column if it is current, or nullptr
+  EncodedColumn const* currentEncodedColumn(Document const& doc, int column);
+
+  // Marks the lookup indexes of column as stale, a negative column drops all of them. The
+  // counts of the format rules, the encoded columns and the memoized results that read it
+  // go stale with them.
+  void invalidateLookups(Document & doc, int column);
+
+  enum class FilterOp
+  {
+    Equal,
+    NotEqual,
+    Match,
+    NoMatch,
+    Greater,
+    GreaterEqual,
+    LessThan,
+    LessEqual,
+    Like,
+    NotLike,
+    Regexp,
+    NotRegexp
+  };
+
+  // A filter clause is compiled once before any row is looked at. The literal is
+  // looked up in the string pool and, for comparisons, parsed into a number or the
+  // microseconds of a timestamp.
+  struct FilterClause
+  {
+    int column = 0;
+    FilterOp op = FilterOp::Match;
+    std::string value;
+    uint32_t valueId = StringPool::EMPTY;
+    double number = 0.0;
+
+    // Text that isn't a number fails a comparison instead of the whole filter
+    bool skipText = false;
+
+    // The regular expression of Regexp and NotRegexp
+    std::shared_ptr<TextPattern> pattern;
+  };
+
+  // Parses the column, operation and value triples of args from first on into clauses
+  // compiled against strings. Columns are checked against columnCount unless it is
+  // negative.
+  bool parseFilterClauses(std::vector<std::string> const& args, std::size_t first, StringPool const& strings, int columnCount, std::vector<FilterClause> & clauses);
+
+  // Sets include when text, the display text of a cell, passes clause. isNumber is set
+  // for number cells, whose value is number. Returns false if text can't be compared,
+  // which is logged unless quiet is set.
+  bool filterIncludes(FilterClause const& clause, StrView text, bool isNumber, double number, bool & include, bool quiet = false);
+
+  // Fills mask with the rows of block of the encoded clause column that pass clause.
+  // Returns false if the block isn't encoded, or the clause has to look at its cells.
+  bool filterEncodedBlock(Document const& doc, FilterClause const& clause, EncodedColumn const& encoded, int block, uint64_t * mask);
+
+  // Whether a line of a CSV file passes clauses. A field is compared the way filtering a
+  // paged document compares the cell loading it makes, field(c) is the c-th field of the
+  // line. Returns false if a field can't be compared, which is logged unless quiet is set.
+  template <typename FieldFunc>
+  bool lineIncludes(std::vector<FilterClause> const& clauses, FieldFunc const& field, std::string & value, bool & include, bool quiet = false)
+  {
+    include = false;
+    for (auto const& clause : clauses)
+    {
+      value.clear();
+      const StrView text = field(clause.column);
+      if (!text.empty())
+        parseFormatAndValue(text, value);
+
+      if (value.empty())
+        return true;
+
+      double number = 0.0;
+      const bool isNumber = value.front() != '=' && str::parseValue(value, number);
+
+      if (!filterIncludes(clause, value, isNumber, number, include, quiet))
+        return false;
+
+      if (!include)
+        return true;
+    }
+
+    include = true;
+    return true;
+  }
+
+  // Bytes of a CSV file parsed at once, see doc_loadChunkSize
+  std::size_t loadChunkSize();
+
+  // Returns the length of the whole lines at the start of data. Line breaks in quoted
+  // fields don't end lines.
+  std::size_t wholeLines(StrView data);
+
+  // Which of app_delimiters the first line of data uses
+  char detectDelimiter(StrView data);
+
+  // Quotes value if it holds the delimiter, a quote or a line break, so csv::Reader
+  // reads it back as one field
+  template <typename Writer>
+  void writeCsvText(Writer & writer, StrView value, char delimiter)
+  {
+    if (!csv::needsQuotes(value, delimiter))
+    {
+      writer.write(value);
+      return;
+    }
+
+    writer.put(csv::QUOTE);
+
+    std::size_t pos = 0;
+    for (std::size_t found = value.find(csv::QUOTE); found != StrView::npos; found = value.find(csv::QUOTE, pos))
+    {
+      writer.write(value.data() + pos, found + 1 - pos);
+      writer.put(csv::QUOTE);
+      pos = found + 1;
+    }
+
+    writer.write(value.data() + pos, value.size() - pos);
+    writer.put(csv::QUOTE);
+  }
+
+  // The arguments of a command from first on
+  std::vector<std::string> stringArgs(int first, int argc, Jim_Obj * const* argv);
+
+  // The cells yankCells() took last
+  Clip & yankedClip();
+
+  struct SortKey
+  {
+    int column = 0;
+    bool descending = false;
+    bool numeric = false;
+  };
+
+  // An entry of a top view: orderedKey() of the number of a row, inverted when the largest
+  // numbers come first, and the position of the row in the buffer. The smaller entry goes
+  // first, so rows with the same number keep their order.
+  typedef std::pair<uint64_t, uint32_t> TopEntry;
+
+  enum class AggregateOp
+  {
+    Count,
+    Sum,
+    Average,
+    Min,
+    Max,
+  };
+
+  // input is the aggregated column's index in the value arrays, unused by Count
+  struct Aggregate
+  {
+    AggregateOp op = AggregateOp::Count;
+    int column = 0;
+    std::size_t input = 0;
+  };
+
+  // One side of a join: the document rows of a buffer and the key of each row, an id of
+  // the document's pool. header_ is the document row of the header, or -1.
+  struct JoinSide
+  {
+    std::shared_ptr<Document> doc_;
+    int column_ = 0;
+    int header_ = -1;
+    std::vector<int> rows_;
+    std::vector<uint32_t> keys_;
+  };
+
+  // Parses the columns of sort with their options in args into keys. Columns are checked
+  // against columnCount unless it is negative.
+  bool parseSortKeys(std::vector<std::string> const& args, int columnCount, std::vector<SortKey> & keys);
+
+  // Maps value to an unsigned key that sorts in the same order
+  uint64_t orderedKey(double value);
+
+  // Keeps the count smallest entries offered to heap, a max heap with the largest in front
+  void offerTop(std::vector<TopEntry> & heap, std::size_t count, TopEntry const& entry);
+
+  // The name of the column of aggregate, after the header of the aggregated column
+  std::string aggregateName(Aggregate const& aggregate, std::string const& columnName);
+
+  // The value aggregate gives for a group
+  std::string aggregateText(Aggregate const& aggregate, groupby::Group const& group, groupby::Stats const& stats);
+
+  // Parses the aggregate options of groupby in args into aggregates, their columns go
+  // into inputColumns once each. Columns are checked against columnCount unless it is
+  // negative.
+  bool parseAggregates(std::vector<std::string> const& args, int columnCount, std::vector<Aggregate> & aggregates, std::vector<int> & inputColumns);
+
+  // Collects the rows of buffer into side. Formulas of the rows are evaluated here, the
+  // join only reads the cells.
+  bool collectJoinSide(long buffer, std::string const& column, bool header, JoinSide & side);
+
+  // Copies the cell at idx of from to target in the current document, formulas become what
+  // they show. ids caches the current pool's id of the ids of from's pool, or UINT32_MAX.
+  void copyJoinedCell(Document const& from, Index const& idx, Index const& target, std::vector<uint32_t> & ids);
+
+  // The value a column formula gives idx, a document index whose cell isn't stored.
+  // Returns false if no column formula computes it.
+  bool columnFormulaValue(Document & doc, Index const& idx, double & value);
+
+  // The text of the virtual cell at idx, empty if there is none
+  StrView columnFormulaText(Document & doc, Index const& idx, std::string & scratch);
+
+  // Returns the text cell displays. Formulas are formatted into scratch.
+  StrView filterDisplayText(Document const& doc, Cell & cell, std::string & scratch);
+
+  // Text and format of a field of a paged document, the way loading the file would have
+  // stored them. Formulas are not evaluated, they show their text.
+  std::string pagedText(Document & doc, Index const& idx, uint32_t * format = nullptr);
+
+  // True while the indexer of a paged document still looks for rows
+  bool isIndexing(Document const& doc);
+
+  // Widens column of the current document to fit text
+  void fitColumnWidth(int column, StrView text);
+
+  // Sets the text of a cell of the current document, a formula if it is one
+  void setText(Index const& idx, std::string const& text, bool forceFormat = false);
+
+  // The cell at idx of the current document, added if there is none. The caller may change
+  // it in any way.
+  Cell & getCell(Index const& idx);
+
+  // Makes the current document at least large enough to hold idx
+  void growDocument(Index const& idx);
+
+  // Classifies text, the text of cell, as a formula, number or text, and parses the
+  // formula or number. Safe to call from worker threads.
+  void parseCellText(Cell & cell, std::string const& text);
+
+  // The id in the pool of doc of the text cell displays, formulas intern what they show
+  uint32_t displayTextId(Document & doc, Cell & cell, std::string & scratch);
+
+  // Maps a row of the current buffer to a row of its document, -1 if a view doesn't show it
+  int documentRow(int row);
+
+  // The text of a cell of the current document, formulas give their formula
+  std::string getText(Cell const& cell);
+
+  // Makes the dependency graphs of doc again from its formulas
+  void rebuildDependencies(Document & doc);
+
+  // With keepEvaluated the formulas that are already evaluated keep their values, like
+  // the ones a ZUM2 file was saved with
+  void evaluateDocument(Document & doc, bool keepEvaluated);
+
+  // Moves the formula of cell, which is at idx in doc, onto the template of doc with the
+  // same references relative to idx, adding that template if there is none yet. A filled
+  // column of formulas then holds one expression and one program.
+  void shareFormula(Document & doc, Index const& idx, Cell & cell);
+
+  // Whether data is neither empty nor in any of the formats load() tells apart from CSV
+  bool isPlainCsv(StrView data);
+
+  // Opens a new document of the CSV text data, in defaultDelimiter or else the one its
+  // first line uses. selection picks what of the lines is loaded, see LoadSelection.
+  bool loadCSV(StrView data, char defaultDelimiter, LoadSelection const* selection = nullptr);
+
+  // Splits data at line boundaries into chunks of at least doc_loadChunkSize bytes. A
+  // line break only ends a line when an even number of quotes come before it.
+  std::vector<ParsedChunk> splitChunks(StrView data);
+
+  // The hash of a row, from the hash of the fields before text and text as its field
+  uint64_t hashField(uint64_t row, StrView text, uint32_t field);
+
+  // Appends the row with hash to the runs of chunks
+  void addChunkRow(std::vector<FileChunk> & chunks, uint64_t hash);
+
+  // Appends the run of the rows that follow those of chunks, which continues the last of
+  // them if that isn't closed. Returns true if it is a run of its own.
+  bool appendChunk(std::vector<FileChunk> & chunks, FileChunk const& chunk);
+
+  // The text shown for cell, the one at index of doc, the current document, or nullptr
+  StrView cellDisplayText(Document & doc, Index const& index, Cell * cell, std::string & scratch, bool * stale);
+
+  // getFormulaCost() of the cell at index of doc, a row of the document
+  double formulaCost(Document const& doc, Index const& index);
+
+  // Whatever is drawn of the documents may have changed when this did
+  uint64_t displayVersion();
+
+  // The share of the file of a document that is read, 1 once all of it is. Standard input
+  // doesn't know its size, what arrived stands for all of it.
+  double loadedFraction(Document const& doc);
+
+  // The bits of value, with -0 and 0 the same
+  uint64_t lookupKey(double value);
+
+  // Evaluates the formula in cell, which is at idx, after every formula it depends on. The
+  // order is found with an explicit stack, so a long chain of formulas can't overflow the
+  // call stack. Formulas that depend on themselves, directly or through others, show #CYCLE.
+  void evaluateCell(Index const& idx, Cell & cell);
+}
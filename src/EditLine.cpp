@@ -0,0 +1,96 @@
+
+#include "EditLine.h"
+#include "Utf8.h"
+
+#include <algorithm>
+
+static const int MIN_GAP_SIZE = 64;
+
+EditLine & EditLine::operator = (std::string const& text)
+{
+  clear();
+  insert(0, text);
+  return *this;
+}
+
+void EditLine::clear()
+{
+  gapStart_ = 0;
+  gapEnd_ = buffer_.size();
+  utf8_.clear();
+  utf8Valid_ = true;
+}
+
+void EditLine::moveGap(int pos)
+{
+  if (pos < gapStart_)
+  {
+    const int count = gapStart_ - pos;
+    std::copy_backward(buffer_.begin() + pos, buffer_.begin() + gapStart_, buffer_.begin() + gapEnd_);
+    gapStart_ -= count;
+    gapEnd_ -= count;
+  }
+  else if (pos > gapStart_)
+  {
+    const int count = pos - gapStart_;
+    std::copy(buffer_.begin() + gapEnd_, buffer_.begin() + gapEnd_ + count, buffer_.begin() + gapStart_);
+    gapStart_ += count;
+    gapEnd_ += count;
+  }
+}
+
+void EditLine::reserveGap(int count)
+{
+  if (gapSize() >= count)
+    return;
+
+  // Grow geometrically, so pasting a long text character by character stays linear
+  const int grow = std::max(std::max(count, MIN_GAP_SIZE), (int)buffer_.size()) - gapSize();
+  const int tail = buffer_.size() - gapEnd_;
+
+  buffer_.resize(buffer_.size() + grow);
+  std::copy_backward(buffer_.begin() + gapEnd_, buffer_.begin() + gapEnd_ + tail, buffer_.end());
+  gapEnd_ += grow;
+}
+
+void EditLine::insert(int pos, char_type ch)
+{
+  reserveGap(1);
+  moveGap(pos);
+  buffer_[gapStart_++] = ch;
+  utf8Valid_ = false;
+}
+
+void EditLine::insert(int pos, std::string const& text)
+{
+  // Decoding ends the characters with a 0, which the gap takes too
+  reserveGap(text.size() + 1);
+  moveGap(pos);
+
+  gapStart_ += utf8::toUTF32(StrView(text), &buffer_[gapStart_], gapSize());
+  utf8Valid_ = false;
+}
+
+void EditLine::erase(int pos, int count)
+{
+  count = std::min(count, size() - pos);
+  if (pos < 0 || count <= 0)
+    return;
+
+  moveGap(pos);
+  gapEnd_ += count;
+  utf8Valid_ = false;
+}
+
+std::string const& EditLine::utf8() const
+{
+  if (utf8Valid_)
+    return utf8_;
+
+  utf8_.clear();
+  utf8::fromUTF32(buffer_.data(), gapStart_, utf8_);
+  utf8::fromUTF32(buffer_.data() + gapEnd_, buffer_.size() - gapEnd_, utf8_);
+
+  utf8Valid_ = true;
+  return utf8_;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Text of the command and edit line as unicode characters in a gap buffer. The gap
+// follows the cursor, so typing and deleting only move the characters between the
+// old and the new position instead of the whole tail. The UTF-8 encoding is cached
+// and only rebuilt after a change.
+class EditLine
+{
+  public:
+    typedef uint32_t char_type;
+
+  public:
+    EditLine & operator = (std::string const& text);
+
+    char_type operator [] (int pos) const { return pos < gapStart_ ? buffer_[pos] : buffer_[pos + gapSize()]; }
+
+    int size() const { return buffer_.size() - gapSize(); }
+    bool empty() const { return size() == 0; }
+
+    void clear();
+
+    void insert(int pos, char_type ch);
+    void insert(int pos, std::string const& text);
+
+    // Erases count characters starting at pos, clamped to the end of the line
+    void erase(int pos, int count = 1);
+
+    std::string const& utf8() const;
+
+  private:
+    int gapSize() const { return gapEnd_ - gapStart_; }
+
+    void moveGap(int pos);
+    void reserveGap(int count);
+
+  private:
+    std::vector<char_type> buffer_;
+    int gapStart_ = 0;
+    int gapEnd_ = 0;
+
+    mutable std::string utf8_;
+    mutable bool utf8Valid_ = true;
+};
@@ -1,21 +1,36 @@
 
 #include "Editor.h"
 #include "Document.h"
+#include "HiddenRows.h"
+#include "Viewport.h"
 #include "Str.h"
+#include "EditLine.h"
 #include "Commands.h"
 #include "Completion.h"
 #include "Tcl.h"
+#include "FlatHashMap.h"
+#include "Profile.h"
+#include "Cache.h"
+#include "Memory.h"
 
 #include <memory.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <cmath>
+#include <chrono>
 #include <regex>
+#include <limits>
 
-static const int ROW_HEADER_WIDTH = 8;
-static const int MAX_ROW_COUNT = 100000;
-static const int MAX_COLUMN_COUNT = 10000;
+// The row header is at least this wide, and wide enough for the numbers of the visible rows
+static const int MIN_ROW_HEADER_WIDTH = 8;
+
+// Cells are addressed with an int, the cursor can go as far as that reaches
+static const int MAX_ROW = std::numeric_limits<int>::max() - 1;
+static const int MAX_COLUMN = std::numeric_limits<int>::max() - 1;
+
+// Chars of the info line the file name keeps when the selection stats are shown
+static const int MIN_FILE_AREA_SIZE = 12;
 
 struct ColumnInfo
 {
@@ -41,11 +56,29 @@ EditorMode editMode_ = EditorMode::NAVIGATE;
 
 static std::vector<ColumnInfo> drawColumnInfo_;
 
+// Labels drawHeaders() drew last, for the visible columns from the first column on and
+// the visible rows from the first row on. Only scrolling and resizing change them.
+struct HeaderLabels
+{
+  int firstColumn_ = -1;
+  int firstRow_ = -1;
+  bool alwaysShowHeader_ = false;
+  bool hidden_ = false;
+  std::vector<std::string> columns_;
+  std::vector<std::string> rows_;
+};
+
+static HeaderLabels headerLabels_;
+
+// The cells drawWorkspace() draws, fetched again only when they may have changed. Kept
+// so its memory is reused from frame to frame.
+static doc::Viewport viewport_;
+
 static SelectionMode selectionMode_ = SelectionMode::NONE;
 static Index selectionStart_;
 
 int editLinePos_ = 0;
-static Str editLine_;   //< Edit line if a string of utf32
+static EditLine editLine_;
 static std::string yankBuffer_;
 static std::string flashMessage_;
 static std::string searchTerm_;
@@ -53,6 +86,25 @@ static std::vector<std::string> completionHints_;
 static std::vector<std::string> messageLines_;
 
 static const tcl::Variable ALWAYS_SHOW_HEADER("app_alwaysShowHeader", false);
+static const tcl::Variable SHOW_STATS("app_showStats", false);
+
+// Tints the formulas by what they took in the recalculations recalcProfile timed, the
+// ones that took at least COST_HIGHLIGHT of the most any took are highlighted
+static const tcl::Variable SHOW_RECALC_COST("app_showRecalcCost", false);
+static const double COST_HIGHLIGHT = 0.125;
+
+// Screens of rows read ahead of scrolling at most, 0 reads nothing ahead. How far depends
+// on how fast the rows go by, it covers READ_AHEAD_SECONDS of scrolling at that speed.
+static const tcl::Variable READ_AHEAD_SCREENS("app_readAheadScreens", 4);
+static const double READ_AHEAD_SECONDS = 0.5;
+
+// Scrolling on after a pause this long, or the other way, starts over from no speed
+static const double SCROLL_PAUSE_SECONDS = 0.5;
+
+// Where scrolling goes, in rows per second averaged over the last moves
+static std::chrono::steady_clock::time_point lastScroll_;
+static int scrollDirection_ = 0;
+static double scrollSpeed_ = 0.0;
 
 extern void clearTimeout();
 
@@ -61,6 +113,21 @@ static int getCommandLineHeight()
   return 2 + messageLines_.size();
 }
 
+// The row shown on line y of the workspace, from 1, the hidden rows passed over
+static int rowOnLine(int y)
+{
+  const long long index = (long long)doc::visibleIndex(doc::scroll().y) + y - 1;
+  return doc::visibleRow((int)std::min(index, (long long)MAX_ROW));
+}
+
+// Width of the row header when the rows from scroll().y on are shown, a number and a
+// space on either side of it
+static int rowHeaderWidth()
+{
+  const long long lastRow = rowOnLine(std::max(view::height(), 0) + 2);
+  return std::max(MIN_ROW_HEADER_WIDTH, (int)std::to_string(lastRow).size() + 2);
+}
+
 void updateCursor()
 {
   switch (editMode_)
@@ -85,25 +152,44 @@ static void ensureCursorVisibility()
   if (doc::cursorPos().x < doc::scroll().x)
     doc::scroll().x = doc::cursorPos().x;
 
-  if ((doc::cursorPos().y - (ALWAYS_SHOW_HEADER.toBool() ? 1 : 0)) < doc::scroll().y)
-    doc::scroll().y = doc::cursorPos().y - (ALWAYS_SHOW_HEADER.toBool() && doc::cursorPos().y != 0 ? 1 : 0);
+  // A cursor on a hidden row goes on to the next row shown. The rows are compared by the
+  // rows shown before them, which are the rows themselves when none is hidden.
+  if (doc::isRowHidden(doc::cursorPos().y))
+    doc::cursorPos().y = doc::visibleRow(doc::visibleIndex(doc::cursorPos().y));
 
-  int width = ROW_HEADER_WIDTH;
-  bool scroll = false;
-  for (int i = doc::scroll().x; i <= doc::cursorPos().x && !scroll; ++i)
-  {
-    width += doc::getColumnWidth(i);
+  const int cursorRow = doc::visibleIndex(doc::cursorPos().y);
+  int scrollRow = doc::visibleIndex(doc::scroll().y);
+
+  if ((cursorRow - (ALWAYS_SHOW_HEADER.toBool() ? 1 : 0)) < scrollRow)
+    scrollRow = cursorRow - (ALWAYS_SHOW_HEADER.toBool() && doc::cursorPos().y != 0 ? 1 : 0);
+
+  // Scroll to the first column that still lets every column up to the cursor fit
+  const int cursorEnd = doc::getColumnOffset(doc::cursorPos().x + 1);
+  const int available = view::width() - rowHeaderWidth();
+
+  int first = doc::scroll().x;
+  int last = doc::cursorPos().x;
 
-    while (width >= view::width())
+  if (cursorEnd - doc::getColumnOffset(first) >= available)
+  {
+    while (first < last)
     {
-      scroll = true;
-      width -= doc::getColumnWidth(doc::scroll().x);
-      doc::scroll().x++;
+      const int middle = first + (last - first) / 2;
+      if (cursorEnd - doc::getColumnOffset(middle) < available)
+        last = middle;
+      else
+        first = middle + 1;
     }
+
+    doc::scroll().x = first;
   }
 
-  while ((doc::cursorPos().y - doc::scroll().y) >= (view::height() - 3))
-    doc::scroll().y++;
+  // Scrolls straight to the cursor, however far away it is
+  const int visibleRows = view::height() - 3;
+  if (cursorRow - scrollRow >= visibleRows)
+    scrollRow = cursorRow - visibleRows + 1;
+
+  doc::scroll().y = doc::visibleRow(scrollRow);
 }
 
 Index getCursorPos()
@@ -113,8 +199,8 @@ Index getCursorPos()
 
 void setCursorPos(Index const& idx)
 {
-  doc::cursorPos().x = std::min(std::max(idx.x, 0), MAX_COLUMN_COUNT);
-  doc::cursorPos().y = std::min(std::max(idx.y, 0), MAX_ROW_COUNT);
+  doc::cursorPos().x = std::min(std::max(idx.x, 0), MAX_COLUMN);
+  doc::cursorPos().y = std::min(std::max(idx.y, 0), MAX_ROW);
   ensureCursorVisibility();
 }
 
@@ -166,6 +252,36 @@ static void updateSelection()
   }
 }
 
+// Reads the rows ahead of the scroll, once it moved from previousScroll
+static void readAhead(int previousScroll)
+{
+  const int screens = READ_AHEAD_SCREENS.toInt();
+  const int moved = doc::scroll().y - previousScroll;
+  if (screens <= 0 || moved == 0)
+    return;
+
+  typedef std::chrono::steady_clock Clock;
+  const Clock::time_point now = Clock::now();
+  const double seconds = std::chrono::duration<double>(now - lastScroll_).count();
+  const int direction = moved > 0 ? 1 : -1;
+
+  if (direction == scrollDirection_ && seconds < SCROLL_PAUSE_SECONDS)
+    scrollSpeed_ = (scrollSpeed_ + std::abs(moved) / std::max(seconds, 0.001)) / 2.0;
+  else
+    scrollSpeed_ = 0.0;
+
+  scrollDirection_ = direction;
+  lastScroll_ = now;
+
+  // At least the next screen
+  const int visibleRows = std::max(view::height() - 3, 1);
+  const int rows = (int)std::max<double>(visibleRows, std::min<double>(scrollSpeed_ * READ_AHEAD_SECONDS, (double)screens * visibleRows));
+
+  // Near the last row the sums would overflow
+  const long long first = direction > 0 ? (long long)doc::scroll().y + visibleRows : (long long)doc::scroll().y - rows;
+  doc::readAhead((int)std::max(first, 0LL), (int)std::min(first + rows - 1, (long long)MAX_ROW));
+}
+
 void navigateLeft()
 {
   if (doc::cursorPos().x > 0)
@@ -177,7 +293,7 @@ void navigateLeft()
 
 void navigateRight()
 {
-  if (doc::cursorPos().x < MAX_COLUMN_COUNT)
+  if (doc::cursorPos().x < MAX_COLUMN)
    doc::cursorPos().x++;
 
   ensureCursorVisibility();
@@ -186,46 +302,67 @@ void navigateRight()
 
 void navigateUp()
 {
-  if (doc::cursorPos().y > 0)
-    doc::cursorPos().y--;
+  const int scroll = doc::scroll().y;
+  const int index = doc::visibleIndex(doc::cursorPos().y);
+
+  if (index > 0)
+    doc::cursorPos().y = doc::visibleRow(index - 1);
 
   ensureCursorVisibility();
   updateSelection();
+  readAhead(scroll);
 }
 
 void navigateDown()
 {
-  if (doc::cursorPos().y < MAX_ROW_COUNT)
-    doc::cursorPos().y++;
+  const int scroll = doc::scroll().y;
+
+  if (doc::cursorPos().y < MAX_ROW)
+    doc::cursorPos().y = doc::visibleRow(doc::visibleIndex(doc::cursorPos().y) + 1);
 
   ensureCursorVisibility();
   updateSelection();
+  readAhead(scroll);
 }
 
 void navigatePageUp()
 {
-  doc::cursorPos().y -= view::height() - getCommandLineHeight() - 1;
-  doc::scroll().y -= view::height() - getCommandLineHeight() - 1;
+  const int scroll = doc::scroll().y;
 
-  if (doc::cursorPos().y < 0)
+  // Pages are counted in rows shown
+  int cursorRow = doc::visibleIndex(doc::cursorPos().y) - (view::height() - getCommandLineHeight() - 1);
+  int scrollRow = doc::visibleIndex(doc::scroll().y) - (view::height() - getCommandLineHeight() - 1);
+
+  if (cursorRow < 0)
   {
-    doc::cursorPos().y = 0;
-    doc::scroll().y = 0;
+    cursorRow = 0;
+    scrollRow = 0;
   }
 
+  doc::cursorPos().y = doc::visibleRow(cursorRow);
+  doc::scroll().y = doc::visibleRow(scrollRow);
+
   ensureCursorVisibility();
   updateSelection();
+  readAhead(scroll);
 }
 
 void navigatePageDown()
 {
-  doc::cursorPos().y += view::height() - getCommandLineHeight() - 1;
-  doc::scroll().y += view::height() - getCommandLineHeight() - 1;
-  if (doc::cursorPos().y > MAX_ROW_COUNT)
-    doc::cursorPos().y = MAX_ROW_COUNT - 1;
+  const int scroll = doc::scroll().y;
+
+  // A page never moves past the last row, near it the sums would overflow. Pages are
+  // counted in rows shown.
+  const int cursorRow = doc::visibleIndex(doc::cursorPos().y);
+  const int scrollRow = doc::visibleIndex(doc::scroll().y);
+  const int page = std::min(view::height() - getCommandLineHeight() - 1, MAX_ROW - cursorRow);
+
+  doc::cursorPos().y = doc::visibleRow(cursorRow + page);
+  doc::scroll().y = doc::visibleRow(scrollRow + std::min(page, MAX_ROW - scrollRow));
 
   ensureCursorVisibility();
   updateSelection();
+  readAhead(scroll);
 }
 
 void navigateHome()
@@ -242,6 +379,42 @@ void navigateEnd()
   updateSelection();
 }
 
+static void navigateData(int dx, int dy)
+{
+  const int scroll = doc::scroll().y;
+
+  doc::cursorPos() = doc::findDataEdge(doc::cursorPos(), dx, dy);
+
+  // Upwards an edge on a hidden row gives way to the row shown before it
+  const int index = doc::visibleIndex(doc::cursorPos().y);
+  if (dy < 0 && index > 0 && doc::isRowHidden(doc::cursorPos().y))
+    doc::cursorPos().y = doc::visibleRow(index - 1);
+
+  ensureCursorVisibility();
+  updateSelection();
+  readAhead(scroll);
+}
+
+void navigateDataLeft()
+{
+  navigateData(-1, 0);
+}
+
+void navigateDataRight()
+{
+  navigateData(1, 0);
+}
+
+void navigateDataUp()
+{
+  navigateData(0, -1);
+}
+
+void navigateDataDown()
+{
+  navigateData(0, 1);
+}
+
 void moveCursorInSelection(int x, int y)
 {
   if (doc::hasSelection())
@@ -266,62 +439,22 @@ void moveCursorInSelection(int x, int y)
 
 bool findNextMatch()
 {
-  if (searchTerm_.empty())
+  Index pos;
+  if (!doc::findText(searchTerm_, getCursorPos(), true, pos))
     return false;
 
-  Index pos = getCursorPos();
-  pos.x++;
-
-  while (pos.y < doc::getRowCount())
-  {
-    while (pos.x < doc::getColumnCount())
-    {
-      const std::string text = doc::getCellText(pos);
-      if (text.find(searchTerm_) != std::string::npos)
-      {
-        setCursorPos(pos);
-        ensureCursorVisibility();
-        return true;
-      }
-
-      pos.x++;
-    }
-
-    pos.y++;
-    pos.x = 0;
-  }
-
-  return false;
+  setCursorPos(pos);
+  return true;
 }
 
 bool findPreviousMatch()
 {
-  if (searchTerm_.empty())
+  Index pos;
+  if (!doc::findText(searchTerm_, getCursorPos(), false, pos))
     return false;
 
-  Index pos = getCursorPos();
-  pos.x--;
-
-  while (pos.y >= 0)
-  {
-    while (pos.x >= 0)
-    {
-      const std::string text = doc::getCellText(pos);
-      if (text.find(searchTerm_) != std::string::npos)
-      {
-        setCursorPos(pos);
-        ensureCursorVisibility();
-        return false;
-      }
-
-      pos.x--;
-    }
-
-    pos.y--;
-    pos.x = doc::getColumnCount() - 1;
-  }
-
-  return false;
+  setCursorPos(pos);
+  return true;
 }
 
 void editCurrentCell()
@@ -371,12 +504,7 @@ void handleTextInput(view::Event * event)
       break;
 
     case view::KEY_DELETE:
-      {
-        editLine_.erase(editLinePos_);
-        const int len = editLine_.size();
-        if (editLinePos_ > len)
-          editLinePos_ = len;
-      }
+      editLine_.erase(editLinePos_);
       break;
 
     default:
@@ -621,17 +749,78 @@ void handleKeyEvent(view::Event * event)
   }
 }
 
-void drawText(int x, int y, int length, uint16_t fg, uint16_t bg, std::string const& str, uint32_t format = 0)
+static const uint32_t DRAW_BUFFER_LEN = 1024;
+static uint32_t drawBuffer_[DRAW_BUFFER_LEN];
+static uint32_t columnBuffer_[DRAW_BUFFER_LEN];
+
+// The columns of the cells drawn, kept until the text or the width of a cell changes so
+// drawing it again doesn't decode it. Only texts up to CELL_COLUMNS_MAX_TEXT bytes are
+// kept, and all are dropped when there are more than CELL_COLUMNS_MAX_CELLS.
+struct CellColumns
+{
+  std::string text_;
+  int width_ = -1;
+  std::vector<uint32_t> columns_;
+};
+
+static const std::size_t CELL_COLUMNS_MAX_TEXT = 256;
+static const std::size_t CELL_COLUMNS_MAX_CELLS = 16384;
+static FlatHashMap<CellColumns> cellColumns_;
+
+static cache::Counters CELL_COLUMNS_COUNTERS("cellColumns");
+
+static const cache::Cache CELL_COLUMNS_CACHE("cellColumns", cache::Cost::DRAW, [] () {
+  std::size_t bytes = cellColumns_.memoryUsage();
+  for (auto const& it : cellColumns_)
+    bytes += memory::bytes(it.second.text_) + memory::bytes(it.second.columns_);
+
+  return bytes;
+}, [] (std::size_t target) {
+  cellColumns_.shrink(target, [] (CellColumns const& entry) {
+    return memory::bytes(entry.text_) + memory::bytes(entry.columns_);
+  });
+});
+
+// Lays the first strLen characters of drawBuffer_ out in columnBuffer_, in at most width
+// columns or in all of it for -1. A wide character takes two, the second is 0 and the view
+// leaves it to the first. With cut, text that needs more than width - 1 columns is cut and
+// ends in ".. ". Returns the number of columns.
+static uint32_t layoutColumns(uint32_t strLen, int width, bool cut)
 {
-  static const uint32_t BUFFER_LEN = 1024;
-  static uint32_t BUFFER[BUFFER_LEN];
-  const uint32_t strLen = str::toUTF32(str, BUFFER, BUFFER_LEN);
+  const uint32_t limit = width < 0 ? DRAW_BUFFER_LEN : std::min<uint32_t>(width, DRAW_BUFFER_LEN);
 
+  uint32_t columns = 0;
+  uint32_t i = 0;
+  for (; i < strLen; ++i)
+  {
+    const int chWidth = str::charWidth(drawBuffer_[i]);
+    if (columns + chWidth > limit)
+      break;
 
+    columnBuffer_[columns++] = drawBuffer_[i];
+    if (chWidth == 2)
+      columnBuffer_[columns++] = 0;
+  }
+
+  if (!cut || width < 3 || (i == strLen && columns < (uint32_t)width))
+    return columns;
+
+  while (columns > (uint32_t)width - 3)
+    columns -= columnBuffer_[columns - 1] == 0 ? 2 : 1;
+
+  columnBuffer_[columns++] = '.';
+  columnBuffer_[columns++] = '.';
+  columnBuffer_[columns++] = ' ';
+  return columns;
+}
+
+// Draws the first strLen columns of chars
+static void drawChars(int x, int y, int length, uint16_t fg, uint16_t bg, uint32_t const* chars, uint32_t strLen, uint32_t format)
+{
   if (length == -1)
   {
     for (int i = 0; i < strLen; ++i)
-      view::changeCell(x + i, y, BUFFER[i], fg, bg);
+      view::changeCell(x + i, y, chars[i], fg, bg);
   }
   else
   {
@@ -656,7 +845,7 @@ void drawText(int x, int y, int length, uint16_t fg, uint16_t bg, std::string co
     for (int i = 0; i < length; ++i)
     {
       const int charIdx = i - start;
-      const uint32_t ch = charIdx < 0 || charIdx >= strLen ? ' ' : BUFFER[charIdx];
+      const uint32_t ch = charIdx < 0 || charIdx >= (int)strLen ? ' ' : chars[charIdx];
 
       uint32_t style = fg;
       if (charIdx >= 0 && charIdx < strLen)
@@ -672,12 +861,50 @@ void drawText(int x, int y, int length, uint16_t fg, uint16_t bg, std::string co
   }
 }
 
+void drawText(int x, int y, int length, uint16_t fg, uint16_t bg, std::string const& str, uint32_t format = 0)
+{
+  const uint32_t columns = layoutColumns(str::toUTF32(str, drawBuffer_, DRAW_BUFFER_LEN), length, false);
+  drawChars(x, y, length, fg, bg, columnBuffer_, columns, format);
+}
+
+// Draws the text of cell idx that is width characters wide. Text that doesn't fit is cut
+// and ends in ".. ".
+static void drawCellText(int x, int y, int width, uint16_t fg, uint16_t bg, Index const& idx, StrView text, uint32_t format)
+{
+  // Decoding width + 1 characters tells whether the text fits
+  const uint32_t decodeLen = std::min<uint32_t>(std::max(width, 0) + 2, DRAW_BUFFER_LEN);
+
+  if (text.empty() || text.size() > CELL_COLUMNS_MAX_TEXT)
+  {
+    const uint32_t columns = layoutColumns(str::toUTF32(text, drawBuffer_, decodeLen), width, true);
+    drawChars(x, y, width, fg, bg, columnBuffer_, columns, format);
+    return;
+  }
+
+  if (cellColumns_.size() > CELL_COLUMNS_MAX_CELLS)
+    cellColumns_.clear();
+
+  CellColumns & cell = cellColumns_[idx.key()];
+  if (cell.width_ != width || cell.text_.size() != text.size() || memcmp(cell.text_.data(), text.data(), text.size()) != 0)
+  {
+    CELL_COLUMNS_COUNTERS.miss();
+    const uint32_t columns = layoutColumns(str::toUTF32(text, drawBuffer_, decodeLen), width, true);
+    cell.text_.assign(text.data(), text.size());
+    cell.width_ = width;
+    cell.columns_.assign(columnBuffer_, columnBuffer_ + columns);
+  }
+  else
+    CELL_COLUMNS_COUNTERS.hit();
+
+  drawChars(x, y, width, fg, bg, cell.columns_.data(), cell.columns_.size(), format);
+}
+
 void calculateColumDrawWidths()
 {
   drawColumnInfo_.clear();
 
-  int x = ROW_HEADER_WIDTH;
-  for (int i = doc::scroll().x; i < MAX_COLUMN_COUNT; ++i)
+  int x = rowHeaderWidth();
+  for (int i = doc::scroll().x; i <= MAX_COLUMN; ++i)
   {
     const int width = doc::getColumnWidth(i);
     drawColumnInfo_.emplace_back(i, x, width);
@@ -768,53 +995,118 @@ void drawInterface()
   drawWorkspace();
 
   drawCommandLine();
+
+  PROFILE_SCOPE(PRESENT);
   view::present();
 }
 
 void drawHeaders()
 {
+  PROFILE_SCOPE(DRAW_HEADERS);
+
+  HeaderLabels & labels = headerLabels_;
+
+  const int firstColumn = drawColumnInfo_.empty() ? 0 : drawColumnInfo_.front().column_;
+  if (labels.firstColumn_ != firstColumn || labels.columns_.size() != drawColumnInfo_.size())
+  {
+    labels.firstColumn_ = firstColumn;
+    labels.columns_.clear();
+
+    for (auto const& info : drawColumnInfo_)
+      labels.columns_.push_back(Index::columnToStr(info.column_));
+  }
+
+  const int rows = std::max(view::height() - getCommandLineHeight() - 1, 0);
+  const bool alwaysShowHeader = ALWAYS_SHOW_HEADER.toBool();
+  const int headerWidth = rowHeaderWidth();
+
+  // Hiding rows changes the labels without a scroll, so with hidden rows they are made
+  // every frame
+  const bool hidden = doc::hasHiddenRows();
+
+  if (labels.firstRow_ != doc::scroll().y || labels.rows_.size() != (std::size_t)rows || labels.alwaysShowHeader_ != alwaysShowHeader || hidden || labels.hidden_)
+  {
+    labels.firstRow_ = doc::scroll().y;
+    labels.alwaysShowHeader_ = alwaysShowHeader;
+    labels.hidden_ = hidden;
+    labels.rows_.clear();
+
+    for (int y = 1; y <= rows; ++y)
+    {
+      const int row = y == 1 && alwaysShowHeader ? 0 : rowOnLine(y);
+      const std::string rowNumber = Index::rowToStr(row);
+
+      std::string header;
+      while (header.size() + rowNumber.size() + 1 < (std::size_t)headerWidth)
+        header.append(1, ' ');
+
+      header.append(rowNumber)
+            .append(1, ' ');
+
+      labels.rows_.push_back(header);
+    }
+  }
+
   // Draw column header
   for (int x = 0; x < drawColumnInfo_.size(); ++x)
   {
     const uint16_t bg = (drawColumnInfo_[x].column_) == doc::cursorPos().x ? view::COLOR_HIGHLIGHT : view::COLOR_BACKGROUND;
     const uint16_t fg = (drawColumnInfo_[x].column_) == doc::cursorPos().x ? view::COLOR_WHITE : view::COLOR_TEXT;
-    drawText(drawColumnInfo_[x].x_, 0, drawColumnInfo_[x].width_, fg, bg, Index::columnToStr(drawColumnInfo_[x].column_), ALIGN_CENTER);
+    drawText(drawColumnInfo_[x].x_, 0, drawColumnInfo_[x].width_, fg, bg, labels.columns_[x], ALIGN_CENTER);
   }
 
   // Draw row header
-  for (int y = 1; y < view::height() - getCommandLineHeight(); ++y)
+  for (int y = 1; y <= rows; ++y)
   {
-    int row = y + doc::scroll().y - 1;
+    const int row = rowOnLine(y);
     const uint16_t bg = row == doc::cursorPos().y ? view::COLOR_HIGHLIGHT : view::COLOR_BACKGROUND;
     const uint16_t fg = row == doc::cursorPos().y ? view::COLOR_WHITE : view::COLOR_TEXT;
 
-    if (y == 1 && ALWAYS_SHOW_HEADER.toBool())
-      row = 0;
+    drawText(0, y, headerWidth, fg, bg, labels.rows_[y - 1]);
+  }
+}
+
+void drawWorkspace()
+{
+  PROFILE_SCOPE(DRAW_WORKSPACE);
 
-    const std::string columnNumber = Index::rowToStr(row);
+  // While a search term is typed, the visible cells it matches are highlighted. Only the
+  // visible block is scanned, so every key stroke simply starts over with the new term.
+  FlatHashSet searchMatches;
 
-    std::string header;
-    while (header.size() < (ROW_HEADER_WIDTH - columnNumber.size() - 1))
-      header.append(1, ' ');
+  if (editMode_ == EditorMode::SEARCH && !drawColumnInfo_.empty())
+  {
+    const std::string term = editLine_.utf8();
+    const int firstColumn = drawColumnInfo_.front().column_;
+    const int lastColumn = drawColumnInfo_.back().column_;
+    const int lastRow = rowOnLine(view::height() - getCommandLineHeight() - 1);
 
-    header.append(columnNumber)
-          .append(1, ' ');
+    for (auto const& idx : doc::findTextInBlock(term, Index(firstColumn, doc::scroll().y), Index(lastColumn, lastRow)))
+      searchMatches.insert(idx.key());
 
-    drawText(0, y, ROW_HEADER_WIDTH, fg, bg, header);
+    if (ALWAYS_SHOW_HEADER.toBool())
+      for (auto const& idx : doc::findTextInBlock(term, Index(firstColumn, 0), Index(lastColumn, 0)))
+        searchMatches.insert(idx.key());
   }
-}
 
-void drawWorkspace()
-{
+  viewport_.rows_.clear();
+  for (int y = 1; y < view::height() - getCommandLineHeight(); ++y)
+    viewport_.rows_.push_back(y == 1 && ALWAYS_SHOW_HEADER.toBool() ? 0 : rowOnLine(y));
+
+  viewport_.columns_.clear();
+  for (auto const& info : drawColumnInfo_)
+    viewport_.columns_.push_back(info.column_);
+
+  const bool showCost = SHOW_RECALC_COST.toBool();
+  viewport_.costs_ = showCost;
+  doc::fetchViewport(viewport_);
+
   for (int y = 1; y < view::height() - getCommandLineHeight(); ++y)
   {
+    const int row = viewport_.rows_[y - 1];
+
     for (int x = 0; x < drawColumnInfo_.size(); ++x)
     {
-      int row = y + doc::scroll().y - 1;
-
-      if (y == 1 && ALWAYS_SHOW_HEADER.toBool())
-        row = 0;
-
       const bool cursorHere = drawColumnInfo_[x].column_ == doc::cursorPos().x && row == doc::cursorPos().y;
       const bool sameAsCursor = drawColumnInfo_[x].column_ == doc::cursorPos().x || row == doc::cursorPos().y;
       const bool selected = drawColumnInfo_[x].column_ >= doc::selectionStart().x && drawColumnInfo_[x].column_ <= doc::selectionEnd().x &&
@@ -822,7 +1114,7 @@ void drawWorkspace()
 
       uint16_t bg = sameAsCursor ? view::COLOR_SELECTION : view::COLOR_PANEL;
 
-      if (selected || cursorHere)
+      if (selected || cursorHere || searchMatches.count(Index(drawColumnInfo_[x].column_, row).key()) == 1)
       {
         bg = view::COLOR_HIGHLIGHT;
 
@@ -830,25 +1122,37 @@ void drawWorkspace()
           bg = view::COLOR_SELECTION;
       }
 
-      const uint16_t fg = bg == view::COLOR_HIGHLIGHT ? view::COLOR_WHITE : view::COLOR_TEXT;
       const int width = doc::getColumnWidth(drawColumnInfo_[x].column_);
 
       //if (row < doc::getRowCount())
       {
         if (cursorHere && editMode_ == EditorMode::EDIT)
-          drawText(drawColumnInfo_[x].x_, y, width, fg, bg, editLine_.utf8());
+          drawText(drawColumnInfo_[x].x_, y, width, bg == view::COLOR_HIGHLIGHT ? view::COLOR_WHITE : view::COLOR_TEXT, bg, editLine_.utf8());
         else
         {
-          std::string cellText = doc::getCellDisplayText(Index(drawColumnInfo_[x].column_, row));
-          const uint32_t format = doc::getCellFormat(Index(drawColumnInfo_[x].column_, row));
+          const Index idx(drawColumnInfo_[x].column_, row);
+          doc::ViewportCell const& cell = viewport_.cell(y - 1, x);
+
+          // The format rules mark the cells they match, the cursor and selection show over them
+          uint16_t style = cell.style_;
 
-          if (cellText.size() >= width)
+          if (showCost)
           {
-            cellText = cellText.substr(0, width - 3);
-            cellText.append(2, '.').append(1, ' ');
+            const double cost = cell.cost_;
+            if (cost >= COST_HIGHLIGHT)
+              style |= view::COLOR_HIGHLIGHT | view::COLOR_BOLD;
+            else if (cost > 0.0)
+              style |= view::COLOR_BOLD;
           }
 
-          drawText(drawColumnInfo_[x].x_, y, width, fg, bg, cellText, format);
+          if ((style & view::COLOR_HIGHLIGHT) == view::COLOR_HIGHLIGHT && !selected && !cursorHere)
+            bg = view::COLOR_HIGHLIGHT;
+
+          const uint16_t fg = (bg == view::COLOR_HIGHLIGHT ? view::COLOR_WHITE : view::COLOR_TEXT) | (style & ~0xFF);
+
+          // Values a recalculation hasn't reached yet are dimmed
+          const uint16_t cellFg = !cell.stale_ ? fg : (bg == view::COLOR_HIGHLIGHT ? view::COLOR_TEXT : view::COLOR_HIGHLIGHT) | (style & ~0xFF);
+          drawCellText(drawColumnInfo_[x].x_, y, width, cellFg, bg, idx, cell.text_, cell.format_);
         }
       }
     }
@@ -894,9 +1198,36 @@ void drawCommandLine()
       filename = "[No Name]";
 
 
+    // Numbers in the selection, left out while a large one is still being added up
+    std::string stats;
+    reduce::Stats selection;
+    if (doc::selectionStats(selection))
+    {
+      char number[str::FORMAT_SIZE];
+
+      stats.append("count ").append(str::fromInt(selection.count_));
+      if (selection.count_ > 0)
+      {
+        stats.append(" sum ").append(number, str::formatDouble(selection.sum_, 10, number))
+             .append(" avg ").append(number, str::formatDouble(selection.sum_ / selection.count_, 10, number))
+             .append(" min ").append(number, str::formatDouble(selection.min_, 10, number))
+             .append(" max ").append(number, str::formatDouble(selection.max_, 10, number));
+      }
+
+      stats.append(1, ' ');
+    }
+
+    // A sliced recalculation shows it isn't done yet
+    if (doc::isRecalculating())
+      stats.append("recalc ");
+
     std::string progress = str::fromInt(std::min(100, std::max(0, (int)((double)(doc::cursorPos().y + 1) / (double)(doc::getRowCount() == 0 ? 1 : doc::getRowCount()) * 100.0)))).append(1, '%');
 
-    const int maxFileAreaSize = view::width() - pos.size() - progress.size() - 5;
+    // The stats give way to at least MIN_FILE_AREA_SIZE chars of the file name
+    if ((int)(stats.size() + pos.size() + progress.size()) + 5 + MIN_FILE_AREA_SIZE > view::width())
+      stats.clear();
+
+    const int maxFileAreaSize = view::width() - stats.size() - pos.size() - progress.size() - 5;
     if (filename.size() > maxFileAreaSize)
       filename = filename.substr(filename.size() - maxFileAreaSize);
 
@@ -906,6 +1237,7 @@ void drawCommandLine()
     infoLine.clear();
     infoLine.append(filename)
             .append(1, ' ')
+            .append(stats)
             .append(pos)
             .append(1, ' ')
             .append(progress)
@@ -917,6 +1249,10 @@ void drawCommandLine()
   for (int i = 0; i < messageLines_.size(); ++i)
     drawText(0, view::height() - 1 - messageLines_.size() + i, view::width(), view::COLOR_TEXT, view::COLOR_SELECTION, messageLines_[i]);
 
+  // The timings of the previous frame, over the last workspace row
+  if (SHOW_STATS.toBool())
+    drawText(0, view::height() - messageLines_.size() - 3, view::width(), view::COLOR_TEXT, view::COLOR_SELECTION, profile::overlayLine());
+
   drawText(0, view::height() - messageLines_.size() - 2, view::width(), view::COLOR_WHITE, view::COLOR_HIGHLIGHT | view::COLOR_DEFAULT, infoLine);
   drawText(0, view::height() - 1, view::width(), view::COLOR_TEXT, view::COLOR_BACKGROUND, commandLine);
 }
@@ -930,6 +1266,10 @@ namespace tcl {
   TCL_EXPOSE_FUNC(navigatePageDown, "Move the cursor one page down");
   TCL_EXPOSE_FUNC(navigateHome, "Move the cursor to the first column in the document");
   TCL_EXPOSE_FUNC(navigateEnd, "Move the cursor to the last column in the document");
+  TCL_EXPOSE_FUNC(navigateDataLeft, "Move the cursor to the previous edge of the data in the row");
+  TCL_EXPOSE_FUNC(navigateDataRight, "Move the cursor to the next edge of the data in the row");
+  TCL_EXPOSE_FUNC(navigateDataUp, "Move the cursor to the previous edge of the data in the column");
+  TCL_EXPOSE_FUNC(navigateDataDown, "Move the cursor to the next edge of the data in the column");
   TCL_EXPOSE_FUNC(yankCurrentCell, "Copy the content from the current cell to the yank buffer");
   TCL_EXPOSE_FUNC(findNextMatch, "Jump to the next search result");
   TCL_EXPOSE_FUNC(findPreviousMatch, "Jump to the previous search result");
@@ -938,4 +1278,9 @@ namespace tcl {
   {
     TCL_STRING_UTF8_RESULT(getYankBuffer());
   }
+
+  TCL_FUNC(clipboard, "", "Returns the text on the system clipboard, empty if the view can't read it")
+  {
+    TCL_STRING_UTF8_RESULT(view::clipboard());
+  }
 }
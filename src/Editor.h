@@ -28,6 +28,12 @@ void navigatePageDown();
 void navigateHome();
 void navigateEnd();
 
+// Jumps to the edge of the data, see doc::findDataEdge()
+void navigateDataLeft();
+void navigateDataRight();
+void navigateDataUp();
+void navigateDataDown();
+
 bool findNextMatch();
 bool findPreviousMatch();
 
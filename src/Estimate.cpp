@@ -0,0 +1,429 @@
+#include "Estimate.h"
+#include "DocumentState.h"
+#include "Document.h"
+#include "Editor.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+namespace doc {
+
+  // An estimate reads the rows of its document a block at a time, in random order, and
+  // refines its aggregates each time. Blocks are pages of a paged document and as many
+  // rows of a loaded one.
+  static const int ESTIMATE_BLOCK_ROWS = PagedTable::PAGE_ROWS;
+
+  // Milliseconds updateEstimate() reads blocks for, and least milliseconds between two
+  // updates of the message lines
+  static const int ESTIMATE_STEP = 4;
+  static const int ESTIMATE_REFRESH_INTERVAL = 250;
+
+  // The confidence intervals are at 95%, groups past the first ESTIMATE_GROUP_LINES
+  // by rows are only counted
+  static const double ESTIMATE_Z = 1.96;
+  static const std::size_t ESTIMATE_GROUP_LINES = 8;
+
+  // Sums over the blocks read of what a block adds to an aggregated column of a group,
+  // the sum t of its numbers and the count c of them, with their squares and products
+  struct EstimateSums
+  {
+    double t_ = 0.0;
+    double t2_ = 0.0;
+    double c_ = 0.0;
+    double c2_ = 0.0;
+    double tc_ = 0.0;
+    double min_ = INFINITY;
+    double max_ = -INFINITY;
+  };
+
+  struct EstimateGroup
+  {
+    std::string key_;
+    double rows_ = 0.0;
+    double rows2_ = 0.0;
+    std::vector<EstimateSums> columns_;
+  };
+
+  // An aggregation over a document that may still be loading or being indexed. Blocks are
+  // taken at random from those that are complete, so the ones read stand for the ones
+  // that aren't, and the estimates treat them as a random sample of the blocks. While
+  // the file is read the rows that are there stand for the rest of it as well.
+  struct Estimate
+  {
+    std::weak_ptr<Document> doc_;
+    int first_ = 0;
+    int keyColumn_ = -1;
+    std::vector<Aggregate> aggregates_;
+    std::vector<int> inputColumns_;
+    std::vector<std::string> names_;
+
+    // The blocks queued so far, those not read yet, and how many were read
+    int blocks_ = 0;
+    std::vector<int> pending_;
+    int read_ = 0;
+
+    std::vector<EstimateGroup> groups_;
+    std::unordered_map<std::string, std::size_t> groupIndex_;
+
+    std::mt19937 random_;
+    std::chrono::steady_clock::time_point shown_;
+  };
+
+  static std::unique_ptr<Estimate> estimate_;
+
+  static bool estimateComplete(Document const& doc)
+  {
+    return !doc.loading_ && !(doc.paged_ && doc.paged_->indexing());
+  }
+
+  // The text of the field at idx and the number it holds, NaN unless it holds one. Cells
+  // of a loaded document aren't evaluated, formulas hold no number.
+  static std::string estimateField(Document & doc, Index const& idx, double & number)
+  {
+    number = NAN;
+
+    if (doc.paged_)
+    {
+      const std::string text = pagedText(doc, idx);
+      if (!text.empty() && text.front() != '=' && !str::parseValue(text, number))
+        number = NAN;
+
+      return text;
+    }
+
+    Cell const* cell = static_cast<CellStorage const&>(doc.cells_).find(idx);
+    if (!cell)
+      return std::string();
+
+    if (cell->type == CellType::Number)
+      number = cell->value;
+
+    return doc.strings_.str(cell->text).str();
+  }
+
+  // Reads a block into the sums of the groups of its rows
+  static void readEstimateBlock(Estimate & estimate, Document & doc, int block, int rowCount)
+  {
+    struct BlockSums
+    {
+      double rows_ = 0.0;
+      std::vector<double> t_;
+      std::vector<double> c_;
+    };
+
+    const std::size_t columns = estimate.inputColumns_.size();
+    std::unordered_map<std::size_t, BlockSums> sums;
+
+    const int first = std::max(block * ESTIMATE_BLOCK_ROWS, estimate.first_);
+    const int end = std::min((block + 1) * ESTIMATE_BLOCK_ROWS, rowCount);
+    double number = 0.0;
+
+    for (int row = first; row < end; ++row)
+    {
+      std::string key;
+      if (estimate.keyColumn_ >= 0)
+      {
+        key = estimateField(doc, Index(estimate.keyColumn_, row), number);
+        if (key.empty())
+          continue;
+      }
+
+      auto found = estimate.groupIndex_.find(key);
+      if (found == estimate.groupIndex_.end())
+      {
+        found = estimate.groupIndex_.emplace(key, estimate.groups_.size()).first;
+        estimate.groups_.emplace_back();
+        estimate.groups_.back().key_ = key;
+        estimate.groups_.back().columns_.resize(columns);
+      }
+
+      EstimateGroup & group = estimate.groups_[found->second];
+      BlockSums & blockSums = sums[found->second];
+      if (blockSums.t_.empty())
+      {
+        blockSums.t_.assign(columns, 0.0);
+        blockSums.c_.assign(columns, 0.0);
+      }
+
+      blockSums.rows_ += 1.0;
+      for (std::size_t c = 0; c < columns; ++c)
+      {
+        estimateField(doc, Index(estimate.inputColumns_[c], row), number);
+        if (std::isnan(number))
+          continue;
+
+        blockSums.t_[c] += number;
+        blockSums.c_[c] += 1.0;
+        group.columns_[c].min_ = std::min(group.columns_[c].min_, number);
+        group.columns_[c].max_ = std::max(group.columns_[c].max_, number);
+      }
+    }
+
+    // Groups the block has no rows of add nothing, not even to the squares
+    for (auto const& it : sums)
+    {
+      EstimateGroup & group = estimate.groups_[it.first];
+      group.rows_ += it.second.rows_;
+      group.rows2_ += it.second.rows_ * it.second.rows_;
+
+      for (std::size_t c = 0; c < columns; ++c)
+      {
+        const double t = it.second.t_[c];
+        const double count = it.second.c_[c];
+
+        EstimateSums & column = group.columns_[c];
+        column.t_ += t;
+        column.t2_ += t * t;
+        column.c_ += count;
+        column.c2_ += count * count;
+        column.tc_ += t * count;
+      }
+    }
+
+    estimate.read_++;
+  }
+
+  // The total of blocks adding up to sum, with squares adding up to sum2, over the
+  // blocks of which read were read, and the half width of its confidence interval. The
+  // variance is the one of sampling the blocks without replacement.
+  static std::pair<double, double> estimateTotal(double sum, double sum2, double read, double blocks)
+  {
+    if (read <= 0.0)
+      return std::make_pair(0.0, INFINITY);
+
+    const double total = sum / read * blocks;
+    if (read >= blocks)
+      return std::make_pair(total, 0.0);
+
+    if (read < 2.0)
+      return std::make_pair(total, INFINITY);
+
+    const double variance = std::max((sum2 - sum * sum / read) / (read - 1.0), 0.0);
+    return std::make_pair(total, ESTIMATE_Z * blocks * std::sqrt((1.0 - read / blocks) * variance / read));
+  }
+
+  // The average of the numbers of column, a ratio of the totals of the numbers and of
+  // their counts, with the half width of the interval of its linearized variance
+  static std::pair<double, double> estimateAverage(EstimateSums const& column, double read, double blocks)
+  {
+    if (column.c_ <= 0.0)
+      return std::make_pair(NAN, INFINITY);
+
+    const double average = column.t_ / column.c_;
+    if (read >= blocks)
+      return std::make_pair(average, 0.0);
+
+    if (read < 2.0)
+      return std::make_pair(average, INFINITY);
+
+    const double count = column.c_ / read;
+    const double variance = std::max((column.t2_ - 2.0 * average * column.tc_ + average * average * column.c2_) / (read - 1.0), 0.0);
+    return std::make_pair(average, ESTIMATE_Z * std::sqrt((1.0 - read / blocks) * variance / read) / count);
+  }
+
+  static std::string estimateText(std::pair<double, double> const& value)
+  {
+    char number[str::FORMAT_SIZE];
+    if (std::isnan(value.first))
+      return "-";
+
+    // Exact values are written in full
+    std::string text(number, value.second > 0.0 ? str::formatDouble(value.first, 6, number) : str::formatDouble(value.first, number));
+    if (std::isinf(value.second))
+      text += " ± ?";
+    else if (value.second > 0.0)
+      text += " ± " + std::string(number, str::formatDouble(value.second, 2, number));
+
+    return text;
+  }
+
+  // The message lines of the estimate, with what the blocks read so far give
+  static std::string estimateMessage(Estimate const& estimate, Document const& doc, int rowCount, bool done)
+  {
+    const double read = estimate.read_;
+    double blocks = estimate.blocks_;
+    if (!estimateComplete(doc))
+    {
+      // The blocks of the rest of the file are as many as those that are there suggest
+      const double fraction = loadedFraction(doc);
+      if (fraction > 0.0)
+        blocks = std::max(blocks, blocks / fraction);
+    }
+
+    std::string message;
+    if (done)
+      message = "Exact over the " + std::to_string(std::max(rowCount - estimate.first_, 0)) + " rows of " + doc.filename_;
+    else
+      message = "Estimate over " + std::to_string((int)(100.0 * read / std::max(blocks, 1.0))) + "% of the rows of " + doc.filename_ + ", at 95% confidence";
+
+    std::vector<std::size_t> order(estimate.groups_.size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+      order[i] = i;
+
+    std::sort(order.begin(), order.end(), [&estimate] (std::size_t a, std::size_t b) {
+      return estimate.groups_[a].rows_ > estimate.groups_[b].rows_;
+    });
+
+    char number[str::FORMAT_SIZE];
+    for (std::size_t i = 0; i < std::min(order.size(), ESTIMATE_GROUP_LINES); ++i)
+    {
+      EstimateGroup const& group = estimate.groups_[order[i]];
+
+      message += "\n";
+      if (estimate.keyColumn_ >= 0)
+        message += group.key_ + ":";
+
+      for (std::size_t a = 0; a < estimate.aggregates_.size(); ++a)
+      {
+        Aggregate const& aggregate = estimate.aggregates_[a];
+        EstimateSums const& column = group.columns_.empty() ? EstimateSums() : group.columns_[aggregate.input];
+
+        message += (a == 0 && estimate.keyColumn_ < 0 ? "" : " ") + estimate.names_[a] + " ";
+        switch (aggregate.op)
+        {
+          case AggregateOp::Count:
+            message += estimateText(estimateTotal(group.rows_, group.rows2_, read, blocks));
+            break;
+
+          case AggregateOp::Sum:
+            message += estimateText(estimateTotal(column.t_, column.t2_, read, blocks));
+            break;
+
+          case AggregateOp::Average:
+            message += estimateText(estimateAverage(column, read, blocks));
+            break;
+
+          // The least and greatest numbers read are bounds of those of all rows
+          case AggregateOp::Min:
+          case AggregateOp::Max:
+            {
+              const double value = aggregate.op == AggregateOp::Min ? column.min_ : column.max_;
+              if (std::isinf(value))
+                message += "-";
+              else
+                message += std::string(done ? "" : aggregate.op == AggregateOp::Min ? "<= " : ">= ") + std::string(number, str::formatDouble(value, number));
+            }
+            break;
+        }
+      }
+    }
+
+    if (order.size() > ESTIMATE_GROUP_LINES)
+      message += "\nand " + std::to_string(order.size() - ESTIMATE_GROUP_LINES) + " more groups" + (done ? "" : " so far");
+
+    return message;
+  }
+
+  bool isEstimating()
+  {
+    return estimate_ != nullptr;
+  }
+
+  bool updateEstimate()
+  {
+    if (!estimate_)
+      return false;
+
+    Estimate & estimate = *estimate_;
+    const std::shared_ptr<Document> doc = estimate.doc_.lock();
+    if (!doc)
+    {
+      estimate_.reset();
+      return false;
+    }
+
+    // Blocks join the queue once they are complete, the last one once all rows are there
+    const bool complete = estimateComplete(*doc);
+    const int rowCount = doc->paged_ ? doc->paged_->rowCount() : doc->height_;
+    const int blocks = complete ? (rowCount + ESTIMATE_BLOCK_ROWS - 1) / ESTIMATE_BLOCK_ROWS : rowCount / ESTIMATE_BLOCK_ROWS;
+
+    for (; estimate.blocks_ < blocks; ++estimate.blocks_)
+      estimate.pending_.push_back(estimate.blocks_);
+
+    typedef std::chrono::steady_clock Clock;
+    const Clock::time_point start = Clock::now();
+
+    while (!estimate.pending_.empty() && Clock::now() - start < std::chrono::milliseconds(ESTIMATE_STEP))
+    {
+      std::uniform_int_distribution<std::size_t> pick(0, estimate.pending_.size() - 1);
+      std::swap(estimate.pending_[pick(estimate.random_)], estimate.pending_.back());
+
+      readEstimateBlock(estimate, *doc, estimate.pending_.back(), rowCount);
+      estimate.pending_.pop_back();
+    }
+
+    const bool done = complete && estimate.pending_.empty();
+    const Clock::time_point now = Clock::now();
+    if (!done && now - estimate.shown_ < std::chrono::milliseconds(ESTIMATE_REFRESH_INTERVAL))
+      return false;
+
+    estimate.shown_ = now;
+    flashMessage(estimateMessage(estimate, *doc, rowCount, done));
+
+    if (done)
+      estimate_.reset();
+
+    return true;
+  }
+
+  bool startEstimate(std::vector<std::string> args)
+  {
+    auto started = std::unique_ptr<Estimate>(new Estimate());
+    Estimate & estimate = *started;
+    estimate.first_ = 1;
+
+    if (!args.empty() && args.front() == "-noHeader")
+    {
+      estimate.first_ = 0;
+      args.erase(args.begin());
+    }
+
+    if (args.size() >= 2 && args.front() == "-groupby")
+    {
+      estimate.keyColumn_ = Index::strToColumn(args[1]);
+      if (estimate.keyColumn_ < 0 || estimate.keyColumn_ >= getColumnCount())
+      {
+        logError("estimate column ", estimate.keyColumn_, " out of range");
+        return false;
+      }
+
+      args.erase(args.begin(), args.begin() + 2);
+    }
+
+    if (args.empty())
+      args.push_back("-count");
+
+    if (!parseAggregates(args, getColumnCount(), estimate.aggregates_, estimate.inputColumns_))
+      return false;
+
+    Buffer const& buffer = currentBuffer();
+    if (buffer.view_)
+    {
+      logError("estimate reads the rows of a document, use groupby on a view");
+      return false;
+    }
+
+    Document & doc = *buffer.doc_;
+    for (auto const& aggregate : estimate.aggregates_)
+    {
+      const std::string header = estimate.first_ > 0 ? (doc.paged_ ? pagedText(doc, Index(aggregate.column, 0)) : getCellText(Index(aggregate.column, 0))) : Index::columnToStr(aggregate.column);
+      estimate.names_.push_back(aggregateName(aggregate, header));
+    }
+
+    estimate.doc_ = buffer.doc_;
+    estimate.random_.seed(std::random_device()());
+
+    // The message lines show the first blocks read right away
+    estimate_ = std::move(started);
+    updateEstimate();
+    return true;
+  }
+
+  void cancelEstimate()
+  {
+    estimate_.reset();
+  }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// The estimate command aggregates a document that may be paged or still loading from
+// random blocks of its rows, the way groupby does, with 95% confidence intervals that
+// narrow as more blocks are read
+namespace doc {
+
+  // Starts an estimate of the current document with the arguments of the estimate
+  // command, replacing the one running. Returns false, having logged why, if they are
+  // wrong or the buffer is a view.
+  bool startEstimate(std::vector<std::string> args);
+  void cancelEstimate();
+
+  // updateEstimate() reads blocks for a few milliseconds and returns true when it put
+  // what they give in the message lines
+  bool isEstimating();
+  bool updateEstimate();
+}
@@ -1,19 +1,27 @@
 
 #include "Expression.h"
 #include "Tokenizer.h"
+#include "Jit.h"
 #include "Document.h"
 #include "Editor.h"
 #include "Log.h"
 #include "Tcl.h"
+#include "Scheduler.h"
+#include "ZumPlugin.h"
 
-#include <unordered_map>
-#include <cmath>
+#include "bx/os.h"
 
-#include "ExpressionFunctions.h"
-
-struct FuncDef;
+#include <assert.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 
-typedef bool EvalFunction(std::vector<Expr> & valueStack);
 typedef bool StrFunction(FuncDef const* func, std::vector<std::tuple<int, std::string>> & args);
 
 bool opToString(FuncDef const* func, std::vector<std::tuple<int, std::string>> & args);
@@ -21,40 +29,211 @@ bool funcToString(FuncDef const* func, std::vector<std::tuple<int, std::string>>
 
 struct FuncDef
 {
-  FuncDef(int precedence, int argCount, const char * name, EvalFunction * evalFunc)
+  FuncDef(int precedence, int argCount, const char * name, Program::Op op, int rangeArg = -1)
     : precedence_(precedence),
       argCount_(argCount),
+      rangeArg_(rangeArg),
       name_(name),
-      evalFunc_(evalFunc),
+      op_(op),
       strFunc_(precedence == -1 ? funcToString : opToString)
   { }
 
   int precedence_ = -1;
   int argCount_ = 0;
+
+  // The argument that has to be a range, the others are values
+  int rangeArg_ = -1;
   const char * name_;
-  EvalFunction * evalFunc_= nullptr;
+  Program::Op op_;
   StrFunction * strFunc_ = nullptr;
+
+  // Which Tcl or plugin function a Call or Native calls
+  int function_ = -1;
 };
 
+// A formula function defined in Tcl. Its results are kept by the bytes of their
+// arguments, the arguments of deferred calls wait in queued_ for runDeferredCalls().
+struct TclFunction
+{
+  TclFunction(std::string const& name, int argCount)
+    : name_(name),
+      def_(-1, argCount, name_.c_str(), Program::Call)
+  { }
+
+  std::string name_;
+  std::string command_;
+  FuncDef def_;
+
+  std::unordered_map<std::string, double> results_;
+  std::unordered_set<std::string> queued_;
+};
+
+// A formula function registered by a plugin
+struct NativeFunction
+{
+  NativeFunction(std::string const& name, int argCount)
+    : name_(name),
+      def_(-1, argCount, name_.c_str(), Program::Native)
+  { }
+
+  std::string name_;
+  FuncDef def_;
+
+  ZumScalarFunction scalar_ = nullptr;
+  ZumBatchFunction batch_ = nullptr;
+};
 
-static const std::unordered_map<std::string, FuncDef> functionDefinitions_ = {
-  { "*", FuncDef(4, 2, "*", opMultiply) },
-  { "/", FuncDef(3, 2, "/", opDivide) },
-  { "+", FuncDef(1, 2, "+", opAdd) },
-  { "-", FuncDef(1, 2, "-", opSubtract) },
-
-  { "SUM",    FuncDef(-1, 1, "SUM",   funcSum) },
-  { "MIN",    FuncDef(-1, 1, "MIN",   funcMin) },
-  { "MAX",    FuncDef(-1, 1, "MAX",   funcMax) },
-  { "ABS",    FuncDef(-1, 1, "ABS",   funcAbs) },
-  { "COS",    FuncDef(-1, 1, "COS",   funcCos) },
-  { "SIN",    FuncDef(-1, 1, "SIN",   funcSin) },
-  { "FLOOR",  FuncDef(-1, 1, "FLOOR", funcFloor) },
-  { "CEIL",   FuncDef(-1, 1, "CEIL",  funcCeil) },
+// Names of the buffers formulas reference, by their number. Cells are parsed on the
+// loading threads too.
+static std::deque<std::string> sheets_;
+static std::mutex sheetMutex_;
+
+// Functions are never removed and plugins never unloaded, formulas point at their definitions
+static std::deque<TclFunction> tclFunctions_;
+static std::deque<NativeFunction> nativeFunctions_;
+static std::mutex tclFunctionMutex_;
+static bool deferCalls_ = false;
+static thread_local bool missedCall_ = false;
+
+// With doc_parallelFunctions worker interpreters make the deferred calls of a function
+// at the same time, in batches of at least PARALLEL_BATCH_CALLS calls, see
+// tcl::callBatchedOnWorker()
+static const tcl::Variable PARALLEL_FUNCTIONS("doc_parallelFunctions", false);
+static const std::size_t PARALLEL_BATCH_CALLS = 256;
+
+
+// Ordered the way findFunction() picks them
+static const FuncDef functionDefinitions_[] = {
+  FuncDef(4, 2, "*", Program::Multiply),
+  FuncDef(3, 2, "/", Program::Divide),
+  FuncDef(1, 2, "+", Program::Add),
+  FuncDef(1, 2, "-", Program::Subtract),
+
+  FuncDef(-1, 1, "SUM",   Program::Sum, 0),
+  FuncDef(-1, 2, "MIN",   Program::Min),
+  FuncDef(-1, 2, "MAX",   Program::Max),
+  FuncDef(-1, 1, "ABS",   Program::Abs),
+  FuncDef(-1, 1, "COS",   Program::Cos),
+  FuncDef(-1, 1, "SIN",   Program::Sin),
+  FuncDef(-1, 1, "FLOOR", Program::Floor),
+  FuncDef(-1, 1, "CEIL",  Program::Ceil),
+
+  FuncDef(-1, 2, "MATCH",   Program::Match, 1),
+  FuncDef(-1, 3, "VLOOKUP", Program::Lookup, 1),
+  FuncDef(-1, 2, "COUNTIF", Program::CountIf, 0),
+  FuncDef(-1, 3, "SUMIF",   Program::SumIf, 0),
 };
 
 static const int MAX_PRECEDENCE = 99999;
 
+std::string const& errorText(FormulaError error)
+{
+  static const std::string TEXTS[] = { "", "#ERROR", "#REF", "#DIV0", "#ARG", "#CYCLE" };
+  return TEXTS[(int)error];
+}
+
+static Program failedProgram(FormulaError error)
+{
+  Program program;
+  program.error_ = error;
+  return program;
+}
+
+// An error in the dividend stays the error
+static inline double divide(double dividend, double divisor)
+{
+  return divisor == 0.0 && !std::isnan(dividend) ? errorValue(FormulaError::Div0) : dividend / divisor;
+}
+
+// Unlike std::min() and std::max(), NaNs are kept for both operands
+static inline double minimum(double a, double b)
+{
+  return std::isnan(b) ? b : std::min(a, b);
+}
+
+static inline double maximum(double a, double b)
+{
+  return std::isnan(b) ? b : std::max(a, b);
+}
+
+int findSheet(std::string const& name)
+{
+  std::lock_guard<std::mutex> lock(sheetMutex_);
+
+  auto it = std::find(sheets_.begin(), sheets_.end(), name);
+  return it != sheets_.end() ? (int)(it - sheets_.begin()) : Expr::NO_SHEET;
+}
+
+int sheetId(std::string const& name)
+{
+  const int sheet = findSheet(name);
+  if (sheet != Expr::NO_SHEET)
+    return sheet;
+
+  std::lock_guard<std::mutex> lock(sheetMutex_);
+  sheets_.push_back(name);
+  return sheets_.size() - 1;
+}
+
+std::string sheetName(int sheet)
+{
+  std::lock_guard<std::mutex> lock(sheetMutex_);
+  return sheet >= 0 && sheet < (int)sheets_.size() ? sheets_[sheet] : std::string();
+}
+
+// The first two characters of a name pick the only definition it can be, with the length
+// telling apart the ones that share them, and one comparison then confirms it. Parsing
+// looks up every operator and function this way.
+const FuncDef * findFunction(const char * name, std::size_t length)
+{
+  if (length == 0)
+    return nullptr;
+
+  const char second = length > 1 ? name[1] : 0;
+  int candidate = -1;
+
+  switch (name[0])
+  {
+    case '*': candidate = 0; break;
+    case '/': candidate = 1; break;
+    case '+': candidate = 2; break;
+    case '-': candidate = 3; break;
+    case 'S': candidate = second == 'U' ? (length == 5 ? 15 : 4) : 9; break;
+    case 'M': candidate = second == 'I' ? 5 : (length == 5 ? 12 : 6); break;
+    case 'A': candidate = 7; break;
+    case 'C': candidate = second == 'O' ? (length == 7 ? 14 : 8) : 11; break;
+    case 'F': candidate = 10; break;
+    case 'V': candidate = 13; break;
+  }
+
+  if (candidate >= 0)
+  {
+    FuncDef const& func = functionDefinitions_[candidate];
+    if (strlen(func.name_) == length && memcmp(func.name_, name, length) == 0)
+      return &func;
+  }
+
+  for (auto const& function : tclFunctions_)
+    if (function.name_.size() == length && memcmp(function.name_.data(), name, length) == 0)
+      return &function.def_;
+
+  for (auto const& function : nativeFunctions_)
+    if (function.name_.size() == length && memcmp(function.name_.data(), name, length) == 0)
+      return &function.def_;
+
+  return nullptr;
+}
+
+const FuncDef * findFunction(std::string const& name)
+{
+  return findFunction(name.data(), name.size());
+}
+
+const char * functionName(const FuncDef * func)
+{
+  return func->name_;
+}
+
 bool opToString(FuncDef const* func, std::vector<std::tuple<int, std::string>> & args)
 {
   if (func->argCount_ != 2 || args.size() < 2)
@@ -85,22 +264,24 @@ bool funcToString(FuncDef const* func, std::vector<std::tuple<int, std::string>>
 
   std::string result = func->name_ + std::string("(");
 
-  for (int i = 0; i < func->argCount_; ++i)
+  const std::size_t first = args.size() - func->argCount_;
+  for (std::size_t i = first; i < args.size(); ++i)
   {
-    result += std::get<1>(args.back());
-    args.pop_back();
+    result += std::get<1>(args[i]);
 
-    if (i < (func->argCount_ - 1))
+    if (i < (args.size() - 1))
       result += ", ";
   }
 
+  args.resize(first);
   result += ")";
   args.push_back(std::make_tuple(MAX_PRECEDENCE, result));
 
   return true;
 }
 
-std::string exprToString(std::vector<Expr> const& expression)
+template <typename RefFunc>
+static std::string exprToString(std::vector<Expr> const& expression, RefFunc const& refToString)
 {
   std::vector<std::tuple<int, std::string>> result;
 
@@ -110,45 +291,100 @@ std::string exprToString(std::vector<Expr> const& expression)
     {
       expr.func_->strFunc_(expr.func_, result);
     }
-    else
+    else if (expr.type_ == Expr::Constant)
     {
       result.push_back(std::make_tuple(MAX_PRECEDENCE, expr.toStr()));
     }
+    else
+    {
+      result.push_back(std::make_tuple(MAX_PRECEDENCE, refToString(expr)));
+    }
   }
 
-  return std::get<1>(result.front());
+  return result.empty() ? std::string() : std::get<1>(result.front());
 }
 
-std::string Expr::toStr() const
+std::string exprToString(std::vector<Expr> const& expression)
 {
-  switch (type_)
+  return exprToString(expression, [] (Expr const& expr) { return expr.toStr(); });
+}
+
+// References are written as markers holding their number, which are then cut out of
+// the text again. Constants and function names never contain the marker characters.
+static const char REF_START = '\x01';
+static const char REF_END = '\x02';
+
+ExprText exprText(std::vector<Expr> const& expression)
+{
+  std::vector<Index> refs;
+  auto marker = [&refs] (Index const& idx) {
+    refs.push_back(idx);
+    return REF_START + std::to_string(refs.size() - 1) + REF_END;
+  };
+
+  const std::string marked = exprToString(expression, [&marker] (Expr const& expr) {
+    const std::string sheet = expr.sheet_ != Expr::NO_SHEET ? sheetName(expr.sheet_) + "!" : std::string();
+
+    if (expr.type_ == Expr::Range)
+    {
+      const std::string start = marker(expr.startIndex_);
+      return sheet + start + ":" + marker(expr.endIndex_);
+    }
+
+    return sheet + marker(expr.startIndex_);
+  });
+
+  ExprText text;
+  text.text_.reserve(marked.size());
+
+  for (std::size_t i = 0; i < marked.size(); ++i)
   {
-    case Expr::Constant:
-      return str::fromDouble(constant_);
+    if (marked[i] != REF_START)
+    {
+      text.text_.push_back(marked[i]);
+      continue;
+    }
 
-    case Expr::Function:
-      return func_->name_;
+    const std::size_t end = marked.find(REF_END, i);
+    text.refs_.emplace_back(text.text_.size(), refs[atoi(marked.c_str() + i + 1)]);
+    i = end;
+  }
 
-    case Expr::Cell:
-      return startIndex_.toStr();
+  return text;
+}
 
-    case Expr::Range:
-      return startIndex_.toStr() + ":" + endIndex_.toStr();
+void writeExprText(ExprText const& text, Index const& origin, std::string & out)
+{
+  char name[Index::MAX_NAME_LENGTH];
+  std::size_t position = 0;
+
+  for (auto const& ref : text.refs_)
+  {
+    out.append(text.text_, position, ref.first - position);
+    position = ref.first;
+
+    const Index idx(ref.second.x + origin.x, ref.second.y + origin.y);
+    out.append(name, idx.format(name));
   }
+
+  out.append(text.text_, position, std::string::npos);
 }
 
-double Expr::toDouble() const
+std::string Expr::toStr() const
 {
   switch (type_)
   {
     case Expr::Constant:
-      return constant_;
+      return str::fromDouble(constant_);
+
+    case Expr::Function:
+      return func_->name_;
 
     case Expr::Cell:
-      return doc::getCellValue(startIndex_);
+      return (sheet_ != NO_SHEET ? sheetName(sheet_) + "!" : std::string()) + startIndex_.toStr();
 
-    default:
-      return 0.0;
+    case Expr::Range:
+      return (sheet_ != NO_SHEET ? sheetName(sheet_) + "!" : std::string()) + startIndex_.toStr() + ":" + endIndex_.toStr();
   }
 }
 
@@ -164,7 +400,7 @@ std::vector<Expr> parseExpression(std::string const& source)
 {
   std::vector<Expr> output;
 
-  std::vector<std::tuple<Token, std::string>> operatorStack;
+  std::vector<std::tuple<Token, FuncDef const*>> operatorStack;
   operatorStack.reserve(10);
 
   Tokenizer tokenizer(source);
@@ -177,73 +413,63 @@ std::vector<Expr> parseExpression(std::string const& source)
     switch (token)
     {
       case Token::Number:
-        output.push_back(Expr(std::stof(tokenizer.value().c_str())));
+        output.push_back(Expr(tokenizer.number()));
         break;
 
       case Token::Cell:
-        output.push_back(Expr(Index::fromStr(tokenizer.value())));
+        output.push_back(Expr(tokenizer.startIndex()));
+        if (!tokenizer.sheet().empty())
+          output.back().sheet_ = sheetId(tokenizer.sheet().str());
         break;
 
       case Token::Range:
-        {
-          const std::size_t pos = tokenizer.value().find_first_of(":");
-          if (pos == std::string::npos)
-          {
-            logError("error in expression '", source, "' - malformated range '", tokenizer.value(), "'");
-            return {};
-          }
-
-          const std::string start = tokenizer.value().substr(0, pos);
-          const std::string end = tokenizer.value().substr(pos + 1);
-
-          output.push_back(Expr(Index::fromStr(start), Index::fromStr(end)));
-        }
+        output.push_back(Expr(tokenizer.startIndex(), tokenizer.endIndex()));
+        if (!tokenizer.sheet().empty())
+          output.back().sheet_ = sheetId(tokenizer.sheet().str());
         break;
 
       case Token::Operator:
         {
-          FuncDef const& tokenDef = functionDefinitions_.at(tokenizer.value());
+          FuncDef const* tokenDef = findFunction(tokenizer.value().data(), tokenizer.value().size());
 
           while (!operatorStack.empty())
           {
             Token opToken;
-            std::string opValue;
-            std::tie(opToken, opValue) = operatorStack.back();
+            FuncDef const* stackDef;
+            std::tie(opToken, stackDef) = operatorStack.back();
 
             if (opToken != Token::Operator)
               break;
 
-            FuncDef const& stackDef = functionDefinitions_.at(opValue);
-
-            if (tokenDef.precedence_ <= stackDef.precedence_)
+            if (tokenDef->precedence_ <= stackDef->precedence_)
             {
-              output.push_back(Expr(&stackDef));
+              output.push_back(Expr(stackDef));
               operatorStack.pop_back();
             }
             else
               break;
           }
 
-          operatorStack.push_back(std::make_tuple(Token::Operator, tokenizer.value()));
+          operatorStack.push_back(std::make_tuple(Token::Operator, tokenDef));
         }
         break;
 
       case Token::Identifier:
         {
-          if (functionDefinitions_.count(tokenizer.value()) == 1)
+          if (FuncDef const* func = findFunction(tokenizer.value().data(), tokenizer.value().size()))
           {
-            operatorStack.push_back(std::make_tuple(Token::Identifier, tokenizer.value()));
+            operatorStack.push_back(std::make_tuple(Token::Identifier, func));
           }
           else
           {
-            logError("unknown function in expression '", source, "' - ", tokenizer.value());
+            logError("unknown function in expression '", source, "' - ", tokenizer.value().str());
             return {};
           }
         }
         break;
 
       case Token::LeftParenthesis:
-        operatorStack.push_back(std::make_tuple(Token::LeftParenthesis, ""));
+        operatorStack.push_back(std::make_tuple(Token::LeftParenthesis, nullptr));
         break;
 
       case Token::RightParenthesis:
@@ -253,7 +479,7 @@ std::vector<Expr> parseExpression(std::string const& source)
           while (!operatorStack.empty())
           {
             Token opToken;
-            std::string opValue;
+            FuncDef const* opValue;
             std::tie(opToken, opValue) = operatorStack.back();
             operatorStack.pop_back();
 
@@ -269,8 +495,7 @@ std::vector<Expr> parseExpression(std::string const& source)
               return {};
             }
 
-            FuncDef const& stackDef = functionDefinitions_.at(opValue);
-            output.push_back(Expr(&stackDef));
+            output.push_back(Expr(opValue));
           }
 
           if (!hasLeftParenthesis)
@@ -282,13 +507,12 @@ std::vector<Expr> parseExpression(std::string const& source)
           if (!operatorStack.empty())
           {
             Token opToken;
-            std::string opValue;
+            FuncDef const* opValue;
             std::tie(opToken, opValue) = operatorStack.back();
 
             if (opToken == Token::Identifier)
             {
-              FuncDef const& stackDef = functionDefinitions_.at(opValue);
-              output.push_back(Expr(&stackDef));
+              output.push_back(Expr(opValue));
 
               operatorStack.pop_back();
             }
@@ -303,7 +527,7 @@ std::vector<Expr> parseExpression(std::string const& source)
           while (!operatorStack.empty())
           {
             Token opToken;
-            std::string opValue;
+            FuncDef const* opValue;
             std::tie(opToken, opValue) = operatorStack.back();
 
             if (opToken == Token::LeftParenthesis)
@@ -318,11 +542,11 @@ std::vector<Expr> parseExpression(std::string const& source)
             {
               case Token::Operator:
               case Token::Identifier:
-                output.push_back(Expr(&functionDefinitions_.at(opValue)));
+                output.push_back(Expr(opValue));
                 break;
 
               default:
-                logError("error in expression '", source, "' - did not expect ", opValue);
+                logError("error in expression '", source, "' - did not expect a parenthesis");
                 return {};
             }
           }
@@ -340,7 +564,7 @@ std::vector<Expr> parseExpression(std::string const& source)
         break;
 
       case Token::Error:
-        logError("parse error in expression '", source, "' - ", tokenizer.value());
+        logError("parse error in expression '", source, "' - ", tokenizer.error());
         return {};
     };
   }
@@ -348,7 +572,7 @@ std::vector<Expr> parseExpression(std::string const& source)
   while (!operatorStack.empty())
   {
     Token opToken;
-    std::string opValue;
+    FuncDef const* opValue;
     std::tie(opToken, opValue) = operatorStack.back();
     operatorStack.pop_back();
 
@@ -356,7 +580,7 @@ std::vector<Expr> parseExpression(std::string const& source)
     {
       case Token::Operator:
       case Token::Identifier:
-        output.push_back(Expr(&functionDefinitions_.at(opValue)));
+        output.push_back(Expr(opValue));
         break;
 
       case Token::LeftParenthesis:
@@ -364,7 +588,7 @@ std::vector<Expr> parseExpression(std::string const& source)
         return {};
 
       default:
-        logError("error in expression '", source, "' - did not expect ", opValue);
+        logError("error in expression '", source, "' - did not expect a parenthesis");
         return {};
     }
   }
@@ -372,39 +596,805 @@ std::vector<Expr> parseExpression(std::string const& source)
   return output;
 }
 
-double evaluate(std::vector<Expr> const& expression)
+Program compileExpression(std::vector<Expr> const& expression)
 {
-  std::vector<Expr> valueStack;
-  valueStack.reserve(expression.size() / 2);
+  // parseExpression() already reported why there is nothing to compile
+  if (expression.empty())
+    return failedProgram(FormulaError::Syntax);
+
+  Program program;
+  program.code_.reserve(expression.size());
+
+  // Ranges only exist at compile time, they are consumed by the function taking them.
+  // Operands that are known to be constant are folded into their function.
+  std::vector<Expr const*> operands;
+  std::vector<bool> constants;
+
+  // The instruction of each Cell operand
+  std::vector<std::size_t> cells;
+
+  // Sums emitted so far, a range summed again recalls the first result
+  std::vector<std::size_t> sums;
+  int slots = 0;
 
   for (auto const& expr : expression)
   {
+    Program::Instruction instruction;
+
     switch (expr.type_)
     {
       case Expr::Constant:
+        instruction.op_ = Program::Constant;
+        instruction.constant_ = expr.constant_;
+        program.code_.push_back(instruction);
+        operands.push_back(&expr);
+        constants.push_back(true);
+        cells.push_back(0);
+        break;
+
       case Expr::Cell:
+        instruction.op_ = Program::Cell;
+        instruction.sheet_ = expr.sheet_;
+        instruction.cell_.x_ = expr.startIndex_.x;
+        instruction.cell_.y_ = expr.startIndex_.y;
+        cells.push_back(program.code_.size());
+        program.code_.push_back(instruction);
+        operands.push_back(&expr);
+        constants.push_back(false);
+        break;
+
       case Expr::Range:
-        valueStack.push_back(expr);
+        operands.push_back(&expr);
+        constants.push_back(false);
+        cells.push_back(0);
         break;
 
       case Expr::Function:
         {
-          if (!expr.func_->evalFunc_(valueStack))
-            return 0.0;
+          FuncDef const* func = expr.func_;
+
+          if (operands.size() < func->argCount_)
+          {
+            logError("wrong number of arguments in ", func->name_);
+            return failedProgram(FormulaError::Arg);
+          }
+
+          const std::size_t first = operands.size() - func->argCount_;
+
+          for (std::size_t i = first; i < operands.size(); ++i)
+          {
+            if (operands[i]->type_ == Expr::Range && (int)(i - first) != func->rangeArg_)
+            {
+              logError(func->name_, " expected a value argument, not the range ", operands[i]->toStr());
+              return failedProgram(FormulaError::Arg);
+            }
+
+            if (operands[i]->type_ != Expr::Range && (int)(i - first) == func->rangeArg_)
+            {
+              logError(func->name_, " expected a range argument");
+              return failedProgram(FormulaError::Arg);
+            }
+          }
+
+          if (func->rangeArg_ >= 0)
+          {
+            Expr const* range = operands[first + func->rangeArg_];
+
+            Index const& startIdx = range->startIndex_;
+            Index const& endIdx = range->endIndex_;
+
+            if (startIdx.x > endIdx.x || startIdx.y > endIdx.y)
+            {
+              logError("invalid range, row and column in start index ", startIdx.toStr(), " must be less than end index ", endIdx.toStr());
+              return failedProgram(FormulaError::Ref);
+            }
+
+            // Texts compare by their id in the string pool of a document, so a key is only
+            // given as text when it comes from the document looked up in
+            const std::size_t key = first + (func->rangeArg_ == 0 ? 1 : 0);
+            const bool lookup = func->op_ == Program::Match || func->op_ == Program::Lookup ||
+                                func->op_ == Program::CountIf || func->op_ == Program::SumIf;
+
+            if (lookup && operands[key]->type_ == Expr::Cell && operands[key]->sheet_ == range->sheet_)
+              program.code_[cells[key]].text_ = true;
+
+            instruction.sheet_ = range->sheet_;
+            instruction.cell_.x_ = startIdx.x;
+            instruction.cell_.y_ = startIdx.y;
+            instruction.cell_.endX_ = endIdx.x;
+            instruction.cell_.endY_ = endIdx.y;
+
+            // A range summed again recalls the first sum
+            if (func->op_ == Program::Sum)
+            {
+              for (std::size_t sum : sums)
+              {
+                Program::Instruction & earlier = program.code_[sum];
+                if (earlier.sheet_ != range->sheet_ || earlier.cell_.x_ != startIdx.x || earlier.cell_.y_ != startIdx.y ||
+                    earlier.cell_.endX_ != endIdx.x || earlier.cell_.endY_ != endIdx.y)
+                  continue;
+
+                if (earlier.slot_ == Program::NO_SLOT && slots < Program::MAX_SLOTS)
+                  earlier.slot_ = slots++;
+
+                if (earlier.slot_ != Program::NO_SLOT)
+                {
+                  instruction.op_ = Program::Recall;
+                  instruction.slot_ = earlier.slot_;
+                }
+                break;
+              }
+            }
+          }
+
+          // Tcl and plugin functions are called when the formula is evaluated, they may be
+          // defined again
+          const bool defined = func->op_ == Program::Call || func->op_ == Program::Native;
+          const bool folded = func->argCount_ > 0 && !defined &&
+            std::find(constants.begin() + first, constants.end(), false) == constants.end();
+
+          if (instruction.op_ != Program::Recall)
+            instruction.op_ = func->op_;
+
+          if (defined)
+          {
+            instruction.cell_.x_ = func->function_;
+            instruction.cell_.y_ = func->argCount_;
+          }
+
+          if (instruction.op_ == Program::Sum)
+            sums.push_back(program.code_.size());
+
+          program.code_.push_back(instruction);
+
+          // All arguments are constant instructions right before the function, evaluating
+          // them now leaves a single constant
+          if (folded)
+          {
+            const std::size_t start = program.code_.size() - 1 - func->argCount_;
+
+            Program constant;
+            constant.code_.assign(program.code_.begin() + start, program.code_.end());
+
+            instruction.op_ = Program::Constant;
+            instruction.constant_ = evaluate(constant, Index(0, 0));
+
+            program.code_.resize(start);
+            program.code_.push_back(instruction);
+          }
+
+          operands.resize(first);
+          operands.push_back(&expr);
+          constants.resize(first);
+          constants.push_back(folded);
+          cells.resize(first);
+          cells.push_back(0);
+        }
+        break;
+    }
+
+    if (operands.size() > Program::MAX_STACK_SIZE)
+    {
+      logError("expression '", exprToString(expression), "' is too deeply nested");
+      return failedProgram(FormulaError::Syntax);
+    }
+  }
+
+  if (operands.size() != 1 || operands.front()->type_ == Expr::Range)
+  {
+    logError("error while compiling expression '", exprToString(expression), "'");
+    return failedProgram(FormulaError::Syntax);
+  }
+
+  return program;
+}
+
+// Bytes of the operands that follow the type of an encoded Expr, with the sheet
+static std::size_t operandSize(uint8_t type)
+{
+  if (type & ExprCode::SHEET_FLAG)
+    return sizeof(int32_t) + operandSize(type & ~ExprCode::SHEET_FLAG);
+
+  switch (type)
+  {
+    case Expr::Constant:  return sizeof(double);
+    case Expr::Cell:      return sizeof(Index);
+    case Expr::Range:     return 2 * sizeof(Index);
+    default:              return sizeof(const FuncDef *);
+  }
+}
+
+ExprCode::ExprCode(std::vector<Expr> const& expression)
+{
+  for (auto const& expr : expression)
+    push_back(expr);
+}
+
+void ExprCode::push_back(Expr const& expr)
+{
+  auto append = [this] (void const* data, std::size_t size) {
+    bytes_.append(static_cast<const uint8_t *>(data), static_cast<const uint8_t *>(data) + size);
+  };
+
+  if (expr.sheet_ != Expr::NO_SHEET && (expr.type_ == Expr::Cell || expr.type_ == Expr::Range))
+  {
+    const int32_t sheet = expr.sheet_;
+    bytes_.push_back(static_cast<uint8_t>(expr.type_) | SHEET_FLAG);
+    append(&sheet, sizeof(sheet));
+  }
+  else
+    bytes_.push_back(static_cast<uint8_t>(expr.type_));
+
+  switch (expr.type_)
+  {
+    case Expr::Constant:
+      append(&expr.constant_, sizeof(expr.constant_));
+      break;
+
+    case Expr::Cell:
+      append(&expr.startIndex_, sizeof(expr.startIndex_));
+      break;
+
+    case Expr::Range:
+      append(&expr.startIndex_, sizeof(expr.startIndex_));
+      append(&expr.endIndex_, sizeof(expr.endIndex_));
+      break;
+
+    case Expr::Function:
+      append(&expr.func_, sizeof(expr.func_));
+      break;
+  }
+}
+
+Expr ExprCode::const_iterator::operator * () const
+{
+  Expr expr;
+  expr.type_ = static_cast<Expr::Type>(*at_ & ~SHEET_FLAG);
+
+  const uint8_t * operands = at_ + 1;
+  if (*at_ & SHEET_FLAG)
+  {
+    int32_t sheet;
+    memcpy(&sheet, operands, sizeof(sheet));
+    expr.sheet_ = sheet;
+    operands += sizeof(sheet);
+  }
+
+  switch (expr.type_)
+  {
+    case Expr::Constant:
+      memcpy(&expr.constant_, operands, sizeof(expr.constant_));
+      break;
+
+    case Expr::Cell:
+      memcpy(&expr.startIndex_, operands, sizeof(expr.startIndex_));
+      break;
+
+    case Expr::Range:
+      memcpy(&expr.startIndex_, operands, sizeof(expr.startIndex_));
+      memcpy(&expr.endIndex_, operands + sizeof(expr.startIndex_), sizeof(expr.endIndex_));
+      break;
+
+    case Expr::Function:
+      memcpy(&expr.func_, operands, sizeof(expr.func_));
+      break;
+  }
+
+  return expr;
+}
+
+ExprCode::const_iterator & ExprCode::const_iterator::operator ++ ()
+{
+  at_ += 1 + operandSize(*at_);
+  return *this;
+}
+
+std::vector<Expr> ExprCode::decode() const
+{
+  std::vector<Expr> expression;
+  for (auto const& expr : *this)
+    expression.push_back(expr);
+
+  return expression;
+}
+
+void ExprCode::offset(Index const& offset)
+{
+  for (uint8_t * at = bytes_.begin(); at != bytes_.end(); at += 1 + operandSize(*at))
+  {
+    const uint8_t type = *at & ~SHEET_FLAG;
+    if (type != Expr::Cell && type != Expr::Range)
+      continue;
+
+    uint8_t * first = at + 1 + (*at & SHEET_FLAG ? sizeof(int32_t) : 0);
+    for (uint8_t * ref = first; ref != at + 1 + operandSize(*at); ref += sizeof(Index))
+    {
+      Index idx;
+      memcpy(&idx, ref, sizeof(idx));
+      idx.x += offset.x;
+      idx.y += offset.y;
+      memcpy(ref, &idx, sizeof(idx));
+    }
+  }
+}
+
+void offsetExpression(std::vector<Expr> & expression, Index const& offset)
+{
+  for (auto & expr : expression)
+  {
+    if (expr.type_ != Expr::Cell && expr.type_ != Expr::Range)
+      continue;
+
+    expr.startIndex_.x += offset.x;
+    expr.startIndex_.y += offset.y;
+
+    if (expr.type_ == Expr::Range)
+    {
+      expr.endIndex_.x += offset.x;
+      expr.endIndex_.y += offset.y;
+    }
+  }
+}
+
+void offsetProgram(Program & program, Index const& offset)
+{
+  for (auto & instruction : program.code_)
+  {
+    const bool range = instruction.op_ == Program::Sum || instruction.op_ == Program::Match || instruction.op_ == Program::Lookup ||
+                       instruction.op_ == Program::CountIf || instruction.op_ == Program::SumIf;
+
+    if (instruction.op_ != Program::Cell && !range)
+      continue;
+
+    instruction.cell_.x_ += offset.x;
+    instruction.cell_.y_ += offset.y;
+
+    if (range)
+    {
+      instruction.cell_.endX_ += offset.x;
+      instruction.cell_.endY_ += offset.y;
+    }
+  }
+}
+
+static double callFunction(int id, double const* args, int count)
+{
+  TclFunction & function = tclFunctions_[id];
+  const std::string key(reinterpret_cast<const char *>(args), count * sizeof(double));
+
+  {
+    std::lock_guard<std::mutex> lock(tclFunctionMutex_);
+
+    auto it = function.results_.find(key);
+    if (it != function.results_.end())
+      return it->second;
+
+    if (deferCalls_)
+    {
+      function.queued_.insert(key);
+      missedCall_ = true;
+      return NAN;
+    }
+  }
+
+  // Only the main thread evaluates formulas without deferring the calls
+  std::vector<double> results;
+  const double value = tcl::callBatched(function.command_, std::vector<double>(args, args + count), count, results) ? results.front() : NAN;
+
+  std::lock_guard<std::mutex> lock(tclFunctionMutex_);
+  function.results_[key] = value;
+  return value;
+}
+
+bool deferFunctionCalls(bool defer)
+{
+  const bool deferred = deferCalls_;
+  deferCalls_ = defer;
+  return deferred;
+}
+
+bool takeMissedCall()
+{
+  const bool missed = missedCall_;
+  missedCall_ = false;
+  return missed;
+}
+
+bool runDeferredCalls()
+{
+  // The queued calls of a function, cut into several batches for the workers
+  struct Batch
+  {
+    TclFunction * function_ = nullptr;
+    std::vector<std::string> keys_;
+    std::vector<double> args_;
+    std::vector<double> results_;
+    bool ok_ = false;
+    bool needsMain_ = true;
+  };
+
+  const int threads = Scheduler::shared().threadCount();
+  const bool parallel = PARALLEL_FUNCTIONS.toBool() && threads > 1;
+
+  std::vector<Batch> batches;
+  for (auto & function : tclFunctions_)
+  {
+    if (function.queued_.empty())
+      continue;
+
+    std::vector<std::string> keys(function.queued_.begin(), function.queued_.end());
+    function.queued_.clear();
+
+    const int argCount = function.def_.argCount_;
+    const std::size_t size = parallel ? std::max(PARALLEL_BATCH_CALLS, (keys.size() + threads - 1) / threads) : keys.size();
+
+    for (std::size_t first = 0; first < keys.size(); first += size)
+    {
+      batches.emplace_back();
+      Batch & batch = batches.back();
+      batch.function_ = &function;
+      batch.keys_.assign(keys.begin() + first, keys.begin() + std::min(first + size, keys.size()));
+
+      batch.args_.resize(batch.keys_.size() * argCount);
+      for (std::size_t i = 0; i < batch.keys_.size(); ++i)
+        memcpy(&batch.args_[i * argCount], batch.keys_[i].data(), argCount * sizeof(double));
+    }
+  }
+
+  if (batches.empty())
+    return false;
+
+  if (parallel)
+  {
+    // The workers define the procs as they are now
+    tcl::syncWorkers();
+
+    std::vector<Scheduler::Task> tasks;
+    for (auto & batch : batches)
+      tasks.push_back([&batch] () {
+        batch.ok_ = tcl::callBatchedOnWorker(batch.function_->command_, batch.args_, batch.function_->def_.argCount_, batch.results_, batch.needsMain_);
+      });
+
+    Scheduler::shared().run(tasks);
+  }
+
+  // Batches the workers can't make, those the main thread picked up while it waited too,
+  // are made on the interpreter
+  for (auto & batch : batches)
+  {
+    if (batch.needsMain_)
+      batch.ok_ = tcl::callBatched(batch.function_->command_, batch.args_, batch.function_->def_.argCount_, batch.results_);
+
+    // A failed call isn't made again until the function is defined again
+    if (!batch.ok_)
+      batch.results_.assign(batch.keys_.size(), NAN);
+
+    for (std::size_t i = 0; i < batch.keys_.size(); ++i)
+      batch.function_->results_[batch.keys_[i]] = batch.results_[i];
+  }
+
+  return true;
+}
+
+// Reads from the document of the buffer the instruction references, NaN if none is open
+// under its name
+template <typename Func>
+static double readSheet(Program::Instruction const& instruction, Func const& read)
+{
+  if (instruction.sheet_ == Expr::NO_SHEET)
+    return read();
+
+  double value = errorValue(FormulaError::Ref);
+  doc::readSheet(instruction.sheet_, [&value, &read] () { value = read(); });
+  return value;
+}
+
+static Index rangeStart(Program::Instruction const& instruction, Index const& origin)
+{
+  return Index(origin.x + instruction.cell_.x_, origin.y + instruction.cell_.y_);
+}
+
+static Index rangeEnd(Program::Instruction const& instruction, Index const& origin)
+{
+  return Index(origin.x + instruction.cell_.endX_, origin.y + instruction.cell_.endY_);
+}
+
+static double sumRange(Program::Instruction const& instruction, Index const& origin)
+{
+  return readSheet(instruction, [&] () { return doc::sumRange(rangeStart(instruction, origin), rangeEnd(instruction, origin)); });
+}
+
+double evaluate(Program const& program, Index const& origin)
+{
+  if (program.empty())
+    return program.error_ != FormulaError::None ? errorValue(program.error_) : 0.0;
+
+  // compileExpression() guarantees that the stack never over- or underflows
+  double stack[Program::MAX_STACK_SIZE];
+  int top = 0;
+
+  // Sums that are recalled later, a Sum always comes before its Recall
+  double slots[Program::MAX_SLOTS];
+
+  for (auto const& instruction : program.code_)
+  {
+    switch (instruction.op_)
+    {
+      case Program::Constant:
+        stack[top++] = instruction.constant_;
+        break;
+
+      case Program::Cell:
+        {
+          const Index idx(origin.x + instruction.cell_.x_, origin.y + instruction.cell_.y_);
+          auto read = [&idx, &instruction] () { return instruction.text_ ? doc::getCellKey(idx) : doc::getCellValue(idx); };
+          stack[top++] = instruction.sheet_ == Expr::NO_SHEET ? read() : readSheet(instruction, read);
         }
         break;
+
+      case Program::Add:
+        top--;
+        stack[top - 1] += stack[top];
+        break;
+
+      case Program::Subtract:
+        top--;
+        stack[top - 1] -= stack[top];
+        break;
+
+      case Program::Multiply:
+        top--;
+        stack[top - 1] *= stack[top];
+        break;
+
+      case Program::Divide:
+        top--;
+        stack[top - 1] = divide(stack[top - 1], stack[top]);
+        break;
+
+      case Program::Sum:
+        stack[top++] = sumRange(instruction, origin);
+        if (instruction.slot_ != Program::NO_SLOT)
+          slots[instruction.slot_] = stack[top - 1];
+        break;
+
+      case Program::Recall:
+        stack[top++] = slots[instruction.slot_];
+        break;
+
+      case Program::Min:
+        top--;
+        stack[top - 1] = minimum(stack[top - 1], stack[top]);
+        break;
+
+      case Program::Max:
+        top--;
+        stack[top - 1] = maximum(stack[top - 1], stack[top]);
+        break;
+
+      case Program::Abs:
+        stack[top - 1] = std::abs(stack[top - 1]);
+        break;
+
+      case Program::Cos:
+        stack[top - 1] = std::cos(stack[top - 1]);
+        break;
+
+      case Program::Sin:
+        stack[top - 1] = std::sin(stack[top - 1]);
+        break;
+
+      case Program::Floor:
+        stack[top - 1] = std::floor(stack[top - 1]);
+        break;
+
+      case Program::Ceil:
+        stack[top - 1] = std::ceil(stack[top - 1]);
+        break;
+
+      case Program::Match:
+        stack[top - 1] = readSheet(instruction, [&] () { return doc::matchRange(stack[top - 1], rangeStart(instruction, origin), rangeEnd(instruction, origin)); });
+        break;
+
+      case Program::Lookup:
+        top--;
+        stack[top - 1] = readSheet(instruction, [&] () { return doc::lookupRange(stack[top - 1], rangeStart(instruction, origin), rangeEnd(instruction, origin), stack[top]); });
+        break;
+
+      case Program::CountIf:
+        stack[top - 1] = readSheet(instruction, [&] () { return doc::countRange(stack[top - 1], rangeStart(instruction, origin), rangeEnd(instruction, origin)); });
+        break;
+
+      case Program::SumIf:
+        top--;
+        stack[top - 1] = readSheet(instruction, [&] () { return doc::sumIfRange(stack[top - 1], rangeStart(instruction, origin), rangeEnd(instruction, origin), stack[top]); });
+        break;
+
+      case Program::Call:
+        top -= instruction.cell_.y_;
+        stack[top] = callFunction(instruction.cell_.x_, &stack[top], instruction.cell_.y_);
+        top++;
+        break;
+
+      case Program::Native:
+        top -= instruction.cell_.y_;
+        stack[top] = nativeFunctions_[instruction.cell_.x_].scalar_(&stack[top]);
+        top++;
+        break;
     }
   }
 
-  if (valueStack.size() != 1)
+  return stack[0];
+}
+
+bool isRowProgram(Program const& program)
+{
+  for (auto const& instruction : program.code_)
   {
-    logError("error while calculating expression '", exprToString(expression));
-    return 0.0;
+    if (instruction.op_ == Program::Sum || instruction.op_ == Program::Recall || instruction.op_ == Program::Call ||
+        instruction.op_ == Program::Match || instruction.op_ == Program::Lookup || instruction.op_ == Program::CountIf ||
+        instruction.op_ == Program::SumIf)
+      return false;
+
+    if (instruction.op_ == Program::Cell && (instruction.cell_.y_ != 0 || instruction.sheet_ != Expr::NO_SHEET))
+      return false;
   }
 
-  return valueStack.front().toDouble();
+  return !program.empty();
 }
 
+void evaluateRows(Program const& program, double const* const* columns, std::size_t count, double * out)
+{
+  if (jit::RowFunction function = jit::rowFunction(program, count))
+  {
+    function(columns, count, out);
+    return;
+  }
+
+  // Operands push one entry, functions of two values pop one and plugin functions all but
+  // one of their arguments
+  int depth = 0;
+  int maxDepth = 0;
+  for (auto const& instruction : program.code_)
+  {
+    if (instruction.op_ == Program::Constant || instruction.op_ == Program::Cell)
+      maxDepth = std::max(maxDepth, ++depth);
+    else if (instruction.op_ == Program::Native)
+      depth -= instruction.cell_.y_ - 1;
+    else if (instruction.op_ != Program::Abs && instruction.op_ != Program::Cos && instruction.op_ != Program::Sin &&
+             instruction.op_ != Program::Floor && instruction.op_ != Program::Ceil)
+      depth--;
+  }
+
+  // Row i of stack entry n is stack[n * count + i]
+  std::vector<double> stack(maxDepth * count);
+  int top = 0;
+
+  // Plugin functions write to scratch before their result replaces the arguments
+  std::vector<double> scratch;
+  std::vector<double const*> args;
+
+  for (auto const& instruction : program.code_)
+  {
+    // The top two entries, the operands of a function
+    double * a = top > 1 ? &stack[(top - 2) * count] : nullptr;
+    double * b = top > 0 ? &stack[(top - 1) * count] : nullptr;
+
+    switch (instruction.op_)
+    {
+      case Program::Constant:
+        std::fill_n(&stack[top++ * count], count, instruction.constant_);
+        break;
+
+      case Program::Cell:
+        std::copy_n(columns[instruction.cell_.x_], count, &stack[top++ * count]);
+        break;
+
+      case Program::Add:
+        for (std::size_t i = 0; i < count; ++i)
+          a[i] += b[i];
+        top--;
+        break;
+
+      case Program::Subtract:
+        for (std::size_t i = 0; i < count; ++i)
+          a[i] -= b[i];
+        top--;
+        break;
+
+      case Program::Multiply:
+        for (std::size_t i = 0; i < count; ++i)
+          a[i] *= b[i];
+        top--;
+        break;
+
+      case Program::Divide:
+        for (std::size_t i = 0; i < count; ++i)
+          a[i] = divide(a[i], b[i]);
+        top--;
+        break;
+
+      case Program::Min:
+        for (std::size_t i = 0; i < count; ++i)
+          a[i] = minimum(a[i], b[i]);
+        top--;
+        break;
+
+      case Program::Max:
+        for (std::size_t i = 0; i < count; ++i)
+          a[i] = maximum(a[i], b[i]);
+        top--;
+        break;
+
+      case Program::Abs:
+        for (std::size_t i = 0; i < count; ++i)
+          b[i] = std::abs(b[i]);
+        break;
+
+      case Program::Cos:
+        for (std::size_t i = 0; i < count; ++i)
+          b[i] = std::cos(b[i]);
+        break;
+
+      case Program::Sin:
+        for (std::size_t i = 0; i < count; ++i)
+          b[i] = std::sin(b[i]);
+        break;
+
+      case Program::Floor:
+        for (std::size_t i = 0; i < count; ++i)
+          b[i] = std::floor(b[i]);
+        break;
+
+      case Program::Ceil:
+        for (std::size_t i = 0; i < count; ++i)
+          b[i] = std::ceil(b[i]);
+        break;
+
+      case Program::Native:
+        {
+          NativeFunction const& function = nativeFunctions_[instruction.cell_.x_];
+          const int argCount = instruction.cell_.y_;
+          top -= argCount;
+
+          args.resize(argCount);
+          for (int arg = 0; arg < argCount; ++arg)
+            args[arg] = &stack[(top + arg) * count];
+
+          scratch.resize(count);
+          if (function.batch_)
+            function.batch_(args.data(), count, scratch.data());
+          else
+          {
+            double row[Program::MAX_STACK_SIZE];
+            for (std::size_t i = 0; i < count; ++i)
+            {
+              for (int arg = 0; arg < argCount; ++arg)
+                row[arg] = args[arg][i];
+
+              scratch[i] = function.scalar_(row);
+            }
+          }
+
+          std::copy(scratch.begin(), scratch.end(), &stack[top++ * count]);
+        }
+        break;
+
+      case Program::Sum:
+      case Program::Recall:
+      case Program::Match:
+      case Program::Lookup:
+      case Program::CountIf:
+      case Program::SumIf:
+      case Program::Call:
+        // isRowProgram() rules these out
+        assert(false);
+        break;
+    }
+  }
+
+  std::copy_n(&stack[0], count, out);
+}
 
 TCL_FUNC(calculate, "string ?string ...?", "Evaluates the given expression in the same way a cell that starts with = is evaluated")
 {
@@ -414,13 +1404,152 @@ TCL_FUNC(calculate, "string ?string ...?", "Evaluates the given expression in th
   for (uint32_t i = 1; i < argc; ++i)
     expressionString += Jim_String(argv[i]) + std::string(" ");
 
-  const std::vector<Expr> expr = parseExpression(expressionString);
+  const Program program = compileExpression(parseExpression(expressionString));
 
-  if (expr.empty())
+  if (program.empty())
     return JIM_ERR;
 
   doc::evaluateDocument();
-  const double result = evaluate(expr);
+  const double result = evaluate(program, Index(0, 0));
+
+  const FormulaError error = valueError(result);
+  if (error != FormulaError::None)
+    TCL_STRING_RESULT(errorText(error));
 
   TCL_DOUBLE_RESULT(result);
 }
+
+// Whether a function of op can be defined as name with argCount arguments. existing is
+// set to the definition it replaces, if there is one.
+static bool checkFunctionDefinition(std::string const& name, long argCount, Program::Op op, FuncDef const*& existing)
+{
+  // Digits would make the name read as a cell
+  const bool valid = !name.empty() && std::all_of(name.begin(), name.end(), [] (char ch) { return std::isupper((unsigned char)ch) || ch == '_'; });
+  if (!valid || !std::isupper((unsigned char)name[0]))
+  {
+    logError("function name '", name, "' has to be upper case letters and underscores");
+    return false;
+  }
+
+  if (argCount < 1 || argCount > Program::MAX_STACK_SIZE)
+  {
+    logError("function ", name, " has to take from 1 to ", (int)Program::MAX_STACK_SIZE, " arguments");
+    return false;
+  }
+
+  existing = findFunction(name);
+  if (existing && existing->op_ != op)
+  {
+    logError("function ", name, existing->op_ == Program::Call ? " is defined in Tcl" : existing->op_ == Program::Native ? " comes from a plugin" : " is built in");
+    return false;
+  }
+
+  if (existing && existing->argCount_ != argCount)
+  {
+    logError("function ", name, " is already defined with ", existing->argCount_, " arguments");
+    return false;
+  }
+
+  return true;
+}
+
+TCL_FUNC(function, "name argCount command", "Defines a formula function, like =NAME(A1, 2). A recalculation evaluates command once, with a list holding the list of arguments of every call, and command returns a list with the result of each call. Results are kept by their arguments until the function is defined again.")
+{
+  TCL_CHECK_ARG(4);
+  TCL_INT_ARG(2, argCount);
+
+  const std::string name = Jim_String(argv[1]);
+
+  FuncDef const* existing = nullptr;
+  if (!checkFunctionDefinition(name, argCount, Program::Call, existing))
+    return JIM_ERR;
+
+  if (!existing)
+  {
+    tclFunctions_.emplace_back(name, (int)argCount);
+    tclFunctions_.back().def_.function_ = tclFunctions_.size() - 1;
+    tclFunctions_.back().command_ = Jim_String(argv[3]);
+    return JIM_OK;
+  }
+
+  TclFunction & function = tclFunctions_[existing->function_];
+  function.command_ = Jim_String(argv[3]);
+
+  {
+    std::lock_guard<std::mutex> lock(tclFunctionMutex_);
+    function.results_.clear();
+    function.queued_.clear();
+  }
+
+  // Formulas calling the function show what it gives now
+  doc::evaluateDocument();
+  return JIM_OK;
+}
+
+// Names of the functions the plugin being loaded registered, functions can only be
+// registered while it initializes
+static std::vector<std::string> * registeredFunctions_ = nullptr;
+
+static int registerNativeFunction(void *, const ZumFunction * function)
+{
+  FuncDef const* existing = nullptr;
+  if (!registeredFunctions_ || !function || !function->scalar || !checkFunctionDefinition(function->name ? function->name : "", function->argCount, Program::Native, existing))
+    return 0;
+
+  if (!existing)
+  {
+    nativeFunctions_.emplace_back(function->name, function->argCount);
+    nativeFunctions_.back().def_.function_ = nativeFunctions_.size() - 1;
+  }
+
+  // A plugin loaded again replaces the entry points of its functions
+  NativeFunction & native = nativeFunctions_[existing ? existing->function_ : nativeFunctions_.size() - 1];
+  native.scalar_ = function->scalar;
+  native.batch_ = function->batch;
+
+  registeredFunctions_->push_back(native.name_);
+  return 1;
+}
+
+TCL_FUNC(plugin, "path", "Loads a shared library with formula functions, see ZumPlugin.h. Returns the names of the functions it registered.")
+{
+  TCL_CHECK_ARG(2);
+
+  const std::string path = Jim_String(argv[1]);
+
+  // Formulas may call the functions until the end, so the library is never closed
+  void * library = bx::dlopen(path.c_str());
+  if (!library)
+  {
+    logError("could not load plugin ", path);
+    return JIM_ERR;
+  }
+
+  ZumPluginInit init = reinterpret_cast<ZumPluginInit>(bx::dlsym(library, ZUM_PLUGIN_INIT_SYMBOL));
+  if (!init)
+  {
+    logError("plugin ", path, " has no ", ZUM_PLUGIN_INIT_SYMBOL);
+    return JIM_ERR;
+  }
+
+  std::vector<std::string> names;
+  registeredFunctions_ = &names;
+  const int ok = init(ZUM_PLUGIN_VERSION, registerNativeFunction, nullptr);
+  registeredFunctions_ = nullptr;
+
+  if (!ok)
+  {
+    logError("plugin ", path, " failed to initialize");
+    return JIM_ERR;
+  }
+
+  // Formulas calling functions the plugin replaced show what they give now
+  doc::evaluateDocument();
+
+  Jim_Obj * list = Jim_NewListObj(interp, nullptr, 0);
+  for (auto const& name : names)
+    Jim_ListAppendElement(interp, list, Jim_NewStringObj(interp, name.c_str(), name.size()));
+
+  Jim_SetResult(interp, list);
+  return JIM_OK;
+}
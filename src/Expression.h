@@ -2,8 +2,12 @@
 #pragma once
 
 #include "Index.h"
+#include "SmallVector.h"
+#include "Value.h"
 
 #include <string>
+#include <vector>
+#include <cstdint>
 
 struct FuncDef;
 
@@ -17,6 +21,9 @@ struct Expr
     Function,
   };
 
+  // The sheet_ of a reference to the document of the formula itself
+  static const int NO_SHEET = -1;
+
   Expr() { }
   Expr(double value) : type_(Type::Constant), constant_(value) { }
   Expr(const FuncDef * func) : type_(Function), func_(func) { }
@@ -24,10 +31,12 @@ struct Expr
   Expr(Index const& start, Index const& end) : type_(Range), startIndex_(start), endIndex_(end) { }
 
   std::string toStr() const;
-  double toDouble() const;
 
   Type type_ = Type::Constant;
 
+  // The buffer a Cell or a Range reads, as in ref!B2, see sheetName()
+  int sheet_ = NO_SHEET;
+
   union {
     double constant_;
     const FuncDef * func_;
@@ -37,62 +46,197 @@ struct Expr
   Index endIndex_;
 };
 
+// Names of the buffers references of formulas read, as in ref!B2, by the number they have
+// in Expr::sheet_. A name keeps its number once it was seen.
+int sheetId(std::string const& name);
+std::string sheetName(int sheet);
 
-std::vector<Expr> parseExpression(std::string const& source);
-double evaluate(std::vector<Expr> const& expr);
-std::string exprToString(std::vector<Expr> const& expr);
+// The number of name, NO_SHEET if no formula ever referenced it
+int findSheet(std::string const& name);
 
+// An expression packed into bytes, the type of every Expr followed by only the operands
+// it has. A constant or a reference takes 9 bytes instead of the 32 of an Expr, and
+// expressions of up to INLINE_SIZE bytes, like A1+1, need no allocation of their own. A
+// reference to another buffer has SHEET_FLAG set in its type and its sheet_ before the
+// operands. Equal expressions have equal bytes, so the bytes can be used as a key.
+class ExprCode
+{
+  public:
+    static const uint32_t INLINE_SIZE = 32;
+    static const uint8_t SHEET_FLAG = 0x80;
 
-namespace exp {
+    class const_iterator
+    {
+      public:
+        explicit const_iterator(const uint8_t * at) : at_(at) { }
 
-  class Expr
-  {
-    public:
-      virtual double evaluate() const = 0;
-  };
+        Expr operator * () const;
+        const_iterator & operator ++ ();
+        bool operator != (const_iterator const& other) const { return at_ != other.at_; }
 
-  class Constant : Expr
-  {
-    public:
-      double evaluate() const { return value_; }
+      private:
+        const uint8_t * at_;
+    };
 
-    private:
-      double value_ = 0.0;
-  };
+  public:
+    ExprCode() { }
+    explicit ExprCode(std::vector<Expr> const& expression);
 
-  class Cell : Expr
-  {
-    public:
-      virtual std::vector<Index> indices() const = 0;
-  };
+    bool empty() const { return bytes_.empty(); }
 
-  class CellRef : Cell
-  {
-    public:
-  };
+    const_iterator begin() const { return const_iterator(bytes_.begin()); }
+    const_iterator end() const { return const_iterator(bytes_.end()); }
+
+    void push_back(Expr const& expr);
 
-  class CellRange : Cell
+    // The expression unpacked
+    std::vector<Expr> decode() const;
+
+    // Adds offset to every reference, in place
+    void offset(Index const& offset);
+
+    std::string key() const { return std::string(reinterpret_cast<const char *>(bytes_.data()), bytes_.size()); }
+
+    // Bytes allocated for expressions too long to fit inside
+    std::size_t memoryUsage() const { return bytes_.memoryUsage(); }
+
+  private:
+    SmallVector<uint8_t, INLINE_SIZE> bytes_;
+};
+
+
+// The text an error shows as, empty for None
+std::string const& errorText(FormulaError error);
+
+// Compiled form of an expression. Operands are stored inline in the instructions
+// and evaluation runs on a fixed size stack of doubles. Constant subexpressions are
+// folded, and a range summed more than once in a formula is only summed once.
+struct Program
+{
+  static const int MAX_STACK_SIZE = 64;
+  static const int MAX_SLOTS = 16;
+  static const uint8_t NO_SLOT = 0xFF;
+
+  enum Op : uint8_t
   {
-    public:
+    Constant,
+    Cell,
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Sum,
+    Recall,
+    Min,
+    Max,
+    Abs,
+    Cos,
+    Sin,
+    Floor,
+    Ceil,
+    Match,
+    Lookup,
+    CountIf,
+    SumIf,
+    Call,
+    Native,
   };
 
-  class Function : Expr
+  struct Instruction
   {
-    public:
-      Function(std::vector<std::unique_ptr<Expr>> && args)
-        : arguments_(std::move(args))
-      { }
+    Op op_ = Constant;
 
-    private:
-      std::vector<std::unique_ptr<Expr>> arguments_;
-  };
+    // A Sum saves its result in slot_ for the Recall instructions that repeat it
+    uint8_t slot_ = NO_SLOT;
 
-  class BinaryOp : Expr
-  {
-    public:
+    // The buffer a Cell, Sum, Match, Lookup, CountIf or SumIf reads, see Expr::sheet_
+    int16_t sheet_ = Expr::NO_SHEET;
+
+    // A Cell that is the key of a lookup in the same buffer gives a text cell as its text,
+    // see value::fromText(). Elsewhere text reads as 0.
+    bool text_ = false;
+
+    // A Sum, Match, Lookup, CountIf or SumIf holds its range in cell_, the other arguments
+    // of the lookups come from the stack
+
+    // A Call or a Native takes its arguments from the stack, it calls Tcl or plugin
+    // function cell_.x_ with cell_.y_ of them
 
-    private:
-      std::unique_ptr<Expr> leftHandSide_;
-      std::unique_ptr<Expr> rightHandSide_;
+    union {
+      double constant_;
+      struct {
+        int x_;
+        int y_;
+        int endX_;
+        int endY_;
+      } cell_;
+    };
   };
-}
\ No newline at end of file
+
+  bool empty() const { return code_.empty(); }
+
+  // Programs of up to three instructions, like the one of A1+1, are kept inside
+  SmallVector<Instruction, 3> code_;
+
+  // Why an empty program couldn't be compiled, it evaluates to the error
+  FormulaError error_ = FormulaError::None;
+};
+
+
+std::vector<Expr> parseExpression(std::string const& source);
+std::string exprToString(std::vector<Expr> const& expr);
+
+// The text exprToString() gives an expression, with its references left out so it can
+// be written for any origin. refs_ holds where in text_ each reference goes.
+struct ExprText
+{
+  std::string text_;
+  std::vector<std::pair<std::size_t, Index>> refs_;
+
+  bool empty() const { return text_.empty() && refs_.empty(); }
+};
+
+ExprText exprText(std::vector<Expr> const& expression);
+
+// Appends the text of an expression with references relative to origin
+void writeExprText(ExprText const& text, Index const& origin, std::string & out);
+
+// Looks up a function or operator by name, returns nullptr if there is none
+const FuncDef * findFunction(const char * name, std::size_t length);
+const FuncDef * findFunction(std::string const& name);
+const char * functionName(const FuncDef * func);
+
+// Returns an empty program with the error if the expression can't be compiled
+Program compileExpression(std::vector<Expr> const& expr);
+
+// Adds offset to every reference in expression or program
+void offsetExpression(std::vector<Expr> & expression, Index const& offset);
+void offsetProgram(Program & program, Index const& offset);
+
+// References in program are relative to origin
+double evaluate(Program const& program, Index const& origin);
+
+// Whether every reference of program is a single cell in row 0 of its own document, and
+// it sums or looks up no ranges or calls Tcl functions. Such a program computes a row from the other columns of that row.
+bool isRowProgram(Program const& program);
+
+// Evaluates a row program for count rows at once, an instruction at a time over all of
+// them. columns[x] holds the values of column x for the rows, for every column program
+// references. The results go to out. Plugin functions are called with all rows at once.
+// Hot programs run compiled with doc_jit set, see Jit.h.
+void evaluateRows(Program const& program, double const* const* columns, std::size_t count, double * out);
+
+// Formula functions can be defined in Tcl, see the function command. Their results are
+// kept by their arguments. While calls are deferred, a call with arguments that have no
+// result yet gives NaN and is queued, and the evaluating thread is told it missed. The
+// queued calls of a function are then passed to one evaluation of its command, so a
+// recalculation costs one Tcl call per function instead of one per cell. Returns whether
+// calls were deferred before.
+bool deferFunctionCalls(bool defer);
+
+// Whether a call made on this thread since the last time was queued, clears the flag
+bool takeMissedCall();
+
+// Runs the queued calls from the main thread, on worker interpreters with
+// doc_parallelFunctions set. Returns false if there were none.
+bool runDeferredCalls();
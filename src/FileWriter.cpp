@@ -0,0 +1,101 @@
+
+#include "FileWriter.h"
+#include "bx/platform.h"
+
+#include <cstring>
+#include <algorithm>
+
+#if BX_PLATFORM_LINUX || BX_PLATFORM_OSX
+#include <unistd.h>
+#endif
+
+bool syncFile(FILE * file)
+{
+  if (fflush(file) != 0)
+    return false;
+
+#if BX_PLATFORM_LINUX || BX_PLATFORM_OSX
+  return fsync(fileno(file)) == 0;
+#else
+  return true;
+#endif
+}
+
+FileWriter::~FileWriter()
+{
+  close();
+}
+
+bool FileWriter::open(std::string const& filename)
+{
+  close();
+
+  file_ = fopen(filename.c_str(), "wb");
+  if (!file_)
+    return false;
+
+  buffer_.resize(BUFFER_SIZE);
+  used_ = 0;
+  failed_ = false;
+  return true;
+}
+
+bool FileWriter::close(bool sync)
+{
+  if (!file_)
+    return false;
+
+  flush();
+
+  if (sync && !failed_)
+    failed_ = !syncFile(file_);
+  failed_ |= fclose(file_) != 0;
+  file_ = nullptr;
+
+  return !failed_;
+}
+
+void FileWriter::flush()
+{
+  if (used_ > 0 && fwrite(buffer_.data(), 1, used_, file_) != used_)
+    failed_ = true;
+
+  used_ = 0;
+}
+
+void FileWriter::write(const char * data, std::size_t size)
+{
+  if (size == 0)
+    return;
+
+  if (used_ + size > buffer_.size())
+  {
+    flush();
+
+    // Too large to be worth copying, hand it to the file as is
+    if (size >= buffer_.size())
+    {
+      if (fwrite(data, 1, size, file_) != size)
+        failed_ = true;
+
+      return;
+    }
+  }
+
+  memcpy(buffer_.data() + used_, data, size);
+  used_ += size;
+}
+
+void FileWriter::put(char ch, std::size_t count)
+{
+  while (count > 0)
+  {
+    if (used_ == buffer_.size())
+      flush();
+
+    const std::size_t n = std::min(count, buffer_.size() - used_);
+    memset(buffer_.data() + used_, ch, n);
+    used_ += n;
+    count -= n;
+  }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Str.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Writes a file through one large buffer, so writing many small pieces costs a system
+// call per buffer instead of one per piece. Errors are remembered and reported by
+// close().
+class FileWriter
+{
+  public:
+    static const std::size_t BUFFER_SIZE = 1 << 20;
+
+  public:
+    FileWriter() { }
+    ~FileWriter();
+
+    FileWriter(FileWriter const&) = delete;
+    FileWriter & operator = (FileWriter const&) = delete;
+
+    bool open(std::string const& filename);
+
+    // Flushes and closes the file, returns false if anything could not be written. With
+    // sync set it only returns once the data is on disk.
+    bool close(bool sync = false);
+
+    void write(const char * data, std::size_t size);
+    void write(StrView text) { write(text.data(), text.size()); }
+    void write(std::string const& text) { write(text.data(), text.size()); }
+
+    void put(char ch)
+    {
+      if (used_ == buffer_.size())
+        flush();
+
+      buffer_[used_++] = ch;
+    }
+
+    void put(char ch, std::size_t count);
+
+  private:
+    void flush();
+
+  private:
+    FILE * file_ = nullptr;
+    std::vector<char> buffer_;
+    std::size_t used_ = 0;
+    bool failed_ = false;
+};
+
+// Flushes file and waits until the system has written it to disk
+bool syncFile(FILE * file);
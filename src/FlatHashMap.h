@@ -0,0 +1,306 @@
+#pragma once
+
+#include "MurmurHash.h"
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+// Open addressing hash map from packed 64 bit keys to T. Entries live in one array
+// probed linearly, so there is no heap node per entry and a lookup touches one or
+// two cache lines. Erasing shifts the following entries back instead of leaving
+// tombstones. Pointers to values are invalidated by insertions.
+template <typename T>
+class FlatHashMap
+{
+  public:
+    typedef std::pair<uint64_t, T> value_type;
+
+    class iterator
+    {
+      public:
+        iterator(FlatHashMap * map, std::size_t slot) : map_(map), slot_(slot) { skip(); }
+
+        value_type & operator * () const { return map_->slots_[slot_]; }
+        value_type * operator -> () const { return &map_->slots_[slot_]; }
+
+        iterator & operator ++ () { ++slot_; skip(); return *this; }
+        bool operator != (iterator const& other) const { return slot_ != other.slot_; }
+
+      private:
+        void skip() { while (slot_ < map_->used_.size() && !map_->used_[slot_]) ++slot_; }
+
+      private:
+        FlatHashMap * map_;
+        std::size_t slot_;
+    };
+
+    class const_iterator
+    {
+      public:
+        const_iterator(FlatHashMap const* map, std::size_t slot) : map_(map), slot_(slot) { skip(); }
+
+        value_type const& operator * () const { return map_->slots_[slot_]; }
+        value_type const* operator -> () const { return &map_->slots_[slot_]; }
+
+        const_iterator & operator ++ () { ++slot_; skip(); return *this; }
+        bool operator != (const_iterator const& other) const { return slot_ != other.slot_; }
+
+      private:
+        void skip() { while (slot_ < map_->used_.size() && !map_->used_[slot_]) ++slot_; }
+
+      private:
+        FlatHashMap const* map_;
+        std::size_t slot_;
+    };
+
+  public:
+    FlatHashMap() { }
+    FlatHashMap(FlatHashMap const& copy) = default;
+    FlatHashMap(FlatHashMap && other);
+
+    FlatHashMap & operator = (FlatHashMap const& copy) = default;
+    FlatHashMap & operator = (FlatHashMap && other);
+
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // Bytes of the slot arrays, not counting what the values own
+    std::size_t memoryUsage() const { return slots_.capacity() * sizeof(value_type) + used_.capacity(); }
+
+    void clear();
+    void reserve(std::size_t count);
+
+    // Returns the value of key or nullptr
+    T * find(uint64_t key);
+    T const* find(uint64_t key) const;
+
+    std::size_t count(uint64_t key) const { return find(key) ? 1 : 0; }
+
+    // Returns the value of key, default constructing it if it does not exist
+    T & operator [] (uint64_t key) { return *insert(key, T()).first; }
+
+    // Inserts value unless key exists, returns the value of key and whether it was inserted
+    std::pair<T *, bool> insert(uint64_t key, T && value);
+    std::pair<T *, bool> insert(uint64_t key, T const& value) { return insert(key, T(value)); }
+
+    // Returns the number of erased entries
+    std::size_t erase(uint64_t key);
+
+    // Keeps entries while the slot arrays and what the kept values own, bytes(value), fit
+    // in target bytes, and drops the rest. Which entries are kept is arbitrary.
+    template <typename Bytes>
+    void shrink(std::size_t target, Bytes bytes);
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, used_.size()); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, used_.size()); }
+
+  private:
+    static const std::size_t MIN_CAPACITY = 16;
+
+    std::size_t home(uint64_t key) const { return murmurMix64(key) & (used_.size() - 1); }
+    std::size_t findSlot(uint64_t key) const;
+    void rehash(std::size_t capacity);
+
+    // Capacity of the slot arrays once count entries are inserted
+    static std::size_t capacityFor(std::size_t count);
+
+  private:
+    std::vector<value_type> slots_;
+    std::vector<uint8_t> used_;
+    std::size_t size_ = 0;
+};
+
+// Set of packed 64 bit keys
+class FlatHashSet
+{
+  public:
+    typedef FlatHashMap<bool>::const_iterator const_iterator;
+
+  public:
+    std::size_t size() const { return map_.size(); }
+    bool empty() const { return map_.empty(); }
+    std::size_t memoryUsage() const { return map_.memoryUsage(); }
+
+    void clear() { map_.clear(); }
+    void reserve(std::size_t count) { map_.reserve(count); }
+
+    std::size_t count(uint64_t key) const { return map_.count(key); }
+
+    // Returns false if key already was in the set
+    bool insert(uint64_t key) { return map_.insert(key, true).second; }
+    std::size_t erase(uint64_t key) { return map_.erase(key); }
+
+    const_iterator begin() const { return map_.begin(); }
+    const_iterator end() const { return map_.end(); }
+
+  private:
+    FlatHashMap<bool> map_;
+};
+
+template <typename T>
+FlatHashMap<T>::FlatHashMap(FlatHashMap && other)
+  : slots_(std::move(other.slots_)),
+    used_(std::move(other.used_)),
+    size_(other.size_)
+{
+  other.clear();
+}
+
+template <typename T>
+FlatHashMap<T> & FlatHashMap<T>::operator = (FlatHashMap && other)
+{
+  slots_ = std::move(other.slots_);
+  used_ = std::move(other.used_);
+  size_ = other.size_;
+  other.clear();
+  return *this;
+}
+
+template <typename T>
+void FlatHashMap<T>::clear()
+{
+  slots_.clear();
+  used_.clear();
+  size_ = 0;
+}
+
+template <typename T>
+std::size_t FlatHashMap<T>::capacityFor(std::size_t count)
+{
+  std::size_t capacity = MIN_CAPACITY;
+  while (capacity * 3 < count * 4)
+    capacity *= 2;
+
+  return capacity;
+}
+
+template <typename T>
+void FlatHashMap<T>::reserve(std::size_t count)
+{
+  const std::size_t capacity = capacityFor(count);
+  if (capacity > used_.size())
+    rehash(capacity);
+}
+
+template <typename T>
+std::size_t FlatHashMap<T>::findSlot(uint64_t key) const
+{
+  if (size_ == 0)
+    return used_.size();
+
+  const std::size_t mask = used_.size() - 1;
+
+  for (std::size_t slot = home(key); used_[slot]; slot = (slot + 1) & mask)
+    if (slots_[slot].first == key)
+      return slot;
+
+  return used_.size();
+}
+
+template <typename T>
+T * FlatHashMap<T>::find(uint64_t key)
+{
+  const std::size_t slot = findSlot(key);
+  return slot < used_.size() ? &slots_[slot].second : nullptr;
+}
+
+template <typename T>
+T const* FlatHashMap<T>::find(uint64_t key) const
+{
+  const std::size_t slot = findSlot(key);
+  return slot < used_.size() ? &slots_[slot].second : nullptr;
+}
+
+template <typename T>
+std::pair<T *, bool> FlatHashMap<T>::insert(uint64_t key, T && value)
+{
+  // Keep the load below 3/4, probe sequences grow quickly beyond that
+  if ((size_ + 1) * 4 > used_.size() * 3)
+    rehash(used_.empty() ? MIN_CAPACITY : used_.size() * 2);
+
+  const std::size_t mask = used_.size() - 1;
+  std::size_t slot = home(key);
+
+  for (; used_[slot]; slot = (slot + 1) & mask)
+    if (slots_[slot].first == key)
+      return std::make_pair(&slots_[slot].second, false);
+
+  slots_[slot].first = key;
+  slots_[slot].second = std::move(value);
+  used_[slot] = 1;
+  size_++;
+
+  return std::make_pair(&slots_[slot].second, true);
+}
+
+template <typename T>
+std::size_t FlatHashMap<T>::erase(uint64_t key)
+{
+  std::size_t hole = findSlot(key);
+  if (hole == used_.size())
+    return 0;
+
+  const std::size_t mask = used_.size() - 1;
+
+  // Move back every following entry of the probe run that may no longer be reachable
+  // across the hole, an entry can fill it unless its home lies between hole and itself
+  for (std::size_t slot = (hole + 1) & mask; used_[slot]; slot = (slot + 1) & mask)
+  {
+    const std::size_t distance = (slot - home(slots_[slot].first)) & mask;
+    if (distance < ((slot - hole) & mask))
+      continue;
+
+    slots_[hole] = std::move(slots_[slot]);
+    hole = slot;
+  }
+
+  slots_[hole].second = T();
+  used_[hole] = 0;
+  size_--;
+
+  return 1;
+}
+
+template <typename T>
+void FlatHashMap<T>::rehash(std::size_t capacity)
+{
+  std::vector<value_type> slots(capacity);
+  std::vector<uint8_t> used(capacity, 0);
+
+  slots_.swap(slots);
+  used_.swap(used);
+  size_ = 0;
+
+  for (std::size_t i = 0; i < used.size(); ++i)
+    if (used[i])
+      insert(slots[i].first, std::move(slots[i].second));
+}
+
+template <typename T>
+template <typename Bytes>
+void FlatHashMap<T>::shrink(std::size_t target, Bytes bytes)
+{
+  // Erasing leaves the slot arrays as large as they were, the kept entries go to new ones
+  std::vector<value_type> kept;
+  std::size_t owned = 0;
+
+  for (auto & it : *this)
+  {
+    const std::size_t entry = bytes(it.second);
+    if (capacityFor(kept.size() + 1) * (sizeof(value_type) + 1) + owned + entry > target)
+      break;
+
+    owned += entry;
+    kept.push_back(std::move(it));
+  }
+
+  *this = FlatHashMap();
+  if (!kept.empty())
+    reserve(kept.size());
+
+  for (auto & it : kept)
+    insert(it.first, std::move(it.second));
+}
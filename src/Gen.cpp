@@ -0,0 +1,115 @@
+#include "Generator.h"
+#include "Document.h"
+#include "Tcl.h"
+#include "Log.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// Writes synthetic documents for performance tests, see Generator.h for what they hold:
+//
+//   zum_gen [--rows count] [--text columns] [--numbers columns] [--formula-columns columns]
+//           [--cardinality count] [--formulas density] [--chain depth] [--sum width]
+//           [--moving] [--key] [--header] [--seed seed] [--needle text] [--compression none|lz4] output
+//
+// The format follows the extension of output, .csv, .zum for ZUM1 or .zum2.
+
+static int usage()
+{
+  fprintf(stderr, "usage: zum_gen [--rows count] [--text columns] [--numbers columns] [--formula-columns columns]\n"
+                  "               [--cardinality count] [--formulas density] [--chain depth] [--sum width]\n"
+                  "               [--moving] [--key] [--header] [--seed seed] [--needle text] [--compression none|lz4] output.csv|.zum|.zum2\n");
+  return 1;
+}
+
+static bool endsWith(std::string const& str, std::string const& suffix)
+{
+  return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+int main(int argc, char * argv[])
+{
+  gen::Options options;
+  std::string compression = "lz4";
+  std::string output;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+
+    if (arg == "--header")
+      options.header = true;
+    else if (arg == "--moving")
+      options.movingSum = true;
+    else if (arg == "--key")
+      options.keyColumn = true;
+    else if (arg == "--rows" && hasValue)
+      options.rows = atoll(argv[++i]);
+    else if (arg == "--text" && hasValue)
+      options.textColumns = atoi(argv[++i]);
+    else if (arg == "--numbers" && hasValue)
+      options.numberColumns = atoi(argv[++i]);
+    else if (arg == "--formula-columns" && hasValue)
+      options.formulaColumns = atoi(argv[++i]);
+    else if (arg == "--cardinality" && hasValue)
+      options.cardinality = atoi(argv[++i]);
+    else if (arg == "--formulas" && hasValue)
+      options.formulaDensity = atof(argv[++i]);
+    else if (arg == "--chain" && hasValue)
+      options.chainDepth = atoi(argv[++i]);
+    else if (arg == "--sum" && hasValue)
+      options.sumWidth = atoi(argv[++i]);
+    else if (arg == "--seed" && hasValue)
+      options.seed = strtoull(argv[++i], nullptr, 10);
+    else if (arg == "--needle" && hasValue)
+      options.needle = argv[++i];
+    else if (arg == "--compression" && hasValue)
+      compression = argv[++i];
+    else if (output.empty() && arg.compare(0, 2, "--") != 0)
+      output = arg;
+    else
+      return usage();
+  }
+
+  if (output.empty() || options.rows < 0 || options.textColumns < 0 || options.numberColumns < 0 || options.formulaColumns < 0 || options.columns() == 0)
+    return usage();
+
+  const bool csv = endsWith(output, ".csv");
+  if (!csv && !endsWith(output, ".zum") && !endsWith(output, ".zum2"))
+    return usage();
+
+  // The other formats are saved from the loaded CSV file
+  const std::string csvFile = csv ? output : output + ".csv";
+  if (!gen::writeCsv(csvFile, options))
+  {
+    fprintf(stderr, "Could not write %s\n", csvFile.c_str());
+    return 1;
+  }
+
+  if (csv)
+    return 0;
+
+  setLogLevel(LogLevel::Error);
+  tcl::initialize();
+
+  tcl::evaluate("set doc_backgroundLoadSize 0; set doc_lazyEvaluation 0");
+  tcl::evaluate(std::string("set doc_saveFormat ") + (endsWith(output, ".zum2") ? "zum2" : "zum1"));
+  tcl::evaluate("set doc_saveCompression " + compression);
+
+  bool saved = doc::load(csvFile);
+  while (saved && doc::isLoading())
+    doc::updateLoading();
+
+  saved = saved && doc::save(output);
+  remove(csvFile.c_str());
+
+  if (!saved)
+    fprintf(stderr, "Could not write %s\n", output.c_str());
+
+  doc::shutdown();
+  tcl::shutdown();
+  return saved ? 0 : 1;
+}
@@ -0,0 +1,131 @@
+
+#include "Generator.h"
+#include "Index.h"
+
+#include <fstream>
+#include <algorithm>
+#include <vector>
+
+namespace gen {
+
+  // SplitMix64, small and the same everywhere
+  class Random
+  {
+    public:
+      explicit Random(uint64_t seed) : state_(seed) { }
+
+      uint64_t next()
+      {
+        uint64_t z = (state_ += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+      }
+
+      uint32_t below(uint32_t count) { return count > 0 ? (uint32_t)(next() % count) : 0; }
+
+      // From 0 up to but not including 1
+      double unit() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+    private:
+      uint64_t state_;
+  };
+
+  static std::string cellName(int x, long long y)
+  {
+    return Index::columnToStr(x) + std::to_string(y + 1);
+  }
+
+  bool writeCsv(std::string const& filename, Options const& options)
+  {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file)
+      return false;
+
+    Random random(options.seed);
+
+    const int columns = options.columns();
+    const int firstNumber = options.textColumns;
+    const int firstFormula = options.textColumns + options.numberColumns;
+    const long long firstRow = options.header ? 1 : 0;
+
+    // Formulas that end at the row above, per formula column
+    std::vector<int> chains(options.formulaColumns, 0);
+
+    std::string line;
+
+    if (options.header)
+    {
+      for (int x = 0; x < columns; ++x)
+        line.append(x > 0 ? "," : "").append(x < firstNumber ? "text" : (x < firstFormula ? "number" : "formula")).append(std::to_string(x + 1));
+
+      line.append(1, '\n');
+      file.write(line.data(), line.size());
+    }
+
+    for (long long row = 0; row < options.rows; ++row)
+    {
+      const long long y = row + firstRow;
+      line.clear();
+
+      for (int x = 0; x < columns; ++x)
+      {
+        if (x > 0)
+          line.append(1, ',');
+
+        if (x == 0 && options.keyColumn && firstNumber > 0)
+        {
+          line.append("row").append(std::to_string(row));
+          continue;
+        }
+
+        if (x < firstNumber)
+        {
+          line.append(1, 'v').append(std::to_string(random.below(options.cardinality)));
+          continue;
+        }
+
+        if (x < firstFormula)
+        {
+          line.append(std::to_string(random.below(options.cardinality)));
+          continue;
+        }
+
+        int & chain = chains[x - firstFormula];
+        if (random.unit() >= options.formulaDensity)
+        {
+          line.append(std::to_string(random.below(options.cardinality)));
+          chain = 0;
+          continue;
+        }
+
+        line.append(1, '=');
+
+        if (chain > 0 && chain < options.chainDepth)
+          line.append(cellName(x, y - 1));
+        else if (options.numberColumns > 0)
+          line.append(cellName(firstNumber, y));
+        else
+          line.append(std::to_string(random.below(options.cardinality)));
+
+        if (options.sumWidth > 0 && options.numberColumns > 0)
+        {
+          const long long first = options.movingSum ? y : firstRow;
+          line.append("+SUM(").append(cellName(firstNumber, first)).append(1, ':').append(cellName(firstNumber, first + options.sumWidth - 1)).append(1, ')');
+        }
+        else
+          line.append("+1");
+
+        chain = chain < options.chainDepth ? chain + 1 : 1;
+      }
+
+      if (row + 1 == options.rows && !options.needle.empty())
+        line = options.needle + line.substr(std::min(line.find(','), line.size()));
+
+      line.append(1, '\n');
+      file.write(line.data(), line.size());
+    }
+
+    return (bool)file;
+  }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+// Synthetic documents for performance tests. The same options and seed give the same file
+// on every machine, the values come from a generator of its own instead of the standard
+// library's distributions.
+//
+// The columns are, from the left, text, numbers and formulas. Cells of a formula column
+// that aren't formulas hold numbers. A formula adds one to the cell above it when that is
+// a formula too, until a chain of that many formulas is reached, otherwise to the number
+// column next to the text, or a random number when there is none. With a SUM width the
+// one added is a SUM over that many rows of that number column instead.
+namespace gen {
+
+  struct Options
+  {
+    long long rows = 100000;
+    int textColumns = 1;
+    int numberColumns = 8;
+    int formulaColumns = 1;
+
+    // Distinct values of a text or number column
+    int cardinality = 1000;
+
+    // The first text column holds a key unique to its row instead
+    bool keyColumn = false;
+
+    // Share of the cells in formula columns that are formulas, from 0 to 1
+    double formulaDensity = 0.0;
+
+    // Longest chain of formulas that reference the one above, 0 for none
+    int chainDepth = 0;
+
+    // Rows summed by every formula, 0 for none
+    int sumWidth = 0;
+
+    // The rows summed start at the row of the formula, like a moving sum filled down,
+    // instead of at the first row
+    bool movingSum = false;
+
+    bool header = false;
+    uint64_t seed = 1;
+
+    // Replaces the first cell of the last row, so a search has to read the whole table
+    std::string needle;
+
+    int columns() const { return textColumns + numberColumns + formulaColumns; }
+  };
+
+  // Writes the CSV file, returns false if it can't be written
+  bool writeCsv(std::string const& filename, Options const& options);
+}
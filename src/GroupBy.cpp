@@ -0,0 +1,152 @@
+#include "GroupBy.h"
+#include "FlatHashMap.h"
+#include "MurmurHash.h"
+#include "Scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace groupby {
+
+  // Rows aggregated by one task, fewer rows aren't worth the tables of another range
+  static const std::size_t RANGE_ROWS = 64 * 1024;
+
+  // The groups of one partition of a key range, slots_ maps a key to its group
+  struct Table
+  {
+    FlatHashMap<uint32_t> slots_;
+    std::vector<Group> groups_;
+    std::vector<Stats> stats_;
+  };
+
+  static inline std::size_t partitionOf(uint32_t key, int partitionBits)
+  {
+    return partitionBits == 0 ? 0 : murmurMix64(key) >> (64 - partitionBits);
+  }
+
+  static void aggregateRange(std::vector<uint32_t> const& keys, std::vector<std::vector<double>> const& columns,
+                             std::size_t first, std::size_t last, int partitionBits, std::vector<Table> & tables)
+  {
+    const std::size_t columnCount = columns.size();
+
+    // Every partition can't hold more than the range, nor is it likely to hold more than its share
+    for (auto & table : tables)
+      table.slots_.reserve((last - first) / tables.size() + 16);
+
+    for (std::size_t row = first; row < last; ++row)
+    {
+      const uint32_t key = keys[row];
+      Table & table = tables[partitionOf(key, partitionBits)];
+
+      uint32_t & slot = table.slots_[key];
+      if (slot == 0)
+      {
+        table.groups_.push_back({ key, (uint32_t)row, 0 });
+        table.stats_.resize(table.stats_.size() + columnCount);
+        slot = table.groups_.size();
+      }
+
+      Group & group = table.groups_[slot - 1];
+      group.rows_++;
+
+      Stats * stats = &table.stats_[(slot - 1) * columnCount];
+      for (std::size_t c = 0; c < columnCount; ++c)
+        stats[c].add(columns[c][row]);
+    }
+  }
+
+  // Merges partition of every range into the first range's, the ranges are in row order
+  static void mergePartition(std::vector<std::vector<Table>> & ranges, std::size_t partition, std::size_t columnCount)
+  {
+    Table & merged = ranges[0][partition];
+
+    for (std::size_t r = 1; r < ranges.size(); ++r)
+    {
+      Table & table = ranges[r][partition];
+
+      for (std::size_t g = 0; g < table.groups_.size(); ++g)
+      {
+        Group const& group = table.groups_[g];
+        Stats const* stats = &table.stats_[g * columnCount];
+
+        uint32_t & slot = merged.slots_[group.key_];
+        if (slot == 0)
+        {
+          merged.groups_.push_back(group);
+          merged.stats_.insert(merged.stats_.end(), stats, stats + columnCount);
+          slot = merged.groups_.size();
+          continue;
+        }
+
+        merged.groups_[slot - 1].rows_ += group.rows_;
+
+        Stats * target = &merged.stats_[(slot - 1) * columnCount];
+        for (std::size_t c = 0; c < columnCount; ++c)
+          target[c].merge(stats[c]);
+      }
+
+      table = Table();
+    }
+  }
+
+  Result aggregate(std::vector<uint32_t> const& keys, std::vector<std::vector<double>> const& columns)
+  {
+    const std::size_t columnCount = columns.size();
+    const std::size_t rangeCount = std::max<std::size_t>(1, std::min<std::size_t>(keys.size() / RANGE_ROWS, Scheduler::shared().threadCount()));
+
+    // As many partitions as ranges, rounded up to a power of two
+    int partitionBits = 0;
+    while (((std::size_t)1 << partitionBits) < rangeCount)
+      partitionBits++;
+
+    const std::size_t partitionCount = (std::size_t)1 << partitionBits;
+
+    std::vector<std::vector<Table>> ranges(rangeCount, std::vector<Table>(partitionCount));
+    std::vector<Scheduler::Task> tasks;
+
+    for (std::size_t r = 0; r < rangeCount; ++r)
+    {
+      const std::size_t first = keys.size() * r / rangeCount;
+      const std::size_t last = keys.size() * (r + 1) / rangeCount;
+
+      std::vector<Table> * tables = &ranges[r];
+      tasks.push_back([&keys, &columns, first, last, partitionBits, tables] () {
+        aggregateRange(keys, columns, first, last, partitionBits, *tables);
+      });
+    }
+
+    Scheduler::shared().run(tasks);
+    tasks.clear();
+
+    if (rangeCount > 1)
+    {
+      for (std::size_t p = 0; p < partitionCount; ++p)
+        tasks.push_back([&ranges, p, columnCount] () { mergePartition(ranges, p, columnCount); });
+
+      Scheduler::shared().run(tasks);
+    }
+
+    // Groups keep the first row of the earliest range they were seen in, which is their first row
+    std::vector<std::pair<uint32_t, uint64_t>> order;
+    for (std::size_t p = 0; p < partitionCount; ++p)
+      for (std::size_t g = 0; g < ranges[0][p].groups_.size(); ++g)
+        order.emplace_back(ranges[0][p].groups_[g].firstRow_, (uint64_t)p << 32 | g);
+
+    std::sort(order.begin(), order.end());
+
+    Result result;
+    result.groups_.reserve(order.size());
+    result.stats_.reserve(order.size() * columnCount);
+
+    for (auto const& it : order)
+    {
+      Table const& table = ranges[0][it.second >> 32];
+      const std::size_t g = it.second & 0xffffffff;
+
+      result.groups_.push_back(table.groups_[g]);
+      result.stats_.insert(result.stats_.end(), table.stats_.begin() + g * columnCount, table.stats_.begin() + (g + 1) * columnCount);
+    }
+
+    return result;
+  }
+}
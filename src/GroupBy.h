@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Reduce.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Hash aggregation of rows grouped on a key. The rows are given as typed arrays: a 32
+// bit key per row and a plain array of doubles per aggregated column, NaN where a row
+// has no number. The rows are split into ranges aggregated on the scheduler, every
+// range into its own pre-sized open addressing tables, one per partition of the key
+// hashes. The partitions are then merged in parallel, each key ends up in one of them.
+namespace groupby {
+
+  // What a group holds of one aggregated column
+  typedef reduce::Stats Stats;
+
+  struct Group
+  {
+    uint32_t key_;
+    uint32_t firstRow_;
+    uint32_t rows_;
+  };
+
+  struct Result
+  {
+    // In the order of their first row
+    std::vector<Group> groups_;
+
+    // columnCount stats for every group, group i starts at i * columnCount
+    std::vector<Stats> stats_;
+  };
+
+  // Groups row i of the arrays on keys[i]. Every array in columns holds a value for
+  // each key.
+  Result aggregate(std::vector<uint32_t> const& keys, std::vector<std::vector<double>> const& columns);
+}
@@ -0,0 +1,520 @@
+#include "Gzip.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace gzip {
+
+  enum Flags
+  {
+    FHCRC = 2,
+    FEXTRA = 4,
+    FNAME = 8,
+    FCOMMENT = 16,
+  };
+
+  static const uint8_t ID1 = 0x1f;
+  static const uint8_t ID2 = 0x8b;
+  static const uint8_t DEFLATE = 8;
+
+  // The fixed part of a member header, and of its extra field with the BGZF size
+  static const std::size_t HEADER_SIZE = 10;
+  static const std::size_t BGZF_HEADER_SIZE = 18;
+  static const std::size_t TRAILER_SIZE = 8;
+
+  static const int MAX_BITS = 15;
+  static const int TABLE_BITS = 10;
+  static const std::size_t WINDOW_SIZE = 32768;
+
+  // Once the window holds this much, all but its last WINDOW_SIZE bytes are dropped
+  static const std::size_t WINDOW_TRIM_SIZE = 1 << 20;
+
+  static const uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+  static const uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+  static const uint16_t DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+  static const uint8_t DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+  // The order the lengths of the code length code come in
+  static const uint8_t CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+  static uint32_t crc32(uint32_t crc, const char * data, std::size_t size)
+  {
+    static const struct Table
+    {
+      uint32_t entries[256];
+
+      Table()
+      {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+          uint32_t value = i;
+          for (int bit = 0; bit < 8; ++bit)
+            value = value & 1 ? 0xedb88320u ^ (value >> 1) : value >> 1;
+
+          entries[i] = value;
+        }
+      }
+    } table;
+
+    crc = ~crc;
+    for (std::size_t i = 0; i < size; ++i)
+      crc = table.entries[(crc ^ (uint8_t)data[i]) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+  }
+
+  // A canonical Huffman code. Codes of up to TABLE_BITS bits are looked up in the table,
+  // whose entries hold the symbol and the length of the code in the low 4 bits, longer
+  // ones are decoded a bit at a time from the counts.
+  struct Inflater::Huffman
+  {
+    uint16_t counts[MAX_BITS + 1];
+    uint16_t symbols[288];
+    uint16_t table[1 << TABLE_BITS];
+
+    // Returns false if the lengths don't make a code
+    bool build(const uint8_t * lengths, int size)
+    {
+      memset(counts, 0, sizeof(counts));
+      memset(table, 0, sizeof(table));
+
+      for (int i = 0; i < size; ++i)
+        counts[lengths[i]]++;
+      counts[0] = 0;
+
+      // Left over codes are fine, codes of one distance only are incomplete
+      int left = 1;
+      for (int length = 1; length <= MAX_BITS; ++length)
+      {
+        left = (left << 1) - counts[length];
+        if (left < 0)
+          return false;
+      }
+
+      uint16_t offsets[MAX_BITS + 2];
+      offsets[1] = 0;
+      for (int length = 1; length <= MAX_BITS; ++length)
+        offsets[length + 1] = offsets[length] + counts[length];
+
+      for (int i = 0; i < size; ++i)
+        if (lengths[i] != 0)
+          symbols[offsets[lengths[i]]++] = i;
+
+      // The bits of a code come first bit first, so the table is indexed by them reversed
+      int code = 0;
+      int index = 0;
+      for (int length = 1; length <= MAX_BITS; ++length, code <<= 1)
+      {
+        for (int i = 0; i < counts[length]; ++i, ++code)
+        {
+          const uint16_t symbol = symbols[index++];
+          if (length > TABLE_BITS)
+            continue;
+
+          int reversed = 0;
+          for (int bit = 0; bit < length; ++bit)
+            reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+
+          for (int entry = reversed; entry < (1 << TABLE_BITS); entry += 1 << length)
+            table[entry] = (symbol << 4) | length;
+        }
+      }
+
+      return true;
+    }
+  };
+
+  bool isGzip(StrView data)
+  {
+    return data.size() >= HEADER_SIZE && (uint8_t)data[0] == ID1 && (uint8_t)data[1] == ID2 && (uint8_t)data[2] == DEFLATE;
+  }
+
+  std::vector<StrView> members(StrView data)
+  {
+    std::vector<StrView> found;
+    const uint8_t * bytes = (const uint8_t *)data.data();
+
+    for (std::size_t pos = 0; pos < data.size(); )
+    {
+      const StrView rest = data.substr(pos);
+      if (rest.size() < BGZF_HEADER_SIZE || !isGzip(rest) || (bytes[pos + 3] & FEXTRA) == 0)
+        return std::vector<StrView>(1, data);
+
+      // The subfields of the extra field, BC holds the size of the member less one
+      const std::size_t extraSize = bytes[pos + 10] | (bytes[pos + 11] << 8);
+      std::size_t size = 0;
+
+      for (std::size_t field = 12; field + 4 <= 12 + extraSize && pos + field + 4 <= data.size(); )
+      {
+        const std::size_t fieldSize = bytes[pos + field + 2] | (bytes[pos + field + 3] << 8);
+        if (bytes[pos + field] == 'B' && bytes[pos + field + 1] == 'C' && fieldSize == 2 && pos + field + 6 <= data.size())
+          size = (bytes[pos + field + 4] | (bytes[pos + field + 5] << 8)) + 1;
+
+        field += 4 + fieldSize;
+      }
+
+      if (size < BGZF_HEADER_SIZE + TRAILER_SIZE || size > rest.size())
+        return std::vector<StrView>(1, data);
+
+      found.push_back(rest.substr(0, size));
+      pos += size;
+    }
+
+    return found;
+  }
+
+  uint32_t memberSize(StrView member)
+  {
+    if (member.size() < TRAILER_SIZE)
+      return 0;
+
+    const uint8_t * end = (const uint8_t *)member.data() + member.size();
+    return end[-4] | (end[-3] << 8) | (end[-2] << 16) | ((uint32_t)end[-1] << 24);
+  }
+
+  Inflater::Inflater(StrView data)
+    : in_((const uint8_t *)data.data()),
+      end_((const uint8_t *)data.data() + data.size())
+  { }
+
+  void Inflater::grow(std::size_t size)
+  {
+    if (used_ + size > window_.size())
+      window_.resize(std::max(std::max(window_.size() * 2, used_ + size), WINDOW_SIZE * 2));
+  }
+
+  int Inflater::decode(Huffman const& huffman)
+  {
+    need(MAX_BITS);
+
+    const uint16_t entry = huffman.table[bits_ & ((1 << TABLE_BITS) - 1)];
+    if (entry & 15)
+    {
+      bits_ >>= entry & 15;
+      count_ -= entry & 15;
+      return entry >> 4;
+    }
+
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int length = 1; length <= MAX_BITS; ++length)
+    {
+      code |= (int)((bits_ >> (length - 1)) & 1);
+
+      const int count = huffman.counts[length];
+      if (code - count < first)
+      {
+        bits_ >>= length;
+        count_ -= length;
+        return huffman.symbols[index + (code - first)];
+      }
+
+      index += count;
+      first = (first + count) << 1;
+      code <<= 1;
+    }
+
+    return -1;
+  }
+
+  bool Inflater::readHeader()
+  {
+    const uint32_t id1 = bits(8);
+    const uint32_t id2 = bits(8);
+    const uint32_t method = bits(8);
+    const uint32_t flags = bits(8);
+
+    if (id1 != ID1 || id2 != ID2 || method != DEFLATE)
+      return false;
+
+    // The time, extra flags and system
+    for (int i = 0; i < 6; ++i)
+      bits(8);
+
+    if (flags & FEXTRA)
+      for (uint32_t size = bits(16); size > 0; --size)
+        bits(8);
+
+    if (flags & FNAME)
+      while (bits(8) != 0 && overrun_ <= count_) { }
+
+    if (flags & FCOMMENT)
+      while (bits(8) != 0 && overrun_ <= count_) { }
+
+    if (flags & FHCRC)
+      bits(16);
+
+    used_ = 0;
+    crc_ = 0;
+    size_ = 0;
+    lastBlock_ = false;
+    return overrun_ <= count_;
+  }
+
+  bool Inflater::readTrailer()
+  {
+    bits(count_ % 8);
+
+    const uint32_t crc = bits(16) | (bits(16) << 16);
+    const uint32_t size = bits(16) | (bits(16) << 16);
+    return overrun_ <= count_ && crc == crc_ && size == size_;
+  }
+
+  bool Inflater::inflateStored()
+  {
+    bits(count_ % 8);
+
+    std::size_t size = bits(16);
+    const uint32_t complement = bits(16);
+    if (overrun_ > count_ || (size ^ 0xffff) != complement)
+      return false;
+
+    grow(size);
+
+    // Whole bytes that are still in the bit buffer come first
+    while (size > 0 && count_ >= 8 + overrun_)
+    {
+      window_[used_++] = (char)bits(8);
+      size--;
+    }
+
+    if (size > (std::size_t)(end_ - in_))
+      return false;
+
+    memcpy(window_.data() + used_, in_, size);
+    used_ += size;
+    in_ += size;
+    return true;
+  }
+
+  bool Inflater::readDynamicTables(Huffman & lengths, Huffman & distances)
+  {
+    const int lengthCount = bits(5) + 257;
+    const int distanceCount = bits(5) + 1;
+    const int codeLengthCount = bits(4) + 4;
+
+    if (lengthCount > 286 || distanceCount > 30)
+      return false;
+
+    uint8_t codeLengths[19] = { 0 };
+    for (int i = 0; i < codeLengthCount; ++i)
+      codeLengths[CODE_LENGTH_ORDER[i]] = bits(3);
+
+    Huffman codeLengthCode;
+    if (!codeLengthCode.build(codeLengths, 19))
+      return false;
+
+    // The lengths of both codes are one run, repeats may go from one into the other
+    uint8_t codes[286 + 30];
+    for (int i = 0; i < lengthCount + distanceCount; )
+    {
+      const int symbol = decode(codeLengthCode);
+      if (symbol < 0 || overrun_ > count_)
+        return false;
+
+      if (symbol < 16)
+      {
+        codes[i++] = symbol;
+        continue;
+      }
+
+      uint8_t value = 0;
+      int repeat;
+      if (symbol == 16)
+      {
+        if (i == 0)
+          return false;
+
+        value = codes[i - 1];
+        repeat = 3 + bits(2);
+      }
+      else if (symbol == 17)
+        repeat = 3 + bits(3);
+      else
+        repeat = 11 + bits(7);
+
+      if (i + repeat > lengthCount + distanceCount)
+        return false;
+
+      while (repeat-- > 0)
+        codes[i++] = value;
+    }
+
+    // A block without an end of block code could not end
+    if (codes[256] == 0)
+      return false;
+
+    return lengths.build(codes, lengthCount) && distances.build(codes + lengthCount, distanceCount);
+  }
+
+  bool Inflater::inflateCodes(Huffman const& lengths, Huffman const& distances)
+  {
+    for (;;)
+    {
+      int symbol = decode(lengths);
+      if (symbol < 0 || overrun_ > count_)
+        return false;
+
+      if (symbol < 256)
+      {
+        grow(1);
+        window_[used_++] = (char)symbol;
+        continue;
+      }
+
+      if (symbol == 256)
+        return true;
+
+      symbol -= 257;
+      if (symbol >= 29)
+        return false;
+
+      const std::size_t length = LENGTH_BASE[symbol] + bits(LENGTH_EXTRA[symbol]);
+
+      const int distanceSymbol = decode(distances);
+      if (distanceSymbol < 0 || distanceSymbol >= 30)
+        return false;
+
+      const std::size_t distance = DISTANCE_BASE[distanceSymbol] + bits(DISTANCE_EXTRA[distanceSymbol]);
+      if (distance > used_ || overrun_ > count_)
+        return false;
+
+      grow(length);
+
+      // Copies that overlap what they copy repeat it, which needs them to go a byte at a time
+      char * out = window_.data() + used_;
+      const char * from = out - distance;
+      if (distance >= length)
+        memcpy(out, from, length);
+      else
+        for (std::size_t i = 0; i < length; ++i)
+          out[i] = from[i];
+
+      used_ += length;
+    }
+  }
+
+  bool Inflater::inflateBlock()
+  {
+    static const struct Fixed
+    {
+      Huffman lengths;
+      Huffman distances;
+
+      Fixed()
+      {
+        uint8_t codes[288];
+        std::fill(codes, codes + 144, 8);
+        std::fill(codes + 144, codes + 256, 9);
+        std::fill(codes + 256, codes + 280, 7);
+        std::fill(codes + 280, codes + 288, 8);
+        lengths.build(codes, 288);
+
+        std::fill(codes, codes + 30, 5);
+        distances.build(codes, 30);
+      }
+    } fixed;
+
+    lastBlock_ = bits(1) != 0;
+
+    switch (bits(2))
+    {
+      case 0:
+        return inflateStored();
+
+      case 1:
+        return inflateCodes(fixed.lengths, fixed.distances);
+
+      case 2:
+      {
+        Huffman lengths;
+        Huffman distances;
+        return readDynamicTables(lengths, distances) && inflateCodes(lengths, distances);
+      }
+
+      default:
+        return false;
+    }
+  }
+
+  bool Inflater::inflate(std::string & out, std::size_t size)
+  {
+    std::size_t appended = 0;
+
+    while (appended < size && state_ != State::Done)
+    {
+      switch (state_)
+      {
+        // Members start on a byte, so the whole bytes left in the bit buffer can be read
+        // again. Whatever follows the last member that isn't one is left alone.
+        case State::Header:
+          in_ -= (count_ - overrun_) / 8;
+          bits_ = 0;
+          count_ = 0;
+          overrun_ = 0;
+
+          if (!isGzip(StrView((const char *)in_, end_ - in_)))
+          {
+            if (!started_)
+              return false;
+
+            state_ = State::Done;
+          }
+          else if (!readHeader())
+            return false;
+          else
+          {
+            started_ = true;
+            state_ = State::Blocks;
+          }
+          break;
+
+        case State::Blocks:
+        {
+          const std::size_t start = used_;
+          if (!inflateBlock() || overrun_ > count_)
+            return false;
+
+          const std::size_t produced = used_ - start;
+          crc_ = crc32(crc_, window_.data() + start, produced);
+          size_ += (uint32_t)produced;
+          out.append(window_.data() + start, produced);
+          appended += produced;
+
+          if (used_ > WINDOW_TRIM_SIZE)
+          {
+            memmove(window_.data(), window_.data() + used_ - WINDOW_SIZE, WINDOW_SIZE);
+            used_ = WINDOW_SIZE;
+          }
+
+          if (lastBlock_)
+            state_ = State::Trailer;
+          break;
+        }
+
+        case State::Trailer:
+          if (!readTrailer())
+            return false;
+
+          state_ = State::Header;
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    return true;
+  }
+
+  bool inflate(StrView data, std::string & out)
+  {
+    Inflater inflater(data);
+    while (!inflater.done())
+      if (!inflater.inflate(out, WINDOW_TRIM_SIZE))
+        return false;
+
+    return true;
+  }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "Str.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Decompression of gzip files: members of DEFLATE blocks, each checked against the
+// CRC-32 and size in its trailer. A file may hold several members one after the other,
+// which decompress to what they hold put together. BGZF files, which many tools write so
+// they can seek, record the size of every member in its header, so their members can be
+// found without decompressing them and be decompressed apart.
+namespace gzip {
+
+  // Whether data starts the way a gzip member does
+  bool isGzip(StrView data);
+
+  // The members of data if every one of them records its size, otherwise data as one
+  std::vector<StrView> members(StrView data);
+
+  // The size a member says it decompresses to, modulo 4 GB
+  uint32_t memberSize(StrView member);
+
+  // Decompresses the members of data a few blocks at a time
+  class Inflater
+  {
+    public:
+      explicit Inflater(StrView data);
+
+      // Appends the output of the blocks that come next to out until at least size bytes
+      // were appended or the data ends. Returns false if the data is corrupt.
+      bool inflate(std::string & out, std::size_t size);
+
+      bool done() const { return state_ == State::Done; }
+
+    private:
+      enum class State
+      {
+        Header,
+        Blocks,
+        Trailer,
+        Done,
+      };
+
+      struct Huffman;
+
+      bool readHeader();
+      bool readTrailer();
+      bool inflateBlock();
+      bool inflateStored();
+      bool inflateCodes(Huffman const& lengths, Huffman const& distances);
+      bool readDynamicTables(Huffman & lengths, Huffman & distances);
+
+      // The bit buffer, refilled a byte at a time. Past the end of the data it reads
+      // zeros and counts them as overrun.
+      void need(int bits)
+      {
+        while (count_ < bits)
+        {
+          if (in_ < end_)
+            bits_ |= (uint64_t)*in_++ << count_;
+          else
+            overrun_ += 8;
+
+          count_ += 8;
+        }
+      }
+
+      uint32_t bits(int count)
+      {
+        need(count);
+        const uint32_t value = (uint32_t)(bits_ & (((uint64_t)1 << count) - 1));
+        bits_ >>= count;
+        count_ -= count;
+        return value;
+      }
+
+      int decode(Huffman const& huffman);
+
+      void grow(std::size_t size);
+
+    private:
+      const uint8_t * in_;
+      const uint8_t * end_;
+      uint64_t bits_ = 0;
+      int count_ = 0;
+      int overrun_ = 0;
+
+      State state_ = State::Header;
+      bool started_ = false;
+      bool lastBlock_ = false;
+
+      // What the member decompressed to so far, of which at least the last 32 KB are kept
+      // for the back references
+      std::vector<char> window_;
+      std::size_t used_ = 0;
+
+      uint32_t crc_ = 0;
+      uint32_t size_ = 0;
+  };
+
+  // Decompresses all members of data, appending them to out. Returns false if data is corrupt.
+  bool inflate(StrView data, std::string & out);
+}
@@ -0,0 +1,106 @@
+#include "HiddenRows.h"
+#include "DocumentState.h"
+#include "Document.h"
+#include "Tcl.h"
+
+#include <algorithm>
+
+namespace doc {
+
+  bool hasHiddenRows()
+  {
+    return !currentBuffer().hidden_.empty();
+  }
+
+  bool isRowHidden(int row)
+  {
+    return currentBuffer().hidden_.hidden(row);
+  }
+
+  int visibleIndex(int row)
+  {
+    return currentBuffer().hidden_.visibleBefore(row);
+  }
+
+  int visibleRow(int index)
+  {
+    return currentBuffer().hidden_.visibleRow(index);
+  }
+
+  // Moves the cursor of the current buffer off a hidden row, to the next row shown or
+  // else the last one
+  static void showCursorRow()
+  {
+    RowVisibility const& hidden = currentBuffer().hidden_;
+    int & row = currentBuffer().cursorPos_.y;
+    if (!hidden.hidden(row))
+      return;
+
+    const int index = hidden.visibleBefore(row);
+    const int next = hidden.visibleRow(index);
+    row = next < getRowCount() || index == 0 ? next : hidden.visibleRow(index - 1);
+  }
+
+  long long hideUnselected(std::vector<int> const& selection, int first)
+  {
+    // A walk along the rows and the selection finds the rows left out
+    RowVisibility & hidden = currentBuffer().hidden_;
+    std::vector<int> rows;
+    long long shown = 0;
+    std::size_t next = 0;
+
+    for (int y = first; y < getRowCount(); ++y)
+    {
+      if (next < selection.size() && selection[next] == documentRow(y))
+      {
+        next++;
+        shown += !hidden.hidden(y);
+      }
+      else
+        rows.push_back(y);
+    }
+
+    hidden.hide(rows);
+    showCursorRow();
+    return shown;
+  }
+
+  TCL_FUNC(hide, "?first? ?last?", "Hides rows first to last of the current buffer, or row first, or the selected rows. Hidden rows keep their numbers and take edits, navigating, scrolling and drawing pass over them. Returns the rows hidden in the buffer.")
+  {
+    TCL_CHECK_ARGS(1, 3);
+    TCL_INT_ARG(1, first);
+    TCL_INT_ARG(2, last);
+
+    if (argc == 1)
+    {
+      const IndexRange rows = selectedRows();
+      first = rows.first.y;
+      last = rows.last.y;
+    }
+    else if (argc == 2)
+      last = first;
+
+    RowVisibility & hidden = currentBuffer().hidden_;
+    hidden.set(first, std::min<long>(last, getRowCount() - 1), true);
+    showCursorRow();
+
+    Jim_SetResult(interp, Jim_NewIntObj(interp, hidden.hiddenCount()));
+    return JIM_OK;
+  }
+
+  TCL_FUNC(unhide, "?first? ?last?", "Shows the hidden rows first to last of the current buffer, or row first, or all of them. Returns the rows still hidden.")
+  {
+    TCL_CHECK_ARGS(1, 3);
+    TCL_INT_ARG(1, first);
+    TCL_INT_ARG(2, last);
+
+    RowVisibility & hidden = currentBuffer().hidden_;
+    if (argc == 1)
+      hidden.clear();
+    else
+      hidden.set(first, argc == 2 ? first : last, false);
+
+    Jim_SetResult(interp, Jim_NewIntObj(interp, hidden.hiddenCount()));
+    return JIM_OK;
+  }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <vector>
+
+// Rows of a buffer hidden in place, by hide, unhide and filter -inplace. They keep their
+// row numbers and take edits, navigating, scrolling and drawing pass over them. The
+// buffer keeps them in a RowVisibility, see RowVisibility.h.
+namespace doc {
+
+  // visibleIndex() counts the rows of the current buffer shown before row, visibleRow()
+  // returns the row shown at such an index. Both are O(log n), and row itself without
+  // hidden rows.
+  bool hasHiddenRows();
+  bool isRowHidden(int row);
+  int visibleIndex(int row);
+  int visibleRow(int index);
+
+  // Hides the rows of the current buffer from first on that show none of the document
+  // rows of selection, which is in the order of the rows of the buffer. The rows hidden
+  // before stay hidden. Returns the rows of selection that are shown.
+  long long hideUnselected(std::vector<int> const& selection, int first);
+}
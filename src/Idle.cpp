@@ -0,0 +1,119 @@
+#include "Idle.h"
+#include "Tcl.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+
+namespace idle {
+
+  static const tcl::Variable IDLE_DELAY("app_idleDelay", 250);
+
+  typedef std::chrono::steady_clock Clock;
+
+  struct Entry
+  {
+    std::string name_;
+    Task task_;
+  };
+
+  static std::deque<Entry> queue_;
+  static Clock::time_point lastEvent_;
+
+  void post(std::string const& name, Task task)
+  {
+    if (!name.empty())
+      for (auto & entry : queue_)
+        if (entry.name_ == name)
+        {
+          entry.task_ = std::move(task);
+          return;
+        }
+
+    queue_.push_back({ name, std::move(task) });
+  }
+
+  void cancel(std::string const& name)
+  {
+    for (auto it = queue_.begin(); it != queue_.end(); ++it)
+      if (it->name_ == name)
+      {
+        queue_.erase(it);
+        return;
+      }
+  }
+
+  bool pending()
+  {
+    return !queue_.empty();
+  }
+
+  std::size_t size()
+  {
+    return queue_.size();
+  }
+
+  int wait()
+  {
+    if (queue_.empty())
+      return -1;
+
+    const long long waited = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - lastEvent_).count();
+    return (int)std::max(IDLE_DELAY.toInt() - waited, 0LL);
+  }
+
+  void interrupt()
+  {
+    lastEvent_ = Clock::now();
+  }
+
+  bool step()
+  {
+    if (queue_.empty())
+      return false;
+
+    // The task may post others, it is taken off the queue while it runs
+    Entry entry = std::move(queue_.front());
+    queue_.pop_front();
+
+    if (!entry.task_())
+      return true;
+
+    // Unless a task of the same name was posted meanwhile
+    if (!entry.name_.empty())
+      for (auto const& queued : queue_)
+        if (queued.name_ == entry.name_)
+          return true;
+
+    queue_.push_back(std::move(entry));
+    return false;
+  }
+}
+
+namespace tcl {
+  TCL_FUNC(whenIdle, "?name? script", "Run script once there are no events to handle. A named script replaces a queued one of the same name.")
+  {
+    TCL_CHECK_ARGS(2, 3);
+    TCL_STRING_ARG(1, first);
+    TCL_STRING_ARG(2, second);
+
+    const std::string name = argc == 3 ? first : std::string();
+    const std::string script = argc == 3 ? second : first;
+
+    idle::post(name, [script] () {
+      tcl::evaluate(script);
+      return false;
+    });
+
+    return JIM_OK;
+  }
+
+  TCL_FUNC(cancelIdle, "name", "Drop the queued whenIdle script of that name")
+  {
+    TCL_CHECK_ARG(2);
+    TCL_STRING_ARG(1, name);
+
+    idle::cancel(name);
+    return JIM_OK;
+  }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+// Work the main loop does while it waits for events, like building indexes ahead of the
+// filters that read them. It starts once no event came for app_idleDelay milliseconds.
+// A task runs a step at a time and the loop looks for events between steps, so an event
+// never waits for more than a step and the queue goes on once the loop is idle again. A
+// step should take a few milliseconds at most. Tasks that aren't done go behind the
+// others, so long ones take turns. Main thread only.
+namespace idle {
+
+  // Does a step of a task, returns true while the task has more to do
+  typedef std::function<bool()> Task;
+
+  // Queues task behind the others. A task with a name replaces a queued one of that
+  // name, and keeps its place in the queue.
+  void post(std::string const& name, Task task);
+
+  // Drops the queued task of that name
+  void cancel(std::string const& name);
+
+  bool pending();
+  std::size_t size();
+
+  // Milliseconds until a step may run, -1 while the queue is empty
+  int wait();
+
+  // Called for every event, which puts off the next step by app_idleDelay again
+  void interrupt();
+
+  // Runs a step of the task at the front of the queue. Returns true if that task is done.
+  bool step();
+}
@@ -2,9 +2,12 @@
 #include "Index.h"
 #include "Tcl.h"
 #include "Document.h"
+#include "Log.h"
 
 #include <cmath>
 #include <cctype>
+#include <cstring>
+#include <algorithm>
 
 std::string Index::rowToStr(int row)
 {
@@ -13,41 +16,29 @@ std::string Index::rowToStr(int row)
 
 std::string Index::columnToStr(int col)
 {
-  int power = 0;
-  for (int i = 0; i < 10; ++i)
-  {
-    const int value = std::pow(26, i);
-    if (value > col)
-    {
-      power = i;
-      break;
-    }
-  }
+  char name[MAX_NAME_LENGTH];
+  return std::string(name, formatColumn(col, name));
+}
 
-  std::string result;
-  while (power >= 0)
-  {
-    const int value = std::pow(26, power);
-    if (value > col)
-    {
-      power--;
+// Columns are numbers in base 26 with the digits A to Z, the inverse of strToColumn()
+std::size_t Index::formatColumn(int col, char * out)
+{
+  char digits[8];
+  std::size_t count = 0;
 
-      if (power < 0)
-        result.append(1, 'A');
-    }
-    else
-    {
-      const int division = col / value;
-      const int remainder = col % value;
+  col = std::max(col, 0);
 
-      result.append(1, 'A' + division);
+  do
+  {
+    digits[count++] = 'A' + col % 26;
+    col /= 26;
+  } while (col > 0);
 
-      col = remainder;
-      power--;
-    }
-  }
+  std::size_t length = 0;
+  while (count > 0)
+    out[length++] = digits[--count];
 
-  return result;
+  return length;
 }
 
 int Index::strToColumn(std::string const& str)
@@ -77,25 +68,34 @@ int Index::strToColumn(std::string const& str)
 
 std::string Index::toStr() const
 {
-  return columnToStr(x) + rowToStr(y);
+  char name[MAX_NAME_LENGTH];
+  return std::string(name, format(name));
+}
+
+std::size_t Index::format(char * out) const
+{
+  const std::size_t length = formatColumn(x, out);
+  return length + str::formatInt((long long)y + 1, out + length);
 }
 
 Index Index::fromStr(std::string const& str)
 {
-  Index idx(0, 0);
+  return fromStr(str.data(), str.size());
+}
 
-  if (str.empty())
-    return idx;
+Index Index::fromStr(const char * str, std::size_t length)
+{
+  Index idx(0, 0);
 
-  int i = 0;
-  while ((i < str.size()) && std::isupper(str[i]))
+  std::size_t i = 0;
+  while ((i < length) && std::isupper(str[i]))
   {
     idx.x *= 26;
     idx.x += str[i] - 'A';
     i++;
   }
 
-  while ((i < str.size()) && std::isdigit(str[i]))
+  while ((i < length) && std::isdigit(str[i]))
   {
     idx.y *= 10;
     idx.y += str[i] - '0';
@@ -110,6 +110,55 @@ Index Index::fromStr(std::string const& str)
 
 
 namespace tcl {
+
+  // The index is kept packed in wideValue, see Index::key()
+  static void updateIndexString(Jim_Obj * obj)
+  {
+    char name[Index::MAX_NAME_LENGTH];
+    const std::size_t length = Index::fromKey(obj->internalRep.wideValue).format(name);
+
+    obj->bytes = (char *)Jim_Alloc(length + 1);
+    memcpy(obj->bytes, name, length);
+    obj->bytes[length] = 0;
+    obj->length = length;
+  }
+
+  static const Jim_ObjType indexObjType = { "index", nullptr, nullptr, updateIndexString, JIM_TYPE_NONE };
+
+  Index getIndex(Jim_Interp * interp, Jim_Obj * obj)
+  {
+    if (obj->typePtr != &indexObjType)
+    {
+      int length = 0;
+      const char * str = Jim_GetString(obj, &length);
+      const Index idx = Index::fromStr(str, length);
+
+      Jim_FreeIntRep(interp, obj);
+      obj->typePtr = &indexObjType;
+      obj->internalRep.wideValue = idx.key();
+      return idx;
+    }
+
+    return Index::fromKey(obj->internalRep.wideValue);
+  }
+
+  Jim_Obj * newIndexObj(Jim_Interp * interp, Index const& idx)
+  {
+    Jim_Obj * obj = Jim_NewObj(interp);
+    obj->typePtr = &indexObjType;
+    obj->bytes = nullptr;
+    obj->internalRep.wideValue = idx.key();
+    return obj;
+  }
+
+  int getColumn(Jim_Interp * interp, Jim_Obj * obj)
+  {
+    if (obj->typePtr == &indexObjType)
+      return getIndex(interp, obj).x;
+
+    return Index::strToColumn(Jim_String(obj));
+  }
+
   TCL_SUBFUNC(index, "new",     "column row", "Construct a new index",
                      "row",     "index",      "Returns the row in the supplied index",
                      "column",  "index",      "Returns the column in the supplied index")
@@ -123,28 +172,86 @@ namespace tcl {
           TCL_CHECK_ARG_DESC(2, "column row");
           TCL_INT_ARG(0, column);
           TCL_INT_ARG(1, row);
-          TCL_STRING_RESULT(Index(column, row).toStr());
+          TCL_INDEX_RESULT(Index(column, row));
         }
         break;
 
       case CMD_ROW:
         {
           TCL_CHECK_ARG_DESC(1, "index");
-          TCL_STRING_ARG(0, index);
-          TCL_INT_RESULT(Index::fromStr(index).y);
+          TCL_INDEX_ARG(0, index);
+          TCL_INT_RESULT(index.y);
         }
         break;
 
       case CMD_COLUMN:
         {
           TCL_CHECK_ARG_DESC(1, "index");
-          TCL_STRING_ARG(0, index);
-          TCL_INT_RESULT(Index::fromStr(index).x);
+          TCL_INDEX_ARG(0, index);
+          TCL_INT_RESULT(index.x);
         }
         break;
     }
 
     return JIM_OK;
   }
-}
 
+  TCL_FUNC(forrange, "var range body", "Evaluates body for every cell of range, the first and the last cell of a rectangle, with var set to the index of the cell. Rows are visited in order, the cells of a row from left to right.")
+  {
+    TCL_CHECK_ARG(4);
+
+    const int count = Jim_ListLength(interp, argv[2]);
+    if (count < 1 || count > 2)
+    {
+      logError("forrange range must be a list of one or two indexes");
+      return JIM_ERR;
+    }
+
+    const Index first = getIndex(interp, Jim_ListGetIndex(interp, argv[2], 0));
+    const Index last = getIndex(interp, Jim_ListGetIndex(interp, argv[2], count - 1));
+
+    // The same object is reused while only var holds it besides this, the body makes
+    // its string if it asks for one
+    Jim_Obj * idxObj = nullptr;
+    int retcode = JIM_OK;
+
+    for (int y = std::min(first.y, last.y); y <= std::max(first.y, last.y) && retcode == JIM_OK; ++y)
+      for (int x = std::min(first.x, last.x); x <= std::max(first.x, last.x); ++x)
+      {
+        if (idxObj && idxObj->refCount <= 2)
+        {
+          Jim_InvalidateStringRep(idxObj);
+          idxObj->internalRep.wideValue = Index(x, y).key();
+        }
+        else
+        {
+          if (idxObj)
+            Jim_DecrRefCount(interp, idxObj);
+
+          idxObj = newIndexObj(interp, Index(x, y));
+          Jim_IncrRefCount(idxObj);
+        }
+
+        retcode = Jim_SetVariable(interp, argv[1], idxObj);
+        if (retcode == JIM_OK)
+          retcode = Jim_EvalObj(interp, argv[3]);
+
+        if (retcode == JIM_CONTINUE)
+          retcode = JIM_OK;
+
+        if (retcode != JIM_OK)
+          break;
+      }
+
+    if (idxObj)
+      Jim_DecrRefCount(interp, idxObj);
+
+    if (retcode == JIM_BREAK)
+      retcode = JIM_OK;
+
+    if (retcode == JIM_OK)
+      Jim_SetEmptyResult(interp);
+
+    return retcode;
+  }
+}
@@ -1,8 +1,10 @@
 
 #pragma once
 
+#include <algorithm>
 #include <functional>
 #include "Str.h"
+#include "MurmurHash.h"
 
 class Index
 {
@@ -15,9 +17,20 @@ class Index
       return x == other.x && y == other.y;
     }
 
+    // Packs the index into 64 bits for hashing, row in the high and column in the low half
+    uint64_t key() const { return ((uint64_t)(uint32_t)y << 32) | (uint32_t)x; }
+    static Index fromKey(uint64_t key) { return Index((int)(uint32_t)key, (int)(key >> 32)); }
+
     std::string toStr() const;
 
+    // Writes toStr() to out, which has to hold MAX_NAME_LENGTH chars, and returns the length
+    std::size_t format(char * out) const;
+    static std::size_t formatColumn(int col, char * out);
+
+    static const std::size_t MAX_NAME_LENGTH = 20;
+
     static Index fromStr(std::string const& str);
+    static Index fromStr(const char * str, std::size_t length);
 
     static std::string rowToStr(int row);
     static std::string columnToStr(int col);
@@ -29,6 +42,74 @@ class Index
     int y = -1;
 };
 
+// The cells of a rectangle from first to last, both corners included, visited row by row
+class IndexRange
+{
+  public:
+    class iterator
+    {
+      public:
+        iterator(Index const& idx, int firstColumn, int lastColumn) : idx_(idx), firstColumn_(firstColumn), lastColumn_(lastColumn) { }
+
+        Index const& operator * () const { return idx_; }
+        Index const* operator -> () const { return &idx_; }
+
+        iterator & operator ++ ()
+        {
+          if (++idx_.x > lastColumn_)
+          {
+            idx_.x = firstColumn_;
+            ++idx_.y;
+          }
+
+          return *this;
+        }
+
+        bool operator == (iterator const& other) const { return idx_ == other.idx_; }
+        bool operator != (iterator const& other) const { return !(idx_ == other.idx_); }
+
+      private:
+        Index idx_;
+        int firstColumn_;
+        int lastColumn_;
+    };
+
+  public:
+    IndexRange() : first(0, 0), last(-1, -1) { }
+
+    // The corners may be given in any order
+    IndexRange(Index const& a, Index const& b) :
+      first(std::min(a.x, b.x), std::min(a.y, b.y)),
+      last(std::max(a.x, b.x), std::max(a.y, b.y))
+    { }
+
+    bool empty() const { return last.x < first.x || last.y < first.y; }
+    int width() const { return empty() ? 0 : last.x - first.x + 1; }
+    int height() const { return empty() ? 0 : last.y - first.y + 1; }
+    long long size() const { return (long long)width() * height(); }
+
+    bool contains(Index const& idx) const
+    {
+      return idx.x >= first.x && idx.x <= last.x && idx.y >= first.y && idx.y <= last.y;
+    }
+
+    // The part of the range inside the columns and rows from 0 up to width and height
+    IndexRange clip(int width, int height) const
+    {
+      IndexRange range;
+      range.first = Index(std::max(first.x, 0), std::max(first.y, 0));
+      range.last = Index(std::min(last.x, width - 1), std::min(last.y, height - 1));
+      return range;
+    }
+
+    iterator begin() const { return empty() ? end() : iterator(first, first.x, last.x); }
+    iterator end() const { return iterator(Index(first.x, empty() ? first.y : last.y + 1), first.x, last.x); }
+
+  public:
+    Index first;
+    Index last;
+};
+
 namespace std
 {
   template<>
@@ -39,9 +120,7 @@ namespace std
 
     result_type operator()(argument_type const& s) const
     {
-      result_type const h1(std::hash<int>()(s.x));
-      result_type const h2(std::hash<int>()(s.y));
-      return h1 ^ (h2 << 1);
+      return murmurMix64(s.key());
     }
   };
 }
@@ -0,0 +1,46 @@
+#include "InputStream.h"
+#include "bx/platform.h"
+
+#include <cstdio>
+
+#if BX_PLATFORM_LINUX || BX_PLATFORM_OSX
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#elif BX_PLATFORM_WINDOWS
+#include <io.h>
+#endif
+
+InputStream::Result InputStream::read(std::string & buffer, int timeout)
+{
+  const std::size_t size = buffer.size();
+
+#if BX_PLATFORM_LINUX || BX_PLATFORM_OSX
+  struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+
+  const int ready = poll(&input, 1, timeout);
+  if (ready < 0)
+    return errno == EINTR ? Timeout : End;
+
+  if (ready == 0)
+    return Timeout;
+
+  buffer.resize(size + READ_SIZE);
+  const ssize_t count = ::read(STDIN_FILENO, &buffer[size], READ_SIZE);
+  buffer.resize(size + (count > 0 ? count : 0));
+
+  if (count < 0)
+    return errno == EINTR || errno == EAGAIN ? Timeout : End;
+#elif BX_PLATFORM_WINDOWS
+  // _read() of a pipe returns what the producer wrote so far instead of waiting for all of it
+  buffer.resize(size + READ_SIZE);
+  const int count = _read(0, &buffer[size], READ_SIZE);
+  buffer.resize(size + (count > 0 ? count : 0));
+#else
+  buffer.resize(size + READ_SIZE);
+  const std::size_t count = fread(&buffer[size], 1, READ_SIZE, stdin);
+  buffer.resize(size + count);
+#endif
+
+  return count > 0 ? Data : End;
+}
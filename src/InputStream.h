@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+
+// Reads standard input, which may be a pipe that can't seek. Where the platform can
+// poll, a read waits a limited time for data, so a reader thread can still notice it
+// should stop while the producer is quiet. Elsewhere a read blocks until data arrives.
+class InputStream
+{
+  public:
+    enum Result
+    {
+      Data,
+      Timeout,
+      End,
+    };
+
+    // Bytes read at most per call of read()
+    static const std::size_t READ_SIZE = 1 << 20;
+
+  public:
+    // Appends what is available to buffer, waiting at most timeout milliseconds
+    Result read(std::string & buffer, int timeout);
+};
@@ -0,0 +1,421 @@
+#include "Jit.h"
+#include "Tcl.h"
+#include "Value.h"
+
+#include "bx/platform.h"
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if BX_CPU_X86 && BX_ARCH_64BIT && (BX_PLATFORM_LINUX || BX_PLATFORM_OSX)
+#define JIT_X86_64 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define JIT_X86_64 0
+#endif
+
+namespace jit {
+
+  // Compiles the row programs that computed HOT_ROWS rows to native loops
+  static const tcl::Variable JIT("doc_jit", false);
+
+  // Compiled programs are kept for the life of the process, at most this many
+  static const std::size_t MAX_FUNCTIONS = 1024;
+
+  // Variables are read on the main thread, evaluateRows() also runs on workers of a
+  // parallel recalculation, which see what the main thread read last
+  static const std::thread::id mainThread_ = std::this_thread::get_id();
+  static std::atomic<bool> enabled_(false);
+
+  struct Entry
+  {
+    std::size_t rows_ = 0;
+    bool compiled_ = false;
+    RowFunction function_ = nullptr;
+  };
+
+  static std::mutex mutex_;
+  static std::unordered_map<std::string, Entry> entries_;
+  static std::size_t functions_ = 0;
+
+  // What the code of program depends on, its operations with their constants and columns
+  static std::string programKey(Program const& program)
+  {
+    std::string key;
+    key.reserve(program.code_.size() * 9);
+
+    for (auto const& instruction : program.code_)
+    {
+      uint64_t payload = 0;
+      if (instruction.op_ == Program::Constant)
+        payload = value::bits(instruction.constant_);
+      else
+        payload = (uint32_t)instruction.cell_.x_ | ((uint64_t)(uint32_t)instruction.cell_.y_ << 32);
+
+      key.push_back((char)instruction.op_);
+      key.append(reinterpret_cast<const char *>(&payload), sizeof(payload));
+    }
+
+    return key;
+  }
+
+#if JIT_X86_64
+
+  // The registers of the emitted code. xmm0 to xmm13 hold the stack, xmm14 and xmm15 are
+  // scratch. rdi, rsi and rdx hold the arguments, rcx the row and rax a column.
+  static const int STACK_REGISTERS = 14;
+  static const int SCRATCH1 = 14;
+  static const int SCRATCH2 = 15;
+
+  // Second opcode bytes of the SSE2 instructions on packed doubles, which take 0x66 first
+  enum SseOp : uint8_t
+  {
+    LOAD = 0x10,
+    STORE = 0x11,
+    MOVE = 0x28,
+    AND = 0x54,
+    AND_NOT = 0x55,
+    OR = 0x56,
+    XOR = 0x57,
+    ADD = 0x58,
+    MULTIPLY = 0x59,
+    SUBTRACT = 0x5C,
+    MINIMUM = 0x5D,
+    DIVIDE = 0x5E,
+    MAXIMUM = 0x5F,
+    COMPARE = 0xC2,
+  };
+
+  // The predicates of COMPARE
+  static const uint8_t COMPARE_EQUAL = 0;
+  static const uint8_t COMPARE_UNORDERED = 3;
+  static const uint8_t COMPARE_ORDERED = 7;
+
+  // Rounding toward minus and plus infinity, without the precision exception
+  static const uint8_t ROUND_FLOOR = 0x09;
+  static const uint8_t ROUND_CEIL = 0x0A;
+
+  static const uint64_t SIGN_MASK = 0x7FFFFFFFFFFFFFFFull;
+
+  class Emitter
+  {
+    public:
+      std::vector<uint8_t> code_;
+
+      void byte(uint8_t value) { code_.push_back(value); }
+
+      void int32(int32_t value)
+      {
+        uint8_t bytes[4];
+        memcpy(bytes, &value, sizeof(bytes));
+        code_.insert(code_.end(), bytes, bytes + 4);
+      }
+
+      void bytes(std::initializer_list<uint8_t> values) { code_.insert(code_.end(), values); }
+
+      // The prefix, a REX prefix if a register is xmm8 or above, and the 0x0F escape
+      void prefix(uint8_t prefix, int reg, int rm)
+      {
+        byte(prefix);
+        if (reg >= 8 || rm >= 8)
+          byte(0x40 | (reg >= 8 ? 0x04 : 0) | (rm >= 8 ? 0x01 : 0));
+        byte(0x0F);
+      }
+
+      static uint8_t modrm(int mod, int reg, int rm) { return (uint8_t)((mod << 6) | ((reg & 7) << 3) | (rm & 7)); }
+
+      // op reg, rm on two registers
+      void sse(SseOp op, int reg, int rm)
+      {
+        prefix(0x66, reg, rm);
+        byte(op);
+        byte(modrm(3, reg, rm));
+      }
+
+      void compare(int reg, int rm, uint8_t predicate)
+      {
+        sse(COMPARE, reg, rm);
+        byte(predicate);
+      }
+
+      // ROUNDPD, SSE4.1
+      void round(int reg, uint8_t mode)
+      {
+        prefix(0x66, reg, reg);
+        bytes({ 0x3A, 0x09, modrm(3, reg, reg), mode });
+      }
+
+      // op reg, [rip + constant], with both doubles of the constant value
+      void sseConstant(SseOp op, int reg, uint64_t value)
+      {
+        std::size_t index = 0;
+        while (index < constants_.size() && constants_[index] != value)
+          ++index;
+
+        if (index == constants_.size())
+          constants_.push_back(value);
+
+        prefix(0x66, reg, 0);
+        byte(op);
+        byte(modrm(0, reg, 5));
+        fixups_.emplace_back(code_.size(), index);
+        int32(0);
+      }
+
+      // reg = the rows of column at rcx, both or with scalar the first
+      void loadColumn(int reg, int column, bool scalar)
+      {
+        // mov rax, [rdi + 8 * column]
+        bytes({ 0x48, 0x8B, 0x87 });
+        int32(column * 8);
+
+        // movupd or movsd reg, [rax + rcx * 8]
+        prefix(scalar ? 0xF2 : 0x66, reg, 0);
+        bytes({ LOAD, modrm(0, reg, 4), 0xC8 });
+      }
+
+      // [rdx + rcx * 8] = xmm0
+      void storeResult(bool scalar)
+      {
+        prefix(scalar ? 0xF2 : 0x66, 0, 0);
+        bytes({ STORE, modrm(0, 0, 4), 0xCA });
+      }
+
+      // A jump whose rel32 jumpTo() sets
+      std::size_t jump(std::initializer_list<uint8_t> opcode)
+      {
+        bytes(opcode);
+        int32(0);
+        return code_.size();
+      }
+
+      void jumpTo(std::size_t jump, std::size_t target)
+      {
+        const int32_t offset = (int32_t)(target - jump);
+        memcpy(&code_[jump - 4], &offset, sizeof(offset));
+      }
+
+      // Puts the constants after the code, 16 byte aligned like the operands of the SSE
+      // instructions have to be
+      void placeConstants()
+      {
+        while (code_.size() % 16 != 0)
+          byte(0xCC);
+
+        const std::size_t base = code_.size();
+        for (uint64_t value : constants_)
+        {
+          uint8_t bytes[8];
+          memcpy(bytes, &value, sizeof(bytes));
+          code_.insert(code_.end(), bytes, bytes + 8);
+          code_.insert(code_.end(), bytes, bytes + 8);
+        }
+
+        for (auto const& fixup : fixups_)
+        {
+          const int32_t offset = (int32_t)(base + fixup.second * 16 - (fixup.first + 4));
+          memcpy(&code_[fixup.first], &offset, sizeof(offset));
+        }
+      }
+
+    private:
+      std::vector<uint64_t> constants_;
+      std::vector<std::pair<std::size_t, std::size_t>> fixups_;
+  };
+
+  static bool hasSse41()
+  {
+    static const bool supported = __builtin_cpu_supports("sse4.1");
+    return supported;
+  }
+
+  // The instructions of program for two rows, or for one with scalar, leaving the result
+  // in xmm0. False for instructions the emitter doesn't know.
+  static bool emitRows(Emitter & emitter, Program const& program, bool scalar)
+  {
+    int top = 0;
+
+    for (auto const& instruction : program.code_)
+    {
+      const int a = top - 2;
+      const int b = top - 1;
+
+      switch (instruction.op_)
+      {
+        case Program::Constant:
+        case Program::Cell:
+          if (top == STACK_REGISTERS)
+            return false;
+
+          if (instruction.op_ == Program::Constant)
+            emitter.sseConstant(LOAD, top, value::bits(instruction.constant_));
+          else
+            emitter.loadColumn(top, instruction.cell_.x_, scalar);
+
+          top++;
+          break;
+
+        case Program::Add:
+        case Program::Subtract:
+        case Program::Multiply:
+          emitter.sse(instruction.op_ == Program::Add ? ADD : instruction.op_ == Program::Subtract ? SUBTRACT : MULTIPLY, a, b);
+          top--;
+          break;
+
+        case Program::Divide:
+          // A zero divisor gives #DIV0 unless the dividend is a NaN
+          emitter.sse(MOVE, SCRATCH1, b);
+          emitter.sse(XOR, SCRATCH2, SCRATCH2);
+          emitter.compare(SCRATCH1, SCRATCH2, COMPARE_EQUAL);
+          emitter.sse(MOVE, SCRATCH2, a);
+          emitter.compare(SCRATCH2, SCRATCH2, COMPARE_ORDERED);
+          emitter.sse(AND, SCRATCH1, SCRATCH2);
+          emitter.sse(DIVIDE, a, b);
+          emitter.sse(MOVE, SCRATCH2, SCRATCH1);
+          emitter.sse(AND_NOT, SCRATCH2, a);
+          emitter.sseConstant(AND, SCRATCH1, value::bits(errorValue(FormulaError::Div0)));
+          emitter.sse(OR, SCRATCH1, SCRATCH2);
+          emitter.sse(MOVE, a, SCRATCH1);
+          top--;
+          break;
+
+        case Program::Min:
+        case Program::Max:
+          // MINPD b, a is b < a ? b : a like std::min(a, b), a NaN b is kept
+          emitter.sse(MOVE, SCRATCH1, b);
+          emitter.sse(instruction.op_ == Program::Min ? MINIMUM : MAXIMUM, SCRATCH1, a);
+          emitter.sse(MOVE, SCRATCH2, b);
+          emitter.compare(SCRATCH2, SCRATCH2, COMPARE_UNORDERED);
+          emitter.sse(AND, b, SCRATCH2);
+          emitter.sse(AND_NOT, SCRATCH2, SCRATCH1);
+          emitter.sse(OR, SCRATCH2, b);
+          emitter.sse(MOVE, a, SCRATCH2);
+          top--;
+          break;
+
+        case Program::Abs:
+          emitter.sseConstant(AND, b, SIGN_MASK);
+          break;
+
+        case Program::Floor:
+        case Program::Ceil:
+          if (!hasSse41())
+            return false;
+
+          emitter.round(b, instruction.op_ == Program::Floor ? ROUND_FLOOR : ROUND_CEIL);
+          break;
+
+        default:
+          return false;
+      }
+    }
+
+    return top == 1;
+  }
+
+  // rdi = columns, rsi = count and rdx = out. Pairs of rows first, then the last odd row.
+  static bool emitFunction(Emitter & emitter, Program const& program)
+  {
+    emitter.bytes({ 0x31, 0xC9 });               // xor ecx, ecx
+    emitter.bytes({ 0x49, 0x89, 0xF1 });         // mov r9, rsi
+    emitter.bytes({ 0x49, 0x83, 0xE1, 0xFE });   // and r9, -2
+
+    const std::size_t pairs = emitter.code_.size();
+    emitter.bytes({ 0x4C, 0x39, 0xC9 });         // cmp rcx, r9
+    const std::size_t toTail = emitter.jump({ 0x0F, 0x83 });  // jae tail
+
+    if (!emitRows(emitter, program, false))
+      return false;
+
+    emitter.storeResult(false);
+    emitter.bytes({ 0x48, 0x83, 0xC1, 0x02 });   // add rcx, 2
+    emitter.jumpTo(emitter.jump({ 0xE9 }), pairs);  // jmp pairs
+
+    emitter.jumpTo(toTail, emitter.code_.size());
+    emitter.bytes({ 0x48, 0x39, 0xF1 });         // cmp rcx, rsi
+    const std::size_t toDone = emitter.jump({ 0x0F, 0x83 });  // jae done
+
+    if (!emitRows(emitter, program, true))
+      return false;
+
+    emitter.storeResult(true);
+
+    emitter.jumpTo(toDone, emitter.code_.size());
+    emitter.byte(0xC3);                          // ret
+
+    emitter.placeConstants();
+    return true;
+  }
+
+  // The code is written to pages that are made executable once it is in place
+  static RowFunction install(std::vector<uint8_t> const& code)
+  {
+    static const std::size_t pageSize = sysconf(_SC_PAGESIZE);
+    const std::size_t size = (code.size() + pageSize - 1) / pageSize * pageSize;
+
+    void * memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+      return nullptr;
+
+    memcpy(memory, code.data(), code.size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0)
+    {
+      munmap(memory, size);
+      return nullptr;
+    }
+
+    return reinterpret_cast<RowFunction>(memory);
+  }
+
+  RowFunction compile(Program const& program)
+  {
+    if (!isRowProgram(program))
+      return nullptr;
+
+    Emitter emitter;
+    if (!emitFunction(emitter, program))
+      return nullptr;
+
+    return install(emitter.code_);
+  }
+
+#else
+
+  RowFunction compile(Program const&)
+  {
+    return nullptr;
+  }
+
+#endif
+
+  RowFunction rowFunction(Program const& program, std::size_t count)
+  {
+    if (std::this_thread::get_id() == mainThread_)
+      enabled_ = JIT.toBool();
+
+    if (!JIT_X86_64 || !enabled_)
+      return nullptr;
+
+    const std::string key = programKey(program);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry & entry = entries_[key];
+    if (entry.compiled_)
+      return entry.function_;
+
+    entry.rows_ += count;
+    if (entry.rows_ < HOT_ROWS || functions_ == MAX_FUNCTIONS)
+      return nullptr;
+
+    entry.compiled_ = true;
+    entry.function_ = compile(program);
+    functions_ += entry.function_ ? 1 : 0;
+    return entry.function_;
+  }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Expression.h"
+
+#include <cstddef>
+
+// Row programs, see isRowProgram(), compiled to native loops. evaluateRows() counts the
+// rows each program computes, and with doc_jit set, a program that computed HOT_ROWS rows
+// is compiled into a loop that keeps its stack in registers and does two rows at a time,
+// instead of an instruction at a time over all of them.
+//
+// The emitter writes x86-64 SSE2 for the System V calling convention of Linux and macOS,
+// and FLOOR and CEIL take SSE4.1. Elsewhere, and for programs with instructions it doesn't
+// know like the trigonometric and plugin functions, the interpreter is used. Results are
+// the same to the bit as the ones of the interpreter, but for which NaN is kept when
+// both operands of an instruction are one, which the compiled interpreter leaves to the
+// compiler too.
+namespace jit {
+
+  static const std::size_t HOT_ROWS = 8192;
+
+  // Writes the results of count rows to out, columns[x] holds the values of column x
+  typedef void (*RowFunction)(double const* const* columns, std::size_t count, double * out);
+
+  // Counts count rows for program and returns its compiled loop once it is hot, nullptr
+  // until then or when it can't be compiled. Can be called from any thread.
+  RowFunction rowFunction(Program const& program, std::size_t count);
+
+  // Compiles program right away, nullptr if it can't be
+  RowFunction compile(Program const& program);
+}
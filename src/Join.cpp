@@ -0,0 +1,281 @@
+#include "Join.h"
+#include "DocumentState.h"
+#include "Document.h"
+#include "FlatHashMap.h"
+#include "Scheduler.h"
+#include "Log.h"
+
+#include <algorithm>
+
+namespace join {
+
+  // Probe rows of one task
+  static const std::size_t RANGE_ROWS = 64 * 1024;
+
+  // The build rows of every key as chains through next_. heads_ holds the first row of a
+  // key plus one, next_ the following row of the same key plus one, or 0 at the end.
+  struct Table
+  {
+    FlatHashMap<uint32_t> heads_;
+    std::vector<uint32_t> next_;
+  };
+
+  static void probeRange(std::vector<uint32_t> const& probe, Table const& table, std::size_t first, std::size_t last,
+                         bool keepUnmatched, std::vector<Match> & matches)
+  {
+    for (std::size_t row = first; row < last; ++row)
+    {
+      const uint32_t * head = probe[row] == NO_KEY ? nullptr : table.heads_.find(probe[row]);
+      if (!head)
+      {
+        if (keepUnmatched)
+          matches.push_back({ (int32_t)row, NO_ROW });
+        continue;
+      }
+
+      for (uint32_t build = *head; build != 0; build = table.next_[build - 1])
+        matches.push_back({ (int32_t)row, (int32_t)build - 1 });
+    }
+  }
+
+  std::vector<Match> hashJoin(std::vector<uint32_t> const& probe, std::vector<uint32_t> const& build, bool keepUnmatched)
+  {
+    Table table;
+    table.heads_.reserve(build.size());
+    table.next_.resize(build.size(), 0);
+
+    // Inserted from the back, so every chain runs in row order
+    for (std::size_t row = build.size(); row-- > 0; )
+    {
+      if (build[row] == NO_KEY)
+        continue;
+
+      uint32_t & head = table.heads_[build[row]];
+      table.next_[row] = head;
+      head = row + 1;
+    }
+
+    const std::size_t rangeCount = std::max<std::size_t>(1, (probe.size() + RANGE_ROWS - 1) / RANGE_ROWS);
+
+    std::vector<std::vector<Match>> ranges(rangeCount);
+    std::vector<Scheduler::Task> tasks;
+
+    for (std::size_t r = 0; r < rangeCount; ++r)
+    {
+      const std::size_t first = r * RANGE_ROWS;
+      const std::size_t last = std::min(probe.size(), first + RANGE_ROWS);
+
+      std::vector<Match> * matches = &ranges[r];
+      tasks.push_back([&probe, &table, first, last, keepUnmatched, matches] () {
+        probeRange(probe, table, first, last, keepUnmatched, *matches);
+      });
+    }
+
+    Scheduler::shared().run(tasks);
+
+    std::size_t size = 0;
+    for (auto const& range : ranges)
+      size += range.size();
+
+    std::vector<Match> matches;
+    matches.reserve(size);
+
+    for (auto & range : ranges)
+    {
+      matches.insert(matches.end(), range.begin(), range.end());
+      range = std::vector<Match>();
+    }
+
+    return matches;
+  }
+}
+
+namespace doc {
+
+  bool collectJoinSide(long buffer, std::string const& column, bool header, JoinSide & side)
+  {
+    if (buffer < 0 || buffer >= (long)documentBuffers().size())
+    {
+      logError("no buffer ", buffer, " to join");
+      return false;
+    }
+
+    BufferSwitch bufferSwitch(buffer);
+
+    Document & doc = currentDoc();
+    side.doc_ = currentBuffer().doc_;
+    side.column_ = Index::strToColumn(column);
+
+    if (doc.loading_ || doc.paged_)
+    {
+      logError("can't join a document that is loading or paged, filter it into a view first");
+      return false;
+    }
+
+    if (side.column_ < 0 || side.column_ >= getColumnCount())
+    {
+      logError("join column ", column, " out of range");
+      return false;
+    }
+
+    const int rowCount = getRowCount();
+    const int first = header ? 1 : 0;
+    std::string scratch;
+
+    if (header && rowCount > 0)
+      side.header_ = documentRow(0);
+
+    side.rows_.reserve(std::max(rowCount - first, 0));
+    side.keys_.reserve(side.rows_.capacity());
+
+    for (int y = first; y < rowCount; ++y)
+    {
+      const int row = documentRow(y);
+
+      for (int x = 0; x < doc.width_; ++x)
+      {
+        Cell * cell = doc.cells_.find(Index(x, row));
+        if (cell && cell->hasExpression() && !cell->evaluated)
+          evaluateCell(Index(x, row), *cell);
+      }
+
+      Cell * cell = doc.cells_.find(Index(side.column_, row));
+
+      side.rows_.push_back(row);
+      side.keys_.push_back(cell ? displayTextId(doc, *cell, scratch) : StringPool::EMPTY);
+    }
+
+    return true;
+  }
+
+  // The keys of from as ids of the pool of to, keys to doesn't hold become StringPool::EMPTY.
+  // Every distinct key is looked up once.
+  static std::vector<uint32_t> translateJoinKeys(JoinSide const& from, JoinSide const& to)
+  {
+    std::vector<uint32_t> ids(from.doc_->strings_.size(), UINT32_MAX);
+    std::vector<uint32_t> keys;
+    keys.reserve(from.keys_.size());
+
+    for (const uint32_t key : from.keys_)
+    {
+      uint32_t & id = ids[key];
+      if (id == UINT32_MAX && (key == StringPool::EMPTY || !to.doc_->strings_.find(from.doc_->strings_.str(key), id)))
+        id = StringPool::EMPTY;
+
+      keys.push_back(id);
+    }
+
+    return keys;
+  }
+
+  // Copies the cell at idx of from to target in the current document, formulas become what
+  // they show. ids caches the current pool's id of the ids of from's pool, or UINT32_MAX.
+  void copyJoinedCell(Document const& from, Index const& idx, Index const& target, std::vector<uint32_t> & ids)
+  {
+    Cell const* cell = from.cells_.find(idx);
+    if (!cell)
+      return;
+
+    StringPool & strings = currentDoc().strings_;
+    Cell copy;
+
+    if (cell->hasExpression())
+    {
+      char number[str::FORMAT_SIZE];
+      const std::string text = cell->display().empty() ? std::string(number, str::formatDouble(cell->value, number)) : cell->display();
+
+      copy.text = strings.intern(text);
+      copy.format = cell->format;
+      parseCellText(copy, text);
+    }
+    else
+    {
+      uint32_t & id = ids[cell->text];
+      if (id == UINT32_MAX)
+        id = strings.intern(from.strings_.str(cell->text));
+
+      copy = *cell;
+      copy.text = id;
+    }
+
+    copy.evaluated = true;
+    growDocument(target);
+    getCell(target) = std::move(copy);
+  }
+
+  bool joinBuffers(long leftBuffer, std::string const& leftColumn, long rightBuffer, std::string const& rightColumn,
+                   bool header, bool keepUnmatched, std::size_t & rows)
+  {
+    JoinSide left, right;
+    if (!collectJoinSide(leftBuffer, leftColumn, header, left) ||
+        !collectJoinSide(rightBuffer, rightColumn, header, right))
+      return false;
+
+    // The table is built on the smaller side, the keys of the other side are translated
+    // into its pool so the probes only compare ids. Left joins probe with every left row.
+    const bool buildLeft = !keepUnmatched && left.rows_.size() < right.rows_.size();
+    JoinSide const& probe = buildLeft ? right : left;
+    JoinSide const& build = buildLeft ? left : right;
+
+    std::vector<join::Match> matches = join::hashJoin(translateJoinKeys(probe, build), build.keys_, keepUnmatched);
+
+    // Rows come in the order of the left rows, then of the right rows
+    if (buildLeft)
+    {
+      for (auto & match : matches)
+        std::swap(match.probe_, match.build_);
+
+      std::sort(matches.begin(), matches.end(), [] (join::Match const& a, join::Match const& b) {
+        return a.probe_ < b.probe_ || (a.probe_ == b.probe_ && a.build_ < b.build_);
+      });
+    }
+
+    // The joined rows go into a new document, the sides keep their documents alive while it is filled
+    createDefaultEmpty();
+
+    const int leftWidth = left.doc_->width_;
+    const int rightWidth = right.doc_->width_;
+
+    std::vector<uint32_t> leftIds(left.doc_->strings_.size(), UINT32_MAX);
+    std::vector<uint32_t> rightIds(right.doc_->strings_.size(), UINT32_MAX);
+
+    auto copyRow = [&] (int leftRow, int rightRow, int row) {
+      for (int x = 0; x < leftWidth; ++x)
+        copyJoinedCell(*left.doc_, Index(x, leftRow), Index(x, row), leftIds);
+
+      if (rightRow < 0)
+        return;
+
+      for (int x = 0, column = leftWidth; x < rightWidth; ++x)
+        if (x != right.column_)
+          copyJoinedCell(*right.doc_, Index(x, rightRow), Index(column++, row), rightIds);
+    };
+
+    for (int x = 0, column = 0; x < leftWidth + rightWidth; ++x)
+    {
+      JoinSide const& side = x < leftWidth ? left : right;
+      const int sideColumn = x < leftWidth ? x : x - leftWidth;
+
+      if (&side == &right && sideColumn == right.column_)
+        continue;
+
+      const int width = side.doc_->columns_.stored(sideColumn);
+      if (width >= 0)
+        currentDoc().columns_.set(column, width);
+
+      column++;
+    }
+
+    int row = 0;
+    if (left.header_ >= 0 && right.header_ >= 0)
+      copyRow(left.header_, right.header_, row++);
+
+    for (auto const& match : matches)
+      copyRow(left.rows_[match.probe_], match.build_ == join::NO_ROW ? -1 : right.rows_[match.build_], row++);
+
+    currentDoc().width_ = std::max(currentDoc().width_, leftWidth + rightWidth - 1);
+
+    rows = matches.size();
+    return true;
+  }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Hash join of two sides given as a 32 bit key per row, with keys of both sides in the
+// same id space. A table of the build side's keys is built once, then the probe side is
+// split into ranges probed on the scheduler, the table is only read while probing.
+namespace join {
+
+  // Key that never matches, rows without a key
+  static const uint32_t NO_KEY = 0;
+
+  // Row of the build side paired to probe rows without a match
+  static const int32_t NO_ROW = -1;
+
+  struct Match
+  {
+    int32_t probe_;
+    int32_t build_;
+  };
+
+  // Pairs every probe row with the build rows of the same key, in the order of the probe
+  // rows and then of the build rows. Probe rows without a match are paired with NO_ROW
+  // if keepUnmatched is set, and left out otherwise.
+  std::vector<Match> hashJoin(std::vector<uint32_t> const& probe, std::vector<uint32_t> const& build, bool keepUnmatched);
+}
+
+// Joins of buffers on the hash join, into a new buffer
+namespace doc {
+
+  // Opens a new buffer with the rows of leftBuffer joined to those of rightBuffer on the
+  // text of their columns, and sets rows to the rows it got, not counting the header.
+  // header tells whether the first row of each buffer is one, keepUnmatched keeps left
+  // rows without a match. Returns false, having logged why, when a buffer can't be joined.
+  bool joinBuffers(long leftBuffer, std::string const& leftColumn, long rightBuffer, std::string const& rightColumn,
+                   bool header, bool keepUnmatched, std::size_t & rows);
+}
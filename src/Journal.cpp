@@ -0,0 +1,130 @@
+#include "Journal.h"
+#include "FileWriter.h"
+#include "Log.h"
+
+#include "bx/thread.h"
+#include "bx/mutex.h"
+#include "bx/sem.h"
+
+#include <cstdio>
+
+struct Journal::State
+{
+  bx::Mutex mutex_;
+  bx::Semaphore wake_;
+  bx::Thread thread_;
+  std::string pending_;
+  bool quit_ = false;
+
+  // Owned by the writer thread
+  FILE * file_ = nullptr;
+  bool failed_ = false;
+};
+
+Journal::Journal()
+{ }
+
+Journal::~Journal()
+{
+  close();
+}
+
+bool Journal::open(std::string const& filename, std::string const& header)
+{
+  close();
+
+  FILE * file = fopen(filename.c_str(), "wb");
+  if (!file)
+    return false;
+
+  state_.reset(new State());
+  state_->file_ = file;
+  state_->pending_ = header;
+  filename_ = filename;
+
+  state_->thread_.init(threadMain, state_.get());
+  state_->wake_.post();
+
+  return true;
+}
+
+void Journal::append(std::string const& entry)
+{
+  if (!state_)
+    return;
+
+  bool wake = false;
+
+  {
+    bx::MutexScope lock(state_->mutex_);
+    wake = state_->pending_.empty();
+    state_->pending_ += entry;
+  }
+
+  // The writer sleeps until the first entry of a batch arrives
+  if (wake)
+    state_->wake_.post();
+}
+
+void Journal::close()
+{
+  if (!state_)
+    return;
+
+  {
+    bx::MutexScope lock(state_->mutex_);
+    state_->quit_ = true;
+  }
+
+  state_->wake_.post();
+  state_->thread_.shutdown();
+
+  if (state_->failed_)
+    logError("Could not write journal '", filename_, "'");
+
+  fclose(state_->file_);
+  state_.reset();
+
+  remove(filename_.c_str());
+
+  filename_.clear();
+}
+
+int Journal::threadMain(void * userData)
+{
+  State & state = *static_cast<State *>(userData);
+  std::string batch;
+
+  while (true)
+  {
+    state.wake_.wait();
+
+    bool quit;
+    {
+      bx::MutexScope lock(state.mutex_);
+      quit = state.quit_;
+    }
+
+    // Give the edits that follow the first one time to arrive, so a burst of them is
+    // synced once. Closing posts again and ends the wait early.
+    if (!quit)
+      state.wake_.wait(SYNC_INTERVAL_MS);
+
+    {
+      bx::MutexScope lock(state.mutex_);
+      batch.swap(state.pending_);
+      quit = state.quit_;
+    }
+
+    if (!batch.empty() && !state.failed_)
+    {
+      if (fwrite(batch.data(), 1, batch.size(), state.file_) != batch.size() || !syncFile(state.file_))
+        state.failed_ = true;
+    }
+
+    batch.clear();
+
+    if (quit)
+      return 0;
+  }
+}
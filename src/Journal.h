@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <memory>
+
+// Append-only log of the edits made to a document since it was last saved. Entries are
+// queued by append() and written by a background thread, which syncs them to disk in
+// batches. Destroying the journal removes its file, so only a crash leaves one behind.
+class Journal
+{
+  public:
+    // Time the writer waits for more entries before writing and syncing a batch
+    static const int SYNC_INTERVAL_MS = 200;
+
+  public:
+    Journal();
+    ~Journal();
+
+    Journal(Journal const&) = delete;
+    Journal & operator = (Journal const&) = delete;
+
+    // Starts a new journal file that begins with header. Returns false if it can't be
+    // created, append() then drops the entries.
+    bool open(std::string const& filename, std::string const& header);
+
+    void append(std::string const& entry);
+
+    // Writes the queued entries, then closes and removes the file
+    void close();
+
+    std::string const& filename() const { return filename_; }
+
+  private:
+    struct State;
+
+    static int threadMain(void * userData);
+
+  private:
+    std::unique_ptr<State> state_;
+    std::string filename_;
+};
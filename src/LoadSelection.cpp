@@ -0,0 +1,125 @@
+#include "LoadSelection.h"
+#include "DocumentState.h"
+#include "Document.h"
+#include "MappedFile.h"
+#include "Editor.h"
+#include "Log.h"
+
+#include <algorithm>
+
+namespace doc {
+
+  // Compiles the filter clauses of a load into selection, and appends the columns of the
+  // file they look at to columns. Text that isn't a number fails a comparison, the load
+  // goes on.
+  static bool compileLoadWhere(std::vector<std::string> const& args, LoadSelection & selection, std::vector<int> & columns)
+  {
+    selection.header_ = args[0] != "-noHeader";
+
+    // Without a document no value is in a pool, the clauses compare texts
+    const StringPool strings;
+    std::vector<FilterClause> clauses;
+    if (!parseFilterClauses(args, selection.header_ ? 0 : 1, strings, -1, clauses))
+      return false;
+
+    for (auto & clause : clauses)
+    {
+      clause.skipText = true;
+      columns.push_back(clause.column);
+    }
+
+    // Called on the scheduler for the chunks at once, the clauses are only read
+    selection.where_ = [clauses] (std::vector<StrView> const& fields) {
+      std::string value;
+      bool include = false;
+
+      lineIncludes(clauses, [&fields] (int column) { return column < (int)fields.size() ? fields[column] : StrView(); }, value, include, true);
+      return include;
+    };
+
+    return true;
+  }
+
+  bool loadSelected(std::string const& filename, std::vector<std::string> const& names, std::vector<std::string> const& where)
+  {
+    MappedFile file;
+    if (!file.open(filename))
+    {
+      logError("Could not open document '", filename, "'");
+      flashMessage("Could not open document!");
+      return false;
+    }
+
+    const StrView data = file.data();
+    if (!isPlainCsv(data))
+    {
+      logError("Only CSV files can be loaded in part, load '", filename, "' and filter the buffer instead");
+      return false;
+    }
+
+    const char delimiter = detectDelimiter(data);
+
+    std::vector<std::string> header;
+    csv::Reader reader(delimiter);
+    const std::size_t headerEnd = data.find('\n');
+    reader.read(headerEnd == StrView::npos ? data : data.substr(0, headerEnd + 1), [&header] (StrView text, bool) {
+      header.push_back(text.str());
+    });
+
+    LoadSelection selection;
+    for (std::size_t i = 0; i < names.size(); ++i)
+    {
+      std::string const& name = names[i];
+
+      int column = std::find(header.begin(), header.end(), name) - header.begin();
+      if (column == (int)header.size())
+      {
+        const bool letters = !name.empty() && std::all_of(name.begin(), name.end(), [] (char c) { return c >= 'A' && c <= 'Z'; });
+        column = letters ? Index::strToColumn(name) : -1;
+      }
+
+      if (column < 0)
+      {
+        logError("no column ", name, " in '", filename, "'");
+        return false;
+      }
+
+      if (column >= (int)selection.columns_.size())
+        selection.columns_.resize(column + 1, -1);
+
+      if (selection.columns_[column] >= 0)
+      {
+        logError("column ", name, " is loaded twice");
+        return false;
+      }
+
+      selection.columns_[column] = i;
+    }
+
+    // The reader unquotes the columns that are loaded and the ones the clauses look at
+    std::vector<int> filtered;
+    if (!where.empty() && !compileLoadWhere(where, selection, filtered))
+      return false;
+
+    if (!selection.columns_.empty())
+    {
+      for (const int target : selection.columns_)
+        selection.keep_.push_back(target >= 0);
+
+      for (const int column : filtered)
+      {
+        if (column >= (int)selection.keep_.size())
+          selection.keep_.resize(column + 1, false);
+
+        selection.keep_[column] = true;
+      }
+    }
+
+    if (!loadCSV(data, delimiter, &selection))
+      return false;
+
+    const int rows = std::max(currentDoc().height_ - (selection.header_ ? 1 : 0), 0);
+    flashMessage("Loaded " + str::fromInt(rows) + " rows in " + str::fromInt(currentDoc().width_) + " of the " + str::fromInt(header.size()) + " columns of " + filename);
+    return true;
+  }
+}
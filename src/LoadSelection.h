@@ -0,0 +1,79 @@
+#pragma once
+
+#include "Str.h"
+#include "CsvScanner.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Loading part of a CSV file: only some of its columns, and only the lines that pass
+// filter clauses. The other fields are stepped over by the reader and the lines that
+// don't pass never become cells.
+namespace doc {
+
+  // What a load keeps of the lines of a CSV file
+  struct LoadSelection
+  {
+    // Fields of the c-th column of the file go to column columns_[c], or are skipped
+    // where it is -1 or columns_ is shorter. Empty keeps every column where it is.
+    std::vector<int> columns_;
+
+    // The columns of the file the reader unquotes, empty for all of them
+    std::vector<bool> keep_;
+
+    // Whether the line of the fields, by column of the file, is loaded. The first line
+    // of the file always is with header_.
+    std::function<bool (std::vector<StrView> const& fields)> where_;
+    bool header_ = true;
+  };
+
+  // Reads the lines of data with reader and passes the fields of those where_ of
+  // selection loads to field(column of the file, text), the first line regardless with
+  // header, then calls lineEnd() if the line ends in a line break. The fields of a line
+  // are held until the line is known to be loaded.
+  template <typename FieldFunc, typename LineFunc>
+  void readSelectedLines(csv::Reader & reader, StrView data, LoadSelection const& selection, bool header, FieldFunc const& field, LineFunc const& lineEnd)
+  {
+    std::string line;
+    std::vector<std::pair<std::size_t, std::size_t>> spans;
+    std::vector<StrView> fields;
+
+    auto endLine = [&] (bool ended) {
+      fields.clear();
+      for (auto const& span : spans)
+        fields.push_back(StrView(line.data() + span.first, span.second));
+
+      if (header || selection.where_(fields))
+      {
+        for (std::size_t i = 0; i < fields.size(); ++i)
+          field((int)i, fields[i]);
+
+        if (ended)
+          lineEnd();
+      }
+
+      header = false;
+      line.clear();
+      spans.clear();
+    };
+
+    reader.read(data, [&line, &spans, &endLine] (StrView text, bool lineEnd) {
+      spans.emplace_back(line.size(), text.size());
+      line.append(text.data(), text.size());
+
+      if (lineEnd)
+        endLine(true);
+    });
+
+    // The last line may not end in a line break
+    if (!spans.empty())
+      endLine(false);
+  }
+
+  // Opens a document of the CSV file filename with only the columns of names, in their
+  // order and each by its header or its letter, and only the lines that pass the filter
+  // clauses of where. Either may be empty for all. Like a sample the document has no
+  // name, saving it can't lose the rest of the file.
+  bool loadSelected(std::string const& filename, std::vector<std::string> const& names, std::vector<std::string> const& where);
+}
@@ -1,9 +1,20 @@
-
 #include "Log.h"
 #include "bx/platform.h"
+#include "bx/thread.h"
+#include "bx/sem.h"
 
 #include <cstdlib>
 #include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// Capacity of the message queue, has to be a power of two
+static const std::size_t QUEUE_SIZE = 1024;
+// Debug and info messages written per second before the rest of the second is suppressed
+static const int MESSAGES_PER_SECOND = 100;
+
+static std::atomic<int> logLevel_(ZUM_LOG_LEVEL);
 
 static std::string logFile()
 {
@@ -20,94 +31,388 @@ static std::string logFile()
 #endif
 }
 
+static const char * levelPrefix(LogLevel level)
+{
+  switch (level)
+  {
+    case LogLevel::Debug:
+      return "Debug: ";
+
+    case LogLevel::Warning:
+      return "Warning: ";
+
+    case LogLevel::Error:
+      return "Error: ";
+
+    default:
+      return "";
+  }
+}
+
+// Warnings, errors and the output of scripts are neither dropped nor rate limited
+static bool essential(LogLevel level, bool output)
+{
+  return output || level >= LogLevel::Warning;
+}
+
+namespace
+{
+  // Bounded multi producer, single consumer queue. Every slot carries a sequence number
+  // that tells producers when it is free and the writer thread when it is filled, so a
+  // producer only ever does one compare and swap on the head.
+  class Logger
+  {
+    public:
+      Logger();
+      ~Logger();
+
+      void push(LogLevel level, std::string && message, bool output);
+
+    private:
+      typedef std::chrono::steady_clock Clock;
+
+      struct Slot
+      {
+        std::atomic<std::size_t> sequence_;
+        LogLevel level_;
+        bool output_;
+        std::string message_;
+      };
+
+      static int threadMain(void * userData);
+
+      bool pending() const;
+      bool pop(LogLevel & level, bool & output, std::string & message);
+      void drain();
+
+      void write(LogLevel level, bool output, std::string const& message);
+      void print(LogLevel level, std::string const& message);
+      void flushRepeated();
+      void flushSuppressed(Clock::time_point now);
+
+    private:
+      Slot slots_[QUEUE_SIZE];
+      std::atomic<std::size_t> head_;
+      std::size_t tail_ = 0;
+
+      std::atomic<bool> waiting_;
+      std::atomic<bool> quit_;
+      std::atomic<uint32_t> dropped_;
+
+      bx::Semaphore wake_;
+      bx::Thread thread_;
+
+      // Owned by the writer thread
+      FILE * file_ = nullptr;
+      std::string last_;
+      LogLevel lastLevel_ = LogLevel::Info;
+      int repeated_ = -1;
+      Clock::time_point second_;
+      int written_ = 0;
+      int suppressed_ = 0;
+  };
+
+  Logger::Logger()
+    : head_(0),
+      waiting_(false),
+      quit_(false),
+      dropped_(0)
+  {
+    for (std::size_t i = 0; i < QUEUE_SIZE; ++i)
+      slots_[i].sequence_.store(i, std::memory_order_relaxed);
+
+    thread_.init(threadMain, this);
+  }
+
+  Logger::~Logger()
+  {
+    quit_ = true;
+    wake_.post();
+    thread_.shutdown();
+  }
+
+  void Logger::push(LogLevel level, std::string && message, bool output)
+  {
+    std::size_t pos = head_.load(std::memory_order_relaxed);
+    Slot * slot = nullptr;
+
+    while (true)
+    {
+      slot = &slots_[pos % QUEUE_SIZE];
+      const std::size_t sequence = slot->sequence_.load(std::memory_order_acquire);
+      const intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+      if (diff == 0)
+      {
+        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      }
+      else if (diff < 0)
+      {
+        // The ring is full. Once the writer thread is gone nothing makes room any more.
+        if (!essential(level, output) || quit_)
+        {
+          dropped_++;
+          return;
+        }
+
+        if (waiting_.exchange(false))
+          wake_.post();
+
+        std::this_thread::yield();
+        pos = head_.load(std::memory_order_relaxed);
+      }
+      else
+      {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+
+    slot->level_ = level;
+    slot->output_ = output;
+    slot->message_ = std::move(message);
+    slot->sequence_.store(pos + 1);
+
+    // Only wake the writer when it went to sleep, a burst costs a single post
+    if (waiting_.exchange(false))
+      wake_.post();
+  }
+
+  bool Logger::pending() const
+  {
+    return slots_[tail_ % QUEUE_SIZE].sequence_.load() == tail_ + 1;
+  }
+
+  bool Logger::pop(LogLevel & level, bool & output, std::string & message)
+  {
+    if (!pending())
+      return false;
+
+    Slot & slot = slots_[tail_ % QUEUE_SIZE];
+    level = slot.level_;
+    output = slot.output_;
+    message.swap(slot.message_);
+    slot.message_.clear();
+
+    slot.sequence_.store(tail_ + QUEUE_SIZE, std::memory_order_release);
+    tail_++;
+    return true;
+  }
+
+  void Logger::drain()
+  {
+    LogLevel level;
+    bool output;
+    std::string message;
+
+    while (pop(level, output, message))
+      write(level, output, message);
+
+    const uint32_t dropped = dropped_.exchange(0);
+    if (dropped > 0)
+      print(LogLevel::Warning, "dropped " + std::to_string(dropped) + " log messages, the log queue was full");
+
+    flushSuppressed(Clock::now());
+
+    if (file_)
+      fflush(file_);
+
+    fflush(stderr);
+  }
+
+  void Logger::write(LogLevel level, bool output, std::string const& message)
+  {
+    // Collapse a run of identical messages, the count is written once a different
+    // message arrives. Output is written as it comes.
+    if (!output && repeated_ >= 0 && level == lastLevel_ && message == last_)
+    {
+      repeated_++;
+      return;
+    }
+
+    flushRepeated();
+
+    const Clock::time_point now = Clock::now();
+    flushSuppressed(now);
+
+    if (!essential(level, output))
+    {
+      if (written_ >= MESSAGES_PER_SECOND)
+      {
+        suppressed_++;
+        return;
+      }
+
+      written_++;
+    }
+
+    print(level, message);
+
+    if (output)
+      return;
+
+    last_ = message;
+    lastLevel_ = level;
+    repeated_ = 0;
+  }
+
+  void Logger::print(LogLevel level, std::string const& message)
+  {
+    const char * prefix = levelPrefix(level);
+
+    if (file_)
+      fprintf(file_, "%s%s\n", prefix, message.c_str());
+
+    fprintf(stderr, "%s%s\n", prefix, message.c_str());
+  }
+
+  void Logger::flushRepeated()
+  {
+    if (repeated_ > 0)
+      print(lastLevel_, "last message repeated " + std::to_string(repeated_) + " times");
+
+    repeated_ = -1;
+  }
+
+  void Logger::flushSuppressed(Clock::time_point now)
+  {
+    if (now - second_ < std::chrono::seconds(1))
+      return;
+
+    if (suppressed_ > 0)
+      print(LogLevel::Warning, "suppressed " + std::to_string(suppressed_) + " log messages");
+
+    second_ = now;
+    written_ = 0;
+    suppressed_ = 0;
+  }
+
+  int Logger::threadMain(void * userData)
+  {
+    Logger * logger = static_cast<Logger *>(userData);
+    logger->file_ = fopen(logFile().c_str(), "at");
+
+    while (!logger->quit_)
+    {
+      logger->drain();
+
+      // Announce the sleep before the last look at the queue, so a message pushed in
+      // between either is seen here or posts the semaphore
+      logger->waiting_ = true;
+      if (logger->pending() || logger->quit_)
+      {
+        logger->waiting_ = false;
+        continue;
+      }
+
+      logger->wake_.wait();
+    }
+
+    logger->drain();
+
+    // Repeated and rate limited messages are still reported on the way out
+    logger->flushRepeated();
+    logger->flushSuppressed(logger->second_ + std::chrono::seconds(1));
+
+    if (logger->file_)
+      fclose(logger->file_);
+
+    return 0;
+  }
+
+  Logger & logger()
+  {
+    static Logger instance;
+    return instance;
+  }
+}
+
 void clearLog()
 {
   FILE * file = fopen(logFile().c_str(), "w");
-  fclose(file);
+  if (file)
+    fclose(file);
+}
+
+void setLogLevel(LogLevel level)
+{
+  logLevel_ = (int)level;
+}
+
+LogLevel logLevel()
+{
+  return (LogLevel)logLevel_.load();
 }
 
-void _logValue(FILE * file, char value)
+bool _logEnabled(LogLevel level)
 {
-  fprintf(file, "%c", value);
-  fprintf(stderr, "%c", value);
+  return (int)level >= logLevel_.load(std::memory_order_relaxed);
 }
 
-void _logValue(FILE * file, int value)
+void _logSubmit(LogLevel level, std::string && message, bool output)
 {
-  fprintf(file, "%d", value);
-  fprintf(stderr, "%d", value);
+  logger().push(level, std::move(message), output);
 }
 
-void _logValue(FILE * file, uint32_t value)
+template <typename T>
+static void appendFormatted(std::string & out, const char * format, T value)
 {
-  fprintf(file, "%d", value);
-  fprintf(stderr, "%d", value);
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), format, value);
+  out += buffer;
 }
 
-void _logValue(FILE * file, long value)
+void _logValue(std::string & out, char value)
 {
-  fprintf(file, "%ld", value);
-  fprintf(stderr, "%ld", value);
+  out += value;
 }
 
-void _logValue(FILE * file, long long int value)
+void _logValue(std::string & out, int value)
 {
-  fprintf(file, "%lld", value);
-  fprintf(stderr, "%lld", value);
+  appendFormatted(out, "%d", value);
 }
 
-void _logValue(FILE * file, float value)
+void _logValue(std::string & out, uint32_t value)
 {
-  fprintf(file, "%f", value);
-  fprintf(stderr, "%f", value);
+  appendFormatted(out, "%u", value);
 }
 
-void _logValue(FILE * file, double value)
+void _logValue(std::string & out, long value)
 {
-  fprintf(file, "%f", value);
-  fprintf(stderr, "%f", value);
+  appendFormatted(out, "%ld", value);
 }
 
-void _logValue(FILE * file, const char * value)
+void _logValue(std::string & out, long long int value)
 {
-  fprintf(file, "%s", value);
-  fprintf(stderr, "%s", value);
+  appendFormatted(out, "%lld", value);
 }
 
-void _logValue(FILE * file, Str const& value)
+void _logValue(std::string & out, float value)
 {
-  fprintf(file, "%s", value.utf8().c_str());
-  fprintf(stderr, "%s", value.utf8().c_str());
+  appendFormatted(out, "%f", value);
 }
 
-void _logValue(FILE * file, std::string const& value)
+void _logValue(std::string & out, double value)
 {
-  fprintf(file, "%s", value.c_str());
-  fprintf(stderr, "%s", value.c_str());
+  appendFormatted(out, "%f", value);
 }
 
-FILE * _logBegin()
+void _logValue(std::string & out, const char * value)
 {
-  return fopen(logFile().c_str(), "at");
+  out += value;
 }
 
-void _logEnd(FILE * file)
+void _logValue(std::string & out, Str const& value)
 {
-  _logValue(file, "\n");
-  fclose(file);
-  fflush(stderr);
+  out += value.utf8();
 }
 
-void logInfo(Str const& message)
+void _logValue(std::string & out, std::string const& value)
 {
-  FILE * file = fopen(logFile().c_str(), "at");
-  fprintf(file, "INFO: %s\n", message.utf8().c_str());
-  fclose(file);
+  out += value;
 }
 
-void logError(Str const& message)
+void _logValue(std::string & out, StrView value)
 {
-  FILE * file = fopen(logFile().c_str(), "at");
-  fprintf(file, "ERROR: %s\n", message.utf8().c_str());
-  fclose(file);
+  out.append(value.data(), value.size());
 }
@@ -1,44 +1,103 @@
-
 #pragma once
 
 #include "Str.h"
 #include <string>
 
+// Messages below this level are compiled out
+#ifndef ZUM_LOG_LEVEL
+#ifdef DEBUG
+#define ZUM_LOG_LEVEL 0
+#else
+#define ZUM_LOG_LEVEL 1
+#endif
+#endif
+
+enum class LogLevel
+{
+  Debug,
+  Info,
+  Warning,
+  Error
+};
+
+// Messages are formatted by the caller and queued in a fixed size ring buffer, a
+// background thread writes them to the log file and stderr. Debug and info messages
+// never block, when the ring is full they are dropped and counted instead, and past
+// a hundred a second the rest of the second is suppressed. Warnings, errors and the
+// output of scripts are never dropped: they wait for room in a full ring instead, and
+// aren't rate limited.
 void clearLog();
 
-void _logValue(FILE * file, char value);
-void _logValue(FILE * file, int value);
-void _logValue(FILE * file, uint32_t value);
-void _logValue(FILE * file, long value);
-void _logValue(FILE * file, long long int value);
-void _logValue(FILE * file, float value);
-void _logValue(FILE * file, double value);
-void _logValue(FILE * file, const char * value);
-void _logValue(FILE * file, Str const& value);
-void _logValue(FILE * file, std::string const& value);
-FILE * _logBegin();
-void _logEnd(FILE * file);
+// Messages below level are dropped before they are formatted
+void setLogLevel(LogLevel level);
+LogLevel logLevel();
+
+bool _logEnabled(LogLevel level);
+void _logSubmit(LogLevel level, std::string && message, bool output = false);
+
+void _logValue(std::string & out, char value);
+void _logValue(std::string & out, int value);
+void _logValue(std::string & out, uint32_t value);
+void _logValue(std::string & out, long value);
+void _logValue(std::string & out, long long int value);
+void _logValue(std::string & out, float value);
+void _logValue(std::string & out, double value);
+void _logValue(std::string & out, const char * value);
+void _logValue(std::string & out, Str const& value);
+void _logValue(std::string & out, std::string const& value);
+void _logValue(std::string & out, StrView value);
 
 template <typename T, typename ...U>
-void _logValue(FILE * file, T const& t, U ...u)
+void _logValue(std::string & out, T const& t, U const& ...u)
+{
+  _logValue(out, t);
+  _logValue(out, u...);
+}
+
+template <typename ...T>
+void _log(LogLevel level, T const& ...t)
+{
+  if ((int)level < ZUM_LOG_LEVEL || !_logEnabled(level))
+    return;
+
+  std::string message;
+  _logValue(message, t...);
+  _logSubmit(level, std::move(message));
+}
+
+// What a script prints with puts, written like an info message but kept as output: never
+// dropped, rate limited or collapsed with the same message before it
+template <typename ...T>
+void logOutput(T const& ...t)
+{
+  if ((int)LogLevel::Info < ZUM_LOG_LEVEL || !_logEnabled(LogLevel::Info))
+    return;
+
+  std::string message;
+  _logValue(message, t...);
+  _logSubmit(LogLevel::Info, std::move(message), true);
+}
+
+template <typename ...T>
+void logDebug(T const& ...t)
 {
-  _logValue(file, t);
-  _logValue(file, u...);
+  _log(LogLevel::Debug, t...);
 }
 
 template <typename ...T>
 void logInfo(T const& ...t)
 {
-  FILE * file = _logBegin();
-  _logValue(file, t...);
-  _logEnd(file);
+  _log(LogLevel::Info, t...);
+}
+
+template <typename ...T>
+void logWarning(T const& ...t)
+{
+  _log(LogLevel::Warning, t...);
 }
 
 template <typename ...T>
 void logError(T const& ...t)
 {
-  FILE * file = _logBegin();
-  _logValue(file, "Error: ");
-  _logValue(file, t...);
-  _logEnd(file);
+  _log(LogLevel::Error, t...);
 }
@@ -0,0 +1,197 @@
+#include "Lz4.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace lz4 {
+
+  static const std::size_t MIN_MATCH = 4;
+  static const std::size_t MAX_OFFSET = 65535;
+
+  // The format ends every block with literals: the last match starts at least 12
+  // bytes and ends at least 5 bytes before the end
+  static const std::size_t MATCH_START_LIMIT = 12;
+  static const std::size_t LAST_LITERALS = 5;
+
+  static const int HASH_BITS = 16;
+
+  static inline uint32_t read32(const uint8_t * data)
+  {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+  }
+
+  static inline uint32_t hash(uint32_t sequence)
+  {
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+  }
+
+  // Lengths of 15 and more continue in bytes of 255 and a last byte below it
+  static inline uint8_t * writeLength(uint8_t * out, std::size_t length)
+  {
+    for (; length >= 255; length -= 255)
+      *out++ = 255;
+
+    *out++ = (uint8_t)length;
+    return out;
+  }
+
+  static uint8_t * writeSequence(uint8_t * out, const uint8_t * literals, std::size_t literalCount, std::size_t offset, std::size_t matchLength)
+  {
+    uint8_t * token = out++;
+    *token = (uint8_t)((literalCount < 15 ? literalCount : 15) << 4);
+
+    if (literalCount >= 15)
+      out = writeLength(out, literalCount - 15);
+
+    memcpy(out, literals, literalCount);
+    out += literalCount;
+
+    // The block ends with literals only
+    if (matchLength == 0)
+      return out;
+
+    *out++ = (uint8_t)(offset & 0xff);
+    *out++ = (uint8_t)(offset >> 8);
+
+    const std::size_t extra = matchLength - MIN_MATCH;
+    *token |= (uint8_t)(extra < 15 ? extra : 15);
+
+    if (extra >= 15)
+      out = writeLength(out, extra - 15);
+
+    return out;
+  }
+
+  std::size_t bound(std::size_t size)
+  {
+    return size + size / 255 + 16;
+  }
+
+  std::size_t compress(StrView data, char * out)
+  {
+    const uint8_t * begin = reinterpret_cast<const uint8_t *>(data.data());
+    const uint8_t * end = begin + data.size();
+    const uint8_t * anchor = begin;
+    uint8_t * output = reinterpret_cast<uint8_t *>(out);
+
+    if (data.size() > MATCH_START_LIMIT)
+    {
+      // Positions of the last sequence seen with each hash, a miss only costs a compare
+      std::vector<uint32_t> table(1 << HASH_BITS, 0);
+
+      const uint8_t * matchStartLimit = end - MATCH_START_LIMIT;
+      const uint8_t * matchEndLimit = end - LAST_LITERALS;
+      const uint8_t * pos = begin;
+
+      // Data without matches is skipped faster the longer it goes on
+      std::size_t misses = 0;
+
+      while (pos < matchStartLimit)
+      {
+        const uint32_t sequence = read32(pos);
+        uint32_t & entry = table[hash(sequence)];
+        const uint8_t * match = begin + entry;
+        entry = (uint32_t)(pos - begin);
+
+        if (match >= pos || (std::size_t)(pos - match) > MAX_OFFSET || read32(match) != sequence)
+        {
+          pos += 1 + (misses++ >> 6);
+          continue;
+        }
+
+        const uint8_t * matchEnd = pos + MIN_MATCH;
+        const uint8_t * source = match + MIN_MATCH;
+        while (matchEnd < matchEndLimit && *matchEnd == *source)
+        {
+          ++matchEnd;
+          ++source;
+        }
+
+        output = writeSequence(output, anchor, pos - anchor, pos - match, matchEnd - pos);
+        pos = anchor = matchEnd;
+        misses = 0;
+      }
+    }
+
+    output = writeSequence(output, anchor, end - anchor, 0, 0);
+    return output - reinterpret_cast<uint8_t *>(out);
+  }
+
+  static inline bool readLength(const uint8_t *& in, const uint8_t * end, std::size_t & length)
+  {
+    uint8_t byte;
+    do
+    {
+      if (in == end)
+        return false;
+
+      byte = *in++;
+      length += byte;
+    }
+    while (byte == 255);
+
+    return true;
+  }
+
+  bool decompress(StrView data, char * out, std::size_t size)
+  {
+    const uint8_t * in = reinterpret_cast<const uint8_t *>(data.data());
+    const uint8_t * inEnd = in + data.size();
+    uint8_t * begin = reinterpret_cast<uint8_t *>(out);
+    uint8_t * output = begin;
+    uint8_t * outEnd = begin + size;
+
+    while (in < inEnd)
+    {
+      const uint8_t token = *in++;
+
+      std::size_t literalCount = token >> 4;
+      if (literalCount == 15 && !readLength(in, inEnd, literalCount))
+        return false;
+
+      if (literalCount > (std::size_t)(inEnd - in) || literalCount > (std::size_t)(outEnd - output))
+        return false;
+
+      memcpy(output, in, literalCount);
+      output += literalCount;
+      in += literalCount;
+
+      if (in == inEnd)
+        return output == outEnd;
+
+      if (inEnd - in < 2)
+        return false;
+
+      const std::size_t offset = in[0] | (in[1] << 8);
+      in += 2;
+
+      if (offset == 0 || offset > (std::size_t)(output - begin))
+        return false;
+
+      std::size_t matchLength = token & 15;
+      if (matchLength == 15 && !readLength(in, inEnd, matchLength))
+        return false;
+
+      matchLength += MIN_MATCH;
+      if (matchLength > (std::size_t)(outEnd - output))
+        return false;
+
+      // A match closer than its length repeats its first offset bytes. Those are copied in
+      // chunks that start at a multiple of offset and double in size, so no chunk overlaps
+      // the bytes it is copied from.
+      const uint8_t * match = output - offset;
+      for (std::size_t copied = 0; copied < matchLength; copied += offset + copied)
+      {
+        const std::size_t chunk = offset + copied;
+        memcpy(output + copied, match, chunk < matchLength - copied ? chunk : matchLength - copied);
+      }
+
+      output += matchLength;
+    }
+
+    return false;
+  }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "Str.h"
+
+#include <cstddef>
+
+// Compression in the LZ4 block format: runs of literals and back references of at
+// least 4 bytes into the last 64 KB. Fast in both directions, decompressing only
+// copies bytes, so it pays off whenever the disk is slower than a few hundred MB/s.
+namespace lz4 {
+
+  // The most bytes compress() writes for size bytes of input
+  std::size_t bound(std::size_t size);
+
+  // Compresses data into out, which holds at least bound(data.size()) bytes. Returns
+  // the compressed size.
+  std::size_t compress(StrView data, char * out);
+
+  // Decompresses data into out, which holds exactly size bytes. Returns false if data
+  // is corrupt or doesn't decompress to size bytes.
+  bool decompress(StrView data, char * out, std::size_t size);
+}
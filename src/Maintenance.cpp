@@ -0,0 +1,92 @@
+#include "Maintenance.h"
+#include "DocumentState.h"
+#include "Compaction.h"
+#include "Idle.h"
+#include "Tcl.h"
+
+#include <algorithm>
+
+namespace doc {
+
+  // The indexes, sketches and encoded columns edits left stale are built again while the
+  // application is idle when this is set
+  static const tcl::Variable IDLE_MAINTENANCE("doc_idleMaintenance", true);
+
+  // An encoded column an edit left stale, which the filters only build again on their
+  // second scan. One a single scan asked for isn't, it may never be scanned again.
+  static bool encodingStale(Document const& doc, EncodedColumn const& encoded)
+  {
+    return !encoded.blocks_.empty() && (encoded.stale_ || encoded.height_ != doc.height_);
+  }
+
+  static bool needsMaintenance(Document const& doc)
+  {
+    if (doc.loading_ || doc.paged_)
+      return false;
+
+    if (compactionDue(doc))
+      return true;
+
+    for (auto const& index : doc.indexes_)
+      if (index.stale())
+        return true;
+
+    for (auto const& sketch : doc.sketches_)
+      if (!sketchCurrent(doc, sketch))
+        return true;
+
+    if (COLUMN_ENCODING.toBool())
+      for (auto const& encoded : doc.encodings_)
+        if (encodingStale(doc, encoded))
+          return true;
+
+    return false;
+  }
+
+  // Does a step of compacting the current document, or builds one of its indexes,
+  // sketches and encoded columns that edits left stale, so the next filter or colstats
+  // finds it up to date. Returns true while there is more to do.
+  static bool maintainDocument()
+  {
+    Document & doc = currentDoc();
+    if (!needsMaintenance(doc))
+      return false;
+
+    if (compactionDue(doc))
+    {
+      compactStep(doc);
+      return needsMaintenance(doc);
+    }
+
+    for (auto & index : doc.indexes_)
+      if (index.stale())
+      {
+        index.build(doc.cells_, doc.strings_, doc.height_);
+        return needsMaintenance(doc);
+      }
+
+    for (auto & sketch : doc.sketches_)
+      if (!sketchCurrent(doc, sketch))
+      {
+        useColumnSketch(doc, sketch.column_);
+        return needsMaintenance(doc);
+      }
+
+    for (auto & encoded : doc.encodings_)
+      if (encodingStale(doc, encoded))
+      {
+        // Counts as the scan before the one that builds it again
+        encoded.scans_ = std::max(encoded.scans_, 1);
+        encodedColumn(doc, encoded.column_);
+        return needsMaintenance(doc);
+      }
+
+    return false;
+  }
+
+  void scheduleMaintenance()
+  {
+    if (IDLE_MAINTENANCE.toBool() && needsMaintenance(currentDoc()))
+      idle::post("maintenance", maintainDocument);
+  }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+// Idle maintenance of the documents, see Idle.h
+namespace doc {
+
+  // Queues the idle task that builds what edits left stale of the current document, the
+  // column indexes, sketches and encoded columns, and compacts its cells, strings and
+  // tile file once their dead space passes doc_compactThreshold. Cheap when nothing is
+  // to do.
+  void scheduleMaintenance();
+}
@@ -0,0 +1,103 @@
+
+#include "MappedFile.h"
+#include "bx/platform.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+#if BX_PLATFORM_LINUX || BX_PLATFORM_OSX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+bool MappedFile::open(std::string const& filename)
+{
+  close();
+
+#if BX_PLATFORM_LINUX || BX_PLATFORM_OSX
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0)
+  {
+    ::close(fd);
+    return false;
+  }
+
+  if (info.st_size > 0)
+  {
+    void * mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+      ::close(fd);
+      return false;
+    }
+
+    madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+
+    data_ = static_cast<const char *>(mapping);
+    size_ = info.st_size;
+  }
+
+  // The mapping stays valid after the descriptor is closed
+  ::close(fd);
+  return true;
+#else
+  FILE * file = fopen(filename.c_str(), "rb");
+  if (!file)
+    return false;
+
+  fseek(file, 0, SEEK_END);
+  const long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  if (size > 0)
+  {
+    buffer_.resize(size);
+    buffer_.resize(fread(buffer_.data(), 1, size, file));
+
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+  }
+
+  fclose(file);
+  return true;
+#endif
+}
+
+void MappedFile::willNeed(std::size_t offset, std::size_t size) const
+{
+#if BX_PLATFORM_LINUX || BX_PLATFORM_OSX
+  if (offset >= size_ || size == 0)
+    return;
+
+  // The range has to start at a page
+  static const std::size_t pageSize = sysconf(_SC_PAGESIZE);
+  const std::size_t begin = offset - offset % pageSize;
+  const std::size_t end = std::min(offset + size, size_);
+
+  madvise(const_cast<char *>(data_) + begin, end - begin, MADV_WILLNEED);
+#endif
+}
+
+void MappedFile::close()
+{
+#if BX_PLATFORM_LINUX || BX_PLATFORM_OSX
+  if (data_)
+    munmap(const_cast<char *>(data_), size_);
+#endif
+
+  data_ = nullptr;
+  size_ = 0;
+  buffer_.clear();
+  buffer_.shrink_to_fit();
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Str.h"
+
+#include <string>
+#include <vector>
+
+// Read-only content of a whole file. The file is memory mapped where the platform
+// supports it, and read into memory otherwise.
+class MappedFile
+{
+  public:
+    MappedFile() { }
+    ~MappedFile();
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile & operator = (MappedFile const&) = delete;
+
+    bool open(std::string const& filename);
+    void close();
+
+    StrView data() const { return StrView(data_, size_); }
+
+    // Starts reading size bytes from offset on into memory without waiting for them, so
+    // touching them later doesn't stall on the disk. Many files or parts of a file asked
+    // for at once are read side by side. Does nothing where the file is read into memory.
+    void willNeed(std::size_t offset, std::size_t size) const;
+
+  private:
+    const char * data_ = nullptr;
+    std::size_t size_ = 0;
+    std::vector<char> buffer_;
+};
@@ -0,0 +1,145 @@
+#include "Memoize.h"
+#include "DocumentState.h"
+#include "Cache.h"
+#include "Memory.h"
+#include "Tcl.h"
+
+#include <algorithm>
+
+namespace doc {
+
+  // Filters, queries and groupbys keep their results when this is set, at most this many
+  // per document
+  static const tcl::Variable MEMOIZE_RESULTS("doc_memoizeResults", true);
+  static const std::size_t MAX_MEMOIZED_RESULTS = 32;
+
+  static cache::Counters RESULT_COUNTERS("results");
+
+  // Counts the uses of memoized results, the least recently used one goes first
+  static uint64_t resultUses_ = 0;
+
+  // True if a cell of column holds a formula or a column formula fills it
+  static bool columnHasFormulas(Document & doc, int column)
+  {
+    if (doc.paged_)
+      return false;
+
+    if (!doc.columnFormulas_.empty() && findColumnFormula(doc, column))
+      return true;
+
+    bool formulas = false;
+    doc.cells_.forEachFormula(column, 0, doc.height_ - 1, [&formulas] (Index const&, Cell &) { formulas = true; });
+    return formulas;
+  }
+
+  // True if result was computed over the rows the current buffer has from its first row on
+  static bool sameResultInput(MemoizedResult const& result)
+  {
+    Buffer const& buffer = currentBuffer();
+    if (result.view_ != buffer.view_)
+      return false;
+
+    if (!buffer.view_)
+      return true;
+
+    const std::size_t first = std::min<std::size_t>(result.first_, buffer.rows_.size());
+    return buffer.rows_.size() - first == result.inputRows_.size() &&
+           std::equal(result.inputRows_.begin(), result.inputRows_.end(), buffer.rows_.begin() + first);
+  }
+
+  MemoizedResult const* findMemoizedResult(Document & doc, std::string const& key, int first)
+  {
+    if (!MEMOIZE_RESULTS.toBool())
+      return nullptr;
+
+    for (auto & result : doc.results_)
+    {
+      if (result.key_ != key || result.first_ != first || result.stale_ || result.height_ != doc.height_)
+        continue;
+
+      if (result.formulas_ && (result.changes_ != doc.changes_ || result.resets_ != formulaResets()))
+        continue;
+
+      if (!sameResultInput(result))
+        continue;
+
+      result.lastUse_ = ++resultUses_;
+      RESULT_COUNTERS.hit();
+      return &result;
+    }
+
+    RESULT_COUNTERS.miss();
+    return nullptr;
+  }
+
+  MemoizedResult * memoizeResult(Document & doc, std::string const& key, int first, std::vector<int> const& columns)
+  {
+    if (!MEMOIZE_RESULTS.toBool())
+      return nullptr;
+
+    doc.results_.erase(std::remove_if(doc.results_.begin(), doc.results_.end(), [&key, first] (MemoizedResult const& result) {
+      return result.key_ == key && result.first_ == first && (result.stale_ || sameResultInput(result));
+    }), doc.results_.end());
+
+    if (doc.results_.size() >= MAX_MEMOIZED_RESULTS)
+      doc.results_.erase(std::min_element(doc.results_.begin(), doc.results_.end(), [] (MemoizedResult const& lhs, MemoizedResult const& rhs) {
+        return lhs.lastUse_ < rhs.lastUse_;
+      }));
+
+    doc.results_.emplace_back();
+    MemoizedResult & result = doc.results_.back();
+
+    Buffer const& buffer = currentBuffer();
+    result.key_ = key;
+    result.columns_ = columns;
+    result.first_ = first;
+    result.view_ = buffer.view_;
+    if (buffer.view_ && first < (int)buffer.rows_.size())
+      result.inputRows_.assign(buffer.rows_.begin() + first, buffer.rows_.end());
+
+    result.height_ = doc.height_;
+    for (const int column : columns)
+      result.formulas_ = result.formulas_ || columnHasFormulas(doc, column);
+
+    result.changes_ = doc.changes_;
+    result.resets_ = formulaResets();
+    result.lastUse_ = ++resultUses_;
+    return &result;
+  }
+
+  void invalidateMemoizedResults(Document & doc, int column)
+  {
+    for (auto & result : doc.results_)
+      if (column < 0 || std::find(result.columns_.begin(), result.columns_.end(), column) != result.columns_.end())
+        result.stale_ = true;
+  }
+
+  std::size_t memoizedResultBytes(MemoizedResult const& result)
+  {
+    return sizeof(MemoizedResult) + memory::bytes(result.key_) + memory::bytes(result.columns_) + memory::bytes(result.inputRows_) +
+           memory::bytes(result.rows_) + memory::bytes(result.groups_.groups_) + memory::bytes(result.groups_.stats_);
+  }
+
+  // Stale results go first and then the least recently used
+  static const cache::Cache RESULT_CACHE("results", cache::Cost::SCAN, [] () {
+    std::size_t bytes = 0;
+    forEachDocument([&bytes] (Document & doc) {
+      for (auto const& result : doc.results_)
+        bytes += memoizedResultBytes(result);
+    });
+    return bytes;
+  }, [] (std::size_t target) {
+    std::size_t bytes = RESULT_CACHE.bytes_();
+    forEachDocument([&bytes, target] (Document & doc) {
+      std::stable_sort(doc.results_.begin(), doc.results_.end(), [] (MemoizedResult const& lhs, MemoizedResult const& rhs) {
+        return lhs.stale_ != rhs.stale_ ? lhs.stale_ : lhs.lastUse_ < rhs.lastUse_;
+      });
+
+      std::size_t dropped = 0;
+      for (; dropped < doc.results_.size() && bytes > target; ++dropped)
+        bytes -= std::min(bytes, memoizedResultBytes(doc.results_[dropped]));
+
+      doc.results_.erase(doc.results_.begin(), doc.results_.begin() + dropped);
+    });
+  });
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "GroupBy.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Results of filters, queries and groupbys kept on their document for the same command
+// over the same rows to take again, as long as the columns it read didn't change. At
+// most a few are kept per document, the least recently used one makes room, and the
+// results cache of cache::balance() trims them further.
+namespace doc {
+
+  struct Document;
+
+  // The rows a filter or query selected, or the groups of a groupby, for the same command
+  // to take again while the columns it read stay as they were, see findMemoizedResult().
+  // key_ is the canonical form of the command. Edits of one of columns_ make it stale,
+  // like a ColumnLookup, and so does any change while one of them holds formulas.
+  struct MemoizedResult
+  {
+    std::string key_;
+    std::vector<int> columns_;
+
+    // The document rows of the view it was computed over from row first_ on, or empty
+    // for all the rows of the document from first_
+    int first_ = 0;
+    bool view_ = false;
+    std::vector<int> inputRows_;
+
+    bool stale_ = false;
+    int height_ = 0;
+    bool formulas_ = false;
+    uint64_t changes_ = 0;
+    uint64_t resets_ = 0;
+    uint64_t lastUse_ = 0;
+
+    std::vector<int> rows_;
+    groupby::Result groups_;
+  };
+
+  // The result of the command key over the rows of the current buffer from first on,
+  // nullptr if none is kept or the columns it read changed since
+  MemoizedResult const* findMemoizedResult(Document & doc, std::string const& key, int first);
+
+  // Keeps the result of the command key, which the caller fills in, over the rows of the
+  // current buffer from first on. It replaces the one of the same rows that is no longer
+  // current. nullptr with doc_memoizeResults off.
+  MemoizedResult * memoizeResult(Document & doc, std::string const& key, int first, std::vector<int> const& columns);
+
+  // Marks the results that read column as stale, a negative column all of them
+  void invalidateMemoizedResults(Document & doc, int column);
+
+  std::size_t memoizedResultBytes(MemoizedResult const& result);
+}
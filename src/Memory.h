@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <cstddef>
+
+// Estimates of the heap memory held by standard containers, for the memory command.
+// Only what a container allocates itself is counted, not what its elements own.
+namespace memory {
+
+  // Short strings are stored inside the string object and allocate nothing
+  inline std::size_t bytes(std::string const& str)
+  {
+    const char * data = str.data();
+    const bool local = data >= reinterpret_cast<const char *>(&str) && data < reinterpret_cast<const char *>(&str + 1);
+    return local ? 0 : str.capacity() + 1;
+  }
+
+  template <typename T>
+  std::size_t bytes(std::vector<T> const& vector)
+  {
+    return vector.capacity() * sizeof(T);
+  }
+
+  // Allocated in blocks, the block map is left out
+  template <typename T>
+  std::size_t bytes(std::deque<T> const& deque)
+  {
+    return deque.size() * sizeof(T);
+  }
+
+  // A node per element holding the element, the next pointer and the cached hash
+  template <typename K, typename V>
+  std::size_t bytes(std::unordered_map<K, V> const& map)
+  {
+    return map.size() * (sizeof(typename std::unordered_map<K, V>::value_type) + 2 * sizeof(void *)) +
+           map.bucket_count() * sizeof(void *);
+  }
+}
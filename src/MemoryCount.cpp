@@ -0,0 +1,102 @@
+#include "MemoryCount.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Each block allocated by the operator new below has its size in front of it, for delete
+namespace alloc {
+
+  static const std::size_t HEADER = alignof(std::max_align_t) > sizeof(std::size_t) ? alignof(std::max_align_t) : sizeof(std::size_t);
+
+  static std::atomic<long long> count_(0);
+  static std::atomic<long long> bytes_(0);
+  static std::atomic<long long> live_(0);
+  static std::atomic<long long> peak_(0);
+
+  long long count() { return count_.load(); }
+  long long bytes() { return bytes_.load(); }
+  long long live() { return live_.load(); }
+  long long peak() { return peak_.load(); }
+
+  void resetPeak()
+  {
+    peak_.store(live_.load());
+  }
+
+  static void * allocate(std::size_t size)
+  {
+    for (;;)
+    {
+      if (char * block = static_cast<char *>(malloc(size + HEADER)))
+      {
+        *reinterpret_cast<std::size_t *>(block) = size;
+
+        count_.fetch_add(1, std::memory_order_relaxed);
+        bytes_.fetch_add(size, std::memory_order_relaxed);
+        const long long live = live_.fetch_add(size, std::memory_order_relaxed) + size;
+
+        long long peak = peak_.load(std::memory_order_relaxed);
+        while (live > peak && !peak_.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+          ;
+
+        return block + HEADER;
+      }
+
+      // The cache keeps a reserve for the handler to give back, see Cache.h
+      std::new_handler handler = std::get_new_handler();
+      if (!handler)
+        return nullptr;
+
+      handler();
+    }
+  }
+
+  static void release(void * pointer)
+  {
+    if (!pointer)
+      return;
+
+    char * block = static_cast<char *>(pointer) - HEADER;
+    live_.fetch_sub(*reinterpret_cast<std::size_t *>(block), std::memory_order_relaxed);
+    free(block);
+  }
+}
+
+void * operator new(std::size_t size)
+{
+  if (void * pointer = alloc::allocate(size))
+    return pointer;
+
+  throw std::bad_alloc();
+}
+
+void * operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+void * operator new(std::size_t size, std::nothrow_t const&) noexcept
+{
+  try
+  {
+    return alloc::allocate(size);
+  }
+  catch (...)
+  {
+    return nullptr;
+  }
+}
+
+void * operator new[](std::size_t size, std::nothrow_t const& nothrow) noexcept
+{
+  return operator new(size, nothrow);
+}
+
+void operator delete(void * pointer) noexcept { alloc::release(pointer); }
+void operator delete[](void * pointer) noexcept { alloc::release(pointer); }
+void operator delete(void * pointer, std::size_t) noexcept { alloc::release(pointer); }
+void operator delete[](void * pointer, std::size_t) noexcept { alloc::release(pointer); }
+void operator delete(void * pointer, std::nothrow_t const&) noexcept { alloc::release(pointer); }
+void operator delete[](void * pointer, std::nothrow_t const&) noexcept { alloc::release(pointer); }
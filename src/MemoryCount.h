@@ -0,0 +1,17 @@
+#pragma once
+
+// Counts of what the global operator new and delete handle, replaced in MemoryCount.cpp.
+// Only zum_bench_memory links it, so the timings of zum_bench and the app allocate with
+// the plain operator new. Every allocation updates shared counters, from any thread.
+namespace alloc {
+
+  // Allocations and their bytes so far
+  long long count();
+  long long bytes();
+
+  // Bytes held now, and the most held since resetPeak()
+  long long live();
+  long long peak();
+
+  void resetPeak();
+}
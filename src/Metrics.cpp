@@ -0,0 +1,297 @@
+#include "Metrics.h"
+#include "Remote.h"
+#include "Profile.h"
+#include "Scheduler.h"
+#include "Document.h"
+#include "Cache.h"
+#include "Idle.h"
+#include "View.h"
+#include "Tcl.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+namespace metrics {
+
+  // A request longer than this isn't a scrape, and is dropped
+  static const std::size_t MAX_REQUEST = 8 * 1024;
+
+  struct Scrape
+  {
+    std::unique_ptr<remote::Connection> connection_;
+    std::string request_;
+    bool answered_ = false;
+  };
+
+  static remote::Listener listener_;
+  static std::vector<Scrape> scrapes_;
+  static unsigned long long scrapeCount_ = 0;
+
+  bool listen(std::string const& address)
+  {
+    close();
+
+    char * end = nullptr;
+    const long port = strtol(address.c_str(), &end, 10);
+    if (!address.empty() && *end == '\0')
+      return listener_.listenLocal(port);
+
+    return listener_.listen(address);
+  }
+
+  void close()
+  {
+    scrapes_.clear();
+    listener_.close();
+  }
+
+  remote::Listener const& listener()
+  {
+    return listener_;
+  }
+
+  void connections(std::vector<remote::Connection *> & connections)
+  {
+    for (Scrape const& scrape : scrapes_)
+      connections.push_back(scrape.connection_.get());
+  }
+
+  static void answer(Scrape & scrape)
+  {
+    // The request line is the method, the path and the version
+    const std::size_t methodEnd = scrape.request_.find(' ');
+    const std::size_t pathEnd = methodEnd == std::string::npos ? std::string::npos : scrape.request_.find_first_of(" ?\r", methodEnd + 1);
+
+    const std::string method = scrape.request_.substr(0, methodEnd);
+    const std::string path = pathEnd == std::string::npos ? std::string() : scrape.request_.substr(methodEnd + 1, pathEnd - methodEnd - 1);
+
+    std::string status = "200 OK";
+    std::string body;
+
+    if (method != "GET" && method != "HEAD")
+      status = "405 Method Not Allowed";
+    else if (path != "/metrics" && path != "/")
+      status = "404 Not Found";
+    else
+    {
+      scrapeCount_++;
+      body = text();
+    }
+
+    const std::string header = "HTTP/1.1 " + status + "\r\n"
+                               "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                               "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                               "Connection: close\r\n\r\n";
+
+    scrape.connection_->write(header.data(), header.size());
+    if (method != "HEAD")
+      scrape.connection_->write(body.data(), body.size());
+
+    scrape.answered_ = true;
+  }
+
+  void update()
+  {
+    if (listener_.fd() < 0)
+      return;
+
+    while (std::unique_ptr<remote::Connection> connection = listener_.accept())
+    {
+      scrapes_.emplace_back();
+      scrapes_.back().connection_ = std::move(connection);
+    }
+
+    for (auto it = scrapes_.begin(); it != scrapes_.end(); )
+    {
+      bool connected = it->connection_->receive();
+
+      if (!it->answered_)
+      {
+        it->connection_->takeInput(it->request_);
+        if (it->request_.find("\r\n\r\n") != std::string::npos)
+          answer(*it);
+        else if (it->request_.size() > MAX_REQUEST)
+          connected = false;
+      }
+
+      // The connection closes once the answer is written
+      connected = it->connection_->flush() && connected;
+      if (connected && !(it->answered_ && !it->connection_->hasOutput()))
+        ++it;
+      else
+        it = scrapes_.erase(it);
+    }
+  }
+
+  // Appends the samples of a metric after its help and type lines
+  class Writer
+  {
+    public:
+      void metric(const char * name, const char * type, const char * help)
+      {
+        text_ += std::string("# HELP ") + name + " " + help + "\n";
+        text_ += std::string("# TYPE ") + name + " " + type + "\n";
+      }
+
+      void sample(const char * name, std::string const& labels, double value)
+      {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%.9g", value);
+
+        text_ += name;
+        if (!labels.empty())
+          text_ += "{" + labels + "}";
+
+        text_ += " ";
+        text_ += buffer;
+        text_ += "\n";
+      }
+
+      void sample(const char * name, std::string const& labels, unsigned long long value)
+      {
+        text_ += name;
+        if (!labels.empty())
+          text_ += "{" + labels + "}";
+
+        text_ += " " + std::to_string(value) + "\n";
+      }
+
+      std::string const& text() const { return text_; }
+
+    private:
+      std::string text_;
+  };
+
+  static std::string label(const char * name, std::string const& value)
+  {
+    std::string result = std::string(name) + "=\"";
+    for (const char c : value)
+    {
+      if (c == '\\' || c == '"')
+        result += '\\';
+
+      if (c == '\n')
+        result += "\\n";
+      else
+        result += c;
+    }
+
+    return result + "\"";
+  }
+
+  std::string text()
+  {
+    Writer out;
+
+    out.metric("zum_zone_duration_seconds", "histogram", "Wall clock time of the profiled subsystems, evaluate is recalculation");
+    for (int i = 0; i < (int)profile::Zone::COUNT; ++i)
+    {
+      const profile::ZoneHistogram histogram = profile::histogram((profile::Zone)i);
+      const std::string zone = label("zone", profile::zoneName((profile::Zone)i));
+
+      unsigned long long count = 0;
+      for (int bucket = 0; bucket < profile::HISTOGRAM_BUCKETS; ++bucket)
+      {
+        char bound[32];
+        snprintf(bound, sizeof(bound), "%g", profile::HISTOGRAM_BOUNDS[bucket] / 1000.0);
+
+        count += histogram.buckets_[bucket];
+        out.sample("zum_zone_duration_seconds_bucket", zone + "," + label("le", bound), count);
+      }
+
+      out.sample("zum_zone_duration_seconds_bucket", zone + "," + label("le", "+Inf"), (unsigned long long)histogram.count_);
+      out.sample("zum_zone_duration_seconds_sum", zone, histogram.sum_ / 1000.0);
+      out.sample("zum_zone_duration_seconds_count", zone, (unsigned long long)histogram.count_);
+    }
+
+    Scheduler & scheduler = Scheduler::shared();
+    const Scheduler::Counters counters = scheduler.counters();
+
+    out.metric("zum_scheduler_threads", "gauge", "Worker threads of the task scheduler");
+    out.sample("zum_scheduler_threads", "", (unsigned long long)scheduler.threadCount());
+    out.metric("zum_scheduler_tasks_total", "counter", "Tasks the workers ran");
+    out.sample("zum_scheduler_tasks_total", "", (unsigned long long)counters.tasksRun_);
+    out.metric("zum_scheduler_steals_total", "counter", "Tasks a worker took from the deque of another");
+    out.sample("zum_scheduler_steals_total", "", (unsigned long long)counters.steals_);
+    out.metric("zum_scheduler_idle_seconds_total", "counter", "Time the workers waited for tasks");
+    out.sample("zum_scheduler_idle_seconds_total", "", counters.idleMilliseconds_ / 1000.0);
+    out.metric("zum_scheduler_pending_tasks", "gauge", "Tasks queued or running");
+    out.sample("zum_scheduler_pending_tasks", "", (unsigned long long)counters.pending_);
+    out.metric("zum_scheduler_pending_completions", "gauge", "Finished tasks waiting for the main thread");
+    out.sample("zum_scheduler_pending_completions", "", (unsigned long long)counters.completions_);
+
+    out.metric("zum_events_queued", "gauge", "Keys and resizes of the clients not handled yet");
+    out.sample("zum_events_queued", "", (unsigned long long)view::queuedEvents());
+    out.metric("zum_idle_tasks", "gauge", "Tasks waiting for the application to be idle");
+    out.sample("zum_idle_tasks", "", (unsigned long long)idle::size());
+
+    const std::vector<cache::Stats> caches = cache::stats();
+
+    out.metric("zum_cache_budget_bytes", "gauge", "Bytes the caches may hold together");
+    out.sample("zum_cache_budget_bytes", "", (unsigned long long)cache::budget());
+    out.metric("zum_cache_bytes", "gauge", "Bytes held by each cache");
+    for (auto const& it : caches)
+      out.sample("zum_cache_bytes", label("cache", it.name_), (unsigned long long)it.bytes_);
+
+    out.metric("zum_cache_hits_total", "counter", "Lookups a cache answered from what it held");
+    for (auto const& it : caches)
+      out.sample("zum_cache_hits_total", label("cache", it.name_), (unsigned long long)it.hits_);
+
+    out.metric("zum_cache_misses_total", "counter", "Lookups that made the entry of a cache");
+    for (auto const& it : caches)
+      out.sample("zum_cache_misses_total", label("cache", it.name_), (unsigned long long)it.misses_);
+
+    out.metric("zum_buffers", "gauge", "Open buffers");
+    out.sample("zum_buffers", "", (unsigned long long)doc::getOpenBufferCount());
+    out.metric("zum_buffer_bytes", "gauge", "Bytes held by each part of a buffer");
+    for (int i = 0; i < doc::getOpenBufferCount(); ++i)
+      for (auto const& part : doc::memoryUsage(i))
+        out.sample("zum_buffer_bytes", label("buffer", std::to_string(i)) + "," + label("part", part.first), (unsigned long long)part.second);
+
+    out.metric("zum_view_bytes", "gauge", "Bytes held by the view for its frames");
+    out.sample("zum_view_bytes", "", (unsigned long long)view::memoryUsage());
+    out.metric("zum_tcl_bytes", "gauge", "Bytes held by the Tcl interpreter");
+    out.sample("zum_tcl_bytes", "", (unsigned long long)tcl::memoryUsage());
+
+    const std::vector<view::ClientStats> clients = view::clientStats();
+
+    out.metric("zum_clients", "gauge", "Clients attached to the served view");
+    out.sample("zum_clients", "", (unsigned long long)clients.size());
+    out.metric("zum_client_frames_total", "counter", "Frames sent to a client");
+    for (auto const& client : clients)
+      out.sample("zum_client_frames_total", label("client", std::to_string(client.id)), (unsigned long long)client.frames);
+
+    out.metric("zum_client_sent_bytes_total", "counter", "Bytes of the frames written to a client");
+    for (auto const& client : clients)
+      out.sample("zum_client_sent_bytes_total", label("client", std::to_string(client.id)), (unsigned long long)client.bytesSent);
+
+    out.metric("zum_client_received_bytes_total", "counter", "Bytes of the keys and sizes a client sent");
+    for (auto const& client : clients)
+      out.sample("zum_client_received_bytes_total", label("client", std::to_string(client.id)), (unsigned long long)client.bytesReceived);
+
+    out.metric("zum_client_queued_bytes", "gauge", "Bytes waiting for a slow client to take them");
+    for (auto const& client : clients)
+      out.sample("zum_client_queued_bytes", label("client", std::to_string(client.id)), (unsigned long long)client.queuedBytes);
+
+    out.metric("zum_client_cells", "gauge", "Cells of the terminal of a client");
+    for (auto const& client : clients)
+      out.sample("zum_client_cells", label("client", std::to_string(client.id)), (unsigned long long)client.width * client.height);
+
+    out.metric("zum_scrapes_total", "counter", "Scrapes of the metrics answered");
+    out.sample("zum_scrapes_total", "", scrapeCount_);
+
+    return out.text();
+  }
+}
+
+namespace tcl {
+  TCL_FUNC(metrics, "", "Returns the metrics a scrape of a served zum gets, in the Prometheus text format")
+  {
+    TCL_CHECK_ARG(1);
+
+    const std::string text = metrics::text();
+    Jim_SetResult(interp, Jim_NewStringObj(interp, text.data(), text.size()));
+    return JIM_OK;
+  }
+}
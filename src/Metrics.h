@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace remote {
+  class Listener;
+  class Connection;
+}
+
+// The counters of the profiled zones, the scheduler, the idle tasks, the caches, the
+// buffers' memory and the attached clients of a served view, in the Prometheus text
+// format. A scrape is an HTTP GET of /metrics answered by the served view while it waits
+// for events, and the text is only made for a scrape, so without one the counters cost
+// an increment each.
+// Main thread only.
+namespace metrics {
+
+  // Answers scrapes at address, a port of the loopback interface or else the path of a
+  // Unix socket. Returns false if it can't listen there.
+  bool listen(std::string const& address);
+  void close();
+
+  // What the served view waits on
+  remote::Listener const& listener();
+  void connections(std::vector<remote::Connection *> & connections);
+
+  // Takes the scrapes that connected and answers the ones whose request arrived
+  void update();
+
+  std::string text();
+}
@@ -0,0 +1,383 @@
+#include "Document.h"
+#include "Expression.h"
+#include "Jit.h"
+#include "Tokenizer.h"
+#include "MurmurHash.h"
+#include "Index.h"
+#include "Str.h"
+#include "Tcl.h"
+#include "Log.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Microbenchmarks of the primitives that run per cell, many of them per frame. Each one
+// runs a batch of operations in a loop: it is warmed up first, the batch is sized so a
+// repetition takes about REPETITION_TIME, and the nanoseconds per operation of every
+// repetition go into the statistics. Human readable lines go to stderr, JSON to stdout:
+//
+//   zum_micro [--repetitions count] [name filter]
+
+static const int DEFAULT_REPETITIONS = 15;
+static const double REPETITION_TIME = 0.02;
+static const double WARMUP_TIME = 0.05;
+
+// Operations of the fixtures, the benchmarks cycle through them
+static const int FIXTURE_SIZE = 1024;
+
+// Rows evaluateRows() computes at once
+static const int ROW_BLOCK = 1024;
+
+static const char * FORMULAS[] = {
+  "A1+1",
+  "B2*C2-D2",
+  "SUM(A1:A100)",
+  "MAX(A1, B1)*2+ABS(C3)",
+  "A1/4+B1*C1-FLOOR(D1)",
+};
+
+static const int FORMULA_COUNT = sizeof(FORMULAS) / sizeof(FORMULAS[0]);
+
+// Does count operations, returns something derived from them so they aren't dropped
+typedef std::function<double (long long count)> MicroFunc;
+
+struct MicroResult
+{
+  std::string name_;
+  long long batch_;
+  int repetitions_;
+  double min_;
+  double median_;
+  double mean_;
+  double stddev_;
+};
+
+static std::vector<MicroResult> results_;
+static std::string filter_;
+static int repetitions_ = DEFAULT_REPETITIONS;
+
+static volatile double sink_ = 0.0;
+
+static double seconds()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double timeBatch(MicroFunc const& func, long long count)
+{
+  const double start = seconds();
+  sink_ = sink_ + func(count);
+  return seconds() - start;
+}
+
+static void run(std::string const& name, MicroFunc const& func)
+{
+  if (!filter_.empty() && name.find(filter_) == std::string::npos)
+    return;
+
+  // Doubles the batch until it takes long enough to time, which warms up too
+  long long batch = 1;
+  double warmup = 0.0;
+  for (;;)
+  {
+    const double elapsed = timeBatch(func, batch);
+    warmup += elapsed;
+
+    if (elapsed >= REPETITION_TIME)
+      break;
+
+    batch = elapsed > 0.0 && elapsed * 4 > REPETITION_TIME ? (long long)(batch * REPETITION_TIME / elapsed) + 1 : batch * 2;
+  }
+
+  while (warmup < WARMUP_TIME)
+    warmup += timeBatch(func, batch);
+
+  std::vector<double> samples;
+  for (int i = 0; i < repetitions_; ++i)
+    samples.push_back(timeBatch(func, batch) * 1e9 / batch);
+
+  std::sort(samples.begin(), samples.end());
+
+  double mean = 0.0;
+  for (double sample : samples)
+    mean += sample;
+  mean /= samples.size();
+
+  double variance = 0.0;
+  for (double sample : samples)
+    variance += (sample - mean) * (sample - mean);
+
+  const double stddev = samples.size() > 1 ? std::sqrt(variance / (samples.size() - 1)) : 0.0;
+  const double median = samples.size() % 2 ? samples[samples.size() / 2] : (samples[samples.size() / 2 - 1] + samples[samples.size() / 2]) / 2.0;
+
+  results_.push_back({ name, batch, repetitions_, samples.front(), median, mean, stddev });
+  fprintf(stderr, "%-24s %10.2f ns  median %10.2f ns  +- %6.2f%%\n", name.c_str(), samples.front(), median, mean > 0.0 ? stddev * 100.0 / mean : 0.0);
+}
+
+static void printResults()
+{
+  printf("{\n  \"microbenchmarks\": [\n");
+
+  for (std::size_t i = 0; i < results_.size(); ++i)
+  {
+    MicroResult const& result = results_[i];
+    printf("    { \"name\": \"%s\", \"batch\": %lld, \"repetitions\": %d, \"min_ns\": %.3f, \"median_ns\": %.3f, \"mean_ns\": %.3f, \"stddev_ns\": %.3f }%s\n",
+           result.name_.c_str(), result.batch_, result.repetitions_, result.min_, result.median_, result.mean_, result.stddev_,
+           i + 1 < results_.size() ? "," : "");
+  }
+
+  printf("  ]\n}\n");
+}
+
+static void benchIndex()
+{
+  std::vector<Index> indices;
+  std::vector<std::string> names;
+
+  for (int i = 0; i < FIXTURE_SIZE; ++i)
+  {
+    indices.push_back(Index((i * 37) % 800, (i * 7919) % 1000000));
+    names.push_back(indices.back().toStr());
+  }
+
+  run("index_to_str", [&] (long long count) {
+    double sum = 0.0;
+    for (long long i = 0; i < count; ++i)
+      sum += indices[i % FIXTURE_SIZE].toStr().size();
+    return sum;
+  });
+
+  run("index_format", [&] (long long count) {
+    char buffer[Index::MAX_NAME_LENGTH];
+    double sum = 0.0;
+    for (long long i = 0; i < count; ++i)
+      sum += indices[i % FIXTURE_SIZE].format(buffer);
+    return sum;
+  });
+
+  run("index_from_str", [&] (long long count) {
+    double sum = 0.0;
+    for (long long i = 0; i < count; ++i)
+    {
+      std::string const& name = names[i % FIXTURE_SIZE];
+      sum += Index::fromStr(name.data(), name.size()).y;
+    }
+    return sum;
+  });
+
+  run("column_to_str", [&] (long long count) {
+    double sum = 0.0;
+    for (long long i = 0; i < count; ++i)
+      sum += Index::columnToStr(indices[i % FIXTURE_SIZE].x).size();
+    return sum;
+  });
+}
+
+static void benchStr()
+{
+  // ASCII, as most cells are, and some with characters outside it
+  std::vector<std::string> texts;
+  for (int i = 0; i < FIXTURE_SIZE; ++i)
+    texts.push_back(i % 4 == 3 ? "Malmö " + std::to_string(i) + " €" : "value " + std::to_string(i * 31));
+
+  std::vector<Str> strs(texts.begin(), texts.end());
+
+  run("str_construct", [&] (long long count) {
+    double sum = 0.0;
+    for (long long i = 0; i < count; ++i)
+      sum += Str(texts[i % FIXTURE_SIZE]).size();
+    return sum;
+  });
+
+  run("str_utf8", [&] (long long count) {
+    double sum = 0.0;
+    for (long long i = 0; i < count; ++i)
+      sum += strs[i % FIXTURE_SIZE].utf8().size();
+    return sum;
+  });
+
+  run("str_to_utf32", [&] (long long count) {
+    uint32_t buffer[64];
+    double sum = 0.0;
+    for (long long i = 0; i < count; ++i)
+      sum += str::toUTF32(StrView(texts[i % FIXTURE_SIZE]), buffer, 64);
+    return sum;
+  });
+
+  std::vector<double> values;
+  std::vector<std::string> numbers;
+  for (int i = 0; i < FIXTURE_SIZE; ++i)
+  {
+    values.push_back((i * 7919) % 100000 / 100.0);
+    numbers.push_back(str::fromDouble(values.back()));
+  }
+
+  run("format_double", [&] (long long count) {
+    char buffer[str::FORMAT_SIZE];
+    double sum = 0.0;
+    for (long long i = 0; i < count; ++i)
+      sum += str::formatDouble(values[i % FIXTURE_SIZE], buffer);
+    return sum;
+  });
+
+  run("parse_number", [&] (long long count) {
+    double sum = 0.0;
+    for (long long i = 0; i < count; ++i)
+    {
+      double value = 0.0;
+      str::parseNumber(StrView(numbers[i % FIXTURE_SIZE]), value);
+      sum += value;
+    }
+    return sum;
+  });
+}
+
+static void benchExpressions()
+{
+  std::vector<std::string> formulas(FORMULAS, FORMULAS + FORMULA_COUNT);
+  std::vector<Program> programs;
+
+  for (std::string const& formula : formulas)
+  {
+    programs.push_back(compileExpression(parseExpression(formula)));
+    if (programs.back().empty())
+    {
+      fprintf(stderr, "Could not compile %s\n", formula.c_str());
+      exit(1);
+    }
+  }
+
+  run("tokenize", [&] (long long count) {
+    double sum = 0.0;
+    for (long long i = 0; i < count; ++i)
+    {
+      Tokenizer tokenizer(formulas[i % FORMULA_COUNT]);
+      while (tokenizer.next() != Token::EndOfFile)
+        sum += 1.0;
+    }
+    return sum;
+  });
+
+  run("parse_expression", [&] (long long count) {
+    double sum = 0.0;
+    for (long long i = 0; i < count; ++i)
+      sum += parseExpression(formulas[i % FORMULA_COUNT]).size();
+    return sum;
+  });
+
+  run("compile_expression", [&] (long long count) {
+    std::vector<std::vector<Expr>> parsed;
+    for (std::string const& formula : formulas)
+      parsed.push_back(parseExpression(formula));
+
+    double sum = 0.0;
+    for (long long i = 0; i < count; ++i)
+      sum += compileExpression(parsed[i % FORMULA_COUNT]).empty() ? 0.0 : 1.0;
+    return sum;
+  });
+
+  // The references read the numbers of the document
+  run("evaluate", [&] (long long count) {
+    double sum = 0.0;
+    for (long long i = 0; i < count; ++i)
+      sum += evaluate(programs[i % FORMULA_COUNT], Index(0, (int)(i % 64)));
+    return sum;
+  });
+
+  // B2*C2-D2 is a row program, the columns are what it reads of a block of rows
+  Program rowProgram = compileExpression(parseExpression("B1*C1-D1"));
+  std::vector<std::vector<double>> columns(4, std::vector<double>(ROW_BLOCK));
+  for (int x = 0; x < 4; ++x)
+    for (int y = 0; y < ROW_BLOCK; ++y)
+      columns[x][y] = x * 1000 + y;
+
+  const double * columnData[4] = { columns[0].data(), columns[1].data(), columns[2].data(), columns[3].data() };
+  std::vector<double> out(ROW_BLOCK);
+
+  run("evaluate_rows", [&] (long long count) {
+    double sum = 0.0;
+    for (long long i = 0; i < count; i += ROW_BLOCK)
+    {
+      evaluateRows(rowProgram, columnData, ROW_BLOCK, out.data());
+      sum += out[i % ROW_BLOCK];
+    }
+    return sum;
+  });
+
+  // The same program compiled, where the emitter is there
+  if (jit::RowFunction rowFunction = jit::compile(rowProgram))
+  {
+    run("evaluate_rows_jit", [&] (long long count) {
+      double sum = 0.0;
+      for (long long i = 0; i < count; i += ROW_BLOCK)
+      {
+        rowFunction(columnData, ROW_BLOCK, out.data());
+        sum += out[i % ROW_BLOCK];
+      }
+      return sum;
+    });
+  }
+}
+
+static void benchHashes()
+{
+  std::vector<std::string> keys;
+  for (int i = 0; i < FIXTURE_SIZE; ++i)
+    keys.push_back("key " + std::to_string(i * 104729));
+
+  run("murmur_hash", [&] (long long count) {
+    double sum = 0.0;
+    for (long long i = 0; i < count; ++i)
+    {
+      std::string const& key = keys[i % FIXTURE_SIZE];
+      sum += murmurHash(key.data(), key.size(), 0) & 0xFF;
+    }
+    return sum;
+  });
+
+  run("murmur_mix64", [&] (long long count) {
+    double sum = 0.0;
+    for (long long i = 0; i < count; ++i)
+      sum += murmurMix64(Index((int)(i & 1023), (int)(i >> 10)).key()) & 0xFF;
+    return sum;
+  });
+}
+
+int main(int argc, char * argv[])
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc)
+      repetitions_ = std::max(1, atoi(argv[++i]));
+    else
+      filter_ = argv[i];
+  }
+
+  setLogLevel(LogLevel::Error);
+
+  tcl::initialize();
+  doc::createDefaultEmpty();
+
+  // Numbers for the references of the formulas to read
+  for (int y = 0; y < 200; ++y)
+    for (int x = 0; x < 4; ++x)
+      doc::setCellText(Index(x, y), std::to_string(y * 4 + x));
+
+  benchIndex();
+  benchStr();
+  benchExpressions();
+  benchHashes();
+
+  printResults();
+
+  doc::shutdown();
+  tcl::shutdown();
+  return 0;
+}
@@ -3,4 +3,16 @@
 
 #include <stdint.h>
 
-uint32_t murmurHash(void const * key, int len, uint32_t seed);
\ No newline at end of file
+uint32_t murmurHash(void const * key, int len, uint32_t seed);
+
+// Finalizer of MurmurHash3, every bit of key affects every bit of the result. Used to
+// hash packed keys whose low bits alone, like those of a cell index, cluster badly.
+inline uint64_t murmurMix64(uint64_t key)
+{
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdull;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ull;
+  key ^= key >> 33;
+  return key;
+}
@@ -0,0 +1,871 @@
+#include "PagedTable.h"
+#include "ArrowTable.h"
+#include "Cache.h"
+#include "ParquetTable.h"
+#include "CsvScanner.h"
+#include "FileWriter.h"
+#include "Memory.h"
+#include "Scheduler.h"
+
+#include "bx/thread.h"
+#include "bx/mutex.h"
+
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+#include <sys/stat.h>
+
+// Lookups of the page cache, which Document.cpp registers
+static cache::Counters PAGE_COUNTERS("pages");
+
+// A sidecar is the header, the page offsets and then the zones of every column of every
+// ZONE_ROWS rows, all in the byte order of the machine that wrote it. Version 2 has the
+// lines of RFC 4180, the first split lines at every line break.
+static const char SIDECAR_MAGIC[4] = { 'Z', 'I', 'D', 'X' };
+static const uint32_t SIDECAR_VERSION = 2;
+static const uint32_t SIDECAR_ENDIAN_MARK = 0x01020304;
+
+struct SidecarHeader
+{
+  char magic_[4];
+  uint32_t version_;
+  uint32_t byteOrder_;
+  uint32_t delimiter_;
+  int64_t fileSize_;
+  int64_t fileTime_;
+  uint32_t rows_;
+  uint32_t columns_;
+  uint64_t pageCount_;
+  uint64_t zoneBlocks_;
+};
+
+struct SidecarZone
+{
+  int32_t fields_;
+  int32_t numbers_;
+  double min_;
+  double max_;
+  uint32_t text_;
+  uint32_t reserved_;
+};
+
+// What the indexer found so far, taken over by update()
+struct PagedTable::State
+{
+  bx::Mutex mutex_;
+  bx::Thread thread_;
+  std::atomic<bool> quit_;
+
+  std::vector<std::size_t> pageOffsets_;
+  std::size_t indexed_ = 0;
+  int rows_ = 0;
+  int columns_ = 0;
+  bool done_ = false;
+
+  // Handed over once done
+  std::vector<Zone> zones_;
+  std::vector<std::vector<Zone>> blockZones_;
+
+  State() : quit_(false) { }
+};
+
+// Pages split on the scheduler ahead of being looked at. pending_ is only touched by the
+// owner of the table, the tasks hand their pages over in ready_.
+struct PagedTable::ReadAhead
+{
+  std::mutex mutex_;
+  std::vector<Page> ready_;
+  std::vector<int> pending_;
+
+  // Destroyed first, waiting for the tasks still splitting pages
+  TaskGroup tasks_;
+};
+
+PagedTable::PagedTable()
+{ }
+
+PagedTable::~PagedTable()
+{
+  if (state_)
+  {
+    state_->quit_ = true;
+    state_->thread_.shutdown();
+  }
+}
+
+bool PagedTable::open(std::string const& filename, char delimiter, bool sidecar)
+{
+  if (!sidecar)
+    return start(filename, delimiter, false, false);
+
+  struct stat info;
+  if (stat(filename.c_str(), &info) != 0)
+    return false;
+
+  sidecar_ = filename;
+  fileSize_ = info.st_size;
+  fileTime_ = info.st_mtime;
+  delimiter_ = delimiter;
+
+  if (readSidecar())
+    return file_.open(filename);
+
+  return start(filename, delimiter, false, false);
+}
+
+bool PagedTable::readSidecar()
+{
+  MappedFile file;
+  if (!file.open(sidecarName(sidecar_)))
+    return false;
+
+  const StrView data = file.data();
+  if (data.size() < sizeof(SidecarHeader))
+    return false;
+
+  SidecarHeader header;
+  memcpy(&header, data.data(), sizeof(header));
+
+  if (memcmp(header.magic_, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC)) != 0 || header.version_ != SIDECAR_VERSION ||
+      header.byteOrder_ != SIDECAR_ENDIAN_MARK || header.delimiter_ != (uint8_t)delimiter_ ||
+      header.fileSize_ != fileSize_ || header.fileTime_ != fileTime_ || header.pageCount_ == 0)
+    return false;
+
+  const uint64_t offsetsSize = header.pageCount_ * sizeof(uint64_t);
+  const uint64_t zonesSize = header.zoneBlocks_ * header.columns_ * sizeof(SidecarZone);
+  if (header.pageCount_ > data.size() / sizeof(uint64_t) || sizeof(header) + offsetsSize + zonesSize != data.size())
+    return false;
+
+  const char * read = data.data() + sizeof(header);
+
+  pageOffsets_.resize(header.pageCount_);
+  for (auto & offset : pageOffsets_)
+  {
+    uint64_t value;
+    memcpy(&value, read, sizeof(value));
+    read += sizeof(value);
+
+    if (value > (uint64_t)fileSize_)
+      return false;
+
+    offset = value;
+  }
+
+  blockZones_.assign(header.zoneBlocks_, std::vector<Zone>(header.columns_));
+  for (auto & block : blockZones_)
+    for (auto & zone : block)
+    {
+      SidecarZone stored;
+      memcpy(&stored, read, sizeof(stored));
+      read += sizeof(stored);
+
+      zone.fields = stored.fields_;
+      zone.numbers = stored.numbers_;
+      zone.min = stored.min_;
+      zone.max = stored.max_;
+      zone.text = stored.text_ != 0;
+    }
+
+  indexed_ = fileSize_;
+  rows_ = header.rows_;
+  columns_ = header.columns_;
+  return true;
+}
+
+void PagedTable::writeSidecar() const
+{
+  // A file that changed while it was indexed gets a sidecar once it is indexed again
+  struct stat info;
+  if (stat(sidecar_.c_str(), &info) != 0 || info.st_size != fileSize_ || info.st_mtime != fileTime_)
+    return;
+
+  SidecarHeader header;
+  memcpy(header.magic_, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC));
+  header.version_ = SIDECAR_VERSION;
+  header.byteOrder_ = SIDECAR_ENDIAN_MARK;
+  header.delimiter_ = (uint8_t)delimiter_;
+  header.fileSize_ = fileSize_;
+  header.fileTime_ = fileTime_;
+  header.rows_ = rows_;
+  header.columns_ = columns_;
+  header.pageCount_ = pageOffsets_.size();
+  header.zoneBlocks_ = blockZones_.size();
+
+  // Written next to the sidecar and moved over it, so a reader never sees half of one
+  const std::string filename = sidecarName(sidecar_);
+  const std::string temporary = filename + ".tmp";
+
+  FileWriter writer;
+  if (!writer.open(temporary))
+    return;
+
+  writer.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+  for (const std::size_t offset : pageOffsets_)
+  {
+    const uint64_t value = offset;
+    writer.write(reinterpret_cast<const char *>(&value), sizeof(value));
+  }
+
+  for (auto const& block : blockZones_)
+    for (int column = 0; column < columns_; ++column)
+    {
+      const Zone zone = (std::size_t)column < block.size() ? block[column] : Zone();
+      const SidecarZone stored = { zone.fields, zone.numbers, zone.min, zone.max, zone.text ? 1u : 0u, 0 };
+      writer.write(reinterpret_cast<const char *>(&stored), sizeof(stored));
+    }
+
+  if (!writer.close() || rename(temporary.c_str(), filename.c_str()) != 0)
+    remove(temporary.c_str());
+}
+
+bool PagedTable::open(std::vector<std::string> const& filenames, char delimiter)
+{
+  for (std::size_t i = 0; i < filenames.size(); ++i)
+  {
+    std::unique_ptr<PagedTable> partition(new PagedTable());
+    if (!partition->start(filenames[i], delimiter, i > 0, true))
+    {
+      partitions_.clear();
+      return false;
+    }
+
+    partitions_.push_back(std::move(partition));
+  }
+
+  delimiter_ = delimiter;
+  indexing_ = !partitions_.empty();
+  return indexing_;
+}
+
+bool PagedTable::start(std::string const& filename, char delimiter, bool skipHeader, bool zones)
+{
+  if (!file_.open(filename))
+    return false;
+
+  if (skipHeader)
+  {
+    const std::size_t newline = file_.data().find('\n');
+    skip_ = newline == StrView::npos ? file_.data().size() : newline + 1;
+  }
+
+  delimiter_ = delimiter;
+  buildZones_ = zones;
+  pageOffsets_.assign(1, 0);
+
+  state_.reset(new State());
+  state_->thread_.init(threadMain, this);
+  indexing_ = true;
+
+  return true;
+}
+
+bool PagedTable::openColumnar(std::string const& filename, std::string & error)
+{
+  MappedFile file;
+  if (!file.open(filename))
+  {
+    error = "could not open the file";
+    return false;
+  }
+
+  if (ParquetTable::isParquet(file.data()))
+  {
+    std::unique_ptr<ParquetTable> table(new ParquetTable());
+    if (!table->open(filename, error))
+      return false;
+
+    rows_ = table->rowCount();
+    columns_ = table->columnCount();
+    parquet_ = std::move(table);
+    return true;
+  }
+
+  std::unique_ptr<ArrowTable> table(new ArrowTable());
+  if (!table->open(filename, error))
+    return false;
+
+  rows_ = table->rowCount();
+  columns_ = table->columnCount();
+  arrow_ = std::move(table);
+  return true;
+}
+
+bool PagedTable::isColumnar(StrView data)
+{
+  return ArrowTable::isArrow(data) || ParquetTable::isParquet(data);
+}
+
+int PagedTable::progress() const
+{
+  if (!partitions_.empty())
+  {
+    int progress = 0;
+    for (auto const& partition : partitions_)
+      progress += partition->progress();
+
+    return progress / (int)partitions_.size();
+  }
+
+  return (int)(indexed_ * 100 / std::max<std::size_t>(data().size(), 1));
+}
+
+bool PagedTable::updatePartitions()
+{
+  const int rows = rows_;
+  const int columns = columns_;
+
+  for (auto & partition : partitions_)
+    partition->update();
+
+  // A partition is placed once every partition before it is indexed
+  partitionRows_.clear();
+  rows_ = 0;
+  indexing_ = false;
+
+  for (auto const& partition : partitions_)
+  {
+    if (!indexing_)
+    {
+      partitionRows_.push_back(rows_);
+      rows_ += partition->rowCount();
+    }
+
+    columns_ = std::max(columns_, partition->columnCount());
+    indexing_ = indexing_ || partition->indexing();
+  }
+
+  return rows_ != rows || columns_ != columns || !indexing_;
+}
+
+bool PagedTable::update()
+{
+  if (!indexing_)
+    return false;
+
+  if (!partitions_.empty())
+    return updatePartitions();
+
+  const int rows = rows_;
+  const int columns = columns_;
+  bool done;
+  int filledRows;
+
+  {
+    bx::MutexScope lock(state_->mutex_);
+
+    pageOffsets_.insert(pageOffsets_.end(), state_->pageOffsets_.begin(), state_->pageOffsets_.end());
+    state_->pageOffsets_.clear();
+
+    indexed_ = state_->indexed_;
+    filledRows = state_->rows_;
+    columns_ = state_->columns_;
+    done = state_->done_;
+  }
+
+  if (done)
+  {
+    state_->thread_.shutdown();
+    zones_.swap(state_->zones_);
+    blockZones_.swap(state_->blockZones_);
+    state_.reset();
+    indexing_ = false;
+
+    rows_ = filledRows;
+
+    if (!sidecar_.empty())
+      writeSidecar();
+
+    return true;
+  }
+
+  // Only pages whose end is known can be split, those are the ones before the last
+  rows_ = std::min<std::size_t>(filledRows, (pageOffsets_.size() - 1) * PAGE_ROWS);
+  return rows_ != rows || columns_ != columns;
+}
+
+int PagedTable::threadMain(void * userData)
+{
+  PagedTable & table = *static_cast<PagedTable *>(userData);
+  State & state = *table.state_;
+
+  const StrView data = table.data();
+  const char delimiter = table.delimiter_;
+
+  std::vector<uint32_t> separators;
+  std::vector<std::size_t> pageOffsets;
+  std::vector<Zone> zones;
+  std::vector<std::vector<Zone>> blockZones;
+  const bool buildZones = table.buildZones_ || !table.sidecar_.empty();
+
+  long long line = 0;
+  int column = 0;
+  int rows = 0;
+  int columns = 0;
+  std::size_t fieldStart = 0;
+
+  // The quotes of the field at fieldStart, the way csv::Reader reads them. A quoted field
+  // may go on into the next block.
+  bool quoted = false;
+  bool inQuotes = false;
+  std::size_t closeQuote = 0;
+
+  // A table with a sidecar has a zone of every ZONE_ROWS rows, a partition one for all
+  auto addToZone = [&] (std::size_t end) {
+    std::vector<Zone> * lineZones = &zones;
+    if (!table.sidecar_.empty())
+    {
+      const std::size_t block = line / ZONE_ROWS;
+      if (block >= blockZones.size())
+        blockZones.resize(block + 1);
+
+      lineZones = &blockZones[block];
+    }
+
+    if ((std::size_t)column >= lineZones->size())
+      lineZones->resize(column + 1);
+
+    Zone & zone = (*lineZones)[column];
+    zone.fields++;
+
+    // A number in quotes is one all the same
+    const std::size_t begin = quoted ? fieldStart + 1 : fieldStart;
+    end = quoted ? std::max(closeQuote, begin) : end;
+
+    double value = 0.0;
+    if (!str::parseValue(data.substr(begin, end - begin), value))
+    {
+      zone.text = true;
+      return;
+    }
+
+    zone.min = zone.numbers == 0 ? value : std::min(zone.min, value);
+    zone.max = zone.numbers == 0 ? value : std::max(zone.max, value);
+    zone.numbers++;
+  };
+
+  for (std::size_t block = 0; block < data.size() && !state.quit_; block += INDEX_BLOCK_SIZE)
+  {
+    const StrView chunk = data.substr(block, INDEX_BLOCK_SIZE);
+
+    // The blocks before the one that comes into reach were asked for already
+    if (block == 0)
+      table.file_.willNeed(table.skip_, (INDEX_READ_AHEAD_BLOCKS + 1) * INDEX_BLOCK_SIZE);
+    else
+      table.file_.willNeed(table.skip_ + block + INDEX_READ_AHEAD_BLOCKS * INDEX_BLOCK_SIZE, INDEX_BLOCK_SIZE);
+
+    separators.clear();
+    csv::findStructure(chunk, delimiter, csv::QUOTE, separators);
+
+    for (auto separator : separators)
+    {
+      const std::size_t offset = block + separator;
+
+      // A quote right after the closing quote is a doubled quote, and opens the field again
+      if (data[offset] == csv::QUOTE)
+      {
+        if (inQuotes)
+        {
+          inQuotes = false;
+          closeQuote = offset;
+        }
+        else if (offset == fieldStart || (quoted && offset == closeQuote + 1))
+          quoted = inQuotes = true;
+
+        continue;
+      }
+
+      if (inQuotes)
+        continue;
+
+      // Like loading the file, only lines and columns with a field that isn't empty count
+      if (offset > fieldStart)
+      {
+        rows = line + 1;
+        columns = std::max(columns, column + 1);
+
+        // The header of the first file is the table's and left out of the zones
+        if (buildZones && (line > 0 || table.skip_ > 0))
+          addToZone(offset);
+      }
+
+      fieldStart = offset + 1;
+      quoted = false;
+
+      if (data[offset] == '\n')
+      {
+        line++;
+        column = 0;
+
+        if (line % PAGE_ROWS == 0)
+          pageOffsets.push_back(offset + 1);
+      }
+      else
+        column++;
+    }
+
+    bx::MutexScope lock(state.mutex_);
+    state.pageOffsets_.insert(state.pageOffsets_.end(), pageOffsets.begin(), pageOffsets.end());
+    state.indexed_ = block + chunk.size();
+    state.rows_ = rows;
+    state.columns_ = columns;
+
+    pageOffsets.clear();
+  }
+
+  // The last line may not end with a newline
+  if (data.size() > fieldStart)
+  {
+    rows = line + 1;
+    columns = std::max(columns, column + 1);
+
+    if (buildZones && (line > 0 || table.skip_ > 0))
+      addToZone(data.size());
+  }
+
+  bx::MutexScope lock(state.mutex_);
+  state.rows_ = rows;
+  state.columns_ = columns;
+  state.zones_.swap(zones);
+  state.blockZones_.swap(blockZones);
+  state.done_ = true;
+
+  return 0;
+}
+
+void PagedTable::splitPage(StrView data, char delimiter, Page & page)
+{
+  std::vector<uint32_t> & lines = page.lines_;
+  std::vector<Field> & fields = page.fields_;
+
+  lines.assign(1, 0);
+  fields.clear();
+  page.text_.clear();
+
+  // The reader gives the text of a field in data, only one with doubled quotes is made
+  csv::Reader reader(delimiter);
+  reader.read(data, [&] (StrView text, bool lineEnd) {
+    if (text.empty())
+      fields.push_back({ 0, 0 });
+    else if (text.data() >= data.data() && text.data() < data.data() + data.size())
+    {
+      const uint32_t begin = text.data() - data.data();
+      fields.push_back({ begin, begin + (uint32_t)text.size() });
+    }
+    else
+    {
+      const uint32_t begin = page.text_.size();
+      page.text_.append(text.data(), text.size());
+      fields.push_back({ begin | Field::UNQUOTED, begin + (uint32_t)text.size() });
+    }
+
+    if (lineEnd)
+      lines.push_back(fields.size());
+  });
+
+  if (fields.size() > lines.back())
+    lines.push_back(fields.size());
+}
+
+StrView PagedTable::pageData(int page) const
+{
+  const std::size_t end = page + 1 < (int)pageOffsets_.size() ? pageOffsets_[page + 1] : this->data().size();
+  return this->data().substr(pageOffsets_[page], end - pageOffsets_[page]);
+}
+
+PagedTable::Page * PagedTable::findPage(int page)
+{
+  if (lastPage_ < pages_.size() && pages_[lastPage_].page_ == page)
+    return &pages_[lastPage_];
+
+  for (std::size_t i = 0; i < pages_.size(); ++i)
+  {
+    if (pages_[i].page_ == page)
+    {
+      lastPage_ = i;
+      return &pages_[i];
+    }
+  }
+
+  return nullptr;
+}
+
+PagedTable::Page & PagedTable::cachePage()
+{
+  // Reuse the least recently used page once the cache is full
+  if (pages_.size() < CACHED_PAGES)
+  {
+    pages_.emplace_back();
+    lastPage_ = pages_.size() - 1;
+  }
+  else
+  {
+    lastPage_ = std::min_element(pages_.begin(), pages_.end(), [] (Page const& lhs, Page const& rhs) {
+      return lhs.lastUse_ < rhs.lastUse_;
+    }) - pages_.begin();
+  }
+
+  return pages_[lastPage_];
+}
+
+PagedTable::Page & PagedTable::loadPage(int page)
+{
+  Page * cached = findPage(page);
+  if (!cached && readAhead_ && adoptReadAhead())
+    cached = findPage(page);
+
+  if (cached)
+  {
+    PAGE_COUNTERS.hit();
+    cached->lastUse_ = ++useCount_;
+    return *cached;
+  }
+
+  PAGE_COUNTERS.miss();
+
+  // A page still being split ahead is split here too, rather than waited for
+  Page & result = cachePage();
+  result.page_ = page;
+  result.lastUse_ = ++useCount_;
+  result.offset_ = pageOffsets_[page];
+  splitPage(pageData(page), delimiter_, result);
+
+  return result;
+}
+
+void PagedTable::readAhead(int first, int last)
+{
+  // Arrow fields are read from the mapped file as they are, and a Parquet table reads the
+  // row groups after the ones it decodes ahead on its own
+  if (arrow_ || parquet_)
+    return;
+
+  first = std::max(first, 0);
+  last = std::min(last, rows_ - 1);
+  if (first > last)
+    return;
+
+  if (!partitions_.empty())
+  {
+    for (std::size_t i = 0; i < partitions_.size(); ++i)
+    {
+      const int partitionEnd = i + 1 < partitionRows_.size() ? partitionRows_[i + 1] : rows_;
+      if (partitionRows_[i] <= last && partitionEnd > first)
+        partitions_[i]->readAhead(first - partitionRows_[i], last - partitionRows_[i]);
+    }
+
+    return;
+  }
+
+  if (!readAhead_)
+    readAhead_.reset(new ReadAhead());
+
+  // What was split meanwhile goes to the cache, it is about to be looked at
+  adoptReadAhead();
+
+  for (int page = first / PAGE_ROWS; page <= last / PAGE_ROWS; ++page)
+  {
+    auto & pending = readAhead_->pending_;
+    if (findPage(page) || std::find(pending.begin(), pending.end(), page) != pending.end() || pending.size() >= READ_AHEAD_PAGES)
+      continue;
+
+    pending.push_back(page);
+
+    ReadAhead * readAhead = readAhead_.get();
+    const StrView data = pageData(page);
+    const std::size_t offset = pageOffsets_[page];
+    const char delimiter = delimiter_;
+
+    // The page is read from the disk while the task waits for a worker
+    file_.willNeed(skip_ + offset, data.size());
+
+    readAhead->tasks_.spawn([readAhead, page, offset, data, delimiter] () {
+      Page split;
+      split.page_ = page;
+      split.offset_ = offset;
+
+      splitPage(data, delimiter, split);
+
+      std::lock_guard<std::mutex> lock(readAhead->mutex_);
+      readAhead->ready_.push_back(std::move(split));
+    });
+  }
+}
+
+bool PagedTable::adoptReadAhead()
+{
+  std::vector<Page> ready;
+  {
+    std::lock_guard<std::mutex> lock(readAhead_->mutex_);
+    ready.swap(readAhead_->ready_);
+  }
+
+  auto & pending = readAhead_->pending_;
+  for (auto & page : ready)
+  {
+    pending.erase(std::remove(pending.begin(), pending.end(), page.page_), pending.end());
+
+    // A page looked at before it was split ahead is cached already
+    if (findPage(page.page_))
+      continue;
+
+    // The pages read ahead count as used now, before the ones looked at next
+    page.lastUse_ = useCount_;
+    cachePage() = std::move(page);
+  }
+
+  return !ready.empty();
+}
+
+StrView PagedTable::field(Index const& idx)
+{
+  if (idx.x < 0 || idx.y < 0 || idx.y >= rows_)
+    return StrView();
+
+  if (arrow_)
+    return arrow_->field(idx);
+
+  if (parquet_)
+    return parquet_->field(idx);
+
+  if (!partitions_.empty())
+  {
+    const std::size_t i = std::upper_bound(partitionRows_.begin(), partitionRows_.end(), idx.y) - partitionRows_.begin() - 1;
+    return partitions_[i]->field(Index(idx.x, idx.y - partitionRows_[i]));
+  }
+
+  Page const& page = loadPage(idx.y / PAGE_ROWS);
+  const std::size_t line = idx.y % PAGE_ROWS;
+
+  if (line + 1 >= page.lines_.size())
+    return StrView();
+
+  const uint32_t first = page.lines_[line];
+  if ((uint32_t)idx.x >= page.lines_[line + 1] - first)
+    return StrView();
+
+  Field const& field = page.fields_[first + idx.x];
+  if (field.begin & Field::UNQUOTED)
+  {
+    const uint32_t begin = field.begin & ~Field::UNQUOTED;
+    return StrView(page.text_.data() + begin, field.end - begin);
+  }
+
+  return data().substr(page.offset_ + field.begin, field.end - field.begin);
+}
+
+std::size_t PagedTable::memoryUsage() const
+{
+  std::size_t bytes = memory::bytes(pageOffsets_) + memory::bytes(pages_) + memory::bytes(zones_) + memory::bytes(blockZones_);
+  for (auto const& block : blockZones_)
+    bytes += memory::bytes(block);
+  for (auto const& page : pages_)
+    bytes += memory::bytes(page.lines_) + memory::bytes(page.fields_) + memory::bytes(page.text_);
+
+  if (readAhead_)
+  {
+    std::lock_guard<std::mutex> lock(readAhead_->mutex_);
+    for (auto const& page : readAhead_->ready_)
+      bytes += sizeof(page) + memory::bytes(page.lines_) + memory::bytes(page.fields_) + memory::bytes(page.text_);
+  }
+
+  for (auto const& partition : partitions_)
+    bytes += partition->memoryUsage();
+
+  if (arrow_)
+    bytes += arrow_->memoryUsage();
+
+  if (parquet_)
+    bytes += parquet_->memoryUsage();
+
+  return bytes;
+}
+
+std::size_t PagedTable::cacheBytes() const
+{
+  std::size_t bytes = 0;
+  for (auto const& page : pages_)
+    bytes += sizeof(page) + memory::bytes(page.lines_) + memory::bytes(page.fields_) + memory::bytes(page.text_);
+
+  for (auto const& partition : partitions_)
+    bytes += partition->cacheBytes();
+
+  return bytes;
+}
+
+void PagedTable::trimCache(std::size_t target)
+{
+  std::size_t bytes = cacheBytes();
+
+  for (auto & partition : partitions_)
+  {
+    if (bytes <= target)
+      return;
+
+    const std::size_t held = partition->cacheBytes();
+    partition->trimCache(held > bytes - target ? held - (bytes - target) : 0);
+    bytes -= held - partition->cacheBytes();
+  }
+
+  if (bytes <= target)
+    return;
+
+  std::sort(pages_.begin(), pages_.end(), [] (Page const& lhs, Page const& rhs) {
+    return lhs.lastUse_ < rhs.lastUse_;
+  });
+
+  std::size_t dropped = 0;
+  while (dropped < pages_.size() && bytes > target)
+  {
+    Page const& page = pages_[dropped++];
+    bytes -= std::min(bytes, sizeof(page) + memory::bytes(page.lines_) + memory::bytes(page.fields_));
+  }
+
+  pages_.erase(pages_.begin(), pages_.begin() + dropped);
+  lastPage_ = 0;
+}
+
+bool PagedTable::zone(int column, int row, Zone & zone, int & first, int & end) const
+{
+  // Of columns without a range only the count is known, so they may hold text and numbers
+  if (parquet_)
+  {
+    ParquetTable::Statistics statistics;
+    if (!parquet_->statistics(column, row, statistics, first, end))
+      return false;
+
+    zone.fields = (int)(statistics.values - statistics.nulls);
+    zone.numbers = zone.fields;
+    zone.min = statistics.min;
+    zone.max = statistics.max;
+    zone.text = !statistics.range && zone.fields > 0;
+    return true;
+  }
+
+  if (!sidecar_.empty())
+  {
+    if (indexing_ || column < 0 || row <= 0 || row >= rows_)
+      return false;
+
+    const std::size_t block = row / ZONE_ROWS;
+    first = std::max<int>(block * ZONE_ROWS, 1);
+    end = std::min<int>((block + 1) * ZONE_ROWS, rows_);
+    zone = block < blockZones_.size() && (std::size_t)column < blockZones_[block].size() ? blockZones_[block][column] : Zone();
+    return true;
+  }
+
+  if (column < 0 || row <= 0 || row >= rows_ || partitionRows_.empty())
+    return false;
+
+  const std::size_t i = std::upper_bound(partitionRows_.begin(), partitionRows_.end(), row) - partitionRows_.begin() - 1;
+  PagedTable const& partition = *partitions_[i];
+  if (partition.indexing())
+    return false;
+
+  first = std::max(partitionRows_[i], 1);
+  end = partitionRows_[i] + partition.rowCount();
+  zone = (std::size_t)column < partition.zones_.size() ? partition.zones_[column] : Zone();
+  return true;
+}
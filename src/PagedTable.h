@@ -0,0 +1,213 @@
+#pragma once
+
+#include "Str.h"
+#include "Index.h"
+#include "MappedFile.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+
+class ArrowTable;
+class ParquetTable;
+
+// Read-only table of a CSV file too large to load. A background thread indexes the
+// file, remembering where every PAGE_ROWS-th line starts, and the lines of a page are
+// only split into fields once one of them is looked at. Both follow RFC 4180 like
+// csv::Reader, a line break in a quoted field doesn't end its line. The most recently used pages
+// are kept, so the memory used doesn't grow with the file.
+//
+// A table can also be made of several files, its partitions, one after the other. Every
+// partition is a table of its own, indexed on its own thread, which also sums up the
+// fields of each of its columns in a zone map. The rows of a partition join the table
+// once the partitions before it are indexed.
+//
+// A table of one file may keep its index in a sidecar file next to it, filename.zumidx,
+// written once the file is indexed. As long as the size and modification time of the
+// file are the ones the sidecar was written for, opening the file again reads the page
+// offsets and the zone maps from it instead of indexing. Such a table sums up its
+// columns in a zone map of every ZONE_ROWS rows.
+//
+// Arrow IPC and Parquet files are read through an ArrowTable or a ParquetTable instead,
+// which need no indexing. The zones of a Parquet table are the statistics of its row
+// groups.
+class PagedTable
+{
+  public:
+    static const int PAGE_ROWS = 1024;
+    static const std::size_t CACHED_PAGES = 64;
+
+    // Pages readAhead() splits at most at a time
+    static const std::size_t READ_AHEAD_PAGES = 16;
+
+    // Bytes the indexer scans before it publishes what it found, and blocks it has the
+    // file read ahead of the one it scans, so the disk doesn't wait for the scan
+    static const std::size_t INDEX_BLOCK_SIZE = 4 << 20;
+    static const std::size_t INDEX_READ_AHEAD_BLOCKS = 2;
+
+    // Rows of a zone of a table with a sidecar
+    static const int ZONE_ROWS = 64 * PAGE_ROWS;
+
+  public:
+    PagedTable();
+    ~PagedTable();
+
+    PagedTable(PagedTable const&) = delete;
+    PagedTable & operator = (PagedTable const&) = delete;
+
+    // What a partition holds in a column. Numbers are the fields that read as one,
+    // anything else that isn't empty is text. The range only holds the numbers.
+    struct Zone
+    {
+      int fields = 0;
+      int numbers = 0;
+      double min = 0.0;
+      double max = 0.0;
+      bool text = false;
+    };
+
+  public:
+    // Maps the file and starts indexing it on a background thread. With sidecar the
+    // index is read from the sidecar of the file instead when it fits the file, and is
+    // written to it once indexing ends otherwise.
+    bool open(std::string const& filename, char delimiter, bool sidecar = false);
+
+    static std::string sidecarName(std::string const& filename) { return filename + ".zumidx"; }
+
+    // Opens the files as partitions of one table. The header of the first file stands
+    // for the headers of all of them, the first line of every other file is left out.
+    bool open(std::vector<std::string> const& filenames, char delimiter);
+
+    // Maps an Arrow IPC or Parquet file, whose rows are all there once it returns.
+    // Returns false with what's wrong in error if it can't be read.
+    bool openColumnar(std::string const& filename, std::string & error);
+
+    // Whether data starts the way an Arrow IPC or Parquet file does
+    static bool isColumnar(StrView data);
+
+    // Takes over the pages indexed since the last call, returns true if there were any
+    bool update();
+
+    bool indexing() const { return indexing_; }
+
+    // Percentage of the file that has been indexed
+    int progress() const;
+
+    // Rows and columns holding a field, of the pages indexed so far
+    int rowCount() const { return rows_; }
+    int columnCount() const { return columns_; }
+
+    // Returns field idx.x of line idx.y, which is empty past the end of the line
+    StrView field(Index const& idx);
+
+    // Splits the pages of rows first to last on the scheduler, for rows that are about to
+    // be looked at. field() takes the pages over once they are split, and splits a page
+    // that isn't yet itself.
+    void readAhead(int first, int last);
+
+    // Bytes of the page index and the cached pages, the mapped file is not counted
+    std::size_t memoryUsage() const;
+
+    // Bytes of the cached pages of the table and its partitions, and drops the least
+    // recently used of them until they hold at most target bytes
+    std::size_t cacheBytes() const;
+    void trimCache(std::size_t target);
+
+    int partitionCount() const { return (int)partitions_.size(); }
+
+    // The zone of column in the partition holding row, which goes from first to end.
+    // False if the table has no partitions or that one is still being indexed, and for
+    // the header row, which no zone covers.
+    bool zone(int column, int row, Zone & zone, int & first, int & end) const;
+
+  private:
+    // Offsets in the page, or in the text_ of the page with UNQUOTED set in begin
+    struct Field
+    {
+      static const uint32_t UNQUOTED = 1u << 31;
+
+      uint32_t begin;
+      uint32_t end;
+    };
+
+    // The split lines of a page. lines_ holds the index of the first field of every
+    // line in fields_, and one past the last field at the end. text_ holds the fields
+    // with doubled quotes, without them.
+    struct Page
+    {
+      int page_ = -1;
+      uint64_t lastUse_ = 0;
+      std::size_t offset_ = 0;
+      std::vector<uint32_t> lines_;
+      std::vector<Field> fields_;
+      std::string text_;
+    };
+
+    struct State;
+    struct ReadAhead;
+
+    static int threadMain(void * userData);
+
+    // Splits data, the lines of a page, into the lines and fields of page
+    static void splitPage(StrView data, char delimiter, Page & page);
+
+    bool start(std::string const& filename, char delimiter, bool skipHeader, bool zones);
+
+    // Reads the index from the sidecar, returns false if there is none for the file as
+    // it is. Writing it is best effort, a table that can't goes on without.
+    bool readSidecar();
+    void writeSidecar() const;
+
+    Page & loadPage(int page);
+
+    // The cached page, nullptr if it isn't, and a slot of the cache for a page to go
+    Page * findPage(int page);
+    Page & cachePage();
+
+    // Caches the pages read ahead that are split, returns false if there were none
+    bool adoptReadAhead();
+
+    StrView pageData(int page) const;
+
+    // The file without the header of a partition that leaves it out
+    StrView data() const { return file_.data().substr(skip_); }
+
+    bool updatePartitions();
+
+  private:
+    MappedFile file_;
+    std::size_t skip_ = 0;
+    char delimiter_ = ',';
+    bool buildZones_ = false;
+    std::vector<Zone> zones_;
+
+    // The file a sidecar is for, with its size and modification time when it was opened,
+    // and the zones of every ZONE_ROWS rows of it
+    std::string sidecar_;
+    long long fileSize_ = -1;
+    long long fileTime_ = 0;
+    std::vector<std::vector<Zone>> blockZones_;
+
+    // Of a table made of files, with the first row of every partition that joined it
+    std::vector<std::unique_ptr<PagedTable>> partitions_;
+    std::vector<int> partitionRows_;
+
+    std::unique_ptr<ArrowTable> arrow_;
+    std::unique_ptr<ParquetTable> parquet_;
+
+    std::unique_ptr<State> state_;
+    bool indexing_ = false;
+
+    // Offset of the first line of every indexed page, and the offset the indexer has
+    // reached, taken over from the indexer by update()
+    std::vector<std::size_t> pageOffsets_;
+    std::size_t indexed_ = 0;
+    int rows_ = 0;
+    int columns_ = 0;
+
+    std::vector<Page> pages_;
+    std::size_t lastPage_ = 0;
+    uint64_t useCount_ = 0;
+
+    std::unique_ptr<ReadAhead> readAhead_;
+};
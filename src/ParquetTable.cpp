@@ -0,0 +1,1118 @@
+#include "ParquetTable.h"
+#include "Thrift.h"
+#include "Snappy.h"
+#include "Lz4.h"
+#include "Scheduler.h"
+#include "Memory.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+static const char MAGIC[] = "PAR1";
+static const std::size_t MAGIC_SIZE = 4;
+
+// The magic at the start, the footer size and the magic at the end
+static const std::size_t MIN_FILE_SIZE = MAGIC_SIZE + 4 + MAGIC_SIZE;
+
+// Days from the start of the julian calendar to 1970-01-01, INT96 timestamps count from it
+static const int64_t JULIAN_EPOCH_DAY = 2440588;
+static const int64_t NANOSECONDS_PER_DAY = 86400ll * 1000000000ll;
+
+// The enums of the Parquet format
+enum PhysicalType
+{
+  BOOLEAN = 0,
+  INT32 = 1,
+  INT64 = 2,
+  INT96 = 3,
+  FLOAT = 4,
+  DOUBLE = 5,
+  BYTE_ARRAY = 6,
+  FIXED_LEN_BYTE_ARRAY = 7,
+};
+
+enum Repetition
+{
+  REQUIRED = 0,
+  OPTIONAL = 1,
+  REPEATED = 2,
+};
+
+enum ConvertedType
+{
+  CONVERTED_DECIMAL = 5,
+  CONVERTED_DATE = 6,
+  CONVERTED_TIMESTAMP_MILLIS = 9,
+  CONVERTED_TIMESTAMP_MICROS = 10,
+  CONVERTED_UINT_8 = 11,
+  CONVERTED_UINT_64 = 14,
+};
+
+enum Codec
+{
+  UNCOMPRESSED = 0,
+  SNAPPY = 1,
+  LZ4_RAW = 7,
+};
+
+enum PageType
+{
+  DATA_PAGE = 0,
+  DICTIONARY_PAGE = 2,
+  DATA_PAGE_V2 = 3,
+};
+
+enum Encoding
+{
+  PLAIN = 0,
+  PLAIN_DICTIONARY = 2,
+  RLE = 3,
+  RLE_DICTIONARY = 8,
+};
+
+static const char * CODEC_NAMES[] = { "uncompressed", "Snappy", "gzip", "LZO", "Brotli", "LZ4", "Zstandard", "LZ4" };
+
+template <typename T>
+static T load(const uint8_t * data)
+{
+  T value;
+  memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+bool ParquetTable::isParquet(StrView data)
+{
+  return data.size() >= MAGIC_SIZE && memcmp(data.data(), MAGIC, MAGIC_SIZE) == 0;
+}
+
+// What a SchemaElement holds
+struct SchemaElement
+{
+  int type = -1;
+  int repetition = REQUIRED;
+  std::string name;
+  int children = 0;
+  int converted = -1;
+  int scale = 0;
+
+  // Of the logical type, which newer writers set besides the converted type
+  int logical = 0;
+  int64_t timeUnits = 0;
+  bool isSigned = true;
+};
+
+enum LogicalType
+{
+  LOGICAL_DECIMAL = 5,
+  LOGICAL_DATE = 6,
+  LOGICAL_TIMESTAMP = 8,
+  LOGICAL_INTEGER = 10,
+};
+
+static void readLogicalType(thrift::CompactReader & reader, SchemaElement & element)
+{
+  int id;
+  uint8_t type;
+
+  reader.beginStruct();
+  while (reader.field(id, type))
+  {
+    if (type != thrift::STRUCT)
+    {
+      reader.skip(type);
+      continue;
+    }
+
+    element.logical = id;
+    reader.beginStruct();
+
+    int fieldId;
+    uint8_t fieldType;
+    while (reader.field(fieldId, fieldType))
+    {
+      if (id == LOGICAL_DECIMAL && fieldId == 1)
+        element.scale = (int)reader.readInt(fieldType);
+      else if (id == LOGICAL_INTEGER && fieldId == 2)
+        element.isSigned = reader.readBool(fieldType);
+      else if (id == LOGICAL_TIMESTAMP && fieldId == 2 && fieldType == thrift::STRUCT)
+      {
+        // A union of empty structs for milliseconds, microseconds and nanoseconds
+        static const int64_t UNITS[] = { 0, 1000, 1000000, 1000000000 };
+
+        int unit;
+        uint8_t unitType;
+        reader.beginStruct();
+        while (reader.field(unit, unitType))
+        {
+          if (unit >= 1 && unit <= 3)
+            element.timeUnits = UNITS[unit];
+
+          reader.skip(unitType);
+        }
+      }
+      else
+        reader.skip(fieldType);
+    }
+  }
+}
+
+static bool readSchemaElement(thrift::CompactReader & reader, SchemaElement & element)
+{
+  int id;
+  uint8_t type;
+
+  reader.beginStruct();
+  while (reader.field(id, type))
+  {
+    switch (id)
+    {
+      case 1: element.type = (int)reader.readInt(type); break;
+      case 3: element.repetition = (int)reader.readInt(type); break;
+      case 4: element.name = reader.readBinary().str(); break;
+      case 5: element.children = (int)reader.readInt(type); break;
+      case 6: element.converted = (int)reader.readInt(type); break;
+      case 7: element.scale = (int)reader.readInt(type); break;
+      case 10: readLogicalType(reader, element); break;
+      default: reader.skip(type); break;
+    }
+  }
+
+  return !reader.failed();
+}
+
+// Reads the value of a minimum or maximum in the statistics of a numeric column
+static bool statisticsValue(StrView bytes, int physical, bool isSigned, double & value)
+{
+  const uint8_t * data = (const uint8_t *)bytes.data();
+
+  switch (physical)
+  {
+    case INT32:
+      if (bytes.size() != 4)
+        return false;
+
+      value = isSigned ? (double)load<int32_t>(data) : (double)load<uint32_t>(data);
+      return true;
+
+    case INT64:
+      if (bytes.size() != 8)
+        return false;
+
+      value = isSigned ? (double)load<int64_t>(data) : (double)load<uint64_t>(data);
+      return true;
+
+    case FLOAT:
+      if (bytes.size() != 4)
+        return false;
+
+      value = load<float>(data);
+      return !std::isnan(value);
+
+    case DOUBLE:
+      if (bytes.size() != 8)
+        return false;
+
+      value = load<double>(data);
+      return !std::isnan(value);
+
+    default:
+      return false;
+  }
+}
+
+static void readStatistics(thrift::CompactReader & reader, int physical, bool isSigned, ParquetTable::Statistics & statistics)
+{
+  enum { MAX = 1, MIN = 2, NULL_COUNT = 3, MAX_VALUE = 5, MIN_VALUE = 6 };
+
+  StrView min, max, minValue, maxValue;
+  int id;
+  uint8_t type;
+
+  reader.beginStruct();
+  while (reader.field(id, type))
+  {
+    switch (id)
+    {
+      case MAX: max = reader.readBinary(); break;
+      case MIN: min = reader.readBinary(); break;
+      case NULL_COUNT: statistics.nulls = reader.readInt(type); break;
+      case MAX_VALUE: maxValue = reader.readBinary(); break;
+      case MIN_VALUE: minValue = reader.readBinary(); break;
+      default: reader.skip(type); break;
+    }
+  }
+
+  if (!statistics.numeric)
+    return;
+
+  // The deprecated fields compare unsigned numbers as signed ones
+  if (minValue.empty() && maxValue.empty() && isSigned)
+  {
+    minValue = min;
+    maxValue = max;
+  }
+
+  statistics.range = statisticsValue(minValue, physical, isSigned, statistics.min) && statisticsValue(maxValue, physical, isSigned, statistics.max);
+}
+
+bool ParquetTable::readMetadata(const uint8_t * data, std::size_t size, std::string & error)
+{
+  enum { SCHEMA = 2, ROW_GROUPS = 4 };
+  enum { GROUP_COLUMNS = 1, GROUP_ROWS = 3 };
+  enum { CHUNK_FILE_PATH = 1, CHUNK_META_DATA = 3 };
+  enum { META_CODEC = 4, META_VALUES = 5, META_COMPRESSED_SIZE = 7, META_DATA_PAGE = 9, META_DICTIONARY_PAGE = 11, META_STATISTICS = 12 };
+
+  thrift::CompactReader reader(data, size);
+  std::vector<SchemaElement> schema;
+  int id;
+  uint8_t type;
+
+  reader.beginStruct();
+  while (reader.field(id, type))
+  {
+    if (id == SCHEMA && type == thrift::LIST)
+    {
+      uint8_t elementType;
+      schema.resize(reader.readList(elementType));
+
+      for (auto & element : schema)
+        if (!readSchemaElement(reader, element))
+          break;
+    }
+    else if (id == ROW_GROUPS && type == thrift::LIST)
+    {
+      uint8_t elementType;
+      groups_.resize(reader.readList(elementType));
+
+      for (auto & group : groups_)
+      {
+        reader.beginStruct();
+        while (reader.field(id, type))
+        {
+          if (id == GROUP_ROWS)
+          {
+            const int64_t rows = reader.readInt(type);
+            group.rows_ = rows >= 0 && rows < std::numeric_limits<int>::max() ? (int)rows : -1;
+          }
+          else if (id == GROUP_COLUMNS && type == thrift::LIST)
+          {
+            group.chunks_.resize(reader.readList(elementType));
+
+            for (auto & chunk : group.chunks_)
+            {
+              int64_t dataPage = 0;
+              int64_t dictionaryPage = 0;
+
+              reader.beginStruct();
+              while (reader.field(id, type))
+              {
+                if (id == CHUNK_FILE_PATH)
+                {
+                  error = "column chunks in other files aren't supported";
+                  return false;
+                }
+
+                if (id != CHUNK_META_DATA)
+                {
+                  reader.skip(type);
+                  continue;
+                }
+
+                // The statistics need the column, which the chunk is the one of
+                const std::size_t column = &chunk - group.chunks_.data() + 1;
+                SchemaElement const* leaf = nullptr;
+                if (column < schema.size())
+                  leaf = &schema[column];
+
+                reader.beginStruct();
+                while (reader.field(id, type))
+                {
+                  switch (id)
+                  {
+                    case META_CODEC: chunk.codec_ = (int)reader.readInt(type); break;
+                    case META_VALUES: chunk.values_ = reader.readInt(type); break;
+                    case META_COMPRESSED_SIZE: chunk.size_ = reader.readInt(type); break;
+                    case META_DATA_PAGE: dataPage = reader.readInt(type); break;
+                    case META_DICTIONARY_PAGE: dictionaryPage = reader.readInt(type); break;
+
+                    case META_STATISTICS:
+                      chunk.hasStatistics_ = true;
+                      chunk.statistics_.numeric = leaf && leaf->children == 0 && leaf->type != BOOLEAN && leaf->type != BYTE_ARRAY;
+                      readStatistics(reader, leaf ? leaf->type : -1, true, chunk.statistics_);
+                      break;
+
+                    default:
+                      reader.skip(type);
+                      break;
+                  }
+                }
+              }
+
+              // Some writers leave the dictionary page offset at 0 instead of out
+              chunk.offset_ = dictionaryPage > 0 && dictionaryPage < dataPage ? dictionaryPage : dataPage;
+              chunk.statistics_.values = chunk.values_;
+            }
+          }
+          else
+            reader.skip(type);
+        }
+      }
+    }
+    else
+      reader.skip(type);
+  }
+
+  if (reader.failed() || schema.empty())
+  {
+    error = "the metadata is corrupt";
+    return false;
+  }
+
+  // The root is followed by the fields depth first, every group by its children. Only
+  // the leaves have column chunks.
+  struct Level
+  {
+    int remaining;
+    std::string path;
+    bool nested;
+  };
+
+  std::vector<Level> levels(1, Level { schema[0].children, std::string(), false });
+
+  for (std::size_t i = 1; i < schema.size() && !levels.empty(); ++i)
+  {
+    SchemaElement const& element = schema[i];
+    Level & parent = levels.back();
+    --parent.remaining;
+
+    const std::string path = parent.path.empty() ? element.name : parent.path + "." + element.name;
+    const bool nested = levels.size() > 1 || element.repetition == REPEATED;
+
+    if (element.children > 0)
+      levels.push_back(Level { element.children, path, true });
+    else
+    {
+      Column column;
+      column.name_ = path;
+      column.physical_ = element.type;
+      column.optional_ = element.repetition == OPTIONAL;
+
+      const bool isUnsigned = !element.isSigned || (element.converted >= CONVERTED_UINT_8 && element.converted <= CONVERTED_UINT_64);
+      const bool decimal = element.converted == CONVERTED_DECIMAL || element.logical == LOGICAL_DECIMAL;
+
+      switch (element.type)
+      {
+        case BOOLEAN:
+          column.kind_ = Kind::Bool;
+          break;
+
+        case INT32:
+        case INT64:
+          if (element.type == INT32 && (element.converted == CONVERTED_DATE || element.logical == LOGICAL_DATE))
+            column.kind_ = Kind::Date;
+          else if (element.type == INT64 && (element.timeUnits > 0 || element.converted == CONVERTED_TIMESTAMP_MILLIS || element.converted == CONVERTED_TIMESTAMP_MICROS))
+          {
+            column.kind_ = Kind::Timestamp;
+            column.units_ = element.timeUnits > 0 ? element.timeUnits : element.converted == CONVERTED_TIMESTAMP_MILLIS ? 1000 : 1000000;
+          }
+          else if (decimal)
+          {
+            column.kind_ = Kind::Decimal;
+            column.scale_ = element.scale;
+          }
+          else
+            column.kind_ = isUnsigned ? Kind::Unsigned : Kind::Int;
+          break;
+
+        case INT96:
+          column.kind_ = Kind::Timestamp;
+          column.units_ = 1000000000;
+          break;
+
+        case FLOAT:
+          column.kind_ = Kind::Float;
+          break;
+
+        case DOUBLE:
+          column.kind_ = Kind::Double;
+          break;
+
+        case BYTE_ARRAY:
+          column.kind_ = Kind::Text;
+          break;
+
+        default:
+          break;
+      }
+
+      if (nested)
+        column.kind_ = Kind::Unsupported;
+
+      columns_.push_back(column);
+    }
+
+    while (!levels.empty() && levels.back().remaining <= 0)
+      levels.pop_back();
+  }
+
+  // Row 0 holds the names
+  int64_t rows = 1;
+  for (std::size_t i = 0; i < groups_.size(); ++i)
+  {
+    RowGroup & group = groups_[i];
+    if (group.rows_ < 0 || group.chunks_.size() != columns_.size())
+    {
+      error = "row group " + std::to_string(i) + " doesn't match the schema";
+      return false;
+    }
+
+    for (std::size_t x = 0; x < columns_.size(); ++x)
+    {
+      ChunkInfo & chunk = group.chunks_[x];
+      if (chunk.offset_ < 0 || chunk.size_ < 0 || (uint64_t)chunk.offset_ > file_.data().size() || (uint64_t)chunk.size_ > file_.data().size() - chunk.offset_)
+      {
+        error = "a column chunk lies outside of the file";
+        return false;
+      }
+
+      if (columns_[x].kind_ != Kind::Unsupported && chunk.codec_ != UNCOMPRESSED && chunk.codec_ != SNAPPY && chunk.codec_ != LZ4_RAW)
+      {
+        const bool named = chunk.codec_ >= 0 && chunk.codec_ < (int)(sizeof(CODEC_NAMES) / sizeof(CODEC_NAMES[0]));
+        error = std::string("column '") + columns_[x].name_ + "' is compressed with " + (named ? CODEC_NAMES[chunk.codec_] : "an unknown codec") + ", which isn't supported";
+        return false;
+      }
+
+      // Unsigned ranges are only right from the newer fields, read as signed above
+      Column const& column = columns_[x];
+      Statistics & statistics = chunk.statistics_;
+      statistics.numeric = column.kind_ == Kind::Int || column.kind_ == Kind::Unsigned || column.kind_ == Kind::Decimal ||
+                           column.kind_ == Kind::Float || column.kind_ == Kind::Double;
+
+      if (!statistics.numeric || column.kind_ == Kind::Unsigned)
+        statistics.range = false;
+
+      if (statistics.range && column.kind_ == Kind::Decimal)
+      {
+        const double scale = std::pow(10.0, column.scale_);
+        statistics.min /= scale;
+        statistics.max /= scale;
+      }
+
+      // Floats show as the shortest text that reads back as them, which lies between them
+      // and their neighbours
+      if (statistics.range && column.kind_ == Kind::Float)
+      {
+        statistics.min = std::nextafter((float)statistics.min, -std::numeric_limits<float>::infinity());
+        statistics.max = std::nextafter((float)statistics.max, std::numeric_limits<float>::infinity());
+      }
+    }
+
+    if (group.rows_ == 0)
+      continue;
+
+    if (rows + group.rows_ > std::numeric_limits<int>::max())
+    {
+      error = "the file has too many rows";
+      return false;
+    }
+
+    group.first_ = (int)rows;
+    rows += group.rows_;
+  }
+
+  // Empty row groups are left out, finding a row needs every group to have one
+  groups_.erase(std::remove_if(groups_.begin(), groups_.end(), [] (RowGroup const& group) { return group.rows_ == 0; }), groups_.end());
+
+  rows_ = (int)rows;
+  return true;
+}
+
+bool ParquetTable::open(std::string const& filename, std::string & error)
+{
+  if (!file_.open(filename))
+  {
+    error = "could not open the file";
+    return false;
+  }
+
+  const StrView file = file_.data();
+  const uint8_t * data = (const uint8_t *)file.data();
+
+  if (file.size() < MIN_FILE_SIZE || !isParquet(file) || memcmp(file.data() + file.size() - MAGIC_SIZE, MAGIC, MAGIC_SIZE) != 0)
+  {
+    error = "not a Parquet file";
+    return false;
+  }
+
+  const uint32_t footerSize = load<uint32_t>(data + file.size() - MAGIC_SIZE - 4);
+  if (footerSize > file.size() - MIN_FILE_SIZE)
+  {
+    error = "the footer doesn't fit the file";
+    return false;
+  }
+
+  return readMetadata(data + file.size() - MAGIC_SIZE - 4 - footerSize, footerSize, error);
+}
+
+// The data of a page, decompressed into buffer unless it isn't compressed
+static bool decompressPage(int codec, StrView compressed, std::size_t size, std::vector<char> & buffer, StrView & page)
+{
+  if (codec == UNCOMPRESSED)
+  {
+    page = compressed;
+    return true;
+  }
+
+  buffer.resize(size);
+  if (codec == SNAPPY ? !snappy::decompress(compressed, buffer.data(), size) : !lz4::decompress(compressed, buffer.data(), size))
+    return false;
+
+  page = StrView(buffer.data(), size);
+  return true;
+}
+
+static bool readVarint(const uint8_t *& in, const uint8_t * end, uint32_t & value)
+{
+  value = 0;
+  for (int shift = 0; shift < 35 && in < end; shift += 7)
+  {
+    const uint8_t byte = *in++;
+    value |= (uint32_t)(byte & 0x7f) << shift;
+
+    if ((byte & 0x80) == 0)
+      return true;
+  }
+
+  return false;
+}
+
+// Decodes count values of the hybrid of runs of one value and bit packed groups of eight
+// values that levels and dictionary indices are kept in
+static bool decodeHybrid(StrView data, int bitWidth, std::size_t count, std::vector<uint32_t> & out)
+{
+  out.resize(count);
+  if (bitWidth < 0 || bitWidth > 32)
+    return false;
+
+  const uint8_t * in = (const uint8_t *)data.data();
+  const uint8_t * end = in + data.size();
+  const uint64_t mask = ((uint64_t)1 << bitWidth) - 1;
+
+  std::size_t n = 0;
+  while (n < count)
+  {
+    uint32_t header;
+    if (!readVarint(in, end, header))
+      return false;
+
+    if (header & 1)
+    {
+      // The last group may be cut short at the end of the data
+      const std::size_t values = (std::size_t)(header >> 1) * 8;
+      const std::size_t bytes = std::min<std::size_t>((header >> 1) * (std::size_t)bitWidth, end - in);
+
+      uint64_t buffer = 0;
+      int bits = 0;
+      const uint8_t * packed = in;
+
+      for (std::size_t i = 0; i < values && n < count; ++i)
+      {
+        while (bits < bitWidth && packed < in + bytes)
+        {
+          buffer |= (uint64_t)*packed++ << bits;
+          bits += 8;
+        }
+
+        if (bits < bitWidth)
+          return false;
+
+        out[n++] = (uint32_t)(buffer & mask);
+        buffer >>= bitWidth;
+        bits -= bitWidth;
+      }
+
+      in += bytes;
+    }
+    else
+    {
+      const std::size_t bytes = (bitWidth + 7) / 8;
+      if ((std::size_t)(end - in) < bytes)
+        return false;
+
+      uint32_t value = 0;
+      for (std::size_t i = 0; i < bytes; ++i)
+        value |= (uint32_t)in[i] << (8 * i);
+      in += bytes;
+
+      for (std::size_t run = header >> 1; run > 0 && n < count; --run)
+        out[n++] = value;
+    }
+  }
+
+  return true;
+}
+
+// Hybrid data behind its size in 4 bytes, the way data pages of version 1 keep levels
+static bool decodePrefixedHybrid(StrView & data, int bitWidth, std::size_t count, std::vector<uint32_t> & out)
+{
+  if (data.size() < 4)
+    return false;
+
+  const uint32_t size = load<uint32_t>((const uint8_t *)data.data());
+  if (size > data.size() - 4)
+    return false;
+
+  const bool ok = decodeHybrid(data.substr(4, size), bitWidth, count, out);
+  data = data.substr(4 + size);
+  return ok;
+}
+
+bool ParquetTable::decode(int x, int g, Chunk & chunk, std::string & error) const
+{
+  enum { PAGE_TYPE = 1, PAGE_UNCOMPRESSED_SIZE = 2, PAGE_COMPRESSED_SIZE = 3, PAGE_DATA_HEADER = 5, PAGE_DICTIONARY_HEADER = 7, PAGE_DATA_HEADER_V2 = 8 };
+
+  Column const& column = columns_[x];
+  ChunkInfo const& info = groups_[g].chunks_[x];
+
+  chunk.column_ = x;
+  chunk.group_ = g;
+
+  if (column.kind_ == Kind::Unsupported)
+    return true;
+
+  const uint8_t * data = (const uint8_t *)file_.data().data();
+  std::size_t pos = info.offset_;
+  const std::size_t end = info.offset_ + info.size_;
+
+  Chunk dictionary;
+  std::vector<char> buffer;
+  std::vector<uint32_t> levels;
+  std::vector<uint32_t> indices;
+  int64_t read = 0;
+
+  // Appends the count values of a plain encoded page to values
+  auto decodePlain = [&] (StrView page, std::size_t count, Chunk & values) {
+    const uint8_t * in = (const uint8_t *)page.data();
+    const std::size_t size = page.size();
+
+    static const std::size_t WIDTHS[] = { 0, 4, 8, 12, 4, 8 };
+    if (column.physical_ >= INT32 && column.physical_ <= DOUBLE && size < count * WIDTHS[column.physical_])
+      return false;
+
+    switch (column.physical_)
+    {
+      case BOOLEAN:
+        if (size < (count + 7) / 8)
+          return false;
+
+        for (std::size_t i = 0; i < count; ++i)
+          values.ints_.push_back((in[i >> 3] >> (i & 7)) & 1);
+        return true;
+
+      case INT32:
+        for (std::size_t i = 0; i < count; ++i)
+          values.ints_.push_back(column.kind_ == Kind::Unsigned ? (int64_t)load<uint32_t>(in + i * 4) : (int64_t)load<int32_t>(in + i * 4));
+        return true;
+
+      case INT64:
+        for (std::size_t i = 0; i < count; ++i)
+          values.ints_.push_back(load<int64_t>(in + i * 8));
+        return true;
+
+      case INT96:
+        // Nanoseconds of the day, then the julian day
+        for (std::size_t i = 0; i < count; ++i)
+          values.ints_.push_back(load<int64_t>(in + i * 12) + ((int64_t)load<uint32_t>(in + i * 12 + 8) - JULIAN_EPOCH_DAY) * NANOSECONDS_PER_DAY);
+        return true;
+
+      case FLOAT:
+        for (std::size_t i = 0; i < count; ++i)
+          values.doubles_.push_back(load<float>(in + i * 4));
+        return true;
+
+      case DOUBLE:
+        for (std::size_t i = 0; i < count; ++i)
+          values.doubles_.push_back(load<double>(in + i * 8));
+        return true;
+
+      case BYTE_ARRAY:
+      {
+        std::size_t offset = 0;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+          if (size - offset < 4)
+            return false;
+
+          const uint32_t length = load<uint32_t>(in + offset);
+          if (length > size - offset - 4)
+            return false;
+
+          values.texts_.push_back(page.substr(offset + 4, length));
+          offset += 4 + length;
+        }
+        return true;
+      }
+
+      default:
+        return false;
+    }
+  };
+
+  while (pos < end && read < info.values_)
+  {
+    thrift::CompactReader reader(data + pos, end - pos);
+    int pageType = -1;
+    int64_t uncompressedSize = 0;
+    int64_t compressedSize = 0;
+    int64_t count = 0;
+    int64_t encoding = PLAIN;
+    int64_t definitionSize = 0;
+    int64_t repetitionSize = 0;
+    bool compressed = true;
+    bool version2 = false;
+
+    int id;
+    uint8_t type;
+    reader.beginStruct();
+    while (reader.field(id, type))
+    {
+      if (id == PAGE_TYPE)
+        pageType = (int)reader.readInt(type);
+      else if (id == PAGE_UNCOMPRESSED_SIZE)
+        uncompressedSize = reader.readInt(type);
+      else if (id == PAGE_COMPRESSED_SIZE)
+        compressedSize = reader.readInt(type);
+      else if ((id == PAGE_DATA_HEADER || id == PAGE_DICTIONARY_HEADER || id == PAGE_DATA_HEADER_V2) && type == thrift::STRUCT)
+      {
+        version2 = id == PAGE_DATA_HEADER_V2;
+
+        int headerId;
+        uint8_t headerType;
+        reader.beginStruct();
+        while (reader.field(headerId, headerType))
+        {
+          if (headerId == 1)
+            count = reader.readInt(headerType);
+          else if (headerId == (version2 ? 4 : 2))
+            encoding = reader.readInt(headerType);
+          else if (version2 && headerId == 5)
+            definitionSize = reader.readInt(headerType);
+          else if (version2 && headerId == 6)
+            repetitionSize = reader.readInt(headerType);
+          else if (version2 && headerId == 7)
+            compressed = reader.readBool(headerType);
+          else
+            reader.skip(headerType);
+        }
+      }
+      else
+        reader.skip(type);
+    }
+
+    const std::size_t headerSize = reader.position();
+    if (reader.failed() || compressedSize < 0 || uncompressedSize < 0 || count < 0 || (uint64_t)compressedSize > end - pos - headerSize ||
+        definitionSize < 0 || repetitionSize < 0 || definitionSize + repetitionSize > std::min(compressedSize, uncompressedSize))
+    {
+      error = "a page header is corrupt";
+      return false;
+    }
+
+    const StrView payload((const char *)data + pos + headerSize, compressedSize);
+    pos += headerSize + compressedSize;
+
+    if (pageType == DICTIONARY_PAGE)
+    {
+      StrView page;
+      std::vector<char> owned;
+      if (!decompressPage(info.codec_, payload, uncompressedSize, owned, page) || !decodePlain(page, count, dictionary))
+      {
+        error = "the dictionary page is corrupt";
+        return false;
+      }
+
+      if (!owned.empty())
+        chunk.buffers_.push_back(std::move(owned));
+      continue;
+    }
+
+    if (pageType != DATA_PAGE && pageType != DATA_PAGE_V2)
+      continue;
+
+    // Levels of version 2 pages come before the compressed values, uncompressed
+    StrView page;
+    StrView definitions;
+    std::vector<char> owned;
+
+    if (pageType == DATA_PAGE_V2)
+    {
+      definitions = payload.substr(repetitionSize, definitionSize);
+      const StrView values = payload.substr(repetitionSize + definitionSize);
+      const std::size_t size = uncompressedSize - repetitionSize - definitionSize;
+
+      if (!decompressPage(compressed ? info.codec_ : (int)UNCOMPRESSED, values, size, owned, page))
+      {
+        error = "a data page doesn't decompress";
+        return false;
+      }
+    }
+    else if (!decompressPage(info.codec_, payload, uncompressedSize, owned, page))
+    {
+      error = "a data page doesn't decompress";
+      return false;
+    }
+
+    // Of a flat column the level is 1 for values and 0 for nulls
+    std::size_t present = count;
+    if (column.optional_)
+    {
+      const bool ok = pageType == DATA_PAGE_V2 ? decodeHybrid(definitions, 1, count, levels) : decodePrefixedHybrid(page, 1, count, levels);
+      if (!ok)
+      {
+        error = "the levels of a data page are corrupt";
+        return false;
+      }
+
+      present = std::count(levels.begin(), levels.end(), 1u);
+
+      if (chunk.rows_.empty() && present < (std::size_t)count)
+      {
+        chunk.rows_.resize(read);
+        for (int64_t i = 0; i < read; ++i)
+          chunk.rows_[i] = (int32_t)i;
+      }
+    }
+
+    const std::size_t first = chunk.ints_.size() + chunk.doubles_.size() + chunk.texts_.size();
+    bool ok;
+
+    if (encoding == PLAIN)
+      ok = decodePlain(page, present, chunk);
+    else if (encoding == RLE && column.physical_ == BOOLEAN)
+    {
+      ok = decodePrefixedHybrid(page, 1, present, indices);
+      for (std::size_t i = 0; ok && i < present; ++i)
+        chunk.ints_.push_back(indices[i]);
+    }
+    else if (encoding == PLAIN_DICTIONARY || encoding == RLE_DICTIONARY)
+    {
+      ok = !page.empty() && decodeHybrid(page.substr(1), (uint8_t)page[0], present, indices);
+
+      const std::size_t size = dictionary.ints_.size() + dictionary.doubles_.size() + dictionary.texts_.size();
+      for (std::size_t i = 0; ok && i < present; ++i)
+      {
+        const uint32_t index = indices[i];
+        ok = index < size;
+
+        if (!ok)
+          break;
+        else if (!dictionary.texts_.empty())
+          chunk.texts_.push_back(dictionary.texts_[index]);
+        else if (!dictionary.doubles_.empty())
+          chunk.doubles_.push_back(dictionary.doubles_[index]);
+        else
+          chunk.ints_.push_back(dictionary.ints_[index]);
+      }
+    }
+    else
+    {
+      error = "encoding " + std::to_string(encoding) + " isn't supported";
+      return false;
+    }
+
+    if (!ok)
+    {
+      error = "the values of a data page are corrupt";
+      return false;
+    }
+
+    if (!owned.empty() && column.kind_ == Kind::Text)
+      chunk.buffers_.push_back(std::move(owned));
+
+    if (!chunk.rows_.empty() || (column.optional_ && present < (std::size_t)count))
+    {
+      std::size_t next = first;
+      for (int64_t i = 0; i < count; ++i)
+        chunk.rows_.push_back(levels[i] == 1 ? (int32_t)next++ : -1);
+    }
+
+    read += count;
+  }
+
+  return true;
+}
+
+ParquetTable::Chunk & ParquetTable::useChunk(int x, int g)
+{
+  auto isChunk = [] (Chunk const& chunk, int x, int g) { return chunk.column_ == x && chunk.group_ == g; };
+
+  if (lastChunk_ < chunks_.size() && isChunk(chunks_[lastChunk_], x, g))
+  {
+    chunks_[lastChunk_].lastUse_ = ++useCount_;
+    return chunks_[lastChunk_];
+  }
+
+  for (std::size_t i = 0; i < chunks_.size(); ++i)
+  {
+    if (isChunk(chunks_[i], x, g))
+    {
+      lastChunk_ = i;
+      chunks_[i].lastUse_ = ++useCount_;
+      return chunks_[i];
+    }
+  }
+
+  // A scan of the column reads the row groups after this one too
+  std::vector<int> groups(1, g);
+  const bool scanning = std::any_of(chunks_.begin(), chunks_.end(), [&] (Chunk const& chunk) { return isChunk(chunk, x, g - 1); });
+
+  if (scanning)
+  {
+    const int ahead = std::min((int)READ_AHEAD_GROUPS, Scheduler::shared().threadCount()) - 1;
+    for (int next = g + 1; next < (int)groups_.size() && (int)groups.size() <= ahead; ++next)
+      if (std::none_of(chunks_.begin(), chunks_.end(), [&] (Chunk const& chunk) { return isChunk(chunk, x, next); }))
+        groups.push_back(next);
+  }
+
+  std::vector<Chunk> decoded(groups.size());
+  std::vector<std::string> errors(groups.size());
+  std::vector<char> failed(groups.size(), 0);
+
+  auto decodeGroup = [&] (std::size_t i) {
+    if (!decode(x, groups[i], decoded[i], errors[i]))
+    {
+      failed[i] = 1;
+      decoded[i] = Chunk();
+      decoded[i].column_ = x;
+      decoded[i].group_ = groups[i];
+    }
+  };
+
+  if (groups.size() == 1)
+    decodeGroup(0);
+  else
+  {
+    std::vector<Scheduler::Task> tasks;
+    for (std::size_t i = 0; i < groups.size(); ++i)
+      tasks.push_back([&decodeGroup, i] () { decodeGroup(i); });
+
+    Scheduler::shared().run(tasks);
+  }
+
+  // The chunks read ahead count as used now, the one asked for after them. What fails to
+  // decode is kept as empty fields, so it is only reported once.
+  for (std::size_t i = decoded.size(); i-- > 0; )
+  {
+    if (failed[i])
+      logError("Could not read row group ", groups[i], " of column '", columns_[x].name_, "': ", errors[i]);
+
+    decoded[i].lastUse_ = i == 0 ? ++useCount_ : useCount_;
+
+    std::size_t slot = chunks_.size();
+    if (chunks_.size() >= CACHED_CHUNKS)
+      slot = std::min_element(chunks_.begin(), chunks_.end(), [] (Chunk const& a, Chunk const& b) { return a.lastUse_ < b.lastUse_; }) - chunks_.begin();
+    else
+      chunks_.emplace_back();
+
+    chunks_[slot] = std::move(decoded[i]);
+    lastChunk_ = slot;
+  }
+
+  return chunks_[lastChunk_];
+}
+
+StrView ParquetTable::field(Index const& idx)
+{
+  if (idx.x < 0 || idx.x >= columnCount() || idx.y < 0 || idx.y >= rows_)
+    return StrView();
+
+  Column const& column = columns_[idx.x];
+  if (idx.y == 0)
+    return StrView(column.name_);
+
+  const int g = std::upper_bound(groups_.begin(), groups_.end(), idx.y, [] (int row, RowGroup const& group) { return row < group.first_; }) - groups_.begin() - 1;
+  Chunk const& chunk = useChunk(idx.x, g);
+
+  const std::size_t row = idx.y - groups_[g].first_;
+  const int64_t value = chunk.rows_.empty() ? (int64_t)row : row < chunk.rows_.size() ? chunk.rows_[row] : -1;
+  if (value < 0)
+    return StrView();
+
+  const std::size_t i = (std::size_t)value;
+  const bool isInt = i < chunk.ints_.size();
+  const bool isDouble = i < chunk.doubles_.size();
+
+  switch (column.kind_)
+  {
+    case Kind::Int:
+      return isInt ? StrView(scratch_, str::formatInt(chunk.ints_[i], scratch_)) : StrView();
+
+    case Kind::Unsigned:
+      if (!isInt)
+        return StrView();
+
+      if (chunk.ints_[i] < 0)
+        return StrView(scratch_, snprintf(scratch_, sizeof(scratch_), "%llu", (unsigned long long)chunk.ints_[i]));
+
+      return StrView(scratch_, str::formatInt(chunk.ints_[i], scratch_));
+
+    case Kind::Decimal:
+      return isInt ? StrView(scratch_, str::formatFixed(chunk.ints_[i] / std::pow(10.0, column.scale_), column.scale_, false, scratch_)) : StrView();
+
+    case Kind::Float:
+      return isDouble ? StrView(scratch_, str::formatFloat((float)chunk.doubles_[i], scratch_)) : StrView();
+
+    case Kind::Double:
+      return isDouble ? StrView(scratch_, str::formatDouble(chunk.doubles_[i], scratch_)) : StrView();
+
+    case Kind::Bool:
+      return isInt ? StrView(chunk.ints_[i] ? "TRUE" : "FALSE") : StrView();
+
+    case Kind::Text:
+      return i < chunk.texts_.size() ? chunk.texts_[i] : StrView();
+
+    case Kind::Date:
+      return isInt ? StrView(scratch_, str::formatDate(chunk.ints_[i], scratch_)) : StrView();
+
+    case Kind::Timestamp:
+      return isInt ? StrView(scratch_, str::formatTimestamp(chunk.ints_[i], column.units_, scratch_)) : StrView();
+
+    default:
+      return StrView();
+  }
+}
+
+bool ParquetTable::statistics(int column, int row, Statistics & statistics, int & first, int & end) const
+{
+  if (column < 0 || column >= columnCount() || row <= 0 || row >= rows_)
+    return false;
+
+  const auto group = std::upper_bound(groups_.begin(), groups_.end(), row, [] (int row, RowGroup const& group) { return row < group.first_; }) - 1;
+  ChunkInfo const& chunk = group->chunks_[column];
+  if (!chunk.hasStatistics_)
+    return false;
+
+  statistics = chunk.statistics_;
+  first = group->first_;
+  end = group->first_ + group->rows_;
+  return true;
+}
+
+std::size_t ParquetTable::memoryUsage() const
+{
+  std::size_t bytes = memory::bytes(columns_) + memory::bytes(groups_) + memory::bytes(chunks_);
+  for (auto const& group : groups_)
+    bytes += memory::bytes(group.chunks_);
+
+  for (auto const& chunk : chunks_)
+  {
+    bytes += memory::bytes(chunk.rows_) + memory::bytes(chunk.ints_) + memory::bytes(chunk.doubles_) + memory::bytes(chunk.texts_);
+    for (auto const& buffer : chunk.buffers_)
+      bytes += buffer.capacity();
+  }
+
+  return bytes;
+}
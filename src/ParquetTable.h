@@ -0,0 +1,147 @@
+#pragma once
+
+#include "Str.h"
+#include "Index.h"
+#include "MappedFile.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Read-only table of a Parquet file. Opening it maps the file and reads the metadata in
+// its footer, the column chunks are only decoded once a field of them is looked at, so
+// only the columns and row groups that are viewed or queried are ever read. A chunk read
+// right after the one before it in the same column reads the next few ones on the
+// scheduler too, so scans of a column decode row groups in parallel. The most recently
+// used chunks are kept.
+//
+// Row 0 holds the names of the columns. Uncompressed, Snappy and LZ4 compressed chunks are
+// read, with plain and dictionary encoded pages of both versions. Columns of nested and
+// repeated fields and of fixed length byte arrays read as empty fields.
+class ParquetTable
+{
+  public:
+    static const std::size_t CACHED_CHUNKS = 16;
+
+    // Row groups read at once when a column is read in order
+    static const int READ_AHEAD_GROUPS = 4;
+
+  public:
+    ParquetTable() { }
+
+    ParquetTable(ParquetTable const&) = delete;
+    ParquetTable & operator = (ParquetTable const&) = delete;
+
+    // What the statistics of a column chunk say of its row group. The range is only set
+    // for numeric columns whose chunk has one.
+    struct Statistics
+    {
+      int64_t values = 0;
+      int64_t nulls = 0;
+      bool numeric = false;
+      bool range = false;
+      double min = 0.0;
+      double max = 0.0;
+    };
+
+  public:
+    // Whether data starts the way a Parquet file does
+    static bool isParquet(StrView data);
+
+    // Maps the file and reads its metadata. Returns false with what's wrong in error if it
+    // can't be read.
+    bool open(std::string const& filename, std::string & error);
+
+    int rowCount() const { return rows_; }
+    int columnCount() const { return (int)columns_.size(); }
+
+    // Returns field idx.x of row idx.y, empty for nulls and past the end. Formatted fields
+    // are only valid until the next call.
+    StrView field(Index const& idx);
+
+    // The statistics of the row group holding row, which goes from first to end. False
+    // for the header row and chunks without statistics.
+    bool statistics(int column, int row, Statistics & statistics, int & first, int & end) const;
+
+    // Bytes of the metadata and the decoded chunks, the mapped file is not counted
+    std::size_t memoryUsage() const;
+
+  private:
+    // How the values of a column show
+    enum class Kind
+    {
+      Unsupported,
+      Int,
+      Unsigned,
+      Decimal,
+      Float,
+      Double,
+      Bool,
+      Text,
+      Date,
+      Timestamp,
+    };
+
+    struct Column
+    {
+      std::string name_;
+      int physical_ = -1;
+      Kind kind_ = Kind::Unsupported;
+      bool optional_ = false;
+
+      // Decimals of a Decimal, units in a second of a Timestamp
+      int scale_ = 0;
+      int64_t units_ = 1;
+    };
+
+    struct ChunkInfo
+    {
+      int codec_ = 0;
+      int64_t values_ = 0;
+      int64_t offset_ = 0;
+      int64_t size_ = 0;
+      bool hasStatistics_ = false;
+      Statistics statistics_;
+    };
+
+    struct RowGroup
+    {
+      int first_ = 0;
+      int rows_ = 0;
+      std::vector<ChunkInfo> chunks_;
+    };
+
+    // A decoded column chunk. Numbers go into ints_ or doubles_, text is a view into the
+    // file or into one of the decompressed pages of buffers_. rows_ has the value of every
+    // row or -1 for nulls, it is empty when no row is null.
+    struct Chunk
+    {
+      int column_ = -1;
+      int group_ = -1;
+      uint64_t lastUse_ = 0;
+      std::vector<int32_t> rows_;
+      std::vector<int64_t> ints_;
+      std::vector<double> doubles_;
+      std::vector<StrView> texts_;
+      std::vector<std::vector<char>> buffers_;
+    };
+
+    bool readMetadata(const uint8_t * data, std::size_t size, std::string & error);
+
+    // Decodes a chunk, safe to call from several threads at once
+    bool decode(int column, int group, Chunk & chunk, std::string & error) const;
+
+    Chunk & useChunk(int column, int group);
+
+  private:
+    MappedFile file_;
+    std::vector<Column> columns_;
+    std::vector<RowGroup> groups_;
+    int rows_ = 0;
+
+    std::vector<Chunk> chunks_;
+    std::size_t lastChunk_ = 0;
+    uint64_t useCount_ = 0;
+
+    char scratch_[str::FORMAT_SIZE];
+};
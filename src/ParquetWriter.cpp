@@ -0,0 +1,475 @@
+#include "ParquetWriter.h"
+#include "Thrift.h"
+#include "Lz4.h"
+#include "MurmurHash.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+static const char MAGIC[] = "PAR1";
+static const std::size_t MAGIC_SIZE = 4;
+
+// Text longer than this leaves the statistics without a range, rather than cutting it
+static const std::size_t MAX_STATISTICS_SIZE = 256;
+
+// The enums of the Parquet format
+enum
+{
+  INT64 = 2,
+  DOUBLE = 5,
+  BYTE_ARRAY = 6,
+
+  OPTIONAL = 1,
+  CONVERTED_UTF8 = 0,
+  LOGICAL_STRING = 1,
+
+  UNCOMPRESSED = 0,
+  LZ4_RAW = 7,
+
+  DATA_PAGE = 0,
+  DICTIONARY_PAGE = 2,
+
+  PLAIN = 0,
+  RLE = 3,
+  RLE_DICTIONARY = 8,
+};
+
+static int physicalType(ParquetWriter::Type type)
+{
+  switch (type)
+  {
+    case ParquetWriter::Type::Int: return INT64;
+    case ParquetWriter::Type::Double: return DOUBLE;
+    default: return BYTE_ARRAY;
+  }
+}
+
+template <typename T>
+static void append(std::string & out, T value)
+{
+  out.append((const char *)&value, sizeof(T));
+}
+
+static void appendVarint(std::string & out, uint64_t value)
+{
+  for (; value >= 0x80; value >>= 7)
+    out.push_back((char)(value | 0x80));
+
+  out.push_back((char)value);
+}
+
+// Appends the values as one bit packed run of the hybrid encoding levels and dictionary
+// indices are kept in
+template <typename Values>
+static void appendBitPacked(std::string & out, Values const& values, std::size_t count, int bitWidth)
+{
+  const std::size_t groups = (count + 7) / 8;
+  appendVarint(out, (groups << 1) | 1);
+
+  uint64_t buffer = 0;
+  int bits = 0;
+  for (std::size_t i = 0; i < groups * 8; ++i)
+  {
+    buffer |= (uint64_t)(i < count ? values[i] : 0) << bits;
+    for (bits += bitWidth; bits >= 8; bits -= 8)
+    {
+      out.push_back((char)buffer);
+      buffer >>= 8;
+    }
+  }
+}
+
+static int compareText(StrView a, StrView b)
+{
+  const int order = memcmp(a.data(), b.data(), std::min(a.size(), b.size()));
+  return order != 0 ? order : a.size() < b.size() ? -1 : a.size() > b.size() ? 1 : 0;
+}
+
+bool ParquetWriter::open(std::string const& filename, bool compress)
+{
+  if (!writer_.open(filename))
+    return false;
+
+  compress_ = compress;
+  writer_.write(MAGIC, MAGIC_SIZE);
+  offset_ = MAGIC_SIZE;
+  return true;
+}
+
+void ParquetWriter::addColumn(std::string const& name, Type type)
+{
+  columns_.emplace_back();
+  columns_.back().name_ = name;
+  columns_.back().type_ = type;
+}
+
+void ParquetWriter::addNull()
+{
+  columns_[column_].defined_.push_back(0);
+  endValue();
+}
+
+void ParquetWriter::addInt(int64_t value)
+{
+  Column & column = columns_[column_];
+  column.defined_.push_back(1);
+  column.ints_.push_back(value);
+  endValue();
+}
+
+void ParquetWriter::addDouble(double value)
+{
+  Column & column = columns_[column_];
+  column.defined_.push_back(1);
+  column.doubles_.push_back(value);
+  endValue();
+}
+
+void ParquetWriter::addText(StrView value)
+{
+  Column & column = columns_[column_];
+  column.defined_.push_back(1);
+  column.text_.append(value.data(), value.size());
+  column.ends_.push_back(column.text_.size());
+  endValue();
+}
+
+void ParquetWriter::endValue()
+{
+  if (++column_ < columns_.size())
+    return;
+
+  column_ = 0;
+  if (++rows_ == ROW_GROUP_ROWS)
+    writeRowGroup();
+}
+
+int64_t ParquetWriter::writePage(int type, std::string const& data, int values, int encoding)
+{
+  if (data.size() > (std::size_t)std::numeric_limits<int32_t>::max())
+  {
+    failed_ = true;
+    return 0;
+  }
+
+  StrView body(data);
+  if (compress_)
+  {
+    compressed_.resize(lz4::bound(data.size()));
+    body = StrView(compressed_.data(), lz4::compress(StrView(data), compressed_.data()));
+  }
+
+  thrift::CompactWriter header;
+  header.beginStruct();
+  header.writeInt(1, thrift::I32, type);
+  header.writeInt(2, thrift::I32, data.size());
+  header.writeInt(3, thrift::I32, body.size());
+
+  header.beginStruct(type == DATA_PAGE ? 5 : 7);
+  header.writeInt(1, thrift::I32, values);
+  header.writeInt(2, thrift::I32, encoding);
+  if (type == DATA_PAGE)
+  {
+    header.writeInt(3, thrift::I32, RLE);
+    header.writeInt(4, thrift::I32, RLE);
+  }
+  header.endStruct();
+  header.endStruct();
+
+  writer_.write(header.data());
+  writer_.write(body);
+  offset_ += header.data().size() + body.size();
+  return header.data().size() + data.size();
+}
+
+void ParquetWriter::writeColumn(Column & column, ChunkMetadata & chunk)
+{
+  const std::size_t count = column.defined_.size();
+  const std::size_t values = column.ints_.size() + column.doubles_.size() + column.ends_.size();
+
+  chunk.values_ = count;
+  chunk.nulls_ = count - values;
+
+  // The definition levels, 1 for values and 0 for nulls, behind their size
+  page_.clear();
+  append<uint32_t>(page_, 0);
+
+  if (chunk.nulls_ == 0)
+  {
+    appendVarint(page_, count << 1);
+    page_.push_back(1);
+  }
+  else
+    appendBitPacked(page_, column.defined_, count, 1);
+
+  const uint32_t levelsSize = page_.size() - 4;
+  memcpy(&page_[0], &levelsSize, 4);
+
+  int encoding = PLAIN;
+
+  if (column.type_ == Type::Int)
+  {
+    for (const int64_t value : column.ints_)
+      append(page_, value);
+
+    if (values > 0)
+    {
+      auto range = std::minmax_element(column.ints_.begin(), column.ints_.end());
+      chunk.hasRange_ = true;
+      append(chunk.min_, *range.first);
+      append(chunk.max_, *range.second);
+    }
+  }
+  else if (column.type_ == Type::Double)
+  {
+    double min = std::numeric_limits<double>::infinity();
+    double max = -min;
+
+    for (const double value : column.doubles_)
+    {
+      append(page_, value);
+
+      if (!std::isnan(value))
+      {
+        min = std::min(min, value);
+        max = std::max(max, value);
+      }
+    }
+
+    // A zero range is written as -0 to +0, so either zero falls in it
+    if (min <= max)
+    {
+      chunk.hasRange_ = true;
+      append(chunk.min_, min == 0.0 ? -0.0 : min);
+      append(chunk.max_, max == 0.0 ? 0.0 : max);
+    }
+  }
+  else
+  {
+    auto text = [&] (std::size_t i) { return StrView(column.text_.data() + (i ? column.ends_[i - 1] : 0), column.ends_[i] - (i ? column.ends_[i - 1] : 0)); };
+
+    // The first value of every entry of the dictionary. Hashes that collide move on to
+    // the keys above the 32 bits of the hash.
+    std::vector<uint32_t> entries;
+    std::vector<uint32_t> indices(values);
+    dictionary_.clear();
+
+    for (std::size_t i = 0; i < values && entries.size() <= values / 2; ++i)
+    {
+      const StrView value = text(i);
+      for (uint64_t key = murmurHash(value.data(), value.size(), 0); ; key += (uint64_t)1 << 32)
+      {
+        auto inserted = dictionary_.insert(key, (uint32_t)entries.size());
+        if (inserted.second)
+          entries.push_back(i);
+        else if (!(text(entries[*inserted.first]) == value))
+          continue;
+
+        indices[i] = *inserted.first;
+        break;
+      }
+    }
+
+    if (values > 0 && entries.size() <= values / 2)
+    {
+      std::string dictionary;
+      for (const uint32_t entry : entries)
+      {
+        const StrView value = text(entry);
+        append<uint32_t>(dictionary, value.size());
+        dictionary.append(value.data(), value.size());
+      }
+
+      chunk.dictionaryOffset_ = offset_;
+      chunk.uncompressedSize_ += writePage(DICTIONARY_PAGE, dictionary, entries.size(), PLAIN);
+
+      int bitWidth = 1;
+      while (((std::size_t)1 << bitWidth) < entries.size())
+        ++bitWidth;
+
+      page_.push_back((char)bitWidth);
+      appendBitPacked(page_, indices, values, bitWidth);
+      encoding = RLE_DICTIONARY;
+    }
+    else
+    {
+      for (std::size_t i = 0; i < values; ++i)
+      {
+        const StrView value = text(i);
+        append<uint32_t>(page_, value.size());
+        page_.append(value.data(), value.size());
+      }
+    }
+
+    if (values > 0)
+    {
+      StrView min = text(0);
+      StrView max = min;
+      for (std::size_t i = 1; i < values; ++i)
+      {
+        const StrView value = text(i);
+        if (compareText(value, min) < 0)
+          min = value;
+        if (compareText(value, max) > 0)
+          max = value;
+      }
+
+      if (min.size() <= MAX_STATISTICS_SIZE && max.size() <= MAX_STATISTICS_SIZE)
+      {
+        chunk.hasRange_ = true;
+        chunk.min_ = min.str();
+        chunk.max_ = max.str();
+      }
+    }
+  }
+
+  chunk.offset_ = offset_;
+  chunk.uncompressedSize_ += writePage(DATA_PAGE, page_, count, encoding);
+  chunk.size_ = offset_ - (chunk.dictionaryOffset_ >= 0 ? chunk.dictionaryOffset_ : chunk.offset_);
+
+  column.defined_.clear();
+  column.ints_.clear();
+  column.doubles_.clear();
+  column.text_.clear();
+  column.ends_.clear();
+}
+
+void ParquetWriter::writeRowGroup()
+{
+  if (rows_ == 0)
+    return;
+
+  groups_.emplace_back();
+  RowGroupMetadata & group = groups_.back();
+  group.rows_ = rows_;
+  group.chunks_.resize(columns_.size());
+
+  for (std::size_t i = 0; i < columns_.size(); ++i)
+    writeColumn(columns_[i], group.chunks_[i]);
+
+  rows_ = 0;
+}
+
+bool ParquetWriter::close()
+{
+  // A row cut short ends in nulls
+  while (column_ > 0)
+    addNull();
+
+  writeRowGroup();
+
+  int64_t rows = 0;
+  for (auto const& group : groups_)
+    rows += group.rows_;
+
+  thrift::CompactWriter metadata;
+  metadata.beginStruct();
+  metadata.writeInt(1, thrift::I32, 1);
+
+  // The schema is a root holding every column
+  metadata.beginList(2, thrift::STRUCT, columns_.size() + 1);
+  metadata.beginStruct();
+  metadata.writeBinary(4, StrView("schema"));
+  metadata.writeInt(5, thrift::I32, columns_.size());
+  metadata.endStruct();
+
+  for (auto const& column : columns_)
+  {
+    metadata.beginStruct();
+    metadata.writeInt(1, thrift::I32, physicalType(column.type_));
+    metadata.writeInt(3, thrift::I32, OPTIONAL);
+    metadata.writeBinary(4, column.name_);
+
+    if (column.type_ == Type::Text)
+    {
+      metadata.writeInt(6, thrift::I32, CONVERTED_UTF8);
+      metadata.beginStruct(10);
+      metadata.beginStruct(LOGICAL_STRING);
+      metadata.endStruct();
+      metadata.endStruct();
+    }
+
+    metadata.endStruct();
+  }
+
+  metadata.writeInt(3, thrift::I64, rows);
+
+  metadata.beginList(4, thrift::STRUCT, groups_.size());
+  for (auto const& group : groups_)
+  {
+    int64_t bytes = 0;
+
+    metadata.beginStruct();
+    metadata.beginList(1, thrift::STRUCT, group.chunks_.size());
+
+    for (std::size_t i = 0; i < group.chunks_.size(); ++i)
+    {
+      ChunkMetadata const& chunk = group.chunks_[i];
+      Column const& column = columns_[i];
+      const bool dictionary = chunk.dictionaryOffset_ >= 0;
+      bytes += chunk.uncompressedSize_;
+
+      metadata.beginStruct();
+      metadata.writeInt(2, thrift::I64, dictionary ? chunk.dictionaryOffset_ : chunk.offset_);
+
+      metadata.beginStruct(3);
+      metadata.writeInt(1, thrift::I32, physicalType(column.type_));
+
+      metadata.beginList(2, thrift::I32, dictionary ? 3 : 2);
+      metadata.writeInt(PLAIN);
+      metadata.writeInt(RLE);
+      if (dictionary)
+        metadata.writeInt(RLE_DICTIONARY);
+
+      metadata.beginList(3, thrift::BINARY, 1);
+      metadata.writeBinary(column.name_);
+
+      metadata.writeInt(4, thrift::I32, compress_ ? LZ4_RAW : UNCOMPRESSED);
+      metadata.writeInt(5, thrift::I64, chunk.values_);
+      metadata.writeInt(6, thrift::I64, chunk.uncompressedSize_);
+      metadata.writeInt(7, thrift::I64, chunk.size_);
+      metadata.writeInt(9, thrift::I64, chunk.offset_);
+      if (dictionary)
+        metadata.writeInt(11, thrift::I64, chunk.dictionaryOffset_);
+
+      metadata.beginStruct(12);
+      metadata.writeInt(3, thrift::I64, chunk.nulls_);
+      if (chunk.hasRange_)
+      {
+        metadata.writeBinary(5, chunk.max_);
+        metadata.writeBinary(6, chunk.min_);
+      }
+      metadata.endStruct();
+
+      metadata.endStruct();
+      metadata.endStruct();
+    }
+
+    metadata.writeInt(2, thrift::I64, bytes);
+    metadata.writeInt(3, thrift::I64, group.rows_);
+    metadata.endStruct();
+  }
+
+  metadata.writeBinary(6, StrView("zum"));
+
+  // Every column is ordered the way its type is
+  metadata.beginList(7, thrift::STRUCT, columns_.size());
+  for (std::size_t i = 0; i < columns_.size(); ++i)
+  {
+    metadata.beginStruct();
+    metadata.beginStruct(1);
+    metadata.endStruct();
+    metadata.endStruct();
+  }
+
+  metadata.endStruct();
+
+  const uint32_t size = metadata.data().size();
+  writer_.write(metadata.data());
+  writer_.write((const char *)&size, 4);
+  writer_.write(MAGIC, MAGIC_SIZE);
+
+  return writer_.close() && !failed_;
+}
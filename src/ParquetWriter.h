@@ -0,0 +1,101 @@
+#pragma once
+
+#include "Str.h"
+#include "FileWriter.h"
+#include "FlatHashMap.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Writes a table to a Parquet file a row at a time. The columns are added first, then
+// the values of every row in the order of the columns. The rows are written in row
+// groups of ROW_GROUP_ROWS once there are enough of them, every column chunk as one
+// data page of optional values with its statistics. Text columns are dictionary encoded
+// unless most of their values differ, and the pages are LZ4 compressed if asked to.
+class ParquetWriter
+{
+  public:
+    static const int ROW_GROUP_ROWS = 1 << 17;
+
+    enum class Type
+    {
+      Int,
+      Double,
+      Text,
+    };
+
+  public:
+    ParquetWriter() { }
+
+    ParquetWriter(ParquetWriter const&) = delete;
+    ParquetWriter & operator = (ParquetWriter const&) = delete;
+
+    bool open(std::string const& filename, bool compress);
+
+    void addColumn(std::string const& name, Type type);
+
+    // The value of the next column of the current row, which ends after the last column
+    void addNull();
+    void addInt(int64_t value);
+    void addDouble(double value);
+    void addText(StrView value);
+
+    // Writes the rows left and the footer, returns false if anything could not be written
+    bool close();
+
+  private:
+    // The values of a column in the current row group. Text is kept as one run of bytes
+    // with where every value ends.
+    struct Column
+    {
+      std::string name_;
+      Type type_;
+      std::vector<uint8_t> defined_;
+      std::vector<int64_t> ints_;
+      std::vector<double> doubles_;
+      std::string text_;
+      std::vector<uint32_t> ends_;
+    };
+
+    // Where a column chunk went in the file, for the footer
+    struct ChunkMetadata
+    {
+      int64_t offset_ = 0;
+      int64_t dictionaryOffset_ = -1;
+      int64_t values_ = 0;
+      int64_t nulls_ = 0;
+      int64_t size_ = 0;
+      int64_t uncompressedSize_ = 0;
+      bool hasRange_ = false;
+      std::string min_;
+      std::string max_;
+    };
+
+    struct RowGroupMetadata
+    {
+      int64_t rows_ = 0;
+      std::vector<ChunkMetadata> chunks_;
+    };
+
+    void endValue();
+    void writeRowGroup();
+    void writeColumn(Column & column, ChunkMetadata & chunk);
+
+    // Writes a page with its header, compressed if the file is
+    int64_t writePage(int type, std::string const& data, int values, int encoding);
+
+  private:
+    FileWriter writer_;
+    bool compress_ = false;
+    bool failed_ = false;
+    int64_t offset_ = 0;
+    std::vector<Column> columns_;
+    std::size_t column_ = 0;
+    int rows_ = 0;
+    std::vector<RowGroupMetadata> groups_;
+
+    std::string page_;
+    std::vector<char> compressed_;
+    FlatHashMap<uint32_t> dictionary_;
+};
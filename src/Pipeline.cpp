@@ -0,0 +1,128 @@
+#include "Pipeline.h"
+#include "Scheduler.h"
+
+#include <algorithm>
+
+namespace pipeline {
+
+  // Batches in flight per worker, enough that a worker doesn't wait for the calling
+  // thread to read the next one
+  static const std::size_t BATCHES_PER_THREAD = 2;
+
+  void Batch::addRow(StrView const* fields, std::size_t count)
+  {
+    for (std::size_t c = columns_.size(); c < count; ++c)
+      columns_.emplace_back(rows_, StrView());
+
+    for (std::size_t c = 0; c < columns_.size(); ++c)
+      columns_[c].push_back(c < count ? fields[c] : StrView());
+
+    selection_.push_back(rows_++);
+  }
+
+  StrView Batch::keep(StrView text)
+  {
+    return text.empty() ? StrView() : StrView(arena_.copy(text.data(), text.size()), text.size());
+  }
+
+  void Batch::clear()
+  {
+    // The slices keep their capacity for the next batch
+    for (auto & column : columns_)
+      column.clear();
+
+    columns_.clear();
+    selection_.clear();
+    rows_ = 0;
+    data_.clear();
+    arena_.clear();
+  }
+
+  void Plan::add(std::unique_ptr<Operator> op)
+  {
+    if (!operators_.empty())
+      operators_.back()->connect(op.get());
+
+    operators_.push_back(std::move(op));
+  }
+
+  bool Plan::run(Source & source)
+  {
+    std::vector<std::string> header;
+    if (!source.start(header))
+      return false;
+
+    for (auto & op : operators_)
+      if (!op->start(header))
+        return false;
+
+    // The operators before the first that takes batches in order run with the source
+    std::size_t parallel = 0;
+    while (parallel < operators_.size() && operators_[parallel]->perBatch())
+      parallel++;
+
+    Operator * ordered = parallel < operators_.size() ? operators_[parallel].get() : nullptr;
+
+    const std::size_t batchCount = std::max(Scheduler::shared().threadCount(), 1) * BATCHES_PER_THREAD;
+    std::vector<Batch> batches[2];
+    std::vector<char> results[2];
+    std::size_t used[2] = { 0, 0 };
+
+    for (auto & set : batches)
+      set.resize(batchCount);
+
+    TaskGroup group;
+    bool end = false;
+    bool failed = false;
+
+    // Reads the batches of a set and has them made and narrowed on the scheduler
+    auto start = [&] (int set) {
+      std::size_t count = 0;
+      for (; count < batchCount && !end; ++count)
+      {
+        batches[set][count].clear();
+        if (!source.read(batches[set][count], end))
+        {
+          failed = true;
+          break;
+        }
+      }
+
+      used[set] = count;
+      results[set].assign(count, 1);
+
+      for (std::size_t i = 0; i < count; ++i)
+        group.spawn([this, &source, &batches, &results, set, i, parallel] () {
+          Batch & batch = batches[set][i];
+
+          bool ok = source.parse(batch);
+          for (std::size_t op = 0; ok && op < parallel && !batch.selection_.empty(); ++op)
+            ok = static_cast<BatchOperator const&>(*operators_[op]).apply(batch);
+
+          results[set][i] = ok;
+        });
+    };
+
+    start(0);
+
+    for (int current = 0; used[current] > 0 && !failed; current ^= 1)
+    {
+      group.wait();
+
+      used[current ^ 1] = 0;
+      if (!end && !failed)
+        start(current ^ 1);
+
+      for (std::size_t i = 0; i < used[current] && !failed; ++i)
+      {
+        Batch & batch = batches[current][i];
+        failed = !results[current][i] || (ordered && !batch.selection_.empty() && !ordered->push(batch));
+      }
+    }
+
+    // The tasks of the other set refer to its batches
+    group.wait();
+
+    return !failed && (!ordered || ordered->finish());
+  }
+}
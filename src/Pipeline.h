@@ -0,0 +1,122 @@
+#pragma once
+
+#include "Str.h"
+#include "Arena.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Push based plans for the data commands the pipeline command chains, like
+//
+//   pipeline load x.csv | filter B -gt 10 | groupby A -sum B | export y.csv
+//
+// A source cuts its rows into batches that are pushed down a chain of operators. A batch
+// holds a slice of every column and the selection vector of the rows of it that are
+// still in, in the order they go on in. The operators at the head of the chain that look
+// at one batch at a time run on the scheduler, several batches at once and together with
+// the source making them. From the first operator that takes its batches in order on,
+// the batches go through on the calling thread. Operators that need all of their input,
+// like sort and groupby, hold what they need of it and push their result on once the
+// input ends, no other operator keeps a row after its batch went through.
+namespace pipeline {
+
+  // Rows per batch for sources that are free to choose
+  static const std::size_t BATCH_ROWS = 4096;
+
+  // A slice of rows, field c of row r is columns_[c][r]. Fields point into data_, into
+  // arena_ or into what the operator that pushed the batch keeps until push() returns.
+  struct Batch
+  {
+    std::vector<std::vector<StrView>> columns_;
+    std::vector<uint32_t> selection_;
+    std::size_t rows_ = 0;
+
+    std::string data_;
+    Arena arena_;
+
+    StrView field(std::size_t column, uint32_t row) const { return column < columns_.size() ? columns_[column][row] : StrView(); }
+
+    // Appends the row of count fields and selects it, missing fields are empty
+    void addRow(StrView const* fields, std::size_t count);
+
+    // A copy of text that lives as long as the batch
+    StrView keep(StrView text);
+
+    void clear();
+  };
+
+  class Operator
+  {
+    public:
+      virtual ~Operator() { }
+
+      // Whether the operator only looks at the batch it is given, see BatchOperator
+      virtual bool perBatch() const { return false; }
+
+      // Turns the names of the input columns into the names of the columns the operator
+      // pushes on. Without a header they are empty. Called once before the first batch.
+      virtual bool start(std::vector<std::string> & /*header*/) { return true; }
+
+      // Takes the next batch of the input. Returns false, having logged why, to stop
+      // the plan.
+      virtual bool push(Batch & batch) = 0;
+
+      // The input ended
+      virtual bool finish() { return !next_ || next_->finish(); }
+
+      void connect(Operator * next) { next_ = next; }
+
+    protected:
+      bool emit(Batch & batch) { return !next_ || batch.selection_.empty() || next_->push(batch); }
+
+    protected:
+      Operator * next_ = nullptr;
+  };
+
+  // An operator that narrows or changes each batch on its own. apply() may run for
+  // several batches at once on the scheduler, so it only reads the operator.
+  class BatchOperator : public Operator
+  {
+    public:
+      bool perBatch() const override { return true; }
+
+      virtual bool apply(Batch & batch) const = 0;
+
+      bool push(Batch & batch) override { return apply(batch) && emit(batch); }
+  };
+
+  class Source
+  {
+    public:
+      virtual ~Source() { }
+
+      // The names of the columns, left empty without a header
+      virtual bool start(std::vector<std::string> & header) = 0;
+
+      // Takes the next part of the input into batch, on the calling thread, and sets end
+      // once there is no more. Returns false, having logged why, if it can't be read.
+      virtual bool read(Batch & batch, bool & end) = 0;
+
+      // Makes the rows of what read() took, on the scheduler
+      virtual bool parse(Batch & /*batch*/) const { return true; }
+  };
+
+  class Plan
+  {
+    public:
+      // Appends op to the chain
+      void add(std::unique_ptr<Operator> op);
+
+      bool empty() const { return operators_.empty(); }
+
+      // Pushes all of source through the chain. Returns false if the source or an operator
+      // failed, which they log.
+      bool run(Source & source);
+
+    private:
+      std::vector<std::unique_ptr<Operator>> operators_;
+  };
+}
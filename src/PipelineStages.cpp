@@ -0,0 +1,1014 @@
+#include "PipelineStages.h"
+#include "Pipeline.h"
+#include "DocumentState.h"
+#include "Document.h"
+#include "FileWriter.h"
+#include "Gzip.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_set>
+
+namespace doc {
+
+  // The text a cell gives the operators of a pipeline, formulas give their value and
+  // other cells their text, the way filter compares them
+  static StrView pipelineText(Document & doc, Index const& idx, std::string & scratch)
+  {
+    if (doc.paged_)
+    {
+      scratch = pagedText(doc, idx);
+      return scratch;
+    }
+
+    Cell * cell = doc.cells_.find(idx);
+    if (!cell)
+      return columnFormulaText(doc, idx, scratch);
+
+    return filterDisplayText(doc, *cell, scratch);
+  }
+
+  // The number a field of a pipeline holds, NaN if it holds none
+  static double pipelineNumber(StrView text)
+  {
+    double number = NAN;
+    if (text.empty() || text[0] == '=' || !str::parseValue(text, number))
+      return NAN;
+
+    return number;
+  }
+
+  // A source of the text of CSV fields, which the export of a pipeline writes with the
+  // same delimiter
+  class TextSource : public pipeline::Source
+  {
+    public:
+      char delimiter() const { return delimiter_; }
+
+    protected:
+      char delimiter_ = ',';
+  };
+
+  // The rows of the current buffer from the one after the header on, read on the calling
+  // thread since formulas are evaluated on the way
+  class BufferSource : public TextSource
+  {
+    public:
+      explicit BufferSource(bool header) : header_(header) { }
+
+      bool start(std::vector<std::string> & header) override
+      {
+        doc_ = currentBuffer().doc_;
+        delimiter_ = doc_->delimiter_;
+        rowCount_ = getRowCount();
+        next_ = header_ ? 1 : 0;
+
+        if (header_ && rowCount_ > 0)
+          for (int x = 0; x < doc_->width_; ++x)
+            header.push_back(pipelineText(*doc_, Index(x, documentRow(0)), scratch_).str());
+
+        return true;
+      }
+
+      bool read(pipeline::Batch & batch, bool & end) override
+      {
+        const int last = std::min(next_ + (int)pipeline::BATCH_ROWS, rowCount_);
+        fields_.resize(doc_->width_);
+
+        for (int y = next_; y < last; ++y)
+        {
+          const int row = documentRow(y);
+          for (int x = 0; x < doc_->width_; ++x)
+          {
+            const StrView text = pipelineText(*doc_, Index(x, row), scratch_);
+            fields_[x] = text.data() == scratch_.data() ? batch.keep(text) : text;
+          }
+
+          batch.addRow(fields_.data(), fields_.size());
+        }
+
+        next_ = last;
+        end = next_ >= rowCount_;
+        return true;
+      }
+
+    private:
+      bool header_;
+      std::shared_ptr<Document> doc_;
+      int rowCount_ = 0;
+      int next_ = 0;
+      std::vector<StrView> fields_;
+      std::string scratch_;
+  };
+
+  // The lines of a CSV file, read a chunk of whole lines at a time on the calling thread
+  // and split into fields on the scheduler. Fields are what loading would store in cells.
+  class CsvFileSource : public TextSource
+  {
+    public:
+      CsvFileSource(std::string const& filename, bool header) : filename_(filename), header_(header) { }
+      ~CsvFileSource() { if (file_) fclose(file_); }
+
+      bool start(std::vector<std::string> & header) override
+      {
+        file_ = fopen(filename_.c_str(), "rb");
+        if (!file_)
+        {
+          logError("could not open '", filename_, "'");
+          return false;
+        }
+
+        if (!fill())
+          return false;
+
+        if (gzip::isGzip(pending_))
+        {
+          logError("compressed files can't go through a pipeline, load '", filename_, "' instead");
+          return false;
+        }
+
+        delimiter_ = detectDelimiter(pending_);
+        if (!header_)
+          return true;
+
+        // The header is the first line, which ends at the first line break after an even
+        // number of quotes
+        std::size_t end = 0;
+        for (std::size_t quotes = 0, pos = 0; end == 0; )
+        {
+          const std::size_t newline = pending_.find('\n', pos);
+          if (newline == std::string::npos)
+          {
+            if (eof_)
+              end = pending_.size();
+            else if (!fill())
+              return false;
+
+            continue;
+          }
+
+          quotes += csv::count(StrView(pending_).substr(pos, newline - pos), csv::QUOTE);
+          pos = newline + 1;
+
+          if (quotes % 2 == 0)
+            end = pos;
+        }
+
+        csv::Reader reader(delimiter_);
+        reader.read(StrView(pending_.data(), end), [&header] (StrView text, bool) {
+          header.push_back(fieldValue(text).str());
+        });
+
+        pending_.erase(0, end);
+        return true;
+      }
+
+      bool read(pipeline::Batch & batch, bool & end) override
+      {
+        if (!fill())
+          return false;
+
+        // A line longer than a chunk is read on until it ends
+        std::size_t size = eof_ ? pending_.size() : wholeLines(pending_);
+        while (size == 0 && !eof_)
+        {
+          if (!fill())
+            return false;
+
+          size = eof_ ? pending_.size() : wholeLines(pending_);
+        }
+
+        batch.data_.assign(pending_, 0, size);
+        pending_.erase(0, size);
+
+        end = eof_ && pending_.empty();
+        return true;
+      }
+
+      bool parse(pipeline::Batch & batch) const override
+      {
+        const StrView data(batch.data_);
+        std::vector<StrView> fields;
+
+        csv::Reader reader(delimiter_);
+        reader.read(data, [&] (StrView text, bool lineEnd) {
+          // Fields with doubled quotes are in the reader until the next one
+          const StrView value = fieldValue(text);
+          const bool inData = value.data() >= data.data() && value.data() + value.size() <= data.data() + data.size();
+          fields.push_back(inData ? value : batch.keep(value));
+
+          if (lineEnd)
+          {
+            batch.addRow(fields.data(), fields.size());
+            fields.clear();
+          }
+        });
+
+        // The last line of the file may not end in a line break
+        if (!fields.empty())
+          batch.addRow(fields.data(), fields.size());
+
+        return true;
+      }
+
+    private:
+      // The text of field without the format loading takes off it
+      static StrView fieldValue(StrView field)
+      {
+        const std::size_t start = field.find(StrView("#{", 2));
+        return start != StrView::npos && field.find('}', start) != StrView::npos ? field.substr(0, start) : field;
+      }
+
+      // Appends a chunk of the file to pending_
+      bool fill()
+      {
+        if (eof_)
+          return true;
+
+        const std::size_t chunkSize = loadChunkSize();
+        const std::size_t used = pending_.size();
+
+        pending_.resize(used + chunkSize);
+        pending_.resize(used + fread(&pending_[used], 1, chunkSize, file_));
+        eof_ = pending_.size() < used + chunkSize;
+
+        if (ferror(file_))
+        {
+          logError("could not read '", filename_, "'");
+          return false;
+        }
+
+        return true;
+      }
+
+    private:
+      std::string filename_;
+      bool header_;
+      FILE * file_ = nullptr;
+      std::string pending_;
+      bool eof_ = false;
+  };
+
+  // Keeps the rows that pass every clause, see filterIncludes()
+  class FilterOperator : public pipeline::BatchOperator
+  {
+    public:
+      explicit FilterOperator(std::vector<FilterClause> clauses) : clauses_(std::move(clauses)) { }
+
+      bool apply(pipeline::Batch & batch) const override
+      {
+        std::size_t kept = 0;
+        for (const uint32_t row : batch.selection_)
+        {
+          bool include = true;
+          for (auto const& clause : clauses_)
+          {
+            // Empty fields never pass
+            const StrView text = batch.field(clause.column, row);
+            if (text.empty())
+            {
+              include = false;
+              break;
+            }
+
+            double number = 0.0;
+            const bool isNumber = text[0] != '=' && str::parseValue(text, number);
+            if (!filterIncludes(clause, text, isNumber, number, include))
+              return false;
+
+            if (!include)
+              break;
+          }
+
+          if (include)
+            batch.selection_[kept++] = row;
+        }
+
+        batch.selection_.resize(kept);
+        return true;
+      }
+
+    private:
+      std::vector<FilterClause> clauses_;
+  };
+
+  // Leaves the first of the rows that are equal in columns, or in every column
+  class DedupeOperator : public pipeline::Operator
+  {
+    public:
+      explicit DedupeOperator(std::vector<int> columns) : columns_(std::move(columns)) { }
+
+      bool push(pipeline::Batch & batch) override
+      {
+        std::size_t kept = 0;
+        for (const uint32_t row : batch.selection_)
+        {
+          // The fields with their sizes, so that no two rows of other fields make the same key
+          key_.clear();
+
+          // Without columns the empty fields at the end of a row don't count, rows are the
+          // same however wide they are
+          std::size_t count = columns_.size();
+          if (columns_.empty())
+            for (count = batch.columns_.size(); count > 0 && batch.columns_[count - 1][row].empty(); )
+              count--;
+
+          for (std::size_t c = 0; c < count; ++c)
+          {
+            const StrView text = batch.field(columns_.empty() ? c : columns_[c], row);
+            key_.append(std::to_string(text.size())).append(1, ':').append(text.data(), text.size());
+          }
+
+          if (seen_.insert(key_).second)
+            batch.selection_[kept++] = row;
+        }
+
+        batch.selection_.resize(kept);
+        return emit(batch);
+      }
+
+    private:
+      std::vector<int> columns_;
+      std::unordered_set<std::string> seen_;
+      std::string key_;
+  };
+
+  // Holds every row and pushes them on sorted on the keys, rows that are equal on all of
+  // them keep their order. Empty fields and fields without a number go last.
+  class SortOperator : public pipeline::Operator
+  {
+    public:
+      explicit SortOperator(std::vector<SortKey> keys) : keys_(std::move(keys)) { }
+
+      bool push(pipeline::Batch & batch) override
+      {
+        std::vector<StrView> fields(batch.columns_.size());
+        for (const uint32_t row : batch.selection_)
+        {
+          for (std::size_t c = 0; c < fields.size(); ++c)
+            fields[c] = rows_.keep(batch.columns_[c][row]);
+
+          rows_.addRow(fields.data(), fields.size());
+        }
+
+        return true;
+      }
+
+      bool finish() override
+      {
+        std::vector<std::vector<uint64_t>> numbers(keys_.size());
+        for (std::size_t k = 0; k < keys_.size(); ++k)
+        {
+          if (!keys_[k].numeric)
+            continue;
+
+          numbers[k].resize(rows_.rows_, UINT64_MAX);
+          for (std::size_t row = 0; row < rows_.rows_; ++row)
+          {
+            const double number = pipelineNumber(rows_.field(keys_[k].column, row));
+            if (!std::isnan(number))
+            {
+              const uint64_t key = orderedKey(number);
+              numbers[k][row] = std::min(keys_[k].descending ? ~key : key, UINT64_MAX - 1);
+            }
+          }
+        }
+
+        std::stable_sort(rows_.selection_.begin(), rows_.selection_.end(), [&] (uint32_t a, uint32_t b) {
+          for (std::size_t k = 0; k < keys_.size(); ++k)
+          {
+            if (keys_[k].numeric)
+            {
+              if (numbers[k][a] != numbers[k][b])
+                return numbers[k][a] < numbers[k][b];
+
+              continue;
+            }
+
+            const StrView lhs = rows_.field(keys_[k].column, a);
+            const StrView rhs = rows_.field(keys_[k].column, b);
+            if (lhs == rhs)
+              continue;
+
+            if (lhs.empty() || rhs.empty())
+              return rhs.empty();
+
+            return keys_[k].descending ? rhs < lhs : lhs < rhs;
+          }
+
+          return false;
+        });
+
+        return emit(rows_) && Operator::finish();
+      }
+
+    private:
+      std::vector<SortKey> keys_;
+      pipeline::Batch rows_;
+  };
+
+  // Pushes on the count rows with the largest numbers in column, largest first, or the
+  // smallest with ascending. Only those rows are held, see offerTop().
+  class TopOperator : public pipeline::Operator
+  {
+    public:
+      TopOperator(std::size_t count, int column, bool ascending) : count_(count), column_(column), ascending_(ascending) { }
+
+      bool push(pipeline::Batch & batch) override
+      {
+        for (const uint32_t row : batch.selection_)
+        {
+          const double number = pipelineNumber(batch.field(column_, row));
+          if (std::isnan(number))
+            continue;
+
+          const uint64_t key = orderedKey(number + 0.0);
+          const TopEntry entry(ascending_ ? key : ~key, seen_++);
+
+          // The slot of the row the entry replaces is taken over
+          std::size_t slot = slots_.size();
+          if (heap_.size() == count_)
+          {
+            if (count_ == 0 || !(entry < heap_.front().first))
+              continue;
+
+            std::pop_heap(heap_.begin(), heap_.end());
+            slot = heap_.back().second;
+            heap_.pop_back();
+          }
+          else
+            slots_.emplace_back();
+
+          std::vector<std::string> & fields = slots_[slot];
+          fields.resize(batch.columns_.size());
+          for (std::size_t c = 0; c < fields.size(); ++c)
+            fields[c].assign(batch.columns_[c][row].data(), batch.columns_[c][row].size());
+
+          heap_.emplace_back(entry, slot);
+          std::push_heap(heap_.begin(), heap_.end());
+        }
+
+        return true;
+      }
+
+      bool finish() override
+      {
+        std::sort(heap_.begin(), heap_.end());
+
+        pipeline::Batch batch;
+        std::vector<StrView> fields;
+        for (auto const& it : heap_)
+        {
+          fields.assign(slots_[it.second].begin(), slots_[it.second].end());
+          batch.addRow(fields.data(), fields.size());
+        }
+
+        return emit(batch) && Operator::finish();
+      }
+
+    private:
+      std::size_t count_;
+      int column_;
+      bool ascending_;
+      uint32_t seen_ = 0;
+      std::vector<std::pair<TopEntry, std::size_t>> heap_;
+      std::vector<std::vector<std::string>> slots_;
+  };
+
+  // Aggregates the rows of every key of column, see the groupby command. Only the groups
+  // are held, and pushed on in the order of their first row.
+  class GroupbyOperator : public pipeline::Operator
+  {
+    public:
+      GroupbyOperator(int column, std::vector<Aggregate> aggregates, std::vector<int> inputColumns)
+        : column_(column), aggregates_(std::move(aggregates)), inputColumns_(std::move(inputColumns)) { }
+
+      bool start(std::vector<std::string> & header) override
+      {
+        if (header.empty())
+          return true;
+
+        std::vector<std::string> names(1, column_ < (int)header.size() ? header[column_] : std::string());
+        for (auto const& aggregate : aggregates_)
+          names.push_back(aggregateName(aggregate, aggregate.column < (int)header.size() ? header[aggregate.column] : std::string()));
+
+        header.swap(names);
+        return true;
+      }
+
+      bool push(pipeline::Batch & batch) override
+      {
+        const std::size_t width = inputColumns_.size();
+
+        for (const uint32_t row : batch.selection_)
+        {
+          const StrView key = batch.field(column_, row);
+          if (key.empty())
+            continue;
+
+          const uint32_t id = keys_.intern(key);
+          if (id >= groupOf_.size())
+            groupOf_.resize(id + 1, UINT32_MAX);
+
+          if (groupOf_[id] == UINT32_MAX)
+          {
+            groupOf_[id] = groups_.size();
+            groups_.push_back({ id, (uint32_t)groups_.size(), 0 });
+            stats_.resize(stats_.size() + width);
+          }
+
+          const uint32_t group = groupOf_[id];
+          groups_[group].rows_++;
+
+          for (std::size_t c = 0; c < width; ++c)
+            stats_[group * width + c].add(pipelineNumber(batch.field(inputColumns_[c], row)));
+        }
+
+        return true;
+      }
+
+      bool finish() override
+      {
+        const std::size_t width = inputColumns_.size();
+
+        pipeline::Batch batch;
+        std::vector<StrView> fields(aggregates_.size() + 1);
+
+        for (std::size_t g = 0; g < groups_.size(); ++g)
+        {
+          fields[0] = keys_.str(groups_[g].key_);
+          for (std::size_t a = 0; a < aggregates_.size(); ++a)
+            fields[a + 1] = batch.keep(aggregateText(aggregates_[a], groups_[g], stats_[g * width + aggregates_[a].input]));
+
+          batch.addRow(fields.data(), fields.size());
+        }
+
+        return emit(batch) && Operator::finish();
+      }
+
+    private:
+      int column_;
+      std::vector<Aggregate> aggregates_;
+      std::vector<int> inputColumns_;
+
+      StringPool keys_;
+      std::vector<uint32_t> groupOf_;
+      std::vector<groupby::Group> groups_;
+      std::vector<groupby::Stats> stats_;
+  };
+
+  // Pairs each row with the rows of another buffer that have the same text in a column,
+  // see joinBuffers. The other buffer is read up front, then batches are probed on their
+  // own. A row has its own columns followed by those of the other row, but its key.
+  class JoinOperator : public pipeline::BatchOperator
+  {
+    public:
+      JoinOperator(int column, bool keepUnmatched) : column_(column), keepUnmatched_(keepUnmatched) { }
+
+      // Reads the rows of buffer, with the header of the rows when header is set
+      bool build(long buffer, std::string const& column, bool header)
+      {
+        JoinSide side;
+        if (!collectJoinSide(buffer, column, header, side))
+          return false;
+
+        Document & doc = *side.doc_;
+        key_ = side.column_;
+        width_ = doc.width_;
+
+        std::string scratch;
+        auto text = [&] (int x, int row) {
+          const StrView value = pipelineText(doc, Index(x, row), scratch);
+          return value.data() == scratch.data() ? StrView(texts_.copy(value.data(), value.size()), value.size()) : value;
+        };
+
+        if (side.header_ >= 0)
+          for (int x = 0; x < width_; ++x)
+            if (x != key_)
+              header_.push_back(text(x, side.header_).str());
+
+        for (std::size_t i = 0; i < side.rows_.size(); ++i)
+        {
+          const uint32_t id = keys_.intern(text(key_, side.rows_[i]));
+          if (id >= rowsOf_.size())
+            rowsOf_.resize(id + 1);
+
+          if (id != StringPool::EMPTY)
+            rowsOf_[id].push_back(i);
+
+          for (int x = 0; x < width_; ++x)
+            fields_.push_back(text(x, side.rows_[i]));
+        }
+
+        // The cells stay in the document, which is kept while the plan runs
+        doc_ = side.doc_;
+        return true;
+      }
+
+      bool start(std::vector<std::string> & header) override
+      {
+        leftWidth_ = header.size();
+        if (!header.empty())
+        {
+          header.resize(leftWidth_ + header_.size());
+          std::copy(header_.begin(), header_.end(), header.begin() + leftWidth_);
+        }
+
+        return true;
+      }
+
+      bool apply(pipeline::Batch & batch) const override
+      {
+        const std::size_t leftWidth = leftWidth_ > 0 ? leftWidth_ : batch.columns_.size();
+        const std::size_t rightWidth = width_ > 0 ? width_ - 1 : 0;
+
+        std::vector<std::vector<StrView>> columns(leftWidth + rightWidth);
+        std::size_t rows = 0;
+
+        auto addRow = [&] (uint32_t row, StrView const* right) {
+          for (std::size_t c = 0; c < leftWidth; ++c)
+            columns[c].push_back(batch.field(c, row));
+
+          for (int x = 0, c = leftWidth; x < width_; ++x)
+            if (x != key_)
+              columns[c++].push_back(right ? right[x] : StrView());
+
+          rows++;
+        };
+
+        for (const uint32_t row : batch.selection_)
+        {
+          uint32_t id = StringPool::EMPTY;
+          const StrView key = batch.field(column_, row);
+          if (!key.empty() && keys_.find(key, id) && id < rowsOf_.size() && !rowsOf_[id].empty())
+          {
+            for (const uint32_t match : rowsOf_[id])
+              addRow(row, fields_.data() + (std::size_t)match * width_);
+          }
+          else if (keepUnmatched_)
+            addRow(row, nullptr);
+        }
+
+        batch.columns_.swap(columns);
+        batch.rows_ = rows;
+        batch.selection_.resize(rows);
+        for (std::size_t i = 0; i < rows; ++i)
+          batch.selection_[i] = i;
+
+        return true;
+      }
+
+    private:
+      int column_;
+      bool keepUnmatched_;
+      std::size_t leftWidth_ = 0;
+
+      std::shared_ptr<Document> doc_;
+      int key_ = 0;
+      int width_ = 0;
+      std::vector<std::string> header_;
+      StringPool keys_;
+      std::vector<std::vector<uint32_t>> rowsOf_;
+      std::vector<StrView> fields_;
+      Arena texts_;
+  };
+
+  // Counts the rows that reach the end of a pipeline
+  class PipelineSink : public pipeline::Operator
+  {
+    public:
+      std::size_t rows() const { return rows_; }
+
+    protected:
+      std::size_t rows_ = 0;
+  };
+
+  // Writes the rows to a CSV file as they come, with the delimiter of the source
+  class ExportOperator : public PipelineSink
+  {
+    public:
+      ExportOperator(std::string const& filename, TextSource const& source) : filename_(filename), source_(source) { }
+
+      bool start(std::vector<std::string> & header) override
+      {
+        if (!writer_.open(filename_))
+        {
+          logError("could not write '", filename_, "'");
+          return false;
+        }
+
+        std::vector<StrView> fields(header.begin(), header.end());
+        if (!header.empty())
+          writeRow(fields.data(), fields.size());
+
+        return true;
+      }
+
+      bool push(pipeline::Batch & batch) override
+      {
+        std::vector<StrView> fields(batch.columns_.size());
+        for (const uint32_t row : batch.selection_)
+        {
+          for (std::size_t c = 0; c < fields.size(); ++c)
+            fields[c] = batch.columns_[c][row];
+
+          writeRow(fields.data(), fields.size());
+          rows_++;
+        }
+
+        return true;
+      }
+
+      bool finish() override
+      {
+        if (!writer_.close())
+        {
+          logError("could not write '", filename_, "'");
+          return false;
+        }
+
+        return true;
+      }
+
+    private:
+      void writeRow(StrView const* fields, std::size_t count)
+      {
+        const char delimiter = source_.delimiter();
+        for (std::size_t c = 0; c < count; ++c)
+        {
+          if (c > 0)
+            writer_.put(delimiter);
+
+          writeCsvText(writer_, fields[c], delimiter);
+        }
+
+        writer_.put('\n');
+      }
+
+    private:
+      std::string filename_;
+      TextSource const& source_;
+      FileWriter writer_;
+  };
+
+  // Holds the rows and puts them into a new buffer once the input ended
+  class CollectOperator : public PipelineSink
+  {
+    public:
+      bool start(std::vector<std::string> & header) override
+      {
+        header_ = header;
+        return true;
+      }
+
+      bool push(pipeline::Batch & batch) override
+      {
+        std::vector<StrView> fields(batch.columns_.size());
+        for (const uint32_t row : batch.selection_)
+        {
+          for (std::size_t c = 0; c < fields.size(); ++c)
+            fields[c] = held_.keep(batch.columns_[c][row]);
+
+          held_.addRow(fields.data(), fields.size());
+        }
+
+        return true;
+      }
+
+      bool finish() override
+      {
+        rows_ = held_.rows_;
+
+        createDefaultEmpty();
+
+        auto setPipedText = [] (Index const& idx, StrView text) {
+          if (text.empty())
+            return;
+
+          setText(idx, text.str());
+          fitColumnWidth(idx.x, text);
+        };
+
+        for (std::size_t c = 0; c < header_.size(); ++c)
+          setPipedText(Index(c, 0), header_[c]);
+
+        const int firstRow = header_.empty() ? 0 : 1;
+        for (std::size_t c = 0; c < held_.columns_.size(); ++c)
+          for (std::size_t row = 0; row < held_.rows_; ++row)
+            setPipedText(Index(c, firstRow + row), held_.columns_[c][row]);
+
+        return true;
+      }
+
+    private:
+      std::vector<std::string> header_;
+      pipeline::Batch held_;
+  };
+
+  // Makes the operator of a stage of the pipeline command, see its help. Returns null,
+  // having logged why, if the stage isn't one.
+  static std::unique_ptr<pipeline::Operator> pipelineStage(std::vector<std::string> const& stage, bool header, TextSource const& source, bool last)
+  {
+    std::string const& name = stage[0];
+    const std::vector<std::string> args(stage.begin() + 1, stage.end());
+
+    if (name == "filter")
+    {
+      // The clauses compare texts, no pool holds the values
+      const StringPool strings;
+      std::vector<FilterClause> clauses;
+      if (!parseFilterClauses(args, 0, strings, -1, clauses))
+        return nullptr;
+
+      return std::unique_ptr<pipeline::Operator>(new FilterOperator(std::move(clauses)));
+    }
+
+    if (name == "dedupe")
+    {
+      std::vector<int> columns;
+      if (!args.empty() && (args.size() != 2 || args[0] != "-columns"))
+      {
+        logError("dedupe takes -columns and a comma separated list of them");
+        return nullptr;
+      }
+
+      std::stringstream list(args.empty() ? std::string() : args[1]);
+      std::string column;
+      while (std::getline(list, column, ','))
+      {
+        columns.push_back(Index::strToColumn(column));
+        if (columns.back() < 0)
+        {
+          logError("dedupe column ", column, " out of range");
+          return nullptr;
+        }
+      }
+
+      return std::unique_ptr<pipeline::Operator>(new DedupeOperator(std::move(columns)));
+    }
+
+    if (name == "sort")
+    {
+      std::vector<SortKey> keys;
+      if (!parseSortKeys(args, -1, keys))
+        return nullptr;
+
+      if (keys.empty())
+      {
+        logError("sort needs a column");
+        return nullptr;
+      }
+
+      return std::unique_ptr<pipeline::Operator>(new SortOperator(std::move(keys)));
+    }
+
+    if (name == "top")
+    {
+      char * end = nullptr;
+      const long count = args.empty() ? -1 : strtol(args[0].c_str(), &end, 10);
+      const int column = args.size() < 2 ? -1 : Index::strToColumn(args[1]);
+
+      if (args.size() < 2 || args.size() > 3 || *end != '\0' || count < 0 || column < 0)
+      {
+        logError("top takes a count of at least 0 and a column");
+        return nullptr;
+      }
+
+      if (args.size() == 3 && args[2] != "-ascending" && args[2] != "-asc")
+      {
+        logError("unknown top option '", args[2], "'");
+        return nullptr;
+      }
+
+      return std::unique_ptr<pipeline::Operator>(new TopOperator(count, column, args.size() == 3));
+    }
+
+    if (name == "groupby")
+    {
+      const int column = args.empty() ? -1 : Index::strToColumn(args[0]);
+      if (column < 0)
+      {
+        logError("groupby needs a column");
+        return nullptr;
+      }
+
+      std::vector<Aggregate> aggregates;
+      std::vector<int> inputColumns;
+      if (!parseAggregates(std::vector<std::string>(args.begin() + 1, args.end()), -1, aggregates, inputColumns))
+        return nullptr;
+
+      return std::unique_ptr<pipeline::Operator>(new GroupbyOperator(column, std::move(aggregates), std::move(inputColumns)));
+    }
+
+    if (name == "join")
+    {
+      char * end = nullptr;
+      const long buffer = args.empty() ? -1 : strtol(args[0].c_str(), &end, 10);
+      const int column = args.size() < 2 ? -1 : Index::strToColumn(args[1]);
+
+      if (args.size() < 3 || args.size() > 4 || *end != '\0' || column < 0)
+      {
+        logError("join takes a buffer, the column of the rows and the column of the buffer");
+        return nullptr;
+      }
+
+      if (args.size() == 4 && args[3] != "-inner" && args[3] != "-left")
+      {
+        logError("unknown join option '", args[3], "'");
+        return nullptr;
+      }
+
+      std::unique_ptr<JoinOperator> join(new JoinOperator(column, args.size() == 4 && args[3] == "-left"));
+      if (!join->build(buffer, args[2], header))
+        return nullptr;
+
+      return join;
+    }
+
+    if (name == "export")
+    {
+      if (!last || args.size() != 1)
+      {
+        logError("export takes a filename and ends a pipeline");
+        return nullptr;
+      }
+
+      return std::unique_ptr<pipeline::Operator>(new ExportOperator(args[0], source));
+    }
+
+    logError("unknown pipeline stage '", name, "'");
+    return nullptr;
+  }
+
+  bool runPipeline(std::vector<std::string> const& args, bool header, std::size_t & rows)
+  {
+    std::vector<std::vector<std::string>> stages(1);
+    for (auto const& arg : args)
+    {
+      if (arg == "|")
+        stages.emplace_back();
+      else
+        stages.back().push_back(arg);
+    }
+
+    for (auto const& stage : stages)
+      if (stage.empty())
+      {
+        logError("pipeline stage without a command");
+        return false;
+      }
+
+    std::unique_ptr<TextSource> source;
+    if (stages[0][0] == "load")
+    {
+      if (stages[0].size() != 2)
+      {
+        logError("load takes the filename of a CSV file");
+        return false;
+      }
+
+      source.reset(new CsvFileSource(stages[0][1], header));
+      stages.erase(stages.begin());
+    }
+    else
+    {
+      Document & doc = currentDoc();
+      if (doc.loading_ || isIndexing(doc))
+      {
+        logError("can't pipe a document that is still loading");
+        return false;
+      }
+
+      source.reset(new BufferSource(header));
+    }
+
+    pipeline::Plan plan;
+    PipelineSink * sink = nullptr;
+
+    for (std::size_t i = 0; i < stages.size(); ++i)
+    {
+      std::unique_ptr<pipeline::Operator> op = pipelineStage(stages[i], header, *source, i + 1 == stages.size());
+      if (!op)
+        return false;
+
+      if (stages[i][0] == "export")
+        sink = static_cast<ExportOperator *>(op.get());
+
+      plan.add(std::move(op));
+    }
+
+    if (!sink)
+    {
+      std::unique_ptr<CollectOperator> collect(new CollectOperator());
+      sink = collect.get();
+      plan.add(std::move(collect));
+    }
+
+    if (!plan.run(*source))
+      return false;
+
+    rows = sink->rows();
+    return true;
+  }
+}
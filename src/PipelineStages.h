@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// The stages of the pipeline command as operators of a pipeline::Plan, see Pipeline.h.
+// The rows come from the current buffer or a CSV file read a chunk at a time, and go to
+// a new buffer or a file.
+namespace doc {
+
+  // Runs the stages of args, the arguments of the pipeline command after -noHeader, and
+  // sets rows to the rows of the result. header tells whether the first row is one.
+  bool runPipeline(std::vector<std::string> const& args, bool header, std::size_t & rows);
+}
@@ -0,0 +1,446 @@
+#include "Profile.h"
+#include "FileWriter.h"
+#include "Scheduler.h"
+#include "Tcl.h"
+#include "Log.h"
+#include "Str.h"
+
+#include "bx/timer.h"
+#include "bx/thread.h"
+#include "bx/sem.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <vector>
+
+namespace profile {
+
+  // A trace is dropped after this many samples rather than growing without bound
+  static const std::size_t MAX_TRACE_EVENTS = 1 << 20;
+
+  static const char * ZONE_NAMES[] = { "evaluate", "drawHeaders", "drawWorkspace", "present", "load", "save", "tcl" };
+  static_assert(sizeof(ZONE_NAMES) / sizeof(ZONE_NAMES[0]) == (int)Zone::COUNT, "Every zone needs a name");
+
+  const double HISTOGRAM_BOUNDS[HISTOGRAM_BUCKETS] = { 0.5, 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 5000 };
+
+  struct Samples
+  {
+    double samples_[ROLLING_SAMPLES] = { };
+    uint64_t count_ = 0;
+    ZoneHistogram histogram_;
+  };
+
+  struct TraceEvent
+  {
+    Zone zone_;
+    int64_t start_;
+    int64_t end_;
+  };
+
+  static Samples zones_[(int)Zone::COUNT];
+  static std::vector<TraceEvent> trace_;
+  static bool tracing_ = false;
+  static int64_t traceStart_ = 0;
+
+  static double toMilliseconds(int64_t ticks)
+  {
+    return ticks * 1000.0 / bx::getHPFrequency();
+  }
+
+  static double toMicroseconds(int64_t ticks)
+  {
+    return ticks * 1000000.0 / bx::getHPFrequency();
+  }
+
+  const char * zoneName(Zone zone)
+  {
+    return ZONE_NAMES[(int)zone];
+  }
+
+  void record(Zone zone, int64_t start, int64_t end)
+  {
+    const double milliseconds = toMilliseconds(end - start);
+
+    Samples & samples = zones_[(int)zone];
+    samples.samples_[samples.count_ % ROLLING_SAMPLES] = milliseconds;
+    samples.count_++;
+
+    ZoneHistogram & histogram = samples.histogram_;
+    const int bucket = std::lower_bound(HISTOGRAM_BOUNDS, HISTOGRAM_BOUNDS + HISTOGRAM_BUCKETS, milliseconds) - HISTOGRAM_BOUNDS;
+    if (bucket < HISTOGRAM_BUCKETS)
+      histogram.buckets_[bucket]++;
+
+    histogram.count_++;
+    histogram.sum_ += milliseconds;
+
+    if (tracing_ && trace_.size() < MAX_TRACE_EVENTS)
+      trace_.push_back(TraceEvent { zone, start, end });
+  }
+
+  ZoneStats stats(Zone zone)
+  {
+    Samples const& samples = zones_[(int)zone];
+    ZoneStats result;
+
+    result.count_ = samples.count_;
+    if (samples.count_ == 0)
+      return result;
+
+    const int n = std::min<uint64_t>(samples.count_, ROLLING_SAMPLES);
+    for (int i = 0; i < n; ++i)
+    {
+      result.mean_ += samples.samples_[i];
+      result.max_ = std::max(result.max_, samples.samples_[i]);
+    }
+
+    result.mean_ /= n;
+    result.last_ = samples.samples_[(samples.count_ - 1) % ROLLING_SAMPLES];
+    return result;
+  }
+
+  ZoneHistogram histogram(Zone zone)
+  {
+    return zones_[(int)zone].histogram_;
+  }
+
+  void reset()
+  {
+    for (auto & samples : zones_)
+      samples = Samples();
+  }
+
+  std::string overlayLine()
+  {
+    std::string line;
+    char buffer[64];
+
+    for (int i = 0; i < (int)Zone::COUNT; ++i)
+    {
+      const ZoneStats zone = stats((Zone)i);
+      if (zone.count_ == 0)
+        continue;
+
+      snprintf(buffer, sizeof(buffer), "%s %.2f/%.2fms  ", ZONE_NAMES[i], zone.last_, zone.mean_);
+      line.append(buffer);
+    }
+
+    return line;
+  }
+
+  void startTrace()
+  {
+    trace_.clear();
+    tracing_ = true;
+    traceStart_ = bx::getHPCounter();
+  }
+
+  bool isTracing()
+  {
+    return tracing_;
+  }
+
+  bool writeTrace(std::string const& filename)
+  {
+    tracing_ = false;
+
+    FileWriter file;
+    if (!file.open(filename))
+    {
+      logError("Could not write the trace to ", filename);
+      return false;
+    }
+
+    char buffer[160];
+    file.write(std::string("{\"traceEvents\":[\n"));
+
+    for (std::size_t i = 0; i < trace_.size(); ++i)
+    {
+      TraceEvent const& event = trace_[i];
+      const int length = snprintf(buffer, sizeof(buffer), "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+                                  ZONE_NAMES[(int)event.zone_], toMicroseconds(event.start_ - traceStart_),
+                                  toMicroseconds(event.end_ - event.start_), i + 1 < trace_.size() ? "," : "");
+      file.write(buffer, length);
+    }
+
+    file.write(std::string("]}\n"));
+
+    trace_.clear();
+    trace_.shrink_to_fit();
+
+    if (!file.close())
+    {
+      logError("Could not write the trace to ", filename);
+      return false;
+    }
+
+    return true;
+  }
+
+  struct StartupStage
+  {
+    const char * name_;
+    int64_t end_;
+  };
+
+  static bool startupProfile_ = false;
+  static int64_t startupBegin_ = 0;
+  static std::vector<StartupStage> startupStages_;
+
+  void enableStartupProfile()
+  {
+    startupProfile_ = true;
+    startupBegin_ = bx::getHPCounter();
+  }
+
+  void markStartup(const char * stage)
+  {
+    if (startupProfile_)
+      startupStages_.push_back(StartupStage { stage, bx::getHPCounter() });
+  }
+
+  void printStartupProfile()
+  {
+    if (!startupProfile_)
+      return;
+
+    int64_t last = startupBegin_;
+    for (auto const& stage : startupStages_)
+    {
+      fprintf(stderr, "%-16s %8.3fms\n", stage.name_, toMilliseconds(stage.end_ - last));
+      last = stage.end_;
+    }
+
+    fprintf(stderr, "%-16s %8.3fms\n", "total", toMilliseconds(last - startupBegin_));
+  }
+
+  // The zones the watchdog reports as running, the innermost last. Deeper zones aren't
+  // reported but still counted, so the ones around them come back right.
+  static const int MAX_ACTIVE_ZONES = 8;
+
+  static std::atomic<int> activeZoneCount_(0);
+  static std::atomic<int> activeZones_[MAX_ACTIVE_ZONES];
+  static std::atomic<const char *> activeCommand_(nullptr);
+
+  // When the main loop took the last event, 0 while it waits for one. Each wake has a
+  // number, the watchdog reports a wake at most once.
+  static std::atomic<int64_t> busySince_(0);
+  static std::atomic<uint32_t> wake_(0);
+  static std::atomic<uint32_t> reportedWake_(0);
+  static std::atomic<int> documentColumns_(0);
+  static std::atomic<int> documentRows_(0);
+
+  // How often the watchdog looks, as a part of the threshold
+  static const int WATCHDOG_CHECKS = 4;
+  static const int MIN_WATCHDOG_INTERVAL = 10;
+
+  struct Watchdog
+  {
+    bx::Semaphore wake_;
+    bx::Thread thread_;
+    std::atomic<bool> quit_ { false };
+    int threshold_ = 0;
+  };
+
+  static std::unique_ptr<Watchdog> watchdog_;
+
+  static std::string stallDescription(int64_t milliseconds)
+  {
+    char stamp[32] = "";
+    const time_t now = time(nullptr);
+    struct tm local;
+    if (localtime_r(&now, &local))
+      strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+
+    std::string description = std::string(stamp) + " main loop busy for " + std::to_string(milliseconds) + "ms in ";
+
+    const int count = std::min(activeZoneCount_.load(), MAX_ACTIVE_ZONES);
+    for (int i = 0; i < count; ++i)
+      description += std::string(i > 0 ? " > " : "") + ZONE_NAMES[activeZones_[i].load()];
+
+    if (count == 0)
+      description += "no profiled zone";
+
+    if (const char * command = activeCommand_.load())
+      description += std::string(", command ") + command;
+
+    return description + ", document " + std::to_string(documentColumns_.load()) + "x" + std::to_string(documentRows_.load());
+  }
+
+  static int32_t watchdogMain(void * userData)
+  {
+    Watchdog & watchdog = *static_cast<Watchdog *>(userData);
+    const int interval = std::max(watchdog.threshold_ / WATCHDOG_CHECKS, MIN_WATCHDOG_INTERVAL);
+    const int64_t threshold = watchdog.threshold_ * bx::getHPFrequency() / 1000;
+
+    while (!watchdog.quit_)
+    {
+      watchdog.wake_.wait(interval);
+
+      // The wake is read around the start, so a start of another wake isn't taken for it
+      const uint32_t wake = wake_.load();
+      const int64_t since = busySince_.load();
+      if (since == 0 || wake != wake_.load() || wake == reportedWake_.load())
+        continue;
+
+      const int64_t busy = bx::getHPCounter() - since;
+      if (busy < threshold)
+        continue;
+
+      reportedWake_ = wake;
+      logWarning("Slow frame: ", stallDescription(busy * 1000 / bx::getHPFrequency()));
+    }
+
+    return 0;
+  }
+
+  void watchdogWait(int threshold)
+  {
+    const int64_t since = busySince_.exchange(0);
+    if (since != 0 && reportedWake_.load() == wake_.load())
+      logWarning("Slow frame: main loop waits for events again after ", (long long)((bx::getHPCounter() - since) * 1000 / bx::getHPFrequency()), "ms");
+
+    threshold = std::max(threshold, 0);
+    if ((watchdog_ ? watchdog_->threshold_ : 0) == threshold)
+      return;
+
+    stopWatchdog();
+    if (threshold == 0)
+      return;
+
+    watchdog_.reset(new Watchdog());
+    watchdog_->threshold_ = threshold;
+    watchdog_->thread_.init(watchdogMain, watchdog_.get());
+  }
+
+  void watchdogWoke(int columns, int rows)
+  {
+    documentColumns_ = columns;
+    documentRows_ = rows;
+
+    // The number first, the watchdog takes a wake that changes under it as not started
+    wake_++;
+    busySince_ = bx::getHPCounter();
+  }
+
+  void stopWatchdog()
+  {
+    if (!watchdog_)
+      return;
+
+    watchdog_->quit_ = true;
+    watchdog_->wake_.post();
+    watchdog_->thread_.shutdown();
+    watchdog_.reset();
+  }
+
+  ScopedTimer::ScopedTimer(Zone zone)
+    : zone_(zone),
+      start_(bx::getHPCounter())
+  {
+    const int depth = activeZoneCount_.load(std::memory_order_relaxed);
+    if (depth < MAX_ACTIVE_ZONES)
+      activeZones_[depth].store((int)zone, std::memory_order_relaxed);
+
+    activeZoneCount_.store(depth + 1, std::memory_order_relaxed);
+  }
+
+  ScopedTimer::~ScopedTimer()
+  {
+    activeZoneCount_.fetch_sub(1, std::memory_order_relaxed);
+    record(zone_, start_, bx::getHPCounter());
+  }
+
+  ScopedCommand::ScopedCommand(const char * name)
+    : previous_(activeCommand_.exchange(name, std::memory_order_relaxed))
+  { }
+
+  ScopedCommand::~ScopedCommand()
+  {
+    activeCommand_.store(previous_, std::memory_order_relaxed);
+  }
+}
+
+namespace tcl {
+  TCL_SUBFUNC(stats, "get",       "",           "Returns name, count, last, mean and max milliseconds of every profiled subsystem",
+                     "reset",     "",           "Clears the collected timings and scheduler counters",
+                     "trace",     "?filename?", "Starts recording a trace, or writes it as Chrome trace-event JSON and stops",
+                     "scheduler", "",           "Returns the worker threads, tasks run, steals and idle milliseconds of the task scheduler as name value pairs")
+  {
+    enum { CMD_GET, CMD_RESET, CMD_TRACE, CMD_SCHEDULER };
+
+    switch (subCommand)
+    {
+      case CMD_GET:
+        {
+          TCL_CHECK_ARG_DESC(0, "");
+
+          Jim_Obj * zones = Jim_NewListObj(interp, nullptr, 0);
+
+          for (int i = 0; i < (int)profile::Zone::COUNT; ++i)
+          {
+            const profile::ZoneStats stats = profile::stats((profile::Zone)i);
+
+            Jim_Obj * zone = Jim_NewListObj(interp, nullptr, 0);
+            Jim_ListAppendElement(interp, zone, Jim_NewStringObj(interp, profile::zoneName((profile::Zone)i), -1));
+            Jim_ListAppendElement(interp, zone, Jim_NewIntObj(interp, stats.count_));
+            Jim_ListAppendElement(interp, zone, Jim_NewDoubleObj(interp, stats.last_));
+            Jim_ListAppendElement(interp, zone, Jim_NewDoubleObj(interp, stats.mean_));
+            Jim_ListAppendElement(interp, zone, Jim_NewDoubleObj(interp, stats.max_));
+            Jim_ListAppendElement(interp, zones, zone);
+          }
+
+          Jim_SetResult(interp, zones);
+        }
+        break;
+
+      case CMD_RESET:
+        TCL_CHECK_ARG_DESC(0, "");
+        profile::reset();
+        Scheduler::shared().resetCounters();
+        break;
+
+      case CMD_TRACE:
+        {
+          TCL_CHECK_ARGS_DESC(0, 1, "?filename?");
+
+          if (argc == 0)
+          {
+            profile::startTrace();
+            break;
+          }
+
+          TCL_STRING_ARG(0, filename);
+          if (!profile::writeTrace(filename))
+            return JIM_ERR;
+        }
+        break;
+
+      case CMD_SCHEDULER:
+        {
+          TCL_CHECK_ARG_DESC(0, "");
+
+          Scheduler & scheduler = Scheduler::shared();
+          const Scheduler::Counters counters = scheduler.counters();
+
+          Jim_Obj * result = Jim_NewListObj(interp, nullptr, 0);
+          auto add = [&] (const char * name, Jim_Obj * value) {
+            Jim_ListAppendElement(interp, result, Jim_NewStringObj(interp, name, -1));
+            Jim_ListAppendElement(interp, result, value);
+          };
+
+          add("threads", Jim_NewIntObj(interp, scheduler.threadCount()));
+          add("tasks", Jim_NewIntObj(interp, counters.tasksRun_));
+          add("steals", Jim_NewIntObj(interp, counters.steals_));
+          add("idle", Jim_NewDoubleObj(interp, counters.idleMilliseconds_));
+
+          Jim_SetResult(interp, result);
+        }
+        break;
+    }
+
+    return JIM_OK;
+  }
+}
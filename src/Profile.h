@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Scoped wall clock timers around the subsystems a key press can spend its time in. Each
+// zone keeps rolling statistics over its last samples, which the stats command reports
+// and the editor can show as an overlay line. While a trace is recorded every sample is
+// also kept, so it can be written as a Chrome trace-event file (chrome://tracing).
+// Main thread only.
+namespace profile {
+
+  enum class Zone
+  {
+    EVALUATE,
+    DRAW_HEADERS,
+    DRAW_WORKSPACE,
+    PRESENT,
+    LOAD,
+    SAVE,
+    TCL,
+    COUNT
+  };
+
+  // Number of samples the rolling statistics are taken over
+  static const int ROLLING_SAMPLES = 64;
+
+  struct ZoneStats
+  {
+    uint64_t count_ = 0;
+    double last_ = 0.0;
+    double mean_ = 0.0;
+    double max_ = 0.0;
+  };
+
+  // Upper bounds in milliseconds of the buckets a zone counts its samples in, every sample
+  // since the start or reset(). Slower samples are only in the count.
+  static const int HISTOGRAM_BUCKETS = 12;
+  extern const double HISTOGRAM_BOUNDS[HISTOGRAM_BUCKETS];
+
+  struct ZoneHistogram
+  {
+    uint64_t buckets_[HISTOGRAM_BUCKETS] = { };
+    uint64_t count_ = 0;
+    double sum_ = 0.0;
+  };
+
+  const char * zoneName(Zone zone);
+
+  // Start and end are bx::getHPCounter() values
+  void record(Zone zone, int64_t start, int64_t end);
+
+  ZoneStats stats(Zone zone);
+  ZoneHistogram histogram(Zone zone);
+  void reset();
+
+  // One line with the last and mean milliseconds of every zone that ran
+  std::string overlayLine();
+
+  void startTrace();
+  bool isTracing();
+
+  // Writes the recorded samples and stops tracing
+  bool writeTrace(std::string const& filename);
+
+  // Startup profile, what --startup-profile prints. Each mark puts the time since the
+  // one before it down as stage, marks are ignored until the profile is enabled.
+  void enableStartupProfile();
+  void markStartup(const char * stage);
+
+  // Writes the stages and their milliseconds to stderr
+  void printStartupProfile();
+
+  // The watchdog is a thread that notices the main loop not getting back to waiting for
+  // events within threshold milliseconds. It logs when that happened, the zones that were
+  // running and the Tcl command, if any, with the size of the document, and the main loop
+  // logs how long it took once it waits again. A threshold of 0 stops the watchdog.
+  void watchdogWait(int threshold);
+  void watchdogWoke(int columns, int rows);
+  void stopWatchdog();
+
+  class ScopedTimer
+  {
+    public:
+      explicit ScopedTimer(Zone zone);
+      ~ScopedTimer();
+
+      ScopedTimer(ScopedTimer const&) = delete;
+      ScopedTimer & operator = (ScopedTimer const&) = delete;
+
+    private:
+      Zone zone_;
+      int64_t start_;
+  };
+
+  // The built-in Tcl command that runs, for the watchdog. name has to outlive the scope.
+  class ScopedCommand
+  {
+    public:
+      explicit ScopedCommand(const char * name);
+      ~ScopedCommand();
+
+      ScopedCommand(ScopedCommand const&) = delete;
+      ScopedCommand & operator = (ScopedCommand const&) = delete;
+
+    private:
+      const char * previous_;
+  };
+}
+
+#define PROFILE_SCOPE(zone) const profile::ScopedTimer _profileScope(profile::Zone::zone)
@@ -0,0 +1,334 @@
+#include "Query.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+namespace query {
+
+  // Splits a statement into words, quoted strings, numbers and the symbols of the
+  // grammar. Keywords and bare names are both words, the parser tells them apart.
+  // Words may hold dots, so a file name like data.csv needs no quotes.
+  class Lexer
+  {
+    public:
+      enum Kind
+      {
+        Word,
+        Name,
+        String,
+        Number,
+        Symbol,
+        End,
+        Error
+      };
+
+      explicit Lexer(std::string const& source) : source_(source) { }
+
+      Kind next()
+      {
+        while (pos_ < source_.size() && std::isspace((unsigned char)source_[pos_]))
+          ++pos_;
+
+        text_.clear();
+
+        if (pos_ >= source_.size())
+          return End;
+
+        const char ch = source_[pos_];
+
+        if (std::isalpha((unsigned char)ch) || ch == '_')
+        {
+          while (pos_ < source_.size() && (std::isalnum((unsigned char)source_[pos_]) || source_[pos_] == '_' || source_[pos_] == '.'))
+            text_.push_back(source_[pos_++]);
+
+          return Word;
+        }
+
+        if (std::isdigit((unsigned char)ch) || ((ch == '-' || ch == '.') && pos_ + 1 < source_.size() && (std::isdigit((unsigned char)source_[pos_ + 1]) || source_[pos_ + 1] == '.')))
+        {
+          const char * begin = source_.c_str() + pos_;
+          char * end = nullptr;
+          strtod(begin, &end);
+
+          text_.assign(begin, (const char *)end);
+          pos_ += text_.size();
+          return text_.empty() ? Error : Number;
+        }
+
+        // A quote in a quoted string is written twice
+        if (ch == '\'' || ch == '"')
+        {
+          for (++pos_; pos_ < source_.size(); ++pos_)
+          {
+            if (source_[pos_] != ch)
+              text_.push_back(source_[pos_]);
+            else if (pos_ + 1 < source_.size() && source_[pos_ + 1] == ch)
+              text_.push_back(source_[++pos_]);
+            else
+            {
+              ++pos_;
+              return ch == '\'' ? String : Name;
+            }
+          }
+
+          return Error;
+        }
+
+        static const char * SYMBOLS[] = { "==", "!=", "<>", "<=", ">=", "=", "<", ">", ",", "*", ";" };
+        for (const char * symbol : SYMBOLS)
+          if (source_.compare(pos_, strlen(symbol), symbol) == 0)
+          {
+            text_ = symbol;
+            pos_ += text_.size();
+            return Symbol;
+          }
+
+        text_.push_back(ch);
+        return Error;
+      }
+
+      std::string const& text() const { return text_; }
+
+    private:
+      std::string const& source_;
+      std::size_t pos_ = 0;
+      std::string text_;
+  };
+
+  static bool isKeyword(std::string const& word, const char * keyword)
+  {
+    std::size_t i = 0;
+    for (; i < word.size() && keyword[i]; ++i)
+      if (std::toupper((unsigned char)word[i]) != keyword[i])
+        return false;
+
+    return i == word.size() && keyword[i] == 0;
+  }
+
+  // Reads a statement one token ahead
+  class Parser
+  {
+    public:
+      Parser(std::string const& sql, std::string & error)
+        : lexer_(sql),
+          error_(error)
+      {
+        advance();
+      }
+
+      bool parse(Select & select)
+      {
+        if (!expectKeyword("SELECT"))
+          return false;
+
+        if (isSymbol("*"))
+          advance();
+        else
+        {
+          do
+          {
+            std::string column;
+            if (!parseColumn(column))
+              return false;
+
+            select.columns_.push_back(column);
+          }
+          while (acceptSymbol(","));
+        }
+
+        if (!expectKeyword("FROM"))
+          return false;
+
+        if (kind_ != Lexer::Word && kind_ != Lexer::Name && kind_ != Lexer::String && kind_ != Lexer::Number)
+          return fail("expected a buffer after FROM");
+
+        select.from_ = lexer_.text();
+        advance();
+
+        if (acceptKeyword("WHERE"))
+        {
+          do
+          {
+            Condition condition;
+            if (!parseCondition(condition))
+              return false;
+
+            select.where_.push_back(condition);
+          }
+          while (acceptKeyword("AND"));
+        }
+
+        if (acceptKeyword("ORDER"))
+        {
+          if (!expectKeyword("BY"))
+            return false;
+
+          do
+          {
+            Order order;
+            if (!parseColumn(order.column_))
+              return false;
+
+            if (acceptKeyword("DESC"))
+              order.descending_ = true;
+            else
+              acceptKeyword("ASC");
+
+            select.orderBy_.push_back(order);
+          }
+          while (acceptSymbol(","));
+        }
+
+        if (acceptKeyword("LIMIT"))
+        {
+          char * end = nullptr;
+          select.limit_ = kind_ == Lexer::Number ? strtoll(lexer_.text().c_str(), &end, 10) : -1;
+
+          if (select.limit_ < 0 || *end != 0)
+            return fail("expected a count after LIMIT");
+
+          advance();
+        }
+
+        acceptSymbol(";");
+
+        if (kind_ != Lexer::End)
+          return fail("unexpected '" + lexer_.text() + "'");
+
+        return true;
+      }
+
+    private:
+      void advance() { kind_ = lexer_.next(); }
+
+      bool fail(std::string const& error)
+      {
+        error_ = kind_ == Lexer::Error ? "unexpected '" + lexer_.text() + "'" : error;
+        return false;
+      }
+
+      bool isSymbol(const char * symbol) const { return kind_ == Lexer::Symbol && lexer_.text() == symbol; }
+      bool isKeyword(const char * keyword) const { return kind_ == Lexer::Word && query::isKeyword(lexer_.text(), keyword); }
+
+      bool acceptSymbol(const char * symbol)
+      {
+        if (!isSymbol(symbol))
+          return false;
+
+        advance();
+        return true;
+      }
+
+      bool acceptKeyword(const char * keyword)
+      {
+        if (!isKeyword(keyword))
+          return false;
+
+        advance();
+        return true;
+      }
+
+      bool expectKeyword(const char * keyword)
+      {
+        return acceptKeyword(keyword) || fail(std::string("expected ") + keyword);
+      }
+
+      bool parseColumn(std::string & column)
+      {
+        if (kind_ != Lexer::Word && kind_ != Lexer::Name)
+          return fail("expected a column");
+
+        column = lexer_.text();
+        advance();
+        return true;
+      }
+
+      bool parseCondition(Condition & condition)
+      {
+        if (!parseColumn(condition.column_))
+          return false;
+
+        static const struct { const char * symbol; Op op; } OPERATORS[] = {
+          { "=", Op::Equal }, { "==", Op::Equal }, { "!=", Op::NotEqual }, { "<>", Op::NotEqual },
+          { "<", Op::Less }, { "<=", Op::LessEqual }, { ">", Op::Greater }, { ">=", Op::GreaterEqual },
+        };
+
+        bool found = false;
+        for (auto const& it : OPERATORS)
+          if (isSymbol(it.symbol))
+          {
+            condition.op_ = it.op;
+            found = true;
+          }
+
+        if (found)
+          advance();
+        else if (acceptKeyword("LIKE"))
+          condition.op_ = Op::Like;
+        else if (acceptKeyword("NOT"))
+        {
+          if (!expectKeyword("LIKE"))
+            return false;
+
+          condition.op_ = Op::NotLike;
+        }
+        else
+          return fail("expected an operator after " + condition.column_);
+
+        if (kind_ != Lexer::String && kind_ != Lexer::Number)
+          return fail("expected a number or a quoted string after the operator");
+
+        condition.value_ = lexer_.text();
+        advance();
+        return true;
+      }
+
+    private:
+      Lexer lexer_;
+      Lexer::Kind kind_ = Lexer::End;
+      std::string & error_;
+  };
+
+  bool parse(std::string const& sql, Select & select, std::string & error)
+  {
+    select = Select();
+    return Parser(sql, error).parse(select);
+  }
+
+  bool like(StrView text, StrView pattern)
+  {
+    std::size_t t = 0;
+    std::size_t p = 0;
+
+    // Where the last % was seen, and the text position it has been matched up to
+    std::size_t star = std::string::npos;
+    std::size_t matched = 0;
+
+    while (t < text.size())
+    {
+      if (p < pattern.size() && (pattern[p] == '_' || pattern[p] == text[t]))
+      {
+        ++t;
+        ++p;
+      }
+      else if (p < pattern.size() && pattern[p] == '%')
+      {
+        star = p++;
+        matched = t;
+      }
+      else if (star != std::string::npos)
+      {
+        p = star + 1;
+        t = ++matched;
+      }
+      else
+        return false;
+    }
+
+    while (p < pattern.size() && pattern[p] == '%')
+      ++p;
+
+    return p == pattern.size();
+  }
+}
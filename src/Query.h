@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Str.h"
+
+#include <string>
+#include <vector>
+
+// The SELECT statements of the query command, parsed into what the document runs. The
+// grammar is a subset of SQL, keywords are case insensitive:
+//
+//   SELECT * | column, ...
+//   FROM buffer
+//   WHERE column op value AND ...
+//   ORDER BY column ASC | DESC, ...
+//   LIMIT count
+//
+// where op is one of = == != <> < <= > >= LIKE and NOT LIKE. A column is a header name
+// or a column name like B, either bare or in double quotes, and a value is a number or
+// a string in single quotes. The buffer is a buffer number or the name of its file.
+// The first row of the buffer is its header.
+namespace query {
+
+  enum class Op
+  {
+    Equal,
+    NotEqual,
+    Greater,
+    GreaterEqual,
+    Less,
+    LessEqual,
+    Like,
+    NotLike
+  };
+
+  struct Condition
+  {
+    std::string column_;
+    Op op_ = Op::Equal;
+    std::string value_;
+  };
+
+  struct Order
+  {
+    std::string column_;
+    bool descending_ = false;
+  };
+
+  struct Select
+  {
+    // Empty for SELECT *
+    std::vector<std::string> columns_;
+    std::string from_;
+    std::vector<Condition> where_;
+    std::vector<Order> orderBy_;
+
+    // Negative without a LIMIT
+    long long limit_ = -1;
+  };
+
+  // Parses sql into select. Returns false, with what is wrong in error, if it isn't a
+  // statement of the grammar above.
+  bool parse(std::string const& sql, Select & select, std::string & error);
+
+  // Whether text matches the LIKE pattern, where % matches any run of characters and
+  // _ any single one
+  bool like(StrView text, StrView pattern);
+}
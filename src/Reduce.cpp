@@ -0,0 +1,103 @@
+#include "Reduce.h"
+#include "bx/platform.h"
+
+#if defined(__AVX__)
+#  include <immintrin.h>
+#  define REDUCE_AVX 1
+#elif defined(__SSE2__) || (BX_COMPILER_MSVC && (BX_ARCH_64BIT || _M_IX86_FP >= 2))
+#  include <emmintrin.h>
+#  define REDUCE_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define REDUCE_NEON 1
+#endif
+
+#include <algorithm>
+#include <cmath>
+
+namespace reduce {
+
+  double sum(double const* values, std::size_t count)
+  {
+    std::size_t i = 0;
+    double result = 0.0;
+
+    // Two independent accumulators hide the latency of the adds
+#if REDUCE_AVX
+    __m256d sum0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd();
+
+    for (; i + 8 <= count; i += 8)
+    {
+      sum0 = _mm256_add_pd(sum0, _mm256_loadu_pd(values + i));
+      sum1 = _mm256_add_pd(sum1, _mm256_loadu_pd(values + i + 4));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(sum0, sum1));
+    result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif REDUCE_SSE2
+    __m128d sum0 = _mm_setzero_pd();
+    __m128d sum1 = _mm_setzero_pd();
+
+    for (; i + 4 <= count; i += 4)
+    {
+      sum0 = _mm_add_pd(sum0, _mm_loadu_pd(values + i));
+      sum1 = _mm_add_pd(sum1, _mm_loadu_pd(values + i + 2));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(sum0, sum1));
+    result = lanes[0] + lanes[1];
+#elif REDUCE_NEON
+    float64x2_t sum0 = vdupq_n_f64(0.0);
+    float64x2_t sum1 = vdupq_n_f64(0.0);
+
+    for (; i + 4 <= count; i += 4)
+    {
+      sum0 = vaddq_f64(sum0, vld1q_f64(values + i));
+      sum1 = vaddq_f64(sum1, vld1q_f64(values + i + 2));
+    }
+
+    result = vaddvq_f64(vaddq_f64(sum0, sum1));
+#endif
+
+    for (; i < count; ++i)
+      result += values[i];
+
+    return result;
+  }
+
+  void Stats::add(double value)
+  {
+    if (std::isnan(value))
+      return;
+
+    if (count_ == 0)
+      min_ = max_ = value;
+    else
+    {
+      min_ = std::min(min_, value);
+      max_ = std::max(max_, value);
+    }
+
+    sum_ += value;
+    count_++;
+  }
+
+  void Stats::merge(Stats const& other)
+  {
+    if (other.count_ == 0)
+      return;
+
+    if (count_ == 0)
+      *this = other;
+    else
+    {
+      sum_ += other.sum_;
+      min_ = std::min(min_, other.min_);
+      max_ = std::max(max_, other.max_);
+      count_ += other.count_;
+    }
+  }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Vectorized reductions over contiguous arrays of doubles. The kernels add 4 (AVX)
+// or 2 (SSE2, NEON) values at a time and fall back to plain loops on other targets.
+namespace reduce {
+
+  // Returns the sum of the count values starting at values
+  double sum(double const* values, std::size_t count);
+
+  // Count, sum and range of a set of numbers, count_ numbers were seen. NaN is not a
+  // number, add() skips it.
+  struct Stats
+  {
+    double sum_ = 0.0;
+    double min_ = 0.0;
+    double max_ = 0.0;
+    uint64_t count_ = 0;
+
+    void add(double value);
+    void merge(Stats const& other);
+  };
+}
@@ -0,0 +1,170 @@
+#include "Reload.h"
+#include "DocumentState.h"
+#include "Scheduler.h"
+#include "Diff.h"
+
+namespace doc {
+
+  // Pairs the rows region has in doc with those it has in lines by their hashes. The rows
+  // that aren't in lines, or weren't loaded from the file, pair with none.
+  static void alignRows(Document const& doc, std::vector<FileLine> const& lines, ReloadRegion & region)
+  {
+    auto oldFields = [&doc, &region] (int row) {
+      row += region.oldStart_;
+      return row < (int)doc.fileLines_.size() ? (int)doc.fileLines_[row].fields_ : -1;
+    };
+
+    std::vector<uint64_t> before;
+    for (int row = region.oldStart_; row < region.oldEnd_; ++row)
+      before.push_back(row < (int)doc.fileLines_.size() ? doc.fileLines_[row].hash_ : ~0ull);
+
+    std::vector<uint64_t> after;
+    for (int row = region.newStart_; row < region.newEnd_; ++row)
+      after.push_back(row < (int)lines.size() ? lines[row].hash_ : ~1ull);
+
+    const std::vector<diff::Edit> edits = diff::align(before, after, DIFF_MAX_EDITS);
+
+    for (std::size_t i = 0; i < edits.size(); )
+    {
+      if (edits[i].op_ == diff::Op::Same)
+      {
+        region.steps_.push_back(ReloadStep { ReloadStep::Keep, oldFields(edits[i].a_) });
+        ++i;
+        continue;
+      }
+
+      // The rows removed and those added in their place change in order, the rest of
+      // either go or come
+      const std::size_t removed = i;
+      while (i < edits.size() && edits[i].op_ == diff::Op::Removed)
+        ++i;
+
+      const std::size_t added = i;
+      while (i < edits.size() && edits[i].op_ == diff::Op::Added)
+        ++i;
+
+      const std::size_t pairs = std::min(added - removed, i - added);
+
+      for (std::size_t k = 0; k < pairs; ++k)
+        region.steps_.push_back(ReloadStep { ReloadStep::Change, oldFields(edits[removed + k].a_) });
+
+      for (std::size_t k = removed + pairs; k < added; ++k)
+        region.steps_.push_back(ReloadStep { ReloadStep::Remove, oldFields(edits[k].a_) });
+
+      for (std::size_t k = added + pairs; k < i; ++k)
+        region.steps_.push_back(ReloadStep { ReloadStep::Insert, -1 });
+    }
+  }
+
+  bool planReload(Document const& doc, StrView data, std::vector<FileChunk> & chunks, std::vector<FileLine> & lines, std::vector<ReloadRegion> & regions)
+  {
+    // The runs of the file, hashed the way loading it hashes them
+    std::vector<ParsedChunk> parts = splitChunks(data);
+    std::vector<std::vector<std::size_t>> partEnds(parts.size());
+    const char delimiter = doc.delimiter_;
+
+    std::vector<Scheduler::Task> tasks;
+    for (std::size_t i = 0; i < parts.size(); ++i)
+      tasks.push_back([&parts, &partEnds, &data, delimiter, i] () {
+        ParsedChunk & part = parts[i];
+        const std::size_t offset = part.data_.data() - data.data();
+
+        csv::Reader reader(delimiter);
+        uint32_t field = 0;
+        uint64_t hash = 0;
+        reader.read(part.data_, [&] (StrView text, bool lineEnd) {
+          hash = hashField(hash, text, field++);
+          if (!lineEnd)
+            return;
+
+          addChunkRow(part.fileChunks_, hash);
+          part.fileLines_.push_back(FileLine { (uint32_t)hash, field });
+          partEnds[i].resize(part.fileChunks_.size());
+          partEnds[i].back() = offset + reader.fieldEnd();
+          hash = 0;
+          field = 0;
+        });
+      });
+
+    Scheduler::shared().run(tasks);
+
+    std::vector<std::size_t> ends;
+    for (std::size_t i = 0; i < parts.size(); ++i)
+    {
+      lines.insert(lines.end(), parts[i].fileLines_.begin(), parts[i].fileLines_.end());
+
+      for (std::size_t c = 0; c < parts[i].fileChunks_.size(); ++c)
+      {
+        if (appendChunk(chunks, parts[i].fileChunks_[c]))
+          ends.push_back(partEnds[i][c]);
+        else
+          ends.back() = partEnds[i][c];
+      }
+    }
+
+    // The rows past the runs, a last line without a line break or rows edits added, pair
+    // with nothing
+    std::vector<uint64_t> before;
+    int oldRows = 0;
+    for (auto const& chunk : doc.fileChunks_)
+    {
+      before.push_back(chunk.hash_);
+      oldRows += chunk.rows_;
+    }
+
+    const int oldTail = std::max(doc.height_ - oldRows, 0);
+    if (oldTail > 0)
+      before.push_back(~0ull);
+
+    std::vector<uint64_t> after;
+    for (auto const& chunk : chunks)
+      after.push_back(chunk.hash_);
+
+    const std::size_t tailStart = ends.empty() ? 0 : ends.back();
+    const bool newTail = tailStart < data.size();
+    if (newTail)
+      after.push_back(~1ull);
+
+    // A region is every run between two that are the same
+    int oldRow = 0;
+    int newRow = 0;
+    std::size_t newBytes = 0;
+    bool open = false;
+
+    for (auto const& edit : diff::align(before, after, DIFF_MAX_EDITS))
+    {
+      if (edit.op_ == diff::Op::Same)
+      {
+        oldRow += doc.fileChunks_[edit.a_].rows_;
+        newRow += chunks[edit.b_].rows_;
+        newBytes = ends[edit.b_];
+        open = false;
+        continue;
+      }
+
+      if (!open)
+      {
+        regions.emplace_back();
+        regions.back().oldStart_ = regions.back().oldEnd_ = oldRow;
+        regions.back().newStart_ = regions.back().newEnd_ = newRow;
+        regions.back().bytesStart_ = regions.back().bytesEnd_ = newBytes;
+        open = true;
+      }
+
+      ReloadRegion & region = regions.back();
+      if (edit.op_ == diff::Op::Removed)
+        oldRow = region.oldEnd_ += edit.a_ < (int)doc.fileChunks_.size() ? doc.fileChunks_[edit.a_].rows_ : oldTail;
+      else
+      {
+        const bool tail = edit.b_ == (int)chunks.size();
+        newRow = region.newEnd_ += tail ? 1 : chunks[edit.b_].rows_;
+        newBytes = region.bytesEnd_ = tail ? data.size() : ends[edit.b_];
+      }
+    }
+
+    for (auto & region : regions)
+      alignRows(doc, lines, region);
+
+    return newTail;
+  }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Str.h"
+
+#include <cstddef>
+#include <vector>
+
+// Reloading a CSV file that was rewritten in place. The runs of rows of the file, hashed
+// the way loading it hashes them, are aligned with the runs the document was loaded with.
+// The rows of the runs that differ are aligned in turn, and only the rows that changed
+// are read again.
+namespace doc {
+
+  struct Document;
+  struct FileChunk;
+  struct FileLine;
+
+  // What reload() does at the next row of a region: Keep leaves the row of the document,
+  // which the file has as it was loaded, Change sets it to the row of the file, Remove
+  // deletes it and Insert adds the row of the file before it. Every row of the file in
+  // the region has a Keep, Change or Insert, in order. fields_ is the number of fields the
+  // row of the document was loaded with, -1 if that isn't known.
+  struct ReloadStep
+  {
+    enum Op { Keep, Change, Remove, Insert };
+
+    Op op_;
+    int fields_;
+  };
+
+  // Rows of the document that reload() replaces with rows of the file, the last of them
+  // from byte bytesStart_ to bytesEnd_
+  struct ReloadRegion
+  {
+    int oldStart_ = 0;
+    int oldEnd_ = 0;
+    int newStart_ = 0;
+    int newEnd_ = 0;
+    std::size_t bytesStart_ = 0;
+    std::size_t bytesEnd_ = 0;
+    std::vector<ReloadStep> steps_;
+  };
+
+  // Aligns the runs of data, what the CSV file doc was loaded from holds now, with the
+  // runs of doc. Sets chunks and lines to the runs and rows of data and regions to the
+  // rows that differ, in order. Returns whether data ends in a line without a line break,
+  // which is in no run.
+  bool planReload(Document const& doc, StrView data, std::vector<FileChunk> & chunks, std::vector<FileLine> & lines, std::vector<ReloadRegion> & regions);
+}
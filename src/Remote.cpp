@@ -0,0 +1,317 @@
+
+#include "Remote.h"
+#include "bx/platform.h"
+
+#include <cstring>
+#include <cerrno>
+
+#if BX_PLATFORM_LINUX || BX_PLATFORM_OSX
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#define REMOTE_SUPPORTED 1
+#endif
+
+namespace remote {
+
+  // Size and type in front of every message
+  static const std::size_t HEADER_SIZE = sizeof(uint32_t) + sizeof(uint8_t);
+
+#if REMOTE_SUPPORTED
+  static bool socketAddress(std::string const& path, struct sockaddr_un & address)
+  {
+    if (path.size() >= sizeof(address.sun_path))
+      return false;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size());
+    return true;
+  }
+
+  static void setNonBlocking(int fd)
+  {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+  }
+#endif
+
+  Connection::Connection(int fd)
+    : fd_(fd)
+  {
+  }
+
+  Connection::~Connection()
+  {
+#if REMOTE_SUPPORTED
+    if (fd_ >= 0)
+      ::close(fd_);
+#endif
+  }
+
+  bool Connection::connect(std::string const& path)
+  {
+#if REMOTE_SUPPORTED
+    struct sockaddr_un address;
+    if (!socketAddress(path, address))
+      return false;
+
+    fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd_ < 0)
+      return false;
+
+    if (::connect(fd_, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+      ::close(fd_);
+      fd_ = -1;
+      return false;
+    }
+
+    setNonBlocking(fd_);
+    return true;
+#else
+    (void)path;
+    return false;
+#endif
+  }
+
+  void Connection::send(uint8_t type, const void * data, std::size_t size)
+  {
+    char header[HEADER_SIZE];
+    const uint32_t messageSize = size;
+    memcpy(header, &messageSize, sizeof(messageSize));
+    header[sizeof(messageSize)] = type;
+
+    write(header, sizeof(header));
+    write(data, size);
+  }
+
+  void Connection::write(const void * data, std::size_t size)
+  {
+    // What was written already goes before the buffer grows
+    if (outStart_ > 0)
+    {
+      out_.erase(out_.begin(), out_.begin() + outStart_);
+      outStart_ = 0;
+    }
+
+    if (size > 0)
+      out_.insert(out_.end(), (const char *)data, (const char *)data + size);
+  }
+
+  bool Connection::flush()
+  {
+#if REMOTE_SUPPORTED
+    while (outStart_ < out_.size())
+    {
+#ifdef MSG_NOSIGNAL
+      const ssize_t written = ::send(fd_, &out_[outStart_], out_.size() - outStart_, MSG_NOSIGNAL);
+#else
+      const ssize_t written = ::send(fd_, &out_[outStart_], out_.size() - outStart_, 0);
+#endif
+
+      if (written < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+      outStart_ += written;
+      bytesSent_ += written;
+    }
+
+    out_.clear();
+    outStart_ = 0;
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  bool Connection::receive()
+  {
+#if REMOTE_SUPPORTED
+    if (inStart_ > 0)
+    {
+      in_.erase(in_.begin(), in_.begin() + inStart_);
+      inStart_ = 0;
+    }
+
+    char buffer[16 * 1024];
+    for (;;)
+    {
+      const ssize_t count = ::recv(fd_, buffer, sizeof(buffer), 0);
+      if (count == 0)
+        return false;
+
+      if (count < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+      in_.insert(in_.end(), buffer, buffer + count);
+      bytesReceived_ += count;
+    }
+#else
+    return false;
+#endif
+  }
+
+  bool Connection::nextMessage(uint8_t & type, std::vector<char> & data)
+  {
+    if (in_.size() - inStart_ < HEADER_SIZE)
+      return false;
+
+    uint32_t size = 0;
+    memcpy(&size, &in_[inStart_], sizeof(size));
+
+    if (in_.size() - inStart_ < HEADER_SIZE + size)
+      return false;
+
+    type = in_[inStart_ + sizeof(size)];
+    data.assign(in_.begin() + inStart_ + HEADER_SIZE, in_.begin() + inStart_ + HEADER_SIZE + size);
+
+    inStart_ += HEADER_SIZE + size;
+    return true;
+  }
+
+  void Connection::takeInput(std::string & data)
+  {
+    data.append(in_.begin() + inStart_, in_.end());
+    in_.clear();
+    inStart_ = 0;
+  }
+
+  Listener::~Listener()
+  {
+    close();
+  }
+
+  bool Listener::listen(std::string const& path)
+  {
+#if REMOTE_SUPPORTED
+    struct sockaddr_un address;
+    if (!socketAddress(path, address))
+      return false;
+
+    // Only a socket nobody answers on is replaced
+    {
+      Connection other;
+      if (other.connect(path))
+        return false;
+    }
+
+    unlink(path.c_str());
+
+    fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd_ < 0)
+      return false;
+
+    if (bind(fd_, (struct sockaddr *)&address, sizeof(address)) != 0 || ::listen(fd_, 16) != 0)
+    {
+      ::close(fd_);
+      fd_ = -1;
+      return false;
+    }
+
+    chmod(path.c_str(), 0660);
+    setNonBlocking(fd_);
+
+    path_ = path;
+    return true;
+#else
+    (void)path;
+    return false;
+#endif
+  }
+
+  bool Listener::listenLocal(int port)
+  {
+#if REMOTE_SUPPORTED
+    if (port <= 0 || port > 65535)
+      return false;
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd_ < 0)
+      return false;
+
+    const int reuse = 1;
+    setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    if (bind(fd_, (struct sockaddr *)&address, sizeof(address)) != 0 || ::listen(fd_, 16) != 0)
+    {
+      ::close(fd_);
+      fd_ = -1;
+      return false;
+    }
+
+    setNonBlocking(fd_);
+    return true;
+#else
+    (void)port;
+    return false;
+#endif
+  }
+
+  void Listener::close()
+  {
+#if REMOTE_SUPPORTED
+    if (fd_ < 0)
+      return;
+
+    ::close(fd_);
+    if (!path_.empty())
+      unlink(path_.c_str());
+
+    fd_ = -1;
+    path_.clear();
+#endif
+  }
+
+  std::unique_ptr<Connection> Listener::accept()
+  {
+#if REMOTE_SUPPORTED
+    const int fd = ::accept(fd_, nullptr, nullptr);
+    if (fd < 0)
+      return nullptr;
+
+    setNonBlocking(fd);
+    return std::unique_ptr<Connection>(new Connection(fd));
+#else
+    return nullptr;
+#endif
+  }
+
+  bool wait(Listener const& listener, std::vector<Connection *> const& connections, int timeout)
+  {
+    return wait(std::vector<Listener const*> { &listener }, connections, timeout);
+  }
+
+  bool wait(std::vector<Listener const*> const& listeners, std::vector<Connection *> const& connections, int timeout)
+  {
+#if REMOTE_SUPPORTED
+    std::vector<struct pollfd> fds;
+    fds.reserve(connections.size() + listeners.size());
+
+    for (Listener const* listener : listeners)
+      if (listener->fd() >= 0)
+        fds.push_back(pollfd { listener->fd(), POLLIN, 0 });
+
+    for (Connection * connection : connections)
+      fds.push_back(pollfd { connection->fd(), (short)(POLLIN | (connection->hasOutput() ? POLLOUT : 0)), 0 });
+
+    return poll(fds.data(), fds.size(), timeout) > 0;
+#else
+    (void)listeners;
+    (void)connections;
+    (void)timeout;
+    return false;
+#endif
+  }
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+// Messages over Unix stream sockets, between a zum serving its view and the clients
+// attached to it. A message is its size, a type and that many bytes. Both ends run on
+// the same host, so values are sent as they are laid out in memory.
+//
+// A listener can also take TCP connections on a port of the loopback interface, for the
+// metrics endpoint to answer HTTP on with write() and takeInput().
+//
+// Only supported where there are Unix sockets, listen() and connect() fail elsewhere.
+namespace remote {
+
+  class Connection
+  {
+    public:
+      Connection() { }
+      explicit Connection(int fd);
+      ~Connection();
+
+      Connection(Connection const&) = delete;
+      Connection & operator = (Connection const&) = delete;
+
+      // Connects to the socket at path, returns false if nothing listens there
+      bool connect(std::string const& path);
+
+      int fd() const { return fd_; }
+
+      // Queues a message, it is written by flush()
+      void send(uint8_t type, const void * data, std::size_t size);
+
+      // Queues bytes as they are, without a header
+      void write(const void * data, std::size_t size);
+
+      // Writes as much of the queued messages as the socket takes without blocking.
+      // Returns false once the other end is gone.
+      bool flush();
+      bool hasOutput() const { return outStart_ < out_.size(); }
+
+      // Reads what arrived without blocking, returns false once the other end is gone.
+      // The messages that arrived before can still be taken.
+      bool receive();
+
+      // Takes the oldest message that arrived whole, false if there is none
+      bool nextMessage(uint8_t & type, std::vector<char> & data);
+
+      // Appends the bytes that arrived to data and takes them, messages or not
+      void takeInput(std::string & data);
+
+      // Bytes written to the socket and read from it so far, and queued to be written
+      uint64_t bytesSent() const { return bytesSent_; }
+      uint64_t bytesReceived() const { return bytesReceived_; }
+      std::size_t queuedBytes() const { return out_.size() - outStart_; }
+
+    private:
+      int fd_ = -1;
+      uint64_t bytesSent_ = 0;
+      uint64_t bytesReceived_ = 0;
+
+      std::vector<char> out_;
+      std::size_t outStart_ = 0;
+
+      std::vector<char> in_;
+      std::size_t inStart_ = 0;
+  };
+
+  class Listener
+  {
+    public:
+      Listener() { }
+      ~Listener();
+
+      Listener(Listener const&) = delete;
+      Listener & operator = (Listener const&) = delete;
+
+      // Creates the socket at path, which the members of its group can connect to. A
+      // socket left there by a server that is gone is replaced. Returns false if another
+      // server listens at path or the socket can't be created.
+      bool listen(std::string const& path);
+
+      // Listens for TCP connections to port on the loopback interface, false if it is taken
+      bool listenLocal(int port);
+
+      // Removes the socket
+      void close();
+
+      int fd() const { return fd_; }
+
+      // The next client that connected, nullptr if none is waiting
+      std::unique_ptr<Connection> accept();
+
+    private:
+      int fd_ = -1;
+      std::string path_;
+  };
+
+  // Waits at most timeout ms, without limit when it is negative, until a client connects
+  // to listener, one of the connections can be read or one with output can be written.
+  // Returns false on timeout or when a signal arrived.
+  bool wait(Listener const& listener, std::vector<Connection *> const& connections, int timeout);
+  bool wait(std::vector<Listener const*> const& listeners, std::vector<Connection *> const& connections, int timeout);
+}
@@ -0,0 +1,245 @@
+
+#include "Replay.h"
+#include "Editor.h"
+#include "Commands.h"
+#include "Document.h"
+#include "Scheduler.h"
+#include "Tcl.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace replay {
+
+  static const char * HEADER = "# zum events 1";
+
+  static const int JOB_LOCK_TIMEOUT = 10;
+
+  static std::ofstream recording_;
+  static std::chrono::steady_clock::time_point recordingStart_;
+
+  static double seconds()
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  const char * keyClassName(KeyClass keyClass)
+  {
+    switch (keyClass)
+    {
+      case KeyClass::NAVIGATE: return "navigate";
+      case KeyClass::TYPE: return "type";
+      case KeyClass::COMMIT: return "commit";
+      case KeyClass::COMMAND: return "command";
+      default: return "";
+    }
+  }
+
+  KeyClass classify(view::Event const& event)
+  {
+    const bool enter = event.key == view::KEY_ENTER && event.ch == 0;
+
+    switch (getEditorMode())
+    {
+      case EditorMode::EDIT:
+        return enter ? KeyClass::COMMIT : KeyClass::TYPE;
+
+      case EditorMode::COMMAND:
+      case EditorMode::SEARCH:
+        return enter ? KeyClass::COMMAND : KeyClass::TYPE;
+
+      default:
+        return KeyClass::NAVIGATE;
+    }
+  }
+
+  bool startRecording(std::string const& filename)
+  {
+    recording_.open(filename, std::ios::binary | std::ios::trunc);
+    if (!recording_)
+    {
+      logError("Could not record the events to '", filename, "'");
+      return false;
+    }
+
+    recording_ << HEADER << "\n";
+    recordingStart_ = std::chrono::steady_clock::now();
+    return true;
+  }
+
+  void stopRecording()
+  {
+    if (recording_.is_open())
+      recording_.close();
+  }
+
+  // The time an event came in is kept for reading, playing back ignores it
+  void record(view::Event const& event)
+  {
+    if (!recording_.is_open() || (event.type != view::EVENT_KEY && event.type != view::EVENT_RESIZE))
+      return;
+
+    const long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - recordingStart_).count();
+
+    if (event.type == view::EVENT_KEY)
+      recording_ << ms << " key " << (uint32_t)event.key << " " << event.ch << "\n";
+    else
+      recording_ << ms << " resize\n";
+
+    recording_.flush();
+  }
+
+  bool load(std::string const& filename, std::vector<view::Event> & events)
+  {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file)
+    {
+      logError("Could not open the events '", filename, "'");
+      return false;
+    }
+
+    std::string line;
+    if (!std::getline(file, line) || line != HEADER)
+    {
+      logError("'", filename, "' is not a recording of events");
+      return false;
+    }
+
+    int lineNumber = 1;
+    while (std::getline(file, line))
+    {
+      ++lineNumber;
+
+      std::istringstream words(line);
+      long long ms = 0;
+      std::string type;
+      uint32_t key = 0;
+      uint32_t ch = 0;
+
+      if (!(words >> ms >> type) || (type == "key" && !(words >> key >> ch)) || (type != "key" && type != "resize"))
+      {
+        logError("Bad event on line ", lineNumber, " of '", filename, "'");
+        return false;
+      }
+
+      events.push_back(type == "key" ? view::Event { view::EVENT_KEY, (view::Keys)key, ch } : view::Event { view::EVENT_RESIZE, view::KEY_NONE, 0 });
+    }
+
+    return true;
+  }
+
+  void Latencies::add(KeyClass keyClass, double seconds)
+  {
+    samples_[(int)keyClass].push_back(seconds * 1000.0);
+  }
+
+  double Latencies::percentile(KeyClass keyClass, double fraction) const
+  {
+    std::vector<double> samples = samples_[(int)keyClass];
+    if (samples.empty())
+      return 0.0;
+
+    // Nearest rank
+    const std::size_t rank = std::min(samples.size() - 1, (std::size_t)(fraction * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+    return samples[rank];
+  }
+
+  void Latencies::print() const
+  {
+    printf("{\n  \"latencies\": [\n");
+
+    bool first = true;
+    for (int i = 0; i < (int)KeyClass::COUNT; ++i)
+    {
+      const KeyClass keyClass = (KeyClass)i;
+      const std::size_t count = samples_[i].size();
+      if (count == 0)
+        continue;
+
+      const double p50 = percentile(keyClass, 0.50);
+      const double p95 = percentile(keyClass, 0.95);
+      const double p99 = percentile(keyClass, 0.99);
+
+      fprintf(stderr, "%-10s %8zu keys  p50 %8.3f ms  p95 %8.3f ms  p99 %8.3f ms\n", keyClassName(keyClass), count, p50, p95, p99);
+      printf("%s    { \"class\": \"%s\", \"keys\": %zu, \"p50_ms\": %.3f, \"p95_ms\": %.3f, \"p99_ms\": %.3f }",
+             first ? "" : ",\n", keyClassName(keyClass), count, p50, p95, p99);
+
+      first = false;
+    }
+
+    printf("%s  ]\n}\n", first ? "" : "\n");
+  }
+
+  // Whatever a key started in the background is done before the next one, so it isn't
+  // put down to the keys after it
+  static void settle()
+  {
+    while (doc::isLoading())
+      doc::updateLoading();
+
+    while (Scheduler::shared().busy())
+    {
+      Scheduler::shared().runCompletions();
+      std::this_thread::yield();
+    }
+
+    Scheduler::shared().runCompletions();
+  }
+
+  // The command line runs as a job, which has the document while the main thread waits
+  static void finishJob()
+  {
+    if (!tcl::jobRunning())
+      return;
+
+    tcl::unlockDocument();
+
+    while (!tcl::jobEnded())
+      std::this_thread::yield();
+
+    while (!tcl::lockDocument(JOB_LOCK_TIMEOUT))
+      ;
+
+    finishAppCommands();
+  }
+
+  void play(std::vector<view::Event> const& events, Latencies & latencies, std::function<bool ()> const& running)
+  {
+    updateCursor();
+    drawInterface();
+
+    for (view::Event event : events)
+    {
+      if (running && !running())
+        break;
+
+      settle();
+
+      if (event.type != view::EVENT_KEY)
+      {
+        updateCursor();
+        drawInterface();
+        continue;
+      }
+
+      const KeyClass keyClass = classify(event);
+      const double start = seconds();
+
+      handleKeyEvent(&event);
+      executeEditCommands();
+      finishJob();
+      updateCursor();
+      drawInterface();
+
+      latencies.add(keyClass, seconds() - start);
+    }
+
+    settle();
+  }
+}
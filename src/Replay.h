@@ -0,0 +1,57 @@
+#pragma once
+
+#include "View.h"
+
+#include <string>
+#include <vector>
+#include <functional>
+
+// Recorded sessions for measuring input latency. zum --record file writes down every event
+// the main loop handles, one per line. A recording is played back against the null view
+// by zum_bench --replay or against the real one by zum --replay. Each event is handled and
+// the interface drawn before the next one, and the time from the event to the end of
+// present() is reported as percentiles per kind of key.
+namespace replay {
+
+  enum class KeyClass
+  {
+    NAVIGATE,   // keys in navigation mode
+    TYPE,       // typing into a cell or the command line
+    COMMIT,     // enter while editing a cell
+    COMMAND,    // enter on the command or search line
+    COUNT
+  };
+
+  const char * keyClassName(KeyClass keyClass);
+
+  // What kind of key event is, given the mode the editor is in before it is handled
+  KeyClass classify(view::Event const& event);
+
+  bool startRecording(std::string const& filename);
+  void stopRecording();
+
+  // Appends event to the recording, if one was started
+  void record(view::Event const& event);
+
+  // Reads the events of a recording, returns false if it can't be read
+  bool load(std::string const& filename, std::vector<view::Event> & events);
+
+  class Latencies
+  {
+    public:
+      void add(KeyClass keyClass, double seconds);
+
+      // Milliseconds below which fraction of the samples are, 0 without samples
+      double percentile(KeyClass keyClass, double fraction) const;
+
+      // A line per class to stderr and the percentiles as JSON to stdout
+      void print() const;
+
+    private:
+      std::vector<double> samples_[(int)KeyClass::COUNT];
+  };
+
+  // Handles the events one at a time the way the main loop does until they run out or
+  // running returns false
+  void play(std::vector<view::Event> const& events, Latencies & latencies, std::function<bool ()> const& running = nullptr);
+}
@@ -0,0 +1,224 @@
+
+#include "RowVisibility.h"
+#include "Memory.h"
+#include "bx/platform.h"
+
+#include <algorithm>
+
+#if BX_COMPILER_MSVC
+#  include <intrin.h>
+#endif
+
+static int countBits(uint64_t bits)
+{
+#if BX_COMPILER_MSVC
+  return (int)__popcnt64(bits);
+#else
+  return __builtin_popcountll(bits);
+#endif
+}
+
+// bits can't be 0
+static int lowestBit(uint64_t bits)
+{
+#if BX_COMPILER_MSVC
+  unsigned long index;
+  _BitScanForward64(&index, bits);
+  return index;
+#else
+  return __builtin_ctzll(bits);
+#endif
+}
+
+bool RowVisibility::hidden(int row) const
+{
+  if (row < 0 || (std::size_t)row / 64 >= bits_.size())
+    return false;
+
+  return (bits_[row / 64] >> (row % 64)) & 1;
+}
+
+void RowVisibility::set(int first, int last, bool hidden)
+{
+  first = std::max(first, 0);
+  if (last < first)
+    return;
+
+  if (hidden && (std::size_t)last / 64 >= bits_.size())
+    bits_.resize(last / 64 + 1, 0);
+
+  last = std::min<long long>(last, (long long)bits_.size() * 64 - 1);
+  if (last < first)
+    return;
+
+  for (int word = first / 64; word <= last / 64; ++word)
+  {
+    const int from = word == first / 64 ? first % 64 : 0;
+    const int to = word == last / 64 ? last % 64 : 63;
+    const uint64_t mask = (to == 63 ? ~0ULL : (1ULL << (to + 1)) - 1) & ~((1ULL << from) - 1);
+
+    if (hidden)
+      bits_[word] |= mask;
+    else
+      bits_[word] &= ~mask;
+  }
+
+  build();
+}
+
+void RowVisibility::hide(std::vector<int> const& rows)
+{
+  for (int row : rows)
+  {
+    if (row < 0)
+      continue;
+
+    if ((std::size_t)row / 64 >= bits_.size())
+      bits_.resize(row / 64 + 1, 0);
+
+    bits_[row / 64] |= 1ULL << (row % 64);
+  }
+
+  build();
+}
+
+void RowVisibility::clear()
+{
+  std::vector<uint64_t>().swap(bits_);
+  std::vector<int>().swap(tree_);
+  hiddenCount_ = 0;
+}
+
+int RowVisibility::visibleBefore(int row) const
+{
+  if (row <= 0 || empty())
+    return row;
+
+  const std::size_t word = row / 64;
+  if (word >= bits_.size())
+    return row - hiddenCount_;
+
+  int hiddenRows = countBits(bits_[word] & ((1ULL << (row % 64)) - 1));
+  for (std::size_t i = word; i > 0; i -= i & (0 - i))
+    hiddenRows += tree_[i];
+
+  return row - hiddenRows;
+}
+
+int RowVisibility::visibleRow(int index) const
+{
+  if (index < 0 || empty())
+    return index;
+
+  // Descends the tree to the last word whose shown rows before it are at most index
+  const std::size_t words = bits_.size();
+  std::size_t step = 1;
+  while (step * 2 <= words)
+    step *= 2;
+
+  std::size_t word = 0;
+  int remaining = index;
+  for (; step > 0; step /= 2)
+  {
+    const std::size_t next = word + step;
+    if (next <= words)
+    {
+      const int shown = (int)step * 64 - tree_[next];
+      if (shown <= remaining)
+      {
+        word = next;
+        remaining -= shown;
+      }
+    }
+  }
+
+  if (word == words)
+    return (int)(words * 64) + remaining;
+
+  // The shown row remaining rows after the first one shown in word
+  uint64_t shown = ~bits_[word];
+  for (int i = 0; i < remaining; ++i)
+    shown &= shown - 1;
+
+  return (int)word * 64 + lowestBit(shown);
+}
+
+void RowVisibility::shift(int first, int delta)
+{
+  if (empty() || delta == 0)
+    return;
+
+  std::vector<int> rows = hiddenRows();
+  std::vector<int> moved;
+  moved.reserve(rows.size());
+
+  for (int row : rows)
+  {
+    if (row >= first)
+      moved.push_back(row + delta);
+    else if (row < first + delta)
+      moved.push_back(row);
+  }
+
+  bits_.clear();
+  hide(moved);
+}
+
+void RowVisibility::permute(int first, std::vector<uint32_t> const& order)
+{
+  if (empty() || order.empty())
+    return;
+
+  std::vector<int> moved;
+  for (std::size_t i = 0; i < order.size(); ++i)
+    if (hidden(first + (int)order[i]))
+      moved.push_back(first + (int)i);
+
+  set(first, first + (int)order.size() - 1, false);
+  hide(moved);
+}
+
+std::size_t RowVisibility::memoryUsage() const
+{
+  return memory::bytes(bits_) + memory::bytes(tree_);
+}
+
+// Built bottom up, each node adds itself to its parent once it is complete
+void RowVisibility::build()
+{
+  while (!bits_.empty() && bits_.back() == 0)
+    bits_.pop_back();
+
+  if (bits_.empty())
+  {
+    clear();
+    return;
+  }
+
+  const std::size_t words = bits_.size();
+  tree_.assign(words + 1, 0);
+  hiddenCount_ = 0;
+
+  for (std::size_t i = 1; i <= words; ++i)
+  {
+    const int count = countBits(bits_[i - 1]);
+    tree_[i] += count;
+    hiddenCount_ += count;
+
+    const std::size_t parent = i + (i & (0 - i));
+    if (parent <= words)
+      tree_[parent] += tree_[i];
+  }
+}
+
+std::vector<int> RowVisibility::hiddenRows() const
+{
+  std::vector<int> rows;
+  rows.reserve(hiddenCount_);
+
+  for (std::size_t word = 0; word < bits_.size(); ++word)
+    for (uint64_t bits = bits_[word]; bits != 0; bits &= bits - 1)
+      rows.push_back((int)word * 64 + lowestBit(bits));
+
+  return rows;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// The rows of a buffer hidden in place, a bit per row in words of 64 rows. A Fenwick tree
+// over the words counts the hidden rows before each of them, so the rows shown before a
+// row and the row shown at an index are found in O(log n) plus a scan of one word,
+// however many rows are hidden. Rows past the last word are shown.
+class RowVisibility
+{
+  public:
+    bool empty() const { return hiddenCount_ == 0; }
+    int hiddenCount() const { return hiddenCount_; }
+
+    bool hidden(int row) const;
+
+    // Hides or shows rows first to last
+    void set(int first, int last, bool hidden);
+
+    // Hides rows, in any order
+    void hide(std::vector<int> const& rows);
+
+    void clear();
+
+    // The rows before row that are shown
+    int visibleBefore(int row) const;
+
+    // The row shown at index, counting the rows shown from 0. visibleRow(visibleBefore(row))
+    // is row itself when it is shown, the next row shown after it when it is hidden.
+    int visibleRow(int index) const;
+
+    // Moves every row at or after first by delta. With a negative delta the -delta rows
+    // before first are dropped. The rows moved in are shown.
+    void shift(int first, int delta);
+
+    // Row first + i takes the state of row first + order[i], see CellStorage::permuteRows()
+    void permute(int first, std::vector<uint32_t> const& order);
+
+    std::size_t memoryUsage() const;
+
+  private:
+    void build();
+    std::vector<int> hiddenRows() const;
+
+  private:
+    std::vector<uint64_t> bits_;
+
+    // tree_[i] is the hidden rows of the words i - (i & -i) to i - 1, i from 1
+    std::vector<int> tree_;
+    int hiddenCount_ = 0;
+};
@@ -0,0 +1,75 @@
+#include "Sample.h"
+#include "DocumentState.h"
+#include "Document.h"
+#include "FlatHashMap.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <random>
+
+namespace doc {
+
+  bool openSampleView(int count, bool copyHeader)
+  {
+    Document & doc = currentDoc();
+    if (doc.loading_ || isIndexing(doc))
+    {
+      logError("can't sample a document that is still loading");
+      return false;
+    }
+
+    Buffer const& source = currentBuffer();
+    const int rowCount = getRowCount();
+    const int firstRow = copyHeader ? 1 : 0;
+    const std::size_t size = std::max(rowCount - firstRow, 0);
+
+    // Floyd's algorithm picks count distinct positions in as many steps, without looking
+    // at the rows it leaves out. A paged document finds the rows it picks in its index.
+    std::vector<uint32_t> picked;
+    if ((std::size_t)count >= size)
+    {
+      picked.resize(size);
+      for (std::size_t i = 0; i < size; ++i)
+        picked[i] = i;
+    }
+    else
+    {
+      std::mt19937_64 random(std::random_device{}());
+      FlatHashMap<bool> taken;
+      taken.reserve(count);
+      picked.reserve(count);
+
+      for (std::size_t i = size - count; i < size; ++i)
+      {
+        // i itself can't be taken yet, the earlier steps picked below it
+        uint32_t position = random() % (i + 1);
+        if (!taken.insert(position, true).second)
+        {
+          position = i;
+          taken.insert(i, true);
+        }
+
+        picked.push_back(position);
+      }
+
+      std::sort(picked.begin(), picked.end());
+    }
+
+    Buffer buffer;
+    buffer.doc_ = source.doc_;
+    buffer.view_ = true;
+    buffer.rows_.reserve(picked.size() + 1);
+    if (copyHeader && rowCount > 0)
+      buffer.rows_.push_back(documentRow(0));
+    for (uint32_t position : picked)
+      buffer.rows_.push_back(documentRow(firstRow + position));
+
+    // The header is in neither count
+    buffer.sampleRate_ = source.sampleRate_ * (size > 0 ? (double)picked.size() / size : 1.0);
+
+    documentBuffers().push_back(std::move(buffer));
+    jumpToBuffer(documentBuffers().size() - 1);
+
+    return true;
+  }
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+// Sample views: a number of rows of a buffer picked at random, kept in the order of the
+// buffer and knowing their sampling rate.
+namespace doc {
+
+  // Opens a view of count rows of the current buffer picked at random, and the header
+  // with copyHeader. Returns false, having logged why, for a document that is still loading.
+  bool openSampleView(int count, bool copyHeader);
+}
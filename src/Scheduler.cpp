@@ -0,0 +1,330 @@
+#include "Scheduler.h"
+#include "Tcl.h"
+
+#include "bx/thread.h"
+#include "bx/mutex.h"
+#include "bx/sem.h"
+#include "bx/timer.h"
+
+#include <thread>
+#include <deque>
+#include <algorithm>
+
+static const tcl::Variable THREADS("app_threads", 0);
+
+struct Scheduler::Item
+{
+  Task task_;
+  TaskGroup * group_;
+};
+
+struct Scheduler::Worker
+{
+  Scheduler * scheduler_ = nullptr;
+  int index_ = 0;
+
+  // The owner pushes and pops at the back, thieves and tasks from outside come in at the front
+  bx::Mutex mutex_;
+  std::deque<Item *> tasks_;
+};
+
+struct Scheduler::State
+{
+  std::vector<std::unique_ptr<Worker>> workers_;
+  bx::TlsData currentWorker_;
+
+  // Posted once for every task queued, workers sleep on it when there is nothing to take
+  bx::Semaphore work_;
+  std::atomic<bool> quit_;
+  std::atomic<unsigned> nextWorker_;
+  std::atomic<int> active_;
+
+  std::atomic<uint64_t> tasksRun_;
+  std::atomic<uint64_t> steals_;
+  std::atomic<int64_t> idleTicks_;
+
+  bx::Mutex completionMutex_;
+  std::vector<Task> completions_;
+
+  State()
+    : quit_(false),
+      nextWorker_(0),
+      active_(0),
+      tasksRun_(0),
+      steals_(0),
+      idleTicks_(0)
+  { }
+};
+
+TaskGroup::TaskGroup()
+  : TaskGroup(Scheduler::shared())
+{ }
+
+TaskGroup::TaskGroup(Scheduler & scheduler)
+  : scheduler_(scheduler),
+    pending_(0),
+    cancelled_(false)
+{ }
+
+TaskGroup::~TaskGroup()
+{
+  wait();
+}
+
+void TaskGroup::spawn(Task task)
+{
+  if (scheduler_.threadCount() == 0)
+  {
+    if (!cancelled_)
+    {
+      task();
+      scheduler_.state_->tasksRun_++;
+    }
+
+    return;
+  }
+
+  pending_++;
+  scheduler_.push(new Scheduler::Item { std::move(task), this });
+}
+
+void TaskGroup::wait()
+{
+  Scheduler::Worker * worker = static_cast<Scheduler::Worker *>(scheduler_.state_->currentWorker_.get());
+
+  // Run what nobody picked up yet here instead of sleeping, then wait for the rest
+  while (pending_ > 0)
+  {
+    Scheduler::Item * item = scheduler_.take(worker, this);
+    if (!item)
+      break;
+
+    scheduler_.execute(item);
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  finished_.wait(lock, [this] () { return pending_ == 0; });
+}
+
+// The lock is held until the waiter was told, so the group can't go away before
+void TaskGroup::finish()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (--pending_ == 0)
+    finished_.notify_all();
+}
+
+Scheduler::Scheduler(int threadCount)
+  : state_(new State())
+{
+  for (int i = 0; i < threadCount; ++i)
+  {
+    state_->workers_.emplace_back(new Worker());
+    state_->workers_.back()->scheduler_ = this;
+    state_->workers_.back()->index_ = i;
+  }
+
+  for (int i = 0; i < threadCount; ++i)
+  {
+    threads_.emplace_back(new bx::Thread());
+    threads_.back()->init(threadMain, state_->workers_[i].get());
+  }
+}
+
+Scheduler::~Scheduler()
+{
+  state_->quit_ = true;
+  state_->work_.post(threads_.size());
+
+  for (auto & thread : threads_)
+    thread->shutdown();
+}
+
+void Scheduler::run(std::vector<Task> const& tasks)
+{
+  // Waking a worker for a single task only adds latency
+  if (tasks.size() == 1)
+  {
+    tasks.front()();
+    state_->tasksRun_++;
+    return;
+  }
+
+  TaskGroup group(*this);
+  for (auto const& task : tasks)
+    group.spawn(task);
+
+  group.wait();
+}
+
+void Scheduler::push(Item * item)
+{
+  Worker * worker = static_cast<Worker *>(state_->currentWorker_.get());
+  const bool nested = worker != nullptr;
+  if (!nested)
+    worker = state_->workers_[state_->nextWorker_++ % state_->workers_.size()].get();
+
+  state_->active_++;
+
+  // Tasks from outside go in at the front, so every worker runs those in the order
+  // they came in. A load merges its chunks in that order.
+  {
+    bx::MutexScope lock(worker->mutex_);
+    if (nested)
+      worker->tasks_.push_back(item);
+    else
+      worker->tasks_.push_front(item);
+  }
+
+  state_->work_.post();
+}
+
+Scheduler::Item * Scheduler::take(Worker * worker, TaskGroup const* group)
+{
+  auto matches = [group] (Item const* item) { return !group || item->group_ == group; };
+
+  if (worker)
+  {
+    bx::MutexScope lock(worker->mutex_);
+    std::deque<Item *> & tasks = worker->tasks_;
+
+    for (std::size_t i = tasks.size(); i-- > 0; )
+    {
+      if (!matches(tasks[i]))
+        continue;
+
+      Item * item = tasks[i];
+      tasks.erase(tasks.begin() + i);
+      return item;
+    }
+  }
+
+  const std::size_t workerCount = state_->workers_.size();
+  const std::size_t first = worker ? worker->index_ + 1 : 0;
+
+  for (std::size_t i = 0; i < workerCount; ++i)
+  {
+    Worker & victim = *state_->workers_[(first + i) % workerCount];
+    if (&victim == worker)
+      continue;
+
+    bx::MutexScope lock(victim.mutex_);
+    std::deque<Item *> & tasks = victim.tasks_;
+
+    for (std::size_t j = 0; j < tasks.size(); ++j)
+    {
+      if (!matches(tasks[j]))
+        continue;
+
+      Item * item = tasks[j];
+      tasks.erase(tasks.begin() + j);
+
+      if (worker)
+        state_->steals_++;
+
+      return item;
+    }
+  }
+
+  return nullptr;
+}
+
+// The task and what it captured are gone before the group hears it finished
+void Scheduler::execute(Item * item)
+{
+  TaskGroup * group = item->group_;
+
+  if (!group->cancelled())
+  {
+    item->task_();
+    state_->tasksRun_++;
+  }
+
+  delete item;
+  state_->active_--;
+  group->finish();
+}
+
+int Scheduler::threadMain(void * userData)
+{
+  Worker * worker = static_cast<Worker *>(userData);
+  Scheduler & scheduler = *worker->scheduler_;
+  State & state = *scheduler.state_;
+
+  state.currentWorker_.set(worker);
+
+  while (true)
+  {
+    if (Item * item = scheduler.take(worker, nullptr))
+    {
+      scheduler.execute(item);
+      continue;
+    }
+
+    const int64_t start = bx::getHPCounter();
+    state.work_.wait();
+    state.idleTicks_ += bx::getHPCounter() - start;
+
+    if (state.quit_)
+      break;
+  }
+
+  return 0;
+}
+
+void Scheduler::postCompletion(Task task)
+{
+  bx::MutexScope lock(state_->completionMutex_);
+  state_->completions_.push_back(std::move(task));
+}
+
+bool Scheduler::runCompletions()
+{
+  std::vector<Task> completions;
+  {
+    bx::MutexScope lock(state_->completionMutex_);
+    completions.swap(state_->completions_);
+  }
+
+  for (auto const& completion : completions)
+    completion();
+
+  return !completions.empty();
+}
+
+bool Scheduler::busy()
+{
+  if (state_->active_ > 0)
+    return true;
+
+  bx::MutexScope lock(state_->completionMutex_);
+  return !state_->completions_.empty();
+}
+
+Scheduler::Counters Scheduler::counters() const
+{
+  Counters counters;
+  counters.tasksRun_ = state_->tasksRun_;
+  counters.steals_ = state_->steals_;
+  counters.idleMilliseconds_ = state_->idleTicks_ * 1000.0 / bx::getHPFrequency();
+  counters.pending_ = state_->active_;
+
+  bx::MutexScope lock(state_->completionMutex_);
+  counters.completions_ = state_->completions_.size();
+  return counters;
+}
+
+void Scheduler::resetCounters()
+{
+  state_->tasksRun_ = 0;
+  state_->steals_ = 0;
+  state_->idleTicks_ = 0;
+}
+
+Scheduler & Scheduler::shared()
+{
+  static Scheduler scheduler(THREADS.toInt() > 0 ?
+                             THREADS.toInt() :
+                             std::max(1, (int)std::thread::hardware_concurrency() - 1));
+  return scheduler;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace bx
+{
+  class Thread;
+}
+
+class Scheduler;
+
+// Tasks that are waited for or canceled together. Waiting helps run the group's tasks
+// that haven't started yet, canceling drops them and lets the running ones check
+// cancelled(). The destructor waits, so a group never outlives its tasks.
+class TaskGroup
+{
+  public:
+    typedef std::function<void()> Task;
+
+  public:
+    TaskGroup();
+    explicit TaskGroup(Scheduler & scheduler);
+    ~TaskGroup();
+
+    TaskGroup(TaskGroup const&) = delete;
+    TaskGroup & operator = (TaskGroup const&) = delete;
+
+    void spawn(Task task);
+
+    // Returns once every task spawned so far has finished or was dropped
+    void wait();
+
+    void cancel() { cancelled_ = true; }
+    bool cancelled() const { return cancelled_; }
+
+    bool done() const { return pending_ == 0; }
+
+  private:
+    friend class Scheduler;
+
+    void finish();
+
+  private:
+    Scheduler & scheduler_;
+    std::atomic<int> pending_;
+    std::atomic<bool> cancelled_;
+    std::mutex mutex_;
+    std::condition_variable finished_;
+};
+
+// The engine's worker threads. Every worker has a deque of tasks, it runs the newest
+// task of its own deque first and steals the oldest one of another worker's deque once
+// its own is empty. Tasks spawned on a worker go to its own deque, tasks spawned
+// anywhere else are dealt out to the workers in turn and run oldest first.
+//
+// Tasks must not touch the Tcl interpreter, and may only touch the document in ways
+// the caller made race free. Whatever has to happen on the main thread once a task is
+// done goes through postCompletion().
+class Scheduler
+{
+  public:
+    typedef TaskGroup::Task Task;
+
+    struct Counters
+    {
+      uint64_t tasksRun_ = 0;
+      uint64_t steals_ = 0;
+      double idleMilliseconds_ = 0.0;
+
+      // Tasks queued or running and completions waiting to run now, reset leaves them
+      int pending_ = 0;
+      std::size_t completions_ = 0;
+    };
+
+  public:
+    explicit Scheduler(int threadCount);
+    ~Scheduler();
+
+    Scheduler(Scheduler const&) = delete;
+    Scheduler & operator = (Scheduler const&) = delete;
+
+    int threadCount() const { return threads_.size(); }
+
+    // Runs all tasks in one group and returns when every one of them is done
+    void run(std::vector<Task> const& tasks);
+
+    // Queues task to run on the main thread, from any thread
+    void postCompletion(Task task);
+
+    // Runs the completions posted so far, main thread only. Returns false if there were none.
+    bool runCompletions();
+
+    // True while tasks are queued or running, or completions wait to be run
+    bool busy();
+
+    Counters counters() const;
+    void resetCounters();
+
+    // The shared scheduler, created on first use with app_threads workers
+    static Scheduler & shared();
+
+  private:
+    friend class TaskGroup;
+
+    struct Item;
+    struct Worker;
+    struct State;
+
+    void push(Item * item);
+
+    // Takes a task from worker's own deque, or steals one. Without a worker it only
+    // looks at the workers' deques. With group set only tasks of that group are taken.
+    Item * take(Worker * worker, TaskGroup const* group);
+
+    void execute(Item * item);
+
+    static int threadMain(void * userData);
+
+  private:
+    std::unique_ptr<State> state_;
+    std::vector<std::unique_ptr<bx::Thread>> threads_;
+};
@@ -7,6 +7,10 @@ bind "h" navigateLeft "Move cursor left"
 bind "l" navigateRight "Move cursor right"
 bind "k" navigateUp "Move cursor up"
 bind "j" navigateDown "Move cursor down"
+bind "H" navigateDataLeft "Move cursor to the previous edge of the data in the row"
+bind "L" navigateDataRight "Move cursor to the next edge of the data in the row"
+bind "K" navigateDataUp "Move cursor to the previous edge of the data in the column"
+bind "J" navigateDataDown "Move cursor to the next edge of the data in the column"
 bind "y" yankCurrentCell "Copy the content from the current cell to the yank buffer"
 bind "n" findNextMatch "Find the next search match"
 bind "N" findPreviousMatch "Find the previous match"
@@ -27,9 +31,22 @@ bind "P" {
   }
 } "Paste to the current cell and move to the next column"
 
+bind "Y" {
+  yank
+} "Copy the selected cells"
+
+bind "bp" {
+  paste [cursor]
+} "Paste the copied cells at the cursor"
+
+bind "cp" {
+  pasteText [cursor] [clipboard]
+} "Paste the text on the clipboard at the cursor"
+
 bind "+" {
   execWithUndoMerge {
-    foreach col [selection column] {
+    lassign [selection bounds] first last
+    forrange col [list $first [index new [index column $last] [index row $first]]] {
       set width [columnWidth $col]
       columnWidth $col [expr $width + 1]
     }
@@ -38,7 +55,8 @@ bind "+" {
 
 bind "-" {
   execWithUndoMerge {
-    foreach col [selection column] {
+    lassign [selection bounds] first last
+    forrange col [list $first [index new [index column $last] [index row $first]]] {
       set width [columnWidth $col]
       columnWidth $col [expr $width - 1]
     }
@@ -60,11 +78,7 @@ bind "ap" {
 } "Append the yank-buffer to the current cell"
 
 bind "dw" {
-  execWithUndoMerge {
-    foreach c [selection all] {
-      cell $c ""
-    }
-  }
+  range clear {*}[selection bounds]
 } "Clear the selected cells"
 
 # -- Vim bindings for the application --
@@ -92,10 +106,10 @@ proc w {args} {
     set filename [filename]
   }
 
-  if {[save $filename]} {
-    puts "Document saved!"
-  } else {
-    puts "Could not save document"
+  # A large document is saved in the background, save shows its progress itself
+  switch [save $filename] {
+    1 { puts "Document saved!" }
+    0 { puts "Could not save document" }
   }
 }
 
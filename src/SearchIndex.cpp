@@ -0,0 +1,59 @@
+#include "SearchIndex.h"
+#include "Memory.h"
+
+void SearchIndex::update(StringPool const& strings)
+{
+  for (; indexed_ < strings.size(); ++indexed_)
+  {
+    const StrView str = strings.str(indexed_);
+
+    for (std::size_t i = 0; i + 3 <= str.size(); ++i)
+    {
+      std::vector<uint32_t> & ids = trigrams_[trigram(str.data() + i)];
+      if (ids.empty() || ids.back() != indexed_)
+        ids.push_back(indexed_);
+    }
+  }
+}
+
+void SearchIndex::find(StringPool const& strings, std::string const& term, std::vector<uint8_t> & matches)
+{
+  update(strings);
+  matches.assign(strings.size(), 0);
+
+  if (term.empty())
+    return;
+
+  // Terms too short for a trigram are checked against every string
+  if (term.size() < 3)
+  {
+    for (uint32_t id = StringPool::EMPTY + 1; id < strings.size(); ++id)
+      matches[id] = strings.str(id).find(term) != StrView::npos;
+
+    return;
+  }
+
+  std::vector<uint32_t> const* rarest = nullptr;
+
+  for (std::size_t i = 0; i + 3 <= term.size(); ++i)
+  {
+    auto it = trigrams_.find(trigram(&term[i]));
+    if (it == trigrams_.end())
+      return;
+
+    if (!rarest || it->second.size() < rarest->size())
+      rarest = &it->second;
+  }
+
+  for (uint32_t id : *rarest)
+    matches[id] = strings.str(id).find(term) != StrView::npos;
+}
+
+std::size_t SearchIndex::memoryUsage() const
+{
+  std::size_t bytes = memory::bytes(trigrams_);
+  for (auto const& it : trigrams_)
+    bytes += memory::bytes(it.second);
+
+  return bytes;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "StringPool.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+// Trigram index over the strings of a StringPool. The pool only ever grows, so the
+// index catches up with the strings interned since it was last used instead of being
+// told about every edit. Finding a term only verifies the strings that contain its
+// rarest trigram.
+class SearchIndex
+{
+  public:
+    // Indexes the strings added to strings since the last call
+    void update(StringPool const& strings);
+
+    // Sets matches[id] for every string in strings that contains term. matches ends up
+    // with one entry per string in the pool.
+    void find(StringPool const& strings, std::string const& term, std::vector<uint8_t> & matches);
+
+    std::size_t memoryUsage() const;
+
+  private:
+    static uint32_t trigram(const char * str)
+    {
+      return (uint32_t)(uint8_t)str[0] | ((uint32_t)(uint8_t)str[1] << 8) | ((uint32_t)(uint8_t)str[2] << 16);
+    }
+
+  private:
+    // Ids of the strings that contain each trigram, in increasing order
+    std::unordered_map<uint32_t, std::vector<uint32_t>> trigrams_;
+    uint32_t indexed_ = StringPool::EMPTY + 1;
+};
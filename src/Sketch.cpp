@@ -0,0 +1,185 @@
+#include "Sketch.h"
+#include "bx/uint32_t.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace sketch {
+
+  void HyperLogLog::add(uint64_t hash)
+  {
+    // The top bits pick the register, the rank is one more than the leading zeros of the
+    // rest. The bit set below the rest bounds the rank when it is all zeros.
+    const std::size_t i = hash >> (64 - PRECISION);
+    const uint64_t rest = (hash << PRECISION) | ((uint64_t)1 << (PRECISION - 1));
+    const uint8_t rank = (uint8_t)bx::uint64_cntlz(rest) + 1;
+
+    if (rank > registers_[i])
+      registers_[i] = rank;
+  }
+
+  void HyperLogLog::merge(HyperLogLog const& other)
+  {
+    for (std::size_t i = 0; i < REGISTERS; ++i)
+      registers_[i] = std::max(registers_[i], other.registers_[i]);
+  }
+
+  uint64_t HyperLogLog::estimate() const
+  {
+    const double m = (double)REGISTERS;
+
+    double sum = 0.0;
+    std::size_t zeros = 0;
+    for (uint8_t rank : registers_)
+    {
+      sum += std::ldexp(1.0, -(int)rank);
+      zeros += rank == 0;
+    }
+
+    double estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+
+    // Small sets leave registers empty, counting those is more accurate
+    if (estimate <= 2.5 * m && zeros > 0)
+      estimate = m * std::log(m / zeros);
+
+    return (uint64_t)(estimate + 0.5);
+  }
+
+  void Quantiles::grow()
+  {
+    levels_.emplace_back();
+    capacities_.resize(levels_.size());
+
+    limit_ = 0;
+    for (std::size_t h = 0; h < levels_.size(); ++h)
+    {
+      const double depth = (double)(levels_.size() - 1 - h);
+      capacities_[h] = std::max<std::size_t>(8, (std::size_t)std::ceil(k_ * std::pow(2.0 / 3.0, depth)));
+      limit_ += capacities_[h];
+    }
+  }
+
+  void Quantiles::add(double value)
+  {
+    if (std::isnan(value))
+      return;
+
+    if (count_ == 0)
+      min_ = max_ = value;
+    else
+    {
+      min_ = std::min(min_, value);
+      max_ = std::max(max_, value);
+    }
+
+    count_++;
+
+    if (levels_.empty())
+      grow();
+
+    levels_[0].push_back(value);
+    if (++size_ >= limit_)
+      compress();
+  }
+
+  void Quantiles::merge(Quantiles const& other)
+  {
+    if (other.count_ == 0)
+      return;
+
+    if (count_ == 0)
+    {
+      min_ = other.min_;
+      max_ = other.max_;
+    }
+    else
+    {
+      min_ = std::min(min_, other.min_);
+      max_ = std::max(max_, other.max_);
+    }
+
+    count_ += other.count_;
+
+    while (levels_.size() < other.levels_.size())
+      grow();
+
+    for (std::size_t h = 0; h < other.levels_.size(); ++h)
+      levels_[h].insert(levels_[h].end(), other.levels_[h].begin(), other.levels_[h].end());
+
+    size_ += other.size_;
+    compress();
+  }
+
+  void Quantiles::compress()
+  {
+    // Bottom up, what moves up a level may fill that one too
+    for (std::size_t h = 0; h < levels_.size(); ++h)
+    {
+      if (levels_[h].size() < capacities_[h])
+        continue;
+
+      if (h + 1 == levels_.size())
+        grow();
+
+      std::vector<double> & level = levels_[h];
+      std::vector<double> & up = levels_[h + 1];
+      std::sort(level.begin(), level.end());
+
+      // The smallest value stays when there is an odd one out
+      const std::size_t kept = level.size() % 2;
+
+      random_ ^= random_ << 13;
+      random_ ^= random_ >> 7;
+      random_ ^= random_ << 17;
+
+      for (std::size_t i = kept + (random_ & 1); i < level.size(); i += 2)
+        up.push_back(level[i]);
+
+      size_ -= (level.size() - kept) / 2;
+      level.resize(kept);
+    }
+  }
+
+  double Quantiles::quantile(double q) const
+  {
+    if (count_ == 0)
+      return NAN;
+
+    if (q <= 0.0)
+      return min_;
+
+    if (q >= 1.0)
+      return max_;
+
+    std::vector<std::pair<double, uint64_t>> weighted;
+    weighted.reserve(size_);
+
+    for (std::size_t h = 0; h < levels_.size(); ++h)
+      for (double value : levels_[h])
+        weighted.emplace_back(value, (uint64_t)1 << h);
+
+    std::sort(weighted.begin(), weighted.end());
+
+    // Every value stands for its weight of the count_ values
+    const double rank = q * count_;
+    uint64_t below = 0;
+
+    for (auto const& it : weighted)
+    {
+      below += it.second;
+      if (below >= rank)
+        return it.first;
+    }
+
+    return max_;
+  }
+
+  std::size_t Quantiles::memoryUsage() const
+  {
+    std::size_t bytes = levels_.capacity() * sizeof(std::vector<double>) + capacities_.capacity() * sizeof(std::size_t);
+    for (auto const& level : levels_)
+      bytes += level.capacity() * sizeof(double);
+
+    return bytes;
+  }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Fixed size summaries of large sets of values, for the approximate column statistics
+// of the colstats command. Both sketches are filled by add() and can be merged, so a
+// column is summarized in ranges on the scheduler and the ranges merged afterwards.
+// Values can't be taken out again.
+namespace sketch {
+
+  // HyperLogLog estimate of the number of distinct values, given by 64 bit hashes of
+  // them. The 2^14 registers estimate within about 1% and take 16KB.
+  class HyperLogLog
+  {
+    public:
+      static const int PRECISION = 14;
+      static const std::size_t REGISTERS = (std::size_t)1 << PRECISION;
+
+    public:
+      HyperLogLog() : registers_(REGISTERS, 0) { }
+
+      void add(uint64_t hash);
+      void merge(HyperLogLog const& other);
+
+      uint64_t estimate() const;
+
+      std::size_t memoryUsage() const { return registers_.capacity(); }
+
+    private:
+      std::vector<uint8_t> registers_;
+  };
+
+  // KLL sketch of the distribution of a set of numbers. Level h holds values that stand
+  // for 2^h values each. A full level is sorted and every other value moves up to the
+  // next level. The top level holds k values, every level below it 2/3 of the one above
+  // but at least 8. With k = 200 a quantile is off by less than about 1.5% of the ranks.
+  class Quantiles
+  {
+    public:
+      explicit Quantiles(int k = 200) : k_(k) { }
+
+      // NaN is left out
+      void add(double value);
+      void merge(Quantiles const& other);
+
+      uint64_t count() const { return count_; }
+
+      // The value with about q * count() values below it, q from 0 to 1. The smallest
+      // and largest values are exact. NaN when there are no values.
+      double quantile(double q) const;
+
+      std::size_t memoryUsage() const;
+
+    private:
+      // Adds a level on top, the levels below get smaller
+      void grow();
+      void compress();
+
+    private:
+      int k_;
+      uint64_t count_ = 0;
+      double min_ = 0.0;
+      double max_ = 0.0;
+
+      // Values held on every level together, compress() runs once it reaches limit_,
+      // the sum of the capacities_ of the levels
+      std::size_t size_ = 0;
+      std::size_t limit_ = 0;
+      std::vector<std::vector<double>> levels_;
+      std::vector<std::size_t> capacities_;
+
+      // Picks which half of a level moves up
+      uint64_t random_ = 0x9e3779b97f4a7c15ull;
+  };
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <type_traits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+// Vector of trivially copyable values that keeps up to N of them inside the object and
+// only allocates once it grows past that. Meant for the many small arrays of formulas,
+// which then live in the allocation of whatever holds them. Growing invalidates
+// pointers to the values, like it does for std::vector.
+template <typename T, uint32_t N>
+class SmallVector
+{
+  static_assert(std::is_trivially_copyable<T>::value, "values are copied as bytes");
+
+  public:
+    SmallVector() { }
+    SmallVector(SmallVector const& copy) { *this = copy; }
+    SmallVector(SmallVector && other) { *this = static_cast<SmallVector &&>(other); }
+    ~SmallVector() { release(); }
+
+    SmallVector & operator = (SmallVector const& copy);
+    SmallVector & operator = (SmallVector && other);
+
+    uint32_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    T * data() { return data_; }
+    T const* data() const { return data_; }
+
+    T & operator [] (std::size_t i) { return data_[i]; }
+    T const& operator [] (std::size_t i) const { return data_[i]; }
+
+    T const& back() const { return data_[size_ - 1]; }
+
+    T * begin() { return data_; }
+    T * end() { return data_ + size_; }
+    T const* begin() const { return data_; }
+    T const* end() const { return data_ + size_; }
+
+    void reserve(uint32_t capacity);
+    void push_back(T const& value);
+    void append(T const* first, T const* last);
+
+    void assign(T const* first, T const* last) { size_ = 0; append(first, last); }
+    void clear() { size_ = 0; }
+
+    // Only shrinks
+    void resize(uint32_t size) { if (size < size_) size_ = size; }
+
+    // Bytes allocated on the heap, nothing while the values fit inside
+    std::size_t memoryUsage() const { return data_ == local() ? 0 : capacity_ * sizeof(T); }
+
+  private:
+    T * local() { return reinterpret_cast<T *>(&inline_); }
+    T const* local() const { return reinterpret_cast<T const*>(&inline_); }
+
+    void release() { if (data_ != local()) free(data_); }
+
+  private:
+    T * data_ = local();
+    uint32_t size_ = 0;
+    uint32_t capacity_ = N;
+    typename std::aligned_storage<sizeof(T) * N, alignof(T)>::type inline_;
+};
+
+template <typename T, uint32_t N>
+SmallVector<T, N> & SmallVector<T, N>::operator = (SmallVector const& copy)
+{
+  if (this != &copy)
+    assign(copy.begin(), copy.end());
+
+  return *this;
+}
+
+template <typename T, uint32_t N>
+SmallVector<T, N> & SmallVector<T, N>::operator = (SmallVector && other)
+{
+  if (this == &other)
+    return *this;
+
+  if (other.data_ == other.local())
+  {
+    assign(other.begin(), other.end());
+    other.size_ = 0;
+    return *this;
+  }
+
+  // A heap array is handed over
+  release();
+  data_ = other.data_;
+  size_ = other.size_;
+  capacity_ = other.capacity_;
+
+  other.data_ = other.local();
+  other.size_ = 0;
+  other.capacity_ = N;
+  return *this;
+}
+
+template <typename T, uint32_t N>
+void SmallVector<T, N>::reserve(uint32_t capacity)
+{
+  if (capacity <= capacity_)
+    return;
+
+  T * data = static_cast<T *>(malloc(capacity * sizeof(T)));
+  if (size_ > 0)
+    memcpy(data, data_, size_ * sizeof(T));
+
+  release();
+  data_ = data;
+  capacity_ = capacity;
+}
+
+template <typename T, uint32_t N>
+void SmallVector<T, N>::push_back(T const& value)
+{
+  if (size_ == capacity_)
+  {
+    // value may be one of the values
+    const T copy = value;
+    reserve(capacity_ * 2);
+    data_[size_++] = copy;
+    return;
+  }
+
+  data_[size_++] = value;
+}
+
+template <typename T, uint32_t N>
+void SmallVector<T, N>::append(T const* first, T const* last)
+{
+  const uint32_t count = last - first;
+  if (count == 0)
+    return;
+
+  if (size_ + count > capacity_)
+    reserve(std::max(capacity_ * 2, size_ + count));
+
+  memcpy(data_ + size_, first, count * sizeof(T));
+  size_ += count;
+}
@@ -0,0 +1,130 @@
+#include "Snappy.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace snappy {
+
+  enum Tag
+  {
+    LITERAL = 0,
+    COPY_1 = 1,
+    COPY_2 = 2,
+    COPY_4 = 3,
+  };
+
+  // Little endian base 128, at most 5 bytes for 32 bits
+  static bool readVarint(const uint8_t *& in, const uint8_t * end, std::size_t & value)
+  {
+    value = 0;
+    for (int shift = 0; shift < 35 && in < end; shift += 7)
+    {
+      const uint8_t byte = *in++;
+      value |= (std::size_t)(byte & 0x7f) << shift;
+
+      if ((byte & 0x80) == 0)
+        return true;
+    }
+
+    return false;
+  }
+
+  static std::size_t readLittleEndian(const uint8_t * in, int bytes)
+  {
+    std::size_t value = 0;
+    for (int i = 0; i < bytes; ++i)
+      value |= (std::size_t)in[i] << (8 * i);
+
+    return value;
+  }
+
+  bool decompressedSize(StrView data, std::size_t & size)
+  {
+    const uint8_t * in = (const uint8_t *)data.data();
+    return readVarint(in, in + data.size(), size);
+  }
+
+  bool decompress(StrView data, char * out, std::size_t size)
+  {
+    const uint8_t * in = (const uint8_t *)data.data();
+    const uint8_t * end = in + data.size();
+
+    std::size_t expected;
+    if (!readVarint(in, end, expected) || expected != size)
+      return false;
+
+    std::size_t pos = 0;
+    while (in < end)
+    {
+      const uint8_t tag = *in++;
+      std::size_t length;
+      std::size_t offset;
+
+      switch (tag & 3)
+      {
+        case LITERAL:
+        {
+          // Lengths from 61 on are in the 1 to 4 bytes after the tag
+          length = (tag >> 2) + 1;
+          if (length > 60)
+          {
+            const int bytes = (int)length - 60;
+            if (end - in < bytes)
+              return false;
+
+            length = readLittleEndian(in, bytes) + 1;
+            in += bytes;
+          }
+
+          if ((std::size_t)(end - in) < length || size - pos < length)
+            return false;
+
+          memcpy(out + pos, in, length);
+          in += length;
+          pos += length;
+          continue;
+        }
+
+        case COPY_1:
+          if (end - in < 1)
+            return false;
+
+          length = ((tag >> 2) & 7) + 4;
+          offset = ((std::size_t)(tag >> 5) << 8) | *in++;
+          break;
+
+        case COPY_2:
+          if (end - in < 2)
+            return false;
+
+          length = (tag >> 2) + 1;
+          offset = readLittleEndian(in, 2);
+          in += 2;
+          break;
+
+        default:
+          if (end - in < 4)
+            return false;
+
+          length = (tag >> 2) + 1;
+          offset = readLittleEndian(in, 4);
+          in += 4;
+          break;
+      }
+
+      if (offset == 0 || offset > pos || size - pos < length)
+        return false;
+
+      // Copies overlap when the offset is shorter than the length, byte by byte repeats them
+      if (offset >= length)
+        memcpy(out + pos, out + pos - offset, length);
+      else
+        for (std::size_t i = 0; i < length; ++i)
+          out[pos + i] = out[pos + i - offset];
+
+      pos += length;
+    }
+
+    return pos == size;
+  }
+}
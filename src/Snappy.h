@@ -0,0 +1,18 @@
+#pragma once
+
+#include "Str.h"
+
+#include <cstddef>
+
+// Decompression of the raw Snappy format, which Parquet files compress their pages with
+// more than anything else. Like LZ4 it is literals and back references, with the size
+// of the decompressed data in front.
+namespace snappy {
+
+  // Reads the decompressed size at the start of data, returns false if there is none
+  bool decompressedSize(StrView data, std::size_t & size);
+
+  // Decompresses data into out, which holds exactly size bytes. Returns false if data
+  // is corrupt or doesn't decompress to size bytes.
+  bool decompress(StrView data, char * out, std::size_t size);
+}
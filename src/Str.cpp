@@ -1,31 +1,179 @@
 
 #include "Str.h"
+#include "Utf8.h"
 #include "MurmurHash.h"
 
-#include "termbox.h"
 #include <stdarg.h>
 #include <stdio.h>
 #include <algorithm>
 #include <cmath>
 #include <cstring>
 #include <cstdlib>
-#include <sstream>
-#include <ios>
 
 namespace str {
 
   std::string fromInt(long long int value)
   {
-    std::stringstream ss;
-    ss << value;
-    return ss.str();
+    char out[20];
+    return std::string(out, formatInt(value, out));
+  }
+
+  std::size_t formatInt(long long int value, char * out)
+  {
+    char digits[20];
+    std::size_t count = 0;
+
+    // Negate as unsigned, so the smallest value doesn't overflow
+    unsigned long long magnitude = value < 0 ? 0ull - (unsigned long long)value : (unsigned long long)value;
+
+    do
+    {
+      digits[count++] = '0' + magnitude % 10;
+      magnitude /= 10;
+    } while (magnitude > 0);
+
+    std::size_t length = 0;
+    if (value < 0)
+      out[length++] = '-';
+
+    while (count > 0)
+      out[length++] = digits[--count];
+
+    return length;
+  }
+
+  // Integers this small are exact in a double and print the same with any precision
+  static const double EXACT_INTEGER_LIMIT = 1e15;
+
+  std::size_t formatDouble(double value, char * out)
+  {
+    if (std::fabs(value) < EXACT_INTEGER_LIMIT && value == std::floor(value))
+      return formatInt((long long)value, out);
+
+    // 17 significant digits always round-trip, fewer usually do and read better
+    int length = 0;
+    for (int precision = 15; precision <= 17; ++precision)
+    {
+      length = snprintf(out, FORMAT_SIZE, "%.*g", precision, value);
+      if (strtod(out, nullptr) == value)
+        break;
+    }
+
+    return length;
+  }
+
+  std::size_t formatDouble(double value, int precision, char * out)
+  {
+    if (std::fabs(value) < std::min(std::pow(10.0, precision), EXACT_INTEGER_LIMIT) && value == std::floor(value))
+      return formatInt((long long)value, out);
+
+    return snprintf(out, FORMAT_SIZE, "%.*g", precision, value);
+  }
+
+  std::size_t formatFixed(double value, int decimals, bool grouped, char * out)
+  {
+    if (!(std::fabs(value) < EXACT_INTEGER_LIMIT))
+      return formatDouble(value, 6, out);
+
+    char digits[FORMAT_SIZE];
+    const int length = snprintf(digits, sizeof(digits), "%.*f", std::min(std::max(decimals, 0), 14), value);
+    if (!grouped)
+    {
+      memcpy(out, digits, length + 1);
+      return length;
+    }
+
+    const char * point = (const char *)memchr(digits, '.', length);
+    const int sign = digits[0] == '-' ? 1 : 0;
+    const int integerDigits = (point ? point - digits : length) - sign;
+
+    std::size_t pos = 0;
+    for (int i = 0; i < length; ++i)
+    {
+      const int digit = i - sign;
+
+      // A comma before every group of three integer digits but the first
+      if (digit > 0 && digit < integerDigits && (integerDigits - digit) % 3 == 0)
+        out[pos++] = ',';
+
+      out[pos++] = digits[i];
+    }
+
+    out[pos] = '\0';
+    return pos;
+  }
+
+  std::size_t formatFloat(float value, char * out)
+  {
+    std::size_t length = 0;
+    for (int precision = 6; precision <= 9; ++precision)
+    {
+      length = formatDouble(value, precision, out);
+      out[length] = '\0';
+      if (strtof(out, nullptr) == value)
+        break;
+    }
+
+    return length;
+  }
+
+  // Year, month and day of days since 1970-01-01, see http://howardhinnant.github.io/date_algorithms.html
+  static void civilDate(long long days, long long & year, int & month, int & day)
+  {
+    days += 719468;
+    const long long era = (days >= 0 ? days : days - 146096) / 146097;
+    const long long dayOfEra = days - era * 146097;
+    const long long yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    const long long dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    const long long monthIndex = (5 * dayOfYear + 2) / 153;
+
+    day = (int)(dayOfYear - (153 * monthIndex + 2) / 5 + 1);
+    month = (int)(monthIndex < 10 ? monthIndex + 3 : monthIndex - 9);
+    year = yearOfEra + era * 400 + (month <= 2);
+  }
+
+  static long long floorDivide(long long value, long long divisor)
+  {
+    return value / divisor - (value % divisor < 0 ? 1 : 0);
+  }
+
+  std::size_t formatDate(long long days, char * out)
+  {
+    long long year;
+    int month, day;
+    civilDate(days, year, month, day);
+
+    return std::min<std::size_t>(snprintf(out, FORMAT_SIZE, "%04lld-%02d-%02d", year, month, day), FORMAT_SIZE - 1);
+  }
+
+  std::size_t formatTimestamp(long long value, long long unitsPerSecond, char * out)
+  {
+    unitsPerSecond = std::max(unitsPerSecond, 1ll);
+
+    const long long seconds = floorDivide(value, unitsPerSecond);
+    const long long fraction = value - seconds * unitsPerSecond;
+    const long long days = floorDivide(seconds, 86400);
+    const long long time = seconds - days * 86400;
+
+    std::size_t length = formatDate(days, out);
+    length += snprintf(out + length, FORMAT_SIZE - length, " %02d:%02d:%02d", (int)(time / 3600), (int)(time / 60 % 60), (int)(time % 60));
+
+    if (fraction)
+    {
+      int decimals = 0;
+      for (long long units = unitsPerSecond; units > 1; units /= 10)
+        ++decimals;
+
+      length += snprintf(out + length, FORMAT_SIZE - length, ".%0*lld", decimals, fraction);
+    }
+
+    return std::min<std::size_t>(length, FORMAT_SIZE - 1);
   }
 
   std::string fromDouble(double value)
   {
-    std::stringstream ss;
-    ss << value;
-    return ss.str();
+    char out[FORMAT_SIZE];
+    return std::string(out, formatDouble(value, out));
   }
 
   std::string stripWhitespace(std::string const& str)
@@ -41,6 +189,226 @@ namespace str {
     return str.substr(front, back - front);
   }
 
+  bool parseNumber(StrView text, double & value)
+  {
+    // Powers of ten that are exactly representable as a double
+    static const double POWERS_OF_TEN[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    text = text.stripWhitespace();
+
+    const char * it = text.begin();
+    const char * end = text.end();
+
+    const bool negative = it != end && *it == '-';
+    if (it != end && (*it == '-' || *it == '+'))
+      ++it;
+
+    uint64_t mantissa = 0;
+    int significant = 0;
+    int exponent = 0;
+    int digits = 0;
+
+    for (; it != end && isDigit(*it); ++it, ++digits)
+    {
+      if (significant < 19)
+      {
+        mantissa = mantissa * 10 + (*it - '0');
+        significant += mantissa != 0;
+      }
+      else
+        exponent++;
+    }
+
+    if (it != end && *it == '.')
+    {
+      for (++it; it != end && isDigit(*it); ++it, ++digits)
+      {
+        if (significant < 19)
+        {
+          mantissa = mantissa * 10 + (*it - '0');
+          significant += mantissa != 0;
+          exponent--;
+        }
+      }
+    }
+
+    if (digits == 0)
+      return false;
+
+    if (it != end && (*it == 'e' || *it == 'E'))
+    {
+      ++it;
+
+      const bool negativeExponent = it != end && *it == '-';
+      if (it != end && (*it == '-' || *it == '+'))
+        ++it;
+
+      if (it == end || !isDigit(*it))
+        return false;
+
+      int exponentValue = 0;
+      for (; it != end && isDigit(*it); ++it)
+        if (exponentValue < 100000)
+          exponentValue = exponentValue * 10 + (*it - '0');
+
+      exponent += negativeExponent ? -exponentValue : exponentValue;
+    }
+
+    if (it != end)
+      return false;
+
+    // With at most 15 significant digits both the mantissa and the power of ten are exact,
+    // so a single multiplication or division gives the correctly rounded result
+    if (significant <= 15 && exponent >= -22 && exponent <= 22)
+    {
+      double result = static_cast<double>(mantissa);
+      result = exponent < 0 ? result / POWERS_OF_TEN[-exponent] : result * POWERS_OF_TEN[exponent];
+
+      value = negative ? -result : result;
+      return true;
+    }
+
+    value = strtod(text.str().c_str(), nullptr);
+    return true;
+  }
+
+  // The number the two digits at text make, or -1 if they aren't both digits
+  static int twoDigits(const char * text)
+  {
+    const unsigned high = (unsigned char)text[0] - '0';
+    const unsigned low = (unsigned char)text[1] - '0';
+    return high < 10 && low < 10 ? (int)(high * 10 + low) : -1;
+  }
+
+  // Days since 1970-01-01 of a date, the inverse of civilDate()
+  static long long civilDays(long long year, int month, int day)
+  {
+    year -= month <= 2;
+    const long long era = (year >= 0 ? year : year - 399) / 400;
+    const long long yearOfEra = year - era * 400;
+    const long long dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const long long dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+  }
+
+  static int daysInMonth(int year, int month)
+  {
+    static const int DAYS[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    const bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    return DAYS[month - 1] + (month == 2 && leap ? 1 : 0);
+  }
+
+  bool parseTimestamp(StrView text, long long & micros)
+  {
+    text = text.stripWhitespace();
+
+    const char * it = text.data();
+    const std::size_t size = text.size();
+
+    // Every part is at a fixed offset, so most text is ruled out by its first separators
+    // before a digit is read
+    if (size < 10 || it[4] != '-' || it[7] != '-')
+      return false;
+
+    const int century = twoDigits(it);
+    const int yearOfCentury = twoDigits(it + 2);
+    const int month = twoDigits(it + 5);
+    const int day = twoDigits(it + 8);
+    if (century < 0 || yearOfCentury < 0 || month < 1 || month > 12 || day < 1)
+      return false;
+
+    const int year = century * 100 + yearOfCentury;
+    if (day > daysInMonth(year, month))
+      return false;
+
+    long long seconds = civilDays(year, month, day) * 86400;
+    long long fraction = 0;
+    std::size_t pos = 10;
+
+    if (pos < size)
+    {
+      if ((it[pos] != 'T' && it[pos] != 't' && it[pos] != ' ') || size < pos + 6 || it[pos + 3] != ':')
+        return false;
+
+      const int hours = twoDigits(it + pos + 1);
+      const int minutes = twoDigits(it + pos + 4);
+      if (hours < 0 || hours > 23 || minutes < 0 || minutes > 59)
+        return false;
+
+      seconds += hours * 3600 + minutes * 60;
+      pos += 6;
+
+      if (pos < size && it[pos] == ':')
+      {
+        // 60 is a leap second
+        const int second = size < pos + 3 ? -1 : twoDigits(it + pos + 1);
+        if (second < 0 || second > 60)
+          return false;
+
+        seconds += second;
+        pos += 3;
+
+        if (pos < size && (it[pos] == '.' || it[pos] == ','))
+        {
+          int digits = 0;
+          for (++pos; pos < size && isDigit(it[pos]); ++pos, ++digits)
+            if (digits < 6)
+              fraction = fraction * 10 + (it[pos] - '0');
+
+          if (digits == 0)
+            return false;
+
+          for (; digits < 6; ++digits)
+            fraction *= 10;
+        }
+      }
+
+      if (pos < size && (it[pos] == 'Z' || it[pos] == 'z'))
+        ++pos;
+      else if (pos < size && (it[pos] == '+' || it[pos] == '-'))
+      {
+        // +HH, +HH:MM or +HHMM
+        const long long sign = it[pos] == '-' ? -1 : 1;
+        const int offsetHours = size < pos + 3 ? -1 : twoDigits(it + pos + 1);
+        pos += 3;
+
+        const bool colon = pos < size && it[pos] == ':';
+        pos += colon ? 1 : 0;
+
+        const bool hoursOnly = pos >= size && !colon;
+        const int offsetMinutes = hoursOnly ? 0 : size < pos + 2 ? -1 : twoDigits(it + pos);
+        pos += hoursOnly ? 0 : 2;
+
+        if (offsetHours < 0 || offsetHours > 23 || offsetMinutes < 0 || offsetMinutes > 59)
+          return false;
+
+        seconds -= sign * (offsetHours * 3600 + offsetMinutes * 60);
+      }
+    }
+
+    if (pos != size)
+      return false;
+
+    micros = seconds * 1000000 + fraction;
+    return true;
+  }
+
+  bool parseValue(StrView text, double & value)
+  {
+    if (parseNumber(text, value))
+      return true;
+
+    long long micros = 0;
+    if (!parseTimestamp(text, micros))
+      return false;
+
+    value = (double)micros;
+    return true;
+  }
+
   uint32_t hash(std::string const& str)
   {
     return murmurHash(str.c_str(), str.size(), 0);
@@ -48,22 +416,93 @@ namespace str {
 
   uint32_t toUTF32(std::string const& in, uint32_t * out, uint32_t outLen)
   {
-    // Convert to uft32
-    const char * it = in.c_str();
-    uint32_t strLen = 0;
+    return toUTF32(StrView(in), out, outLen);
+  }
 
-    while (*it && strLen < (outLen - 1))
-    {
-      it += tb_utf8_char_to_unicode(&out[strLen], it);
-      ++strLen;
-    }
-    out[strLen] = '\0';
+  uint32_t toUTF32(StrView in, uint32_t * out, uint32_t outLen)
+  {
+    return utf8::toUTF32(in, out, outLen);
+  }
+
+  int charWidth(uint32_t ch)
+  {
+    static const uint32_t WIDE_RANGES[][2] = {
+      { 0x1100, 0x115F }, { 0x2E80, 0x303E }, { 0x3041, 0x33FF }, { 0x3400, 0x4DBF },
+      { 0x4E00, 0x9FFF }, { 0xA000, 0xA4CF }, { 0xAC00, 0xD7A3 }, { 0xF900, 0xFAFF },
+      { 0xFE30, 0xFE4F }, { 0xFF00, 0xFF60 }, { 0xFFE0, 0xFFE6 }, { 0x1F300, 0x1F64F },
+      { 0x1F900, 0x1F9FF }, { 0x20000, 0x2FFFD }, { 0x30000, 0x3FFFD },
+    };
+
+    if (ch < WIDE_RANGES[0][0])
+      return 1;
 
-    return strLen;
+    for (auto const& range : WIDE_RANGES)
+      if (ch >= range[0] && ch <= range[1])
+        return 2;
+
+    return 1;
   }
 }
 
 
+StrView StrView::substr(std::size_t pos, std::size_t count) const
+{
+  if (pos >= size_)
+    return StrView(data_ + size_, 0);
+
+  return StrView(data_ + pos, std::min(count, size_ - pos));
+}
+
+std::size_t StrView::find(char ch, std::size_t pos) const
+{
+  if (pos >= size_)
+    return npos;
+
+  const void * found = memchr(data_ + pos, ch, size_ - pos);
+  return found ? static_cast<const char *>(found) - data_ : npos;
+}
+
+std::size_t StrView::find(StrView str, std::size_t pos) const
+{
+  if (str.empty())
+    return pos <= size_ ? pos : npos;
+
+  for (pos = find(str[0], pos); pos != npos && pos + str.size() <= size_; pos = find(str[0], pos + 1))
+    if (memcmp(data_ + pos, str.data_, str.size_) == 0)
+      return pos;
+
+  return npos;
+}
+
+StrView StrView::stripWhitespace() const
+{
+  static const char * WHITESPACES = " \t\f\v\n\r";
+
+  std::size_t front = 0;
+  std::size_t back = size_;
+
+  while (front < back && strchr(WHITESPACES, data_[front]))
+    front++;
+
+  while (back > front && strchr(WHITESPACES, data_[back - 1]))
+    back--;
+
+  return StrView(data_ + front, back - front);
+}
+
+bool StrView::operator == (StrView const& other) const
+{
+  return size_ == other.size_ && (size_ == 0 || memcmp(data_, other.data_, size_) == 0);
+}
+
+bool StrView::operator < (StrView const& other) const
+{
+  const std::size_t size = std::min(size_, other.size_);
+  const int order = size == 0 ? 0 : memcmp(data_, other.data_, size);
+  return order < 0 || (order == 0 && size_ < other.size_);
+}
+
+
 Str Str::EMPTY;
 
 Str::Str()
@@ -109,15 +548,10 @@ Str & Str::operator = (std::string const& copy)
 
 void Str::set(const char * str)
 {
-  data_.clear();
-  const char * it = str;
-
-  while (*it)
-  {
-    char_type ch;
-    it += tb_utf8_char_to_unicode(&ch, it);
-    data_.push_back(ch);
-  }
+  // There are at most as many characters as bytes
+  const std::size_t size = strlen(str);
+  data_.resize(size + 1);
+  data_.resize(utf8::toUTF32(StrView(str, size), data_.data(), size + 1));
 }
 
 void Str::set(Str const& str)
@@ -194,14 +628,6 @@ std::vector<Str> Str::split(char_type delimiter, bool keepDelimiter) const
 std::string Str::utf8() const
 {
   std::string result;
-
-  for (auto const& ch : data_)
-  {
-    char str[7];
-    char * it = str + tb_utf8_unicode_to_char(str, ch);
-    *it = '\0';
-    result += str;
-  }
-
+  utf8::fromUTF32(data_.data(), data_.size(), result);
   return result;
 }
@@ -4,13 +4,100 @@
 #include <vector>
 #include <string>
 
+// Non-owning view of a range of chars. The viewed buffer has to outlive the view.
+class StrView
+{
+  public:
+    static const std::size_t npos = std::string::npos;
+
+  public:
+    StrView() { }
+    StrView(const char * data, std::size_t size) : data_(data), size_(size) { }
+    StrView(std::string const& str) : data_(str.data()), size_(str.size()) { }
+
+    char operator [] (std::size_t idx) const { return data_[idx]; }
+
+    const char * data() const { return data_; }
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    const char * begin() const { return data_; }
+    const char * end() const { return data_ + size_; }
+
+    StrView substr(std::size_t pos, std::size_t count = npos) const;
+    std::size_t find(char ch, std::size_t pos = 0) const;
+    std::size_t find(StrView str, std::size_t pos = 0) const;
+    StrView stripWhitespace() const;
+
+    bool operator == (StrView const& other) const;
+    bool operator != (StrView const& other) const { return !(*this == other); }
+
+    // Byte wise, like std::string
+    bool operator < (StrView const& other) const;
+
+    std::string str() const { return std::string(data_, size_); }
+
+  private:
+    const char * data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
 namespace str {
   std::string fromInt(long long int value);
+
+  // Writes value in decimal to out, which has to hold 20 chars, and returns the length
+  std::size_t formatInt(long long int value, char * out);
+
+  // The number formatters write to out, which has to hold FORMAT_SIZE chars, and return
+  // the length. None of them allocate.
+  static const std::size_t FORMAT_SIZE = 48;
+
+  // Writes the shortest text that parses back to exactly value
+  std::size_t formatDouble(double value, char * out);
+
+  // Writes value with at most precision significant digits, the way %g does
+  std::size_t formatDouble(double value, int precision, char * out);
+
+  // Writes value with decimals digits after the point, with a comma between thousands
+  // if grouped is set. Values too large for that are written the way %g does.
+  std::size_t formatFixed(double value, int decimals, bool grouped, char * out);
+
+  // Writes the shortest text that parses back to exactly value as a float, rather than
+  // the double it widens to
+  std::size_t formatFloat(float value, char * out);
+
+  // Writes days since 1970-01-01 as YYYY-MM-DD
+  std::size_t formatDate(long long days, char * out);
+
+  // Writes value, a time since 1970-01-01 in units of which a second has unitsPerSecond,
+  // as YYYY-MM-DD HH:MM:SS. Times between seconds get the decimals a unit needs.
+  std::size_t formatTimestamp(long long value, long long unitsPerSecond, char * out);
+
+  // The shortest text that parses back to value, see formatDouble()
   std::string fromDouble(double value);
 
   std::string stripWhitespace(std::string const& str);
+
+  // Parses text as a decimal number, allowing surrounding whitespace. Unlike std::stod
+  // it never throws and rejects text with trailing characters.
+  bool parseNumber(StrView text, double & value);
+
+  // Parses text as an ISO 8601 date, YYYY-MM-DD, or time: the date, T or a space and then
+  // HH:MM, HH:MM:SS or HH:MM:SS with decimals, maybe followed by Z or an offset like +02:00.
+  // Sets micros to the time since 1970-01-01 UTC in microseconds, a time without an offset
+  // is taken to be UTC. Decimals past the sixth are dropped.
+  bool parseTimestamp(StrView text, long long & micros);
+
+  // Parses text as a number or else as a timestamp, which gives its microseconds. This is
+  // how cells tell numbers from text.
+  bool parseValue(StrView text, double & value);
   uint32_t hash(std::string const& str);
   uint32_t toUTF32(std::string const& in, uint32_t * out, uint32_t outLen);
+  uint32_t toUTF32(StrView in, uint32_t * out, uint32_t outLen);
+
+  // Columns ch takes in a terminal, 2 for the wide and fullwidth characters of East Asian
+  // scripts and for emoji, 1 for the others
+  int charWidth(uint32_t ch);
 }
 
 class Str
@@ -0,0 +1,167 @@
+#include "StreamFilter.h"
+#include "DocumentState.h"
+#include "FileWriter.h"
+#include "Gzip.h"
+#include "Log.h"
+#include "Tcl.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+namespace doc {
+
+  bool filterFile(std::string const& input, std::string const& output, std::vector<std::string> const& args, std::size_t & rows)
+  {
+    rows = 0;
+    const bool copyHeader = args.empty() || args[0] != "-noHeader";
+
+    // Without a document no value is in a pool, the clauses compare texts
+    const StringPool strings;
+    std::vector<FilterClause> clauses;
+    if (!parseFilterClauses(args, copyHeader ? 0 : 1, strings, -1, clauses))
+      return false;
+
+    FILE * file = fopen(input.c_str(), "rb");
+    if (!file)
+    {
+      logError("could not open '", input, "'");
+      return false;
+    }
+
+    FileWriter writer;
+    if (!writer.open(output))
+    {
+      fclose(file);
+      logError("could not write '", output, "'");
+      return false;
+    }
+
+    // The fields of the line being read, the strings keep their capacity from line to line
+    std::vector<std::string> fields;
+    std::size_t fieldCount = 0;
+    std::string value;
+    char delimiter = 0;
+    bool header = copyHeader;
+
+    auto writeLine = [&] () {
+      for (std::size_t i = 0; i < fieldCount; ++i)
+      {
+        if (i > 0)
+          writer.put(delimiter);
+
+        writeCsvText(writer, fields[i], delimiter);
+      }
+
+      writer.put('\n');
+    };
+
+    // A field is what loading would store in a cell, and is compared the way filtering
+    // a paged document compares it
+    auto filterLine = [&] () {
+      if (header)
+      {
+        header = false;
+        writeLine();
+        return true;
+      }
+
+      bool include = false;
+      if (!lineIncludes(clauses, [&] (int column) { return column < (int)fieldCount ? StrView(fields[column]) : StrView(); }, value, include))
+        return false;
+
+      if (include)
+      {
+        writeLine();
+        rows++;
+      }
+
+      return true;
+    };
+
+    // Whole lines are parsed a chunk at a time, so memory holds a chunk and the longest line
+    const std::size_t chunkSize = loadChunkSize();
+    std::string buffer;
+    bool ok = true;
+
+    for (bool end = false; ok && !end; )
+    {
+      const std::size_t used = buffer.size();
+      buffer.resize(used + chunkSize);
+      buffer.resize(used + fread(&buffer[used], 1, chunkSize, file));
+      end = buffer.size() < used + chunkSize;
+
+      if (ferror(file))
+      {
+        logError("could not read '", input, "'");
+        ok = false;
+        break;
+      }
+
+      if (delimiter == 0 && gzip::isGzip(buffer))
+      {
+        logError("compressed files can't be filtered into a file, load '", input, "' instead");
+        ok = false;
+        break;
+      }
+
+      const std::size_t size = end ? buffer.size() : wholeLines(buffer);
+      if (size == 0)
+        continue;
+
+      if (delimiter == 0)
+        delimiter = detectDelimiter(buffer);
+
+      csv::Reader reader(delimiter);
+      reader.read(StrView(buffer.data(), size), [&] (StrView text, bool lineEnd) {
+        if (fields.size() <= fieldCount)
+          fields.emplace_back();
+
+        fields[fieldCount++].assign(text.data(), text.size());
+
+        if (lineEnd)
+        {
+          ok = ok && filterLine();
+          fieldCount = 0;
+        }
+      });
+
+      // The last line of the file may not end in a line break
+      if (end && fieldCount > 0)
+      {
+        ok = ok && filterLine();
+        fieldCount = 0;
+      }
+
+      buffer.erase(0, size);
+    }
+
+    fclose(file);
+
+    if (!writer.close() && ok)
+    {
+      logError("could not write '", output, "'");
+      ok = false;
+    }
+
+    return ok;
+  }
+
+  TCL_FUNC(filterFile, "input output ?-noHeader? column operation value ?column operation value ...?", "Write the lines of the CSV file input that pass the clauses to output, without loading it. Returns the number of lines written, the header not counted.")
+  {
+    TCL_CHECK_ARGS(6, 1000);
+
+    std::vector<std::string> args = stringArgs(1, argc, argv);
+
+    const std::string input = args[0];
+    const std::string output = args[1];
+    args.erase(args.begin(), args.begin() + 2);
+
+    std::size_t rows = 0;
+    if (!filterFile(input, output, args, rows))
+      return JIM_ERR;
+
+    Jim_SetResult(interp, Jim_NewIntObj(interp, (long long)rows));
+    return JIM_OK;
+  }
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace doc {
+
+  // Writes the lines of the CSV file input that pass the filter clauses of args, the
+  // arguments of the filter command, to output. The file is read a chunk at a time and
+  // never loaded, the header is copied unless args start with -noHeader. rows is set to
+  // the number of lines that passed, the header not counted.
+  bool filterFile(std::string const& input, std::string const& output, std::vector<std::string> const& args, std::size_t & rows);
+}
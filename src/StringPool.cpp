@@ -0,0 +1,168 @@
+
+#include "StringPool.h"
+#include "MurmurHash.h"
+#include "Memory.h"
+
+#include <cstring>
+
+static uint32_t hashOf(StrView str)
+{
+  return murmurHash(str.data(), (int)str.size(), 0x9747b28c);
+}
+
+StringPool::StringPool()
+  : slots_(16, (uint32_t)NONE)
+{
+  intern(StrView("", 0));
+}
+
+StringPool::StringPool(StringPool const& copy)
+{
+  *this = copy;
+}
+
+StringPool::StringPool(StringPool && other)
+{
+  *this = std::move(other);
+}
+
+StringPool & StringPool::operator = (StringPool && other)
+{
+  text_ = std::move(other.text_);
+  chunks_ = std::move(other.chunks_);
+  size_ = other.size_;
+  hashes_ = std::move(other.hashes_);
+  slots_ = std::move(other.slots_);
+  other.size_ = 0;
+  return *this;
+}
+
+StringPool & StringPool::operator = (StringPool const& copy)
+{
+  if (this == &copy)
+    return *this;
+
+  // The ids stay the same, so only the strings have to move to an arena of their own
+  std::size_t size = 0;
+  for (uint32_t id = 0; id < copy.size_; ++id)
+    size += copy.str(id).size();
+
+  text_.clear();
+  char * text = size > 0 ? static_cast<char *>(text_.allocate(size)) : nullptr;
+
+  chunks_.clear();
+  size_ = 0;
+  for (uint32_t id = 0; id < copy.size_; ++id)
+  {
+    const StrView str = copy.str(id);
+    if (str.empty())
+    {
+      append(StrView("", 0));
+      continue;
+    }
+
+    memcpy(text, str.data(), str.size());
+    append(StrView(text, str.size()));
+    text += str.size();
+  }
+
+  hashes_ = copy.hashes_;
+  slots_ = copy.slots_;
+  return *this;
+}
+
+std::size_t StringPool::slotOf(StrView str, uint32_t hash) const
+{
+  const std::size_t mask = slots_.size() - 1;
+
+  for (std::size_t slot = hash & mask; ; slot = (slot + 1) & mask)
+  {
+    const uint32_t id = slots_[slot];
+    if (id == NONE || (hashes_[id] == hash && this->str(id) == str))
+      return slot;
+  }
+}
+
+void StringPool::grow()
+{
+  slots_.assign(slots_.size() * 2, (uint32_t)NONE);
+
+  const std::size_t mask = slots_.size() - 1;
+  for (uint32_t id = 0; id < size_; ++id)
+  {
+    std::size_t slot = hashes_[id] & mask;
+    while (slots_[slot] != NONE)
+      slot = (slot + 1) & mask;
+
+    slots_[slot] = id;
+  }
+}
+
+uint32_t StringPool::intern(StrView str)
+{
+  const uint32_t hash = hashOf(str);
+
+  std::size_t slot = slotOf(str, hash);
+  if (slots_[slot] != NONE)
+    return slots_[slot];
+
+  const uint32_t id = size_;
+  append(StrView(text_.copy(str.data(), str.size()), str.size()));
+  hashes_.push_back(hash);
+
+  slots_[slot] = id;
+  if (size_ * 2 > slots_.size())
+    grow();
+
+  return id;
+}
+
+// A full chunk is followed by a new one, the ones before stay where they are
+void StringPool::append(StrView str)
+{
+  if (size_ % CHUNK_SIZE == 0)
+    chunks_.emplace_back(new StrView[CHUNK_SIZE]);
+
+  chunks_.back()[size_ % CHUNK_SIZE] = str;
+  size_++;
+}
+
+StringPool::Table StringPool::strings() const
+{
+  Table table;
+  table.size_ = size_;
+  table.chunks_.reserve(chunks_.size());
+
+  for (auto const& chunk : chunks_)
+    table.chunks_.push_back(chunk.get());
+
+  return table;
+}
+
+bool StringPool::find(StrView str, uint32_t & id) const
+{
+  const std::size_t slot = slotOf(str, hashOf(str));
+  if (slots_[slot] == NONE)
+    return false;
+
+  id = slots_[slot];
+  return true;
+}
+
+std::size_t StringPool::memoryUsage() const
+{
+  return text_.memoryUsage() + memory::bytes(chunks_) + chunks_.size() * CHUNK_SIZE * sizeof(StrView) + memory::bytes(hashes_) + memory::bytes(slots_);
+}
+
+std::vector<uint32_t> StringPool::compact(std::vector<bool> const& live)
+{
+  std::vector<uint32_t> ids(size_, (uint32_t)EMPTY);
+  StringPool pool;
+
+  for (uint32_t id = EMPTY + 1; id < size_; ++id)
+    if (id < live.size() && live[id])
+      ids[id] = pool.intern(str(id));
+
+  *this = std::move(pool);
+  return ids;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Str.h"
+#include "Arena.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+// Interns strings so equal strings are stored once and can be referred to, and
+// compared, by a 32 bit id. Id 0 is always the empty string. Strings are only removed
+// by compact(), which gives the ones left new ids.
+//
+// The characters are kept in an arena and the ids in an open addressing table, so
+// interning a new string allocates nothing but now and then a chunk, and a pool is
+// freed a chunk at a time instead of a string at a time. The strings of the ids are
+// kept in chunks of CHUNK_SIZE too, which never move.
+class StringPool
+{
+  public:
+    static const uint32_t EMPTY = 0;
+    static const uint32_t CHUNK_SIZE = 4096;
+
+    // The strings of the ids a pool had when the table was taken. Taking one copies a
+    // pointer per chunk, and it can be read on another thread while the pool grows, for
+    // as long as the pool lives.
+    class Table
+    {
+      public:
+        StrView str(uint32_t id) const { return chunks_[id / CHUNK_SIZE][id % CHUNK_SIZE]; }
+        std::size_t size() const { return size_; }
+
+      private:
+        friend class StringPool;
+
+        std::vector<StrView const*> chunks_;
+        std::size_t size_ = 0;
+    };
+
+  public:
+    StringPool();
+    StringPool(StringPool const& copy);
+    StringPool(StringPool && other);
+
+    StringPool & operator = (StringPool const& copy);
+    StringPool & operator = (StringPool && other);
+
+    // Returns the id of str, adding it to the pool if needed
+    uint32_t intern(StrView str);
+
+    // Looks up the id of str without adding it. Returns false if str isn't in the pool.
+    bool find(StrView str, uint32_t & id) const;
+
+    StrView str(uint32_t id) const { return chunks_[id / CHUNK_SIZE][id % CHUNK_SIZE]; }
+    std::size_t size() const { return size_; }
+
+    // The string of every id so far
+    Table strings() const;
+
+    // Bytes held by the pool, the strings included
+    std::size_t memoryUsage() const;
+
+    // Keeps the empty string and the strings live is set for, in the order of their ids,
+    // and returns the new id of every old one, EMPTY for the ones dropped. The tables
+    // taken before are of the old strings, which are freed.
+    std::vector<uint32_t> compact(std::vector<bool> const& live);
+
+  private:
+    static const uint32_t NONE = UINT32_MAX;
+
+    // The slot holding str, or the empty slot it would go to
+    std::size_t slotOf(StrView str, uint32_t hash) const;
+    void grow();
+    void append(StrView str);
+
+  private:
+    Arena text_;
+    std::vector<std::unique_ptr<StrView[]>> chunks_;
+    std::size_t size_ = 0;
+    std::vector<uint32_t> hashes_;
+
+    // Ids by hash, probed linearly. The size is a power of two and at most half is used.
+    std::vector<uint32_t> slots_;
+};
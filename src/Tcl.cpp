@@ -2,6 +2,9 @@
 #include "Tcl.h"
 #include "Editor.h"
 #include "Log.h"
+#include "Profile.h"
+#include "FileWriter.h"
+#include "Utf8.h"
 
 #ifndef DEBUG
 #include "ScriptingLib.tcl.h"
@@ -14,11 +17,20 @@
 #include <algorithm>
 #include <functional>
 #include <cstring>
+#include <cmath>
 #include <cassert>
 #include <string.h>
 #include <map>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <csignal>
 
 #include "bx/os.h"
+#include "bx/thread.h"
+#include "bx/timer.h"
 
 extern "C" {
   int Jim_clockInit(Jim_Interp * interp);
@@ -31,6 +43,59 @@ namespace tcl {
 
   static Jim_Interp * interpreter_ = nullptr;
 
+  // Counts the interpreters created, a Script made for an earlier one parses again
+  static uint32_t interpreterGeneration_ = 0;
+
+  // -- Jobs --
+
+  struct Job
+  {
+    std::string code_;
+    bx::Thread thread_;
+    std::atomic<bool> ended_ { false };
+    int retcode_ = JIM_OK;
+  };
+
+  static std::unique_ptr<Job> job_;
+
+  // Set while a job runs, the main thread then leaves the interpreter alone
+  static std::atomic<bool> jobActive_ { false };
+  static thread_local bool jobThread_ = false;
+
+  // Held by the main thread while a job runs, except when it lets the job's commands run
+  static std::timed_mutex documentMutex_;
+  static bool documentLocked_ = false;
+  static std::atomic<bool> documentWanted_ { false };
+
+  // The job takes the document lock around the outermost of its commands, a command
+  // called from a script a command runs holds it already
+  class JobLock
+  {
+    public:
+      JobLock()
+      {
+        if (jobThread_ && depth_++ == 0)
+        {
+          // The main thread only asks for the lock to draw, it goes first
+          while (documentWanted_.load(std::memory_order_acquire))
+            std::this_thread::yield();
+
+          documentMutex_.lock();
+        }
+      }
+
+      ~JobLock()
+      {
+        if (jobThread_ && --depth_ == 0)
+          documentMutex_.unlock();
+      }
+
+    private:
+      static thread_local int depth_;
+  };
+
+  thread_local int JobLock::depth_ = 0;
+
   // -- Variable --
 
   static std::vector<Variable *> & builtInVariables()
@@ -88,23 +153,47 @@ namespace tcl {
     return nullptr;
   }
 
-  std::string Variable::toStr() const
+  // Starts at one so a freshly constructed variable is always refreshed on first read
+  uint32_t Variable::generation_ = 1;
+
+  void Variable::update() const
   {
-    return std::string(Jim_String(value()));
+    // The cached value is kept while a job may be using the interpreter
+    if (jobActive_.load(std::memory_order_acquire) && !jobThread_)
+      return;
+
+    Jim_Obj * obj = value();
+
+    // Only numbers are parsed, and a failed parse leaves the result of the command alone
+    long val = 0;
+    if (obj != nullptr && type_ != ValueType::STRING)
+    {
+      Jim_Obj * result = Jim_GetResult(interpreter_);
+      Jim_IncrRefCount(result);
+      if (Jim_GetLong(interpreter_, obj, &val) != JIM_OK)
+      {
+        val = 0;
+        Jim_SetResult(interpreter_, result);
+      }
+      Jim_DecrRefCount(interpreter_, result);
+    }
+
+    cachedInt_ = val;
+    cachedStr_ = obj ? std::string(Jim_String(obj)) : std::string();
+    cacheGeneration_ = generation_;
   }
 
-  bool Variable::toBool() const
+  void invalidateVariables()
   {
-    return toInt() > 0;
+    // Jim has no variable traces, so any evaluation is treated as a possible write
+    Variable::generation_++;
+    if (Variable::generation_ == 0)
+      Variable::generation_ = 1;
   }
 
-  int Variable::toInt() const
+  uint32_t scriptGeneration()
   {
-    long val;
-    if (Jim_GetLong(interpreter_, value(), &val) != JIM_OK)
-      return 0;
-
-    return val;
+    return Variable::generation_;
   }
 
   // -- BuiltInProc --
@@ -162,9 +251,331 @@ namespace tcl {
   }
 
 
+  // -- Script profiler --
+
+  // Between profile start and stop every call of a zum command or a proc is timed. Time
+  // is kept in HP counter ticks. Inclusive time counts a recursive call once, exclusive
+  // time leaves out the commands called from it, zum time is what was spent in zum
+  // commands, the call itself included if it is one.
+  struct ProfileEntry
+  {
+    std::string name_;
+    uint64_t calls_ = 0;
+    int64_t inclusive_ = 0;
+    int64_t exclusive_ = 0;
+    int64_t zum_ = 0;
+    int active_ = 0;
+  };
+
+  struct ProfileFrame
+  {
+    std::size_t entry_;
+    std::string stack_;       // the names of the calls up to this one, joined by ;
+    bool zum_;                // outermost zum command on the stack
+    int64_t zumStart_;
+    int64_t children_;
+    int64_t start_;
+  };
+
+  static bool profiling_ = false;
+  static uint32_t profileRun_ = 0;
+  static std::vector<ProfileEntry> profileEntries_;
+  static std::unordered_map<std::string, std::size_t> profileIndex_;
+  static std::vector<ProfileFrame> profileStack_;
+
+  // Exclusive time of every call stack, what a flame graph is drawn from
+  static std::unordered_map<std::string, int64_t> profileStacks_;
+
+  // Spent in outermost zum commands so far
+  static int64_t profileZumTicks_ = 0;
+  static int profileZumDepth_ = 0;
+
+  class ProfileScope
+  {
+    public:
+      ProfileScope(std::string const& name, bool zum)
+        : run_(profiling_ ? profileRun_ : 0)
+      {
+        if (run_ == 0)
+          return;
+
+        auto it = profileIndex_.find(name);
+        if (it == profileIndex_.end())
+        {
+          it = profileIndex_.emplace(name, profileEntries_.size()).first;
+          profileEntries_.emplace_back();
+          profileEntries_.back().name_ = name;
+        }
+
+        ProfileEntry & entry = profileEntries_[it->second];
+        entry.calls_++;
+        entry.active_++;
+
+        ProfileFrame frame;
+        frame.entry_ = it->second;
+        frame.stack_ = profileStack_.empty() ? name : profileStack_.back().stack_ + ";" + name;
+        frame.zum_ = zum && profileZumDepth_ == 0;
+        frame.zumStart_ = profileZumTicks_;
+        frame.children_ = 0;
+
+        if (zum)
+          profileZumDepth_++;
+
+        profileStack_.push_back(std::move(frame));
+        zum_ = zum;
+        profileStack_.back().start_ = bx::getHPCounter();
+      }
+
+      ~ProfileScope()
+      {
+        // A profile started again meanwhile dropped the frame
+        if (run_ != profileRun_ || profileStack_.empty())
+          return;
+
+        const int64_t elapsed = bx::getHPCounter() - profileStack_.back().start_;
+        ProfileFrame frame = std::move(profileStack_.back());
+        profileStack_.pop_back();
+
+        if (zum_)
+          profileZumDepth_--;
+
+        if (frame.zum_)
+          profileZumTicks_ += elapsed;
+
+        ProfileEntry & entry = profileEntries_[frame.entry_];
+        const int64_t exclusive = elapsed - frame.children_;
+        entry.exclusive_ += exclusive;
+        profileStacks_[frame.stack_] += exclusive;
+
+        if (--entry.active_ == 0)
+        {
+          entry.inclusive_ += elapsed;
+          entry.zum_ += profileZumTicks_ - frame.zumStart_;
+        }
+
+        if (!profileStack_.empty())
+          profileStack_.back().children_ += elapsed;
+      }
+
+    private:
+      uint32_t run_;
+      bool zum_ = false;
+  };
+
+  // Procs are profiled through a command of the same name that calls the renamed proc.
+  // proc is wrapped the same way, so procs defined while profiling are profiled too.
+  static const std::string PROFILED_PREFIX = "zum_profiled_";
+
+  struct ProfiledProc
+  {
+    std::string name_;
+    std::string hidden_;
+  };
+
+  static std::vector<std::string> profiledProcs_;
+
+  static int profiledProcCmd(Jim_Interp * interp, int argc, Jim_Obj * const * argv)
+  {
+    ProfiledProc const* proc = static_cast<ProfiledProc *>(Jim_CmdPrivData(interp));
+    ProfileScope scope(proc->name_, false);
+
+    std::vector<Jim_Obj *> args(argv, argv + argc);
+    args[0] = Jim_NewStringObj(interp, proc->hidden_.c_str(), proc->hidden_.size());
+    Jim_IncrRefCount(args[0]);
+
+    // The proc may define itself again, proc isn't used after this
+    const int retcode = Jim_EvalObjVector(interp, argc, args.data());
+    Jim_DecrRefCount(interp, args[0]);
+
+    return retcode;
+  }
+
+  static void deleteProfiledProc(Jim_Interp *, void * privData)
+  {
+    delete static_cast<ProfiledProc *>(privData);
+  }
+
+  static Jim_Cmd * findCommand(std::string const& name)
+  {
+    Jim_Obj * nameObj = Jim_NewStringObj(interpreter_, name.c_str(), name.size());
+    Jim_IncrRefCount(nameObj);
+    Jim_Cmd * cmd = Jim_GetCommand(interpreter_, nameObj, 0);
+    Jim_DecrRefCount(interpreter_, nameObj);
+
+    return cmd;
+  }
+
+  static void deleteCommand(std::string const& name)
+  {
+    if (findCommand(name))
+      Jim_DeleteCommand(interpreter_, name.c_str());
+  }
+
+  static bool isProfiledProc(std::string const& name)
+  {
+    Jim_Cmd * cmd = findCommand(name);
+    return cmd && !cmd->isproc && cmd->u.native.cmdProc == profiledProcCmd;
+  }
+
+  static void profileProc(std::string const& name)
+  {
+    const std::string hidden = PROFILED_PREFIX + name;
+
+    deleteCommand(hidden);
+    if (Jim_RenameCommand(interpreter_, name.c_str(), hidden.c_str()) != JIM_OK)
+      return;
+
+    Jim_CreateCommand(interpreter_, name.c_str(), profiledProcCmd, new ProfiledProc{ name, hidden }, deleteProfiledProc);
+    profiledProcs_.push_back(name);
+  }
+
+  static int profiledProcDefinitionCmd(Jim_Interp * interp, int argc, Jim_Obj * const * argv)
+  {
+    std::vector<Jim_Obj *> args(argv, argv + argc);
+    args[0] = Jim_NewStringObj(interp, (PROFILED_PREFIX + "proc").c_str(), -1);
+    Jim_IncrRefCount(args[0]);
+
+    const int retcode = Jim_EvalObjVector(interp, argc, args.data());
+    Jim_DecrRefCount(interp, args[0]);
+
+    if (retcode == JIM_OK && argc > 1)
+    {
+      Jim_Obj * result = Jim_GetResult(interp);
+      Jim_IncrRefCount(result);
+
+      // A proc defined again replaced the command profiling it, the old proc goes too
+      const std::string name = Jim_String(argv[1]);
+      deleteCommand(PROFILED_PREFIX + name);
+      profileProc(name);
+
+      Jim_SetResult(interp, result);
+      Jim_DecrRefCount(interp, result);
+    }
+
+    return retcode;
+  }
+
+  static void startProfile()
+  {
+    profileEntries_.clear();
+    profileIndex_.clear();
+    profileStack_.clear();
+    profileStacks_.clear();
+    profileZumTicks_ = 0;
+    profileZumDepth_ = 0;
+
+    if (++profileRun_ == 0)
+      profileRun_ = 1;
+
+    profiling_ = true;
+
+    if (Jim_EvalGlobal(interpreter_, "info procs") == JIM_OK)
+    {
+      Jim_Obj * procs = Jim_GetResult(interpreter_);
+      Jim_IncrRefCount(procs);
+
+      for (int i = 0; i < Jim_ListLength(interpreter_, procs); ++i)
+        profileProc(Jim_String(Jim_ListGetIndex(interpreter_, procs, i)));
+
+      Jim_DecrRefCount(interpreter_, procs);
+    }
+
+    Jim_RenameCommand(interpreter_, "proc", (PROFILED_PREFIX + "proc").c_str());
+    Jim_CreateCommand(interpreter_, "proc", profiledProcDefinitionCmd, nullptr, nullptr);
+  }
+
+  static void stopProfile()
+  {
+    profiling_ = false;
+
+    Jim_DeleteCommand(interpreter_, "proc");
+    Jim_RenameCommand(interpreter_, (PROFILED_PREFIX + "proc").c_str(), "proc");
+
+    // A proc renamed meanwhile keeps calling through its profiling command
+    for (auto const& name : profiledProcs_)
+    {
+      if (!isProfiledProc(name))
+        continue;
+
+      Jim_DeleteCommand(interpreter_, name.c_str());
+      Jim_RenameCommand(interpreter_, (PROFILED_PREFIX + name).c_str(), name.c_str());
+    }
+
+    profiledProcs_.clear();
+    Jim_SetEmptyResult(interpreter_);
+  }
+
+  static double ticksToMilliseconds(int64_t ticks)
+  {
+    return double(ticks) * 1000.0 / double(bx::getHPFrequency());
+  }
+
+  // The entries by exclusive time, as lines of name, calls and milliseconds
+  static std::string profileReport()
+  {
+    std::vector<ProfileEntry const*> entries;
+    for (auto const& entry : profileEntries_)
+      entries.push_back(&entry);
+
+    std::sort(entries.begin(), entries.end(), [] (ProfileEntry const* a, ProfileEntry const* b) {
+      return a->exclusive_ > b->exclusive_;
+    });
+
+    std::size_t width = 7;
+    for (auto const* entry : entries)
+      width = std::max(width, entry->name_.size());
+
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "%-*s %10s %12s %12s %12s\n", (int)width, "command", "calls", "inclusive", "exclusive", "zum");
+    std::string report = buffer;
+
+    for (auto const* entry : entries)
+    {
+      snprintf(buffer, sizeof(buffer), " %10llu %10.3fms %10.3fms %10.3fms\n", (unsigned long long)entry->calls_,
+               ticksToMilliseconds(entry->inclusive_), ticksToMilliseconds(entry->exclusive_), ticksToMilliseconds(entry->zum_));
+      report += entry->name_ + std::string(width - entry->name_.size(), ' ') + buffer;
+    }
+
+    return report;
+  }
+
+  // Folded stacks, a line of names joined by ; and microseconds per call stack, the input
+  // of flamegraph.pl
+  static bool writeProfileStacks(std::string const& filename)
+  {
+    FileWriter file;
+    if (!file.open(filename))
+    {
+      logError("Could not write the profile to ", filename);
+      return false;
+    }
+
+    char buffer[32];
+    for (auto const& it : profileStacks_)
+    {
+      const int length = snprintf(buffer, sizeof(buffer), " %lld\n", (long long)(ticksToMilliseconds(it.second) * 1000.0));
+      file.write(it.first);
+      file.write(buffer, length);
+    }
+
+    if (!file.close())
+    {
+      logError("Could not write the profile to ", filename);
+      return false;
+    }
+
+    return true;
+  }
+
   static int cmdProc(Jim_Interp * interp, int argc, Jim_Obj * const * argv)
   {
     BuiltInProc * cmd = static_cast<BuiltInProc *>(Jim_CmdPrivData(interp));
+    JobLock lock;
+    const profile::ScopedCommand command(cmd->name());
+    ProfileScope scope(profiling_ ? cmd->name() : std::string(), true);
+
+    // The script may have set variables before calling back into us
+    invalidateVariables();
     return cmd->call(interp, argc, argv);
   }
 
@@ -176,7 +587,7 @@ namespace tcl {
 
     for (int i = 0; i < subCommands.size() / 3; ++i)
     {
-      logInfo(subCommands[i * 3]);
+      logDebug(subCommands[i * 3]);
       Jim_AppendStrings(interp, Jim_GetResult(interp), s, subCommands[i * 3], NULL);
       s = sep;
     }
@@ -277,6 +688,11 @@ namespace tcl {
   static int subCmdProc(Jim_Interp * interp, int argc, Jim_Obj * const * argv)
   {
     BuiltInSubProc * subCmd = static_cast<BuiltInSubProc *>(Jim_CmdPrivData(interp));
+    JobLock lock;
+    const profile::ScopedCommand command(subCmd->name());
+    ProfileScope scope(profiling_ ? subCmd->name() + (argc > 1 ? std::string(" ") + Jim_String(argv[1]) : std::string()) : std::string(), true);
+
+    invalidateVariables();
     return subCmd->call(interp, argc, argv);
   }
 
@@ -297,6 +713,119 @@ namespace tcl {
 
   static std::vector<ExposedProc> exposedProcs_;
 
+  // Names completion looks at, sorted so the matches of a prefix are next to each other.
+  // Built on first use, expose adds to it.
+  static std::vector<std::string> completionNames_;
+
+  static void addCompletionName(std::string const& name)
+  {
+    auto it = std::lower_bound(completionNames_.begin(), completionNames_.end(), name);
+    if (it == completionNames_.end() || *it != name)
+      completionNames_.insert(it, name);
+  }
+
+  static std::vector<std::string> & completionNames()
+  {
+    if (completionNames_.empty())
+    {
+      for (auto * cmd : builtInProcs())
+        completionNames_.push_back(cmd->name());
+
+      for (auto * cmd : builtInSubCmdProcs())
+        completionNames_.push_back(cmd->name());
+
+      for (auto const& it : exposedProcs_)
+        completionNames_.push_back(it.name());
+
+      for (auto * var : builtInVariables())
+        completionNames_.push_back(var->name());
+
+      std::sort(completionNames_.begin(), completionNames_.end());
+      completionNames_.erase(std::unique(completionNames_.begin(), completionNames_.end()), completionNames_.end());
+    }
+
+    return completionNames_;
+  }
+
+  // -- Lazy extensions --
+
+  // Extensions few scripts use are registered by their first call, the command standing
+  // in for them initializes the extension, which replaces it, and calls it again
+  typedef int ExtensionInit(Jim_Interp * interp);
+
+  static int lazyExtensionCmd(Jim_Interp * interp, int argc, Jim_Obj * const * argv)
+  {
+    ExtensionInit * init = reinterpret_cast<ExtensionInit *>(Jim_CmdPrivData(interp));
+    if (init(interp) != JIM_OK)
+      return JIM_ERR;
+
+    return Jim_EvalObjVector(interp, argc, argv);
+  }
+
+  static void registerLazyExtension(Jim_Interp * interp, std::vector<const char *> const& commands, ExtensionInit * init)
+  {
+    for (auto * name : commands)
+      Jim_CreateCommand(interp, name, lazyExtensionCmd, reinterpret_cast<void *>(init), nullptr);
+  }
+
+  // -- Workers --
+
+  // Idle worker interpreters, and the script defining the procs of the interpreter as
+  // syncWorkers() last found them. A worker evaluates it again when it was made for an
+  // earlier version.
+  struct Worker
+  {
+    Jim_Interp * interp_ = nullptr;
+    uint32_t procsVersion_ = 0;
+  };
+
+  static std::mutex workerMutex_;
+  static std::vector<Worker> idleWorkers_;
+  static std::string workerProcs_;
+  static uint32_t workerProcsVersion_ = 0;
+
+  // Set on the thread that initialized the interpreter, and on a worker once the call it
+  // makes used a command that is only available there
+  static thread_local bool mainThread_ = false;
+  static thread_local bool needsMain_ = false;
+
+  // Stands in for the commands of zum on a worker
+  static int mainThreadCmd(Jim_Interp * interp, int argc, Jim_Obj * const * argv)
+  {
+    needsMain_ = true;
+    Jim_SetResultFormatted(interp, "%#s is only available on the main thread", argv[0]);
+    return JIM_ERR;
+  }
+
+  static Worker makeWorker()
+  {
+    Worker worker;
+    worker.interp_ = Jim_CreateInterp();
+    Jim_RegisterCoreCommands(worker.interp_);
+
+    registerLazyExtension(worker.interp_, { "clock" }, ::Jim_clockInit);
+    registerLazyExtension(worker.interp_, { "regexp", "regsub" }, ::Jim_regexpInit);
+
+    for (auto * cmd : builtInProcs())
+      Jim_CreateCommand(worker.interp_, cmd->name(), mainThreadCmd, nullptr, nullptr);
+
+    for (auto * cmd : builtInSubCmdProcs())
+      Jim_CreateCommand(worker.interp_, cmd->name(), mainThreadCmd, nullptr, nullptr);
+
+    return worker;
+  }
+
+  static void freeWorkers()
+  {
+    std::lock_guard<std::mutex> lock(workerMutex_);
+    for (auto & worker : idleWorkers_)
+      Jim_FreeInterp(worker.interp_);
+
+    idleWorkers_.clear();
+    workerProcs_.clear();
+    workerProcsVersion_++;
+  }
+
   // -- Interface --
 
   static const std::string CONFIG_FILE = "zum.conf";
@@ -304,11 +833,14 @@ namespace tcl {
   void initialize()
   {
     interpreter_ = Jim_CreateInterp();
+    ++interpreterGeneration_;
+    mainThread_ = true;
     Jim_RegisterCoreCommands(interpreter_);
+    profile::markStartup("interpreter");
 
     // Register extensions
-    ::Jim_clockInit(interpreter_);
-    ::Jim_regexpInit(interpreter_);
+    registerLazyExtension(interpreter_, { "clock" }, ::Jim_clockInit);
+    registerLazyExtension(interpreter_, { "regexp", "regsub" }, ::Jim_regexpInit);
 
     // Register built in commands
     for (auto * cmd : builtInProcs())
@@ -321,6 +853,8 @@ namespace tcl {
     for (auto * var : builtInVariables())
       Jim_SetGlobalVariableStr(interpreter_, var->name(), var->defaultValue());
 
+    profile::markStartup("commands");
+
 #if DEBUG
     // Use the file from the source directory
     Jim_EvalFileGlobal(interpreter_, "../src/ScriptingLib.tcl");
@@ -328,6 +862,8 @@ namespace tcl {
     Jim_EvalSource(interpreter_, __FILE__, __LINE__, std::string((char *)&ScriptingLib[0], BX_COUNTOF(ScriptingLib)).c_str());
 #endif
 
+    profile::markStartup("scripting lib");
+
 
     std::string configFile = "";
 #if BX_PLATFORM_LINUX || BX_PLATFORM_OSX
@@ -344,60 +880,361 @@ namespace tcl {
 
     logInfo("Loading config file: ", configFile);
     Jim_EvalFileGlobal(interpreter_, configFile.c_str());
+    profile::markStartup("config");
+
+    invalidateVariables();
   }
 
   void shutdown()
   {
+    freeWorkers();
+
     Jim_FreeInterp(interpreter_);
     interpreter_ = nullptr;
+    invalidateVariables();
   }
 
   bool evaluate(std::string const& code)
   {
+    PROFILE_SCOPE(TCL);
+
     const bool ok = Jim_EvalGlobal(interpreter_, code.c_str()) == JIM_OK;
+    invalidateVariables();
+
     if (!ok)
       logError(result());
 
     return ok;
   }
 
-  std::string result()
+  // Makes the calls on interp, leaving the error in its result
+  static bool callBatched(Jim_Interp * interp, std::string const& command, std::vector<double> const& args, int argCount, std::vector<double> & results)
   {
-    return std::string(Jim_String(Jim_GetResult(interpreter_)));
+    const std::size_t calls = argCount > 0 ? args.size() / argCount : 0;
+
+    Jim_Obj * list = Jim_NewListObj(interp, nullptr, 0);
+    for (std::size_t i = 0; i < calls; ++i)
+    {
+      Jim_Obj * call = Jim_NewListObj(interp, nullptr, 0);
+      for (int arg = 0; arg < argCount; ++arg)
+        Jim_ListAppendElement(interp, call, Jim_NewDoubleObj(interp, args[i * argCount + arg]));
+
+      Jim_ListAppendElement(interp, list, call);
+    }
+
+    Jim_Obj * prefix = Jim_NewStringObj(interp, command.c_str(), command.size());
+    Jim_IncrRefCount(prefix);
+    Jim_IncrRefCount(list);
+
+    Jim_CallFrame * savedFrame = interp->framePtr;
+    interp->framePtr = interp->topFramePtr;
+    const bool ok = Jim_EvalObjPrefix(interp, prefix, 1, &list) == JIM_OK;
+    interp->framePtr = savedFrame;
+
+    Jim_DecrRefCount(interp, list);
+    Jim_DecrRefCount(interp, prefix);
+
+    if (!ok)
+      return false;
+
+    Jim_Obj * values = Jim_GetResult(interp);
+    if ((std::size_t)Jim_ListLength(interp, values) != calls)
+    {
+      Jim_SetResultFormatted(interp, "%s returned %d results for %d calls", command.c_str(), Jim_ListLength(interp, values), (int)calls);
+      return false;
+    }
+
+    results.resize(calls);
+    for (std::size_t i = 0; i < calls; ++i)
+      if (Jim_GetDouble(interp, Jim_ListGetIndex(interp, values, i), &results[i]) != JIM_OK)
+        results[i] = NAN;
+
+    return true;
   }
 
-  std::vector<std::string> findMatches(std::string const& name)
+  bool callBatched(std::string const& command, std::vector<double> const& args, int argCount, std::vector<double> & results)
   {
-    std::vector<std::string> result;
+    PROFILE_SCOPE(TCL);
 
-    // Search for matching procs
-    for (auto * cmd : builtInProcs())
+    const bool ok = callBatched(interpreter_, command, args, argCount, results);
+    invalidateVariables();
+
+    if (!ok)
+      logError(result());
+
+    return ok;
+  }
+
+  void syncWorkers()
+  {
+    // The procs a profile wraps are defined under their own names
+    std::string procs;
+    if (Jim_EvalGlobal(interpreter_, "info procs") == JIM_OK)
     {
-      const std::string cmdName(cmd->name());
-      if (cmdName.find(name) == 0)
-        result.push_back(cmdName);
+      Jim_Obj * names = Jim_GetResult(interpreter_);
+      Jim_IncrRefCount(names);
+
+      for (int i = 0; i < Jim_ListLength(interpreter_, names); ++i)
+      {
+        std::string name = Jim_String(Jim_ListGetIndex(interpreter_, names, i));
+        Jim_Cmd * cmd = findCommand(name);
+        if (!cmd || !cmd->isproc)
+          continue;
+
+        if (name.compare(0, PROFILED_PREFIX.size(), PROFILED_PREFIX) == 0)
+          name.erase(0, PROFILED_PREFIX.size());
+
+        Jim_Obj * definition = Jim_NewListObj(interpreter_, nullptr, 0);
+        Jim_ListAppendElement(interpreter_, definition, Jim_NewStringObj(interpreter_, "proc", -1));
+        Jim_ListAppendElement(interpreter_, definition, Jim_NewStringObj(interpreter_, name.c_str(), name.size()));
+        Jim_ListAppendElement(interpreter_, definition, cmd->u.proc.argListObjPtr);
+        Jim_ListAppendElement(interpreter_, definition, cmd->u.proc.bodyObjPtr);
+
+        procs.append(Jim_String(definition)).append(1, '\n');
+        Jim_FreeNewObj(interpreter_, definition);
+      }
+
+      Jim_DecrRefCount(interpreter_, names);
     }
 
-    // Search for matching global variables
-    for (auto * cmd : builtInSubCmdProcs())
+    Jim_SetEmptyResult(interpreter_);
+
+    std::lock_guard<std::mutex> lock(workerMutex_);
+    if (procs != workerProcs_)
     {
-      const std::string cmdName(cmd->name());
-      if (cmdName.find(name) == 0)
-        result.push_back(cmdName);
+      workerProcs_.swap(procs);
+      workerProcsVersion_++;
     }
+  }
 
-    for (auto const& it : exposedProcs_)
+  bool callBatchedOnWorker(std::string const& command, std::vector<double> const& args, int argCount, std::vector<double> & results, bool & needsMain)
+  {
+    // The thread using the interpreter makes its calls there
+    needsMain = mainThread_ || jobThread_;
+    if (needsMain)
+      return false;
+
+    Worker worker;
+    std::string procs;
     {
-      if (it.name().find(name) == 0)
-        result.push_back(it.name());
+      std::lock_guard<std::mutex> lock(workerMutex_);
+      if (!idleWorkers_.empty())
+      {
+        worker = idleWorkers_.back();
+        idleWorkers_.pop_back();
+      }
+
+      if (worker.procsVersion_ != workerProcsVersion_)
+      {
+        procs = workerProcs_;
+        worker.procsVersion_ = workerProcsVersion_;
+      }
     }
 
-    // Search for matching global variables
-    for (auto * var : builtInVariables())
+    if (!worker.interp_)
     {
-      const std::string varName(var->name());
-      if (varName.find(name) == 0)
-        result.push_back(varName);
+      const uint32_t version = worker.procsVersion_;
+      worker = makeWorker();
+      worker.procsVersion_ = version;
+    }
+
+    if (!procs.empty())
+      Jim_EvalGlobal(worker.interp_, procs.c_str());
+
+    needsMain_ = false;
+    const bool ok = callBatched(worker.interp_, command, args, argCount, results);
+    needsMain = needsMain_;
+
+    if (!ok && !needsMain)
+      logError(Jim_String(Jim_GetResult(worker.interp_)));
+
+    std::lock_guard<std::mutex> lock(workerMutex_);
+    idleWorkers_.push_back(worker);
+    return ok;
+  }
+
+  static int32_t jobMain(void * userData)
+  {
+    Job * job = static_cast<Job *>(userData);
+    jobThread_ = true;
+
+    // Jim looks for signals after every command once the level is above zero, that is
+    // how cancelJob() gets through
+    interpreter_->signal_level++;
+    job->retcode_ = Jim_EvalGlobal(interpreter_, job->code_.c_str());
+    interpreter_->signal_level--;
+
+    if (job->retcode_ != JIM_OK && job->retcode_ != JIM_SIGNAL)
+      job->retcode_ = JIM_ERR;
+
+    job->ended_.store(true, std::memory_order_release);
+    return 0;
+  }
+
+  void startJob(std::string const& code)
+  {
+    assert(!job_);
+
+    documentMutex_.lock();
+    documentLocked_ = true;
+
+    job_.reset(new Job());
+    job_->code_ = code;
+
+    jobActive_.store(true, std::memory_order_release);
+    job_->thread_.init(jobMain, job_.get());
+  }
+
+  bool jobRunning()
+  {
+    return job_ != nullptr;
+  }
+
+  bool jobEnded()
+  {
+    return job_ && job_->ended_.load(std::memory_order_acquire);
+  }
+
+  void cancelJob()
+  {
+    // What a signal handler would do, the job sees it once its command returns
+    if (job_)
+      interpreter_->sigmask |= (jim_wide)1 << SIGINT;
+  }
+
+  int finishJob()
+  {
+    assert(job_ && documentLocked_);
+
+    job_->thread_.shutdown();
+    const int retcode = job_->retcode_;
+    job_.reset();
+
+    // Also drops a cancel that came after the code returned
+    interpreter_->sigmask = 0;
+
+    jobActive_.store(false, std::memory_order_release);
+    documentLocked_ = false;
+    documentMutex_.unlock();
+
+    invalidateVariables();
+
+    if (retcode == JIM_ERR)
+      logError(result());
+
+    return retcode;
+  }
+
+  bool lockDocument(int timeout)
+  {
+    if (!job_ || documentLocked_)
+      return true;
+
+    documentWanted_.store(true, std::memory_order_release);
+    documentLocked_ = documentMutex_.try_lock_for(std::chrono::milliseconds(timeout));
+    documentWanted_.store(false, std::memory_order_release);
+
+    return documentLocked_;
+  }
+
+  void unlockDocument()
+  {
+    if (!job_ || !documentLocked_)
+      return;
+
+    documentLocked_ = false;
+    documentMutex_.unlock();
+  }
+
+  Script::~Script()
+  {
+    if (script_ && interpreter_ && generation_ == interpreterGeneration_)
+      Jim_DecrRefCount(interpreter_, script_);
+  }
+
+  bool Script::evaluate()
+  {
+    PROFILE_SCOPE(TCL);
+
+    if (!script_ || generation_ != interpreterGeneration_)
+    {
+      script_ = Jim_NewStringObj(interpreter_, code_.c_str(), code_.size());
+      Jim_IncrRefCount(script_);
+      generation_ = interpreterGeneration_;
+    }
+
+    // Evaluated at the global level, like evaluate() does
+    Jim_CallFrame * savedFrame = interpreter_->framePtr;
+    interpreter_->framePtr = interpreter_->topFramePtr;
+    const bool ok = Jim_EvalObj(interpreter_, script_) == JIM_OK;
+    interpreter_->framePtr = savedFrame;
+
+    invalidateVariables();
+
+    if (!ok)
+      logError(result());
+
+    return ok;
+  }
+
+  std::string result()
+  {
+    return std::string(Jim_String(Jim_GetResult(interpreter_)));
+  }
+
+  Jim_Obj * newStringObjUtf8(Jim_Interp * interp, std::string const& text)
+  {
+    if (utf8::validate(text))
+      return Jim_NewStringObj(interp, text.data(), text.size());
+
+    return Jim_NewStringObjUtf8(interp, text.c_str(), utf8_strlen(text.c_str(), text.size()));
+  }
+
+  static std::size_t objectBytes(Jim_Obj const* obj)
+  {
+    std::size_t bytes = 0;
+
+    for (; obj; obj = obj->nextObjPtr)
+      bytes += sizeof(Jim_Obj) + (obj->bytes && obj->length > 0 ? obj->length + 1 : 0);
+
+    return bytes;
+  }
+
+  std::size_t memoryUsage()
+  {
+    if (!interpreter_)
+      return 0;
+
+    Jim_HashTable const& commands = interpreter_->commands;
+
+    return sizeof(Jim_Interp) + objectBytes(interpreter_->liveList) + objectBytes(interpreter_->freeList) +
+           commands.size * sizeof(Jim_HashEntry *) + commands.used * (sizeof(Jim_HashEntry) + sizeof(Jim_Cmd));
+  }
+
+  std::vector<std::string> findMatches(std::string const& name, std::string * commonPrefix)
+  {
+    std::vector<std::string> const& names = completionNames();
+    std::vector<std::string> result;
+
+    for (auto it = std::lower_bound(names.begin(), names.end(), name); it != names.end() && it->compare(0, name.size(), name) == 0; ++it)
+      result.push_back(*it);
+
+    // The names are sorted, what the first and the last share all of them share
+    if (commonPrefix)
+    {
+      commonPrefix->clear();
+
+      if (!result.empty())
+      {
+        std::string const& first = result.front();
+        std::string const& last = result.back();
+
+        std::size_t length = 0;
+        while (length < first.size() && length < last.size() && first[length] == last[length])
+          ++length;
+
+        commonPrefix->assign(first, 0, length);
+      }
     }
 
     return result;
@@ -411,17 +1248,89 @@ namespace tcl {
     for (uint32_t i = 1; i < argc; ++i)
       log += Jim_String(argv[i]) + std::string((i + 1) == argc ? "" : " ");
 
-    logInfo(log);
+    logOutput(log);
     flashMessage(log);
 
     return JIM_OK;
   }
 
+  TCL_FUNC(logLevel, "?level?", "Return and optionally set the lowest level written to the log: debug, info, warning or error")
+  {
+    static const char * LEVELS[] = { "debug", "info", "warning", "error" };
+
+    TCL_CHECK_ARGS(1, 2);
+
+    if (argc == 2)
+    {
+      TCL_STRING_ARG(1, level);
+
+      const auto it = std::find(std::begin(LEVELS), std::end(LEVELS), level);
+      if (it == std::end(LEVELS))
+      {
+        logError("unknown log level '", level, "'");
+        return JIM_ERR;
+      }
+
+      setLogLevel((LogLevel)(it - std::begin(LEVELS)));
+    }
+
+    TCL_STRING_RESULT(LEVELS[(int)logLevel()]);
+  }
+
+  TCL_SUBFUNC(profile, "start",  "",           "Starts timing every call of a zum command or a proc",
+                       "stop",   "",           "Stops timing, what was collected is kept for report",
+                       "report", "?filename?", "Returns calls and inclusive, exclusive and zum command milliseconds of every command by exclusive time, optionally writes folded stacks for a flame graph to filename")
+  {
+    enum { CMD_START, CMD_STOP, CMD_REPORT };
+
+    switch (subCommand)
+    {
+      case CMD_START:
+        TCL_CHECK_ARG_DESC(0, "");
+
+        if (profiling_)
+        {
+          logError("The profiler is already running");
+          return JIM_ERR;
+        }
+
+        startProfile();
+        Jim_SetEmptyResult(interp);
+        break;
+
+      case CMD_STOP:
+        TCL_CHECK_ARG_DESC(0, "");
+
+        if (profiling_)
+          stopProfile();
+        break;
+
+      case CMD_REPORT:
+        {
+          TCL_CHECK_ARGS_DESC(0, 1, "?filename?");
+
+          if (argc == 1)
+          {
+            TCL_STRING_ARG(0, filename);
+            if (!writeProfileStacks(filename))
+              return JIM_ERR;
+          }
+
+          TCL_STRING_RESULT(profileReport());
+        }
+    }
+
+    return JIM_OK;
+  }
+
   TCL_FUNC(expose, "string", "Expose a tcl function to command auto-completion")
   {
     TCL_CHECK_ARG(2);
     TCL_STRING_ARG(1, procName);
 
     exposedProcs_.push_back(ExposedProc(procName));
+
+    if (!completionNames_.empty())
+      addCompletionName(procName);
   }
 }
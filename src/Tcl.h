@@ -2,6 +2,7 @@
 #pragma once
 
 #include <vector>
+#include "Index.h"
 #include "Str.h"
 #include "jim.h"
 #include "utf8.h"
@@ -62,9 +63,11 @@ namespace tcl {
       Variable(const char * name, int defaultValue);
       Variable(const char * name, bool defaultValue);
 
-      bool toBool() const;
-      int toInt() const;
-      std::string toStr() const;
+      // Reads are served from a cache that is refreshed after any script ran,
+      // so they are plain loads on hot paths. Main thread only.
+      bool toBool() const { refresh(); return cachedInt_ > 0; }
+      int toInt() const { refresh(); return cachedInt_; }
+      std::string const& toStr() const { refresh(); return cachedStr_; }
 
       const char * name() const { return name_; }
 
@@ -72,8 +75,20 @@ namespace tcl {
       Jim_Obj * defaultValue() const;
 
     private:
+      void refresh() const { if (cacheGeneration_ != generation_) update(); }
+      void update() const;
+
+    private:
+      friend void invalidateVariables();
+      friend uint32_t scriptGeneration();
+      static uint32_t generation_;
+
       const char * name_ = nullptr;
 
+      mutable uint32_t cacheGeneration_ = 0;
+      mutable int cachedInt_ = 0;
+      mutable std::string cachedStr_;
+
       ValueType type_ = ValueType::STRING;
       union {
         const char * defaultStrValue_;
@@ -86,10 +101,97 @@ namespace tcl {
   void shutdown();
   void reset();
 
+  // Drops the cached value of every Variable, called whenever Tcl code was run
+  void invalidateVariables();
+
+  // Changes along with invalidateVariables(), so whatever the code run since did only has
+  // to be looked for when it changed
+  uint32_t scriptGeneration();
+
   bool evaluate(std::string const& code);
   std::string result();
 
-  std::vector<std::string> findMatches(std::string const& name);
+  // Evaluates command with one more word, a list with the arguments of every call in
+  // args, argCount numbers each. The command returns a list with the result of each
+  // call. Results that aren't numbers are NaN. Returns false, with the error logged, if
+  // the command fails or returns a list of another length.
+  bool callBatched(std::string const& command, std::vector<double> const& args, int argCount, std::vector<double> & results);
+
+  // Worker interpreters make batched calls on the threads of the scheduler. They have the
+  // commands of Jim, clock and regexp and the procs of the interpreter as syncWorkers()
+  // last found them, but not its global variables. The commands of zum read and change
+  // the documents and the interface, which only the main thread may do, so on a worker
+  // they fail the call with needsMain set. The thread using the interpreter, the main
+  // thread or that of a job, is refused the same way, it makes its calls there.
+  void syncWorkers();
+  bool callBatchedOnWorker(std::string const& command, std::vector<double> const& args, int argCount, std::vector<double> & results, bool & needsMain);
+
+  // A job evaluates code on a thread of its own, at the global level. Only one job runs
+  // at a time and nothing else may use the interpreter until it is finished. The main
+  // thread holds the document lock from startJob() on and has to release it now and
+  // then, the commands of the job only run while it does. Pure Tcl runs without it.
+  void startJob(std::string const& code);
+
+  // From startJob() until finishJob()
+  bool jobRunning();
+
+  // The code of the job returned, finishJob() can be called
+  bool jobEnded();
+
+  // Makes the job stop after the command it is running, finishJob() then returns JIM_SIGNAL
+  void cancelJob();
+
+  // Waits for the job to end and returns what its code returned. result() is what it
+  // left, the document lock has to be held.
+  int finishJob();
+
+  // The main thread's side of the document lock while a job runs. lockDocument() gives
+  // up after timeout ms and returns false, both do nothing if the lock is already held
+  // or released.
+  bool lockDocument(int timeout);
+  void unlockDocument();
+
+  // Code that is evaluated over and over, like the script of a key binding. It is kept
+  // as one Jim object, which holds on to the parsed script, so only the first
+  // evaluation parses it. Main thread only.
+  class Script
+  {
+    public:
+      explicit Script(std::string const& code) : code_(code) { }
+      ~Script();
+
+      Script(Script const&) = delete;
+      Script & operator = (Script const&) = delete;
+
+      std::string const& code() const { return code_; }
+      bool evaluate();
+
+    private:
+      std::string code_;
+      Jim_Obj * script_ = nullptr;
+      uint32_t generation_ = 0;    // of the interpreter script_ belongs to
+  };
+
+  // Bytes of the interpreter's objects, their strings and its command table. What lists
+  // and dicts allocate for their internal representation is not included.
+  std::size_t memoryUsage();
+
+  // Commands and variables whose names start with name, sorted. commonPrefix is set to the
+  // longest prefix all of them share.
+  std::vector<std::string> findMatches(std::string const& name, std::string * commonPrefix = nullptr);
+
+  // A string object of text. Jim counts the characters of well formed UTF-8 only when a
+  // script asks for them, malformed text is counted up front the way Jim reads it.
+  Jim_Obj * newStringObjUtf8(Jim_Interp * interp, std::string const& text);
+
+  // Cell indices are a Jim object type of their own, so an object passed to commands over
+  // and over is only parsed the first time. Any string converts the way Index::fromStr()
+  // reads it, and a new index only makes its string when a script asks for it.
+  Index getIndex(Jim_Interp * interp, Jim_Obj * obj);
+  Jim_Obj * newIndexObj(Jim_Interp * interp, Index const& idx);
+
+  // The column of an index object, or of a column name or number
+  int getColumn(Jim_Interp * interp, Jim_Obj * obj);
 
 }
 
@@ -136,10 +238,21 @@ namespace tcl {
       name = std::string(Jim_String(argv[i])); \
   } while (false)
 
+#define TCL_INDEX_ARG(i, name) \
+  Index name(0, 0); \
+  do { \
+    if (i < argc) \
+      name = tcl::getIndex(interp, argv[i]); \
+  } while (false)
+
 #define TCL_INT_RESULT(value) \
   Jim_SetResultInt(interp, value); \
   return JIM_OK
 
+#define TCL_INDEX_RESULT(value) \
+  Jim_SetResult(interp, tcl::newIndexObj(interp, value)); \
+  return JIM_OK
+
 #define TCL_DOUBLE_RESULT(value) \
   Jim_SetResult(interp, Jim_NewDoubleObj(interp, value)); \
   return JIM_OK
@@ -147,7 +260,7 @@ namespace tcl {
 #define TCL_STRING_UTF8_RESULT(value) \
   do { \
     const std::string result = (value); \
-    Jim_SetResult(interp, Jim_NewStringObjUtf8(interp, result.c_str(), utf8_strlen(result.c_str(), result.size()))); \
+    Jim_SetResult(interp, tcl::newStringObjUtf8(interp, result)); \
     return JIM_OK; \
   } while (false)
 
@@ -0,0 +1,79 @@
+#include "TextPattern.h"
+
+#include <cstring>
+#include <algorithm>
+
+bool TextPattern::compile(std::string const& pattern)
+{
+  try {
+    regex_ = std::regex(pattern);
+  } catch (std::regex_error const&) {
+    return false;
+  }
+
+  source_ = pattern;
+  literal_ = requiredPrefix(pattern);
+  known_.reset();
+  knownSize_ = 0;
+  return true;
+}
+
+// Only the plain characters at the start count, up to the first operator. A character
+// made optional by the quantifier after it isn't required, and with an alternative
+// anywhere nothing is.
+std::string TextPattern::requiredPrefix(std::string const& pattern)
+{
+  static const char * OPERATORS = "\\^$.|?*+()[]{}";
+
+  if (pattern.find('|') != std::string::npos)
+    return std::string();
+
+  std::size_t i = !pattern.empty() && pattern[0] == '^' ? 1 : 0;
+
+  std::string prefix;
+  for (; i < pattern.size() && !strchr(OPERATORS, pattern[i]); ++i)
+    prefix += pattern[i];
+
+  if (!prefix.empty() && i < pattern.size() && (pattern[i] == '?' || pattern[i] == '*' || pattern[i] == '{'))
+    prefix.pop_back();
+
+  return prefix;
+}
+
+bool TextPattern::matches(StrView text) const
+{
+  if (!literal_.empty() && text.find(StrView(literal_)) == StrView::npos)
+    return false;
+
+  return std::regex_search(text.begin(), text.end(), regex_);
+}
+
+bool TextPattern::matches(uint32_t id, StrView text) const
+{
+  if (id >= knownSize_)
+    return matches(text);
+
+  const uint8_t known = known_[id].load(std::memory_order_relaxed);
+  if (known != UNKNOWN)
+    return known == MATCH;
+
+  const bool found = matches(text);
+  known_[id].store(found ? MATCH : MISS, std::memory_order_relaxed);
+  return found;
+}
+
+void TextPattern::reserve(std::size_t count)
+{
+  if (count <= knownSize_)
+    return;
+
+  // Grows by half again at least, the pool grows a string at a time
+  count = std::max(count, knownSize_ + knownSize_ / 2);
+
+  std::unique_ptr<std::atomic<uint8_t>[]> known(new std::atomic<uint8_t>[count]);
+  for (std::size_t i = 0; i < count; ++i)
+    known[i].store(i < knownSize_ ? known_[i].load(std::memory_order_relaxed) : (uint8_t)UNKNOWN, std::memory_order_relaxed);
+
+  known_ = std::move(known);
+  knownSize_ = count;
+}
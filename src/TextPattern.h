@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Str.h"
+
+#include <regex>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+// A regular expression compiled once for a filter or a search. Texts that lack the
+// literal every match starts with are ruled out with a memchr scan before the
+// expression runs. The strings of a StringPool are matched by id, each distinct string
+// once however many cells show it, which matters most on columns with few values.
+//
+// Matching only reads the expression, so workers can share a pattern. The results by
+// id are kept in atomics and a string matched by two workers at once is just matched
+// twice.
+class TextPattern
+{
+  public:
+    // Returns false if pattern isn't a valid ECMAScript regular expression
+    bool compile(std::string const& pattern);
+
+    std::string const& source() const { return source_; }
+    std::regex const& regex() const { return regex_; }
+
+    bool matches(StrView text) const;
+
+    // Like matches(), for the string of id in a pool, text. Ids from reserve() on are
+    // matched every time.
+    bool matches(uint32_t id, StrView text) const;
+
+    // Makes room for the results of the ids below count, main thread only
+    void reserve(std::size_t count);
+
+    std::size_t memoryUsage() const { return sizeof(*this) + source_.size() + literal_.size() + knownSize_; }
+
+  private:
+    // The characters every match starts with, empty if there are none to go by
+    static std::string requiredPrefix(std::string const& pattern);
+
+  private:
+    enum : uint8_t { UNKNOWN, MISS, MATCH };
+
+    std::string source_;
+    std::string literal_;
+    std::regex regex_;
+
+    std::unique_ptr<std::atomic<uint8_t>[]> known_;
+    std::size_t knownSize_ = 0;
+};
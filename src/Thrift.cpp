@@ -0,0 +1,314 @@
+#include "Thrift.h"
+
+#include <cstring>
+
+namespace thrift {
+
+  // Nesting deeper than this is taken for a corrupt buffer, not read
+  static const int MAX_DEPTH = 64;
+
+  static int64_t unzigzag(uint64_t value)
+  {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+  }
+
+  static uint64_t zigzag(int64_t value)
+  {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+  }
+
+  uint64_t CompactReader::readVarint()
+  {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 70 && pos_ < end_; shift += 7)
+    {
+      const uint8_t byte = *pos_++;
+      value |= (uint64_t)(byte & 0x7f) << shift;
+
+      if ((byte & 0x80) == 0)
+        return value;
+    }
+
+    fail();
+    return 0;
+  }
+
+  void CompactReader::beginStruct()
+  {
+    if (++depth_ > MAX_DEPTH)
+      fail();
+
+    lastIds_.push_back(lastId_);
+    lastId_ = 0;
+  }
+
+  bool CompactReader::field(int & id, uint8_t & type)
+  {
+    const uint8_t header = pos_ < end_ ? *pos_++ : (fail(), uint8_t(STOP));
+    type = header & 0x0f;
+
+    if (type == STOP || failed_)
+    {
+      if (!lastIds_.empty())
+      {
+        lastId_ = lastIds_.back();
+        lastIds_.pop_back();
+      }
+
+      --depth_;
+      return false;
+    }
+
+    // A delta of 0 means the id follows in full
+    const int delta = header >> 4;
+    id = delta ? lastId_ + delta : (int)unzigzag(readVarint());
+    lastId_ = id;
+    return !failed_;
+  }
+
+  bool CompactReader::readBool(uint8_t type)
+  {
+    // Fields keep booleans in their type, list elements in a byte of their own
+    if (type == BOOL_TRUE || type == BOOL_FALSE)
+      return type == BOOL_TRUE;
+
+    if (pos_ >= end_)
+    {
+      fail();
+      return false;
+    }
+
+    return *pos_++ == BOOL_TRUE;
+  }
+
+  int64_t CompactReader::readInt(uint8_t type)
+  {
+    if (type != BYTE)
+      return unzigzag(readVarint());
+
+    if (pos_ >= end_)
+    {
+      fail();
+      return 0;
+    }
+
+    return (int8_t)*pos_++;
+  }
+
+  double CompactReader::readDouble()
+  {
+    double value = 0.0;
+    if (end_ - pos_ < 8)
+    {
+      fail();
+      return value;
+    }
+
+    memcpy(&value, pos_, sizeof(value));
+    pos_ += 8;
+    return value;
+  }
+
+  StrView CompactReader::readBinary()
+  {
+    const uint64_t size = readVarint();
+    if (size > (uint64_t)(end_ - pos_))
+    {
+      fail();
+      return StrView();
+    }
+
+    const StrView value((const char *)pos_, size);
+    pos_ += size;
+    return value;
+  }
+
+  uint32_t CompactReader::readList(uint8_t & elementType)
+  {
+    const uint8_t header = pos_ < end_ ? *pos_++ : (fail(), 0);
+    elementType = header & 0x0f;
+
+    // Sizes from 15 on follow the header
+    const uint64_t size = (header >> 4) == 15 ? readVarint() : (header >> 4);
+    if (size > (uint64_t)(end_ - pos_))
+    {
+      fail();
+      return 0;
+    }
+
+    return (uint32_t)size;
+  }
+
+  void CompactReader::skip(uint8_t type)
+  {
+    if (failed_)
+      return;
+
+    switch (type)
+    {
+      case BOOL_TRUE:
+      case BOOL_FALSE:
+        break;
+
+      case BYTE:
+        readInt(BYTE);
+        break;
+
+      case I16:
+      case I32:
+      case I64:
+        readVarint();
+        break;
+
+      case DOUBLE:
+        readDouble();
+        break;
+
+      case BINARY:
+        readBinary();
+        break;
+
+      case LIST:
+      case SET:
+      {
+        uint8_t elementType;
+        const uint32_t size = readList(elementType);
+
+        if (++depth_ > MAX_DEPTH)
+          fail();
+
+        for (uint32_t i = 0; i < size && !failed_; ++i)
+          if (elementType == BOOL_TRUE || elementType == BOOL_FALSE)
+            readBool(BYTE);
+          else
+            skip(elementType);
+
+        --depth_;
+        break;
+      }
+
+      case MAP:
+      {
+        const uint64_t size = readVarint();
+        if (size == 0)
+          break;
+
+        const uint8_t types = pos_ < end_ ? *pos_++ : (fail(), 0);
+
+        if (++depth_ > MAX_DEPTH)
+          fail();
+
+        for (uint64_t i = 0; i < size && !failed_; ++i)
+        {
+          skip(types >> 4);
+          skip(types & 0x0f);
+        }
+
+        --depth_;
+        break;
+      }
+
+      case STRUCT:
+      {
+        beginStruct();
+
+        int id;
+        uint8_t fieldType;
+        while (field(id, fieldType))
+          skip(fieldType);
+
+        break;
+      }
+
+      default:
+        fail();
+        break;
+    }
+  }
+
+  void CompactWriter::writeVarint(uint64_t value)
+  {
+    for (; value >= 0x80; value >>= 7)
+      data_.push_back((char)(value | 0x80));
+
+    data_.push_back((char)value);
+  }
+
+  void CompactWriter::writeHeader(int id, uint8_t type)
+  {
+    const int delta = id - lastId_;
+    if (delta > 0 && delta <= 15)
+      data_.push_back((char)((delta << 4) | type));
+    else
+    {
+      data_.push_back((char)type);
+      writeVarint(zigzag(id));
+    }
+
+    lastId_ = id;
+  }
+
+  void CompactWriter::beginStruct()
+  {
+    lastIds_.push_back(lastId_);
+    lastId_ = 0;
+  }
+
+  void CompactWriter::endStruct()
+  {
+    data_.push_back(STOP);
+
+    if (!lastIds_.empty())
+    {
+      lastId_ = lastIds_.back();
+      lastIds_.pop_back();
+    }
+  }
+
+  void CompactWriter::writeBool(int id, bool value)
+  {
+    writeHeader(id, value ? BOOL_TRUE : BOOL_FALSE);
+  }
+
+  void CompactWriter::writeInt(int id, uint8_t type, int64_t value)
+  {
+    writeHeader(id, type);
+    writeInt(value);
+  }
+
+  void CompactWriter::writeBinary(int id, StrView value)
+  {
+    writeHeader(id, BINARY);
+    writeBinary(value);
+  }
+
+  void CompactWriter::beginStruct(int id)
+  {
+    writeHeader(id, STRUCT);
+    beginStruct();
+  }
+
+  void CompactWriter::beginList(int id, uint8_t elementType, uint32_t size)
+  {
+    writeHeader(id, LIST);
+
+    if (size < 15)
+      data_.push_back((char)((size << 4) | elementType));
+    else
+    {
+      data_.push_back((char)(0xf0 | elementType));
+      writeVarint(size);
+    }
+  }
+
+  void CompactWriter::writeInt(int64_t value)
+  {
+    writeVarint(zigzag(value));
+  }
+
+  void CompactWriter::writeBinary(StrView value)
+  {
+    writeVarint(value.size());
+    data_.append(value.data(), value.size());
+  }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "Str.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The Thrift compact protocol, which Parquet writes its metadata in. A struct is a run of
+// fields ended by a stop byte, every field a header with its type and the difference of
+// its id to the one before, then its value. Integers are zigzag varints.
+namespace thrift {
+
+  enum Type : uint8_t
+  {
+    STOP = 0,
+    BOOL_TRUE = 1,
+    BOOL_FALSE = 2,
+    BYTE = 3,
+    I16 = 4,
+    I32 = 5,
+    I64 = 6,
+    DOUBLE = 7,
+    BINARY = 8,
+    LIST = 9,
+    SET = 10,
+    MAP = 11,
+    STRUCT = 12,
+  };
+
+  // Reads a buffer in the compact protocol. Reading past its end or a malformed value
+  // marks the reader failed, after which it only reads zeros and stops.
+  class CompactReader
+  {
+    public:
+      CompactReader(const uint8_t * data, std::size_t size) : data_(data), end_(data + size), pos_(data) { }
+
+      // Starts reading a struct, the field ids of the one around it come back at its end
+      void beginStruct();
+
+      // Reads the header of the next field of the struct, false at the end of it
+      bool field(int & id, uint8_t & type);
+
+      // The value of a field of type
+      bool readBool(uint8_t type);
+      int64_t readInt(uint8_t type);
+      double readDouble();
+      StrView readBinary();
+
+      // Starts a list or set, the elements follow
+      uint32_t readList(uint8_t & elementType);
+
+      // Skips a value of type
+      void skip(uint8_t type);
+
+      bool failed() const { return failed_; }
+      std::size_t position() const { return pos_ - data_; }
+
+    private:
+      uint64_t readVarint();
+      void fail() { failed_ = true; pos_ = end_; }
+
+    private:
+      const uint8_t * data_;
+      const uint8_t * end_;
+      const uint8_t * pos_;
+      std::vector<int> lastIds_;
+      int lastId_ = 0;
+      int depth_ = 0;
+      bool failed_ = false;
+  };
+
+  // Writes the compact protocol to a string
+  class CompactWriter
+  {
+    public:
+      void beginStruct();
+      void endStruct();
+
+      void writeBool(int id, bool value);
+      void writeInt(int id, uint8_t type, int64_t value);
+      void writeBinary(int id, StrView value);
+
+      // Starts a field holding a struct or list, for the elements to follow
+      void beginStruct(int id);
+      void beginList(int id, uint8_t elementType, uint32_t size);
+
+      // Elements of a list
+      void writeInt(int64_t value);
+      void writeBinary(StrView value);
+
+      std::string const& data() const { return data_; }
+
+    private:
+      void writeHeader(int id, uint8_t type);
+      void writeVarint(uint64_t value);
+
+    private:
+      std::string data_;
+      std::vector<int> lastIds_;
+      int lastId_ = 0;
+  };
+}
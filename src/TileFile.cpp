@@ -0,0 +1,245 @@
+
+#include "TileFile.h"
+#include "bx/platform.h"
+
+#include <algorithm>
+#include <functional>
+
+#if BX_PLATFORM_LINUX || BX_PLATFORM_OSX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+static const std::size_t PAGE_SIZE = 4096;
+
+TileFile::TileFile(std::size_t slotSize, std::size_t budget)
+  : slotSize_((slotSize + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE),
+    budgetSlots_(std::max<std::size_t>(budget / slotSize_, 16))
+{
+}
+
+TileFile::~TileFile()
+{
+#if BX_PLATFORM_LINUX || BX_PLATFORM_OSX
+  if (base_)
+    munmap(base_, MAX_SIZE);
+
+  if (fd_ >= 0)
+    ::close(fd_);
+#endif
+}
+
+bool TileFile::open(std::string const& directory)
+{
+#if BX_PLATFORM_LINUX || BX_PLATFORM_OSX
+  // /tmp is often held in memory, which would defeat the point
+  std::string name = (directory.empty() ? std::string("/var/tmp") : directory) + "/zum-tiles-XXXXXX";
+
+  fd_ = mkstemp(&name[0]);
+  if (fd_ < 0)
+    return false;
+
+  // Nothing else needs to find the file, it is gone once the descriptor is closed
+  unlink(name.c_str());
+
+  // Only address space is reserved, the chunks are mapped over it as the file grows
+  void * base = mmap(nullptr, MAX_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED)
+  {
+    ::close(fd_);
+    fd_ = -1;
+    return false;
+  }
+
+  base_ = static_cast<char *>(base);
+  maxChunks_ = MAX_SIZE / (slotSize_ * CHUNK_SLOTS);
+  uses_.reset(new std::unique_ptr<std::atomic<uint32_t>[]>[maxChunks_]);
+  return true;
+#else
+  (void)directory;
+  return false;
+#endif
+}
+
+void * TileFile::allocate()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (free_.empty())
+  {
+#if BX_PLATFORM_LINUX || BX_PLATFORM_OSX
+    const std::size_t chunk = chunkCount_.load(std::memory_order_relaxed);
+    if (fd_ < 0 || chunk == maxChunks_)
+      return nullptr;
+
+    const std::size_t chunkSize = CHUNK_SLOTS * slotSize_;
+    const off_t offset = chunk * chunkSize;
+
+    if (ftruncate(fd_, offset + chunkSize) != 0)
+      return nullptr;
+
+    if (mmap(base_ + offset, chunkSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd_, offset) == MAP_FAILED)
+      return nullptr;
+
+    uses_[chunk].reset(new std::atomic<uint32_t>[CHUNK_SLOTS]);
+    for (std::size_t i = 0; i < CHUNK_SLOTS; ++i)
+      uses_[chunk][i].store(0, std::memory_order_relaxed);
+
+    // free_ is empty, the slots in order are a heap already
+    for (std::size_t i = 0; i < CHUNK_SLOTS; ++i)
+      free_.push_back(chunk * CHUNK_SLOTS + i);
+
+    chunkCount_.store(chunk + 1, std::memory_order_release);
+#else
+    return nullptr;
+#endif
+  }
+
+  // Handed out from the front of the file first
+  std::pop_heap(free_.begin(), free_.end(), std::greater<std::size_t>());
+  const std::size_t i = free_.back();
+  free_.pop_back();
+
+  return base_ + i * slotSize_;
+}
+
+void TileFile::release(void * slot)
+{
+  const std::size_t i = indexOf(slot);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // What the slot held is of no use anymore, its blocks are freed instead of written back
+  pageOut(i, 1, true);
+  free_.push_back(i);
+  std::push_heap(free_.begin(), free_.end(), std::greater<std::size_t>());
+}
+
+std::size_t TileFile::firstFree() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return free_.empty() ? SIZE_MAX : free_.front();
+}
+
+std::size_t TileFile::freeSlots() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return free_.size();
+}
+
+std::size_t TileFile::shrink()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::size_t chunks = chunkCount_.load(std::memory_order_relaxed);
+  const std::size_t mapped = chunks;
+
+  // A chunk is free when all of its slots are, and only the last ones can go
+  std::vector<std::size_t> freePerChunk(chunks, 0);
+  for (const std::size_t i : free_)
+    freePerChunk[i / CHUNK_SLOTS]++;
+
+  while (chunks > 0 && freePerChunk[chunks - 1] == CHUNK_SLOTS)
+    chunks--;
+
+  if (chunks == mapped)
+    return 0;
+
+  const std::size_t chunkSize = CHUNK_SLOTS * slotSize_;
+
+#if BX_PLATFORM_LINUX || BX_PLATFORM_OSX
+  if (ftruncate(fd_, chunks * chunkSize) != 0)
+    return 0;
+
+  // The address space stays reserved for the file to grow into again
+  mmap(base_ + chunks * chunkSize, (mapped - chunks) * chunkSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+#endif
+
+  free_.erase(std::remove_if(free_.begin(), free_.end(), [chunks] (std::size_t i) { return i >= chunks * CHUNK_SLOTS; }), free_.end());
+  std::make_heap(free_.begin(), free_.end(), std::greater<std::size_t>());
+
+  for (std::size_t chunk = chunks; chunk < mapped; ++chunk)
+    uses_[chunk].reset();
+
+  chunkCount_.store(chunks, std::memory_order_release);
+  return (mapped - chunks) * chunkSize;
+}
+
+void TileFile::pageOut(std::size_t first, std::size_t count, bool discard)
+{
+  for (std::size_t i = first; i < first + count; ++i)
+    if (useOf(i).exchange(0, std::memory_order_relaxed) != 0)
+      resident_.fetch_sub(1, std::memory_order_relaxed);
+
+#if BX_PLATFORM_LINUX || BX_PLATFORM_OSX
+  char * begin = base_ + first * slotSize_;
+  const std::size_t size = count * slotSize_;
+
+#ifdef MADV_REMOVE
+  if (discard && madvise(begin, size, MADV_REMOVE) == 0)
+    return;
+#endif
+
+  // Dirty pages are only dropped once they are written back
+  if (!discard)
+    msync(begin, size, MS_SYNC);
+
+  madvise(begin, size, MADV_DONTNEED);
+
+#if BX_PLATFORM_LINUX
+  // The written back pages can leave the page cache too
+  if (!discard)
+    posix_fadvise(fd_, first * slotSize_, size, POSIX_FADV_DONTNEED);
+#endif
+#else
+  (void)discard;
+#endif
+}
+
+void TileFile::trim()
+{
+  std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+  if (!lock.owns_lock() || residentSlots() <= budgetSlots_)
+    return;
+
+  // Touches from now on count as more recent than any before
+  const uint32_t epoch = epoch_.fetch_add(1, std::memory_order_relaxed);
+
+  std::vector<std::pair<uint32_t, std::size_t>> used;
+  used.reserve(residentSlots());
+
+  const std::size_t slots = chunkCount_.load(std::memory_order_acquire) * CHUNK_SLOTS;
+  for (std::size_t i = 0; i < slots; ++i)
+  {
+    const uint32_t use = useOf(i).load(std::memory_order_relaxed);
+    if (use != 0)
+      used.emplace_back(use, i);
+  }
+
+  const std::size_t keep = budgetSlots_ - budgetSlots_ / 4;
+  if (used.size() <= keep)
+    return;
+
+  const std::size_t evict = used.size() - keep;
+  std::nth_element(used.begin(), used.begin() + evict, used.end());
+
+  // Slots are written back in file order, runs of neighbouring slots at once
+  std::vector<std::size_t> slotsOut;
+  slotsOut.reserve(evict);
+  for (std::size_t i = 0; i < evict; ++i)
+    if (used[i].first <= epoch)
+      slotsOut.push_back(used[i].second);
+
+  std::sort(slotsOut.begin(), slotsOut.end());
+
+  for (std::size_t first = 0; first < slotsOut.size(); )
+  {
+    std::size_t last = first + 1;
+    while (last < slotsOut.size() && slotsOut[last] == slotsOut[last - 1] + 1)
+      ++last;
+
+    pageOut(slotsOut[first], last - first, false);
+    first = last;
+  }
+}
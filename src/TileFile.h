@@ -0,0 +1,112 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+
+// Scratch file that fixed size slots are allocated from instead of the heap. The file
+// is mapped into one reserved address range, a chunk at a time as it grows, and it is
+// removed as soon as it is created so it goes away with the process. The operating
+// system pages the slots in and out. Once more slots than the budget have been used
+// since they were last paged out, the least recently used ones are written back and
+// dropped from memory until a quarter of the budget is free again.
+//
+// Every member can be used from any thread. Only mapped platforms support a tile file,
+// open() fails elsewhere.
+class TileFile
+{
+  public:
+    // Slots mapped at once as the file grows
+    static const std::size_t CHUNK_SLOTS = 256;
+
+    // Address space reserved for the file
+    static const std::size_t MAX_SIZE = (std::size_t)1 << 38;
+
+  public:
+    // slotSize is rounded up to whole pages, budget is in bytes
+    TileFile(std::size_t slotSize, std::size_t budget);
+    ~TileFile();
+
+    TileFile(TileFile const&) = delete;
+    TileFile & operator = (TileFile const&) = delete;
+
+    // Creates the scratch file in directory, /var/tmp if it is empty. Returns false if
+    // it can't be created.
+    bool open(std::string const& directory);
+
+    std::size_t slotSize() const { return slotSize_; }
+
+    // Returns a slot of slotSize() bytes, or nullptr when the file can't grow
+    void * allocate();
+    void release(void * slot);
+
+    // Whether slot was allocated from the file
+    bool holds(void const* slot) const
+    {
+      return base_ && static_cast<const char *>(slot) >= base_ && static_cast<const char *>(slot) < base_ + MAX_SIZE;
+    }
+
+    // Marks slot as used, pages out other slots when that goes over the budget. Memory
+    // not allocated from the file is ignored.
+    void touch(void const* slot)
+    {
+      if (!holds(slot))
+        return;
+
+      std::atomic<uint32_t> & use = useOf(indexOf(slot));
+
+      const uint32_t epoch = epoch_.load(std::memory_order_relaxed);
+      if (use.load(std::memory_order_relaxed) != epoch && use.exchange(epoch, std::memory_order_relaxed) == 0)
+        if (resident_.fetch_add(1, std::memory_order_relaxed) + 1 > budgetSlots_)
+          trim();
+    }
+
+    // Where slot is in the file, slots with a lower index come first in it
+    std::size_t indexOf(void const* slot) const
+    {
+      return holds(slot) ? (static_cast<const char *>(slot) - base_) / slotSize_ : SIZE_MAX;
+    }
+
+    // Slots used since they were last paged out, and bytes of the file
+    std::size_t residentSlots() const { return resident_.load(std::memory_order_relaxed); }
+    std::size_t fileSize() const { return chunkCount_.load(std::memory_order_relaxed) * CHUNK_SLOTS * slotSize_; }
+
+    // The index of the free slot allocate() hands out next, SIZE_MAX if the file has to
+    // grow first. Free slots are handed out from the front of the file.
+    std::size_t firstFree() const;
+    std::size_t freeSlots() const;
+
+    // Gives back the chunks at the end of the file that have no slot in use. Returns the
+    // bytes the file shrank by.
+    std::size_t shrink();
+
+  private:
+    // Epoch of the last touch of slot i, 0 while it is paged out
+    std::atomic<uint32_t> & useOf(std::size_t i) const { return uses_[i / CHUNK_SLOTS][i % CHUNK_SLOTS]; }
+
+    void trim();
+
+    // Drops the count slots from first on from memory, written back unless discard is set
+    void pageOut(std::size_t first, std::size_t count, bool discard);
+
+  private:
+    const std::size_t slotSize_;
+    const std::size_t budgetSlots_;
+
+    int fd_ = -1;
+    char * base_ = nullptr;
+
+    // One array of uses per mapped chunk, the table is sized for MAX_SIZE up front so
+    // it never moves while other threads touch slots
+    std::unique_ptr<std::unique_ptr<std::atomic<uint32_t>[]>[]> uses_;
+    std::size_t maxChunks_ = 0;
+    std::atomic<std::size_t> chunkCount_ { 0 };
+
+    mutable std::mutex mutex_;
+    std::vector<std::size_t> free_;
+    std::atomic<uint32_t> epoch_ { 1 };
+    std::atomic<std::size_t> resident_ { 0 };
+};
@@ -18,30 +18,22 @@ inline bool isOperator(char ch)
   }
 }
 
-Tokenizer::Tokenizer(std::string const& stream)
-  : stream_(stream),
-    value_(),
-    pos_(0)
+Tokenizer::Tokenizer(StrView source)
+  : source_(source)
 { }
 
 Token Tokenizer::next()
 {
-  value_.clear();
   eatWhitespace();
+  start_ = pos_;
 
   if (eof())
     return Token::EndOfFile;
 
-  if (std::isdigit(current()))
+  if (std::isdigit(current()) || (current() == '-' && std::isdigit(peak())))
   {
     return parseNumber();
   }
-  else if (current() == '-' && std::isdigit(peak()))
-  {
-    // Eat the '-'' and then parse the number
-    value_.append(1, '-');
-    return parseNumber();
-  }
   else if (current() == '(')
   {
     step();
@@ -59,9 +51,7 @@ Token Tokenizer::next()
   }
   else if (isOperator(current()) && (std::isspace(peak()) || std::isalpha(peak()) || std::isdigit(peak())))
   {
-    value_.append(1, current());
     step();
-
     return Token::Operator;
   }
   else if (std::isalpha(current()))
@@ -72,9 +62,7 @@ Token Tokenizer::next()
     return Token::EndOfFile;
 
   // If we get here, we have encountered an error
-  value_.append("unknown character: ")
-        .append(1, current());
-
+  error_ = std::string("unknown character: ") + current();
   return Token::Error;
 }
 
@@ -84,95 +72,104 @@ void Tokenizer::eatWhitespace()
     step();
 }
 
+// A number is an optional '-', digits and optionally a '.' followed by more digits
 Token Tokenizer::parseNumber()
 {
-  value_.append(1, current());
   step();
 
   while (!eof() && std::isdigit(current()))
-  {
-    value_.append(1, current());
     step();
-  }
 
   if (current() == '.')
   {
     if (!std::isdigit(peak()))
     {
-      const std::string number = value_;
-      value_ = "expected digit but got ";
-      value_.append(1, peak())
-            .append(" in number ")
-            .append(number);
+      error_ = std::string("expected digit but got ") + peak() + " in number " + value().str();
       return Token::Error;
     }
-    else
-    {
-      value_.append(1, current());
-      step();
 
-      while (!eof() && std::isdigit(current()))
-      {
-        value_.append(1, current());
-        step();
-      }
-    }
+    step();
+
+    while (!eof() && std::isdigit(current()))
+      step();
   }
 
+  str::parseNumber(value(), number_);
   return Token::Number;
 }
 
 Token Tokenizer::parseIdentifier()
 {
-  if (std::isupper(current()))
-    if (parseCell())
+  sheet_ = StrView();
+
+  // A name followed by ! is the buffer the cell or range after it is in
+  std::size_t end = pos_;
+  while (end < source_.size() && (std::isalnum(source_[end]) || source_[end] == '_'))
+    ++end;
+
+  if (end < source_.size() && source_[end] == '!')
+  {
+    sheet_ = source_.substr(pos_, end - pos_);
+    pos_ = end + 1;
+
+    if (!std::isupper(current()))
     {
-      if (current() == ':' && std::isupper(peak()))
-      {
-        value_.append(1, current());
-        step();
-
-        if (parseCell())
-        {
-          return Token::Range;
-        }
-        else
-        {
-          value_ = "expected range";
-          return Token::Error;
-        }
-      }
-
-      return Token::Cell;
+      error_ = "expected a cell after " + sheet_.str() + "!";
+      return Token::Error;
     }
+  }
 
-  while (!eof() && (std::isalpha(current()) || std::isdigit(current()) || current() == '_'))
+  if (std::isupper(current()) && parseCell(startIndex_))
   {
-    value_.append(1, current());
-    step();
+    if (current() == ':' && std::isupper(peak()))
+    {
+      step();
+
+      if (parseCell(endIndex_))
+        return Token::Range;
+
+      error_ = "expected range";
+      return Token::Error;
+    }
+
+    return Token::Cell;
   }
 
+  if (!sheet_.empty())
+  {
+    error_ = "expected a cell after " + sheet_.str() + "!";
+    return Token::Error;
+  }
+
+  while (!eof() && (std::isalpha(current()) || std::isdigit(current()) || current() == '_'))
+    step();
+
   return Token::Identifier;
 }
 
-bool Tokenizer::parseCell()
+// Reads a cell name, upper case column letters followed by a row number, into idx the
+// same way as Index::fromStr()
+bool Tokenizer::parseCell(Index & idx)
 {
+  idx = Index(0, 0);
+
   while (!eof() && std::isupper(current()))
   {
-    value_.append(1, current());
+    idx.x = idx.x * 26 + (current() - 'A');
     step();
   }
 
-  if (!eof() && std::isdigit(current()))
-  {
-    while (!eof() && std::isdigit(current()))
-    {
-      value_.append(1, current());
-      step();
-    }
+  if (eof() || !std::isdigit(current()))
+    return false;
 
-    return true;
+  while (!eof() && std::isdigit(current()))
+  {
+    idx.y = idx.y * 10 + (current() - '0');
+    step();
   }
 
-  return false;
+  if (idx.y > 0)
+    idx.y--;
+
+  return true;
 }
@@ -1,6 +1,8 @@
-
 #pragma once
 
+#include "Str.h"
+#include "Index.h"
+
 #include <string>
 
 enum class Token
@@ -17,24 +19,42 @@ enum class Token
   Error
 };
 
+// Splits an expression into tokens without copying it, the source has to outlive the
+// tokenizer. Numbers, cells and ranges are converted while they are scanned, only an
+// error allocates.
 class Tokenizer
 {
   public:
-    Tokenizer(std::string const& str);
+    Tokenizer(StrView source);
 
     Token next();
-    std::string const& value() const { return value_; }
 
-    bool eof() const { return pos_ >= stream_.size(); }
+    // Text of the last token, a view into the source
+    StrView value() const { return source_.substr(start_, pos_ - start_); }
+
+    // Value of the last Token::Number
+    double number() const { return number_; }
+
+    // Cell of the last Token::Cell, or the corners of the last Token::Range
+    Index const& startIndex() const { return startIndex_; }
+    Index const& endIndex() const { return endIndex_; }
+
+    // The buffer name of a cell or range like ref!B2, empty for one without
+    StrView sheet() const { return sheet_; }
+
+    // What is wrong with the source after Token::Error
+    std::string const& error() const { return error_; }
+
+    bool eof() const { return pos_ >= source_.size(); }
 
   private:
     void eatWhitespace();
     Token parseNumber();
     Token parseIdentifier();
-    bool parseCell();
+    bool parseCell(Index & idx);
 
-    char current() const { return stream_[pos_]; }
-    char peak() const { return pos_ < (stream_.size() - 1) ? stream_[pos_ + 1] : 0; }
+    char current() const { return pos_ < source_.size() ? source_[pos_] : 0; }
+    char peak() const { return pos_ + 1 < source_.size() ? source_[pos_ + 1] : 0; }
 
     bool step()
     {
@@ -43,7 +63,13 @@ class Tokenizer
     }
 
   private:
-    std::string stream_;
-    std::string value_;
-    uint32_t pos_;
-};
\ No newline at end of file
+    StrView source_;
+    std::size_t pos_ = 0;
+    std::size_t start_ = 0;
+
+    double number_ = 0.0;
+    Index startIndex_;
+    Index endIndex_;
+    StrView sheet_;
+    std::string error_;
+};
@@ -0,0 +1,159 @@
+#include "Top.h"
+#include "DocumentState.h"
+#include "Document.h"
+#include "Scheduler.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace doc {
+
+  void offerTop(std::vector<TopEntry> & heap, std::size_t count, TopEntry const& entry)
+  {
+    if (heap.size() < count)
+    {
+      heap.push_back(entry);
+      std::push_heap(heap.begin(), heap.end());
+    }
+    else if (!heap.empty() && entry < heap.front())
+    {
+      std::pop_heap(heap.begin(), heap.end());
+      heap.back() = entry;
+      std::push_heap(heap.begin(), heap.end());
+    }
+  }
+
+  bool openTopView(int count, int column, bool copyHeader, bool ascending)
+  {
+    Document & doc = currentDoc();
+    if (doc.loading_ || isIndexing(doc))
+    {
+      logError("can't take the top of a document that is still loading");
+      return false;
+    }
+
+    Buffer const& source = currentBuffer();
+    const int rowCount = getRowCount();
+
+    // The rows looked at are counted from the first one after the header, a view maps
+    // them to the rows of the document
+    const int firstRow = copyHeader ? 1 : 0;
+    const std::size_t size = std::max(rowCount - firstRow, 0);
+    int const* viewRows = source.view_ ? source.rows_.data() + firstRow : nullptr;
+
+    auto rowAt = [viewRows, firstRow] (std::size_t position) {
+      return viewRows ? viewRows[position] : firstRow + (int)position;
+    };
+
+    auto entry = [ascending] (double value, std::size_t position) {
+      const uint64_t key = orderedKey(value + 0.0);
+      return TopEntry(ascending ? key : ~key, (uint32_t)position);
+    };
+
+    // Paged documents and the virtual cells of a column formula are read one row after
+    // the other
+    const bool virtualCells = !doc.paged_ && !doc.columnFormulas_.empty() && findColumnFormula(doc, column);
+    const std::size_t rangeCount = doc.paged_ || virtualCells ? 1 : std::max<std::size_t>(1, std::min<std::size_t>(size / FILTER_CHUNK_ROWS, Scheduler::shared().threadCount()));
+
+    std::vector<std::vector<TopEntry>> heaps(rangeCount);
+
+    if (doc.paged_ || virtualCells)
+    {
+      for (std::size_t r = 0; r < size; ++r)
+      {
+        const Index idx(column, rowAt(r));
+
+        double value = NAN;
+        if (doc.paged_)
+          str::parseValue(pagedText(doc, idx), value);
+        else if (Cell * cell = doc.cells_.find(idx))
+          value = cell->type == CellType::Text ? NAN : getCellValue(idx);
+        else
+          columnFormulaValue(doc, idx, value);
+
+        if (!std::isnan(value))
+          offerTop(heaps[0], count, entry(value, r));
+      }
+    }
+    else
+    {
+      // The formulas of the column are evaluated first, the workers only read the cells,
+      // and must not copy the tiles a snapshot shares
+      doc.cells_.forEachFormula(column, 0, doc.height_ - 1, [] (Index const& idx, Cell & cell) {
+        if (!cell.evaluated)
+          evaluateCell(idx, cell);
+      });
+
+      doc.cells_.unshare();
+      doc.cells_.updateSums();
+
+      std::vector<Scheduler::Task> tasks;
+      for (std::size_t range = 0; range < rangeCount; ++range)
+      {
+        tasks.push_back([&, range] () {
+          const std::size_t first = size * range / rangeCount;
+          const std::size_t last = size * (range + 1) / rangeCount;
+          std::vector<TopEntry> & heap = heaps[range];
+
+          // Once the heap is full, the rows of a tile whose zone map has no number that
+          // beats the last entry are dropped at once
+          CellStorage::Zone zone;
+          int zoneFirst = -1;
+          bool skipZone = false;
+
+          for (std::size_t r = first; r < last; ++r)
+          {
+            const int y = rowAt(r);
+
+            if (y < zoneFirst || y >= zoneFirst + CellStorage::TILE_HEIGHT)
+            {
+              zoneFirst = y - y % CellStorage::TILE_HEIGHT;
+              doc.cells_.zone(column, y, zone);
+              skipZone = !zone.formulas && (zone.numbers == 0 ||
+                         (heap.size() == (std::size_t)count && heap.front() < entry(ascending ? zone.min : zone.max, 0)));
+            }
+
+            // The rest of the tile is skipped at once unless the rows come from a view
+            if (skipZone)
+            {
+              if (!viewRows)
+                r += std::min<std::size_t>(zoneFirst + CellStorage::TILE_HEIGHT - 1 - y, last - 1 - r);
+              continue;
+            }
+
+            Cell const* cell = static_cast<CellStorage const&>(doc.cells_).find(Index(column, y));
+            if (cell && cell->type != CellType::Text && !std::isnan(cell->value))
+              offerTop(heap, count, entry(cell->value, r));
+          }
+        });
+      }
+
+      Scheduler::shared().run(tasks);
+    }
+
+    std::vector<TopEntry> top;
+    top.reserve(std::min<std::size_t>(count, size));
+
+    for (auto const& heap : heaps)
+      for (auto const& it : heap)
+        offerTop(top, count, it);
+
+    std::sort_heap(top.begin(), top.end());
+
+    Buffer buffer;
+    buffer.doc_ = source.doc_;
+    buffer.view_ = true;
+
+    buffer.rows_.reserve(top.size() + 1);
+    if (copyHeader && rowCount > 0)
+      buffer.rows_.push_back(documentRow(0));
+    for (auto const& it : top)
+      buffer.rows_.push_back(rowAt(it.second));
+
+    documentBuffers().push_back(std::move(buffer));
+    jumpToBuffer(documentBuffers().size() - 1);
+
+    return true;
+  }
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+// Top views: the rows of a buffer with the largest or smallest numbers of a column, kept
+// in a bounded heap for each range of rows instead of sorting them. Tiles whose zone map
+// can't beat the heap are passed over.
+namespace doc {
+
+  // Opens a view of the count rows of the current buffer with the largest numbers in
+  // column, largest first, or the smallest with ascending. The header is kept with
+  // copyHeader. Returns false, having logged why, for a document that is still loading.
+  bool openTopView(int count, int column, bool copyHeader, bool ascending);
+}
@@ -0,0 +1,326 @@
+
+#include "Utf8.h"
+#include "bx/platform.h"
+
+#include "termbox.h"
+#include <algorithm>
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#  define UTF8_AVX2 1
+#elif defined(__SSE2__) || (BX_COMPILER_MSVC && (BX_ARCH_64BIT || _M_IX86_FP >= 2))
+#  include <emmintrin.h>
+#  define UTF8_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define UTF8_NEON 1
+#endif
+
+namespace utf8 {
+
+  // Characters narrowed to ASCII at a time by fromUTF32()
+  static const std::size_t NARROW_SIZE = 16;
+
+  // Longest sequence tb_utf8_unicode_to_char() writes
+  static const std::size_t MAX_SEQUENCE = 6;
+
+  // isAscii() is whether the block at data is ASCII, isText() whether it also has no 0
+  // byte. widen() decodes an ASCII block into out, narrow() encodes NARROW_SIZE characters
+  // of in into out, if they are ASCII, and otherwise returns false.
+#if UTF8_AVX2
+  static const std::size_t BLOCK_SIZE = 32;
+
+  static inline bool isAscii(const char * data)
+  {
+    return _mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data))) == 0;
+  }
+
+  static inline bool isText(const char * data)
+  {
+    const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+    return _mm256_movemask_epi8(_mm256_or_si256(block, _mm256_cmpeq_epi8(block, _mm256_setzero_si256()))) == 0;
+  }
+
+  static inline void widen(const char * data, uint32_t * out)
+  {
+    for (std::size_t i = 0; i < BLOCK_SIZE; i += 8)
+    {
+      const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(data + i));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_cvtepu8_epi32(bytes));
+    }
+  }
+#elif UTF8_SSE2
+  static const std::size_t BLOCK_SIZE = 16;
+
+  static inline bool isAscii(const char * data)
+  {
+    return _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data))) == 0;
+  }
+
+  static inline bool isText(const char * data)
+  {
+    const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+    return _mm_movemask_epi8(_mm_or_si128(block, _mm_cmpeq_epi8(block, _mm_setzero_si128()))) == 0;
+  }
+
+  static inline void widen(const char * data, uint32_t * out)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+    const __m128i low = _mm_unpacklo_epi8(block, zero);
+    const __m128i high = _mm_unpackhi_epi8(block, zero);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_unpacklo_epi16(low, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 4), _mm_unpackhi_epi16(low, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 8), _mm_unpacklo_epi16(high, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 12), _mm_unpackhi_epi16(high, zero));
+  }
+#elif UTF8_NEON
+  static const std::size_t BLOCK_SIZE = 16;
+
+  static inline bool isAscii(const char * data)
+  {
+    return vmaxvq_u8(vld1q_u8(reinterpret_cast<const uint8_t *>(data))) < 0x80;
+  }
+
+  static inline bool isText(const char * data)
+  {
+    const uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t *>(data));
+    return vmaxvq_u8(block) < 0x80 && vminvq_u8(block) > 0;
+  }
+
+  static inline void widen(const char * data, uint32_t * out)
+  {
+    const uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t *>(data));
+    const uint16x8_t low = vmovl_u8(vget_low_u8(block));
+    const uint16x8_t high = vmovl_u8(vget_high_u8(block));
+
+    vst1q_u32(out, vmovl_u16(vget_low_u16(low)));
+    vst1q_u32(out + 4, vmovl_u16(vget_high_u16(low)));
+    vst1q_u32(out + 8, vmovl_u16(vget_low_u16(high)));
+    vst1q_u32(out + 12, vmovl_u16(vget_high_u16(high)));
+  }
+#else
+  static const std::size_t BLOCK_SIZE = 16;
+
+  static inline bool isAscii(const char * data)
+  {
+    unsigned char bits = 0;
+    for (std::size_t i = 0; i < BLOCK_SIZE; ++i)
+      bits |= (unsigned char)data[i];
+
+    return bits < 0x80;
+  }
+
+  static inline bool isText(const char * data)
+  {
+    for (std::size_t i = 0; i < BLOCK_SIZE; ++i)
+      if ((unsigned char)data[i] >= 0x80 || data[i] == 0)
+        return false;
+
+    return true;
+  }
+
+  static inline void widen(const char * data, uint32_t * out)
+  {
+    for (std::size_t i = 0; i < BLOCK_SIZE; ++i)
+      out[i] = (unsigned char)data[i];
+  }
+#endif
+
+#if UTF8_AVX2 || UTF8_SSE2
+  static inline bool narrow(uint32_t const* in, char * out)
+  {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 4));
+    const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 8));
+    const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 12));
+
+    const __m128i high = _mm_and_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), _mm_set1_epi32(~0x7F));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, _mm_setzero_si128())) != 0xFFFF)
+      return false;
+
+    // The characters are below 0x80, so neither pack saturates
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+    return true;
+  }
+#elif UTF8_NEON
+  static inline bool narrow(uint32_t const* in, char * out)
+  {
+    const uint32x4_t a = vld1q_u32(in);
+    const uint32x4_t b = vld1q_u32(in + 4);
+    const uint32x4_t c = vld1q_u32(in + 8);
+    const uint32x4_t d = vld1q_u32(in + 12);
+
+    if (vmaxvq_u32(vorrq_u32(vorrq_u32(a, b), vorrq_u32(c, d))) >= 0x80)
+      return false;
+
+    const uint16x8_t low = vcombine_u16(vmovn_u32(a), vmovn_u32(b));
+    const uint16x8_t high = vcombine_u16(vmovn_u32(c), vmovn_u32(d));
+    vst1q_u8(reinterpret_cast<uint8_t *>(out), vcombine_u8(vmovn_u16(low), vmovn_u16(high)));
+    return true;
+  }
+#else
+  static inline bool narrow(uint32_t const* in, char * out)
+  {
+    uint32_t bits = 0;
+    for (std::size_t i = 0; i < NARROW_SIZE; ++i)
+      bits |= in[i];
+
+    if (bits >= 0x80)
+      return false;
+
+    for (std::size_t i = 0; i < NARROW_SIZE; ++i)
+      out[i] = (char)in[i];
+
+    return true;
+  }
+#endif
+
+  // The length of the well formed character at it, 0 if there is none before end
+  static inline std::size_t sequenceLength(const unsigned char * it, const unsigned char * end)
+  {
+    const unsigned char lead = *it;
+    if (lead < 0x80)
+      return 1;
+
+    std::size_t length;
+    uint32_t ch;
+    uint32_t least;
+
+    if ((lead & 0xE0) == 0xC0)
+    {
+      length = 2;
+      ch = lead & 0x1F;
+      least = 0x80;
+    }
+    else if ((lead & 0xF0) == 0xE0)
+    {
+      length = 3;
+      ch = lead & 0x0F;
+      least = 0x800;
+    }
+    else if ((lead & 0xF8) == 0xF0)
+    {
+      length = 4;
+      ch = lead & 0x07;
+      least = 0x10000;
+    }
+    else
+      return 0;
+
+    if ((std::size_t)(end - it) < length)
+      return 0;
+
+    for (std::size_t i = 1; i < length; ++i)
+    {
+      if ((it[i] & 0xC0) != 0x80)
+        return 0;
+
+      ch = (ch << 6) | (it[i] & 0x3F);
+    }
+
+    if (ch < least || ch > 0x10FFFF || (ch >= 0xD800 && ch <= 0xDFFF))
+      return 0;
+
+    return length;
+  }
+
+  bool validate(StrView text, std::size_t * invalid)
+  {
+    const unsigned char * begin = reinterpret_cast<const unsigned char *>(text.data());
+    const unsigned char * end = begin + text.size();
+    const unsigned char * it = begin;
+
+    while (it < end)
+    {
+      if ((std::size_t)(end - it) >= BLOCK_SIZE && isAscii(reinterpret_cast<const char *>(it)))
+      {
+        it += BLOCK_SIZE;
+        continue;
+      }
+
+      // The rest of a block that isn't ASCII goes a character at a time, up to the
+      // character that ends past it
+      const unsigned char * blockEnd = it + std::min<std::size_t>(BLOCK_SIZE, end - it);
+      while (it < blockEnd)
+      {
+        const std::size_t length = sequenceLength(it, end);
+        if (length == 0)
+        {
+          if (invalid)
+            *invalid = it - begin;
+
+          return false;
+        }
+
+        it += length;
+      }
+    }
+
+    return true;
+  }
+
+  uint32_t toUTF32(StrView in, uint32_t * out, uint32_t outLen)
+  {
+    const char * it = in.data();
+    const char * end = it + in.size();
+    uint32_t strLen = 0;
+
+    while (it < end && strLen < outLen - 1)
+    {
+      if ((std::size_t)(end - it) >= BLOCK_SIZE && outLen - 1 - strLen >= BLOCK_SIZE && isText(it))
+      {
+        widen(it, out + strLen);
+        it += BLOCK_SIZE;
+        strLen += BLOCK_SIZE;
+        continue;
+      }
+
+      const char * blockEnd = it + std::min<std::size_t>(BLOCK_SIZE, end - it);
+      while (it < blockEnd && strLen < outLen - 1)
+      {
+        if (!*it || tb_utf8_char_length(*it) > end - it)
+        {
+          out[strLen] = '\0';
+          return strLen;
+        }
+
+        it += tb_utf8_char_to_unicode(&out[strLen], it);
+        ++strLen;
+      }
+    }
+
+    out[strLen] = '\0';
+    return strLen;
+  }
+
+  void fromUTF32(uint32_t const* in, std::size_t count, std::string & out)
+  {
+    // Written in place, grown by what a character may take when one isn't ASCII
+    std::size_t length = out.size();
+    out.resize(length + count + NARROW_SIZE);
+
+    std::size_t i = 0;
+    while (i < count)
+    {
+      if (count - i >= NARROW_SIZE && narrow(in + i, &out[length]))
+      {
+        i += NARROW_SIZE;
+        length += NARROW_SIZE;
+        continue;
+      }
+
+      const std::size_t blockEnd = std::min(i + NARROW_SIZE, count);
+      for (; i < blockEnd; ++i)
+      {
+        if (out.size() < length + MAX_SEQUENCE + (count - i) + NARROW_SIZE)
+          out.resize(length + MAX_SEQUENCE + (count - i) + NARROW_SIZE);
+
+        length += tb_utf8_unicode_to_char(&out[length], in[i]);
+      }
+    }
+
+    out.resize(length);
+  }
+}
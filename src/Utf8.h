@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Str.h"
+
+#include <cstdint>
+#include <string>
+
+// UTF-8 between the documents, Tcl and the edit line. Runs of ASCII, which most CSV text
+// is, go a block of 16 or 32 bytes at a time with SSE2, AVX2 or NEON, other characters
+// one at a time the way termbox decodes and encodes them.
+namespace utf8 {
+
+  // Whether text is well formed UTF-8, without overlong forms, surrogates, characters past
+  // U+10FFFF or a character cut off by its end. Otherwise sets invalid, if it is given, to
+  // the offset of the first byte that isn't.
+  bool validate(StrView text, std::size_t * invalid = nullptr);
+
+  // Decodes in into at most outLen - 1 characters of out followed by a 0 and returns how
+  // many it wrote. Stops at a 0 byte, a character cut off by the end of in is dropped.
+  uint32_t toUTF32(StrView in, uint32_t * out, uint32_t outLen);
+
+  // Appends the count characters of in to out
+  void fromUTF32(uint32_t const* in, std::size_t count, std::string & out);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// What a formula that can't be evaluated gives instead of a number
+enum class FormulaError : uint8_t
+{
+  None,
+  Syntax,   // #ERROR, the formula doesn't parse or compile
+  Ref,      // #REF, an invalid range or a sheet that isn't open
+  Div0,     // #DIV0
+  Arg,      // #ARG, a function with the wrong number or kind of arguments
+  Cycle,    // #CYCLE, the formula depends on itself
+};
+
+// Values of cells and of the evaluation stack are doubles. Other kinds of values are
+// quiet NaNs with a tag in bits 32 to 39 and their payload in the low 32 bits, so they
+// take no more room and numbers need no unboxing. The NaNs arithmetic makes have no
+// tag, and arithmetic keeps the payload of a NaN operand.
+//
+// An error travels through evaluation, a formula reading one gives it too without a
+// check per instruction. Its sign is left out, negating an error keeps it.
+//
+// A text is the id of a string in the string pool of its document, so comparing texts
+// compares ids. Only the keys of lookups are given as text, see Program::Instruction.
+namespace value {
+
+  static const uint64_t NAN_BITS = 0x7FF8000000000000ull;
+  static const uint64_t TAG_MASK = 0x7FFFFFFF00000000ull;
+
+  static const uint64_t ERROR_TAG = 0xE0;
+  static const uint64_t TEXT_TAG = 0xE1;
+
+  inline uint64_t bits(double value)
+  {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+  }
+
+  inline double box(uint64_t tag, uint32_t payload)
+  {
+    const uint64_t bits = NAN_BITS | (tag << 32) | payload;
+
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  inline bool hasTag(double value, uint64_t tag)
+  {
+    return (bits(value) & TAG_MASK) == (NAN_BITS | (tag << 32));
+  }
+
+  inline double fromText(uint32_t id)
+  {
+    return box(TEXT_TAG, id);
+  }
+
+  inline bool isText(double value)
+  {
+    return hasTag(value, TEXT_TAG);
+  }
+
+  inline uint32_t textId(double value)
+  {
+    return (uint32_t)bits(value);
+  }
+}
+
+inline double errorValue(FormulaError error)
+{
+  return value::box(value::ERROR_TAG, (uint32_t)error);
+}
+
+// The error value holds, None for numbers, texts and other NaNs
+inline FormulaError valueError(double value)
+{
+  const uint32_t payload = (uint32_t)value::bits(value);
+  if (!value::hasTag(value, value::ERROR_TAG) || payload > (uint32_t)FormulaError::Cycle)
+    return FormulaError::None;
+
+  return (FormulaError)payload;
+}
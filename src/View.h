@@ -2,6 +2,9 @@
 #pragma once
 
 #include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
 
 namespace view {
 
@@ -109,6 +112,36 @@ namespace view {
   bool init(int preferredWidth, int preferredHeight, const char * title);
   void shutdown();
 
+  // Instead of init(), the view draws for the clients attached to the Unix socket at
+  // path, at the size of the smallest one, and their keys are its events. Only the
+  // terminal view can be served.
+  bool serve(const char * path, int preferredWidth, int preferredHeight);
+
+  // Shows the view served at path on this terminal and sends it the keys typed, until the
+  // client is detached or the server goes away. Returns the exit code of the client.
+  int attach(const char * path);
+
+  // Detaches the client the last key came from, false if the view isn't served
+  bool detachClient();
+
+  // A client attached to a served view, numbered from 1 in the order they attached
+  struct ClientStats
+  {
+    uint64_t id;
+    int width;
+    int height;
+    uint64_t frames;
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+    std::size_t queuedBytes;
+  };
+
+  // The clients attached to the view, none if it isn't served
+  std::vector<ClientStats> clientStats();
+
+  // Events that arrived from the clients and weren't handed out yet
+  std::size_t queuedEvents();
+
   int width();
   int height();
 
@@ -116,10 +149,20 @@ namespace view {
   void hideCursor();
 
   void setClearAttributes(uint16_t fg, uint16_t bg);
+  // A ch of 0 is the second column of the wide character before it
   void changeCell(int x, int y, uint32_t ch, uint16_t fg, uint16_t bg);
 
   void clear();
   void present();
 
   void waitEvent(Event * event);
+
+  // Waits at most timeout milliseconds for an event, returns false if none arrived
+  bool waitEvent(Event * event, int timeout);
+
+  // The text on the system clipboard, empty if there is none or the view can't read it
+  std::string clipboard();
+
+  // Bytes held by the view for its frames, and its glyphs if it draws them itself
+  std::size_t memoryUsage();
 }
@@ -3,26 +3,39 @@
 #include "Log.h"
 #include "Tcl.h"
 #include "Index.h"
+#include "Scheduler.h"
 
 #include "UbuntuMono.ttf.h"
 
 #include <vector>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <stb_truetype.h>
 #include <GLFW/glfw3.h>
-#include <sera.h>
-
-#define GL_BGRA 0x80E1
 
 namespace view {
 
   static const tcl::Variable FONT_SIZE("view_fontSize", 16);
   static const tcl::Variable BLINK_RATE("view_cursorBlinkRate", 400);
+  static const tcl::Variable GLYPH_CACHE_SIZE("view_glyphCacheSize", 512);
 
+  // Glyphs are rasterized once into a single alpha atlas texture, x and y are the
+  // bearing relative to the pen position and atlasX and atlasY the glyph's place in the atlas
   struct Glyph
   {
-    sr_Buffer * surface = nullptr;
     int x = 0;
     int y = 0;
+    int width = 0;
+    int height = 0;
+    int atlasX = 0;
+    int atlasY = 0;
   };
 
   struct Cell
@@ -39,9 +52,34 @@ namespace view {
     uint8_t b;
   };
 
+  struct Vertex
+  {
+    float x, y;
+    float u, v;
+    uint8_t r, g, b, a;
+  };
+
+  static const int ATLAS_WIDTH = 512;
+  static const int ATLAS_INITIAL_HEIGHT = 256;
+  static const int ATLAS_PADDING = 1;
+
+  // ASCII and Latin-1 are rasterized at startup and looked up directly by codepoint
+  static const int DENSE_GLYPHS = 256;
+
+  // Fewer cells to build than this and they are built on the render thread alone
+  static const std::size_t PARALLEL_BUILD_CELLS = 16384;
+
   static GLFWwindow * _window = nullptr;
-  static sr_Buffer * _canvas = nullptr;
-  static uint32_t _canvasTexture = 0;
+
+  // CPU copy of the atlas, the texture is re-uploaded from it when glyphs were added.
+  // The top left texels are solid and used to draw cell backgrounds and the cursor.
+  static std::vector<uint8_t> _atlasPixels;
+  static int _atlasHeight = 0;
+  static int _atlasPenX = 0;
+  static int _atlasPenY = 0;
+  static int _atlasRowHeight = 0;
+  static bool _atlasDirty = true;
+  static uint32_t _atlasTexture = 0;
 
   static stbtt_fontinfo _font;
   static int _fontBaseline;
@@ -53,27 +91,112 @@ namespace view {
   static int _width = 0;
   static int _height = 0;
   static Index _cursor;
-  static int _cursorBlinkTimeout = 0;
-  static int _cursorBlinkVisible = true;  
   static uint16_t _clearForeground = COLOR_TEXT;
   static uint16_t _clearBackground = COLOR_BACKGROUND;
 
   static Color BACKGROUND_COLOR = {39, 40, 34};
   static Color TEXT_COLOR = {248, 248, 242};
 
-  static std::vector<Glyph> _glyphCache;
+  // Every other codepoint gets one of a fixed number of equally sized atlas slots below
+  // the dense glyphs. When all are taken the least recently drawn glyph gives up its slot.
+  struct SlotGlyph
+  {
+    Glyph glyph;
+    int slot;
+    std::list<int>::iterator use;
+  };
+
+  static Glyph _denseGlyphs[DENSE_GLYPHS];
+  static std::unordered_map<int, SlotGlyph> _slotGlyphs;
+  static std::list<int> _slotGlyphUse;
+  static int _slotSize = 0;
+  static int _slotColumns = 0;
+  static int _slotTop = 0;
+  static int _slotCapacity = 0;
   static std::vector<Cell> _cells;
 
-  static std::vector<Event> _eventQueue;
+  // What was last presented, a frame that matches it is not handed on. _cellSerial
+  // counts the presented grids, so the render thread knows when to build vertices.
+  static std::vector<Cell> _presentedCells;
+  static Index _presentedCursor;
+  static bool _fullRedraw = true;
+  static uint32_t _cellSerial = 0;
+
+  // Everything the render thread needs to draw a frame, it never reads the main
+  // thread's state. Window sizes and the blink rate can only be read on the main thread.
+  struct Frame
+  {
+    std::vector<Cell> cells;
+    int width = 0;
+    int height = 0;
+    int windowWidth = 0;
+    int windowHeight = 0;
+    Index cursor;
+    double blinkInterval = 0.0;
+    uint32_t serial = 0;
+  };
+
+  // Frames go through a triple buffer. present() fills _frames[_writeFrame] and swaps it
+  // with _pendingFrame, the render thread swaps that with _readFrame and draws it. A
+  // frame the render thread didn't get to is replaced by the next one. Only the swaps
+  // and the flags below need _frameMutex.
+  static Frame _frames[3];
+  static int _writeFrame = 0;
+  static int _pendingFrame = 1;
+  static int _readFrame = 2;
+  static bool _framePending = false;
+  static bool _blinkReset = false;
+  static bool _stopRendering = false;
+  static std::mutex _frameMutex;
+  static std::condition_variable _frameReady;
+  static std::thread _renderThread;
+
+  // The thread that created the window, the only one GLFW lets read the clipboard
+  static std::thread::id _mainThread;
+
+  // The vertices of a row of the grid, placed relative to the top of the row so a row
+  // that scrolled keeps them. slotGlyphs says whether any of them come from the glyph
+  // slots, which may have been given to other glyphs since.
+  struct GridRow
+  {
+    std::vector<Cell> cells;
+    std::vector<Vertex> backgrounds;
+    std::vector<Vertex> glyphs;
+    uint64_t hash = 0;
+    bool slotGlyphs = false;
+  };
+
+  // Owned by the render thread. It checks the glyphs, rasterizes the ones that are
+  // missing, and draws. A row whose cells were already drawn in some row of the last
+  // grid takes over that row's vertices, so scrolling only builds the rows it exposed.
+  // _vertices holds the cursor, if it is shown. A blink only draws the rows again,
+  // with or without the cursor.
+  static std::vector<GridRow> _rows;
+  static std::vector<GridRow> _lastRows;
+  static int _rowsWidth = 0;
+  static int _rowsAtlasHeight = 0;
+  static std::unordered_map<uint64_t, int> _lastRowsByHash;
+  static std::vector<int> _denseRows;
+
+  // Taken on the main thread, the shared scheduler reads its size from a Tcl variable
+  static Scheduler * _scheduler = nullptr;
+  static std::vector<Vertex> _vertices;
+  static bool _cursorBlinkVisible = true;
+  static double _nextBlink = 0.0;    // glfwGetTime() at which the cursor blinks next
+  static std::atomic<std::size_t> _renderBytes(0);
+
+  static std::deque<Event> _eventQueue;
 
   static bool initializeFont();
-  static void initGlyph(int ch);
+  static void initAtlas();
+  static Glyph const& findGlyph(int ch);
   static void keyboardEvent(int event, int key);
 
   static void errorCallback(int error, const char * description);
   static void windowSizeCallback(GLFWwindow * window, int width, int height);
   static void keyCallback(GLFWwindow * window, int key, int scancode, int action, int mods);
   static void inputCallback(GLFWwindow * window, unsigned int codePoint);
+  static void renderLoop();
 
 
   bool init(int preferredWidth, int preferredHeight, const char * title)
@@ -96,29 +219,27 @@ namespace view {
       return false;
     }
 
+    _mainThread = std::this_thread::get_id();
+
     glfwSetWindowSizeCallback(_window, windowSizeCallback);
     glfwSetKeyCallback(_window, keyCallback);
     glfwSetCharCallback(_window, inputCallback);
 
-    glfwMakeContextCurrent(_window);
-
     {
       int w, h;
       glfwGetWindowSize(_window, &w, &h);
       _width = w / _fontAdvance;
       _height = h / _fontLineHeight;
-
-      _canvas = sr_newBuffer(w, h);
     }
 
-    glEnable(GL_TEXTURE_2D);
-    glGenTextures(1, &_canvasTexture);
-    glBindTexture(GL_TEXTURE_2D, _canvasTexture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
     _cells.resize(_width * _height);
 
+    _scheduler = &Scheduler::shared();
+
+    // The GL context belongs to the render thread from here on
+    _stopRendering = false;
+    _renderThread = std::thread(renderLoop);
+
     return true;
   }
 
@@ -126,16 +247,47 @@ namespace view {
   {
     if (_window)
     {
-      sr_destroyBuffer(_canvas);
-      glfwDestroyWindow(_window);
+      {
+        std::lock_guard<std::mutex> lock(_frameMutex);
+        _stopRendering = true;
+      }
+
+      _frameReady.notify_one();
+      _renderThread.join();
 
-      _canvas = nullptr;
+      glfwDestroyWindow(_window);
       _window = nullptr;
     }
 
     glfwTerminate();
   }
 
+  // A window can't be shared, only the terminal view serves clients
+  bool serve(const char *, int, int)
+  {
+    return false;
+  }
+
+  int attach(const char *)
+  {
+    return 1;
+  }
+
+  bool detachClient()
+  {
+    return false;
+  }
+
+  std::vector<ClientStats> clientStats()
+  {
+    return std::vector<ClientStats>();
+  }
+
+  std::size_t queuedEvents()
+  {
+    return 0;
+  }
+
   void setCursor(int x, int y)
   {
     _cursor.x = x;
@@ -187,97 +339,410 @@ namespace view {
     return _height;
   }
 
-  inline sr_Pixel colorFromEnum(uint16_t color)
+  inline Color colorFromEnum(uint16_t color)
   {
     switch (color & 0x00FF)
     {
-      case COLOR_BACKGROUND:  return sr_color(33, 37, 43);
-      case COLOR_PANEL:       return sr_color(40, 44, 52);
-      case COLOR_HIGHLIGHT:   return sr_color(82, 139, 255);
-      case COLOR_TEXT:        return sr_color(178, 186, 199);
-      case COLOR_SELECTION:   return sr_color(44, 50, 60);
-      case COLOR_WHITE:       return sr_color(255, 255, 255);
-      default:                return sr_color(255, 255, 255);
+      case COLOR_BACKGROUND:  return Color {33, 37, 43};
+      case COLOR_PANEL:       return Color {40, 44, 52};
+      case COLOR_HIGHLIGHT:   return Color {82, 139, 255};
+      case COLOR_TEXT:        return Color {178, 186, 199};
+      case COLOR_SELECTION:   return Color {44, 50, 60};
+      case COLOR_WHITE:       return Color {255, 255, 255};
+      default:                return Color {255, 255, 255};
     }
   }
 
-  void present()
+  static void addQuad(std::vector<Vertex> & vertices, float x, float y, float w, float h, int atlasX, int atlasY, int atlasW, int atlasH, Color color)
+  {
+    const float u0 = (float)atlasX / ATLAS_WIDTH;
+    const float v0 = (float)atlasY / _atlasHeight;
+    const float u1 = (float)(atlasX + atlasW) / ATLAS_WIDTH;
+    const float v1 = (float)(atlasY + atlasH) / _atlasHeight;
+
+    vertices.push_back(Vertex {x,     y,     u0, v0, color.r, color.g, color.b, 255});
+    vertices.push_back(Vertex {x + w, y,     u1, v0, color.r, color.g, color.b, 255});
+    vertices.push_back(Vertex {x + w, y + h, u1, v1, color.r, color.g, color.b, 255});
+    vertices.push_back(Vertex {x,     y + h, u0, v1, color.r, color.g, color.b, 255});
+  }
+
+  static void addSolidQuad(std::vector<Vertex> & vertices, float x, float y, float w, float h, Color color)
+  {
+    // Sample the middle of the solid block so filtering never reaches a glyph
+    addQuad(vertices, x, y, w, h, 1, 1, 0, 0, color);
+  }
+
+  static uint64_t rowHash(Cell const* cells, int width)
+  {
+    uint64_t hash = 14695981039346656037ull;
+    for (int x = 0; x < width; ++x)
+    {
+      hash = (hash ^ (uint32_t)cells[x].ch) * 1099511628211ull;
+      hash = (hash ^ (((uint32_t)cells[x].fg << 16) | cells[x].bg)) * 1099511628211ull;
+    }
+
+    return hash;
+  }
+
+  static bool sameCells(std::vector<Cell> const& row, Cell const* cells, int width)
+  {
+    if ((int)row.size() != width)
+      return false;
+
+    for (int x = 0; x < width; ++x)
+      if (row[x].ch != cells[x].ch || row[x].fg != cells[x].fg || row[x].bg != cells[x].bg)
+        return false;
+
+    return true;
+  }
+
+  static void buildRow(GridRow & row, Cell const* cells, int width, uint64_t hash)
   {
-    int xPos = 0;
-    int yPos = 0;
-    sr_Pixel whiteColor = sr_color(255, 255, 255);
+    row.cells.assign(cells, cells + width);
+    row.backgrounds.clear();
+    row.glyphs.clear();
+    row.hash = hash;
+    row.slotGlyphs = false;
 
-    sr_reset(_canvas);
-    sr_clear(_canvas, colorFromEnum(COLOR_BACKGROUND));
+    for (int x = 0; x < width; ++x)
+      if (cells[x].bg != COLOR_DEFAULT)
+        addSolidQuad(row.backgrounds, x * _fontAdvance, 0, _fontAdvance, _fontLineHeight, colorFromEnum(cells[x].bg));
 
+    for (int x = 0; x < width; ++x)
+    {
+      Cell const& cell = cells[x];
+      if (cell.ch == 32)
+        continue;
 
-    for (int y = 0; y < _height; ++y)
+      row.slotGlyphs |= cell.ch < 0 || cell.ch >= DENSE_GLYPHS;
+
+      Glyph const& glyph = findGlyph(cell.ch);
+      if (glyph.width == 0 || glyph.height == 0)
+        continue;
+
+      //if (cell.fg & COLOR_REVERSE)
+      //  textColor = tigrRGB(BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b);
+
+      addQuad(row.glyphs, x * _fontAdvance + glyph.x, _fontBaseline + glyph.y + (_fontLinePadding / 2),
+              glyph.width, glyph.height, glyph.atlasX, glyph.atlasY, glyph.width, glyph.height, colorFromEnum(cell.fg));
+    }
+  }
+
+  static bool hasSlotGlyphs(Cell const* cells, int width)
+  {
+    for (int x = 0; x < width; ++x)
+      if (cells[x].ch < 0 || cells[x].ch >= DENSE_GLYPHS)
+        return true;
+
+    return false;
+  }
+
+  // The dense glyphs don't change once the font is loaded, so the rows that only have
+  // those are built in bands on the scheduler while a frame has enough of them
+  static void buildDenseRows(Frame const& frame)
+  {
+    const int bands = std::min<int>(_scheduler->threadCount() * 2, _denseRows.size());
+    if (bands < 2 || _denseRows.size() * frame.width < PARALLEL_BUILD_CELLS)
     {
-      for (int x = 0; x < _width; ++x)
-      {
-        Cell & cell = _cells[y * _width + x];
+      for (int y : _denseRows)
+        buildRow(_rows[y], &frame.cells[y * frame.width], frame.width, _rows[y].hash);
 
-        if (cell.ch >= _glyphCache.size() || (cell.ch != 32 && _glyphCache[cell.ch].surface == nullptr))
-          initGlyph(cell.ch);
+      return;
+    }
 
-        Glyph & glyph = _glyphCache[cell.ch];
+    std::vector<Scheduler::Task> tasks;
+    for (int band = 0; band < bands; ++band)
+    {
+      const std::size_t begin = _denseRows.size() * band / bands;
+      const std::size_t end = _denseRows.size() * (band + 1) / bands;
 
-        if (cell.bg != COLOR_DEFAULT)
+      tasks.push_back([&frame, begin, end] ()
+      {
+        for (std::size_t i = begin; i < end; ++i)
         {
-          sr_setColor(_canvas, whiteColor);
-          sr_drawRect(_canvas, colorFromEnum(cell.bg), xPos, yPos, _fontAdvance, _fontLineHeight);
+          const int y = _denseRows[i];
+          buildRow(_rows[y], &frame.cells[y * frame.width], frame.width, _rows[y].hash);
         }
+      });
+    }
 
-        if (cell.ch != 32)
-        {
-          //if (cell.fg & COLOR_REVERSE)
-          //  textColor = tigrRGB(BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b);
-
-          sr_setColor(_canvas, colorFromEnum(cell.fg));
-          sr_drawBuffer(_canvas, glyph.surface, xPos + glyph.x, yPos + _fontBaseline + glyph.y + (_fontLinePadding / 2), nullptr, nullptr); //colorFromEnum(cell.fg));
-        }
+    _scheduler->run(tasks);
+  }
 
-        xPos += _fontAdvance;
-      }
+  // Rows that are in the last grid, in the same place or scrolled to another, keep their
+  // vertices, the others are built. Rows with slot glyphs are always built, since they
+  // may point at slots that were given to other glyphs, and on the render thread, since
+  // looking up a slot glyph may rasterize it and gives it its place in the LRU order.
+  static void buildVertices(Frame const& frame)
+  {
+    std::swap(_rows, _lastRows);
+    _rows.resize(frame.height);
+    _denseRows.clear();
 
-      xPos = 0;
-      yPos += _fontLineHeight;
+    // A different width or atlas size means no row can be kept
+    if (frame.width != _rowsWidth || _atlasHeight != _rowsAtlasHeight)
+    {
+      _lastRows.clear();
+      _rowsWidth = frame.width;
+      _rowsAtlasHeight = _atlasHeight;
     }
 
-    if (_cursor.x >= 0 && _cursor.y >= 0 && _cursorBlinkVisible)
+    _lastRowsByHash.clear();
+    for (int y = 0; y < (int)_lastRows.size(); ++y)
+      if (!_lastRows[y].slotGlyphs)
+        _lastRowsByHash[_lastRows[y].hash] = y;
+
+    for (int y = 0; y < frame.height; ++y)
     {
-      sr_setColor(_canvas, whiteColor);
-      sr_drawLine(_canvas, whiteColor,
-                  _fontAdvance * _cursor.x, _fontLineHeight * _cursor.y,
-                  _fontAdvance * _cursor.x, _fontLineHeight * (_cursor.y + 1));
+      Cell const* cells = &frame.cells[y * frame.width];
+      const uint64_t hash = rowHash(cells, frame.width);
+
+      // A row is taken over at most once, what is left of it has no cells
+      int last = y < (int)_lastRows.size() && _lastRows[y].hash == hash ? y : -1;
+      if (last < 0)
+      {
+        auto it = _lastRowsByHash.find(hash);
+        if (it != _lastRowsByHash.end())
+          last = it->second;
+      }
+
+      if (last >= 0 && !_lastRows[last].slotGlyphs && sameCells(_lastRows[last].cells, cells, frame.width))
+      {
+        std::swap(_rows[y], _lastRows[last]);
+        _lastRows[last].cells.clear();
+      }
+      else if (hasSlotGlyphs(cells, frame.width))
+        buildRow(_rows[y], cells, frame.width, hash);
+      else
+      {
+        _rows[y].hash = hash;
+        _denseRows.push_back(y);
+      }
     }
-    
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT);
 
-    int windowWidth, windowHeight;
-    glfwGetWindowSize(_window, &windowWidth, &windowHeight);  
+    buildDenseRows(frame);
+  }
+
+  static void drawVertices(std::vector<Vertex> const& vertices)
+  {
+    glVertexPointer(2, GL_FLOAT, sizeof(Vertex), &vertices[0].x);
+    glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), &vertices[0].u);
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(Vertex), &vertices[0].r);
+    glDrawArrays(GL_QUADS, 0, (GLsizei)vertices.size());
+  }
+
+  static void uploadAtlas()
+  {
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, ATLAS_WIDTH, _atlasHeight, 0, GL_ALPHA, GL_UNSIGNED_BYTE, &_atlasPixels[0]);
+    _atlasDirty = false;
+  }
+
+  // Draws the rows built by buildVertices() and the cursor over them, a draw call for
+  // each row moved to its place
+  static void drawFrame(Frame const& frame)
+  {
+    const bool cursorVisible = frame.cursor.x >= 0 && frame.cursor.y >= 0 && _cursorBlinkVisible;
+
+    _vertices.clear();
+    if (cursorVisible)
+      addSolidQuad(_vertices, _fontAdvance * frame.cursor.x, _fontLineHeight * frame.cursor.y, 1, _fontLineHeight, colorFromEnum(COLOR_WHITE));
+
+    glBindTexture(GL_TEXTURE_2D, _atlasTexture);
+    if (_atlasDirty)
+      uploadAtlas();
+
+    const Color background = colorFromEnum(COLOR_BACKGROUND);
+    glClearColor(background.r / 255.0f, background.g / 255.0f, background.b / 255.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
 
-    glViewport(0, 0, windowWidth, windowHeight);
+    glViewport(0, 0, frame.windowWidth, frame.windowHeight);
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
-    glOrtho(0.0, windowWidth, windowHeight, 0.0, 1.0, -1.0);
+    glOrtho(0.0, frame.windowWidth, frame.windowHeight, 0.0, 1.0, -1.0);
     glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
 
-    glBindTexture(GL_TEXTURE_2D, _canvasTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, _canvas->w, _canvas->h, 0, GL_BGRA, GL_UNSIGNED_BYTE, _canvas->pixels);
+    // Backgrounds go first so glyphs reaching into the next row blend over it
+    for (int pass = 0; pass < 2; ++pass)
+      for (std::size_t y = 0; y < _rows.size(); ++y)
+      {
+        std::vector<Vertex> const& vertices = pass == 0 ? _rows[y].backgrounds : _rows[y].glyphs;
+        if (vertices.empty())
+          continue;
+
+        glLoadIdentity();
+        glTranslatef(0.0f, (float)(y * _fontLineHeight), 0.0f);
+        drawVertices(vertices);
+      }
 
-    glBegin(GL_QUADS);
-      glTexCoord2f(0.0f, 0.0f); glVertex2f(0.0f, 0.0f);
-      glTexCoord2f(1.0f, 0.0f); glVertex2f(windowWidth, 0.0f);
-      glTexCoord2f(1.0f, 1.0f); glVertex2f(windowWidth, windowHeight);
-      glTexCoord2f(0.0f, 1.0f); glVertex2f(0.0f, windowHeight);
-    glEnd();
+    glLoadIdentity();
+    if (!_vertices.empty())
+      drawVertices(_vertices);
 
     glfwSwapBuffers(_window);
   }
 
+  static void initRenderer()
+  {
+    glfwMakeContextCurrent(_window);
+
+    glEnable(GL_TEXTURE_2D);
+    glGenTextures(1, &_atlasTexture);
+    glBindTexture(GL_TEXTURE_2D, _atlasTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+  }
+
+  // Draws every frame present() hands over and blinks the cursor, so neither waits for
+  // the main thread to be done with input, scripts or recalculation
+  static void renderLoop()
+  {
+    initRenderer();
+
+    Frame const* frame = nullptr;
+    uint32_t builtSerial = 0;
+
+    std::unique_lock<std::mutex> lock(_frameMutex);
+
+    while (!_stopRendering)
+    {
+      if (!_framePending && !_blinkReset)
+      {
+        if (frame && frame->blinkInterval > 0.0)
+          _frameReady.wait_for(lock, std::chrono::duration<double>(std::max(_nextBlink - glfwGetTime(), 0.0)));
+        else
+          _frameReady.wait(lock);
+      }
+
+      if (_stopRendering)
+        break;
+
+      bool draw = false;
+      if (_framePending)
+      {
+        std::swap(_readFrame, _pendingFrame);
+        _framePending = false;
+        frame = &_frames[_readFrame];
+        draw = true;
+      }
+
+      const bool blinkReset = _blinkReset;
+      _blinkReset = false;
+
+      lock.unlock();
+
+      if (frame)
+      {
+        const bool hasCursor = frame->cursor.x >= 0 && frame->cursor.y >= 0;
+        const double now = glfwGetTime();
+
+        // Input shows the cursor and restarts blinking
+        if (blinkReset || frame->blinkInterval <= 0.0)
+        {
+          draw |= hasCursor && !_cursorBlinkVisible;
+          _cursorBlinkVisible = true;
+          _nextBlink = now + frame->blinkInterval;
+        }
+        else if (now >= _nextBlink)
+        {
+          _cursorBlinkVisible = !_cursorBlinkVisible;
+          _nextBlink = now + frame->blinkInterval;
+          draw |= hasCursor;
+        }
+
+        // Building the vertices may rasterize new glyphs into the atlas
+        if (frame->serial != builtSerial)
+        {
+          buildVertices(*frame);
+          builtSerial = frame->serial;
+        }
+
+        if (draw)
+          drawFrame(*frame);
+
+        // The atlas texture is counted once more for its copy on the GPU
+        std::size_t bytes = 2 * _atlasPixels.capacity() + _vertices.capacity() * sizeof(Vertex) +
+                            _slotGlyphs.size() * (sizeof(SlotGlyph) + 4 * sizeof(void *)) + _slotGlyphs.bucket_count() * sizeof(void *) +
+                            _lastRowsByHash.size() * (sizeof(uint64_t) + sizeof(int) + 2 * sizeof(void *)) + _lastRowsByHash.bucket_count() * sizeof(void *);
+
+        for (std::vector<GridRow> const* rows : {&_rows, &_lastRows})
+          for (GridRow const& row : *rows)
+            bytes += sizeof(GridRow) + row.cells.capacity() * sizeof(Cell) + (row.backgrounds.capacity() + row.glyphs.capacity()) * sizeof(Vertex);
+
+        _renderBytes = bytes;
+      }
+
+      lock.lock();
+    }
+
+    lock.unlock();
+
+    glDeleteTextures(1, &_atlasTexture);
+    _atlasTexture = 0;
+    glfwMakeContextCurrent(nullptr);
+  }
+
+  void present()
+  {
+    // The render thread keeps the vertices of rows it already built, even when they
+    // scrolled, so here it is only worth skipping a frame identical to the one on screen
+    bool changed = _fullRedraw || _presentedCells.size() != _cells.size();
+    for (std::size_t i = 0; i < _cells.size() && !changed; ++i)
+    {
+      Cell const& cell = _cells[i];
+      Cell const& presented = _presentedCells[i];
+      changed = cell.ch != presented.ch || cell.fg != presented.fg || cell.bg != presented.bg;
+    }
+
+    if (!changed && _cursor == _presentedCursor)
+      return;
+
+    if (changed)
+    {
+      _presentedCells = _cells;
+      _fullRedraw = false;
+      ++_cellSerial;
+    }
+
+    _presentedCursor = _cursor;
+
+    Frame & frame = _frames[_writeFrame];
+    frame.cells = _cells;
+    frame.width = _width;
+    frame.height = _height;
+    glfwGetWindowSize(_window, &frame.windowWidth, &frame.windowHeight);
+    frame.cursor = _cursor;
+    frame.blinkInterval = BLINK_RATE.toInt() / 1000.0;
+    frame.serial = _cellSerial;
+
+    {
+      std::lock_guard<std::mutex> lock(_frameMutex);
+      std::swap(_writeFrame, _pendingFrame);
+      _framePending = true;
+    }
+
+    _frameReady.notify_one();
+  }
+
+  // Shows the cursor and restarts blinking, after input
+  static void resetBlink()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_frameMutex);
+      _blinkReset = true;
+    }
+
+    _frameReady.notify_one();
+  }
+
   inline Keys glfwToCtrl(int symb)
   {
     switch (symb)
@@ -367,15 +832,13 @@ namespace view {
       if (k != KEY_NONE)
         _eventQueue.push_back(Event {EVENT_KEY, k, 0});
 
-      _cursorBlinkVisible = true;
-      _cursorBlinkTimeout = 0;
+      resetBlink();
     }
   }
 
   static void inputCallback(GLFWwindow * window, unsigned int codePoint)
   {
-    _cursorBlinkVisible = true;
-    _cursorBlinkTimeout = 0;
+    resetBlink();
     _eventQueue.push_back(Event {EVENT_KEY, KEY_NONE, (uint32_t)codePoint});
   }
 
@@ -400,9 +863,7 @@ namespace view {
     if (_height == 0) _height = 1;
 
     _cells.resize(_width * _height);
-
-    sr_destroyBuffer(_canvas);
-    _canvas = sr_newBuffer(width, height);
+    _fullRedraw = true;
   }
 
   void waitEvent(Event * event)
@@ -412,59 +873,205 @@ namespace view {
     {
       glfwPollEvents();
       *event = _eventQueue.front();
-      _eventQueue.erase(_eventQueue.begin());
+      _eventQueue.pop_front();
       return;
     }
 
+    // Sleep until there is input, the render thread blinks the cursor meanwhile
     while (_eventQueue.size() == 0)
     {
-      glfwWaitEventsTimeout(0.01);
+      glfwWaitEvents();
 
       if (glfwWindowShouldClose(_window))
       {
         Event e = {EVENT_QUIT, KEY_NONE, 0};
         _eventQueue.push_back(e);
       }
+    }
 
-      _cursorBlinkTimeout += 10;
-      if (_cursorBlinkTimeout > BLINK_RATE.toInt())
-      {
-        _cursorBlinkVisible = !_cursorBlinkVisible;
-        _cursorBlinkTimeout = 0;
-        present();
-      }
+    *event = _eventQueue.front();
+    _eventQueue.pop_front();
+  }
+
+  bool waitEvent(Event * event, int timeout)
+  {
+    if (_eventQueue.size() > 0 || timeout <= 0)
+      glfwPollEvents();
+    else
+      glfwWaitEventsTimeout(timeout / 1000.0);
+
+    if (glfwWindowShouldClose(_window))
+    {
+      Event e = {EVENT_QUIT, KEY_NONE, 0};
+      _eventQueue.push_back(e);
     }
 
+    if (_eventQueue.size() == 0)
+      return false;
+
     *event = _eventQueue.front();
-    _eventQueue.erase(_eventQueue.begin());
+    _eventQueue.pop_front();
+    return true;
   }
 
-  static void initGlyph(int ch)
+  // Commands typed on the command line run on a thread of their own, they get nothing
+  std::string clipboard()
   {
-    Glyph glyph;
+    const char * text = _window && std::this_thread::get_id() == _mainThread ? glfwGetClipboardString(_window) : nullptr;
+    return text ? std::string(text) : std::string();
+  }
+
+  // The atlas, the glyph slots and the vertices belong to the render thread, it reports
+  // their size after each frame
+  std::size_t memoryUsage()
+  {
+    std::size_t bytes = sizeof(_denseGlyphs) + _renderBytes;
+    bytes += (_cells.capacity() + _presentedCells.capacity()) * sizeof(Cell);
+
+    for (Frame const& frame : _frames)
+      bytes += frame.cells.capacity() * sizeof(Cell);
+
+    return bytes;
+  }
+
+  static void initAtlas()
+  {
+    _atlasHeight = ATLAS_INITIAL_HEIGHT;
+    _atlasPixels.assign(ATLAS_WIDTH * _atlasHeight, 0);
+
+    // Solid block used for backgrounds and the cursor
+    for (int y = 0; y < 3; ++y)
+      for (int x = 0; x < 3; ++x)
+        _atlasPixels[y * ATLAS_WIDTH + x] = 255;
+
+    _atlasPenX = 3 + ATLAS_PADDING;
+    _atlasPenY = 0;
+    _atlasRowHeight = 3;
+    _atlasDirty = true;
+  }
+
+  static void copyBitmap(const unsigned char * pixels, int pitch, int width, int height, int atlasX, int atlasY)
+  {
+    for (int y = 0; y < height; ++y)
+      for (int x = 0; x < width; ++x)
+        _atlasPixels[(atlasY + y) * ATLAS_WIDTH + atlasX + x] = pixels[y * pitch + x];
+
+    _atlasDirty = true;
+  }
+
+  // Shelf packs a dense glyph, these never leave the atlas
+  static void packGlyph(int ch)
+  {
+    Glyph & glyph = _denseGlyphs[ch];
     int width, height;
 
     unsigned char * pixels = stbtt_GetCodepointBitmap(&_font, _fontScale, _fontScale, ch, &width, &height, &glyph.x, &glyph.y);
 
     // Ignore the whitespace character
-    if (ch != 32)
+    if (ch != 32 && pixels && width > 0 && height > 0 && width <= ATLAS_WIDTH)
     {
-      glyph.surface = sr_newBuffer(width, height);
+      // Simple shelf packing, start a new row when this one is full
+      if (_atlasPenX + width > ATLAS_WIDTH)
+      {
+        _atlasPenX = 0;
+        _atlasPenY += _atlasRowHeight + ATLAS_PADDING;
+        _atlasRowHeight = 0;
+      }
 
-      for (int y = 0; y < height; ++y)
-        for (int x = 0; x < width; ++x)
-        {
-          const int idx = y * width + x;
-          glyph.surface->pixels[idx] = sr_pixel(255, 255, 255, pixels[idx]);
-        }
+      // Grow the atlas downwards, the texture coordinates are computed per frame so nothing moves
+      while (_atlasPenY + height > _atlasHeight)
+      {
+        _atlasHeight *= 2;
+        _atlasPixels.resize(ATLAS_WIDTH * _atlasHeight, 0);
+      }
+
+      copyBitmap(pixels, width, width, height, _atlasPenX, _atlasPenY);
+
+      glyph.width = width;
+      glyph.height = height;
+      glyph.atlasX = _atlasPenX;
+      glyph.atlasY = _atlasPenY;
+
+      _atlasPenX += width + ATLAS_PADDING;
+      if (height > _atlasRowHeight)
+        _atlasRowHeight = height;
+    }
+
+    stbtt_FreeBitmap(pixels, nullptr);
+  }
+
+  // Reserves the slots below the dense glyphs, so the atlas does not grow afterwards
+  static void initSlots()
+  {
+    _slotSize = std::max(_fontLineHeight, 2 * _fontAdvance);
+    _slotColumns = std::max(ATLAS_WIDTH / (_slotSize + ATLAS_PADDING), 1);
+    _slotTop = _atlasPenY + _atlasRowHeight + ATLAS_PADDING;
+    _slotCapacity = std::max(GLYPH_CACHE_SIZE.toInt(), 1);
+
+    const int rows = (_slotCapacity + _slotColumns - 1) / _slotColumns;
+    while (_slotTop + rows * (_slotSize + ATLAS_PADDING) > _atlasHeight)
+      _atlasHeight *= 2;
+
+    _atlasPixels.resize(ATLAS_WIDTH * _atlasHeight, 0);
+    _slotGlyphs.clear();
+    _slotGlyphUse.clear();
+  }
+
+  // Rasterizes ch into slot, clipped to the slot size
+  static Glyph rasterizeSlot(int ch, int slot)
+  {
+    Glyph glyph;
+    glyph.atlasX = (slot % _slotColumns) * (_slotSize + ATLAS_PADDING);
+    glyph.atlasY = _slotTop + (slot / _slotColumns) * (_slotSize + ATLAS_PADDING);
+
+    // Clear what the previous owner left behind
+    for (int y = 0; y < _slotSize; ++y)
+      std::fill_n(&_atlasPixels[(glyph.atlasY + y) * ATLAS_WIDTH + glyph.atlasX], _slotSize, 0);
+
+    int width, height;
+    unsigned char * pixels = stbtt_GetCodepointBitmap(&_font, _fontScale, _fontScale, ch, &width, &height, &glyph.x, &glyph.y);
+
+    if (pixels && width > 0 && height > 0)
+    {
+      glyph.width = std::min(width, _slotSize);
+      glyph.height = std::min(height, _slotSize);
+      copyBitmap(pixels, width, glyph.width, glyph.height, glyph.atlasX, glyph.atlasY);
     }
 
     stbtt_FreeBitmap(pixels, nullptr);
+    return glyph;
+  }
+
+  // A frame can show at most view_glyphCacheSize glyphs outside Latin-1, more than that
+  // and the ones drawn first are overwritten by the ones drawn last
+  static Glyph const& findGlyph(int ch)
+  {
+    if (ch >= 0 && ch < DENSE_GLYPHS)
+      return _denseGlyphs[ch];
+
+    auto it = _slotGlyphs.find(ch);
+    if (it != _slotGlyphs.end())
+    {
+      _slotGlyphUse.splice(_slotGlyphUse.begin(), _slotGlyphUse, it->second.use);
+      return it->second.glyph;
+    }
+
+    int slot = _slotGlyphs.size();
+    if (slot >= _slotCapacity)
+    {
+      auto evicted = _slotGlyphs.find(_slotGlyphUse.back());
+      slot = evicted->second.slot;
+      _slotGlyphs.erase(evicted);
+      _slotGlyphUse.pop_back();
+    }
 
-    if (ch >= _glyphCache.size())
-      _glyphCache.resize(ch + 1);
+    _slotGlyphUse.push_front(ch);
 
-    _glyphCache[ch] = glyph;
+    SlotGlyph & entry = _slotGlyphs[ch];
+    entry.glyph = rasterizeSlot(ch, slot);
+    entry.slot = slot;
+    entry.use = _slotGlyphUse.begin();
+    return entry.glyph;
   }
 
   static bool initializeFont()
@@ -487,10 +1094,17 @@ namespace view {
     _fontLineHeight = (ascent - decent + lineGap) * _fontScale + _fontLinePadding;
     _fontAdvance = advance * _fontScale;
 
-    // Initialize some default glyphs
-    const Str DEFAULT_GLYPHS(" 0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ,.-;:()=+-*/!\"'#$%&{[]}<>|~");
-    for (auto ch : DEFAULT_GLYPHS)
-      initGlyph(ch);
+    initAtlas();
+
+    // Rasterize ASCII and Latin-1 in one pass, the atlas is uploaded once on the first frame
+    for (int ch = 0; ch < DENSE_GLYPHS; ++ch)
+    {
+      _denseGlyphs[ch] = Glyph();
+      if (ch >= 32 && (ch < 127 || ch >= 160))
+        packGlyph(ch);
+    }
+
+    initSlots();
 
     return true;
   }
@@ -0,0 +1,96 @@
+#include "View.h"
+
+// View that draws nothing and never has events, for running the editor without a
+// terminal or window. The size is fixed, so drawing always covers the same cells.
+namespace view {
+
+  static const int WIDTH = 200;
+  static const int HEIGHT = 60;
+
+  bool init(int, int, const char *)
+  {
+    return true;
+  }
+
+  void shutdown()
+  { }
+
+  bool serve(const char *, int, int)
+  {
+    return false;
+  }
+
+  int attach(const char *)
+  {
+    return 1;
+  }
+
+  bool detachClient()
+  {
+    return false;
+  }
+
+  std::vector<ClientStats> clientStats()
+  {
+    return std::vector<ClientStats>();
+  }
+
+  std::size_t queuedEvents()
+  {
+    return 0;
+  }
+
+  int width()
+  {
+    return WIDTH;
+  }
+
+  int height()
+  {
+    return HEIGHT;
+  }
+
+  void setCursor(int, int)
+  { }
+
+  void hideCursor()
+  { }
+
+  void setClearAttributes(uint16_t, uint16_t)
+  { }
+
+  void changeCell(int, int, uint32_t, uint16_t, uint16_t)
+  { }
+
+  void clear()
+  { }
+
+  void present()
+  { }
+
+  void waitEvent(Event * event)
+  {
+    event->type = EVENT_QUIT;
+  }
+
+  bool waitEvent(Event * event, int)
+  {
+    event->type = EVENT_QUIT;
+    return true;
+  }
+
+  std::string clipboard()
+  {
+    return std::string();
+  }
+
+  std::size_t memoryUsage()
+  {
+    return 0;
+  }
+}
+
+// Editor.cpp lets the main loop know an event cleared the timeout, there is no loop
+// without a view
+void clearTimeout()
+{ }
@@ -1,71 +1,899 @@
-
 #include "View.h"
+#include "Remote.h"
+#include "Metrics.h"
+#include "Tcl.h"
 
 #include "termbox.h"
 
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+
+// Terminal view. Drawing goes into a shadow grid, and present() only hands termbox
+// the cells that differ from the frame on screen. A frame that matches it is not
+// presented at all, so keys that change nothing send nothing to the terminal.
+//
+// A served view has no terminal of its own. The frames go to the clients attached to
+// its socket instead, what differs from the last one or all of it to a client that
+// just attached, and the keys typed into any of them are its events. What a frame
+// sends depends on how much of the screen changed, never on the document. A client
+// that hasn't taken the last frame yet gets none until it did, and then the whole
+// screen once, so a slow link skips frames instead of falling behind.
+//
+// With view_scrollRegions set, a frame whose rows are those on screen moved up or down
+// scrolls them in the terminal and only draws the rows that scrolled in and the ones
+// around them that changed. Not every terminal knows scroll regions, so it is off by
+// default. Served views send their frames to clients, which don't scroll.
 namespace view {
 
-  bool init(int preferredWidth, int preferredHeight, const char * title)
+  static const tcl::Variable SCROLL_REGIONS("view_scrollRegions", false);
+
+  // Messages between a served view and its clients
+  enum MessageType : uint8_t
+  {
+    MESSAGE_SIZE = 1,     // client, width and height of its terminal
+    MESSAGE_KEYS = 2,     // client, the KeyMessages typed since it last sent any
+    MESSAGE_FRAME = 3     // server, a FrameHeader and the cells as FrameOps
+  };
+
+  // The cells of a frame are a stream of operations on a position that starts at the
+  // top left cell, each a byte and its arguments. Counts and characters are varints.
+  enum FrameOp : uint8_t
   {
-      int result = tb_init();
-      return (bool)result;
+    OP_SKIP = 0,          // count, the cells stay as they are
+    OP_ATTRIBUTES = 1,    // fg and bg, 16 bits each, of the cells that follow
+    OP_TEXT = 2,          // count and that many characters
+    OP_REPEAT = 3         // count and a character, repeated
+  };
+
+  // Runs of the same character at least this long are repeated instead of sent as text
+  static const std::size_t MIN_REPEAT = 4;
+
+  struct SizeMessage
+  {
+    uint16_t width;
+    uint16_t height;
+  };
+
+  struct KeyMessage
+  {
+    uint32_t key;
+    uint32_t ch;
+  };
+
+  struct FrameHeader
+  {
+    uint16_t width;
+    uint16_t height;
+    int16_t cursorX;
+    int16_t cursorY;
+    uint16_t clearForeground;
+    uint16_t clearBackground;
+    uint32_t full;        // the cells cover the frame, what is outside it is cleared
+  };
+
+  // A client looks for frames this often while no keys are typed
+  static const int ATTACH_POLL_INTERVAL = 10;
+
+  // Size of a served view until a client attaches
+  static const int SERVED_MAX_SIZE = 1024;
+
+  struct Cell
+  {
+    uint32_t ch;
+    uint16_t fg;
+    uint16_t bg;
+
+    bool operator == (Cell const& other) const
+    {
+      return ch == other.ch && fg == other.fg && bg == other.bg;
+    }
+  };
+
+  static int _width = 0;
+  static int _height = 0;
+
+  static uint16_t _clearForeground = COLOR_DEFAULT;
+  static uint16_t _clearBackground = COLOR_DEFAULT;
+
+  static std::vector<Cell> _cells;
+  static int _cursorX = -1;
+  static int _cursorY = -1;
+
+  // What was last presented, termbox still holds it in its back buffer
+  static std::vector<Cell> _presentedCells;
+  static int _presentedCursorX = -1;
+  static int _presentedCursorY = -1;
+  static bool _fullRedraw = true;
+
+  struct Client
+  {
+    std::unique_ptr<remote::Connection> connection;
+    uint64_t id = 0;
+    int width = 0;
+    int height = 0;
+    bool synced = false;    // it shows the presented frame, or will once it took its output
+    uint64_t frames = 0;
+  };
+
+  static bool _serving = false;
+  static remote::Listener _listener;
+  static std::vector<Client> _clients;
+  static uint64_t _lastClientId = 0;
+
+  // Events of the clients not handed out yet, and the client of each
+  static std::deque<Event> _events;
+  static std::deque<remote::Connection *> _eventClients;
+  static remote::Connection * _lastEventClient = nullptr;
+
+  static volatile std::sig_atomic_t _stopServing = 0;
+
+  static void setSize(int width, int height)
+  {
+    _width = width;
+    _height = height;
+
+    _cells.assign(_width * _height, Cell { ' ', _clearForeground, _clearBackground });
+    _presentedCells.clear();
+    _fullRedraw = true;
+  }
+
+  static void resize()
+  {
+    setSize(tb_width(), tb_height());
+  }
+
+  // A served view is as large as the smallest client, it keeps its size while none is attached
+  static bool resizeServed()
+  {
+    int width = SERVED_MAX_SIZE;
+    int height = SERVED_MAX_SIZE;
+    bool sized = false;
+
+    for (Client const& client : _clients)
+    {
+      if (client.width <= 0 || client.height <= 0)
+        continue;
+
+      width = std::min(width, client.width);
+      height = std::min(height, client.height);
+      sized = true;
+    }
+
+    if (!sized || (width == _width && height == _height))
+      return false;
+
+    setSize(width, height);
+    return true;
+  }
+
+  std::vector<ClientStats> clientStats()
+  {
+    std::vector<ClientStats> stats;
+    for (Client const& client : _clients)
+    {
+      remote::Connection const& connection = *client.connection;
+      stats.push_back(ClientStats { client.id, client.width, client.height, client.frames,
+                                    connection.bytesSent(), connection.bytesReceived(), connection.queuedBytes() });
+    }
+
+    return stats;
+  }
+
+  std::size_t queuedEvents()
+  {
+    return _events.size();
+  }
+
+  static void stopServing(int)
+  {
+    _stopServing = 1;
+  }
+
+  bool init(int, int, const char *)
+  {
+    if (tb_init() != 0)
+      return false;
+
+    resize();
+    return true;
   }
 
   void shutdown()
   {
-    tb_shutdown();
+    if (!_serving)
+    {
+      tb_shutdown();
+      return;
+    }
+
+    _clients.clear();
+    _listener.close();
+    metrics::close();
+    _serving = false;
+  }
+
+  bool serve(const char * path, int preferredWidth, int preferredHeight)
+  {
+    if (!_listener.listen(path))
+      return false;
+
+    // Clients that go away mid frame are noticed when writing to them fails
+    std::signal(SIGPIPE, SIG_IGN);
+
+    // The server is stopped the way daemons are, its clients only detach
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stopServing;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    sigaction(SIGHUP, &action, nullptr);
+
+    _serving = true;
+    setSize(preferredWidth, preferredHeight);
+    return true;
+  }
+
+  bool detachClient()
+  {
+    if (!_serving)
+      return false;
+
+    for (auto it = _clients.begin(); it != _clients.end(); ++it)
+    {
+      if (it->connection.get() != _lastEventClient)
+        continue;
+
+      // Its keys that are still waiting go with it
+      for (std::size_t i = 0; i < _eventClients.size(); )
+      {
+        if (_eventClients[i] == _lastEventClient)
+        {
+          _events.erase(_events.begin() + i);
+          _eventClients.erase(_eventClients.begin() + i);
+        }
+        else
+          ++i;
+      }
+
+      _clients.erase(it);
+      resizeServed();
+      break;
+    }
+
+    _lastEventClient = nullptr;
+    return true;
   }
 
   void setCursor(int x, int y)
   {
-    tb_set_cursor(x, y);
+    _cursorX = x;
+    _cursorY = y;
   }
 
   void hideCursor()
   {
-    tb_set_cursor(-1, -1);
+    setCursor(-1, -1);
   }
 
   void setClearAttributes(uint16_t fg, uint16_t bg)
   {
-    tb_set_clear_attributes(fg, bg);
+    _clearForeground = fg;
+    _clearBackground = bg;
+
+    if (!_serving)
+      tb_set_clear_attributes(fg, bg);
   }
 
   void changeCell(int x, int y, uint32_t ch, uint16_t fg, uint16_t bg)
   {
-    tb_change_cell(x, y, ch, fg, bg); 
+    if (x < 0 || x >= _width || y < 0 || y >= _height)
+      return;
+
+    _cells[y * _width + x] = Cell { ch, fg, bg };
   }
 
   int width()
   {
-    return tb_width();
+    return _width;
   }
 
   int height()
   {
-    return tb_height();
+    return _height;
   }
 
   void clear()
   {
-    tb_clear();
+    for (auto & cell : _cells)
+      cell = Cell { ' ', _clearForeground, _clearBackground };
+  }
+
+  static void putVarint(std::vector<char> & out, uint32_t value)
+  {
+    while (value >= 0x80)
+    {
+      out.push_back((char)(value | 0x80));
+      value >>= 7;
+    }
+
+    out.push_back((char)value);
+  }
+
+  static bool getVarint(const char *& it, const char * end, uint32_t & value)
+  {
+    value = 0;
+    for (int shift = 0; it < end && shift < 35; shift += 7)
+    {
+      const uint8_t byte = *it++;
+      value |= (uint32_t)(byte & 0x7F) << shift;
+
+      if ((byte & 0x80) == 0)
+        return true;
+    }
+
+    return false;
+  }
+
+  // Appends the cells that differ from previous, all of them without it
+  static void encodeCells(std::vector<char> & out, std::vector<Cell> const& cells, std::vector<Cell> const* previous)
+  {
+    uint32_t skipped = 0;
+    bool attributesSent = false;
+    uint16_t fg = 0;
+    uint16_t bg = 0;
+
+    for (std::size_t i = 0; i < cells.size(); )
+    {
+      if (previous && cells[i] == (*previous)[i])
+      {
+        ++skipped;
+        ++i;
+        continue;
+      }
+
+      if (skipped > 0)
+      {
+        out.push_back(OP_SKIP);
+        putVarint(out, skipped);
+        skipped = 0;
+      }
+
+      if (!attributesSent || cells[i].fg != fg || cells[i].bg != bg)
+      {
+        fg = cells[i].fg;
+        bg = cells[i].bg;
+        attributesSent = true;
+
+        out.push_back(OP_ATTRIBUTES);
+        out.insert(out.end(), (const char *)&fg, (const char *)&fg + sizeof(fg));
+        out.insert(out.end(), (const char *)&bg, (const char *)&bg + sizeof(bg));
+      }
+
+      // The changed cells with these attributes
+      std::size_t end = i + 1;
+      while (end < cells.size() && cells[end].fg == fg && cells[end].bg == bg && !(previous && cells[end] == (*previous)[end]))
+        ++end;
+
+      while (i < end)
+      {
+        std::size_t repeat = i + 1;
+        while (repeat < end && cells[repeat].ch == cells[i].ch)
+          ++repeat;
+
+        if (repeat - i >= MIN_REPEAT)
+        {
+          out.push_back(OP_REPEAT);
+          putVarint(out, repeat - i);
+          putVarint(out, cells[i].ch);
+          i = repeat;
+          continue;
+        }
+
+        // Text up to the next run worth repeating
+        std::size_t text = i;
+        std::size_t same = 0;
+        while (text < end && same + 1 < MIN_REPEAT)
+        {
+          same = text > i && cells[text].ch == cells[text - 1].ch ? same + 1 : 0;
+          ++text;
+        }
+
+        if (same + 1 >= MIN_REPEAT)
+          text -= same + 1;
+
+        out.push_back(OP_TEXT);
+        putVarint(out, text - i);
+        for (; i < text; ++i)
+          putVarint(out, cells[i].ch);
+      }
+    }
+  }
+
+  static void sendFrame(Client & client, std::vector<Cell> const& cells, std::vector<Cell> const* previous)
+  {
+    FrameHeader header;
+    header.width = _width;
+    header.height = _height;
+    header.cursorX = _cursorX;
+    header.cursorY = _cursorY;
+    header.clearForeground = _clearForeground;
+    header.clearBackground = _clearBackground;
+    header.full = previous ? 0 : 1;
+
+    std::vector<char> message((const char *)&header, (const char *)&header + sizeof(header));
+    encodeCells(message, cells, previous);
+
+    client.connection->send(MESSAGE_FRAME, message.data(), message.size());
+    client.synced = true;
+    client.frames++;
+  }
+
+  static void presentServed()
+  {
+    const bool changed = _fullRedraw || _cells != _presentedCells || _cursorX != _presentedCursorX || _cursorY != _presentedCursorY;
+
+    for (auto it = _clients.begin(); it != _clients.end(); )
+    {
+      // A client that is behind catches up with a whole frame once it took its output,
+      // one that didn't send its size yet gets nothing
+      if (it->width <= 0 || it->connection->hasOutput())
+        it->synced = false;
+      else if (!it->synced || _fullRedraw)
+        sendFrame(*it, _cells, nullptr);
+      else if (changed)
+        sendFrame(*it, _cells, &_presentedCells);
+
+      if (it->connection->flush())
+      {
+        ++it;
+        continue;
+      }
+
+      if (_lastEventClient == it->connection.get())
+        _lastEventClient = nullptr;
+
+      it = _clients.erase(it);
+    }
+
+    _presentedCells = _cells;
+    _presentedCursorX = _cursorX;
+    _presentedCursorY = _cursorY;
+    _fullRedraw = false;
+  }
+
+  static bool sameRow(std::vector<Cell> const& cells, int y, std::vector<Cell> const& other, int otherY)
+  {
+    return std::equal(cells.begin() + y * _width, cells.begin() + (y + 1) * _width, other.begin() + otherY * _width);
+  }
+
+  static uint64_t rowHash(std::vector<Cell> const& cells, int y)
+  {
+    uint64_t hash = 14695981039346656037ull;
+    for (int x = y * _width; x < (y + 1) * _width; ++x)
+    {
+      hash = (hash ^ cells[x].ch) * 1099511628211ull;
+      hash = (hash ^ (((uint32_t)cells[x].fg << 16) | cells[x].bg)) * 1099511628211ull;
+    }
+
+    return hash;
+  }
+
+  // The rows between the first and the last that changed are taken as a region that
+  // scrolled by the distance most of its rows moved, found by looking up every new row
+  // among the old ones. The terminal is scrolled if more than half the region then stays
+  // as it is, the rows around the cursor or with a changed row number just don't.
+  static void scrollTerminal()
+  {
+    static std::unordered_map<uint64_t, int> presentedRows;
+    static std::vector<int> votes;
+
+    int top = 0;
+    while (top < _height && sameRow(_cells, top, _presentedCells, top))
+      ++top;
+
+    int bottom = _height - 1;
+    while (bottom > top && sameRow(_cells, bottom, _presentedCells, bottom))
+      --bottom;
+
+    const int rows = bottom - top + 1;
+    if (rows < 3)
+      return;
+
+    presentedRows.clear();
+    for (int y = top; y <= bottom; ++y)
+      presentedRows.emplace(rowHash(_presentedCells, y), y);
+
+    // Votes for the distances from -rows to rows, up is positive
+    votes.assign(2 * rows + 1, 0);
+    for (int y = top; y <= bottom; ++y)
+    {
+      auto it = presentedRows.find(rowHash(_cells, y));
+      if (it != presentedRows.end() && it->second != y)
+        ++votes[it->second - y + rows];
+    }
+
+    const int lines = (int)(std::max_element(votes.begin(), votes.end()) - votes.begin()) - rows;
+    if (lines == 0)
+      return;
+
+    int matches = 0;
+    for (int y = std::max(top, top - lines); y <= std::min(bottom, bottom - lines); ++y)
+      if (sameRow(_cells, y, _presentedCells, y + lines))
+        ++matches;
+
+    if (matches * 2 > rows)
+      tb_scroll(top, bottom, lines);
   }
 
   void present()
   {
+    if (_serving)
+    {
+      presentServed();
+      return;
+    }
+
+    if (!_fullRedraw && SCROLL_REGIONS.toBool())
+      scrollTerminal();
+
+    bool changed = _fullRedraw || _cursorX != _presentedCursorX || _cursorY != _presentedCursorY;
+
+    for (std::size_t i = 0; i < _cells.size(); ++i)
+    {
+      if (!_fullRedraw && _cells[i] == _presentedCells[i])
+        continue;
+
+      Cell const& cell = _cells[i];
+      tb_change_cell(i % _width, i / _width, cell.ch, cell.fg, cell.bg);
+      changed = true;
+    }
+
+    if (!changed)
+      return;
+
+    tb_set_cursor(_cursorX, _cursorY);
     tb_present();
+
+    _presentedCells = _cells;
+    _presentedCursorX = _cursorX;
+    _presentedCursorY = _cursorY;
+    _fullRedraw = false;
+  }
+
+  static bool translateEvent(int result, struct tb_event const& tbEvent, Event * event)
+  {
+    switch (result)
+    {
+      case TB_EVENT_KEY:
+        event->type = EVENT_KEY;
+        event->key = (Keys)tbEvent.key;
+        event->ch = tbEvent.ch;
+        return true;
+
+      // Termbox cleared its buffers, everything has to be drawn again
+      case TB_EVENT_RESIZE:
+        resize();
+        event->type = EVENT_RESIZE;
+        event->key = KEY_NONE;
+        event->ch = 0;
+        return true;
+
+      default:
+        event->type = EVENT_NONE;
+        return false;
+    }
   }
 
-  bool peekEvent(Event * event, int timeout)
+  static void pushEvent(EventType type, Keys key, uint32_t ch, remote::Connection * client)
   {
+    _events.push_back(Event { type, key, ch });
+    _eventClients.push_back(client);
+  }
+
+  // Reads what the clients sent and lets in the ones that connected
+  static void updateClients()
+  {
+    while (std::unique_ptr<remote::Connection> connection = _listener.accept())
+    {
+      _clients.emplace_back();
+      _clients.back().connection = std::move(connection);
+      _clients.back().id = ++_lastClientId;
+    }
+
+    std::vector<char> data;
+    for (auto it = _clients.begin(); it != _clients.end(); )
+    {
+      remote::Connection * connection = it->connection.get();
+
+      const bool connected = connection->receive() && connection->flush();
+
+      // The presented frame is still what the screen shows
+      if (connected && !it->synced && it->width > 0 && !it->connection->hasOutput() && !_presentedCells.empty())
+      {
+        sendFrame(*it, _presentedCells, nullptr);
+        connection->flush();
+      }
+
+      uint8_t type = 0;
+      while (connection->nextMessage(type, data))
+      {
+        if (type == MESSAGE_SIZE && data.size() == sizeof(SizeMessage))
+        {
+          SizeMessage size;
+          memcpy(&size, data.data(), sizeof(size));
+
+          it->width = size.width;
+          it->height = size.height;
+
+          // Everything is drawn again, the first frame of a new client too
+          resizeServed();
+          it->synced = false;
+          pushEvent(EVENT_RESIZE, KEY_NONE, 0, connection);
+        }
+        else if (type == MESSAGE_KEYS && data.size() % sizeof(KeyMessage) == 0)
+        {
+          for (std::size_t i = 0; i < data.size(); i += sizeof(KeyMessage))
+          {
+            KeyMessage key;
+            memcpy(&key, data.data() + i, sizeof(key));
+            pushEvent(EVENT_KEY, (Keys)key.key, key.ch, connection);
+          }
+        }
+      }
+
+      if (connected)
+      {
+        ++it;
+        continue;
+      }
+
+      // Its keys that arrived are still handled
+      for (auto & client : _eventClients)
+        if (client == connection)
+          client = nullptr;
+
+      if (_lastEventClient == connection)
+        _lastEventClient = nullptr;
+
+      it = _clients.erase(it);
+
+      if (resizeServed())
+        pushEvent(EVENT_RESIZE, KEY_NONE, 0, nullptr);
+    }
+  }
+
+  static bool popEvent(Event * event)
+  {
+    if (_stopServing)
+    {
+      event->type = EVENT_QUIT;
+      event->key = KEY_NONE;
+      event->ch = 0;
+      return true;
+    }
+
+    if (_events.empty())
+      return false;
+
+    *event = _events.front();
+    _lastEventClient = _eventClients.front();
+
+    _events.pop_front();
+    _eventClients.pop_front();
+    return true;
+  }
+
+  static bool waitServedEvent(Event * event, int timeout)
+  {
+    if (popEvent(event))
+      return true;
+
+    // Scrapes of the metrics are answered while waiting
+    std::vector<remote::Connection *> connections;
+    for (Client const& client : _clients)
+      connections.push_back(client.connection.get());
+
+    metrics::connections(connections);
+
+    if (!remote::wait({ &_listener, &metrics::listener() }, connections, timeout) && !_stopServing)
+      return false;
+
+    updateClients();
+    metrics::update();
+    return popEvent(event);
+  }
+
+  void waitEvent(Event * event)
+  {
+    if (_serving)
+    {
+      while (!waitServedEvent(event, -1))
+        ;
+
+      return;
+    }
+
+    struct tb_event tbEvent;
+
+    for (;;)
+    {
+      const int result = tb_poll_event(&tbEvent);
+
+      // The terminal is gone, there won't be any more events
+      if (result < 0)
+      {
+        event->type = EVENT_QUIT;
+        return;
+      }
+
+      if (translateEvent(result, tbEvent, event))
+        return;
+    }
+  }
+
+  bool waitEvent(Event * event, int timeout)
+  {
+    if (_serving)
+      return waitServedEvent(event, timeout);
+
     struct tb_event tbEvent;
-    int result = tb_peek_event(&tbEvent, timeout);
-    if (result)
+    return translateEvent(tb_peek_event(&tbEvent, timeout), tbEvent, event);
+  }
+
+  static void sendSize(remote::Connection & connection)
+  {
+    const SizeMessage size { (uint16_t)tb_width(), (uint16_t)tb_height() };
+    connection.send(MESSAGE_SIZE, &size, sizeof(size));
+  }
+
+  static void showFrame(std::vector<char> const& data)
+  {
+    FrameHeader header;
+    if (data.size() < sizeof(header))
+      return;
+
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.width == 0)
+      return;
+
+    if (header.full)
+    {
+      tb_set_clear_attributes(header.clearForeground, header.clearBackground);
+      tb_clear();
+    }
+
+    const char * it = data.data() + sizeof(header);
+    const char * end = data.data() + data.size();
+
+    uint32_t position = 0;
+    uint16_t fg = COLOR_DEFAULT;
+    uint16_t bg = COLOR_DEFAULT;
+
+    // A frame that doesn't decode shows what decoded of it
+    while (it < end)
+    {
+      const uint8_t op = *it++;
+      uint32_t count = 0;
+      uint32_t ch = 0;
+
+      if (op == OP_ATTRIBUTES)
+      {
+        if (end - it < (std::ptrdiff_t)(sizeof(fg) + sizeof(bg)))
+          break;
+
+        memcpy(&fg, it, sizeof(fg));
+        memcpy(&bg, it + sizeof(fg), sizeof(bg));
+        it += sizeof(fg) + sizeof(bg);
+        continue;
+      }
+
+      if (!getVarint(it, end, count))
+        break;
+
+      if (op == OP_SKIP)
+        position += count;
+      else if (op == OP_REPEAT)
+      {
+        if (!getVarint(it, end, ch))
+          break;
+
+        for (uint32_t i = 0; i < count; ++i, ++position)
+          tb_change_cell(position % header.width, position / header.width, ch, fg, bg);
+      }
+      else if (op == OP_TEXT)
+      {
+        for (uint32_t i = 0; i < count && getVarint(it, end, ch); ++i, ++position)
+          tb_change_cell(position % header.width, position / header.width, ch, fg, bg);
+      }
+      else
+        break;
+    }
+
+    tb_set_cursor(header.cursorX, header.cursorY);
+    tb_present();
+  }
+
+  int attach(const char * path)
+  {
+    remote::Connection connection;
+    if (!connection.connect(path))
+    {
+      fprintf(stderr, "zum: nothing serves '%s'\n", path);
+      return 1;
+    }
+
+    if (tb_init() != 0)
+    {
+      fprintf(stderr, "zum: could not initialize the terminal\n");
+      return 1;
+    }
+
+    sendSize(connection);
+
+    bool connected = true;
+    std::vector<char> data;
+    std::vector<KeyMessage> keys;
+
+    while (connected)
     {
-      event->type = 
+      // Every key that is waiting goes in one message
+      struct tb_event tbEvent;
+      int result = tb_peek_event(&tbEvent, ATTACH_POLL_INTERVAL);
+
+      for (; result > 0; result = tb_peek_event(&tbEvent, 0))
+      {
+        if (result == TB_EVENT_KEY)
+          keys.push_back(KeyMessage { tbEvent.key, tbEvent.ch });
+        else if (result == TB_EVENT_RESIZE)
+          sendSize(connection);
+      }
+
+      // The terminal is gone
+      if (result < 0)
+        break;
+
+      if (!keys.empty())
+      {
+        connection.send(MESSAGE_KEYS, keys.data(), keys.size() * sizeof(KeyMessage));
+        keys.clear();
+      }
+
+      connected = connection.flush() && connection.receive();
+
+      uint8_t type = 0;
+      while (connection.nextMessage(type, data))
+      {
+        if (type == MESSAGE_FRAME)
+          showFrame(data);
+      }
     }
 
-    return (bool)result;
+    tb_shutdown();
+    return 0;
+  }
+
+  // A terminal doesn't let programs read its clipboard, pasting into it types the text
+  std::string clipboard()
+  {
+    return std::string();
   }
 
-}
\ No newline at end of file
+  // Termbox keeps a front and a back buffer of the same size as ours, a served view has
+  // no terminal but queues the frames of its clients
+  std::size_t memoryUsage()
+  {
+    std::size_t bytes = (_cells.capacity() + _presentedCells.capacity()) * sizeof(Cell);
+
+    if (!_serving)
+      bytes += 2 * _width * _height * sizeof(struct tb_cell);
+
+    return bytes;
+  }
+}
@@ -0,0 +1,71 @@
+#include "Viewport.h"
+#include "DocumentState.h"
+#include "ConditionalFormat.h"
+
+namespace doc {
+
+  bool fetchViewport(Viewport & viewport)
+  {
+    Buffer & buffer = currentBuffer();
+    Document & doc = *buffer.doc_;
+
+    if (viewport.buffer_ == &buffer && viewport.document_ == &doc && viewport.version_ == displayVersion() &&
+        viewport.fetchedRows_ == viewport.rows_ && viewport.fetchedColumns_ == viewport.columns_ && viewport.fetchedCosts_ == viewport.costs_)
+      return false;
+
+    const std::size_t width = viewport.columns_.size();
+    viewport.cells_.assign(viewport.rows_.size() * width, ViewportCell());
+    viewport.arena_.clear();
+
+    const bool styles = hasCellStyles(doc);
+    std::string scratch;
+
+    for (std::size_t r = 0; r < viewport.rows_.size(); ++r)
+    {
+      const int row = viewport.rows_[r];
+      const int y = !buffer.view_ ? row : row >= 0 && row < (int)buffer.rows_.size() ? buffer.rows_[row] : -1;
+      if (y < 0)
+        continue;
+
+      for (std::size_t c = 0; c < width; ++c)
+      {
+        ViewportCell & out = viewport.cells_[r * width + c];
+        const Index index(viewport.columns_[c], y);
+        const bool inside = index.x >= 0 && index.x < doc.width_ && y < doc.height_;
+
+        StrView text;
+        if (doc.paged_)
+        {
+          scratch = pagedText(doc, index, inside ? &out.format_ : nullptr);
+          text = scratch;
+        }
+        else
+        {
+          Cell * cell = doc.cells_.find(index);
+          text = cellDisplayText(doc, index, cell, scratch, &out.stale_);
+
+          if (cell && inside)
+            out.format_ = cell->format;
+
+          if (styles)
+            out.style_ = cellStyle(doc, index, cell);
+        }
+
+        if (viewport.costs_)
+          out.cost_ = formulaCost(doc, index);
+
+        if (!text.empty())
+          out.text_ = StrView(viewport.arena_.copy(text.data(), text.size()), text.size());
+      }
+    }
+
+    // Formulas evaluated for the fetch changed nothing it didn't see
+    viewport.buffer_ = &buffer;
+    viewport.document_ = &doc;
+    viewport.version_ = displayVersion();
+    viewport.fetchedRows_ = viewport.rows_;
+    viewport.fetchedColumns_ = viewport.columns_;
+    viewport.fetchedCosts_ = viewport.costs_;
+    return true;
+  }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Str.h"
+#include "Arena.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// For drawing: the cells on screen fetched in one pass, instead of a lookup per cell for
+// each of their text, format, style and cost
+namespace doc {
+
+  // What getCellDisplayText(), getCellFormat(), getCellStyle() and getFormulaCost() give
+  // a cell, fetched together
+  struct ViewportCell
+  {
+    StrView text_;
+    uint32_t format_ = 0;
+    uint16_t style_ = 0;
+    bool stale_ = false;
+    double cost_ = 0.0;
+  };
+
+  // The cells of the rows and columns of the current buffer on screen, which the caller
+  // sets. A row out of the buffer has empty cells, the costs are left 0 without costs_.
+  // The texts are copies the viewport holds until the next fetch.
+  struct Viewport
+  {
+    std::vector<int> rows_;
+    std::vector<int> columns_;
+    bool costs_ = false;
+
+    ViewportCell const& cell(std::size_t row, std::size_t column) const { return cells_[row * columns_.size() + column]; }
+
+    std::vector<ViewportCell> cells_;
+    Arena arena_;
+
+    // What the cells were fetched for
+    std::vector<int> fetchedRows_;
+    std::vector<int> fetchedColumns_;
+    bool fetchedCosts_ = false;
+    const void * buffer_ = nullptr;
+    const void * document_ = nullptr;
+    uint64_t version_ = 0;
+  };
+
+  // Fills the cells of viewport in one pass, row by row, resolving the buffer once and
+  // looking each cell up once. Returns false, keeping the cells, when they were fetched
+  // for the same rows and columns of the same buffer, and neither a script, an edit, a
+  // load nor an evaluation ran since.
+  bool fetchViewport(Viewport & viewport);
+}
@@ -1,22 +1,69 @@
 
 #include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
 
 #include "termbox.h"
 #include "Document.h"
 #include "Editor.h"
 #include "Commands.h"
+#include "Scheduler.h"
+#include "Cache.h"
 #include "Tcl.h"
 #include "Log.h"
+#include "Profile.h"
+#include "Metrics.h"
+#include "Replay.h"
+#include "Idle.h"
+#include "Maintenance.h"
+#include "Batch.h"
+#include "StreamFilter.h"
+#include "Estimate.h"
 #include "View.h"
 
 static bool applicationRunning_ = true;
 static int timeout_ = 0;
 
+// With --serve clients attach to the view over a socket, quitting only detaches them.
+// --metrics answers scrapes of its metrics at a local port or a socket meanwhile.
+static std::string serveSocket_;
+static std::string metricsAddress_;
+
+// --record writes the events down, --replay plays them back instead of waiting for any
+static std::string recordFile_;
+static std::string replayFile_;
+
 static const tcl::Variable DEFAULT_WIDTH("app_defaultWidth", 120);
 static const tcl::Variable DEFAULT_HEIGHT("app_defaultHeight", 40);
 
-TCL_FUNC(quit, "", "Quit the application")
+// The main loop not waiting for events again within this many ms after taking one is
+// logged with what it was doing, 0 turns the watchdog off
+static const tcl::Variable WATCHDOG_THRESHOLD("app_watchdogThreshold", 500);
+
+static const int LOADING_POLL_INTERVAL = 10;
+
+// Followed documents look for appended lines at most every doc_followInterval ms
+static const int FOLLOW_POLL_INTERVAL = 100;
+
+// Most events handled before the interface is drawn again
+static const int MAX_EVENT_BATCH = 256;
+
+// While a script runs the interface looks for events this often, and gives up drawing
+// when the script's command doesn't return the document within the timeout
+static const int JOB_POLL_INTERVAL = 10;
+static const int JOB_LOCK_TIMEOUT = 5;
+
+// Shortest time between two frames while a script runs, it holds the document meanwhile
+static const int JOB_FRAME_INTERVAL = 50;
+
+TCL_FUNC(quit, "", "Quit the application, or detach from it when it is served")
 {
+  if (view::detachClient())
+    return JIM_OK;
+
   applicationRunning_ = false;
   return true;
 }
@@ -26,63 +73,335 @@ void clearTimeout()
   timeout_ = 0;
 }
 
+// Waits like view::waitEvent(), without a timeout when it is negative, for the watchdog
+// to time the main loop from an event to the next wait
+static bool waitEvent(view::Event & event, int timeout = -1)
+{
+  profile::watchdogWait(WATCHDOG_THRESHOLD.toInt());
+
+  bool received = true;
+  if (timeout < 0)
+    view::waitEvent(&event);
+  else
+    received = view::waitEvent(&event, timeout);
+
+  profile::watchdogWoke(doc::getColumnCount(), doc::getRowCount());
+  return received;
+}
+
+static void handleEvent(view::Event & event)
+{
+  replay::record(event);
+
+  switch (event.type)
+  {
+    case view::EVENT_KEY:
+      handleKeyEvent(&event);
+      break;
+
+    case view::EVENT_RESIZE:
+      break;
+
+    case view::EVENT_QUIT:
+      applicationRunning_ = false;
+      break;
+
+    default:
+      break;
+  }
+
+  executeEditCommands();
+  updateCursor();
+}
+
+// A script of the command line runs while the interface keeps drawing what it did so far.
+// Ctrl-C stops it and quitting waits for it to stop, other keys are ignored. The document
+// is released while events are waited for, the commands of the script run then.
+static void updateJob(view::Event & event)
+{
+  static bool started = false;
+  static bool noticeShown = false;
+  static std::chrono::steady_clock::time_point lastFrame;
+
+  // The notice only shows up if the script takes longer than a frame
+  if (!started)
+  {
+    lastFrame = std::chrono::steady_clock::now();
+    started = true;
+  }
+
+  tcl::unlockDocument();
+
+  bool ignored = false;
+  if (waitEvent(event, JOB_POLL_INTERVAL))
+  {
+    if (event.type == view::EVENT_QUIT)
+    {
+      tcl::cancelJob();
+      applicationRunning_ = false;
+    }
+    else if (event.type == view::EVENT_KEY && event.key == view::KEY_CTRL_C)
+      tcl::cancelJob();
+    else if (event.type == view::EVENT_KEY)
+      ignored = true;
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  const bool ended = tcl::jobEnded();
+  if (!ended && !ignored && now - lastFrame < std::chrono::milliseconds(JOB_FRAME_INTERVAL))
+    return;
+
+  // Once the script ended nothing holds the document anymore
+  if (!tcl::lockDocument(ended ? JOB_POLL_INTERVAL : JOB_LOCK_TIMEOUT))
+    return;
+
+  if (ended)
+  {
+    finishAppCommands();
+    updateCursor();
+    started = false;
+    noticeShown = false;
+  }
+  else if (!noticeShown || ignored)
+  {
+    // After that the message lines are left to what the script puts there
+    flashMessage("Running script, Ctrl-C stops it");
+    noticeShown = true;
+  }
+
+  drawInterface();
+  lastFrame = now;
+}
+
 int main(int argc, char * argv[])
 {
+  // --startup-profile can come before anything else, it prints where startup went
+  if (argc > 1 && std::string(argv[1]) == "--startup-profile")
+  {
+    profile::enableStartupProfile();
+    argv[1] = argv[0];
+    --argc;
+    ++argv;
+  }
+
+  if (argc > 1 && std::string(argv[1]) == "--batch")
+  {
+    if (argc < 3)
+    {
+      fprintf(stderr, "usage: zum ?--startup-profile? --batch script.tcl ?document ...?\n");
+      return 1;
+    }
+
+    return batch::run(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+  }
+
+  // Filters a CSV file into another one a chunk at a time, without loading it
+  if (argc > 1 && std::string(argv[1]) == "--filter")
+  {
+    if (argc < 7)
+    {
+      fprintf(stderr, "usage: zum --filter input.csv output.csv ?-noHeader? column operation value ?column operation value ...?\n");
+      return 1;
+    }
+
+    tcl::initialize();
+    std::size_t rows = 0;
+    const bool ok = doc::filterFile(argv[2], argv[3], std::vector<std::string>(argv + 4, argv + argc), rows);
+    tcl::shutdown();
+    return ok ? 0 : 1;
+  }
+
+  // A thin client, the server it attaches to has the documents
+  if (argc > 1 && std::string(argv[1]) == "--attach")
+  {
+    if (argc != 3)
+    {
+      fprintf(stderr, "usage: zum --attach socket\n");
+      return 1;
+    }
+
+    return view::attach(argv[2]);
+  }
+
+  if (argc > 1 && std::string(argv[1]) == "--serve")
+  {
+    if (argc < 3)
+    {
+      fprintf(stderr, "usage: zum ?--startup-profile? --serve socket ?--metrics port|socket? ?document ...?\n");
+      return 1;
+    }
+
+    serveSocket_ = argv[2];
+    argv[2] = argv[0];
+    argc -= 2;
+    argv += 2;
+
+    if (argc > 2 && std::string(argv[1]) == "--metrics")
+    {
+      metricsAddress_ = argv[2];
+      argv[2] = argv[0];
+      argc -= 2;
+      argv += 2;
+    }
+  }
+
+  while (argc > 2 && (std::string(argv[1]) == "--record" || std::string(argv[1]) == "--replay"))
+  {
+    (std::string(argv[1]) == "--record" ? recordFile_ : replayFile_) = argv[2];
+    argv[2] = argv[0];
+    argc -= 2;
+    argv += 2;
+  }
+
   clearLog();
 
   logInfo("Initializing Tcl...");
   tcl::initialize();
+  cache::initialize();
 
   logInfo("Initializing view...");
-  if (!view::init(DEFAULT_WIDTH.toInt(), DEFAULT_HEIGHT.toInt(), "Zum"))
+  if (!serveSocket_.empty())
+  {
+    if (!view::serve(serveSocket_.c_str(), DEFAULT_WIDTH.toInt(), DEFAULT_HEIGHT.toInt()))
+    {
+      fprintf(stderr, "zum: could not serve at '%s'\n", serveSocket_.c_str());
+      return 1;
+    }
+
+    if (!metricsAddress_.empty() && !metrics::listen(metricsAddress_))
+    {
+      fprintf(stderr, "zum: could not answer metrics at '%s'\n", metricsAddress_.c_str());
+      view::shutdown();
+      return 1;
+    }
+  }
+  else if (!view::init(DEFAULT_WIDTH.toInt(), DEFAULT_HEIGHT.toInt(), "Zum"))
   {
     logError("Faild to initialize the view");
     return 1;
   }
 
+  profile::markStartup("view");
+
   if (argc > 1)
-  {
-    for (int i = 1; i < argc; ++i)
-      doc::load(argv[i]);
-  }
+    doc::load(std::vector<std::string>(argv + 1, argv + argc));
 
   if (doc::getOpenBufferCount() == 0)
     doc::createDefaultEmpty();
 
+  profile::markStartup("documents");
+
   updateCursor();
   drawInterface();
 
+  profile::markStartup("first frame");
+  profile::printStartupProfile();
+
+  if (!replayFile_.empty())
+  {
+    std::vector<view::Event> events;
+    const bool loaded = replay::load(replayFile_, events);
+
+    replay::Latencies latencies;
+    if (loaded)
+      replay::play(events, latencies, [] () { return applicationRunning_; });
+
+    doc::shutdown();
+    tcl::shutdown();
+    view::shutdown();
+
+    if (loaded)
+      latencies.print();
+
+    return loaded ? 0 : 1;
+  }
+
+  if (!recordFile_.empty())
+    replay::startRecording(recordFile_);
+
   view::Event event;
 
   logInfo("Application running...");
 
-  while (applicationRunning_)
+  while (applicationRunning_ || tcl::jobRunning())
   {
-    view::waitEvent(&event);
+    if (tcl::jobRunning())
+    {
+      updateJob(event);
+      continue;
+    }
+
+    // Tasks on the scheduler hand what they finished over to the main thread here
+    if (Scheduler::shared().runCompletions())
+    {
+      updateCursor();
+      drawInterface();
+    }
 
-    switch (event.type)
+    // Caches over the budget, or while memory is short, give memory back between events
+    cache::balance();
+
+    // Merge rows of a background load or of followed files, evaluate whatever lazy
+    // evaluation left over, refine an estimate, run the idle tasks and look for finished
+    // tasks while the user isn't doing anything
+    const bool polling = doc::isLoading() || Scheduler::shared().busy();
+    const bool following = doc::isFollowing();
+    const bool estimating = doc::isEstimating();
+    const int idleWait = idle::wait();
+    if (polling || following || estimating || doc::hasPendingEvaluation() || idleWait >= 0)
     {
-      case view::EVENT_KEY:
-        handleKeyEvent(&event);
-        break;
+      int timeout = estimating ? 0 : polling ? LOADING_POLL_INTERVAL : doc::hasPendingEvaluation() ? 0 : FOLLOW_POLL_INTERVAL;
+      if (idleWait >= 0)
+        timeout = std::min(timeout, idleWait);
+
+      if (!waitEvent(event, timeout))
+      {
+        const bool loaded = doc::updateLoading();
+        if (doc::updateFollowing() || loaded)
+        {
+          updateCursor();
+          drawInterface();
+        }
 
-      case view::EVENT_RESIZE:
-        break;
+        if (doc::hasPendingEvaluation() && doc::evaluateIdle())
+        {
+          updateCursor();
+          drawInterface();
+        }
 
-      case view::EVENT_QUIT:
-        applicationRunning_ = false;
-        break;
+        if (doc::updateEstimate())
+          drawInterface();
 
-      default:
-        break;
+        // Lazy evaluation goes first, it is what is on screen
+        if (!doc::hasPendingEvaluation() && idle::wait() == 0 && idle::step())
+        {
+          updateCursor();
+          drawInterface();
+        }
+
+        continue;
+      }
     }
+    else
+      waitEvent(event);
 
-    // Only update cursor and redraw interface when we have recievied an event
-    executeEditCommands();
-    updateCursor();
+    // Every event that is already waiting is handled before drawing, so holding a key
+    // down costs one redraw per batch of repeats instead of one per repeat
+    int handled = 0;
+    do
+    {
+      handleEvent(event);
+    } while (applicationRunning_ && !tcl::jobRunning() && ++handled < MAX_EVENT_BATCH && waitEvent(event, 0));
+
+    idle::interrupt();
+    doc::scheduleMaintenance();
     drawInterface();
   }
 
+  replay::stopRecording();
+  profile::stopWatchdog();
+  doc::shutdown();
+
   tcl::shutdown();
   view::shutdown();
 
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+
+// Interface of a formula function plugin, a shared library loaded with the plugin command.
+// The library exports zum_plugin_init(), which registers its functions through the
+// callback it is given. A formula calls the scalar entry point of a function once per
+// cell, a column formula calls the batch entry point with a block of rows at once. Both
+// are called from several threads at the same time during a recalculation, and have to
+// give the same result for the same arguments.
+//
+// Plain C, so a plugin can be built with any compiler.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ZUM_PLUGIN_VERSION 1
+#define ZUM_PLUGIN_INIT_SYMBOL "zum_plugin_init"
+
+// Computes a call from its argCount arguments
+typedef double (*ZumScalarFunction)(const double * args);
+
+// Computes count calls at once. args[i][row] is argument i of call row, its result goes
+// to out[row]. out doesn't overlap the arguments.
+typedef void (*ZumBatchFunction)(const double * const * args, size_t count, double * out);
+
+typedef struct ZumFunction
+{
+  // Upper case letters and underscores, like PRICE_CURVE
+  const char * name;
+  int argCount;
+
+  ZumScalarFunction scalar;
+
+  // May be NULL, the scalar entry point is then called for every row
+  ZumBatchFunction batch;
+} ZumFunction;
+
+// Returns 0 if the function can't be registered, the reason is logged
+typedef int (*ZumRegisterFunction)(void * context, const ZumFunction * function);
+
+// Returns 0 if the plugin can't be used, version is the ZUM_PLUGIN_VERSION of the host
+typedef int (*ZumPluginInit)(int version, ZumRegisterFunction registerFunction, void * context);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,40 @@
+# Runs zum_batch on a script and checks its exit code and what it writes, for add_test():
+#
+#   cmake -DZUM_BATCH=path -DSCRIPT=file.tcl [-DDOCUMENTS=list] -DEXIT_CODE=code
+#         [-DEXPECT=list of regular expressions] -DHOME=directory [-DCONFIG=file]
+#         -P RunBatch.cmake
+#
+# zum_batch runs in HOME with a copy of the data directory next to the script, so the
+# documents it is given and the files it writes are relative to HOME and the source
+# tree is left alone. Each expression has to match what zum_batch wrote to stdout and
+# stderr. HOME is made the home of zum_batch, with CONFIG as its .zum.conf, so the
+# config and log of the user are left alone too.
+
+get_filename_component(DIRECTORY "${SCRIPT}" DIRECTORY)
+
+file(REMOVE_RECURSE "${HOME}")
+file(MAKE_DIRECTORY "${HOME}")
+if(CONFIG)
+  configure_file("${CONFIG}" "${HOME}/.zum.conf" COPYONLY)
+endif()
+if(EXISTS "${DIRECTORY}/data")
+  file(COPY "${DIRECTORY}/data" DESTINATION "${HOME}")
+endif()
+
+set(ENV{HOME} "${HOME}")
+
+execute_process(COMMAND "${ZUM_BATCH}" "${SCRIPT}" ${DOCUMENTS}
+                WORKING_DIRECTORY "${HOME}"
+                RESULT_VARIABLE result
+                OUTPUT_VARIABLE output
+                ERROR_VARIABLE output)
+
+if(NOT "${result}" STREQUAL "${EXIT_CODE}")
+  message(FATAL_ERROR "zum_batch exited with ${result} instead of ${EXIT_CODE}:\n${output}")
+endif()
+
+foreach(expression IN LISTS EXPECT)
+  if(NOT output MATCHES "${expression}")
+    message(FATAL_ERROR "zum_batch didn't write '${expression}':\n${output}")
+  endif()
+endforeach()
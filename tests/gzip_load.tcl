@@ -0,0 +1,4 @@
+# Batch mode loads documents whole, a compressed one as well
+load data/table.csv.gz
+puts "rows [rowCount]"
+puts "last [cell A251] [cellValue B251]"
@@ -0,0 +1,4 @@
+# The formulas of the document fail to parse, more than the log writes in a second.
+# What the script prints and the error it ends with must still be written.
+puts "rows [rowCount]"
+noSuchCommand
@@ -0,0 +1,6 @@
+# Quoted fields hold line breaks, delimiters and doubled quotes, a paged document has
+# the same rows and fields as a loaded one
+puts "rows [rowCount]"
+puts "page [cell A1026] [cell B1026]"
+puts "last [cell A3001] [cell C3001]"
+puts "note [cell B2]"
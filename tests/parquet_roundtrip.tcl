@@ -0,0 +1,20 @@
+# A document exported to Parquet opens paged with its header and values, and a filter
+# on it reads the numbers of its column chunk
+newDocument
+cell A1 name
+cell B1 amount
+cell C1 price
+for {set row 2} {$row <= 30001} {incr row} {
+  cell A$row item$row
+  cell B$row $row
+  cell C$row [expr {$row / 4.0}]
+}
+export table.parquet
+closeBuffer
+
+load table.parquet
+puts "loaded rows [rowCount] [cell A1] [cell B1] [cell C1]"
+puts "values [cell A2] [cellValue B30001] [cellValue C3]"
+
+filter B -gt 29990
+puts "filtered [rowCount] [cell B2] [cell A12]"
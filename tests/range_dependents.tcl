@@ -0,0 +1,12 @@
+# Formulas over ranges are updated when a cell they cover changes: a range in one
+# bucket of rows, one across buckets and one too wide to be indexed by bucket
+newDocument
+for {set row 1} {$row <= 3000} {incr row} {
+  cell A$row 1
+}
+cell B1 "=SUM(A1025:A1030)"
+cell B2 "=SUM(A1:A3000)"
+cell B3 "=SUM(A1:A5000000)"
+cell A1026 10
+cell A2500 100
+puts "sums [cellValue B1] [cellValue B2] [cellValue B3]"
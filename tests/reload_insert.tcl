@@ -0,0 +1,31 @@
+# Reloading a CSV file with a row inserted into it moves the cells and formulas added to
+# the document, and the edits of its cells, down with the rows they are in
+proc writeTable {inserted} {
+  newDocument
+  set row 1
+  for {set i 1} {$i <= 2000} {incr i} {
+    if {$i == 4 && $inserted} {
+      cell A$row new
+      cell B$row 0
+      incr row
+    }
+    cell A$row item$i
+    cell B$row $i
+    incr row
+  }
+  export reload.csv
+  closeBuffer
+}
+
+writeTable 0
+load reload.csv
+cell C5 "=B5 * 2"
+cell D7 note
+cell B1500 edited
+
+# Closing the buffer it was written from leaves the loaded one current
+writeTable 1
+puts "current [filename]"
+puts "reloaded [reload]"
+puts "after rows [rowCount] [cell A4] [cell A6]"
+puts "added [cell C6] [cellValue C6] [cell D8] [cell B1501]"
@@ -0,0 +1,29 @@
+# Saving a ZUM2 file again after edits appends the blocks they are in, and the file then
+# opens with every edit. So does one saved again after it was opened.
+set doc_saveFormat zum2
+
+newDocument
+for {set row 1} {$row <= 20000} {incr row} {
+  cell A$row item$row
+  cell B$row $row
+}
+save append.zum2
+
+cell B10 first
+cell A15000 "=B15000 * 2"
+save append.zum2
+
+cell B19999 second
+cell C1 "=SUM(B1:B20000)"
+save append.zum2
+closeBuffer
+
+load append.zum2
+puts "reopened rows [rowCount] [cell B10] [cell A15000] [cellValue A15000] [cell B19999] [cellValue C1]"
+
+cell B20 third
+save append.zum2
+closeBuffer
+
+load append.zum2
+puts "saved again [cell B10] [cell B20] [cell B19999] [cell A20000]"
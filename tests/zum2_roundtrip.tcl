@@ -0,0 +1,24 @@
+# A document saved as ZUM2, with column blocks compressed by LZ4 and without, loads back
+# with its texts, numbers and formulas
+set doc_saveFormat zum2
+
+foreach codec {lz4 none} {
+  newDocument
+  for {set row 1} {$row <= 5000} {incr row} {
+    cell A$row item$row
+    cell B$row [expr {$row * 3}]
+  }
+  cell C1 "=SUM(B1:B5000)"
+  cell C2 "=B2 * 2"
+  cell D4000 "text, with \"quotes\""
+
+  set doc_saveCompression $codec
+  save roundtrip_$codec.zum2
+  closeBuffer
+
+  load roundtrip_$codec.zum2
+  puts "$codec rows [rowCount] [cell A1] [cell A5000] [cellValue B4999]"
+  puts "$codec formulas [cell C1] [cellValue C1] [cell C2] [cellValue C2]"
+  puts "$codec text [cell D4000]"
+  closeBuffer
+}